@@ -71,6 +71,28 @@ namespace ScreenRecorderLib {
 			SnapshotPath = path;
 		}
 	};
+	public ref class SegmentCompleteEventArgs :System::EventArgs {
+	public:
+		/// <summary>
+		/// The path of the completed segment file.
+		/// </summary>
+		property String^ FilePath;
+		/// <summary>
+		/// The number of the segment, starting at 0.
+		/// </summary>
+		property int Index;
+		/// <summary>
+		/// Where the segment starts and ends in the recording. A segment ends where the next one starts.
+		/// </summary>
+		property TimeSpan StartTime;
+		property TimeSpan EndTime;
+		SegmentCompleteEventArgs(String^ path, int index, TimeSpan startTime, TimeSpan endTime) {
+			FilePath = path;
+			Index = index;
+			StartTime = startTime;
+			EndTime = endTime;
+		}
+	};
 	public ref class FrameRecordedEventArgs :System::EventArgs {
 	public:
 		property int FrameNumber;
@@ -18,7 +18,7 @@ namespace ScreenRecorderLib {
 	};
 	public enum class MouseDetectionMode {
 		///<summary>
-		///Use polling for detecting mouse clicks. Does not affect mouse performance, but may not work for all mouse clicks generated programmatically.
+		///Use raw mouse input for detecting mouse clicks. Does not affect mouse performance, but may not work for all mouse clicks generated programmatically.
 		///</summary>
 		Polling = MOUSE_OPTIONS::MOUSE_DETECTION_MODE_POLLING,
 		///<summary>
@@ -56,6 +56,22 @@ namespace ScreenRecorderLib {
 		Screenshot = (int)RecorderModeInternal::Screenshot
 	};
 
+	public enum class AudioResampler {
+		///<summary>The Media Foundation audio resampler.</summary>
+		MediaFoundation = (int)AudioResamplerType::MediaFoundation,
+		///<summary>The built-in polyphase resampler. Converts the captured audio in place, without the copies and allocations of the Media Foundation resampler.</summary>
+		Polyphase = (int)AudioResamplerType::Polyphase
+	};
+
+	public enum class FrameDropPolicy {
+		///<summary>Wait for the encoder to catch up before capturing the next frame.</summary>
+		Block = (int)PipelineDropPolicy::Block,
+		///<summary>Drop the oldest queued frame, so the most recent screen content is recorded. The duration of the dropped frame is added to the next one.</summary>
+		DropOldest = (int)PipelineDropPolicy::DropOldest,
+		///<summary>Drop the newly captured frame, and extend the duration of the last queued frame instead.</summary>
+		DropNewest = (int)PipelineDropPolicy::DropNewest
+	};
+
 	public ref class SourceOptions : public INotifyPropertyChanged {
 	private:
 		List<RecordingSourceBase^>^ _recordingSources;
@@ -166,11 +182,21 @@ namespace ScreenRecorderLib {
 		StretchMode _stretch;
 		ScreenSize^ _outputFrameSize;
 		RecorderMode _recorderMode;
+		int _segmentDurationMillis;
+		Int64 _segmentMaxBytes;
+		int _replayBufferDurationMillis;
+		Int64 _replayBufferMaxBytes;
+		Int64 _gifFrameCacheMaxBytes;
 	public:
 		OutputOptions() :DynamicOutputOptions() {
 			Stretch = StretchMode::Uniform;
 			OutputFrameSize = ScreenSize::Empty;
 			RecorderMode = ScreenRecorderLib::RecorderMode::Video;
+			SegmentDurationMillis = 0;
+			SegmentMaxBytes = 0;
+			ReplayBufferDurationMillis = 0;
+			ReplayBufferMaxBytes = 0;
+			GifFrameCacheMaxBytes = 0;
 		}
 
 		/// <summary>
@@ -207,6 +233,70 @@ namespace ScreenRecorderLib {
 				OnPropertyChanged("RecorderMode");
 			}
 		}
+		/// <summary>
+		/// Splits a video recording into files of about this duration. The first file is written to the output path, and later ones get a number appended, e.g. video_002.mp4.
+		/// A new file starts on the first new frame after the duration has passed. 0 to disable. Not supported when recording to a stream. Default is 0.
+		/// </summary>
+		property int SegmentDurationMillis {
+			int get() {
+				return _segmentDurationMillis;
+			}
+			void set(int value) {
+				_segmentDurationMillis = value;
+				OnPropertyChanged("SegmentDurationMillis");
+			}
+		}
+		/// <summary>
+		/// Splits a video recording into files of about this size in bytes, in the same way as SegmentDurationMillis. 0 to disable. Default is 0.
+		/// </summary>
+		property Int64 SegmentMaxBytes {
+			Int64 get() {
+				return _segmentMaxBytes;
+			}
+			void set(Int64 value) {
+				_segmentMaxBytes = value;
+				OnPropertyChanged("SegmentMaxBytes");
+			}
+		}
+		/// <summary>
+		/// Keeps at least this much of a video recording in memory, so it can be saved to another file or stream with Recorder.SaveReplay. The whole recording is still written to the output.
+		/// The buffer starts at a keyframe, so it may hold a few seconds more. 0 to disable. Default is 0.
+		/// </summary>
+		property int ReplayBufferDurationMillis {
+			int get() {
+				return _replayBufferDurationMillis;
+			}
+			void set(int value) {
+				_replayBufferDurationMillis = value;
+				OnPropertyChanged("ReplayBufferDurationMillis");
+			}
+		}
+		/// <summary>
+		/// The most bytes of encoded video and audio the replay buffer keeps in memory. 0 for no limit. Default is 0.
+		/// </summary>
+		property Int64 ReplayBufferMaxBytes {
+			Int64 get() {
+				return _replayBufferMaxBytes;
+			}
+			void set(Int64 value) {
+				_replayBufferMaxBytes = value;
+				OnPropertyChanged("ReplayBufferMaxBytes");
+			}
+		}
+		/// <summary>
+		/// The most bytes the decoded frames of animated GIF sources and overlays may hold in memory. Each GIF is then decoded once instead of on every loop,
+		/// and the frames are shared between all sources and overlays showing the same file. GIFs that do not fit are decoded as they are shown.
+		/// 0 to decode all GIFs as they are shown. Default is 0.
+		/// </summary>
+		property Int64 GifFrameCacheMaxBytes {
+			Int64 get() {
+				return _gifFrameCacheMaxBytes;
+			}
+			void set(Int64 value) {
+				_gifFrameCacheMaxBytes = value;
+				OnPropertyChanged("GifFrameCacheMaxBytes");
+			}
+		}
 	};
 
 	public ref class VideoEncoderOptions : public INotifyPropertyChanged {
@@ -220,6 +310,9 @@ namespace ScreenRecorderLib {
 		bool _isHardwareEncodingEnabled;
 		bool _isMp4FastStartEnabled;
 		bool _isFragmentedMp4Enabled;
+		int _framePoolSize;
+		int _frameQueueSize;
+		ScreenRecorderLib::FrameDropPolicy _frameDropPolicy;
 		IVideoEncoder^ _encoder = gcnew H264VideoEncoder();
 	public:
 		VideoEncoderOptions() {
@@ -232,6 +325,9 @@ namespace ScreenRecorderLib {
 			IsHardwareEncodingEnabled = true;
 			IsMp4FastStartEnabled = true;
 			IsFragmentedMp4Enabled = false;
+			FramePoolSize = 4;
+			FrameQueueSize = 3;
+			FrameDropPolicy = ScreenRecorderLib::FrameDropPolicy::DropOldest;
 			Encoder = gcnew H264VideoEncoder();
 		}
 		virtual event PropertyChangedEventHandler^ PropertyChanged;
@@ -348,6 +444,42 @@ namespace ScreenRecorderLib {
 			}
 		}
 		/// <summary>
+		/// The number of idle frame textures kept for reuse by the encoder input. Higher values avoid reallocating video memory when the encoder falls behind, at the cost of GPU memory. Default is 4.
+		/// </summary>
+		property int FramePoolSize {
+			int get() {
+				return _framePoolSize;
+			}
+			void set(int value) {
+				_framePoolSize = value;
+				OnPropertyChanged("FramePoolSize");
+			}
+		}
+		/// <summary>
+		/// The number of frames that can be queued between the capture, processing and encoding of frames. This absorbs short stalls in the encoder without delaying capture. Default is 3.
+		/// </summary>
+		property int FrameQueueSize {
+			int get() {
+				return _frameQueueSize;
+			}
+			void set(int value) {
+				_frameQueueSize = value;
+				OnPropertyChanged("FrameQueueSize");
+			}
+		}
+		/// <summary>
+		/// What to do with captured frames when the frame queue is full because processing or encoding falls behind. Only used in Video mode. Default is DropOldest.
+		/// </summary>
+		property ScreenRecorderLib::FrameDropPolicy FrameDropPolicy {
+			ScreenRecorderLib::FrameDropPolicy get() {
+				return _frameDropPolicy;
+			}
+			void set(ScreenRecorderLib::FrameDropPolicy value) {
+				_frameDropPolicy = value;
+				OnPropertyChanged("FrameDropPolicy");
+			}
+		}
+		/// <summary>
 		/// Set the video encoder to use. Current supported encoders are H264VideoEncoder and H265VideoEncoder.
 		/// </summary>
 		property IVideoEncoder^ Encoder {
@@ -367,11 +499,13 @@ namespace ScreenRecorderLib {
 		bool _snapshotsWithVideo;
 		int _snapshotsIntervalMillis;
 		String^ _snapshotsDirectory;
+		bool _isBuiltInEncoderEnabled;
 	public:
 		SnapshotOptions() {
 			SnapshotFormat = ImageFormat::PNG;
 			SnapshotsWithVideo = false;
 			SnapshotsIntervalMillis = 10000;
+			IsBuiltInEncoderEnabled = false;
 		}
 		virtual event PropertyChangedEventHandler^ PropertyChanged;
 		void OnPropertyChanged(String^ info)
@@ -426,6 +560,19 @@ namespace ScreenRecorderLib {
 				OnPropertyChanged("SnapshotsDirectory");
 			}
 		}
+		/// <summary>
+		///Encode PNG and JPEG snapshots taken during a recording with the built-in encoders, which split each image between several threads, instead of Windows Imaging Component.
+		///Snapshots are encoded off the recording thread either way. Defaults to false.
+		/// </summary>
+		property bool IsBuiltInEncoderEnabled {
+			bool get() {
+				return _isBuiltInEncoderEnabled;
+			}
+			void set(bool value) {
+				_isBuiltInEncoderEnabled = value;
+				OnPropertyChanged("IsBuiltInEncoderEnabled");
+			}
+		}
 	};
 
 	public ref class DynamicAudioOptions : public INotifyPropertyChanged {
@@ -505,6 +652,7 @@ namespace ScreenRecorderLib {
 		Nullable<AudioChannels> _channels;
 		String^ _audioInputDevice;
 		String^ _audioOutputDevice;
+		Nullable<ScreenRecorderLib::AudioResampler> _resampler;
 
 	public:
 		AudioOptions() :DynamicAudioOptions() {
@@ -515,6 +663,7 @@ namespace ScreenRecorderLib {
 			IsInputDeviceEnabled = false;
 			InputVolume = 1.0f;
 			OutputVolume = 1.0f;
+			Resampler = ScreenRecorderLib::AudioResampler::MediaFoundation;
 		}
 		/// <summary>
 		/// Enable or disable the writing of an audio track for the recording.
@@ -570,6 +719,18 @@ namespace ScreenRecorderLib {
 				OnPropertyChanged("AudioInputDevice");
 			}
 		}
+		/// <summary>
+		/// The resampler used to convert captured audio to the sample rate and channel count of the recording, when the audio devices use a different format. Default is MediaFoundation.
+		/// </summary>
+		property Nullable<ScreenRecorderLib::AudioResampler> Resampler {
+			Nullable<ScreenRecorderLib::AudioResampler> get() {
+				return _resampler;
+			}
+			void set(Nullable<ScreenRecorderLib::AudioResampler> value) {
+				_resampler = value;
+				OnPropertyChanged("Resampler");
+			}
+		}
 
 
 	};
@@ -653,7 +814,7 @@ namespace ScreenRecorderLib {
 			}
 		}
 		/// <summary>
-		/// The duration of the dot shown where the mouse button is pressed, in milliseconds. Default is 150.
+		/// How long the dot shown where the mouse button is pressed stays after the button is released, in milliseconds. Default is 150.
 		/// </summary>
 		property Nullable<int> MouseClickDetectionDuration {
 			Nullable<int> get() {
@@ -775,6 +936,30 @@ namespace ScreenRecorderLib {
 		}
 	};
 
+	/// <summary>
+	/// An output recording the same video and audio as the main output, with its own encoder settings and frame size, e.g. a low bitrate copy next to a full resolution recording.
+	/// </summary>
+	public ref class AdditionalOutput {
+	public:
+		AdditionalOutput() {
+			VideoEncoderOptions = gcnew ScreenRecorderLib::VideoEncoderOptions();
+			OutputOptions = gcnew ScreenRecorderLib::OutputOptions();
+		}
+		/// <summary>
+		/// The path of the output file.
+		/// </summary>
+		property String^ FilePath;
+		/// <summary>
+		/// The encoder settings of the output. The framerate of the main output is used, as the frames are shared with it.
+		/// </summary>
+		property VideoEncoderOptions^ VideoEncoderOptions;
+		/// <summary>
+		/// The frame size and stretch mode of the output. If no frame size is set, the frame size of the main output is used. Other settings are ignored.
+		/// The frames are resized from the frames of the main output, so a frame size larger than that of the main output gives no more detail, only a scaled up image.
+		/// </summary>
+		property OutputOptions^ OutputOptions;
+	};
+
 	public ref class RecorderOptions {
 	public:
 		static property RecorderOptions^ Default {
@@ -810,6 +995,10 @@ namespace ScreenRecorderLib {
 		property OverLayOptions^ OverlayOptions;
 		property SnapshotOptions^ SnapshotOptions;
 		property LogOptions^ LogOptions;
+		/// <summary>
+		/// Outputs recorded at the same time as the main output, sharing its capture, mouse pointer and audio. Only used when recording video.
+		/// </summary>
+		property List<AdditionalOutput^>^ AdditionalOutputs;
 	};
 
 
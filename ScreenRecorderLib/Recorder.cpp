@@ -21,40 +21,14 @@ Recorder::Recorder(RecorderOptions^ options)
 void Recorder::SetOptions(RecorderOptions^ options) {
 	if (options && m_Rec && !m_Rec->IsRecording()) {
 		if (options->VideoEncoderOptions) {
-			if (!options->VideoEncoderOptions->Encoder) {
-				options->VideoEncoderOptions->Encoder = gcnew H264VideoEncoder();
-			}
-			ENCODER_OPTIONS* encoderOptions = nullptr;
-
-			switch (options->VideoEncoderOptions->Encoder->EncodingFormat)
-			{
-				default:
-				case VideoEncoderFormat::H264: {
-					encoderOptions = new H264_ENCODER_OPTIONS();
-					break;
-				}
-				case VideoEncoderFormat::H265: {
-					encoderOptions = new H265_ENCODER_OPTIONS();
-					break;
-				}
-			}
-			encoderOptions->SetVideoBitrateMode((UINT32)options->VideoEncoderOptions->Encoder->GetBitrateMode());
-			encoderOptions->SetEncoderProfile((UINT32)options->VideoEncoderOptions->Encoder->GetEncoderProfile());
-			encoderOptions->SetVideoBitrate(options->VideoEncoderOptions->Bitrate);
-			encoderOptions->SetVideoQuality(options->VideoEncoderOptions->Quality);
-			encoderOptions->SetVideoFps(options->VideoEncoderOptions->Framerate);
-			encoderOptions->SetFixedFramerate(options->VideoEncoderOptions->IsFixedFramerate);
-			encoderOptions->SetThrottlingDisabled(options->VideoEncoderOptions->IsThrottlingDisabled);
-			encoderOptions->SetLowLatencyModeEnabled(options->VideoEncoderOptions->IsLowLatencyEnabled);
-			encoderOptions->SetFastStartEnabled(options->VideoEncoderOptions->IsMp4FastStartEnabled);
-			encoderOptions->SetHardwareEncodingEnabled(options->VideoEncoderOptions->IsHardwareEncodingEnabled);
-			encoderOptions->SetFragmentedMp4Enabled(options->VideoEncoderOptions->IsFragmentedMp4Enabled);
+			ENCODER_OPTIONS* encoderOptions = CreateEncoderOptions(options->VideoEncoderOptions);
 			m_Rec->SetEncoderOptions(encoderOptions);
 		}
 		if (options->SnapshotOptions) {
 			SNAPSHOT_OPTIONS* snapshotOptions = new SNAPSHOT_OPTIONS();
 			snapshotOptions->SetTakeSnapshotsWithVideo(options->SnapshotOptions->SnapshotsWithVideo);
 			snapshotOptions->SetSnapshotsWithVideoInterval(options->SnapshotOptions->SnapshotsIntervalMillis);
+			snapshotOptions->SetIsBuiltInEncoderEnabled(options->SnapshotOptions->IsBuiltInEncoderEnabled);
 			if (options->SnapshotOptions->SnapshotsDirectory != nullptr) {
 				snapshotOptions->SetSnapshotDirectory(msclr::interop::marshal_as<std::wstring>(options->SnapshotOptions->SnapshotsDirectory));
 			}
@@ -89,6 +63,11 @@ void Recorder::SetOptions(RecorderOptions^ options) {
 			}
 			outputOptions->SetRecorderMode(static_cast<RecorderModeInternal>(options->OutputOptions->RecorderMode));
 			outputOptions->SetStretch(static_cast<TextureStretchMode>(options->OutputOptions->Stretch));
+			outputOptions->SetSegmentDuration(std::chrono::milliseconds((std::max)(options->OutputOptions->SegmentDurationMillis, 0)));
+			outputOptions->SetSegmentMaxBytes(static_cast<UINT64>((std::max)(options->OutputOptions->SegmentMaxBytes, 0LL)));
+			outputOptions->SetReplayBufferDuration(std::chrono::milliseconds((std::max)(options->OutputOptions->ReplayBufferDurationMillis, 0)));
+			outputOptions->SetReplayBufferMaxBytes(static_cast<UINT64>((std::max)(options->OutputOptions->ReplayBufferMaxBytes, 0LL)));
+			outputOptions->SetGifFrameCacheMaxBytes(static_cast<UINT64>((std::max)(options->OutputOptions->GifFrameCacheMaxBytes, 0LL)));
 			if (options->OutputOptions->IsVideoFramePreviewEnabled.HasValue) {
 				outputOptions->SetVideoFramePreviewEnabled(options->OutputOptions->IsVideoFramePreviewEnabled.Value);
 			}
@@ -97,6 +76,32 @@ void Recorder::SetOptions(RecorderOptions^ options) {
 			}
 			m_Rec->SetOutputOptions(outputOptions);
 		}
+		if (options->AdditionalOutputs) {
+			std::vector<RECORDING_OUTPUT> outputs;
+			for each (AdditionalOutput ^ managedOutput in options->AdditionalOutputs)
+			{
+				if (!managedOutput || String::IsNullOrEmpty(managedOutput->FilePath)) {
+					continue;
+				}
+				RECORDING_OUTPUT output{};
+				output.Path = msclr::interop::marshal_as<std::wstring>(managedOutput->FilePath);
+				if (managedOutput->VideoEncoderOptions) {
+					output.EncoderOptions.reset(CreateEncoderOptions(managedOutput->VideoEncoderOptions));
+				}
+				if (managedOutput->OutputOptions) {
+					OUTPUT_OPTIONS* outputOptions = new OUTPUT_OPTIONS();
+					if (managedOutput->OutputOptions->OutputFrameSize && !managedOutput->OutputOptions->OutputFrameSize->Equals(ScreenSize::Empty)) {
+						outputOptions->SetFrameSize(SIZE{ (long)round(managedOutput->OutputOptions->OutputFrameSize->Width),(long)round(managedOutput->OutputOptions->OutputFrameSize->Height) });
+					}
+					outputOptions->SetStretch(static_cast<TextureStretchMode>(managedOutput->OutputOptions->Stretch));
+					outputOptions->SetSegmentDuration(std::chrono::milliseconds((std::max)(managedOutput->OutputOptions->SegmentDurationMillis, 0)));
+					outputOptions->SetSegmentMaxBytes(static_cast<UINT64>((std::max)(managedOutput->OutputOptions->SegmentMaxBytes, 0LL)));
+					output.OutputOptions.reset(outputOptions);
+				}
+				outputs.push_back(output);
+			}
+			m_Rec->SetAdditionalOutputs(outputs);
+		}
 		if (options->AudioOptions) {
 			AUDIO_OPTIONS* audioOptions = new AUDIO_OPTIONS();
 
@@ -127,6 +132,9 @@ void Recorder::SetOptions(RecorderOptions^ options) {
 			if (options->AudioOptions->OutputVolume.HasValue) {
 				audioOptions->SetOutputVolume(options->AudioOptions->OutputVolume.Value);
 			}
+			if (options->AudioOptions->Resampler.HasValue) {
+				audioOptions->SetResamplerType(static_cast<AudioResamplerType>(options->AudioOptions->Resampler.Value));
+			}
 			m_Rec->SetAudioOptions(audioOptions);
 		}
 		if (options->MouseOptions) {
@@ -368,6 +376,7 @@ void Recorder::SetDynamicOptions(DynamicOptions^ options)
 			}
 		}
 	}
+	m_Rec->NotifyOptionsChanged();
 }
 
 bool Recorder::SetExcludeFromCapture(System::IntPtr hwnd, bool isExcluded)
@@ -656,6 +665,41 @@ void Recorder::Resume() {
 void Recorder::Stop() {
 	m_Rec->EndRecording();
 }
+RecordingStats^ Recorder::GetStats() {
+	RECORDING_STATS nativeStats = m_Rec->GetRecordingStats();
+	RecordingStats^ stats = gcnew RecordingStats();
+	stats->CaptureWait = CreateFrameTimingStats(nativeStats.GetTimer(RecordingTimer::CaptureWait));
+	stats->CaptureWakeToCopy = CreateFrameTimingStats(nativeStats.GetTimer(RecordingTimer::CaptureWakeToCopy));
+	stats->KeyedMutexHold = CreateFrameTimingStats(nativeStats.GetTimer(RecordingTimer::KeyedMutexHold));
+	stats->TextureProcessing = CreateFrameTimingStats(nativeStats.GetTimer(RecordingTimer::TextureProcessing));
+	stats->AudioGrab = CreateFrameTimingStats(nativeStats.GetTimer(RecordingTimer::AudioGrab));
+	stats->EncodeSubmit = CreateFrameTimingStats(nativeStats.GetTimer(RecordingTimer::EncodeSubmit));
+	stats->EncodeCallback = CreateFrameTimingStats(nativeStats.GetTimer(RecordingTimer::EncodeCallback));
+	stats->SnapshotQueueWait = CreateFrameTimingStats(nativeStats.GetTimer(RecordingTimer::SnapshotQueueWait));
+	stats->SnapshotEncode = CreateFrameTimingStats(nativeStats.GetTimer(RecordingTimer::SnapshotEncode));
+	stats->CapturedFrames = nativeStats.GetCounter(RecordingCounter::CapturedFrames);
+	stats->CaptureWakeups = nativeStats.GetCounter(RecordingCounter::CaptureWakeups);
+	stats->RenderedFrames = nativeStats.GetCounter(RecordingCounter::RenderedFrames);
+	stats->DroppedFrames = nativeStats.GetCounter(RecordingCounter::DroppedFrames);
+	stats->DuplicatedFrames = nativeStats.GetCounter(RecordingCounter::DuplicatedFrames);
+	stats->ExtendedFrames = nativeStats.GetCounter(RecordingCounter::ExtendedFrames);
+	stats->AudioUnderruns = nativeStats.GetCounter(RecordingCounter::AudioUnderruns);
+	stats->Snapshots = nativeStats.GetCounter(RecordingCounter::Snapshots);
+	stats->DroppedSnapshots = nativeStats.GetCounter(RecordingCounter::DroppedSnapshots);
+	return stats;
+}
+FrameTimingStats^ Recorder::CreateFrameTimingStats(_In_ const HISTOGRAM_SNAPSHOT &snapshot) {
+	FrameTimingStats^ stats = gcnew FrameTimingStats();
+	stats->Count = snapshot.Count;
+	stats->Min = HundredNanosToMillisDouble(snapshot.Min);
+	stats->Mean = HundredNanosToMillisDouble((INT64)snapshot.Mean);
+	stats->P50 = HundredNanosToMillisDouble(snapshot.P50);
+	stats->P90 = HundredNanosToMillisDouble(snapshot.P90);
+	stats->P99 = HundredNanosToMillisDouble(snapshot.P99);
+	stats->P999 = HundredNanosToMillisDouble(snapshot.P999);
+	stats->Max = HundredNanosToMillisDouble(snapshot.Max);
+	return stats;
+}
 bool Recorder::TakeSnapshot()
 {
 	HRESULT hr = m_Rec->TakeSnapshot(L"");
@@ -674,12 +718,25 @@ bool Recorder::TakeSnapshot(System::IO::Stream^ stream) {
 	OutputDebugStringW(L"Snapshot returning");
 	return SUCCEEDED(hr);
 }
+bool Recorder::SaveReplay(System::String^ path)
+{
+	std::wstring stdPathString = msclr::interop::marshal_as<std::wstring>(path);
+	HRESULT hr = m_Rec->SaveReplay(stdPathString);
+	return SUCCEEDED(hr);
+}
+bool Recorder::SaveReplay(System::IO::Stream^ stream) {
+	ManagedIStream* interopStream = new ManagedIStream(stream);
+	HRESULT hr = m_Rec->SaveReplay(interopStream);
+	interopStream->Release();
+	return SUCCEEDED(hr);
+}
 void Recorder::SetupCallbacks() {
 	CreateErrorCallback();
 	CreateCompletionCallback();
 	CreateStatusCallback();
 	CreateSnapshotCallback();
 	CreateFrameNumberCallback();
+	CreateSegmentCompleteCallback();
 }
 
 void Recorder::ReleaseCallbacks() {
@@ -693,6 +750,8 @@ void Recorder::ReleaseCallbacks() {
 		_snapshotDelegateGcHandler.Free();
 	if (_frameNumberDelegateGcHandler.IsAllocated)
 		_frameNumberDelegateGcHandler.Free();
+	if (_segmentCompleteDelegateGcHandler.IsAllocated)
+		_segmentCompleteDelegateGcHandler.Free();
 }
 
 void Recorder::ReleaseResources() {
@@ -973,6 +1032,41 @@ List<VideoCaptureFormat^>^ ScreenRecorderLib::Recorder::CreateVideoCaptureFormat
 	return managedFormats;
 }
 
+ENCODER_OPTIONS* Recorder::CreateEncoderOptions(_In_ VideoEncoderOptions^ managedOptions)
+{
+	if (!managedOptions->Encoder) {
+		managedOptions->Encoder = gcnew H264VideoEncoder();
+	}
+	ENCODER_OPTIONS* encoderOptions = nullptr;
+
+	switch (managedOptions->Encoder->EncodingFormat)
+	{
+		default:
+		case VideoEncoderFormat::H264: {
+			encoderOptions = new H264_ENCODER_OPTIONS();
+			break;
+		}
+		case VideoEncoderFormat::H265: {
+			encoderOptions = new H265_ENCODER_OPTIONS();
+			break;
+		}
+	}
+	encoderOptions->SetVideoBitrateMode((UINT32)managedOptions->Encoder->GetBitrateMode());
+	encoderOptions->SetEncoderProfile((UINT32)managedOptions->Encoder->GetEncoderProfile());
+	encoderOptions->SetVideoBitrate(managedOptions->Bitrate);
+	encoderOptions->SetVideoQuality(managedOptions->Quality);
+	encoderOptions->SetVideoFps(managedOptions->Framerate);
+	encoderOptions->SetFixedFramerate(managedOptions->IsFixedFramerate);
+	encoderOptions->SetThrottlingDisabled(managedOptions->IsThrottlingDisabled);
+	encoderOptions->SetLowLatencyModeEnabled(managedOptions->IsLowLatencyEnabled);
+	encoderOptions->SetFastStartEnabled(managedOptions->IsMp4FastStartEnabled);
+	encoderOptions->SetHardwareEncodingEnabled(managedOptions->IsHardwareEncodingEnabled);
+	encoderOptions->SetFragmentedMp4Enabled(managedOptions->IsFragmentedMp4Enabled);
+	encoderOptions->SetFramePoolSize(max(0, managedOptions->FramePoolSize));
+	encoderOptions->SetFrameQueueSize(max(1, managedOptions->FrameQueueSize));
+	encoderOptions->SetFrameDropPolicy(static_cast<PipelineDropPolicy>(managedOptions->FrameDropPolicy));
+	return encoderOptions;
+}
 
 std::vector<RECORDING_SOURCE> Recorder::CreateRecordingSourceList(_In_ IEnumerable<RecordingSourceBase^>^ managedSources) {
 	std::vector<RECORDING_SOURCE> sources{};
@@ -1051,6 +1145,13 @@ void Recorder::CreateFrameNumberCallback() {
 	CallbackFrameNumberChangedFunction cb = static_cast<CallbackFrameNumberChangedFunction>(ip.ToPointer());
 	m_Rec->RecordingFrameNumberChangedCallback = cb;
 }
+void Recorder::CreateSegmentCompleteCallback() {
+	InternalSegmentCompleteCallbackDelegate^ fp = gcnew InternalSegmentCompleteCallbackDelegate(this, &Recorder::EventSegmentComplete);
+	_segmentCompleteDelegateGcHandler = GCHandle::Alloc(fp);
+	IntPtr ip = Marshal::GetFunctionPointerForDelegate(fp);
+	CallbackSegmentCompleteFunction cb = static_cast<CallbackSegmentCompleteFunction>(ip.ToPointer());
+	m_Rec->RecordingSegmentCompleteCallback = cb;
+}
 void Recorder::EventComplete(std::wstring path, fifo_map<std::wstring, int> delays)
 {
 	ReleaseResources();
@@ -1080,6 +1181,11 @@ void ScreenRecorderLib::Recorder::EventSnapshotCreated(std::wstring str)
 	OnSnapshotSaved(this, gcnew SnapshotSavedEventArgs(gcnew String(str.c_str())));
 }
 
+void Recorder::EventSegmentComplete(std::wstring path, int index, INT64 startMillis, INT64 endMillis)
+{
+	OnSegmentComplete(this, gcnew SegmentCompleteEventArgs(gcnew String(path.c_str()), index, TimeSpan::FromMilliseconds((double)startMillis), TimeSpan::FromMilliseconds((double)endMillis)));
+}
+
 void Recorder::FrameNumberChanged(int newFrameNumber, INT64 timestamp, FRAME_BITMAP_DATA* frameData)
 {
 	FrameBitmapData^ managedFrameData = nullptr;
@@ -11,6 +11,7 @@
 #include "Options.h"
 #include "Callback.h"
 #include "AudioDevice.h"
+#include "RecordingStats.h"
 
 using namespace System;
 using namespace System::Runtime::InteropServices;
@@ -22,6 +23,7 @@ delegate void InternalCompletionCallbackDelegate(std::wstring path, nlohmann::fi
 delegate void InternalErrorCallbackDelegate(std::wstring error, std::wstring path);
 delegate void InternalSnapshotCallbackDelegate(std::wstring path);
 delegate void InternalFrameNumberCallbackDelegate(int newFrameNumber, INT64 timestamp, FRAME_BITMAP_DATA* data);
+delegate void InternalSegmentCompleteCallbackDelegate(std::wstring path, int index, INT64 startMillis, INT64 endMillis);
 namespace ScreenRecorderLib {
 
 	ref class DynamicOptionsBuilder;
@@ -60,11 +62,13 @@ namespace ScreenRecorderLib {
 		void CreateStatusCallback();
 		void CreateSnapshotCallback();
 		void CreateFrameNumberCallback();
+		void CreateSegmentCompleteCallback();
 		void EventComplete(std::wstring path, nlohmann::fifo_map<std::wstring, int> delays);
 		void EventFailed(std::wstring error, std::wstring path);
 		void EventStatusChanged(int status);
 		void EventSnapshotCreated(std::wstring str);
 		void FrameNumberChanged(int newFrameNumber, INT64 timestamp, FRAME_BITMAP_DATA* data);
+		void EventSegmentComplete(std::wstring path, int index, INT64 startMillis, INT64 endMillis);
 		void SetupCallbacks();
 		void ReleaseCallbacks();
 		void ReleaseResources();
@@ -73,7 +77,9 @@ namespace ScreenRecorderLib {
 		static List<VideoCaptureFormat^>^ CreateVideoCaptureFormatList(_In_ std::vector< IMFMediaType*> mediaTypes);
 		static std::vector<RECORDING_SOURCE> CreateRecordingSourceList(_In_ IEnumerable<RecordingSourceBase^>^ options);
 		static std::vector<RECORDING_OVERLAY> CreateOverlayList(_In_ IEnumerable<RecordingOverlayBase^>^ managedOverlays);
+		static ENCODER_OPTIONS* CreateEncoderOptions(_In_ VideoEncoderOptions^ managedOptions);
 		static Guid FromNativeGuid(_In_ const GUID& guid);
+		static FrameTimingStats^ CreateFrameTimingStats(_In_ const HISTOGRAM_SNAPSHOT &snapshot);
 
 		int _currentFrameNumber;
 		RecorderStatus _status;
@@ -84,6 +90,7 @@ namespace ScreenRecorderLib {
 		GCHandle _completedDelegateGcHandler;
 		GCHandle _snapshotDelegateGcHandler;
 		GCHandle _frameNumberDelegateGcHandler;
+		GCHandle _segmentCompleteDelegateGcHandler;
 
 	internal:
 		void SetDynamicOptions(DynamicOptions^ options);
@@ -114,9 +121,19 @@ namespace ScreenRecorderLib {
 		bool TakeSnapshot();
 		bool TakeSnapshot(System::String^ path);
 		bool TakeSnapshot(System::IO::Stream^ stream);
+		/// <summary>
+		/// Saves the last seconds of the recording kept in the replay buffer to a file, without interrupting the recording.
+		/// Requires OutputOptions.ReplayBufferDurationMillis or OutputOptions.ReplayBufferMaxBytes to be set.
+		/// </summary>
+		bool SaveReplay(System::String^ path);
+		bool SaveReplay(System::IO::Stream^ stream);
 		void Pause();
 		void Resume();
 		void Stop();
+		/// <summary>
+		/// Gets frame timings and counters for the current or most recent recording, e.g. to find which step limits the frame rate.
+		/// </summary>
+		RecordingStats^ GetStats();
 		void SetOptions(RecorderOptions^ options);
 		/// <summary>
 		/// DynamicOptionsBuilder can be used to update a subset of options while a recording is in progress.
@@ -138,6 +155,7 @@ namespace ScreenRecorderLib {
 		event EventHandler<RecordingStatusEventArgs^>^ OnStatusChanged;
 		event EventHandler<SnapshotSavedEventArgs^>^ OnSnapshotSaved;
 		event EventHandler<FrameRecordedEventArgs^>^ OnFrameRecorded;
+		event EventHandler<SegmentCompleteEventArgs^>^ OnSegmentComplete;
 	};
 
 	public ref class DynamicOptionsBuilder {
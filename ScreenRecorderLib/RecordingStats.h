@@ -0,0 +1,93 @@
+#pragma once
+
+using namespace System;
+
+namespace ScreenRecorderLib {
+	/// <summary>
+	/// Distribution of the durations measured for one step of the recording, in milliseconds.
+	/// </summary>
+	public ref class FrameTimingStats {
+	public:
+		/// <summary>
+		/// Number of measurements.
+		/// </summary>
+		property UInt64 Count;
+		property double Min;
+		property double Mean;
+		property double P50;
+		property double P90;
+		property double P99;
+		property double P999;
+		property double Max;
+	};
+
+	/// <summary>
+	/// Frame timings and counters for the current or most recent recording.
+	/// </summary>
+	public ref class RecordingStats {
+	public:
+		/// <summary>
+		/// Time spent waiting for a new frame from the capture sources.
+		/// </summary>
+		property FrameTimingStats^ CaptureWait;
+		/// <summary>
+		/// Time from a capture thread wakes up for a new frame until the frame is written to the shared capture surface.
+		/// </summary>
+		property FrameTimingStats^ CaptureWakeToCopy;
+		/// <summary>
+		/// Time the canvas buffer holding the latest captured frame is locked while the frame is copied out.
+		/// </summary>
+		property FrameTimingStats^ KeyedMutexHold;
+		/// <summary>
+		/// Time spent drawing overlays and the mouse pointer, cropping and resizing a frame.
+		/// </summary>
+		property FrameTimingStats^ TextureProcessing;
+		/// <summary>
+		/// Time spent grabbing and mixing the audio for a frame.
+		/// </summary>
+		property FrameTimingStats^ AudioGrab;
+		/// <summary>
+		/// Time spent submitting a frame and its audio to the encoder.
+		/// </summary>
+		property FrameTimingStats^ EncodeSubmit;
+		/// <summary>
+		/// Time from a frame is submitted until the encoder is done with it.
+		/// </summary>
+		property FrameTimingStats^ EncodeCallback;
+		/// <summary>
+		/// Time from a snapshot is queued until a snapshot worker starts reading it back.
+		/// </summary>
+		property FrameTimingStats^ SnapshotQueueWait;
+		/// <summary>
+		/// Time spent reading back, encoding and writing a snapshot.
+		/// </summary>
+		property FrameTimingStats^ SnapshotEncode;
+		property UInt64 CapturedFrames;
+		/// <summary>
+		/// Times a capture thread woke up from waiting for a frame, a signal or a deadline.
+		/// </summary>
+		property UInt64 CaptureWakeups;
+		property UInt64 RenderedFrames;
+		/// <summary>
+		/// Frames dropped because processing or encoding fell behind.
+		/// </summary>
+		property UInt64 DroppedFrames;
+		/// <summary>
+		/// Frames written without any new content since the previous frame.
+		/// </summary>
+		property UInt64 DuplicatedFrames;
+		/// <summary>
+		/// Unchanged frames that extended the duration of the previous frame instead of being encoded.
+		/// </summary>
+		property UInt64 ExtendedFrames;
+		/// <summary>
+		/// Frames that had no captured audio while audio recording is enabled.
+		/// </summary>
+		property UInt64 AudioUnderruns;
+		property UInt64 Snapshots;
+		/// <summary>
+		/// Snapshots skipped because the snapshot workers were still busy with earlier ones.
+		/// </summary>
+		property UInt64 DroppedSnapshots;
+	};
+}
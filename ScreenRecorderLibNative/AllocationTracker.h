@@ -0,0 +1,88 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+
+struct ALLOCATION_STATS {
+	//Allocations made, and their summed size in bytes.
+	uint64_t Allocations = 0;
+	uint64_t Bytes = 0;
+	//Frames ended with EndFrame, and the allocations made during them.
+	uint64_t Frames = 0;
+	uint64_t FrameAllocations = 0;
+	//Frames during which anything was allocated.
+	uint64_t FramesWithAllocations = 0;
+	//The most allocations made during a single frame.
+	uint64_t MaxFrameAllocations = 0;
+
+	double GetMeanFrameAllocations() const {
+		return Frames > 0 ? static_cast<double>(FrameAllocations) / Frames : 0;
+	}
+};
+
+/// <summary>
+/// Counts the resources allocated per frame, so allocations creeping into the per frame work show up in the stats.
+/// Allocations made before the first EndFrame, e.g. during initialization, are counted in the totals but not as part of a frame.
+/// </summary>
+class AllocationTracker
+{
+public:
+	AllocationTracker() :
+		m_FrameAllocations(0),
+		m_IsFrameStarted(false),
+		m_Stats{}
+	{
+	}
+
+	void OnAllocation(uint64_t bytes)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stats.Allocations++;
+		m_Stats.Bytes += bytes;
+		if (m_IsFrameStarted) {
+			m_FrameAllocations++;
+		}
+	}
+
+	/// <summary>
+	/// Ends the current frame and starts the next.
+	/// </summary>
+	/// <returns>The number of allocations made during the ended frame</returns>
+	uint64_t EndFrame()
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		uint64_t frameAllocations = m_FrameAllocations;
+		if (m_IsFrameStarted) {
+			m_Stats.Frames++;
+			m_Stats.FrameAllocations += frameAllocations;
+			if (frameAllocations > 0) {
+				m_Stats.FramesWithAllocations++;
+			}
+			m_Stats.MaxFrameAllocations = (std::max)(m_Stats.MaxFrameAllocations, frameAllocations);
+		}
+		m_FrameAllocations = 0;
+		m_IsFrameStarted = true;
+		return frameAllocations;
+	}
+
+	/// <summary>
+	/// The number of allocations made so far during the current frame.
+	/// </summary>
+	uint64_t GetFrameAllocations()
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		return m_FrameAllocations;
+	}
+
+	ALLOCATION_STATS GetStats()
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		return m_Stats;
+	}
+
+private:
+	std::mutex m_Mutex;
+	uint64_t m_FrameAllocations;
+	bool m_IsFrameStarted;
+	ALLOCATION_STATS m_Stats;
+};
@@ -0,0 +1,246 @@
+#include "AsyncLogWriter.h"
+#include <cstdio>
+#include <cwchar>
+#include <filesystem>
+
+AsyncLogWriter::AsyncLogWriter(size_t queueCapacity) :
+	m_Queue(queueCapacity),
+	m_Queued(0),
+	m_Dropped(0),
+	m_MaxFileSize(ASYNC_LOG_MAX_FILE_SIZE),
+	m_FlushIntervalMillis(ASYNC_LOG_FLUSH_INTERVAL_MS),
+	m_IsStopping(false),
+	m_IsWakeRequested(false),
+	m_Processed(0),
+	m_FilePath(L""),
+	m_FallbackSink(nullptr),
+	m_OpenFilePath(L""),
+	m_FileSize(0),
+	m_ReportedDropped(0),
+	m_Written(0),
+	m_Rotations(0)
+{
+}
+
+AsyncLogWriter::~AsyncLogWriter()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_SignalMutex);
+		m_IsStopping = true;
+	}
+	m_WakeCondition.notify_one();
+	if (m_WriterThread.joinable()) {
+		m_WriterThread.join();
+	}
+}
+
+bool AsyncLogWriter::Write(const wchar_t *format, va_list args)
+{
+	bool isQueued = m_Queue.TryPush([&](LOG_MESSAGE &message) {
+		va_list argsCopy;
+		va_copy(argsCopy, args);
+#ifdef _MSC_VER
+		int length = _vsnwprintf_s(message.Text, ASYNC_LOG_MESSAGE_SIZE, _TRUNCATE, format, argsCopy);
+#else
+		int length = vswprintf(message.Text, ASYNC_LOG_MESSAGE_SIZE, format, argsCopy);
+#endif
+		va_end(argsCopy);
+		if (length < 0) {
+			//Truncated. Keep what fits, and end the line so the next message starts on its own line.
+			message.Text[ASYNC_LOG_MESSAGE_SIZE - 2] = L'\n';
+			message.Text[ASYNC_LOG_MESSAGE_SIZE - 1] = L'\0';
+			message.Length = wcslen(message.Text);
+		}
+		else {
+			message.Length = (size_t)length;
+		}
+	});
+	return OnEnqueued(isQueued);
+}
+
+bool AsyncLogWriter::WriteString(const wchar_t *text)
+{
+	bool isQueued = m_Queue.TryPush([&](LOG_MESSAGE &message) {
+		size_t length = wcslen(text);
+		if (length > ASYNC_LOG_MESSAGE_SIZE - 1) {
+			length = ASYNC_LOG_MESSAGE_SIZE - 1;
+		}
+		wmemcpy(message.Text, text, length);
+		message.Text[length] = L'\0';
+		message.Length = length;
+	});
+	return OnEnqueued(isQueued);
+}
+
+bool AsyncLogWriter::OnEnqueued(bool isQueued)
+{
+	if (!isQueued) {
+		m_Dropped++;
+		EnsureStarted();
+		return false;
+	}
+	m_Queued++;
+	EnsureStarted();
+	//Wake the writer early when the queue is filling up, instead of waiting for the flush interval.
+	if (m_Queue.ApproximateSize() > m_Queue.Capacity() / 2 && !m_IsWakeRequested.exchange(true)) {
+		m_WakeCondition.notify_one();
+	}
+	return true;
+}
+
+bool AsyncLogWriter::Flush(std::chrono::milliseconds timeout)
+{
+	uint64_t target = m_Queued.load();
+	std::unique_lock<std::mutex> lock(m_SignalMutex);
+	if (m_Processed >= target) {
+		return true;
+	}
+	m_IsWakeRequested = true;
+	m_WakeCondition.notify_one();
+	return m_FlushedCondition.wait_for(lock, timeout, [&]() { return m_Processed >= target; });
+}
+
+void AsyncLogWriter::SetFilePath(const std::wstring &path)
+{
+	std::lock_guard<std::mutex> lock(m_SettingsMutex);
+	m_FilePath = path;
+}
+
+void AsyncLogWriter::SetFallbackSink(std::function<void(const wchar_t *)> sink)
+{
+	std::lock_guard<std::mutex> lock(m_SettingsMutex);
+	m_FallbackSink = sink;
+}
+
+ASYNC_LOG_STATS AsyncLogWriter::GetStats()
+{
+	std::lock_guard<std::mutex> lock(m_SignalMutex);
+	ASYNC_LOG_STATS stats;
+	stats.Written = m_Written;
+	stats.Rotations = m_Rotations.load();
+	stats.Dropped = m_Dropped.load();
+	return stats;
+}
+
+void AsyncLogWriter::EnsureStarted()
+{
+	std::call_once(m_StartFlag, [this]() {
+		m_WriterThread = std::thread([this]() { WriterThreadProc(); });
+	});
+}
+
+void AsyncLogWriter::WriterThreadProc()
+{
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(m_SignalMutex);
+			m_WakeCondition.wait_for(lock, std::chrono::milliseconds(m_FlushIntervalMillis.load()), [&]() { return m_IsStopping || m_IsWakeRequested; });
+			m_IsWakeRequested = false;
+		}
+		//Anything queued before the stop request is written by this last drain.
+		bool isStopping = m_IsStopping;
+		DrainQueue();
+		if (isStopping) {
+			break;
+		}
+	}
+	if (m_File.is_open()) {
+		m_File.close();
+	}
+}
+
+void AsyncLogWriter::DrainQueue()
+{
+	std::wstring filePath;
+	std::function<void(const wchar_t *)> fallbackSink;
+	{
+		std::lock_guard<std::mutex> lock(m_SettingsMutex);
+		filePath = m_FilePath;
+		fallbackSink = m_FallbackSink;
+	}
+	if (filePath != m_OpenFilePath || (!filePath.empty() && !m_File.is_open())) {
+		OpenFile(filePath);
+		if (!filePath.empty() && !m_File.is_open() && fallbackSink) {
+			fallbackSink(L"Error opening log file for write");
+		}
+	}
+	uint64_t processed = 0;
+	while (m_Queue.TryPop([&](LOG_MESSAGE &message) {
+		WriteMessage(message.Text, message.Length, filePath, fallbackSink);
+	})) {
+		processed++;
+	}
+	uint64_t dropped = m_Dropped.load();
+	if (dropped > m_ReportedDropped) {
+		wchar_t text[128];
+		int length = swprintf(text, sizeof(text) / sizeof(text[0]), L"[WARN]  Log queue overflow, %llu log messages dropped\n", (unsigned long long)(dropped - m_ReportedDropped));
+		if (length > 0) {
+			WriteMessage(text, (size_t)length, filePath, fallbackSink);
+		}
+		m_ReportedDropped = dropped;
+	}
+	if (m_File.is_open()) {
+		m_File.flush();
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_SignalMutex);
+		m_Processed += processed;
+		m_Written += processed;
+	}
+	m_FlushedCondition.notify_all();
+}
+
+void AsyncLogWriter::WriteMessage(const wchar_t *text, size_t length, const std::wstring &filePath, const std::function<void(const wchar_t *)> &fallbackSink)
+{
+	if (filePath.empty()) {
+		if (fallbackSink) {
+			fallbackSink(text);
+		}
+		return;
+	}
+	if (!m_File.is_open()) {
+		return;
+	}
+	uint64_t maxFileSize = m_MaxFileSize.load();
+	if (maxFileSize > 0 && m_FileSize > 0 && m_FileSize + length > maxFileSize) {
+		RotateFile();
+	}
+	m_File.write(text, length);
+	m_FileSize += length;
+}
+
+void AsyncLogWriter::OpenFile(const std::wstring &filePath)
+{
+	if (m_File.is_open()) {
+		m_File.close();
+	}
+	m_File.clear();
+	m_OpenFilePath = filePath;
+	m_FileSize = 0;
+	if (filePath.empty()) {
+		return;
+	}
+	std::filesystem::path path(filePath);
+	std::error_code ec;
+	uintmax_t existingSize = std::filesystem::file_size(path, ec);
+	if (!ec) {
+		m_FileSize = existingSize;
+	}
+	m_File.open(path, std::ios_base::app | std::ios_base::out);
+}
+
+void AsyncLogWriter::RotateFile()
+{
+	m_File.close();
+	std::filesystem::path path(m_OpenFilePath);
+	std::filesystem::path rotatedPath = path.parent_path() / path.stem();
+	rotatedPath += L".1";
+	rotatedPath += path.extension();
+	std::error_code ec;
+	std::filesystem::remove(rotatedPath, ec);
+	std::filesystem::rename(path, rotatedPath, ec);
+	m_File.clear();
+	m_File.open(path, std::ios_base::app | std::ios_base::out);
+	m_FileSize = 0;
+	m_Rotations++;
+}
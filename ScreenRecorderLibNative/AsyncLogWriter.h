@@ -0,0 +1,122 @@
+#pragma once
+#include "BoundedMpscQueue.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+//Maximum length of a single log message in characters, including the terminator. Longer messages are truncated.
+#define ASYNC_LOG_MESSAGE_SIZE 1024
+//Number of messages that can be queued before new ones are dropped.
+#define ASYNC_LOG_QUEUE_CAPACITY 1024
+//Default interval between flushes of the log file, in milliseconds.
+#define ASYNC_LOG_FLUSH_INTERVAL_MS 200
+//Default size at which the log file is rotated, in bytes.
+#define ASYNC_LOG_MAX_FILE_SIZE (10 * 1024 * 1024)
+
+struct ASYNC_LOG_STATS {
+	//Messages written to the log file or fallback sink.
+	uint64_t Written = 0;
+	//Messages dropped because the queue was full.
+	uint64_t Dropped = 0;
+	//Number of times the log file has been rotated.
+	uint64_t Rotations = 0;
+};
+
+/// <summary>
+/// Writes log messages from any thread to a file on a background thread.
+/// Messages are formatted on the calling thread directly into a lock-free queue slot, so logging never blocks on file I/O.
+/// The writer thread keeps the file open, writes queued messages in batches and flushes them at a fixed interval.
+/// The file is rotated to "name.1.ext" when it exceeds the maximum size. If the queue is full, messages are dropped and counted,
+/// and the number of dropped messages is reported in the log once there is room again.
+/// </summary>
+class AsyncLogWriter
+{
+public:
+	AsyncLogWriter(size_t queueCapacity = ASYNC_LOG_QUEUE_CAPACITY);
+	~AsyncLogWriter();
+	AsyncLogWriter(const AsyncLogWriter &) = delete;
+	AsyncLogWriter &operator=(const AsyncLogWriter &) = delete;
+
+	/// <summary>
+	/// Formats a message with vswprintf semantics and queues it for writing. Never blocks.
+	/// </summary>
+	/// <returns>false if the message was dropped because the queue is full</returns>
+	bool Write(const wchar_t *format, va_list args);
+	/// <summary>
+	/// Queues a preformatted message for writing. Never blocks.
+	/// </summary>
+	/// <returns>false if the message was dropped because the queue is full</returns>
+	bool WriteString(const wchar_t *message);
+
+	/// <summary>
+	/// Waits until all messages queued before the call have been written and flushed, or the timeout elapses.
+	/// </summary>
+	/// <returns>true if everything was flushed within the timeout</returns>
+	bool Flush(std::chrono::milliseconds timeout);
+
+	/// <summary>
+	/// Sets the file to log to. If empty, messages are passed to the fallback sink instead. Takes effect with the next batch.
+	/// </summary>
+	void SetFilePath(const std::wstring &path);
+	/// <summary>
+	/// Sets the size in bytes at which the log file is rotated. 0 disables rotation.
+	/// </summary>
+	void SetMaxFileSize(uint64_t maxFileSize) { m_MaxFileSize.store(maxFileSize); }
+	void SetFlushInterval(std::chrono::milliseconds interval) { m_FlushIntervalMillis.store(interval.count()); }
+	/// <summary>
+	/// Sets the function receiving messages when no log file is set, e.g. to forward them to a debugger.
+	/// </summary>
+	void SetFallbackSink(std::function<void(const wchar_t *)> sink);
+
+	ASYNC_LOG_STATS GetStats();
+
+private:
+	struct LOG_MESSAGE {
+		size_t Length;
+		wchar_t Text[ASYNC_LOG_MESSAGE_SIZE];
+	};
+	BoundedMpscQueue<LOG_MESSAGE> m_Queue;
+
+	std::atomic<uint64_t> m_Queued;
+	std::atomic<uint64_t> m_Dropped;
+	std::atomic<uint64_t> m_MaxFileSize;
+	std::atomic<long long> m_FlushIntervalMillis;
+	std::atomic<bool> m_IsStopping;
+	std::atomic<bool> m_IsWakeRequested;
+	std::once_flag m_StartFlag;
+	std::thread m_WriterThread;
+
+	//Guards the wake up and flush handshakes between callers and the writer thread.
+	std::mutex m_SignalMutex;
+	std::condition_variable m_WakeCondition;
+	std::condition_variable m_FlushedCondition;
+	uint64_t m_Processed;
+
+	//Guards the settings below, which are read by the writer thread.
+	std::mutex m_SettingsMutex;
+	std::wstring m_FilePath;
+	std::function<void(const wchar_t *)> m_FallbackSink;
+
+	//Owned by the writer thread.
+	std::wofstream m_File;
+	std::wstring m_OpenFilePath;
+	uint64_t m_FileSize;
+	uint64_t m_ReportedDropped;
+	uint64_t m_Written;
+	std::atomic<uint64_t> m_Rotations;
+
+	bool OnEnqueued(bool isQueued);
+	void EnsureStarted();
+	void WriterThreadProc();
+	void DrainQueue();
+	void WriteMessage(const wchar_t *text, size_t length, const std::wstring &filePath, const std::function<void(const wchar_t *)> &fallbackSink);
+	void OpenFile(const std::wstring &filePath);
+	void RotateFile();
+};
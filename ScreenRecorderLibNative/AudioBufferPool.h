@@ -0,0 +1,276 @@
+#pragma once
+#include "ResourcePool.h"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+//Smallest buffer handed out by an AudioBufferPool. Requests are rounded up to a power of two of at least this size,
+//so buffers are reused even though the audio length of each frame varies with the frame duration.
+#define AUDIO_BUFFER_MIN_CAPACITY 4096
+
+/// <summary>
+/// Creates, destroys and gives write access to the buffers handed out by an AudioBufferPool, e.g. IMFMediaBuffer instances.
+/// </summary>
+template <typename TBuffer>
+class IAudioBufferAllocator : public IResourceAllocator<size_t, TBuffer>
+{
+public:
+	/// <summary>
+	/// Gets write access to the memory of a buffer.
+	/// </summary>
+	/// <returns>Pointer to the capacity the buffer was allocated with, or nullptr on failure</returns>
+	virtual uint8_t *Lock(TBuffer buffer) = 0;
+	/// <summary>
+	/// Ends write access, and sets the number of valid bytes in the buffer.
+	/// </summary>
+	virtual void Unlock(TBuffer buffer, size_t length) = 0;
+};
+
+template <typename TBuffer>
+class AudioBufferPool;
+
+/// <summary>
+/// A reference counted buffer of audio samples acquired from an AudioBufferPool.
+/// The memory is writable from when the buffer is acquired until Commit is called, after which the backing buffer can be handed to a consumer such as an encoder.
+/// When the last AudioBufferRef to it is released, the buffer and this object go back to the pool, so acquiring a buffer of a size seen before does not allocate.
+/// </summary>
+template <typename TBuffer>
+class AudioBuffer
+{
+public:
+	AudioBuffer(const AudioBuffer &) = delete;
+	AudioBuffer &operator=(const AudioBuffer &) = delete;
+
+	/// <summary>
+	/// The writable memory of the buffer, or nullptr once committed.
+	/// </summary>
+	inline uint8_t *Data() { return m_pData; }
+	inline size_t Capacity() const { return m_Capacity; }
+	/// <summary>
+	/// The number of valid bytes in the buffer.
+	/// </summary>
+	inline size_t Length() const { return m_Length; }
+	/// <summary>
+	/// Sets the number of valid bytes in the buffer, up to its capacity.
+	/// </summary>
+	inline void SetLength(size_t length) { m_Length = (std::min)(length, m_Capacity); }
+	inline bool IsCommitted() const { return m_pData == nullptr; }
+	/// <summary>
+	/// The backing buffer. Still owned by this object.
+	/// </summary>
+	inline TBuffer GetBuffer() const { return m_Buffer; }
+
+	/// <summary>
+	/// Ends writing, and sets the length of the backing buffer. Further writes are not possible.
+	/// </summary>
+	/// <returns>The backing buffer, still owned by this object</returns>
+	TBuffer Commit()
+	{
+		if (m_pData) {
+			m_pData = nullptr;
+			m_Pool->m_Allocator->Unlock(m_Buffer, m_Length);
+		}
+		return m_Buffer;
+	}
+
+	void AddRef()
+	{
+		m_RefCount.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void Release()
+	{
+		if (m_RefCount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			Commit();
+			//Keep the pool alive until the buffer is back in it, even if this was the last thing referencing it.
+			std::shared_ptr<AudioBufferPool<TBuffer>> pool = std::move(m_Pool);
+			pool->Recycle(this);
+		}
+	}
+
+private:
+	friend class AudioBufferPool<TBuffer>;
+	AudioBuffer(TBuffer buffer, size_t capacity) :
+		m_Buffer(buffer),
+		m_Capacity(capacity),
+		m_Length(0),
+		m_pData(nullptr),
+		m_RefCount(0)
+	{
+	}
+	~AudioBuffer() {}
+
+	TBuffer m_Buffer;
+	size_t m_Capacity;
+	size_t m_Length;
+	uint8_t *m_pData;
+	std::atomic<uint32_t> m_RefCount;
+	//Set while the buffer is in use, so the pool outlives every buffer acquired from it.
+	std::shared_ptr<AudioBufferPool<TBuffer>> m_Pool;
+};
+
+/// <summary>
+/// Smart pointer holding a reference to an AudioBuffer. Copies share the buffer, and the buffer goes back to its pool when the last one is released.
+/// </summary>
+template <typename TBuffer>
+class AudioBufferRef
+{
+public:
+	AudioBufferRef() : m_pBuffer(nullptr) {}
+	explicit AudioBufferRef(AudioBuffer<TBuffer> *pBuffer) :
+		m_pBuffer(pBuffer)
+	{
+		if (m_pBuffer) {
+			m_pBuffer->AddRef();
+		}
+	}
+	AudioBufferRef(const AudioBufferRef &other) :
+		AudioBufferRef(other.m_pBuffer)
+	{
+	}
+	AudioBufferRef(AudioBufferRef &&other) noexcept :
+		m_pBuffer(other.m_pBuffer)
+	{
+		other.m_pBuffer = nullptr;
+	}
+	~AudioBufferRef()
+	{
+		Reset();
+	}
+	AudioBufferRef &operator=(const AudioBufferRef &other)
+	{
+		AudioBufferRef(other).Swap(*this);
+		return *this;
+	}
+	AudioBufferRef &operator=(AudioBufferRef &&other) noexcept
+	{
+		AudioBufferRef(std::move(other)).Swap(*this);
+		return *this;
+	}
+
+	void Reset()
+	{
+		if (m_pBuffer) {
+			AudioBuffer<TBuffer> *pBuffer = m_pBuffer;
+			m_pBuffer = nullptr;
+			pBuffer->Release();
+		}
+	}
+	void Swap(AudioBufferRef &other) noexcept
+	{
+		std::swap(m_pBuffer, other.m_pBuffer);
+	}
+
+	inline AudioBuffer<TBuffer> *Get() const { return m_pBuffer; }
+	inline AudioBuffer<TBuffer> *operator->() const { return m_pBuffer; }
+	inline explicit operator bool() const { return m_pBuffer != nullptr; }
+	/// <summary>
+	/// The number of valid bytes in the referenced buffer, or 0 if there is none.
+	/// </summary>
+	inline size_t Length() const { return m_pBuffer ? m_pBuffer->Length() : 0; }
+
+private:
+	AudioBuffer<TBuffer> *m_pBuffer;
+};
+
+/// <summary>
+/// A thread safe pool of audio buffers, so audio can be written straight into the buffers handed to the encoder without allocating them for every frame.
+/// Buffers are pooled by capacity, in power of two size classes. Like ResourcePool, at most Depth idle buffers are kept,
+/// and buffers are allocated on demand when every pooled one is in use.
+/// </summary>
+template <typename TBuffer>
+class AudioBufferPool : public std::enable_shared_from_this<AudioBufferPool<TBuffer>>
+{
+public:
+	static std::shared_ptr<AudioBufferPool> Create(std::unique_ptr<IAudioBufferAllocator<TBuffer>> allocator, size_t depth)
+	{
+		return std::shared_ptr<AudioBufferPool>(new AudioBufferPool(std::move(allocator), depth));
+	}
+	AudioBufferPool(const AudioBufferPool &) = delete;
+	AudioBufferPool &operator=(const AudioBufferPool &) = delete;
+
+	/// <summary>
+	/// Gets a writable buffer with room for at least the given number of bytes. Its length is initially 0.
+	/// </summary>
+	/// <returns>A reference to the buffer, or an empty reference if allocation failed</returns>
+	AudioBufferRef<TBuffer> Acquire(size_t minimumCapacity)
+	{
+		size_t capacity = GetCapacityClass(minimumCapacity);
+		AudioBuffer<TBuffer> *pBuffer = nullptr;
+		if (!m_Pool.Acquire(capacity, &pBuffer)) {
+			return AudioBufferRef<TBuffer>();
+		}
+		pBuffer->m_pData = m_Allocator->Lock(pBuffer->m_Buffer);
+		if (!pBuffer->m_pData) {
+			m_Pool.Release(capacity, pBuffer);
+			return AudioBufferRef<TBuffer>();
+		}
+		pBuffer->m_Length = 0;
+		pBuffer->m_Pool = this->shared_from_this();
+		return AudioBufferRef<TBuffer>(pBuffer);
+	}
+
+	/// <summary>
+	/// Frees all idle buffers. Buffers in use are unaffected and are pooled again when released.
+	/// </summary>
+	void Trim() { m_Pool.Trim(); }
+	void SetDepth(size_t depth) { m_Pool.SetDepth(depth); }
+	RESOURCE_POOL_STATS GetStats() { return m_Pool.GetStats(); }
+
+	/// <summary>
+	/// The capacity of the buffers used for a request of the given size.
+	/// </summary>
+	static size_t GetCapacityClass(size_t minimumCapacity)
+	{
+		size_t capacity = AUDIO_BUFFER_MIN_CAPACITY;
+		while (capacity < minimumCapacity) {
+			capacity <<= 1;
+		}
+		return capacity;
+	}
+
+private:
+	friend class AudioBuffer<TBuffer>;
+
+	/// <summary>
+	/// Wraps the backend allocator, so the pool hands out AudioBuffer objects that are reused along with their backing buffer.
+	/// </summary>
+	class AudioBufferAllocator : public IResourceAllocator<size_t, AudioBuffer<TBuffer> *>
+	{
+	public:
+		AudioBufferAllocator(std::unique_ptr<IAudioBufferAllocator<TBuffer>> allocator) :
+			m_Allocator(std::move(allocator))
+		{
+		}
+		bool Allocate(const size_t &capacity, AudioBuffer<TBuffer> **ppBuffer) override {
+			TBuffer buffer;
+			if (!m_Allocator->Allocate(capacity, &buffer)) {
+				return false;
+			}
+			*ppBuffer = new AudioBuffer<TBuffer>(buffer, capacity);
+			return true;
+		}
+		void Free(AudioBuffer<TBuffer> *pBuffer) override {
+			m_Allocator->Free(pBuffer->m_Buffer);
+			delete pBuffer;
+		}
+		std::unique_ptr<IAudioBufferAllocator<TBuffer>> m_Allocator;
+	};
+
+	AudioBufferPool(std::unique_ptr<IAudioBufferAllocator<TBuffer>> allocator, size_t depth) :
+		m_Allocator(allocator.get()),
+		m_Pool(std::make_unique<AudioBufferAllocator>(std::move(allocator)), depth)
+	{
+	}
+
+	void Recycle(AudioBuffer<TBuffer> *pBuffer)
+	{
+		m_Pool.Release(pBuffer->m_Capacity, pBuffer);
+	}
+
+	//Owned by the allocator of m_Pool.
+	IAudioBufferAllocator<TBuffer> *m_Allocator;
+	ResourcePool<size_t, AudioBuffer<TBuffer> *> m_Pool;
+};
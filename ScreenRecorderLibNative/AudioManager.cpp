@@ -6,7 +6,8 @@ using namespace std;
 
 AudioManager::AudioManager() :
 	m_AudioOptions(nullptr),
-	m_IsCaptureEnabled(false)
+	m_IsCaptureEnabled(false),
+	m_AudioBufferPool(MediaBufferPool::Create(make_unique<MFMemoryBufferAllocator>(), AUDIO_BUFFER_POOL_DEPTH))
 {
 	InitializeCriticalSection(&m_CriticalSection);
 	m_OptionsListenerStopEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
@@ -157,66 +158,66 @@ HRESULT AudioManager::ConfigureAudioCapture() {
 	return hr;
 }
 
-std::vector<BYTE> AudioManager::GrabAudioFrame(_In_ UINT64 durationHundredNanos)
+MediaBufferRef AudioManager::GrabAudioFrame(_In_ UINT64 durationHundredNanos)
 {
 	EnterCriticalSection(&m_CriticalSection);
 	LeaveCriticalSectionOnExit leaveOnExit(&m_CriticalSection);
+	auto createMixSource = [](std::vector<BYTE> &bytes, float volume) {
+		AUDIO_MIX_SOURCE source;
+		source.pSamples = reinterpret_cast<const int16_t *>(bytes.data());
+		source.SampleCount = bytes.size() / sizeof(int16_t);
+		source.Volume = volume;
+		return source;
+	};
+	AUDIO_MIX_SOURCE sources[2];
+	size_t sourceCount = 0;
 	if (m_AudioOutputCapture && m_AudioInputCapture) {
-		auto returnAudioOverflowToBuffer = [&](auto &outputDeviceData, auto &inputDeviceData) {
-			if (outputDeviceData.size() > 0 && inputDeviceData.size() > 0) {
-				if (outputDeviceData.size() > inputDeviceData.size()) {
-					auto diff = outputDeviceData.size() - inputDeviceData.size();
-					std::vector<BYTE> overflow(outputDeviceData.end() - diff, outputDeviceData.end());
-					outputDeviceData.resize(outputDeviceData.size() - diff);
-					m_AudioOutputCapture->ReturnAudioBytesToBuffer(overflow);
-				}
-				else if (inputDeviceData.size() > outputDeviceData.size()) {
-					auto diff = inputDeviceData.size() - outputDeviceData.size();
-					std::vector<BYTE> overflow(inputDeviceData.end() - diff, inputDeviceData.end());
-					inputDeviceData.resize(inputDeviceData.size() - diff);
-					m_AudioInputCapture->ReturnAudioBytesToBuffer(overflow);
-				}
+		m_AudioOutputCapture->GetRecordedBytes(durationHundredNanos, &m_OutputDeviceBytes);
+		m_AudioInputCapture->GetRecordedBytes(durationHundredNanos, &m_InputDeviceBytes);
+		//Whatever one device delivered beyond the other is returned to it, so both streams are mixed in step.
+		if (m_OutputDeviceBytes.size() > 0 && m_InputDeviceBytes.size() > 0) {
+			if (m_OutputDeviceBytes.size() > m_InputDeviceBytes.size()) {
+				m_AudioOutputCapture->ReturnAudioBytesToBuffer(&m_OutputDeviceBytes[m_InputDeviceBytes.size()], m_OutputDeviceBytes.size() - m_InputDeviceBytes.size());
+				m_OutputDeviceBytes.resize(m_InputDeviceBytes.size());
+			}
+			else if (m_InputDeviceBytes.size() > m_OutputDeviceBytes.size()) {
+				m_AudioInputCapture->ReturnAudioBytesToBuffer(&m_InputDeviceBytes[m_OutputDeviceBytes.size()], m_InputDeviceBytes.size() - m_OutputDeviceBytes.size());
+				m_InputDeviceBytes.resize(m_OutputDeviceBytes.size());
 			}
-		};
-
-		std::vector<BYTE> outputDeviceData = m_AudioOutputCapture->GetRecordedBytes(durationHundredNanos);
-		std::vector<BYTE> inputDeviceData = m_AudioInputCapture->GetRecordedBytes(durationHundredNanos);
-		returnAudioOverflowToBuffer(outputDeviceData, inputDeviceData);
-		if (inputDeviceData.size() > 0 && outputDeviceData.size() && inputDeviceData.size() != outputDeviceData.size()) {
-			LOG_ERROR(L"Mixing audio byte arrays with differing sizes");
 		}
-
-		return std::move(MixAudio(outputDeviceData, inputDeviceData, GetAudioOptions()->GetOutputVolume(), GetAudioOptions()->GetInputVolume()));
-	}
-	else if (m_AudioOutputCapture)
-		return std::move(MixAudio(m_AudioOutputCapture->GetRecordedBytes(durationHundredNanos), std::vector<BYTE>(), GetAudioOptions()->GetOutputVolume(), 1.0));
-	else if (m_AudioInputCapture)
-		return std::move(MixAudio(std::vector<BYTE>(), m_AudioInputCapture->GetRecordedBytes(durationHundredNanos), 1.0, GetAudioOptions()->GetInputVolume()));
-	else
-		return std::vector<BYTE>();
+		sources[sourceCount++] = createMixSource(m_OutputDeviceBytes, GetAudioOptions()->GetOutputVolume());
+		sources[sourceCount++] = createMixSource(m_InputDeviceBytes, GetAudioOptions()->GetInputVolume());
+	}
+	else if (m_AudioOutputCapture) {
+		m_AudioOutputCapture->GetRecordedBytes(durationHundredNanos, &m_OutputDeviceBytes);
+		sources[sourceCount++] = createMixSource(m_OutputDeviceBytes, GetAudioOptions()->GetOutputVolume());
+	}
+	else if (m_AudioInputCapture) {
+		m_AudioInputCapture->GetRecordedBytes(durationHundredNanos, &m_InputDeviceBytes);
+		sources[sourceCount++] = createMixSource(m_InputDeviceBytes, GetAudioOptions()->GetInputVolume());
+	}
+	return MixAudio(sources, sourceCount);
 }
 
-std::vector<BYTE> AudioManager::MixAudio(_In_ std::vector<BYTE> const &first, _In_ std::vector<BYTE> const &second, _In_ float firstVolume, _In_ float secondVolume)
+MediaBufferRef AudioManager::MixAudio(_In_reads_(sourceCount) const AUDIO_MIX_SOURCE *pSources, _In_ size_t sourceCount)
 {
-	std::vector<BYTE> newvector(max(first.size(), second.size()));
-	bool clipped = false;
-	for (size_t i = 0; i < newvector.size(); i += 2) {
-		short firstSample = first.size() > i + 1 ? static_cast<short>(first[i] | first[i + 1] << 8) : 0;
-		short secondSample = second.size() > i + 1 ? static_cast<short>(second[i] | second[i + 1] << 8) : 0;
-		auto out = reinterpret_cast<short *>(&newvector[i]);
-		int mixedSample = int(round((firstSample)*firstVolume + (secondSample)*secondVolume));
-		if (mixedSample > MAXSHORT) {
-			clipped = true;
-			mixedSample = MAXSHORT;
-		}
-		else if (mixedSample < -MAXSHORT) {
-			clipped = true;
-			mixedSample = -MAXSHORT;
-		}
-		*out = (short)mixedSample;
+	size_t sampleCount = 0;
+	for (size_t i = 0; i < sourceCount; i++) {
+		sampleCount = max(sampleCount, pSources[i].SampleCount);
 	}
+	if (sampleCount == 0) {
+		return MediaBufferRef();
+	}
+	MediaBufferRef mixedAudio = m_AudioBufferPool->Acquire(sampleCount * sizeof(int16_t));
+	if (!mixedAudio) {
+		LOG_ERROR(L"Failed to acquire buffer for mixed audio");
+		return mixedAudio;
+	}
+	//The sources are mixed straight into the media buffer that is handed to the sink writer.
+	bool clipped = AudioMixer::Mix(pSources, sourceCount, reinterpret_cast<int16_t *>(mixedAudio->Data()), sampleCount);
+	mixedAudio->SetLength(sampleCount * sizeof(int16_t));
 	if (clipped) {
 		LOG_WARN("Audio clipped during mixing");
 	}
-	return newvector;
-}
\ No newline at end of file
+	return mixedAudio;
+}
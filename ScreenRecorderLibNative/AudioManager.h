@@ -2,6 +2,8 @@
 #include <vector>
 #include "WASAPICapture.h"
 #include "CommonTypes.h"
+#include "AudioMixer.h"
+#include "MediaBufferPool.h"
 class AudioManager 
 {
 public:
@@ -11,8 +13,14 @@ public:
 	void ClearRecordedBytes();
 	HRESULT StartCapture();
 	HRESULT StopCapture();
-	std::vector<BYTE> GrabAudioFrame(_In_ UINT64 durationHundredNanos);
+	/// <summary>
+	/// Gets the mixed audio for the given duration, in a pooled media buffer that can be passed to the sink writer as is.
+	/// </summary>
+	/// <returns>The mixed audio, or an empty reference if no audio was captured</returns>
+	MediaBufferRef GrabAudioFrame(_In_ UINT64 durationHundredNanos);
 private:
+	//Number of idle mixed audio buffers kept for reuse. Covers the frames queued in the recorder pipeline and the encoder.
+	static const size_t AUDIO_BUFFER_POOL_DEPTH = 16;
 	CRITICAL_SECTION m_CriticalSection;
 	std::shared_ptr<AUDIO_OPTIONS> m_AudioOptions;
 	//Output loopback capture, e.g. system audio.
@@ -21,6 +29,10 @@ private:
 	std::unique_ptr<WASAPICapture> m_AudioInputCapture;
 
 	bool m_IsCaptureEnabled;
+	std::shared_ptr<MediaBufferPool> m_AudioBufferPool;
+	//Reused across GrabAudioFrame calls, so fetching the captured audio does not allocate.
+	std::vector<BYTE> m_OutputDeviceBytes;
+	std::vector<BYTE> m_InputDeviceBytes;
 
 	AUDIO_OPTIONS *GetAudioOptions() { return m_AudioOptions.get(); }
 
@@ -33,5 +45,11 @@ private:
 	void OnOptionsChanged();
 	HRESULT StopOptionsChangeListenerThread();
 
-	std::vector<BYTE> MixAudio(_In_ std::vector<BYTE> const &first, _In_ std::vector<BYTE> const &second, _In_ float firstVolume, _In_ float secondVolume);
+	/// <summary>
+	/// Mixes any number of 16-bit PCM sources into a pooled media buffer.
+	/// </summary>
+	/// <param name="pSources">The sources to mix, with their volumes</param>
+	/// <param name="sourceCount">The number of sources in pSources</param>
+	/// <returns>The mixed audio, as long as the longest source, or an empty reference if all sources are empty</returns>
+	MediaBufferRef MixAudio(_In_reads_(sourceCount) const AUDIO_MIX_SOURCE *pSources, _In_ size_t sourceCount);
 };
\ No newline at end of file
@@ -0,0 +1,282 @@
+#include "AudioMixer.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define AUDIO_MIXER_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+//MSVC allows AVX2 intrinsics in any function, the kernel is only called after checking CPU support.
+#define AUDIO_MIXER_TARGET_AVX2
+#else
+#include <cpuid.h>
+#define AUDIO_MIXER_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace {
+	//Samples are mixed in blocks small enough for the float accumulator to stay in L1 cache.
+	const size_t MIX_BLOCK_SAMPLES = 512;
+	const int MIX_MAX_SAMPLE = 32767;
+	const int MIX_MIN_SAMPLE = -32767;
+	//Values beyond this are always clipped, so they are clamped before the float to int conversion to keep it in range.
+	const float MIX_CONVERT_LIMIT = 65536.0f;
+
+	typedef void(*AccumulateFunc)(const int16_t *pSamples, float volume, float *pAccumulator, size_t count, bool isFirst);
+	typedef bool(*StoreFunc)(const float *pAccumulator, int16_t *pOutput, size_t count);
+
+#pragma region Scalar
+	void AccumulateScalar(const int16_t *pSamples, float volume, float *pAccumulator, size_t count, bool isFirst) {
+		if (isFirst) {
+			for (size_t i = 0; i < count; i++) {
+				pAccumulator[i] = pSamples[i] * volume;
+			}
+		}
+		else {
+			for (size_t i = 0; i < count; i++) {
+				pAccumulator[i] = pAccumulator[i] + pSamples[i] * volume;
+			}
+		}
+	}
+
+	bool StoreScalar(const float *pAccumulator, int16_t *pOutput, size_t count) {
+		bool clipped = false;
+		for (size_t i = 0; i < count; i++) {
+			float value = (std::max)(-MIX_CONVERT_LIMIT, (std::min)(MIX_CONVERT_LIMIT, pAccumulator[i]));
+			int sample = int(std::round(value));
+			if (sample > MIX_MAX_SAMPLE) {
+				clipped = true;
+				sample = MIX_MAX_SAMPLE;
+			}
+			else if (sample < MIX_MIN_SAMPLE) {
+				clipped = true;
+				sample = MIX_MIN_SAMPLE;
+			}
+			pOutput[i] = (int16_t)sample;
+		}
+		return clipped;
+	}
+#pragma endregion
+
+#ifdef AUDIO_MIXER_X86
+#pragma region SSE2
+	void AccumulateSSE2(const int16_t *pSamples, float volume, float *pAccumulator, size_t count, bool isFirst) {
+		const __m128 vVolume = _mm_set1_ps(volume);
+		size_t i = 0;
+		for (; i + 8 <= count; i += 8) {
+			__m128i samples = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pSamples + i));
+			//Sign extend to 32 bits by moving each sample into the high half and shifting back.
+			__m128 lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(samples, samples), 16));
+			__m128 hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(samples, samples), 16));
+			lo = _mm_mul_ps(lo, vVolume);
+			hi = _mm_mul_ps(hi, vVolume);
+			if (!isFirst) {
+				lo = _mm_add_ps(_mm_loadu_ps(pAccumulator + i), lo);
+				hi = _mm_add_ps(_mm_loadu_ps(pAccumulator + i + 4), hi);
+			}
+			_mm_storeu_ps(pAccumulator + i, lo);
+			_mm_storeu_ps(pAccumulator + i + 4, hi);
+		}
+		AccumulateScalar(pSamples + i, volume, pAccumulator + i, count - i, isFirst);
+	}
+
+	/// <summary>
+	/// Rounds half away from zero, matching std::round. The fraction x - trunc(x) is exact for the clamped range, so this never double rounds.
+	/// </summary>
+	inline __m128i RoundSSE2(__m128 value) {
+		__m128i truncated = _mm_cvttps_epi32(value);
+		__m128 fraction = _mm_sub_ps(value, _mm_cvtepi32_ps(truncated));
+		//Comparison masks are -1 where true, so subtracting rounds up and adding rounds down.
+		__m128i roundUp = _mm_castps_si128(_mm_cmpge_ps(fraction, _mm_set1_ps(0.5f)));
+		__m128i roundDown = _mm_castps_si128(_mm_cmple_ps(fraction, _mm_set1_ps(-0.5f)));
+		return _mm_add_epi32(_mm_sub_epi32(truncated, roundUp), roundDown);
+	}
+
+	bool StoreSSE2(const float *pAccumulator, int16_t *pOutput, size_t count) {
+		const __m128 vLimitHigh = _mm_set1_ps(MIX_CONVERT_LIMIT);
+		const __m128 vLimitLow = _mm_set1_ps(-MIX_CONVERT_LIMIT);
+		const __m128i vMax = _mm_set1_epi32(MIX_MAX_SAMPLE);
+		const __m128i vMin = _mm_set1_epi32(MIX_MIN_SAMPLE);
+		__m128i clipMask = _mm_setzero_si128();
+		size_t i = 0;
+		for (; i + 8 <= count; i += 8) {
+			__m128 lo = _mm_max_ps(vLimitLow, _mm_min_ps(vLimitHigh, _mm_loadu_ps(pAccumulator + i)));
+			__m128 hi = _mm_max_ps(vLimitLow, _mm_min_ps(vLimitHigh, _mm_loadu_ps(pAccumulator + i + 4)));
+			__m128i loInt = RoundSSE2(lo);
+			__m128i hiInt = RoundSSE2(hi);
+			clipMask = _mm_or_si128(clipMask, _mm_or_si128(_mm_cmpgt_epi32(loInt, vMax), _mm_cmplt_epi32(loInt, vMin)));
+			clipMask = _mm_or_si128(clipMask, _mm_or_si128(_mm_cmpgt_epi32(hiInt, vMax), _mm_cmplt_epi32(hiInt, vMin)));
+			//packs saturates to [-32768, 32767], the max brings the lower bound up to -MAXSHORT.
+			__m128i packed = _mm_max_epi16(_mm_packs_epi32(loInt, hiInt), _mm_set1_epi16(MIX_MIN_SAMPLE));
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(pOutput + i), packed);
+		}
+		bool clipped = _mm_movemask_epi8(clipMask) != 0;
+		return StoreScalar(pAccumulator + i, pOutput + i, count - i) || clipped;
+	}
+#pragma endregion
+
+#pragma region AVX2
+	AUDIO_MIXER_TARGET_AVX2 void AccumulateAVX2(const int16_t *pSamples, float volume, float *pAccumulator, size_t count, bool isFirst) {
+		const __m256 vVolume = _mm256_set1_ps(volume);
+		size_t i = 0;
+		for (; i + 16 <= count; i += 16) {
+			__m256 lo = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(pSamples + i))));
+			__m256 hi = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(pSamples + i + 8))));
+			//Multiply and add are kept separate instead of fused, so the rounding matches the scalar path.
+			lo = _mm256_mul_ps(lo, vVolume);
+			hi = _mm256_mul_ps(hi, vVolume);
+			if (!isFirst) {
+				lo = _mm256_add_ps(_mm256_loadu_ps(pAccumulator + i), lo);
+				hi = _mm256_add_ps(_mm256_loadu_ps(pAccumulator + i + 8), hi);
+			}
+			_mm256_storeu_ps(pAccumulator + i, lo);
+			_mm256_storeu_ps(pAccumulator + i + 8, hi);
+		}
+		AccumulateScalar(pSamples + i, volume, pAccumulator + i, count - i, isFirst);
+	}
+
+	AUDIO_MIXER_TARGET_AVX2 inline __m256i RoundAVX2(__m256 value) {
+		__m256i truncated = _mm256_cvttps_epi32(value);
+		__m256 fraction = _mm256_sub_ps(value, _mm256_cvtepi32_ps(truncated));
+		__m256i roundUp = _mm256_castps_si256(_mm256_cmp_ps(fraction, _mm256_set1_ps(0.5f), _CMP_GE_OQ));
+		__m256i roundDown = _mm256_castps_si256(_mm256_cmp_ps(fraction, _mm256_set1_ps(-0.5f), _CMP_LE_OQ));
+		return _mm256_add_epi32(_mm256_sub_epi32(truncated, roundUp), roundDown);
+	}
+
+	AUDIO_MIXER_TARGET_AVX2 bool StoreAVX2(const float *pAccumulator, int16_t *pOutput, size_t count) {
+		const __m256 vLimitHigh = _mm256_set1_ps(MIX_CONVERT_LIMIT);
+		const __m256 vLimitLow = _mm256_set1_ps(-MIX_CONVERT_LIMIT);
+		const __m256i vMax = _mm256_set1_epi32(MIX_MAX_SAMPLE);
+		const __m256i vMin = _mm256_set1_epi32(MIX_MIN_SAMPLE);
+		__m256i clipMask = _mm256_setzero_si256();
+		size_t i = 0;
+		for (; i + 16 <= count; i += 16) {
+			__m256 lo = _mm256_max_ps(vLimitLow, _mm256_min_ps(vLimitHigh, _mm256_loadu_ps(pAccumulator + i)));
+			__m256 hi = _mm256_max_ps(vLimitLow, _mm256_min_ps(vLimitHigh, _mm256_loadu_ps(pAccumulator + i + 8)));
+			__m256i loInt = RoundAVX2(lo);
+			__m256i hiInt = RoundAVX2(hi);
+			clipMask = _mm256_or_si256(clipMask, _mm256_or_si256(_mm256_cmpgt_epi32(loInt, vMax), _mm256_cmpgt_epi32(vMin, loInt)));
+			clipMask = _mm256_or_si256(clipMask, _mm256_or_si256(_mm256_cmpgt_epi32(hiInt, vMax), _mm256_cmpgt_epi32(vMin, hiInt)));
+			//packs works per 128-bit lane, so the 64-bit quarters come out as lo0 hi0 lo1 hi1 and are permuted back into order.
+			__m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(loInt, hiInt), _MM_SHUFFLE(3, 1, 2, 0));
+			packed = _mm256_max_epi16(packed, _mm256_set1_epi16(MIX_MIN_SAMPLE));
+			_mm256_storeu_si256(reinterpret_cast<__m256i *>(pOutput + i), packed);
+		}
+		bool clipped = _mm256_movemask_epi8(clipMask) != 0;
+		return StoreScalar(pAccumulator + i, pOutput + i, count - i) || clipped;
+	}
+#pragma endregion
+
+	bool IsAVX2Supported() {
+#if defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] < 7) {
+			return false;
+		}
+		__cpuid(info, 1);
+		bool osxsave = (info[2] & (1 << 27)) != 0;
+		bool avx = (info[2] & (1 << 28)) != 0;
+		if (!osxsave || !avx) {
+			return false;
+		}
+		//The OS must save the YMM registers on context switches.
+		if ((_xgetbv(0) & 0x6) != 0x6) {
+			return false;
+		}
+		__cpuidex(info, 7, 0);
+		return (info[1] & (1 << 5)) != 0;
+#else
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2");
+#endif
+	}
+
+	bool IsSSE2Supported() {
+#if defined(_M_X64) || defined(__x86_64__)
+		return true;
+#elif defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 1);
+		return (info[3] & (1 << 26)) != 0;
+#else
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("sse2");
+#endif
+	}
+#endif
+
+	AudioMixer::Kernel DetectBestKernel() {
+#ifdef AUDIO_MIXER_X86
+		if (IsAVX2Supported()) {
+			return AudioMixer::Kernel::AVX2;
+		}
+		if (IsSSE2Supported()) {
+			return AudioMixer::Kernel::SSE2;
+		}
+#endif
+		return AudioMixer::Kernel::Scalar;
+	}
+}
+
+AudioMixer::Kernel AudioMixer::GetBestKernel()
+{
+	static const Kernel bestKernel = DetectBestKernel();
+	return bestKernel;
+}
+
+bool AudioMixer::Mix(const AUDIO_MIX_SOURCE *pSources, size_t sourceCount, int16_t *pOutput, size_t sampleCount)
+{
+	return Mix(GetBestKernel(), pSources, sourceCount, pOutput, sampleCount);
+}
+
+bool AudioMixer::Mix(Kernel kernel, const AUDIO_MIX_SOURCE *pSources, size_t sourceCount, int16_t *pOutput, size_t sampleCount)
+{
+	if (kernel > GetBestKernel()) {
+		kernel = GetBestKernel();
+	}
+	AccumulateFunc accumulate = AccumulateScalar;
+	StoreFunc store = StoreScalar;
+#ifdef AUDIO_MIXER_X86
+	if (kernel == Kernel::AVX2) {
+		accumulate = AccumulateAVX2;
+		store = StoreAVX2;
+	}
+	else if (kernel == Kernel::SSE2) {
+		accumulate = AccumulateSSE2;
+		store = StoreSSE2;
+	}
+#endif
+
+	alignas(32) float accumulator[MIX_BLOCK_SAMPLES];
+	bool clipped = false;
+	for (size_t blockStart = 0; blockStart < sampleCount; blockStart += MIX_BLOCK_SAMPLES) {
+		size_t blockLength = (std::min)(MIX_BLOCK_SAMPLES, sampleCount - blockStart);
+		//Sources are added in order, so the float sums are the same regardless of the kernel.
+		size_t accumulated = 0;
+		for (size_t s = 0; s < sourceCount; s++) {
+			const AUDIO_MIX_SOURCE &source = pSources[s];
+			if (source.SampleCount <= blockStart) {
+				continue;
+			}
+			size_t count = (std::min)(blockLength, source.SampleCount - blockStart);
+			if (count > accumulated) {
+				//Samples past what earlier sources covered are silence so far, so the first write to them must not read the accumulator.
+				if (accumulated > 0) {
+					accumulate(source.pSamples + blockStart, source.Volume, accumulator, accumulated, false);
+				}
+				accumulate(source.pSamples + blockStart + accumulated, source.Volume, accumulator + accumulated, count - accumulated, true);
+				accumulated = count;
+			}
+			else {
+				accumulate(source.pSamples + blockStart, source.Volume, accumulator, count, false);
+			}
+		}
+		if (accumulated < blockLength) {
+			std::fill(accumulator + accumulated, accumulator + blockLength, 0.0f);
+		}
+		clipped |= store(accumulator, pOutput + blockStart, blockLength);
+	}
+	return clipped;
+}
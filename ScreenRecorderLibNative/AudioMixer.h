@@ -0,0 +1,49 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+/// <summary>
+/// A 16-bit PCM input to the audio mixer.
+/// </summary>
+struct AUDIO_MIX_SOURCE {
+	//Interleaved 16-bit samples. May be null if SampleCount is 0.
+	const int16_t *pSamples = nullptr;
+	//Number of 16-bit samples (not frames) in pSamples. Sources shorter than the output are treated as silence past their end.
+	size_t SampleCount = 0;
+	//Gain applied to every sample of this source.
+	float Volume = 1.0f;
+};
+
+/// <summary>
+/// Mixes any number of 16-bit PCM sources into a single stream, using SSE2 or AVX2 when the CPU supports it.
+/// Samples are scaled and summed in single precision in source order, rounded half away from zero and clamped to [-MAXSHORT, MAXSHORT],
+/// so the result for two sources is identical to scaling, summing and clamping each sample pair in scalar code.
+/// </summary>
+class AudioMixer
+{
+public:
+	enum class Kernel {
+		Scalar,
+		SSE2,
+		AVX2
+	};
+	/// <summary>
+	/// Mixes the sources into pOutput.
+	/// </summary>
+	/// <param name="pSources">The sources to mix</param>
+	/// <param name="sourceCount">The number of sources in pSources</param>
+	/// <param name="pOutput">Caller supplied buffer receiving sampleCount mixed samples. May be the samples of one of the sources, as each block is read from all sources before it is written.</param>
+	/// <param name="sampleCount">The number of samples to write to pOutput</param>
+	/// <returns>true if any sample was clipped</returns>
+	static bool Mix(const AUDIO_MIX_SOURCE *pSources, size_t sourceCount, int16_t *pOutput, size_t sampleCount);
+
+	/// <summary>
+	/// Mixes the sources with a specific kernel. Falls back to the best supported kernel if the requested one is not available on this CPU.
+	/// </summary>
+	static bool Mix(Kernel kernel, const AUDIO_MIX_SOURCE *pSources, size_t sourceCount, int16_t *pOutput, size_t sampleCount);
+
+	/// <summary>
+	/// The fastest kernel supported by the current CPU. Detected once on first use.
+	/// </summary>
+	static Kernel GetBestKernel();
+};
@@ -0,0 +1,118 @@
+#pragma once
+#include "ResourcePool.h"
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+//The granularity the sizes of cached blank surfaces are rounded up to, so clears of slightly different sizes share a surface.
+#define BLANK_SURFACE_BUCKET_SIZE 256
+
+template <typename TFormat>
+struct BLANK_SURFACE_DESC {
+	TFormat Format;
+	uint32_t Width;
+	uint32_t Height;
+};
+
+struct BLANK_SURFACE_CACHE_STATS {
+	//Requests served by a cached surface.
+	uint64_t Hits = 0;
+	//Requests that had to allocate a surface, because none was cached for the format or the cached one was too small.
+	uint64_t Misses = 0;
+	//Requests that failed because the allocator failed.
+	uint64_t Failures = 0;
+	//Surfaces currently cached.
+	size_t Surfaces = 0;
+};
+
+/// <summary>
+/// Cleared surfaces kept around to clear regions of other surfaces by copying from them, so clearing does not allocate.
+/// One surface is cached per format. Its size is rounded up to the bucket size, and it is only replaced when a larger region is requested,
+/// by one large enough for both the old and the new size, so it is reallocated a few times at most as the cleared regions grow.
+/// The cached surfaces are never written to, so they stay blank. Not thread safe.
+/// </summary>
+template <typename TFormat, typename TSurface>
+class BlankSurfaceCache
+{
+public:
+	BlankSurfaceCache(std::unique_ptr<IResourceAllocator<BLANK_SURFACE_DESC<TFormat>, TSurface>> allocator, uint32_t bucketSize = BLANK_SURFACE_BUCKET_SIZE) :
+		m_Allocator(std::move(allocator)),
+		m_BucketSize((std::max)(bucketSize, 1u)),
+		m_Stats{}
+	{
+	}
+	BlankSurfaceCache(const BlankSurfaceCache &) = delete;
+	BlankSurfaceCache &operator=(const BlankSurfaceCache &) = delete;
+	~BlankSurfaceCache()
+	{
+		Clear();
+	}
+
+	/// <summary>
+	/// Gets a blank surface of the format, at least as large as the requested size. The surface is owned by the cache, and valid until the next call for the same format or Clear.
+	/// </summary>
+	/// <returns>true if a surface was returned in pSurface</returns>
+	bool Get(TFormat format, uint32_t width, uint32_t height, TSurface *pSurface)
+	{
+		auto entry = std::find_if(m_Entries.begin(), m_Entries.end(), [&](const CACHE_ENTRY &e) { return e.Description.Format == format; });
+		if (entry != m_Entries.end()
+			&& entry->Description.Width >= width
+			&& entry->Description.Height >= height) {
+			m_Stats.Hits++;
+			*pSurface = entry->Surface;
+			return true;
+		}
+		BLANK_SURFACE_DESC<TFormat> description{ format, RoundUpToBucket(width), RoundUpToBucket(height) };
+		if (entry != m_Entries.end()) {
+			description.Width = (std::max)(description.Width, entry->Description.Width);
+			description.Height = (std::max)(description.Height, entry->Description.Height);
+			m_Allocator->Free(entry->Surface);
+			m_Entries.erase(entry);
+		}
+		TSurface surface{};
+		if (!m_Allocator->Allocate(description, &surface)) {
+			m_Stats.Failures++;
+			return false;
+		}
+		m_Stats.Misses++;
+		m_Entries.push_back(CACHE_ENTRY{ description, surface });
+		*pSurface = surface;
+		return true;
+	}
+
+	/// <summary>
+	/// Frees all cached surfaces.
+	/// </summary>
+	void Clear()
+	{
+		for (CACHE_ENTRY &entry : m_Entries) {
+			m_Allocator->Free(entry.Surface);
+		}
+		m_Entries.clear();
+	}
+
+	BLANK_SURFACE_CACHE_STATS GetStats() const
+	{
+		BLANK_SURFACE_CACHE_STATS stats = m_Stats;
+		stats.Surfaces = m_Entries.size();
+		return stats;
+	}
+
+private:
+	struct CACHE_ENTRY {
+		BLANK_SURFACE_DESC<TFormat> Description;
+		TSurface Surface;
+	};
+
+	uint32_t RoundUpToBucket(uint32_t size) const
+	{
+		uint32_t buckets = size / m_BucketSize + (size % m_BucketSize != 0 ? 1 : 0);
+		return (std::max)(buckets, 1u) * m_BucketSize;
+	}
+
+	std::unique_ptr<IResourceAllocator<BLANK_SURFACE_DESC<TFormat>, TSurface>> m_Allocator;
+	uint32_t m_BucketSize;
+	std::vector<CACHE_ENTRY> m_Entries;
+	BLANK_SURFACE_CACHE_STATS m_Stats;
+};
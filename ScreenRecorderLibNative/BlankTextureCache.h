@@ -0,0 +1,49 @@
+#pragma once
+#include "BlankSurfaceCache.h"
+#include "TexturePool.h"
+#include "Log.h"
+#include <d3d11.h>
+#include <atlbase.h>
+
+/// <summary>
+/// Allocates the blank textures of a BlankTextureCache from a D3D11 device. The cache owns one reference to each texture.
+/// </summary>
+class D3D11BlankTextureAllocator : public IResourceAllocator<BLANK_SURFACE_DESC<DXGI_FORMAT>, ID3D11Texture2D *>
+{
+public:
+	D3D11BlankTextureAllocator(_In_ ID3D11Device *pDevice, _In_opt_ AllocationTracker *pTracker = nullptr) :
+		m_Device(pDevice),
+		m_Tracker(pTracker)
+	{
+	}
+	bool Allocate(const BLANK_SURFACE_DESC<DXGI_FORMAT> &description, ID3D11Texture2D **ppTexture) override {
+		*ppTexture = nullptr;
+		D3D11_TEXTURE2D_DESC desc{};
+		desc.Width = description.Width;
+		desc.Height = description.Height;
+		desc.MipLevels = 1;
+		desc.ArraySize = 1;
+		desc.Format = description.Format;
+		desc.SampleDesc.Count = 1;
+		desc.Usage = D3D11_USAGE_DEFAULT;
+		//The texture is only ever copied from, and new textures are zero filled, so it needs no binding and no initial data.
+		desc.BindFlags = 0;
+		HRESULT hr = m_Device->CreateTexture2D(&desc, nullptr, ppTexture);
+		if (FAILED(hr)) {
+			LOG_ERROR(L"Failed to create blank texture: hr = 0x%08x", hr);
+			return false;
+		}
+		if (m_Tracker) {
+			m_Tracker->OnAllocation(GetTextureByteSize(desc));
+		}
+		return true;
+	}
+	void Free(ID3D11Texture2D *pTexture) override {
+		pTexture->Release();
+	}
+private:
+	CComPtr<ID3D11Device> m_Device;
+	AllocationTracker *m_Tracker;
+};
+
+typedef BlankSurfaceCache<DXGI_FORMAT, ID3D11Texture2D *> BlankTextureCache;
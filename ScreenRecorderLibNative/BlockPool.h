@@ -0,0 +1,130 @@
+#pragma once
+#include "AllocationTracker.h"
+#include "ResourcePool.h"
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <vector>
+
+//Size of the blocks handed out by a BlockPool. Large enough for the control block of a shared_ptr with a custom deleter and allocator,
+//whose size depends on the compiler and what the deleter captures.
+#define BLOCK_POOL_BLOCK_SIZE 128
+
+/// <summary>
+/// A thread safe pool of small memory blocks, for allocations made for every frame that cannot be avoided otherwise,
+/// e.g. the control blocks of shared_ptr instances releasing pooled textures. Use BlockPoolAllocator to allocate from it.
+/// Requests up to BLOCK_POOL_BLOCK_SIZE bytes are served by blocks of that size, of which Depth are created up front.
+/// Larger requests are pooled by their exact size, so they allocate the first times only.
+/// </summary>
+class BlockPool
+{
+public:
+	/// <param name="depth">The number of blocks created up front, and the most idle blocks kept for reuse</param>
+	/// <param name="pTracker">Optional tracker counting the blocks created, to catch a pool too small for its use</param>
+	BlockPool(size_t depth, AllocationTracker *pTracker = nullptr) :
+		m_Pool(std::make_unique<BlockAllocator>(pTracker), depth)
+	{
+		std::vector<void *> blocks;
+		for (size_t i = 0; i < depth; i++) {
+			void *pBlock = nullptr;
+			if (m_Pool.Acquire(BLOCK_POOL_BLOCK_SIZE, &pBlock)) {
+				blocks.push_back(pBlock);
+			}
+		}
+		for (void *pBlock : blocks) {
+			m_Pool.Release(BLOCK_POOL_BLOCK_SIZE, pBlock);
+		}
+	}
+	BlockPool(const BlockPool &) = delete;
+	BlockPool &operator=(const BlockPool &) = delete;
+
+	/// <returns>A block of at least the given size, aligned like memory from operator new, or nullptr if allocation failed</returns>
+	void *Allocate(size_t bytes)
+	{
+		void *pBlock = nullptr;
+		return m_Pool.Acquire(GetBlockSize(bytes), &pBlock) ? pBlock : nullptr;
+	}
+
+	/// <summary>
+	/// Returns a block from Allocate, requested with the same size.
+	/// </summary>
+	void Free(void *pBlock, size_t bytes)
+	{
+		m_Pool.Release(GetBlockSize(bytes), pBlock);
+	}
+
+	RESOURCE_POOL_STATS GetStats() { return m_Pool.GetStats(); }
+
+private:
+	class BlockAllocator : public IResourceAllocator<size_t, void *>
+	{
+	public:
+		BlockAllocator(AllocationTracker *pTracker) :
+			m_pTracker(pTracker)
+		{
+		}
+		bool Allocate(const size_t &blockSize, void **ppBlock) override {
+			*ppBlock = ::operator new(blockSize, std::nothrow);
+			if (*ppBlock && m_pTracker) {
+				m_pTracker->OnAllocation(blockSize);
+			}
+			return *ppBlock != nullptr;
+		}
+		void Free(void *pBlock) override {
+			::operator delete(pBlock);
+		}
+		AllocationTracker *m_pTracker;
+	};
+
+	static size_t GetBlockSize(size_t bytes)
+	{
+		return bytes <= BLOCK_POOL_BLOCK_SIZE ? BLOCK_POOL_BLOCK_SIZE : bytes;
+	}
+
+	ResourcePool<size_t, void *> m_Pool;
+};
+
+/// <summary>
+/// Standard allocator drawing from a BlockPool, e.g. for std::shared_ptr with a custom deleter, whose control block would otherwise be allocated with new.
+/// Copies, including rebound ones, share the pool, which stays alive until the last copy is destroyed.
+/// </summary>
+template <typename T>
+class BlockPoolAllocator
+{
+public:
+	typedef T value_type;
+
+	BlockPoolAllocator(std::shared_ptr<BlockPool> pool) noexcept :
+		m_Pool(std::move(pool))
+	{
+	}
+	template <typename U>
+	BlockPoolAllocator(const BlockPoolAllocator<U> &other) noexcept :
+		m_Pool(other.m_Pool)
+	{
+	}
+
+	T *allocate(size_t count)
+	{
+		static_assert(alignof(T) <= alignof(std::max_align_t), "BlockPoolAllocator does not support over-aligned types");
+		void *pBlock = m_Pool->Allocate(count * sizeof(T));
+		if (!pBlock) {
+			throw std::bad_alloc();
+		}
+		return static_cast<T *>(pBlock);
+	}
+	void deallocate(T *p, size_t count) noexcept
+	{
+		m_Pool->Free(p, count * sizeof(T));
+	}
+
+	template <typename U>
+	bool operator==(const BlockPoolAllocator<U> &other) const noexcept { return m_Pool == other.m_Pool; }
+	template <typename U>
+	bool operator!=(const BlockPoolAllocator<U> &other) const noexcept { return m_Pool != other.m_Pool; }
+
+private:
+	template <typename U>
+	friend class BlockPoolAllocator;
+	std::shared_ptr<BlockPool> m_Pool;
+};
@@ -0,0 +1,106 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+/// <summary>
+/// Fixed capacity, lock-free queue for any number of producer threads and a single consumer thread.
+/// Each slot carries a sequence number that tells producers and the consumer whose turn it is, so items are written and read in place without locks or allocations.
+/// When the queue is full, pushes fail instead of blocking, leaving it to the caller to drop or retry.
+/// </summary>
+template <typename T>
+class BoundedMpscQueue
+{
+public:
+	/// <summary>
+	/// Creates a queue holding at least the given number of items, rounded up to a power of two.
+	/// </summary>
+	explicit BoundedMpscQueue(size_t minimumCapacity) :
+		m_EnqueuePos(0),
+		m_DequeuePos(0)
+	{
+		size_t capacity = 2;
+		while (capacity < minimumCapacity) {
+			capacity <<= 1;
+		}
+		m_Capacity = capacity;
+		m_Mask = capacity - 1;
+		m_Cells.reset(new CELL[capacity]);
+		for (size_t i = 0; i < capacity; i++) {
+			m_Cells[i].Sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+	BoundedMpscQueue(const BoundedMpscQueue &) = delete;
+	BoundedMpscQueue &operator=(const BoundedMpscQueue &) = delete;
+
+	inline size_t Capacity() const { return m_Capacity; }
+
+	/// <summary>
+	/// Approximate number of queued items. Exact only when no other thread is pushing or popping.
+	/// </summary>
+	inline size_t ApproximateSize() const {
+		size_t enqueuePos = m_EnqueuePos.load(std::memory_order_relaxed);
+		size_t dequeuePos = m_DequeuePos.load(std::memory_order_relaxed);
+		return enqueuePos > dequeuePos ? enqueuePos - dequeuePos : 0;
+	}
+
+	/// <summary>
+	/// Claims a free slot and fills it in place by calling writeItem(T&). Safe to call from any thread.
+	/// </summary>
+	/// <returns>false if the queue is full, in which case writeItem is not called</returns>
+	template <typename TWriter>
+	bool TryPush(TWriter &&writeItem) {
+		CELL *pCell;
+		size_t pos = m_EnqueuePos.load(std::memory_order_relaxed);
+		for (;;) {
+			pCell = &m_Cells[pos & m_Mask];
+			size_t sequence = pCell->Sequence.load(std::memory_order_acquire);
+			intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+			if (diff == 0) {
+				if (m_EnqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					break;
+				}
+			}
+			else if (diff < 0) {
+				//The consumer has not yet freed this slot since the last lap, so the queue is full.
+				return false;
+			}
+			else {
+				pos = m_EnqueuePos.load(std::memory_order_relaxed);
+			}
+		}
+		writeItem(pCell->Item);
+		pCell->Sequence.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	/// <summary>
+	/// Reads the oldest item in place by calling readItem(T&), then frees its slot. Must only be called from the consumer thread.
+	/// </summary>
+	/// <returns>false if the queue is empty, or the oldest slot is still being written by a producer</returns>
+	template <typename TReader>
+	bool TryPop(TReader &&readItem) {
+		size_t pos = m_DequeuePos.load(std::memory_order_relaxed);
+		CELL *pCell = &m_Cells[pos & m_Mask];
+		size_t sequence = pCell->Sequence.load(std::memory_order_acquire);
+		if ((intptr_t)sequence - (intptr_t)(pos + 1) < 0) {
+			return false;
+		}
+		readItem(pCell->Item);
+		pCell->Sequence.store(pos + m_Mask + 1, std::memory_order_release);
+		m_DequeuePos.store(pos + 1, std::memory_order_relaxed);
+		return true;
+	}
+
+private:
+	struct CELL {
+		std::atomic<size_t> Sequence;
+		T Item;
+	};
+	std::unique_ptr<CELL[]> m_Cells;
+	size_t m_Capacity;
+	size_t m_Mask;
+	alignas(64) std::atomic<size_t> m_EnqueuePos;
+	alignas(64) std::atomic<size_t> m_DequeuePos;
+};
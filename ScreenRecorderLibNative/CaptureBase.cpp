@@ -54,6 +54,11 @@ SIZE CaptureBase::GetContentOffset(_In_ ContentAnchor anchor, _In_ RECT parentRe
 	return SIZE{ leftMargin,topMargin };
 }
 
+void CaptureBase::GetUpdatedRegion(_In_ RECT sourceRect, _Inout_ DirtyRegion *pRegion)
+{
+	pRegion->Add(sourceRect);
+}
+
 HRESULT CaptureBase::SendBitmapCallback(_In_ ID3D11Texture2D *pTexture) {
 	HRESULT hr = S_FALSE;
 	CComPtr< ID3D11Texture2D> pProcessedTexture = nullptr;
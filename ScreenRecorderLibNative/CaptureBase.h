@@ -15,6 +15,19 @@ public:
 	virtual std::wstring Name() abstract;
 	virtual HRESULT SendBitmapCallback(_In_ ID3D11Texture2D *pTexture);
 	/// <summary>
+	/// Gets an event that is signaled when the source has a new frame, so the capture thread can wait for it together with other events.
+	/// After the event is signaled, AcquireNextFrame returns the frame without waiting.
+	/// </summary>
+	/// <returns>The event, or nullptr if the frames of the source can only be waited for with AcquireNextFrame</returns>
+	virtual HANDLE GetFrameArrivedEvent() { return nullptr; }
+	/// <summary>
+	/// Adds the area of the shared surface changed by the last successful call to WriteNextFrameToSharedSurface to a region.
+	/// Captures that do not track changes report the whole area of the source.
+	/// </summary>
+	/// <param name="sourceRect">The area of the shared surface the source is drawn to</param>
+	/// <param name="pRegion">The region to add the changed area to</param>
+	virtual void GetUpdatedRegion(_In_ RECT sourceRect, _Inout_ DirtyRegion *pRegion);
+	/// <summary>
 	/// Calculate the offset used to position the content withing the parent frame based on the given anchor.
 	/// </summary>
 	/// <param name="anchor"></param>
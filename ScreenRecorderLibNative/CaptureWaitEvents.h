@@ -0,0 +1,50 @@
+#pragma once
+#include "CaptureWaitScheduler.h"
+#include "Log.h"
+#include <windows.h>
+
+/// <summary>
+/// Waits for Win32 event handles, one for each capture wake reason. The events are owned by the caller, and may be null if the signal is not available.
+/// </summary>
+class EventCaptureWaitBackend : public ICaptureWaitBackend
+{
+public:
+	EventCaptureWaitBackend(_In_opt_ HANDLE hTerminateEvent, _In_opt_ HANDLE hOptionsChangedEvent, _In_opt_ HANDLE hFrameArrivedEvent) :
+		m_Events{ hTerminateEvent, hOptionsChangedEvent, hFrameArrivedEvent }
+	{
+	}
+
+	CaptureWakeReason Wait(uint32_t signalMask, int64_t timeoutMicros) override {
+		HANDLE handles[SIGNAL_COUNT];
+		CaptureWakeReason reasons[SIGNAL_COUNT];
+		DWORD count = 0;
+		for (size_t i = 0; i < SIGNAL_COUNT; i++) {
+			CaptureWakeReason reason = static_cast<CaptureWakeReason>(i);
+			if (m_Events[i] && (signalMask & GetCaptureWakeMask(reason))) {
+				handles[count] = m_Events[i];
+				reasons[count] = reason;
+				count++;
+			}
+		}
+		//Round up, so the thread does not wake up just before the time it asked for and wait again.
+		DWORD timeoutMillis = timeoutMicros > 0 ? static_cast<DWORD>((std::min)((timeoutMicros + 999) / 1000, (int64_t)INFINITE - 1)) : 0;
+		if (count == 0) {
+			Sleep(timeoutMillis);
+			return CaptureWakeReason::Deadline;
+		}
+		//WaitForMultipleObjects reports the lowest index of the signaled handles, so the wake reasons keep their priority.
+		DWORD result = WaitForMultipleObjects(count, handles, FALSE, timeoutMillis);
+		if (result >= WAIT_OBJECT_0 && result < WAIT_OBJECT_0 + count) {
+			return reasons[result - WAIT_OBJECT_0];
+		}
+		if (result != WAIT_TIMEOUT) {
+			LOG_ERROR(L"Failed to wait for capture events: last error is %u", GetLastError());
+			Sleep(timeoutMillis);
+		}
+		return CaptureWakeReason::Deadline;
+	}
+
+private:
+	static const size_t SIGNAL_COUNT = static_cast<size_t>(CaptureWakeReason::Deadline);
+	HANDLE m_Events[SIGNAL_COUNT];
+};
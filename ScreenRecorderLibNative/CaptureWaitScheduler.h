@@ -0,0 +1,271 @@
+#pragma once
+#include "RecordingMetrics.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
+//Capture threads wake up this long before a frame deadline, so a frame captured on waking is written to the shared canvas before the recorder takes it.
+#define CAPTURE_WAIT_DEFAULT_LEAD_MICROS 2000
+//Shortest wait until a deadline. A deadline closer than this is skipped in favor of the next one, so a thread never wakes up in a busy loop.
+#define CAPTURE_WAIT_DEFAULT_MIN_MICROS 1000
+//Longest wait before a capture thread wakes up to check its state, when the next frame deadline is further away or unknown.
+#define CAPTURE_WAIT_DEFAULT_MAX_MICROS 100000
+//Longest wait for a source that has nothing to capture until it is signaled, e.g. while its video capture is disabled.
+#define CAPTURE_WAIT_DEFAULT_IDLE_MICROS 500000
+
+/// <summary>
+/// What ended a wait of a capture thread. The signals are listed in priority order, so when several are set, the first one is reported.
+/// </summary>
+enum class CaptureWakeReason {
+	///<summary>The capture is stopping.</summary>
+	Terminate = 0,
+	///<summary>The options of the source were changed.</summary>
+	OptionsChanged,
+	///<summary>The source has a new frame.</summary>
+	FrameArrived,
+	///<summary>No signal was set before the wait timed out.</summary>
+	Deadline,
+	Count
+};
+
+inline uint32_t GetCaptureWakeMask(CaptureWakeReason reason) { return uint32_t(1) << (uint32_t)reason; }
+
+//The signals every capture thread must respond to while waiting.
+#define CAPTURE_WAKE_MASK_CONTROL (GetCaptureWakeMask(CaptureWakeReason::Terminate) | GetCaptureWakeMask(CaptureWakeReason::OptionsChanged))
+
+/// <summary>
+/// The signals a capture thread waits for, e.g. Win32 events.
+/// </summary>
+class ICaptureWaitBackend
+{
+public:
+	virtual ~ICaptureWaitBackend() {}
+	/// <summary>
+	/// Blocks until one of the signals in the mask is set, or the timeout elapses. Signals the backend does not have are ignored.
+	/// </summary>
+	/// <param name="timeoutMicros">The longest time to wait. If 0, the signals are only checked.</param>
+	/// <returns>The first set signal in the mask, or CaptureWakeReason::Deadline if none was set</returns>
+	virtual CaptureWakeReason Wait(uint32_t signalMask, int64_t timeoutMicros) = 0;
+	/// <summary>
+	/// The current time of the clock frame deadlines are given in, in microseconds.
+	/// </summary>
+	virtual int64_t GetTimeMicros()
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+};
+
+/// <summary>
+/// The deadline of the next frame of the recorder, shared with the capture threads so they can wake up in time for it.
+/// Deadlines that have passed are extrapolated with the frame interval until the recorder publishes a new one.
+/// </summary>
+class FrameDeadlineClock
+{
+public:
+	FrameDeadlineClock() :
+		m_Deadline(0),
+		m_Interval(0)
+	{
+	}
+	FrameDeadlineClock(const FrameDeadlineClock &) = delete;
+	FrameDeadlineClock &operator=(const FrameDeadlineClock &) = delete;
+
+	/// <summary>
+	/// Publishes the time of the next frame, and the interval between frames, in microseconds of the clock used by the capture threads.
+	/// The two values are not updated together, so a reader may briefly combine a new deadline with the previous interval.
+	/// </summary>
+	void SetNextDeadline(int64_t deadlineMicros, int64_t intervalMicros)
+	{
+		m_Interval.store(intervalMicros, std::memory_order_relaxed);
+		m_Deadline.store(deadlineMicros, std::memory_order_release);
+	}
+
+	/// <summary>
+	/// Gets the first frame deadline after the given time.
+	/// </summary>
+	/// <returns>The deadline in microseconds, or INT64_MAX if no deadline is known</returns>
+	int64_t GetNextDeadline(int64_t timeMicros) const
+	{
+		int64_t deadline = m_Deadline.load(std::memory_order_acquire);
+		int64_t interval = m_Interval.load(std::memory_order_relaxed);
+		if (deadline > timeMicros) {
+			return deadline;
+		}
+		if (deadline == 0 || interval <= 0) {
+			return INT64_MAX;
+		}
+		return deadline + ((timeMicros - deadline) / interval + 1) * interval;
+	}
+
+	void Reset()
+	{
+		m_Deadline.store(0, std::memory_order_relaxed);
+		m_Interval.store(0, std::memory_order_relaxed);
+	}
+
+private:
+	std::atomic<int64_t> m_Deadline;
+	std::atomic<int64_t> m_Interval;
+};
+
+struct CAPTURE_WAIT_STATS {
+	//Times the thread woke up from a blocking wait, for each reason.
+	uint64_t Wakeups[(size_t)CaptureWakeReason::Count] = {};
+	//Frames written after waking up for them.
+	uint64_t CopiedFrames = 0;
+	//Summed and largest time from waking up for a frame until it was written, in microseconds.
+	int64_t TotalWakeToCopyMicros = 0;
+	int64_t MaxWakeToCopyMicros = 0;
+	//Time since the scheduler was created, in microseconds.
+	int64_t ElapsedMicros = 0;
+
+	inline uint64_t GetTotalWakeups() const
+	{
+		uint64_t total = 0;
+		for (uint64_t count : Wakeups) {
+			total += count;
+		}
+		return total;
+	}
+	inline double GetWakeupsPerSecond() const { return ElapsedMicros > 0 ? GetTotalWakeups() * 1000000.0 / ElapsedMicros : 0; }
+	inline double GetMeanWakeToCopyMillis() const { return CopiedFrames > 0 ? TotalWakeToCopyMicros / 1000.0 / CopiedFrames : 0; }
+};
+
+/// <summary>
+/// Decides how long a capture thread sleeps, so it blocks on all the signals it cares about at once instead of polling them,
+/// and never waits past the point where it must wake up for the next frame of the recorder.
+/// Counts the wakeups and the time from waking up for a frame until the frame is written, and adds them to the recording metrics.
+/// Not thread safe. Each capture thread has its own scheduler.
+/// </summary>
+class CaptureWaitScheduler
+{
+public:
+	CaptureWaitScheduler(
+		std::unique_ptr<ICaptureWaitBackend> backend,
+		const FrameDeadlineClock *pDeadlineClock,
+		RecordingMetrics *pMetrics = nullptr,
+		int64_t leadMicros = CAPTURE_WAIT_DEFAULT_LEAD_MICROS,
+		int64_t minWaitMicros = CAPTURE_WAIT_DEFAULT_MIN_MICROS,
+		int64_t maxWaitMicros = CAPTURE_WAIT_DEFAULT_MAX_MICROS,
+		int64_t idleWaitMicros = CAPTURE_WAIT_DEFAULT_IDLE_MICROS) :
+		m_Backend(std::move(backend)),
+		m_DeadlineClock(pDeadlineClock),
+		m_Metrics(pMetrics),
+		m_LeadMicros(leadMicros),
+		m_MinWaitMicros(minWaitMicros),
+		m_MaxWaitMicros(maxWaitMicros),
+		m_IdleWaitMicros(idleWaitMicros),
+		m_FrameWakeTime(-1),
+		m_Stats{}
+	{
+		m_StartTime = m_Backend->GetTimeMicros();
+	}
+	CaptureWaitScheduler(const CaptureWaitScheduler &) = delete;
+	CaptureWaitScheduler &operator=(const CaptureWaitScheduler &) = delete;
+
+	/// <summary>
+	/// Waits for the signals in the mask, until shortly before the next frame deadline at most.
+	/// </summary>
+	CaptureWakeReason WaitUntilDeadline(uint32_t signalMask)
+	{
+		return Wait(signalMask, GetTimeoutMicros());
+	}
+
+	/// <summary>
+	/// Waits for the signals in the mask, ignoring frame deadlines. Used when the source has nothing to capture until it is signaled.
+	/// </summary>
+	CaptureWakeReason WaitIdle(uint32_t signalMask)
+	{
+		return Wait(signalMask, m_IdleWaitMicros);
+	}
+
+	/// <summary>
+	/// Checks the signals in the mask without blocking. Not counted as a wakeup.
+	/// </summary>
+	CaptureWakeReason Poll(uint32_t signalMask)
+	{
+		return m_Backend->Wait(signalMask, 0);
+	}
+
+	/// <summary>
+	/// Gets the time until the thread should wake up for the next frame deadline, bounded by the minimum and maximum wait.
+	/// Used directly as the timeout of blocking calls that cannot wait on the signals, e.g. the DXGI AcquireNextFrame, followed by a call to OnWake.
+	/// </summary>
+	int64_t GetTimeoutMicros()
+	{
+		int64_t now = m_Backend->GetTimeMicros();
+		int64_t deadline = m_DeadlineClock ? m_DeadlineClock->GetNextDeadline(now + m_LeadMicros + m_MinWaitMicros) : INT64_MAX;
+		if (deadline == INT64_MAX) {
+			return m_MaxWaitMicros;
+		}
+		return (std::min)(m_MaxWaitMicros, (std::max)(m_MinWaitMicros, deadline - m_LeadMicros - now));
+	}
+
+	/// <summary>
+	/// Counts a wakeup from a blocking call made outside the scheduler.
+	/// </summary>
+	void OnWake(CaptureWakeReason reason)
+	{
+		OnWake(reason, m_Backend->GetTimeMicros());
+	}
+
+	/// <summary>
+	/// Records the time since the thread last woke up for a frame, when the frame has been written.
+	/// </summary>
+	/// <returns>The time from waking up to writing the frame in microseconds, or -1 if the thread has not woken up for a frame since the last call</returns>
+	int64_t OnFrameCopied()
+	{
+		if (m_FrameWakeTime < 0) {
+			return -1;
+		}
+		int64_t latency = (std::max)((int64_t)0, m_Backend->GetTimeMicros() - m_FrameWakeTime);
+		m_FrameWakeTime = -1;
+		m_Stats.CopiedFrames++;
+		m_Stats.TotalWakeToCopyMicros += latency;
+		m_Stats.MaxWakeToCopyMicros = (std::max)(m_Stats.MaxWakeToCopyMicros, latency);
+		if (m_Metrics) {
+			m_Metrics->Record(RecordingTimer::CaptureWakeToCopy, latency * 10);
+		}
+		return latency;
+	}
+
+	CAPTURE_WAIT_STATS GetStats()
+	{
+		CAPTURE_WAIT_STATS stats = m_Stats;
+		stats.ElapsedMicros = m_Backend->GetTimeMicros() - m_StartTime;
+		return stats;
+	}
+
+private:
+	std::unique_ptr<ICaptureWaitBackend> m_Backend;
+	const FrameDeadlineClock *m_DeadlineClock;
+	RecordingMetrics *m_Metrics;
+	int64_t m_LeadMicros;
+	int64_t m_MinWaitMicros;
+	int64_t m_MaxWaitMicros;
+	int64_t m_IdleWaitMicros;
+	int64_t m_StartTime;
+	//When the thread last woke up for a frame that has not been written yet, or -1.
+	int64_t m_FrameWakeTime;
+	CAPTURE_WAIT_STATS m_Stats;
+
+	CaptureWakeReason Wait(uint32_t signalMask, int64_t timeoutMicros)
+	{
+		CaptureWakeReason reason = m_Backend->Wait(signalMask, timeoutMicros);
+		OnWake(reason, m_Backend->GetTimeMicros());
+		return reason;
+	}
+
+	void OnWake(CaptureWakeReason reason, int64_t time)
+	{
+		m_Stats.Wakeups[(size_t)reason]++;
+		if (m_Metrics) {
+			m_Metrics->Increment(RecordingCounter::CaptureWakeups);
+		}
+		if (reason == CaptureWakeReason::FrameArrived) {
+			m_FrameWakeTime = time;
+		}
+	}
+};
@@ -9,9 +9,14 @@
 #include <codecapi.h>
 #include <mfapi.h>
 #include <optional>
+#include <memory>
 #include <wincodec.h>
 #include <chrono>
 #include "util.h"
+#include "FramePipeline.h"
+#include "DirtyRegion.h"
+#include "CaptureWaitScheduler.h"
+#include "TripleBufferedCanvas.h"
 
 typedef void(__stdcall *CallbackNewFrameDataFunction)(int, byte *, int, int, int);
 
@@ -165,6 +170,10 @@ struct CAPTURED_FRAME
 	std::optional<PTR_INFO> PtrInfo;
 	//The number of updates written to the current frame since last fetch.
 	int FrameUpdateCount;
+	//The area of the frame that changed since the last fetch. Empty if the frame is identical to the previous one.
+	DirtyRegion UpdatedRegion;
+	//The performance counter value when the frame was acquired. Updates written after it count towards the next frame.
+	INT64 AcquiredTimeStamp;
 };
 
 enum class RecorderModeInternal {
@@ -191,6 +200,13 @@ enum class TextureStretchMode {
 	UniformToFill
 };
 
+enum class AudioResamplerType {
+	///<summary>The Media Foundation audio resampler DSP.</summary>
+	MediaFoundation = 0,
+	///<summary>The built-in polyphase resampler, which converts in place without going through Media Foundation samples.</summary>
+	Polyphase = 1
+};
+
 enum class ContentAnchor {
 	TopLeft,
 	TopRight,
@@ -383,14 +399,21 @@ struct RECORDING_SOURCE_DATA {
 //
 struct THREAD_DATA_BASE
 {
-	////Handle to shared surface texture
-	HANDLE CanvasTexSharedHandle{ nullptr };
 	// Used to signal an error in the ongoing capture
 	HANDLE ErrorEvent{};
 	// Used to signal capture has started
 	HANDLE StartedEvent{};
 	// Used by WinProc to signal to threads to exit
 	HANDLE TerminateThreadsEvent{};
+	// Signaled when the options of the recording source or overlay are changed
+	HANDLE OptionsChangedEvent{};
+	// Signaled when the thread has written a frame, to wake up the recorder
+	HANDLE FrameWrittenEvent{};
+	// The time of the next frame of the recorder, so the thread can wake up in time for it
+	const FrameDeadlineClock *FrameDeadline{ nullptr };
+	RecordingMetrics *Metrics{ nullptr };
+	// The most bytes the decoded frames of GIF sources and overlays may hold, from OUTPUT_OPTIONS
+	UINT64 GifFrameCacheMaxBytes{};
 	LARGE_INTEGER LastUpdateTimeStamp{};
 	CAPTURE_RESULT *ThreadResult{ };
 };
@@ -403,6 +426,11 @@ struct CAPTURE_THREAD_DATA :THREAD_DATA_BASE
 	RECORDING_SOURCE_DATA *RecordingSource{ nullptr };
 	INT64 TotalUpdatedFrameCount{};
 	PTR_INFO *PtrInfo{ nullptr };
+	// Guards PtrInfo, which is shared with the recorder and the other capture threads
+	CRITICAL_SECTION *PtrInfoCriticalSection{ nullptr };
+	// The canvas all capture threads draw into, and the handles to its shared buffer textures
+	TripleBufferedCanvas *Canvas{ nullptr };
+	HANDLE CanvasBufferSharedHandles[CANVAS_BUFFER_COUNT]{};
 };
 
 //
@@ -472,6 +500,7 @@ protected:
 	UINT32 m_AudioChannels = 2; //Number of audio channels. 1,2 and 6 is supported. 6 only on windows 8 and up.
 	float m_OutputVolumeModifier = 1;
 	float m_InputVolumeModifier = 1;
+	AudioResamplerType m_ResamplerType = AudioResamplerType::MediaFoundation;
 
 	void Notify(HANDLE h) {
 		SetEvent(h);
@@ -493,6 +522,7 @@ public:
 	void SetAudioEnabled(bool value) { m_IsAudioEnabled = value; Notify(OnPropertyChangedEvent); }
 	void SetOutputDeviceEnabled(bool value) { m_IsOutputDeviceEnabled = value; Notify(OnPropertyChangedEvent); }
 	void SetInputDeviceEnabled(bool value) { m_IsInputDeviceEnabled = value; Notify(OnPropertyChangedEvent); }
+	void SetResamplerType(AudioResamplerType type) { m_ResamplerType = type; }
 
 	std::wstring GetAudioOutputDevice() { return m_AudioOutputDevice; }
 	std::wstring GetAudioInputDevice() { return m_AudioInputDevice; }
@@ -503,6 +533,7 @@ public:
 	float GetInputVolume() { return m_InputVolumeModifier; }
 	bool IsOutputDeviceEnabled() { return m_IsOutputDeviceEnabled; }
 	bool IsInputDeviceEnabled() { return m_IsInputDeviceEnabled; }
+	AudioResamplerType GetResamplerType() { return m_ResamplerType; }
 	GUID GetAudioEncoderFormat() { return AUDIO_ENCODING_FORMAT; }
 	UINT32 GetAudioBitsPerSample() { return AUDIO_BITS_PER_SAMPLE; }
 	UINT32 GetAudioSamplesPerSecond() { return AUDIO_SAMPLES_PER_SECOND; }
@@ -517,6 +548,11 @@ protected:
 	bool m_IsVideoCaptureEnabled = true;
 	bool m_IsVideoFramePreviewEnabled = false;
 	std::optional<SIZE> m_VideoFramePreviewSize{};
+	std::chrono::milliseconds m_SegmentDuration = std::chrono::milliseconds(0);//Start a new output file after this duration. 0 to disable.
+	UINT64 m_SegmentMaxBytes = 0;//Start a new output file after this many bytes. 0 to disable.
+	std::chrono::milliseconds m_ReplayBufferDuration = std::chrono::milliseconds(0);//Keep this much of the encoded recording in memory while it is written to the output, so it can be saved on request. 0 to disable.
+	UINT64 m_ReplayBufferMaxBytes = 0;//The most bytes the replay buffer keeps. 0 for no limit.
+	UINT64 m_GifFrameCacheMaxBytes = 0;//The most bytes the decoded frames of animated GIFs may hold, so looping GIFs are decoded only once. 0 to decode GIF frames as they are shown.
 public:
 	std::optional<SIZE> GetFrameSize() { return m_FrameSize; }
 	void SetFrameSize(SIZE size) { m_FrameSize = size; }
@@ -532,6 +568,18 @@ public:
 	void SetVideoFramePreviewSize(SIZE value) { m_VideoFramePreviewSize = value; }
 	bool IsVideoFramePreviewEnabled() { return m_IsVideoFramePreviewEnabled; }
 	std::optional<SIZE> GetVideoFramePreviewSize() { return m_VideoFramePreviewSize; }
+	void SetSegmentDuration(std::chrono::milliseconds duration) { m_SegmentDuration = duration; }
+	std::chrono::milliseconds GetSegmentDuration() { return m_SegmentDuration; }
+	void SetSegmentMaxBytes(UINT64 bytes) { m_SegmentMaxBytes = bytes; }
+	UINT64 GetSegmentMaxBytes() { return m_SegmentMaxBytes; }
+	bool IsSegmentingEnabled() { return m_SegmentDuration.count() > 0 || m_SegmentMaxBytes > 0; }
+	void SetReplayBufferDuration(std::chrono::milliseconds duration) { m_ReplayBufferDuration = duration; }
+	std::chrono::milliseconds GetReplayBufferDuration() { return m_ReplayBufferDuration; }
+	void SetReplayBufferMaxBytes(UINT64 bytes) { m_ReplayBufferMaxBytes = bytes; }
+	UINT64 GetReplayBufferMaxBytes() { return m_ReplayBufferMaxBytes; }
+	bool IsReplayBufferEnabled() { return m_ReplayBufferDuration.count() > 0 || m_ReplayBufferMaxBytes > 0; }
+	void SetGifFrameCacheMaxBytes(UINT64 bytes) { m_GifFrameCacheMaxBytes = bytes; }
+	UINT64 GetGifFrameCacheMaxBytes() { return m_GifFrameCacheMaxBytes; }
 };
 
 struct ENCODER_OPTIONS abstract {
@@ -549,6 +597,9 @@ protected:
 	bool m_IsHardwareEncodingEnabled = true;
 	UINT32 m_VideoBitrateControlMode = eAVEncCommonRateControlMode_Quality;
 	UINT32 m_EncoderProfile = eAVEncH264VProfile_High;
+	UINT32 m_FramePoolSize = 4;//Number of idle encoder input textures kept for reuse.
+	UINT32 m_FrameQueueSize = 3;//Number of frames that can be queued between each stage of the recording pipeline.
+	PipelineDropPolicy m_FrameDropPolicy = PipelineDropPolicy::DropOldest;//What to do with new frames when the pipeline is full.
 public:
 	void SetVideoFps(UINT32 fps) { m_VideoFps = fps; }
 	void SetVideoBitrate(UINT32 bitrate) { m_VideoBitrate = bitrate; }
@@ -561,6 +612,9 @@ public:
 	void SetLowLatencyModeEnabled(bool value) { m_IsLowLatencyModeEnabled = value; }
 	void SetVideoBitrateMode(UINT32 bitrateMode) { m_VideoBitrateControlMode = bitrateMode; }
 	void SetEncoderProfile(UINT32 profile) { m_EncoderProfile = profile; }
+	void SetFramePoolSize(UINT32 size) { m_FramePoolSize = size; }
+	void SetFrameQueueSize(UINT32 size) { m_FrameQueueSize = size; }
+	void SetFrameDropPolicy(PipelineDropPolicy policy) { m_FrameDropPolicy = policy; }
 
 	UINT32 GetVideoFps() { return m_VideoFps; }
 	UINT32 GetVideoBitrate() { return m_VideoBitrate; }
@@ -573,6 +627,9 @@ public:
 	bool GetIsLowLatencyModeEnabled() { return m_IsLowLatencyModeEnabled; }
 	UINT32 GetVideoBitrateMode() { return m_VideoBitrateControlMode; }
 	UINT32 GetEncoderProfile() { return m_EncoderProfile; }
+	UINT32 GetFramePoolSize() { return m_FramePoolSize; }
+	UINT32 GetFrameQueueSize() { return m_FrameQueueSize; }
+	PipelineDropPolicy GetFrameDropPolicy() { return m_FrameDropPolicy; }
 
 	virtual GUID GetVideoEncoderFormat() abstract;
 	virtual std::wstring GetVideoExtension() {
@@ -596,17 +653,32 @@ public:
 	virtual GUID GetVideoEncoderFormat() override { return MFVideoFormat_HEVC; }
 };
 
+//
+// An additional video output, encoding the same frames and audio as the main output, e.g. a low bitrate copy next to a full resolution recording.
+//
+struct RECORDING_OUTPUT {
+	//The path of the output file.
+	std::wstring Path;
+	//The encoder settings of the output. The frame rate is taken from the main output, as the frames are shared with it.
+	std::shared_ptr<ENCODER_OPTIONS> EncoderOptions;
+	//The frame size and stretch mode of the output. If no frame size is set, the frame size of the main output is used.
+	//The frames are resized from the composed frames of the main output, so a frame size larger than that of the main output only scales them up.
+	std::shared_ptr<OUTPUT_OPTIONS> OutputOptions;
+};
+
 struct SNAPSHOT_OPTIONS {
 protected:
 	std::wstring m_OutputSnapshotsFolderPath = L"";
 	std::chrono::milliseconds m_SnapshotsInterval = std::chrono::milliseconds(10000);
 	bool m_TakesSnapshotsWithVideo = false;
 	GUID m_ImageEncoderFormat = GUID_ContainerFormatPng;
+	bool m_IsBuiltInEncoderEnabled = false;
 public:
 	void SetTakeSnapshotsWithVideo(bool isEnabled) { m_TakesSnapshotsWithVideo = isEnabled; }
 	void SetSnapshotsWithVideoInterval(UINT32 value) { m_SnapshotsInterval = std::chrono::milliseconds(value); }
 	void SetSnapshotDirectory(std::wstring string) { m_OutputSnapshotsFolderPath = string; }
 	void SetSnapshotSaveFormat(GUID value) { m_ImageEncoderFormat = value; }
+	void SetIsBuiltInEncoderEnabled(bool isEnabled) { m_IsBuiltInEncoderEnabled = isEnabled; }
 
 	bool IsSnapshotWithVideoEnabled() {
 		return m_TakesSnapshotsWithVideo;
@@ -620,6 +692,12 @@ public:
 	GUID GetSnapshotEncoderFormat() {
 		return m_ImageEncoderFormat;
 	}
+	/// <summary>
+	/// Whether PNG and JPEG snapshots taken during a recording are encoded by the built-in parallel encoders instead of WIC.
+	/// </summary>
+	bool IsBuiltInEncoderEnabled() {
+		return m_IsBuiltInEncoderEnabled;
+	}
 
 
 	std::wstring GetImageExtension() {
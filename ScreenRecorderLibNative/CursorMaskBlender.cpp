@@ -0,0 +1,352 @@
+#include "CursorMaskBlender.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CURSOR_MASK_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+//MSVC allows AVX2 intrinsics in any function, the kernel is only called after checking CPU support.
+#define CURSOR_MASK_TARGET_AVX2
+#else
+#include <cpuid.h>
+#define CURSOR_MASK_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#elif defined(_M_ARM64) || defined(__aarch64__)
+//NEON is part of every ARM64 CPU.
+#define CURSOR_MASK_NEON
+#include <arm_neon.h>
+#endif
+
+namespace {
+	const uint32_t TRANSPARENT_WHITE = 0x00FFFFFF;
+	const uint32_t TRANSPARENT_BLACK = 0x00000000;
+	const uint32_t OPAQUE_WHITE = 0xFFFFFFFF;
+	const uint32_t OPAQUE_BLACK = 0xFF000000;
+
+	typedef void(*MonochromeRowFunc)(const uint8_t *pAndRow, const uint8_t *pXorRow, uint32_t rowBytes, uint32_t firstBit, const uint32_t *pBackground, uint32_t *pOutput, uint32_t count);
+	typedef void(*MaskedColorRowFunc)(const uint32_t *pShape, const uint32_t *pBackground, uint32_t *pOutput, uint32_t count);
+
+	/// <summary>
+	/// Gets the 8 mask bits starting at the given bit of the row, the first in the highest bit. Bits past the end of the row are zero.
+	/// </summary>
+	inline uint32_t GetMaskBits(const uint8_t *pRow, uint32_t rowBytes, uint32_t bit) {
+		uint32_t index = bit / 8;
+		uint32_t shift = bit % 8;
+		uint32_t bits = static_cast<uint32_t>(pRow[index]) << shift;
+		if (shift > 0 && index + 1 < rowBytes) {
+			bits |= pRow[index + 1] >> (8 - shift);
+		}
+		return bits & 0xFF;
+	}
+
+#pragma region Scalar
+	void BlendMonochromeRowScalar(const uint8_t *pAndRow, const uint8_t *pXorRow, uint32_t /*rowBytes*/, uint32_t firstBit, const uint32_t *pBackground, uint32_t *pOutput, uint32_t count) {
+		uint8_t mask = static_cast<uint8_t>(0x80 >> (firstBit % 8));
+		for (uint32_t col = 0; col < count; col++) {
+			uint8_t andBit = pAndRow[(col + firstBit) / 8] & mask;
+			uint8_t xorBit = pXorRow[(col + firstBit) / 8] & mask;
+			uint32_t andMask32 = andBit ? OPAQUE_WHITE : OPAQUE_BLACK;
+			uint32_t xorMask32 = xorBit ? TRANSPARENT_WHITE : TRANSPARENT_BLACK;
+			if (andBit && !xorBit) {
+				pOutput[col] = TRANSPARENT_WHITE;
+			}
+			else {
+				pOutput[col] = (pBackground[col] & andMask32) ^ xorMask32;
+			}
+			mask = mask == 0x01 ? 0x80 : mask >> 1;
+		}
+	}
+
+	void BlendMaskedColorRowScalar(const uint32_t *pShape, const uint32_t *pBackground, uint32_t *pOutput, uint32_t count) {
+		for (uint32_t col = 0; col < count; col++) {
+			uint32_t rgbValue = pShape[col];
+			uint32_t maskValue = OPAQUE_BLACK & rgbValue;
+			if (maskValue) {
+				pOutput[col] = rgbValue == maskValue ? TRANSPARENT_WHITE : (pBackground[col] ^ rgbValue) | OPAQUE_BLACK;
+			}
+			else {
+				pOutput[col] = rgbValue | OPAQUE_BLACK;
+			}
+		}
+	}
+#pragma endregion
+
+#ifdef CURSOR_MASK_X86
+#pragma region SSE2
+	/// <summary>
+	/// Expands mask bits to a lane mask, all ones in the lanes whose bit is set.
+	/// </summary>
+	inline __m128i ExpandMaskBitsSSE2(uint32_t bits, __m128i laneBits) {
+		return _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(static_cast<int>(bits)), laneBits), laneBits);
+	}
+
+	inline __m128i BlendMonochromeSSE2(__m128i background, __m128i andMask, __m128i xorMask) {
+		const __m128i opaqueBlack = _mm_set1_epi32(static_cast<int>(OPAQUE_BLACK));
+		const __m128i transparentWhite = _mm_set1_epi32(static_cast<int>(TRANSPARENT_WHITE));
+		__m128i pixel = _mm_xor_si128(_mm_and_si128(background, _mm_or_si128(andMask, opaqueBlack)), _mm_and_si128(xorMask, transparentWhite));
+		__m128i isTransparent = _mm_andnot_si128(xorMask, andMask);
+		return _mm_or_si128(_mm_and_si128(isTransparent, transparentWhite), _mm_andnot_si128(isTransparent, pixel));
+	}
+
+	void BlendMonochromeRowSSE2(const uint8_t *pAndRow, const uint8_t *pXorRow, uint32_t rowBytes, uint32_t firstBit, const uint32_t *pBackground, uint32_t *pOutput, uint32_t count) {
+		const __m128i loBits = _mm_setr_epi32(0x80, 0x40, 0x20, 0x10);
+		const __m128i hiBits = _mm_setr_epi32(0x08, 0x04, 0x02, 0x01);
+		uint32_t i = 0;
+		for (; i + 8 <= count; i += 8) {
+			uint32_t andBits = GetMaskBits(pAndRow, rowBytes, firstBit + i);
+			uint32_t xorBits = GetMaskBits(pXorRow, rowBytes, firstBit + i);
+			__m128i lo = BlendMonochromeSSE2(_mm_loadu_si128(reinterpret_cast<const __m128i *>(pBackground + i)), ExpandMaskBitsSSE2(andBits, loBits), ExpandMaskBitsSSE2(xorBits, loBits));
+			__m128i hi = BlendMonochromeSSE2(_mm_loadu_si128(reinterpret_cast<const __m128i *>(pBackground + i + 4)), ExpandMaskBitsSSE2(andBits, hiBits), ExpandMaskBitsSSE2(xorBits, hiBits));
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(pOutput + i), lo);
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(pOutput + i + 4), hi);
+		}
+		BlendMonochromeRowScalar(pAndRow, pXorRow, rowBytes, firstBit + i, pBackground + i, pOutput + i, count - i);
+	}
+
+	void BlendMaskedColorRowSSE2(const uint32_t *pShape, const uint32_t *pBackground, uint32_t *pOutput, uint32_t count) {
+		const __m128i opaqueBlack = _mm_set1_epi32(static_cast<int>(OPAQUE_BLACK));
+		const __m128i transparentWhite = _mm_set1_epi32(static_cast<int>(TRANSPARENT_WHITE));
+		const __m128i zero = _mm_setzero_si128();
+		uint32_t i = 0;
+		for (; i + 4 <= count; i += 4) {
+			__m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pShape + i));
+			__m128i background = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pBackground + i));
+			__m128i hasNoMask = _mm_cmpeq_epi32(_mm_and_si128(value, opaqueBlack), zero);
+			__m128i isMaskOnly = _mm_cmpeq_epi32(value, opaqueBlack);
+			__m128i xorPixel = _mm_or_si128(_mm_xor_si128(background, value), opaqueBlack);
+			__m128i maskedPixel = _mm_or_si128(_mm_and_si128(isMaskOnly, transparentWhite), _mm_andnot_si128(isMaskOnly, xorPixel));
+			__m128i pixel = _mm_or_si128(_mm_and_si128(hasNoMask, _mm_or_si128(value, opaqueBlack)), _mm_andnot_si128(hasNoMask, maskedPixel));
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(pOutput + i), pixel);
+		}
+		BlendMaskedColorRowScalar(pShape + i, pBackground + i, pOutput + i, count - i);
+	}
+#pragma endregion
+
+#pragma region AVX2
+	CURSOR_MASK_TARGET_AVX2 inline __m256i ExpandMaskBitsAVX2(uint32_t bits, __m256i laneBits) {
+		return _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(static_cast<int>(bits)), laneBits), laneBits);
+	}
+
+	CURSOR_MASK_TARGET_AVX2 void BlendMonochromeRowAVX2(const uint8_t *pAndRow, const uint8_t *pXorRow, uint32_t rowBytes, uint32_t firstBit, const uint32_t *pBackground, uint32_t *pOutput, uint32_t count) {
+		const __m256i laneBits = _mm256_setr_epi32(0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01);
+		const __m256i opaqueBlack = _mm256_set1_epi32(static_cast<int>(OPAQUE_BLACK));
+		const __m256i transparentWhite = _mm256_set1_epi32(static_cast<int>(TRANSPARENT_WHITE));
+		uint32_t i = 0;
+		for (; i + 8 <= count; i += 8) {
+			__m256i andMask = ExpandMaskBitsAVX2(GetMaskBits(pAndRow, rowBytes, firstBit + i), laneBits);
+			__m256i xorMask = ExpandMaskBitsAVX2(GetMaskBits(pXorRow, rowBytes, firstBit + i), laneBits);
+			__m256i background = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pBackground + i));
+			__m256i pixel = _mm256_xor_si256(_mm256_and_si256(background, _mm256_or_si256(andMask, opaqueBlack)), _mm256_and_si256(xorMask, transparentWhite));
+			__m256i isTransparent = _mm256_andnot_si256(xorMask, andMask);
+			pixel = _mm256_blendv_epi8(pixel, transparentWhite, isTransparent);
+			_mm256_storeu_si256(reinterpret_cast<__m256i *>(pOutput + i), pixel);
+		}
+		BlendMonochromeRowScalar(pAndRow, pXorRow, rowBytes, firstBit + i, pBackground + i, pOutput + i, count - i);
+	}
+
+	CURSOR_MASK_TARGET_AVX2 void BlendMaskedColorRowAVX2(const uint32_t *pShape, const uint32_t *pBackground, uint32_t *pOutput, uint32_t count) {
+		const __m256i opaqueBlack = _mm256_set1_epi32(static_cast<int>(OPAQUE_BLACK));
+		const __m256i transparentWhite = _mm256_set1_epi32(static_cast<int>(TRANSPARENT_WHITE));
+		const __m256i zero = _mm256_setzero_si256();
+		uint32_t i = 0;
+		for (; i + 8 <= count; i += 8) {
+			__m256i value = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pShape + i));
+			__m256i background = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pBackground + i));
+			__m256i hasNoMask = _mm256_cmpeq_epi32(_mm256_and_si256(value, opaqueBlack), zero);
+			__m256i isMaskOnly = _mm256_cmpeq_epi32(value, opaqueBlack);
+			__m256i xorPixel = _mm256_or_si256(_mm256_xor_si256(background, value), opaqueBlack);
+			__m256i pixel = _mm256_blendv_epi8(xorPixel, transparentWhite, isMaskOnly);
+			pixel = _mm256_blendv_epi8(pixel, _mm256_or_si256(value, opaqueBlack), hasNoMask);
+			_mm256_storeu_si256(reinterpret_cast<__m256i *>(pOutput + i), pixel);
+		}
+		BlendMaskedColorRowScalar(pShape + i, pBackground + i, pOutput + i, count - i);
+	}
+#pragma endregion
+
+	bool IsAVX2Supported() {
+#if defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] < 7) {
+			return false;
+		}
+		__cpuid(info, 1);
+		bool osxsave = (info[2] & (1 << 27)) != 0;
+		bool avx = (info[2] & (1 << 28)) != 0;
+		if (!osxsave || !avx) {
+			return false;
+		}
+		//The OS must save the YMM registers on context switches.
+		if ((_xgetbv(0) & 0x6) != 0x6) {
+			return false;
+		}
+		__cpuidex(info, 7, 0);
+		return (info[1] & (1 << 5)) != 0;
+#else
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2");
+#endif
+	}
+
+	bool IsSSE2Supported() {
+#if defined(_M_X64) || defined(__x86_64__)
+		return true;
+#elif defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 1);
+		return (info[3] & (1 << 26)) != 0;
+#else
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("sse2");
+#endif
+	}
+#endif
+
+#ifdef CURSOR_MASK_NEON
+#pragma region NEON
+	const uint32_t NEON_LANE_BITS[8] = { 0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01 };
+
+	inline uint32x4_t BlendMonochromeNEON(uint32x4_t background, uint32x4_t andMask, uint32x4_t xorMask) {
+		const uint32x4_t opaqueBlack = vdupq_n_u32(OPAQUE_BLACK);
+		const uint32x4_t transparentWhite = vdupq_n_u32(TRANSPARENT_WHITE);
+		uint32x4_t pixel = veorq_u32(vandq_u32(background, vorrq_u32(andMask, opaqueBlack)), vandq_u32(xorMask, transparentWhite));
+		//vbic is a AND NOT b.
+		uint32x4_t isTransparent = vbicq_u32(andMask, xorMask);
+		return vbslq_u32(isTransparent, transparentWhite, pixel);
+	}
+
+	void BlendMonochromeRowNEON(const uint8_t *pAndRow, const uint8_t *pXorRow, uint32_t rowBytes, uint32_t firstBit, const uint32_t *pBackground, uint32_t *pOutput, uint32_t count) {
+		const uint32x4_t loBits = vld1q_u32(NEON_LANE_BITS);
+		const uint32x4_t hiBits = vld1q_u32(NEON_LANE_BITS + 4);
+		uint32_t i = 0;
+		for (; i + 8 <= count; i += 8) {
+			//vtst sets the lanes whose bit is set.
+			uint32x4_t andBits = vdupq_n_u32(GetMaskBits(pAndRow, rowBytes, firstBit + i));
+			uint32x4_t xorBits = vdupq_n_u32(GetMaskBits(pXorRow, rowBytes, firstBit + i));
+			uint32x4_t lo = BlendMonochromeNEON(vld1q_u32(pBackground + i), vtstq_u32(andBits, loBits), vtstq_u32(xorBits, loBits));
+			uint32x4_t hi = BlendMonochromeNEON(vld1q_u32(pBackground + i + 4), vtstq_u32(andBits, hiBits), vtstq_u32(xorBits, hiBits));
+			vst1q_u32(pOutput + i, lo);
+			vst1q_u32(pOutput + i + 4, hi);
+		}
+		BlendMonochromeRowScalar(pAndRow, pXorRow, rowBytes, firstBit + i, pBackground + i, pOutput + i, count - i);
+	}
+
+	void BlendMaskedColorRowNEON(const uint32_t *pShape, const uint32_t *pBackground, uint32_t *pOutput, uint32_t count) {
+		const uint32x4_t opaqueBlack = vdupq_n_u32(OPAQUE_BLACK);
+		const uint32x4_t transparentWhite = vdupq_n_u32(TRANSPARENT_WHITE);
+		uint32_t i = 0;
+		for (; i + 4 <= count; i += 4) {
+			uint32x4_t value = vld1q_u32(pShape + i);
+			uint32x4_t background = vld1q_u32(pBackground + i);
+			uint32x4_t hasMask = vtstq_u32(value, opaqueBlack);
+			uint32x4_t isMaskOnly = vceqq_u32(value, opaqueBlack);
+			uint32x4_t xorPixel = vorrq_u32(veorq_u32(background, value), opaqueBlack);
+			uint32x4_t maskedPixel = vbslq_u32(isMaskOnly, transparentWhite, xorPixel);
+			vst1q_u32(pOutput + i, vbslq_u32(hasMask, maskedPixel, vorrq_u32(value, opaqueBlack)));
+		}
+		BlendMaskedColorRowScalar(pShape + i, pBackground + i, pOutput + i, count - i);
+	}
+#pragma endregion
+#endif
+
+	CursorMaskBlender::Kernel DetectBestKernel() {
+#if defined(CURSOR_MASK_X86)
+		if (IsAVX2Supported()) {
+			return CursorMaskBlender::Kernel::AVX2;
+		}
+		if (IsSSE2Supported()) {
+			return CursorMaskBlender::Kernel::SSE2;
+		}
+#elif defined(CURSOR_MASK_NEON)
+		return CursorMaskBlender::Kernel::NEON;
+#endif
+		return CursorMaskBlender::Kernel::Scalar;
+	}
+}
+
+CursorMaskBlender::Kernel CursorMaskBlender::GetBestKernel()
+{
+	static const Kernel bestKernel = DetectBestKernel();
+	return bestKernel;
+}
+
+bool CursorMaskBlender::IsKernelSupported(Kernel kernel)
+{
+	switch (kernel)
+	{
+	case Kernel::Scalar:
+		return true;
+	case Kernel::SSE2:
+		//AVX2 CPUs support SSE2 too.
+		return GetBestKernel() == Kernel::SSE2 || GetBestKernel() == Kernel::AVX2;
+	default:
+		return GetBestKernel() == kernel;
+	}
+}
+
+void CursorMaskBlender::BlendMonochrome(const CURSOR_MASK_BLEND &blend)
+{
+	BlendMonochrome(GetBestKernel(), blend);
+}
+
+void CursorMaskBlender::BlendMonochrome(Kernel kernel, const CURSOR_MASK_BLEND &blend)
+{
+	if (!IsKernelSupported(kernel)) {
+		kernel = GetBestKernel();
+	}
+	MonochromeRowFunc blendRow = BlendMonochromeRowScalar;
+#if defined(CURSOR_MASK_X86)
+	if (kernel == Kernel::AVX2) {
+		blendRow = BlendMonochromeRowAVX2;
+	}
+	else if (kernel == Kernel::SSE2) {
+		blendRow = BlendMonochromeRowSSE2;
+	}
+#elif defined(CURSOR_MASK_NEON)
+	if (kernel == Kernel::NEON) {
+		blendRow = BlendMonochromeRowNEON;
+	}
+#endif
+	for (uint32_t row = 0; row < blend.Height; row++) {
+		const uint8_t *pAndRow = blend.pShape + static_cast<size_t>(row + blend.ShapeTop) * blend.ShapePitch;
+		blendRow(pAndRow,
+			pAndRow + blend.XorMaskOffset,
+			blend.ShapePitch,
+			blend.ShapeLeft,
+			blend.pBackground + static_cast<size_t>(row) * blend.BackgroundPitch,
+			blend.pOutput + static_cast<size_t>(row) * blend.OutputPitch,
+			blend.Width);
+	}
+}
+
+void CursorMaskBlender::BlendMaskedColor(const CURSOR_MASK_BLEND &blend)
+{
+	BlendMaskedColor(GetBestKernel(), blend);
+}
+
+void CursorMaskBlender::BlendMaskedColor(Kernel kernel, const CURSOR_MASK_BLEND &blend)
+{
+	if (!IsKernelSupported(kernel)) {
+		kernel = GetBestKernel();
+	}
+	MaskedColorRowFunc blendRow = BlendMaskedColorRowScalar;
+#if defined(CURSOR_MASK_X86)
+	if (kernel == Kernel::AVX2) {
+		blendRow = BlendMaskedColorRowAVX2;
+	}
+	else if (kernel == Kernel::SSE2) {
+		blendRow = BlendMaskedColorRowSSE2;
+	}
+#elif defined(CURSOR_MASK_NEON)
+	if (kernel == Kernel::NEON) {
+		blendRow = BlendMaskedColorRowNEON;
+	}
+#endif
+	for (uint32_t row = 0; row < blend.Height; row++) {
+		const uint32_t *pShapeRow = reinterpret_cast<const uint32_t *>(blend.pShape + static_cast<size_t>(row + blend.ShapeTop) * blend.ShapePitch) + blend.ShapeLeft;
+		blendRow(pShapeRow,
+			blend.pBackground + static_cast<size_t>(row) * blend.BackgroundPitch,
+			blend.pOutput + static_cast<size_t>(row) * blend.OutputPitch,
+			blend.Width);
+	}
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+/// <summary>
+/// An area of a pointer shape to blend with the background under it.
+/// </summary>
+struct CURSOR_MASK_BLEND {
+	//The pointer shape buffer and its pitch in bytes. Monochrome shapes have 1 bit per pixel, with the XOR mask XorMaskOffset bytes after the AND mask.
+	//Masked color shapes have 32 bits per pixel.
+	const uint8_t *pShape = nullptr;
+	uint32_t ShapePitch = 0;
+	uint32_t XorMaskOffset = 0;
+	//The pixel of the shape the blended area starts at, e.g. to skip the part of the pointer outside the desktop.
+	uint32_t ShapeLeft = 0;
+	uint32_t ShapeTop = 0;
+	//The BGRA background under the area, and its pitch in pixels.
+	const uint32_t *pBackground = nullptr;
+	uint32_t BackgroundPitch = 0;
+	//Receives the blended BGRA pixels. The pitch is in pixels.
+	uint32_t *pOutput = nullptr;
+	uint32_t OutputPitch = 0;
+	//The size of the blended area in pixels.
+	uint32_t Width = 0;
+	uint32_t Height = 0;
+};
+
+/// <summary>
+/// Blends monochrome and masked color pointer shapes with the background under them, using SSE2, AVX2 or NEON when the CPU supports it.
+/// The rules are those of https://docs.microsoft.com/en-us/windows-hardware/drivers/display/drawing-monochrome-pointers and drawing-color-pointers,
+/// except that pixels the pointer leaves unchanged become transparent white, so the result can be resized independently of the background and drawn on top of it.
+/// All kernels give the same pixels.
+/// </summary>
+class CursorMaskBlender
+{
+public:
+	enum class Kernel {
+		Scalar,
+		SSE2,
+		AVX2,
+		NEON
+	};
+	/// <summary>
+	/// Blends a monochrome pointer. Pixels with the AND bit set and the XOR bit clear are transparent white,
+	/// the others are (background AND mask) XOR mask, where the AND mask keeps the alpha of the background.
+	/// </summary>
+	static void BlendMonochrome(const CURSOR_MASK_BLEND &blend);
+	/// <summary>
+	/// Blends a monochrome pointer with a specific kernel. Falls back to the best supported kernel if the requested one is not available on this CPU.
+	/// </summary>
+	static void BlendMonochrome(Kernel kernel, const CURSOR_MASK_BLEND &blend);
+
+	/// <summary>
+	/// Blends a masked color pointer. Pixels with an alpha of zero are drawn opaque, pixels with a mask and no color are transparent white,
+	/// and the others are the background XOR the pixel.
+	/// </summary>
+	static void BlendMaskedColor(const CURSOR_MASK_BLEND &blend);
+	/// <summary>
+	/// Blends a masked color pointer with a specific kernel. Falls back to the best supported kernel if the requested one is not available on this CPU.
+	/// </summary>
+	static void BlendMaskedColor(Kernel kernel, const CURSOR_MASK_BLEND &blend);
+
+	/// <summary>
+	/// The fastest kernel supported by the current CPU. Detected once on first use.
+	/// </summary>
+	static Kernel GetBestKernel();
+	static bool IsKernelSupported(Kernel kernel);
+};
@@ -0,0 +1,324 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <iterator>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+//The pointer shape types, with the values of DXGI_OUTDUPL_POINTER_SHAPE_TYPE.
+#define CURSOR_SHAPE_TYPE_MONOCHROME 1
+#define CURSOR_SHAPE_TYPE_COLOR 2
+#define CURSOR_SHAPE_TYPE_MASKED_COLOR 4
+
+//Mixes the eight bytes at pWord into one lane of HashCursorShape.
+inline uint64_t HashCursorShapeRound(uint64_t lane, const uint8_t *pWord)
+{
+	uint64_t word;
+	memcpy(&word, pWord, sizeof(word));
+	lane += word * 0xC2B2AE3D27D4EB4Full;
+	lane = (lane << 31) | (lane >> 33);
+	return lane * 0x9E3779B185EBCA87ull;
+}
+
+/// <summary>
+/// Hashes a pointer shape buffer. The buffer is hashed 32 bytes at a time in four independent lanes, so the multiplications of one lane
+/// overlap with those of the others, as the shape is hashed on every frame the pointer is drawn.
+/// </summary>
+inline uint64_t HashCursorShape(const uint8_t *pShape, size_t size)
+{
+	const uint64_t prime1 = 0x9E3779B185EBCA87ull;
+	const uint64_t prime2 = 0xC2B2AE3D27D4EB4Full;
+	uint64_t hash = prime2 ^ (size * prime1);
+	size_t i = 0;
+	if (size >= 32) {
+		uint64_t lane1 = prime1 + prime2;
+		uint64_t lane2 = prime2;
+		uint64_t lane3 = 0;
+		uint64_t lane4 = 0 - prime1;
+		for (; i + 32 <= size; i += 32) {
+			lane1 = HashCursorShapeRound(lane1, pShape + i);
+			lane2 = HashCursorShapeRound(lane2, pShape + i + 8);
+			lane3 = HashCursorShapeRound(lane3, pShape + i + 16);
+			lane4 = HashCursorShapeRound(lane4, pShape + i + 24);
+		}
+		for (uint64_t lane : { lane1, lane2, lane3, lane4 }) {
+			hash ^= HashCursorShapeRound(0, reinterpret_cast<const uint8_t *>(&lane));
+			hash = ((hash << 27) | (hash >> 37)) * prime1 + prime2;
+		}
+	}
+	for (; i + 8 <= size; i += 8) {
+		hash ^= HashCursorShapeRound(0, pShape + i);
+		hash = ((hash << 27) | (hash >> 37)) * prime1 + prime2;
+	}
+	for (; i < size; i++) {
+		hash ^= pShape[i] * prime1;
+		hash = ((hash << 11) | (hash >> 53)) * prime2;
+	}
+	//Mix the bits, so shapes differing in a few bits spread over the whole hash.
+	hash ^= hash >> 33;
+	hash *= prime2;
+	hash ^= hash >> 29;
+	hash *= prime1;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+struct CURSOR_SHAPE_KEY {
+	//The shape type, size and pitch of the pointer shape buffer, as in DXGI_OUTDUPL_POINTER_SHAPE_INFO.
+	uint32_t Type = 0;
+	uint32_t Width = 0;
+	uint32_t Height = 0;
+	uint32_t Pitch = 0;
+	//The scale the pointer is drawn at, since the cached resource is scaled.
+	float ScaleX = 1;
+	float ScaleY = 1;
+	//The hash of the shape buffer, from HashCursorShape.
+	uint64_t Hash = 0;
+
+	bool operator==(const CURSOR_SHAPE_KEY &other) const
+	{
+		return Type == other.Type
+			&& Width == other.Width
+			&& Height == other.Height
+			&& Pitch == other.Pitch
+			&& ScaleX == other.ScaleX
+			&& ScaleY == other.ScaleY
+			&& Hash == other.Hash;
+	}
+	/// <summary>
+	/// The size of the shape buffer in bytes. Monochrome shapes hold the AND mask and the XOR mask, so their height is twice the height of the pointer.
+	/// </summary>
+	size_t GetShapeSize() const
+	{
+		return static_cast<size_t>(Pitch) * Height;
+	}
+};
+
+struct CURSOR_SHAPE_KEY_HASH {
+	size_t operator()(const CURSOR_SHAPE_KEY &key) const
+	{
+		return static_cast<size_t>(key.Hash ^ (static_cast<uint64_t>(key.Width) << 32) ^ key.Height);
+	}
+};
+
+struct CURSOR_SHAPE_CACHE_STATS {
+	//Draws served by a cached pointer, and draws that converted the pointer shape.
+	uint64_t Hits = 0;
+	uint64_t Misses = 0;
+	//Pointers freed to stay within the capacity.
+	uint64_t Evictions = 0;
+	//Cached pointers.
+	size_t Entries = 0;
+
+	double GetHitRate() const
+	{
+		return Hits + Misses > 0 ? static_cast<double>(Hits) / (Hits + Misses) : 0;
+	}
+};
+
+/// <summary>
+/// Converts a pointer shape to BGRA pixels that can be drawn on top of any background, using the rules of
+/// https://docs.microsoft.com/en-us/windows-hardware/drivers/display/drawing-monochrome-pointers and drawing-color-pointers.
+/// Pixels the pointer leaves unchanged become transparent white. Pixels inverting the background cannot be converted without it,
+/// e.g. those of the text selection pointer. If pInvertMask is given, pixels inverting the color of the background are left transparent white
+/// and set to opaque white in the mask instead, so they can be inverted by drawing the mask with an inverting blend. Pixels XORing the background
+/// with any other color still cannot be converted, in which case the shape has to be drawn against the background every frame instead.
+/// </summary>
+/// <param name="pShape">The shape buffer, with the layout given by the key</param>
+/// <param name="pPixels">Receives Width * PointerHeight pixels, where monochrome pointers are half the height of the shape</param>
+/// <param name="pInvertMask">Optionally receives Width * PointerHeight pixels, opaque white where the background is inverted and transparent black elsewhere</param>
+/// <param name="pIsInverting">Optionally receives whether any pixel is set in pInvertMask</param>
+/// <returns>false if the shape cannot be converted without the background, in which case the pixels are left partly written</returns>
+inline bool ConvertCursorShape(const CURSOR_SHAPE_KEY &key, const uint8_t *pShape, uint32_t *pPixels, uint32_t *pInvertMask = nullptr, bool *pIsInverting = nullptr)
+{
+	const uint32_t transparentWhite = 0x00FFFFFF;
+	const uint32_t transparentBlack = 0x00000000;
+	const uint32_t opaqueWhite = 0xFFFFFFFF;
+	const uint32_t opaqueBlack = 0xFF000000;
+	bool isInverting = false;
+	switch (key.Type)
+	{
+	case CURSOR_SHAPE_TYPE_COLOR:
+		for (uint32_t row = 0; row < key.Height; row++) {
+			memcpy(pPixels + static_cast<size_t>(row) * key.Width, pShape + static_cast<size_t>(row) * key.Pitch, static_cast<size_t>(key.Width) * sizeof(uint32_t));
+		}
+		if (pInvertMask) {
+			std::fill(pInvertMask, pInvertMask + static_cast<size_t>(key.Width) * key.Height, transparentBlack);
+		}
+		break;
+	case CURSOR_SHAPE_TYPE_MONOCHROME: {
+		uint32_t height = key.Height / 2;
+		for (uint32_t row = 0; row < height; row++) {
+			const uint8_t *pAndRow = pShape + static_cast<size_t>(row) * key.Pitch;
+			const uint8_t *pXorRow = pShape + static_cast<size_t>(row + height) * key.Pitch;
+			size_t offset = static_cast<size_t>(row) * key.Width;
+			for (uint32_t col = 0; col < key.Width; col++) {
+				uint8_t mask = static_cast<uint8_t>(0x80 >> (col % 8));
+				bool andBit = (pAndRow[col / 8] & mask) != 0;
+				bool xorBit = (pXorRow[col / 8] & mask) != 0;
+				uint32_t invert = transparentBlack;
+				if (andBit) {
+					if (xorBit) {
+						//The background XOR white, which inverts its color.
+						if (!pInvertMask) {
+							return false;
+						}
+						invert = opaqueWhite;
+						isInverting = true;
+					}
+					pPixels[offset + col] = transparentWhite;
+				}
+				else {
+					pPixels[offset + col] = xorBit ? opaqueWhite : opaqueBlack;
+				}
+				if (pInvertMask) {
+					pInvertMask[offset + col] = invert;
+				}
+			}
+		}
+		break;
+	}
+	case CURSOR_SHAPE_TYPE_MASKED_COLOR:
+		for (uint32_t row = 0; row < key.Height; row++) {
+			const uint8_t *pRow = pShape + static_cast<size_t>(row) * key.Pitch;
+			size_t offset = static_cast<size_t>(row) * key.Width;
+			for (uint32_t col = 0; col < key.Width; col++) {
+				uint32_t value;
+				memcpy(&value, pRow + static_cast<size_t>(col) * sizeof(uint32_t), sizeof(value));
+				uint32_t invert = transparentBlack;
+				if (value & opaqueBlack) {
+					if (value != opaqueBlack) {
+						//Only XOR with white is an inversion, other colors need the background.
+						if (!pInvertMask || value != opaqueWhite) {
+							return false;
+						}
+						invert = opaqueWhite;
+						isInverting = true;
+					}
+					pPixels[offset + col] = transparentWhite;
+				}
+				else {
+					pPixels[offset + col] = value | opaqueBlack;
+				}
+				if (pInvertMask) {
+					pInvertMask[offset + col] = invert;
+				}
+			}
+		}
+		break;
+	default:
+		return false;
+	}
+	if (pIsInverting) {
+		*pIsInverting = isInverting;
+	}
+	return true;
+}
+
+/// <summary>
+/// A thread safe cache of the resources drawn for pointer shapes, e.g. the texture of each pointer, so a pointer is converted and uploaded
+/// once per shape instead of every frame. Shapes are looked up by their hash and then compared byte by byte, so a hash collision cannot draw the wrong pointer.
+/// At most Capacity pointers are kept, and the least recently drawn is freed when another is added. Freeing a resource just destroys it,
+/// so resources owning e.g. COM references should release them in their destructor.
+/// A default constructed resource may be cached for shapes that cannot be cached as a resource, e.g. because they XOR the background with a color,
+/// so the shape is not converted again on every frame only to find that out.
+/// </summary>
+template <typename TResource>
+class CursorShapeCache
+{
+public:
+	CursorShapeCache(size_t capacity) :
+		m_Capacity(capacity > 0 ? capacity : 1),
+		m_Stats{}
+	{
+	}
+	CursorShapeCache(const CursorShapeCache &) = delete;
+	CursorShapeCache &operator=(const CursorShapeCache &) = delete;
+
+	/// <summary>
+	/// Gets the resource cached for the shape, and marks it as the most recently drawn.
+	/// </summary>
+	/// <param name="pShape">The shape buffer, of key.GetShapeSize() bytes</param>
+	/// <returns>true if the shape was cached</returns>
+	bool Find(const CURSOR_SHAPE_KEY &key, const uint8_t *pShape, TResource *pResource)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		auto range = m_Index.equal_range(key);
+		for (auto it = range.first; it != range.second; it++) {
+			EntryIterator entry = it->second;
+			if (memcmp(entry->Shape.data(), pShape, entry->Shape.size()) == 0) {
+				m_Entries.splice(m_Entries.begin(), m_Entries, entry);
+				m_Stats.Hits++;
+				*pResource = entry->Resource;
+				return true;
+			}
+		}
+		m_Stats.Misses++;
+		return false;
+	}
+
+	/// <summary>
+	/// Caches the resource for the shape, freeing the least recently drawn pointer if the cache is full.
+	/// </summary>
+	/// <param name="pShape">The shape buffer, of key.GetShapeSize() bytes. It is copied, to tell shapes with the same hash apart.</param>
+	void Insert(const CURSOR_SHAPE_KEY &key, const uint8_t *pShape, TResource resource)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		while (m_Entries.size() >= m_Capacity) {
+			Remove(std::prev(m_Entries.end()));
+			m_Stats.Evictions++;
+		}
+		m_Entries.push_front(CACHE_ENTRY{ key, std::vector<uint8_t>(pShape, pShape + key.GetShapeSize()), std::move(resource) });
+		m_Index.emplace(key, m_Entries.begin());
+	}
+
+	/// <summary>
+	/// Frees all cached pointers, e.g. when the device their resources belong to is released.
+	/// </summary>
+	void Clear()
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Index.clear();
+		m_Entries.clear();
+	}
+
+	CURSOR_SHAPE_CACHE_STATS GetStats()
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		CURSOR_SHAPE_CACHE_STATS stats = m_Stats;
+		stats.Entries = m_Entries.size();
+		return stats;
+	}
+
+private:
+	struct CACHE_ENTRY {
+		CURSOR_SHAPE_KEY Key;
+		std::vector<uint8_t> Shape;
+		TResource Resource;
+	};
+	typedef typename std::list<CACHE_ENTRY>::iterator EntryIterator;
+
+	void Remove(EntryIterator entry)
+	{
+		auto range = m_Index.equal_range(entry->Key);
+		for (auto it = range.first; it != range.second; it++) {
+			if (it->second == entry) {
+				m_Index.erase(it);
+				break;
+			}
+		}
+		m_Entries.erase(entry);
+	}
+
+	std::mutex m_Mutex;
+	size_t m_Capacity;
+	//Most recently drawn first.
+	std::list<CACHE_ENTRY> m_Entries;
+	std::unordered_multimap<CURSOR_SHAPE_KEY, EntryIterator, CURSOR_SHAPE_KEY_HASH> m_Index;
+	CURSOR_SHAPE_CACHE_STATS m_Stats;
+};
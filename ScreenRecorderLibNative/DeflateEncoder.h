@@ -0,0 +1,700 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define DEFLATE_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+//The most bytes back a match may reach, and the longest match, as defined by deflate.
+#define DEFLATE_WINDOW_SIZE 32768
+#define DEFLATE_MAX_MATCH 258
+//Matches are found by hashing 4 bytes, so shorter matches are written as literals.
+#define DEFLATE_MIN_MATCH 4
+
+/// <summary>
+/// Updates the Adler-32 checksum of a zlib stream with more data. Start with 1.
+/// </summary>
+inline uint32_t UpdateAdler32(uint32_t adler, const uint8_t *pData, size_t size)
+{
+	const uint32_t BASE = 65521;
+	//The largest number of bytes that can be summed before the sums may overflow 32 bits.
+	const size_t NMAX = 5552;
+	uint32_t a = adler & 0xFFFF;
+	uint32_t b = adler >> 16;
+	while (size > 0) {
+		size_t count = (std::min)(size, NMAX);
+		size -= count;
+		for (size_t i = 0; i < count; i++) {
+			a += pData[i];
+			b += a;
+		}
+		pData += count;
+		a %= BASE;
+		b %= BASE;
+	}
+	return (b << 16) | a;
+}
+
+/// <summary>
+/// Combines the Adler-32 checksums of two consecutive pieces of data into the checksum of both, so the pieces can be summed in parallel.
+/// </summary>
+/// <param name="secondSize">The size of the second piece, in bytes</param>
+inline uint32_t CombineAdler32(uint32_t first, uint32_t second, size_t secondSize)
+{
+	const uint32_t BASE = 65521;
+	uint32_t remainder = static_cast<uint32_t>(secondSize % BASE);
+	uint32_t a = first & 0xFFFF;
+	uint32_t b = static_cast<uint32_t>((static_cast<uint64_t>(remainder) * a) % BASE);
+	a += (second & 0xFFFF) + BASE - 1;
+	b += (first >> 16) + (second >> 16) + BASE - remainder;
+	if (a >= BASE) a -= BASE;
+	if (a >= BASE) a -= BASE;
+	if (b >= (BASE << 1)) b -= (BASE << 1);
+	if (b >= BASE) b -= BASE;
+	return (b << 16) | a;
+}
+
+/// <summary>
+/// Updates the CRC-32 of a PNG chunk with more data. Start with 0.
+/// </summary>
+inline uint32_t UpdateCrc32(uint32_t crc, const uint8_t *pData, size_t size)
+{
+	struct CRC_TABLE {
+		uint32_t Values[256];
+		CRC_TABLE() {
+			for (uint32_t i = 0; i < 256; i++) {
+				uint32_t value = i;
+				for (int bit = 0; bit < 8; bit++) {
+					value = (value & 1) ? 0xEDB88320u ^ (value >> 1) : value >> 1;
+				}
+				Values[i] = value;
+			}
+		}
+	};
+	static const CRC_TABLE table;
+	crc = ~crc;
+	for (size_t i = 0; i < size; i++) {
+		crc = table.Values[(crc ^ pData[i]) & 0xFF] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+/// <summary>
+/// Compresses data to raw deflate blocks (RFC 1951) with greedy hash chain matching and dynamic Huffman codes, falling back to fixed codes
+/// or stored blocks where they are smaller.
+/// Data can be compressed in pieces, each piece ending on a byte boundary, and each seeing the data before it as a dictionary,
+/// so consecutive pieces can be compressed in parallel by separate encoders and concatenated into one stream, like pigz does.
+/// Holds its hash tables and symbol buffer between calls, so reusing an encoder does not allocate. Not thread safe.
+/// </summary>
+class DeflateEncoder
+{
+public:
+	/// <param name="maxChainLength">The most earlier positions tried for each match. Higher values compress better and slower.</param>
+	DeflateEncoder(int maxChainLength = 8) :
+		m_MaxChainLength((std::max)(maxChainLength, 1)),
+		m_Head(HASH_SIZE),
+		m_Prev(DEFLATE_WINDOW_SIZE)
+	{
+		m_Symbols.reserve(MAX_BLOCK_SYMBOLS);
+	}
+	DeflateEncoder(const DeflateEncoder &) = delete;
+	DeflateEncoder &operator=(const DeflateEncoder &) = delete;
+
+	/// <summary>
+	/// Compresses a piece of data and appends the deflate blocks to the output.
+	/// </summary>
+	/// <param name="pData">The dictionary followed by the data to compress</param>
+	/// <param name="dictionarySize">The number of bytes before the data to compress that matches may refer to, i.e. the end of the previous piece</param>
+	/// <param name="size">The number of bytes to compress</param>
+	/// <param name="isFinal">True for the last piece of the stream. Other pieces end with an empty stored block, so the next piece starts on a byte boundary.</param>
+	void Compress(const uint8_t *pData, size_t dictionarySize, size_t size, bool isFinal, std::vector<uint8_t> &output)
+	{
+		m_pOutput = &output;
+		m_BitBuffer = 0;
+		m_BitCount = 0;
+		std::fill(m_Head.begin(), m_Head.end(), -1);
+		const int32_t end = static_cast<int32_t>(dictionarySize + size);
+		int32_t pos = static_cast<int32_t>(dictionarySize);
+		for (int32_t dictionaryPos = (std::max)(pos - DEFLATE_WINDOW_SIZE, 0); dictionaryPos + DEFLATE_MIN_MATCH <= pos; dictionaryPos++) {
+			Insert(pData, dictionaryPos);
+		}
+		ResetBlock(pos);
+		while (pos < end) {
+			int32_t matchLength = 0;
+			int32_t matchDistance = 0;
+			if (end - pos >= DEFLATE_MIN_MATCH) {
+				FindMatch(pData, pos, end, &matchLength, &matchDistance);
+			}
+			if (matchLength >= DEFLATE_MIN_MATCH) {
+				AddMatch(matchLength, matchDistance);
+				//Long matches are mostly runs, whose positions are not worth remembering.
+				if (matchLength <= MAX_INSERT_LENGTH) {
+					for (int32_t i = 1; i < matchLength && pos + i + DEFLATE_MIN_MATCH <= end; i++) {
+						Insert(pData, pos + i);
+					}
+				}
+				pos += matchLength;
+			}
+			else {
+				AddLiteral(pData[pos]);
+				pos++;
+			}
+			if (m_Symbols.size() >= MAX_BLOCK_SYMBOLS) {
+				WriteBlock(pData, pos, isFinal && pos == end);
+				ResetBlock(pos);
+			}
+		}
+		if (!m_Symbols.empty() || isFinal) {
+			WriteBlock(pData, pos, isFinal);
+		}
+		if (!isFinal) {
+			//An empty stored block, as written by a zlib sync flush.
+			PutBits(0, 3);
+			AlignToByte();
+			PutBits(0x0000, 16);
+			PutBits(0xFFFF, 16);
+		}
+		AlignToByte();
+		FlushBits();
+		m_pOutput = nullptr;
+	}
+
+private:
+	static const int HASH_BITS = 15;
+	static const int HASH_SIZE = 1 << HASH_BITS;
+	static const int MAX_INSERT_LENGTH = 32;
+	static const size_t MAX_BLOCK_SYMBOLS = 32768;
+	//Matches at least this long are taken without looking for longer ones.
+	static const int NICE_MATCH = 128;
+	static const int LITERAL_LENGTH_CODES = 288;
+	static const int DISTANCE_CODES = 32;
+	static const int CODE_LENGTH_CODES = 19;
+	//Marks a symbol as a match. Matches hold the length - 3 in bits 16 to 23 and the distance - 1 in bits 0 to 15.
+	static const uint32_t MATCH_FLAG = 0x80000000u;
+
+	struct TABLES {
+		uint8_t LengthCode[256];
+		uint8_t DistanceCode[512];
+		uint16_t LengthBase[29];
+		uint8_t LengthExtra[29];
+		uint16_t DistanceBase[30];
+		uint8_t DistanceExtra[30];
+		TABLES() {
+			const uint8_t lengthExtra[29] = { 0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0 };
+			const uint8_t distanceExtra[30] = { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13 };
+			int length = 0;
+			for (int code = 0; code < 28; code++) {
+				LengthBase[code] = static_cast<uint16_t>(length + 3);
+				LengthExtra[code] = lengthExtra[code];
+				for (int i = 0; i < (1 << lengthExtra[code]); i++) {
+					LengthCode[length++] = static_cast<uint8_t>(code);
+				}
+			}
+			//A length of 258 has its own code, instead of the last value of code 27.
+			LengthBase[28] = 258;
+			LengthExtra[28] = 0;
+			LengthCode[255] = 28;
+			int distance = 0;
+			for (int code = 0; code < 30; code++) {
+				DistanceBase[code] = static_cast<uint16_t>(distance + 1);
+				DistanceExtra[code] = distanceExtra[code];
+				distance += 1 << distanceExtra[code];
+			}
+			distance = 0;
+			//Distances - 1 below 256 are looked up directly, larger ones by their value / 128, as zlib does.
+			for (int code = 0; code < 16; code++) {
+				for (int i = 0; i < (1 << distanceExtra[code]); i++) {
+					DistanceCode[distance++] = static_cast<uint8_t>(code);
+				}
+			}
+			distance >>= 7;
+			for (int code = 16; code < 30; code++) {
+				for (int i = 0; i < (1 << (distanceExtra[code] - 7)); i++) {
+					DistanceCode[256 + distance++] = static_cast<uint8_t>(code);
+				}
+			}
+		}
+	};
+
+	static const TABLES &GetTables()
+	{
+		static const TABLES tables;
+		return tables;
+	}
+
+	static inline int GetDistanceCode(uint32_t distanceMinusOne)
+	{
+		const TABLES &tables = GetTables();
+		return distanceMinusOne < 256 ? tables.DistanceCode[distanceMinusOne] : tables.DistanceCode[256 + (distanceMinusOne >> 7)];
+	}
+
+	int m_MaxChainLength;
+	std::vector<int32_t> m_Head;
+	std::vector<int32_t> m_Prev;
+	std::vector<uint32_t> m_Symbols;
+	uint32_t m_LiteralLengthFrequencies[LITERAL_LENGTH_CODES];
+	uint32_t m_DistanceFrequencies[DISTANCE_CODES];
+	//Where the data of the current block starts, for writing it as a stored block.
+	int32_t m_BlockStart = 0;
+	std::vector<uint8_t> *m_pOutput = nullptr;
+	uint64_t m_BitBuffer = 0;
+	int m_BitCount = 0;
+
+	static inline uint32_t Read32(const uint8_t *p)
+	{
+		uint32_t value;
+		memcpy(&value, p, sizeof(value));
+		return value;
+	}
+
+	static inline uint32_t Hash(const uint8_t *p)
+	{
+		return (Read32(p) * 2654435761u) >> (32 - HASH_BITS);
+	}
+
+	inline void Insert(const uint8_t *pData, int32_t pos)
+	{
+		uint32_t hash = Hash(pData + pos);
+		m_Prev[pos & (DEFLATE_WINDOW_SIZE - 1)] = m_Head[hash];
+		m_Head[hash] = pos;
+	}
+
+	static inline int32_t GetMatchLength(const uint8_t *pA, const uint8_t *pB, int32_t maxLength)
+	{
+		int32_t length = 0;
+#ifdef DEFLATE_SSE2
+		while (length + 16 <= maxLength) {
+			__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pA + length));
+			__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pB + length));
+			uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(a, b))) ^ 0xFFFF;
+			if (mask != 0) {
+				return length + CountTrailingZeros(mask);
+			}
+			length += 16;
+		}
+#endif
+		while (length + 8 <= maxLength) {
+			uint64_t a, b;
+			memcpy(&a, pA + length, sizeof(a));
+			memcpy(&b, pB + length, sizeof(b));
+			uint64_t difference = a ^ b;
+			if (difference != 0) {
+				//Little endian, so the lowest set bit is in the first differing byte.
+				return length + static_cast<int32_t>(CountTrailingZeros(difference) / 8);
+			}
+			length += 8;
+		}
+		while (length < maxLength && pA[length] == pB[length]) {
+			length++;
+		}
+		return length;
+	}
+
+	static inline int CountTrailingZeros(uint64_t value)
+	{
+#if defined(_MSC_VER)
+		unsigned long index;
+		_BitScanForward64(&index, value);
+		return static_cast<int>(index);
+#else
+		return __builtin_ctzll(value);
+#endif
+	}
+
+	inline void FindMatch(const uint8_t *pData, int32_t pos, int32_t end, int32_t *pLength, int32_t *pDistance)
+	{
+		int32_t maxLength = (std::min)(end - pos, DEFLATE_MAX_MATCH);
+		uint32_t hash = Hash(pData + pos);
+		int32_t candidate = m_Head[hash];
+		m_Prev[pos & (DEFLATE_WINDOW_SIZE - 1)] = candidate;
+		m_Head[hash] = pos;
+		int32_t niceLength = maxLength < NICE_MATCH ? maxLength : NICE_MATCH;
+		int32_t bestLength = 0;
+		int32_t bestDistance = 0;
+		for (int chain = m_MaxChainLength; candidate >= 0 && pos - candidate <= DEFLATE_WINDOW_SIZE && chain > 0; chain--) {
+			//A candidate can only beat the best match if it also matches at the byte after it.
+			if (pData[candidate + bestLength] == pData[pos + bestLength]) {
+				int32_t length = GetMatchLength(pData + candidate, pData + pos, maxLength);
+				if (length > bestLength) {
+					bestLength = length;
+					bestDistance = pos - candidate;
+					if (length >= niceLength) {
+						break;
+					}
+				}
+			}
+			int32_t next = m_Prev[candidate & (DEFLATE_WINDOW_SIZE - 1)];
+			//The slot was taken over by a newer position, so the rest of the chain is out of the window.
+			if (next >= candidate) {
+				break;
+			}
+			candidate = next;
+		}
+		*pLength = bestLength;
+		*pDistance = bestDistance;
+	}
+
+	void ResetBlock(int32_t blockStart)
+	{
+		m_Symbols.clear();
+		memset(m_LiteralLengthFrequencies, 0, sizeof(m_LiteralLengthFrequencies));
+		memset(m_DistanceFrequencies, 0, sizeof(m_DistanceFrequencies));
+		m_BlockStart = blockStart;
+	}
+
+	inline void AddLiteral(uint8_t value)
+	{
+		m_Symbols.push_back(value);
+		m_LiteralLengthFrequencies[value]++;
+	}
+
+	inline void AddMatch(int32_t length, int32_t distance)
+	{
+		m_Symbols.push_back(MATCH_FLAG | (static_cast<uint32_t>(length - 3) << 16) | static_cast<uint32_t>(distance - 1));
+		m_LiteralLengthFrequencies[257 + GetTables().LengthCode[length - 3]]++;
+		m_DistanceFrequencies[GetDistanceCode(distance - 1)]++;
+	}
+
+	inline void PutBits(uint32_t value, int count)
+	{
+		m_BitBuffer |= static_cast<uint64_t>(value) << m_BitCount;
+		m_BitCount += count;
+		if (m_BitCount >= 32) {
+			uint8_t bytes[4] = { static_cast<uint8_t>(m_BitBuffer), static_cast<uint8_t>(m_BitBuffer >> 8), static_cast<uint8_t>(m_BitBuffer >> 16), static_cast<uint8_t>(m_BitBuffer >> 24) };
+			m_pOutput->insert(m_pOutput->end(), bytes, bytes + 4);
+			m_BitBuffer >>= 32;
+			m_BitCount -= 32;
+		}
+	}
+
+	void AlignToByte()
+	{
+		if (m_BitCount % 8 != 0) {
+			PutBits(0, 8 - (m_BitCount % 8));
+		}
+	}
+
+	void FlushBits()
+	{
+		while (m_BitCount > 0) {
+			m_pOutput->push_back(static_cast<uint8_t>(m_BitBuffer));
+			m_BitBuffer >>= 8;
+			m_BitCount -= 8;
+		}
+		m_BitBuffer = 0;
+		m_BitCount = 0;
+	}
+
+	/// <summary>
+	/// Builds code lengths of at most maxLength bits for the given symbol frequencies. Symbols that are not used get no code.
+	/// At least two symbols get a code, so the code is complete, which some decoders require.
+	/// </summary>
+	static void BuildCodeLengths(const uint32_t *pFrequencies, int count, int maxLength, uint8_t *pLengths)
+	{
+		memset(pLengths, 0, count);
+		std::vector<int> symbols;
+		symbols.reserve(count);
+		for (int i = 0; i < count; i++) {
+			if (pFrequencies[i] > 0) {
+				symbols.push_back(i);
+			}
+		}
+		for (int i = 0; symbols.size() < 2; i++) {
+			if (pFrequencies[i] == 0) {
+				symbols.push_back(i);
+			}
+		}
+		std::stable_sort(symbols.begin(), symbols.end(), [&](int a, int b) { return pFrequencies[a] < pFrequencies[b]; });
+		//Huffman's algorithm with two queues: the sorted leaves, and the internal nodes, which are created in order of weight.
+		size_t leafCount = symbols.size();
+		std::vector<uint64_t> weights(leafCount * 2 - 1);
+		std::vector<int> parents(leafCount * 2 - 1, -1);
+		for (size_t i = 0; i < leafCount; i++) {
+			weights[i] = pFrequencies[symbols[i]];
+		}
+		size_t nextLeaf = 0;
+		size_t nextNode = leafCount;
+		size_t nodeCount = leafCount;
+		auto TakeSmallest([&]() {
+			if (nextLeaf < leafCount && (nextNode >= nodeCount || weights[nextLeaf] <= weights[nextNode])) {
+				return nextLeaf++;
+			}
+			return nextNode++;
+			});
+		while (nodeCount < weights.size()) {
+			size_t first = TakeSmallest();
+			size_t second = TakeSmallest();
+			weights[nodeCount] = weights[first] + weights[second];
+			parents[first] = static_cast<int>(nodeCount);
+			parents[second] = static_cast<int>(nodeCount);
+			nodeCount++;
+		}
+		//The depth of each node is one more than its parent, and parents come after their children.
+		std::vector<int> depths(weights.size(), 0);
+		int lengthCounts[16] = {};
+		for (size_t i = weights.size() - 1; i-- > 0;) {
+			depths[i] = depths[parents[i]] + 1;
+		}
+		for (size_t i = 0; i < leafCount; i++) {
+			lengthCounts[(std::min)(depths[i], maxLength)]++;
+		}
+		//Codes clamped to the longest length overflow the code space, so codes are lengthened until it fits again, as miniz does.
+		uint32_t total = 0;
+		for (int length = maxLength; length > 0; length--) {
+			total += static_cast<uint32_t>(lengthCounts[length]) << (maxLength - length);
+		}
+		while (total != (1u << maxLength)) {
+			lengthCounts[maxLength]--;
+			for (int length = maxLength - 1; length > 0; length--) {
+				if (lengthCounts[length] > 0) {
+					lengthCounts[length]--;
+					lengthCounts[length + 1] += 2;
+					break;
+				}
+			}
+			total--;
+		}
+		//The least frequent symbols get the longest codes.
+		size_t symbol = 0;
+		for (int length = maxLength; length > 0; length--) {
+			for (int i = 0; i < lengthCounts[length]; i++) {
+				pLengths[symbols[symbol++]] = static_cast<uint8_t>(length);
+			}
+		}
+	}
+
+	/// <summary>
+	/// Assigns canonical codes to the code lengths, bit reversed, as deflate writes codes starting from their most significant bit.
+	/// </summary>
+	static void BuildCodes(const uint8_t *pLengths, int count, uint16_t *pCodes)
+	{
+		int lengthCounts[16] = {};
+		for (int i = 0; i < count; i++) {
+			lengthCounts[pLengths[i]]++;
+		}
+		lengthCounts[0] = 0;
+		uint32_t nextCodes[16] = {};
+		uint32_t code = 0;
+		for (int length = 1; length < 16; length++) {
+			code = (code + lengthCounts[length - 1]) << 1;
+			nextCodes[length] = code;
+		}
+		for (int i = 0; i < count; i++) {
+			int length = pLengths[i];
+			if (length == 0) {
+				pCodes[i] = 0;
+				continue;
+			}
+			uint32_t value = nextCodes[length]++;
+			uint32_t reversed = 0;
+			for (int bit = 0; bit < length; bit++) {
+				reversed = (reversed << 1) | ((value >> bit) & 1);
+			}
+			pCodes[i] = static_cast<uint16_t>(reversed);
+		}
+	}
+
+	struct CODE_LENGTH_SYMBOL {
+		uint8_t Symbol;
+		uint8_t Extra;
+	};
+
+	/// <summary>
+	/// Run length encodes the code lengths of a dynamic block with the repeat codes 16, 17 and 18.
+	/// </summary>
+	static void EncodeCodeLengths(const uint8_t *pLengths, int count, std::vector<CODE_LENGTH_SYMBOL> &symbols, uint32_t *pFrequencies)
+	{
+		for (int i = 0; i < count;) {
+			uint8_t length = pLengths[i];
+			int run = 1;
+			while (i + run < count && pLengths[i + run] == length) {
+				run++;
+			}
+			i += run;
+			if (length == 0) {
+				while (run >= 11) {
+					int repeat = (std::min)(run, 138);
+					symbols.push_back(CODE_LENGTH_SYMBOL{ 18, static_cast<uint8_t>(repeat - 11) });
+					run -= repeat;
+				}
+				if (run >= 3) {
+					symbols.push_back(CODE_LENGTH_SYMBOL{ 17, static_cast<uint8_t>(run - 3) });
+					run = 0;
+				}
+			}
+			else {
+				symbols.push_back(CODE_LENGTH_SYMBOL{ length, 0 });
+				run--;
+				while (run >= 3) {
+					int repeat = (std::min)(run, 6);
+					symbols.push_back(CODE_LENGTH_SYMBOL{ 16, static_cast<uint8_t>(repeat - 3) });
+					run -= repeat;
+				}
+			}
+			for (; run > 0; run--) {
+				symbols.push_back(CODE_LENGTH_SYMBOL{ length, 0 });
+			}
+		}
+		for (const CODE_LENGTH_SYMBOL &symbol : symbols) {
+			pFrequencies[symbol.Symbol]++;
+		}
+	}
+
+	/// <summary>
+	/// The number of bits the symbols of the block take with the given code lengths, including the extra bits of lengths and distances.
+	/// </summary>
+	uint64_t GetSymbolBits(const uint8_t *pLiteralLengthLengths, const uint8_t *pDistanceLengths) const
+	{
+		const TABLES &tables = GetTables();
+		uint64_t bits = 0;
+		for (int i = 0; i < LITERAL_LENGTH_CODES; i++) {
+			bits += static_cast<uint64_t>(m_LiteralLengthFrequencies[i]) * (pLiteralLengthLengths[i] + (i >= 257 && i < 286 ? tables.LengthExtra[i - 257] : 0));
+		}
+		for (int i = 0; i < 30; i++) {
+			bits += static_cast<uint64_t>(m_DistanceFrequencies[i]) * (pDistanceLengths[i] + tables.DistanceExtra[i]);
+		}
+		return bits;
+	}
+
+	void WriteSymbols(const uint8_t *pLiteralLengthLengths, const uint16_t *pLiteralLengthCodes, const uint8_t *pDistanceLengths, const uint16_t *pDistanceCodes)
+	{
+		const TABLES &tables = GetTables();
+		for (uint32_t symbol : m_Symbols) {
+			if (symbol & MATCH_FLAG) {
+				uint32_t lengthMinusThree = (symbol >> 16) & 0xFF;
+				uint32_t distanceMinusOne = symbol & 0xFFFF;
+				int lengthCode = tables.LengthCode[lengthMinusThree];
+				PutBits(pLiteralLengthCodes[257 + lengthCode], pLiteralLengthLengths[257 + lengthCode]);
+				if (tables.LengthExtra[lengthCode] > 0) {
+					PutBits(lengthMinusThree + 3 - tables.LengthBase[lengthCode], tables.LengthExtra[lengthCode]);
+				}
+				int distanceCode = GetDistanceCode(distanceMinusOne);
+				PutBits(pDistanceCodes[distanceCode], pDistanceLengths[distanceCode]);
+				if (tables.DistanceExtra[distanceCode] > 0) {
+					PutBits(distanceMinusOne + 1 - tables.DistanceBase[distanceCode], tables.DistanceExtra[distanceCode]);
+				}
+			}
+			else {
+				PutBits(pLiteralLengthCodes[symbol], pLiteralLengthLengths[symbol]);
+			}
+		}
+		PutBits(pLiteralLengthCodes[256], pLiteralLengthLengths[256]);
+	}
+
+	/// <summary>
+	/// Writes the symbols gathered since blockStart as one block, with dynamic or fixed codes, or stored, whichever is smallest.
+	/// </summary>
+	void WriteBlock(const uint8_t *pData, int32_t blockEnd, bool isFinal)
+	{
+		m_LiteralLengthFrequencies[256] = 1;
+
+		uint8_t literalLengthLengths[LITERAL_LENGTH_CODES];
+		uint8_t distanceLengths[DISTANCE_CODES];
+		BuildCodeLengths(m_LiteralLengthFrequencies, 286, 15, literalLengthLengths);
+		literalLengthLengths[286] = literalLengthLengths[287] = 0;
+		BuildCodeLengths(m_DistanceFrequencies, 30, 15, distanceLengths);
+		distanceLengths[30] = distanceLengths[31] = 0;
+		int literalLengthCount = 286;
+		while (literalLengthCount > 257 && literalLengthLengths[literalLengthCount - 1] == 0) {
+			literalLengthCount--;
+		}
+		int distanceCount = 30;
+		while (distanceCount > 1 && distanceLengths[distanceCount - 1] == 0) {
+			distanceCount--;
+		}
+		//The code lengths of both codes are run length encoded together.
+		uint8_t combinedLengths[286 + 30];
+		memcpy(combinedLengths, literalLengthLengths, literalLengthCount);
+		memcpy(combinedLengths + literalLengthCount, distanceLengths, distanceCount);
+		std::vector<CODE_LENGTH_SYMBOL> codeLengthSymbols;
+		uint32_t codeLengthFrequencies[CODE_LENGTH_CODES] = {};
+		EncodeCodeLengths(combinedLengths, literalLengthCount + distanceCount, codeLengthSymbols, codeLengthFrequencies);
+		uint8_t codeLengthLengths[CODE_LENGTH_CODES];
+		BuildCodeLengths(codeLengthFrequencies, CODE_LENGTH_CODES, 7, codeLengthLengths);
+		static const uint8_t CODE_LENGTH_ORDER[CODE_LENGTH_CODES] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+		int codeLengthCount = CODE_LENGTH_CODES;
+		while (codeLengthCount > 4 && codeLengthLengths[CODE_LENGTH_ORDER[codeLengthCount - 1]] == 0) {
+			codeLengthCount--;
+		}
+
+		uint64_t dynamicBits = 3 + 5 + 5 + 4 + 3 * static_cast<uint64_t>(codeLengthCount) + GetSymbolBits(literalLengthLengths, distanceLengths);
+		for (const CODE_LENGTH_SYMBOL &symbol : codeLengthSymbols) {
+			dynamicBits += codeLengthLengths[symbol.Symbol] + (symbol.Symbol == 16 ? 2 : symbol.Symbol == 17 ? 3 : symbol.Symbol == 18 ? 7 : 0);
+		}
+		uint8_t fixedLiteralLengthLengths[LITERAL_LENGTH_CODES];
+		uint8_t fixedDistanceLengths[DISTANCE_CODES];
+		for (int i = 0; i < LITERAL_LENGTH_CODES; i++) {
+			fixedLiteralLengthLengths[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+		}
+		memset(fixedDistanceLengths, 5, sizeof(fixedDistanceLengths));
+		uint64_t fixedBits = 3 + GetSymbolBits(fixedLiteralLengthLengths, fixedDistanceLengths);
+		uint64_t blockSize = static_cast<uint64_t>(blockEnd - m_BlockStart);
+		uint64_t storedBits = (blockSize + 5 * ((blockSize / 65535) + 1)) * 8 + 7;
+
+		if (storedBits < dynamicBits && storedBits < fixedBits) {
+			WriteStoredBlocks(pData + m_BlockStart, static_cast<size_t>(blockSize), isFinal);
+		}
+		else if (fixedBits <= dynamicBits) {
+			uint16_t literalLengthCodes[LITERAL_LENGTH_CODES];
+			uint16_t distanceCodes[DISTANCE_CODES];
+			BuildCodes(fixedLiteralLengthLengths, LITERAL_LENGTH_CODES, literalLengthCodes);
+			BuildCodes(fixedDistanceLengths, DISTANCE_CODES, distanceCodes);
+			PutBits(isFinal ? 1 : 0, 1);
+			PutBits(1, 2);
+			WriteSymbols(fixedLiteralLengthLengths, literalLengthCodes, fixedDistanceLengths, distanceCodes);
+		}
+		else {
+			uint16_t literalLengthCodes[LITERAL_LENGTH_CODES];
+			uint16_t distanceCodes[DISTANCE_CODES];
+			uint16_t codeLengthCodes[CODE_LENGTH_CODES];
+			BuildCodes(literalLengthLengths, LITERAL_LENGTH_CODES, literalLengthCodes);
+			BuildCodes(distanceLengths, DISTANCE_CODES, distanceCodes);
+			BuildCodes(codeLengthLengths, CODE_LENGTH_CODES, codeLengthCodes);
+			PutBits(isFinal ? 1 : 0, 1);
+			PutBits(2, 2);
+			PutBits(literalLengthCount - 257, 5);
+			PutBits(distanceCount - 1, 5);
+			PutBits(codeLengthCount - 4, 4);
+			for (int i = 0; i < codeLengthCount; i++) {
+				PutBits(codeLengthLengths[CODE_LENGTH_ORDER[i]], 3);
+			}
+			for (const CODE_LENGTH_SYMBOL &symbol : codeLengthSymbols) {
+				PutBits(codeLengthCodes[symbol.Symbol], codeLengthLengths[symbol.Symbol]);
+				if (symbol.Symbol == 16) {
+					PutBits(symbol.Extra, 2);
+				}
+				else if (symbol.Symbol == 17) {
+					PutBits(symbol.Extra, 3);
+				}
+				else if (symbol.Symbol == 18) {
+					PutBits(symbol.Extra, 7);
+				}
+			}
+			WriteSymbols(literalLengthLengths, literalLengthCodes, distanceLengths, distanceCodes);
+		}
+	}
+
+	void WriteStoredBlocks(const uint8_t *pData, size_t size, bool isFinal)
+	{
+		do {
+			uint32_t length = static_cast<uint32_t>((std::min)(size, (size_t)65535));
+			size -= length;
+			PutBits(isFinal && size == 0 ? 1 : 0, 1);
+			PutBits(0, 2);
+			AlignToByte();
+			PutBits(length, 16);
+			PutBits(~length & 0xFFFF, 16);
+			FlushBits();
+			m_pOutput->insert(m_pOutput->end(), pData, pData + length);
+			pData += length;
+		} while (size > 0);
+	}
+};
@@ -30,7 +30,8 @@ DesktopDuplicationCapture::DesktopDuplicationCapture() :
 	m_CursorScaleY(1.0),
 	m_BitmapDataCallbackTexture(nullptr),
 	m_BitmapDataCallbackTextureDesc{},
-	m_BitmapDataCallbackPtrInfo{}
+	m_BitmapDataCallbackPtrInfo{},
+	m_UpdatedRegion{}
 {
 	RtlZeroMemory(&m_CurrentData, sizeof(m_CurrentData));
 	RtlZeroMemory(&m_OutputDesc, sizeof(m_OutputDesc));
@@ -120,6 +121,7 @@ HRESULT DesktopDuplicationCapture::WriteNextFrameToSharedSurface(_In_ DWORD time
 	}
 
 	if (SUCCEEDED(hr)) {
+		m_UpdatedRegion.Clear();
 		DXGI_MODE_ROTATION rotation = m_OutputDesc.Rotation;
 		D3D11_TEXTURE2D_DESC frameDesc;
 		m_CurrentData.Frame->GetDesc(&frameDesc);
@@ -194,6 +196,7 @@ HRESULT DesktopDuplicationCapture::WriteNextFrameToSharedSurface(_In_ DWORD time
 				int dstY = destinationRect.top + offsetY + contentOffset.cy;
 
 				m_DeviceContext->CopySubresourceRegion(pSharedSurf, 0, dstX, dstY, 0, pProcessedTexture, 0, &Box);
+				m_UpdatedRegion.Add(RECT{ dstX, dstY, dstX + static_cast<LONG>(Box.right), dstY + static_cast<LONG>(Box.bottom) });
 
 				SendBitmapCallback(pSharedSurf, SIZE{ offsetX,offsetY }, contentOffset, destinationRect);
 
@@ -205,6 +208,7 @@ HRESULT DesktopDuplicationCapture::WriteNextFrameToSharedSurface(_In_ DWORD time
 			else
 			{
 				// Process dirties and moves
+				SetUpdatedRects(reinterpret_cast<DXGI_OUTDUPL_MOVE_RECT *>(m_CurrentData.MetaData), m_CurrentData.MoveCount, reinterpret_cast<RECT *>(m_CurrentData.MetaData + (m_CurrentData.MoveCount * sizeof(DXGI_OUTDUPL_MOVE_RECT))), m_CurrentData.DirtyCount, offsetX, offsetY, destinationRect, rotation);
 				if (m_CurrentData.MoveCount)
 				{
 					RETURN_ON_BAD_HR(hr = CopyMove(pSharedSurf, reinterpret_cast<DXGI_OUTDUPL_MOVE_RECT *>(m_CurrentData.MetaData), m_CurrentData.MoveCount, offsetX, offsetY, destinationRect, rotation));
@@ -633,18 +637,13 @@ void DesktopDuplicationCapture::SetDirtyVert(_Out_writes_(NUMVERTICES) VERTEX *p
 	INT Height = RectHeight(desktopCoordinates);
 
 	// Rotation compensated destination rect
-	RECT DestDirty = *pDirty;
+	RECT DestDirty = GetRotatedDirtyRect(pDirty, rotation, Width, Height);
 
 	// Set appropriate coordinates compensated for rotation
 	switch (rotation)
 	{
 		case DXGI_MODE_ROTATION_ROTATE90:
 		{
-			DestDirty.left = Width - pDirty->bottom;
-			DestDirty.top = pDirty->left;
-			DestDirty.right = Width - pDirty->top;
-			DestDirty.bottom = pDirty->right;
-
 			pVertices[0].TexCoord = XMFLOAT2(pDirty->right / static_cast<FLOAT>(pThisDesc->Width), pDirty->bottom / static_cast<FLOAT>(pThisDesc->Height));
 			pVertices[1].TexCoord = XMFLOAT2(pDirty->left / static_cast<FLOAT>(pThisDesc->Width), pDirty->bottom / static_cast<FLOAT>(pThisDesc->Height));
 			pVertices[2].TexCoord = XMFLOAT2(pDirty->right / static_cast<FLOAT>(pThisDesc->Width), pDirty->top / static_cast<FLOAT>(pThisDesc->Height));
@@ -653,11 +652,6 @@ void DesktopDuplicationCapture::SetDirtyVert(_Out_writes_(NUMVERTICES) VERTEX *p
 		}
 		case DXGI_MODE_ROTATION_ROTATE180:
 		{
-			DestDirty.left = Width - pDirty->right;
-			DestDirty.top = Height - pDirty->bottom;
-			DestDirty.right = Width - pDirty->left;
-			DestDirty.bottom = Height - pDirty->top;
-
 			pVertices[0].TexCoord = XMFLOAT2(pDirty->right / static_cast<FLOAT>(pThisDesc->Width), pDirty->top / static_cast<FLOAT>(pThisDesc->Height));
 			pVertices[1].TexCoord = XMFLOAT2(pDirty->right / static_cast<FLOAT>(pThisDesc->Width), pDirty->bottom / static_cast<FLOAT>(pThisDesc->Height));
 			pVertices[2].TexCoord = XMFLOAT2(pDirty->left / static_cast<FLOAT>(pThisDesc->Width), pDirty->top / static_cast<FLOAT>(pThisDesc->Height));
@@ -666,11 +660,6 @@ void DesktopDuplicationCapture::SetDirtyVert(_Out_writes_(NUMVERTICES) VERTEX *p
 		}
 		case DXGI_MODE_ROTATION_ROTATE270:
 		{
-			DestDirty.left = pDirty->top;
-			DestDirty.top = Height - pDirty->right;
-			DestDirty.right = pDirty->bottom;
-			DestDirty.bottom = Height - pDirty->left;
-
 			pVertices[0].TexCoord = XMFLOAT2(pDirty->left / static_cast<FLOAT>(pThisDesc->Width), pDirty->top / static_cast<FLOAT>(pThisDesc->Height));
 			pVertices[1].TexCoord = XMFLOAT2(pDirty->right / static_cast<FLOAT>(pThisDesc->Width), pDirty->top / static_cast<FLOAT>(pThisDesc->Height));
 			pVertices[2].TexCoord = XMFLOAT2(pDirty->left / static_cast<FLOAT>(pThisDesc->Width), pDirty->bottom / static_cast<FLOAT>(pThisDesc->Height));
@@ -712,6 +701,72 @@ void DesktopDuplicationCapture::SetDirtyVert(_Out_writes_(NUMVERTICES) VERTEX *p
 
 #pragma warning(pop) // re-enable __WARNING_USING_UNINIT_VAR
 
+//
+// Returns the destination of a dirty rect in the desktop image, compensated for rotation
+//
+RECT DesktopDuplicationCapture::GetRotatedDirtyRect(_In_ RECT *pDirty, _In_ DXGI_MODE_ROTATION rotation, INT width, INT height)
+{
+	RECT destDirty = *pDirty;
+	switch (rotation)
+	{
+		case DXGI_MODE_ROTATION_ROTATE90:
+		{
+			destDirty.left = width - pDirty->bottom;
+			destDirty.top = pDirty->left;
+			destDirty.right = width - pDirty->top;
+			destDirty.bottom = pDirty->right;
+			break;
+		}
+		case DXGI_MODE_ROTATION_ROTATE180:
+		{
+			destDirty.left = width - pDirty->right;
+			destDirty.top = height - pDirty->bottom;
+			destDirty.right = width - pDirty->left;
+			destDirty.bottom = height - pDirty->top;
+			break;
+		}
+		case DXGI_MODE_ROTATION_ROTATE270:
+		{
+			destDirty.left = pDirty->top;
+			destDirty.top = height - pDirty->right;
+			destDirty.right = pDirty->bottom;
+			destDirty.bottom = height - pDirty->left;
+			break;
+		}
+		default:
+			break;
+	}
+	return destDirty;
+}
+
+//
+// Records the areas of the shared surface written by the move and dirty rects of a frame
+//
+void DesktopDuplicationCapture::SetUpdatedRects(_In_reads_(moveCount) DXGI_OUTDUPL_MOVE_RECT *pMoveBuffer, UINT moveCount, _In_reads_(dirtyCount) RECT *pDirtyBuffer, UINT dirtyCount, INT offsetX, INT offsetY, _In_ RECT desktopCoordinates, _In_ DXGI_MODE_ROTATION rotation)
+{
+	int texWidth = RectWidth(desktopCoordinates);
+	int texHeight = RectHeight(desktopCoordinates);
+	for (UINT i = 0; i < moveCount; ++i)
+	{
+		RECT srcRect;
+		RECT destRect;
+		SetMoveRect(&srcRect, &destRect, rotation, &(pMoveBuffer[i]), texWidth, texHeight);
+		OffsetRect(&destRect, desktopCoordinates.left + offsetX, desktopCoordinates.top + offsetY);
+		m_UpdatedRegion.Add(destRect);
+	}
+	for (UINT i = 0; i < dirtyCount; ++i)
+	{
+		RECT destDirty = GetRotatedDirtyRect(&(pDirtyBuffer[i]), rotation, texWidth, texHeight);
+		OffsetRect(&destDirty, desktopCoordinates.left + offsetX, desktopCoordinates.top + offsetY);
+		m_UpdatedRegion.Add(destDirty);
+	}
+}
+
+void DesktopDuplicationCapture::GetUpdatedRegion(_In_ RECT sourceRect, _Inout_ DirtyRegion *pRegion)
+{
+	pRegion->Add(m_UpdatedRegion);
+}
+
 //
 // Copies dirty rectangles
 //
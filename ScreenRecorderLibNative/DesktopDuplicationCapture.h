@@ -16,6 +16,7 @@ public:
 	virtual HRESULT StartCapture(_In_ RECORDING_SOURCE_BASE &recordingSource) override;
 	virtual HRESULT GetNativeSize(_In_ RECORDING_SOURCE_BASE &recordingSource, _Out_ SIZE *nativeMediaSize) override;
 	virtual HRESULT GetMouse(_Inout_ PTR_INFO *pPtrInfo, _In_ RECT frameCoordinates, _In_ int offsetX, _In_ int offsetY) override;
+	virtual void GetUpdatedRegion(_In_ RECT sourceRect, _Inout_ DirtyRegion *pRegion) override;
 	virtual inline std::wstring Name() override { return L"DesktopDuplicationCapture"; };
 private:
 	static const int NUMVERTICES = 6;
@@ -26,10 +27,14 @@ private:
 	HRESULT CopyMove(_Inout_ ID3D11Texture2D *pSharedSurf, _In_reads_(moveCount) DXGI_OUTDUPL_MOVE_RECT *pMoveBuffer, UINT moveCount, INT offsetX, INT offsetY, _In_ RECT desktopCoordinates, _In_ DXGI_MODE_ROTATION rotation);
 	void SetDirtyVert(_Out_writes_(NUMVERTICES) VERTEX *pVertices, _In_ RECT *pDirty, INT offsetX, INT offsetY, _In_ RECT desktopCoordinates, _In_ DXGI_MODE_ROTATION rotation, _In_ D3D11_TEXTURE2D_DESC *pFullDesc, _In_ D3D11_TEXTURE2D_DESC *pThisDesc);
 	void SetMoveRect(_Out_ RECT *SrcRect, _Out_ RECT *pDestRect, _In_ DXGI_MODE_ROTATION rotation, _In_ DXGI_OUTDUPL_MOVE_RECT *pMoveRect, INT texWidth, INT texHeight);
+	RECT GetRotatedDirtyRect(_In_ RECT *pDirty, _In_ DXGI_MODE_ROTATION rotation, INT width, INT height);
+	void SetUpdatedRects(_In_reads_(moveCount) DXGI_OUTDUPL_MOVE_RECT *pMoveBuffer, UINT moveCount, _In_reads_(dirtyCount) RECT *pDirtyBuffer, UINT dirtyCount, INT offsetX, INT offsetY, _In_ RECT desktopCoordinates, _In_ DXGI_MODE_ROTATION rotation);
 	HRESULT SendBitmapCallback(_In_ ID3D11Texture2D *pSharedSurf, _In_ SIZE frameOffset, _In_ SIZE contentOffset, _In_ RECT destinationRect);
 
 	std::unique_ptr<MouseManager> m_MouseManager;
 	DUPL_FRAME_DATA m_CurrentData;
+	//The area of the shared surface written by the last call to WriteNextFrameToSharedSurface.
+	DirtyRegion m_UpdatedRegion;
 
 	ID3D11Texture2D *m_BitmapDataCallbackTexture;
 	D3D11_TEXTURE2D_DESC m_BitmapDataCallbackTextureDesc;
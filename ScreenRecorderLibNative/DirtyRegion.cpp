@@ -0,0 +1,198 @@
+#include "DirtyRegion.h"
+#include <algorithm>
+
+namespace {
+	//Division rounding towards negative infinity. The divisor must be positive.
+	inline int64_t FloorDiv(int64_t value, int64_t divisor) {
+		int64_t quotient = value / divisor;
+		return (value % divisor != 0 && value < 0) ? quotient - 1 : quotient;
+	}
+	//Division rounding towards positive infinity. The divisor must be positive.
+	inline int64_t CeilDiv(int64_t value, int64_t divisor) {
+		return -FloorDiv(-value, divisor);
+	}
+	inline int32_t Saturate(int64_t value) {
+		return (int32_t)(std::max)((int64_t)INT32_MIN, (std::min)((int64_t)INT32_MAX, value));
+	}
+}
+
+DirtyRegion::DirtyRegion(size_t maxRects) :
+	m_MaxRects((std::max)(maxRects, (size_t)1)),
+	m_Rects{},
+	m_Scratch{}
+{
+	m_Rects.reserve(m_MaxRects + 1);
+}
+
+REGION_RECT DirtyRegion::Union(const REGION_RECT &a, const REGION_RECT &b)
+{
+	return REGION_RECT{ (std::min)(a.left, b.left), (std::min)(a.top, b.top), (std::max)(a.right, b.right), (std::max)(a.bottom, b.bottom) };
+}
+
+REGION_RECT DirtyRegion::Intersect(const REGION_RECT &a, const REGION_RECT &b)
+{
+	REGION_RECT rect{ (std::max)(a.left, b.left), (std::max)(a.top, b.top), (std::min)(a.right, b.right), (std::min)(a.bottom, b.bottom) };
+	return rect.IsEmpty() ? REGION_RECT{} : rect;
+}
+
+bool DirtyRegion::Contains(const REGION_RECT &outer, const REGION_RECT &inner)
+{
+	return outer.left <= inner.left && outer.top <= inner.top && outer.right >= inner.right && outer.bottom >= inner.bottom;
+}
+
+uint64_t DirtyRegion::GetMergeWaste(const REGION_RECT &a, const REGION_RECT &b)
+{
+	uint64_t covered = a.Area() + b.Area() - Intersect(a, b).Area();
+	return Union(a, b).Area() - covered;
+}
+
+bool DirtyRegion::ShouldMerge(const REGION_RECT &a, const REGION_RECT &b)
+{
+	uint64_t covered = a.Area() + b.Area() - Intersect(a, b).Area();
+	uint64_t allowedWaste = covered / 100 * DIRTY_REGION_MERGE_SLACK_PERCENT + covered % 100 * DIRTY_REGION_MERGE_SLACK_PERCENT / 100;
+	return Union(a, b).Area() - covered <= allowedWaste;
+}
+
+void DirtyRegion::Add(const REGION_RECT &rect)
+{
+	if (rect.IsEmpty()) {
+		return;
+	}
+	Insert(rect);
+	if (m_Rects.size() > m_MaxRects) {
+		MergeNewestRect();
+	}
+}
+
+void DirtyRegion::Add(const DirtyRegion &region)
+{
+	if (&region == this) {
+		return;
+	}
+	for (const REGION_RECT &rect : region.m_Rects) {
+		Add(rect);
+	}
+}
+
+void DirtyRegion::Insert(REGION_RECT rect)
+{
+	//Absorb every rect that can be merged with the new one. A merge grows the rect, which can make it mergeable with rects already checked, so start over after each.
+	for (size_t i = 0; i < m_Rects.size();) {
+		const REGION_RECT &existing = m_Rects[i];
+		if (Contains(existing, rect)) {
+			return;
+		}
+		if (Contains(rect, existing) || ShouldMerge(existing, rect)) {
+			rect = Union(existing, rect);
+			m_Rects[i] = m_Rects.back();
+			m_Rects.pop_back();
+			i = 0;
+			continue;
+		}
+		i++;
+	}
+	m_Rects.push_back(rect);
+}
+
+void DirtyRegion::MergeNewestRect()
+{
+	//Insert always appends, so the last rect is the one just added.
+	REGION_RECT newest = m_Rects.back();
+	m_Rects.pop_back();
+	size_t cheapest = 0;
+	uint64_t lowestWaste = UINT64_MAX;
+	for (size_t i = 0; i < m_Rects.size(); i++) {
+		uint64_t waste = GetMergeWaste(m_Rects[i], newest);
+		if (waste < lowestWaste) {
+			lowestWaste = waste;
+			cheapest = i;
+		}
+	}
+	REGION_RECT merged = Union(m_Rects[cheapest], newest);
+	m_Rects[cheapest] = m_Rects.back();
+	m_Rects.pop_back();
+	Insert(merged);
+}
+
+void DirtyRegion::Clear()
+{
+	m_Rects.clear();
+}
+
+void DirtyRegion::Clip(const REGION_RECT &bounds)
+{
+	size_t count = 0;
+	for (size_t i = 0; i < m_Rects.size(); i++) {
+		REGION_RECT clipped = Intersect(m_Rects[i], bounds);
+		if (!clipped.IsEmpty()) {
+			m_Rects[count++] = clipped;
+		}
+	}
+	m_Rects.resize(count);
+}
+
+void DirtyRegion::Offset(int32_t dx, int32_t dy)
+{
+	for (REGION_RECT &rect : m_Rects) {
+		rect.left = Saturate((int64_t)rect.left + dx);
+		rect.top = Saturate((int64_t)rect.top + dy);
+		rect.right = Saturate((int64_t)rect.right + dx);
+		rect.bottom = Saturate((int64_t)rect.bottom + dy);
+	}
+}
+
+void DirtyRegion::Transform(const REGION_RECT &source, const REGION_RECT &destination, int32_t margin)
+{
+	if (source.IsEmpty() || destination.IsEmpty()) {
+		Clear();
+		return;
+	}
+	int64_t sourceWidth = source.Width();
+	int64_t sourceHeight = source.Height();
+	int64_t destinationWidth = destination.Width();
+	int64_t destinationHeight = destination.Height();
+	//Scaling can make rects overlap or touch that did not before, so the mapped rects are added again to coalesce them.
+	m_Scratch.swap(m_Rects);
+	m_Rects.clear();
+	for (const REGION_RECT &rect : m_Scratch) {
+		REGION_RECT mapped{
+			Saturate(destination.left + FloorDiv(((int64_t)rect.left - source.left) * destinationWidth, sourceWidth) - margin),
+			Saturate(destination.top + FloorDiv(((int64_t)rect.top - source.top) * destinationHeight, sourceHeight) - margin),
+			Saturate(destination.left + CeilDiv(((int64_t)rect.right - source.left) * destinationWidth, sourceWidth) + margin),
+			Saturate(destination.top + CeilDiv(((int64_t)rect.bottom - source.top) * destinationHeight, sourceHeight) + margin)
+		};
+		Add(Intersect(mapped, destination));
+	}
+	m_Scratch.clear();
+}
+
+REGION_RECT DirtyRegion::GetBounds() const
+{
+	if (m_Rects.empty()) {
+		return REGION_RECT{};
+	}
+	REGION_RECT bounds = m_Rects[0];
+	for (size_t i = 1; i < m_Rects.size(); i++) {
+		bounds = Union(bounds, m_Rects[i]);
+	}
+	return bounds;
+}
+
+uint64_t DirtyRegion::GetArea() const
+{
+	uint64_t area = 0;
+	for (const REGION_RECT &rect : m_Rects) {
+		area += rect.Area();
+	}
+	return area;
+}
+
+bool DirtyRegion::Intersects(const REGION_RECT &rect) const
+{
+	for (const REGION_RECT &existing : m_Rects) {
+		if (!Intersect(existing, rect).IsEmpty()) {
+			return true;
+		}
+	}
+	return false;
+}
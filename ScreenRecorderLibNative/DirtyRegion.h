@@ -0,0 +1,101 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+//Default largest number of rects kept in a DirtyRegion. A rect added to a full region is merged with the rect that wastes the least area when merged.
+#define DIRTY_REGION_DEFAULT_MAX_RECTS 16
+//Two rects are merged when their bounding box is at most this many percent larger than the area they cover,
+//so adjacent and heavily overlapping rects become one, while rects far apart are kept separate.
+#define DIRTY_REGION_MERGE_SLACK_PERCENT 25
+
+/// <summary>
+/// A rect with exclusive right and bottom edges, with the same layout as the Windows RECT.
+/// </summary>
+struct REGION_RECT {
+	int32_t left = 0;
+	int32_t top = 0;
+	int32_t right = 0;
+	int32_t bottom = 0;
+
+	inline int64_t Width() const { return (int64_t)right - left; }
+	inline int64_t Height() const { return (int64_t)bottom - top; }
+	inline bool IsEmpty() const { return right <= left || bottom <= top; }
+	inline uint64_t Area() const { return IsEmpty() ? 0 : (uint64_t)(Width() * Height()); }
+	inline bool operator==(const REGION_RECT &other) const { return left == other.left && top == other.top && right == other.right && bottom == other.bottom; }
+	inline bool operator!=(const REGION_RECT &other) const { return !(*this == other); }
+};
+
+#ifdef _WIN32
+inline REGION_RECT ToRegionRect(const RECT &rect) { return REGION_RECT{ rect.left, rect.top, rect.right, rect.bottom }; }
+inline RECT ToRECT(const REGION_RECT &rect) { return RECT{ rect.left, rect.top, rect.right, rect.bottom }; }
+#endif
+
+/// <summary>
+/// The changed area of a frame, as a short list of rects.
+/// Added rects are coalesced with the ones already in the region when that costs little extra area, and the list is capped,
+/// so consumers can copy or process each rect separately without the overhead growing with the number of small updates.
+/// The rects may overlap, and together always cover every added rect. Cleared regions keep their memory, so reusing a region does not allocate.
+/// </summary>
+class DirtyRegion
+{
+public:
+	DirtyRegion(size_t maxRects = DIRTY_REGION_DEFAULT_MAX_RECTS);
+
+	/// <summary>
+	/// Adds a rect to the region. Empty rects are ignored.
+	/// </summary>
+	void Add(const REGION_RECT &rect);
+	/// <summary>
+	/// Adds all rects of another region.
+	/// </summary>
+	void Add(const DirtyRegion &region);
+#ifdef _WIN32
+	inline void Add(const RECT &rect) { Add(ToRegionRect(rect)); }
+#endif
+	void Clear();
+	/// <summary>
+	/// Limits the region to the given bounds.
+	/// </summary>
+	void Clip(const REGION_RECT &bounds);
+	void Offset(int32_t dx, int32_t dy);
+	/// <summary>
+	/// Maps the region from one coordinate space to another, e.g. from the source to the destination of a resize, and clips it to the destination.
+	/// Rects are rounded outwards, and grown by the margin to cover pixels that sample across the rect edges when filtered.
+	/// </summary>
+	void Transform(const REGION_RECT &source, const REGION_RECT &destination, int32_t margin);
+
+	inline bool IsEmpty() const { return m_Rects.empty(); }
+	inline size_t GetCount() const { return m_Rects.size(); }
+	inline const std::vector<REGION_RECT> &GetRects() const { return m_Rects; }
+	inline size_t GetMaxRects() const { return m_MaxRects; }
+	/// <summary>
+	/// The bounding box of all rects in the region, or an empty rect if the region is empty.
+	/// </summary>
+	REGION_RECT GetBounds() const;
+	/// <summary>
+	/// The summed area of the rects. Overlapping parts are counted once for each rect, so this is at least the covered area.
+	/// </summary>
+	uint64_t GetArea() const;
+	bool Intersects(const REGION_RECT &rect) const;
+
+	static REGION_RECT Union(const REGION_RECT &a, const REGION_RECT &b);
+	static REGION_RECT Intersect(const REGION_RECT &a, const REGION_RECT &b);
+	static bool Contains(const REGION_RECT &outer, const REGION_RECT &inner);
+
+private:
+	size_t m_MaxRects;
+	std::vector<REGION_RECT> m_Rects;
+	//Reused by Transform, so it does not allocate.
+	std::vector<REGION_RECT> m_Scratch;
+
+	void Insert(REGION_RECT rect);
+	//Merges the most recently added rect with the rect that wastes the least area, when the region has too many rects.
+	void MergeNewestRect();
+	//The area the bounding box of two rects covers that neither of the rects do.
+	static uint64_t GetMergeWaste(const REGION_RECT &a, const REGION_RECT &b);
+	static bool ShouldMerge(const REGION_RECT &a, const REGION_RECT &b);
+};
@@ -0,0 +1,345 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+enum class FramePacingMode {
+	///<summary>Frames are due on a fixed grid of intervals from the first frame. Frames the producer is already too late for are skipped, and the grid is kept.</summary>
+	FixedRate = 0,
+	///<summary>Frames are due at most once per interval. While the producer keeps up, frames follow a fixed grid, and after a gap the grid restarts at the next frame.
+	///Frames produced before they are due do not move the grid.</summary>
+	VariableRate = 1,
+	///<summary>Each frame is due one interval after the frame before it was due, where the interval may change from frame to frame, e.g. the delays of an animated GIF.
+	///A producer falling more than an interval behind restarts the schedule.</summary>
+	Deadline = 2
+};
+
+struct FRAME_PACING_STATS {
+	//Frames produced.
+	uint64_t Frames = 0;
+	//Frames that were due while the producer was still busy with an earlier one, and were skipped. Only fixed rate pacing skips frames.
+	uint64_t Skipped = 0;
+	//Frames produced more than half an interval after they were due.
+	uint64_t Late = 0;
+	//Times the schedule restarted at a frame, because of a gap in variable rate pacing, a producer falling behind in deadline pacing, or Restart.
+	uint64_t Restarts = 0;
+	//How far frames were produced from when they were due, in 100 nanosecond units. The first frame, and frames after a gap or ahead of time in variable rate pacing, are not counted.
+	uint64_t JitterFrames = 0;
+	int64_t TotalJitter = 0;
+	int64_t MaxJitter = 0;
+	double TotalSquaredJitter = 0;
+	//The offset of the last frame from when it was due, positive if it was late. Since frames are scheduled on a grid rather than from the previous frame,
+	//this does not grow with the number of frames unless the producer is falling behind.
+	int64_t Drift = 0;
+
+	double GetMeanJitter() const {
+		return JitterFrames > 0 ? static_cast<double>(TotalJitter) / JitterFrames : 0;
+	}
+	double GetRmsJitter() const {
+		return JitterFrames > 0 ? std::sqrt(TotalSquaredJitter / JitterFrames) : 0;
+	}
+};
+
+/// <summary>
+/// The clock a FramePacer schedules frames against, e.g. the media clock of the recording.
+/// </summary>
+class IFramePacingClock
+{
+public:
+	virtual ~IFramePacingClock() {}
+	/// <summary>
+	/// The current time, in 100 nanosecond units.
+	/// </summary>
+	virtual int64_t GetTime() = 0;
+	/// <summary>
+	/// Waits until the clock reaches the given time. The wait may end slightly early, and the pacer waits again if it does.
+	/// </summary>
+	/// <returns>false if the clock was canceled</returns>
+	virtual bool WaitUntil(int64_t time) = 0;
+	/// <summary>
+	/// Ends any wait in progress, and makes later waits fail.
+	/// </summary>
+	virtual void Cancel() = 0;
+};
+
+/// <summary>
+/// Schedules the frames of a producer, e.g. the recorder loop or a video file source, against a clock.
+/// Frames are scheduled on a grid from the start of the schedule rather than from when the previous frame was produced,
+/// so the time it takes to wake up and produce each frame does not add up to drift.
+/// The producer either waits for each frame with WaitForNextFrame, or waits on its own, e.g. for a captured frame with a timeout of GetTimeUntilNextFrame, and reports the frames with OnFrame.
+/// The first frame is due immediately and starts the schedule. Waits and frames come from one thread, while Cancel and GetStats may be called from any thread.
+/// </summary>
+class FramePacer
+{
+public:
+	FramePacer(std::shared_ptr<IFramePacingClock> clock, FramePacingMode mode) :
+		m_Clock(clock),
+		m_Mode(mode),
+		m_IntervalNumerator(0),
+		m_IntervalDenominator(1),
+		m_IsStarted(false),
+		m_Anchor(0),
+		m_Index(0),
+		m_LastDue(0),
+		m_Stats{}
+	{
+	}
+	FramePacer(const FramePacer &) = delete;
+	FramePacer &operator=(const FramePacer &) = delete;
+
+	/// <summary>
+	/// Sets the interval between frames, in 100 nanosecond units. Takes effect from the next frame.
+	/// </summary>
+	void SetInterval(int64_t interval)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		SetIntervalRatio((std::max)(interval, (int64_t)0), 1);
+	}
+
+	/// <summary>
+	/// Sets the interval between frames from a frame rate. The interval is kept as a fraction, so rates like 30 or 29.97 frames per second do not drift from rounding.
+	/// </summary>
+	void SetFrameRate(double framesPerSecond)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		int64_t millihertz = framesPerSecond > 0 ? std::llround(framesPerSecond * 1000) : 0;
+		if (millihertz > 0) {
+			SetIntervalRatio(10000000000ll, millihertz);
+		}
+		else {
+			SetIntervalRatio(0, 1);
+		}
+	}
+
+	/// <summary>
+	/// The interval between frames, in 100 nanosecond units, rounded down.
+	/// </summary>
+	int64_t GetInterval()
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		return m_IntervalNumerator / m_IntervalDenominator;
+	}
+
+	/// <summary>
+	/// Restarts the schedule, so the next frame is due immediately, e.g. after the producer was paused.
+	/// </summary>
+	void Restart()
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_IsStarted = false;
+	}
+
+	/// <summary>
+	/// When the next frame is due.
+	/// </summary>
+	int64_t GetNextFrameTime()
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		return m_IsStarted ? GetNextDue() : m_Clock->GetTime();
+	}
+
+	/// <summary>
+	/// The time until the next frame is due, or 0 if it is already due.
+	/// </summary>
+	int64_t GetTimeUntilNextFrame()
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		return m_IsStarted ? (std::max)(GetNextDue() - m_Clock->GetTime(), (int64_t)0) : 0;
+	}
+
+	/// <summary>
+	/// Waits until the next frame is due, and counts it as produced.
+	/// </summary>
+	/// <returns>false if the clock was canceled</returns>
+	bool WaitForNextFrame()
+	{
+		int64_t due = GetNextFrameTime();
+		int64_t now = m_Clock->GetTime();
+		while (now < due) {
+			if (!m_Clock->WaitUntil(due)) {
+				return false;
+			}
+			now = m_Clock->GetTime();
+		}
+		OnFrame(now);
+		return true;
+	}
+
+	/// <summary>
+	/// Counts a frame as produced at the given time, and schedules the next one.
+	/// </summary>
+	void OnFrame(int64_t time)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stats.Frames++;
+		if (!m_IsStarted) {
+			StartSchedule(time);
+			return;
+		}
+		int64_t due = GetNextDue();
+		int64_t offset = time - due;
+		switch (m_Mode)
+		{
+		case FramePacingMode::FixedRate: {
+			m_Index++;
+			//Skip the frames that are already due, so a late producer does not catch up with a burst of frames.
+			int64_t skipTo = GetLastIndexDueBy(time);
+			if (skipTo > m_Index) {
+				m_Stats.Skipped += skipTo - m_Index;
+				m_Index = skipTo;
+			}
+			break;
+		}
+		case FramePacingMode::VariableRate:
+			if (time >= m_Anchor + GetOffset(m_Index + 2)) {
+				//The producer had nothing to produce for more than an interval, so this frame starts a new grid instead of counting as late.
+				StartSchedule(time);
+				m_Stats.Restarts++;
+				return;
+			}
+			if (offset < 0) {
+				//A frame produced before it was due, e.g. for an urgent change, leaves the grid as it is, so the next frame is not put off.
+				return;
+			}
+			m_Index++;
+			break;
+		case FramePacingMode::Deadline:
+			m_LastDue = due;
+			if (time >= due + GetOffset(1)) {
+				StartSchedule(time);
+				m_Stats.Restarts++;
+			}
+			break;
+		}
+		RecordOffset(offset);
+	}
+
+	/// <summary>
+	/// Ends any wait in progress, and makes later waits fail.
+	/// </summary>
+	void Cancel()
+	{
+		m_Clock->Cancel();
+	}
+
+	FRAME_PACING_STATS GetStats()
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		return m_Stats;
+	}
+
+private:
+	void SetIntervalRatio(int64_t numerator, int64_t denominator)
+	{
+		if (m_IsStarted && m_Mode != FramePacingMode::Deadline) {
+			//Keep the frames already scheduled where they are, and apply the new interval from the last frame on.
+			m_Anchor += GetOffset(m_Index);
+			m_Index = 0;
+		}
+		m_IntervalNumerator = numerator;
+		m_IntervalDenominator = denominator;
+	}
+
+	void StartSchedule(int64_t time)
+	{
+		m_IsStarted = true;
+		m_Anchor = time;
+		m_Index = 0;
+		m_LastDue = time;
+	}
+
+	//The time from the start of the grid to the frame with the given index.
+	int64_t GetOffset(int64_t index) const
+	{
+		return index * m_IntervalNumerator / m_IntervalDenominator;
+	}
+
+	int64_t GetNextDue() const
+	{
+		return m_Mode == FramePacingMode::Deadline ? m_LastDue + GetOffset(1) : m_Anchor + GetOffset(m_Index + 1);
+	}
+
+	//The index of the last frame on the grid due at or before the given time.
+	int64_t GetLastIndexDueBy(int64_t time) const
+	{
+		if (m_IntervalNumerator <= 0 || time < m_Anchor) {
+			return 0;
+		}
+		int64_t index = (time - m_Anchor) * m_IntervalDenominator / m_IntervalNumerator;
+		//Correct for the rounding of GetOffset.
+		while (m_Anchor + GetOffset(index + 1) <= time) {
+			index++;
+		}
+		while (index > 0 && m_Anchor + GetOffset(index) > time) {
+			index--;
+		}
+		return index;
+	}
+
+	void RecordOffset(int64_t offset)
+	{
+		int64_t jitter = offset < 0 ? -offset : offset;
+		m_Stats.JitterFrames++;
+		m_Stats.TotalJitter += jitter;
+		m_Stats.MaxJitter = (std::max)(m_Stats.MaxJitter, jitter);
+		m_Stats.TotalSquaredJitter += static_cast<double>(jitter) * jitter;
+		m_Stats.Drift = offset;
+		if (offset * 2 > GetOffset(1)) {
+			m_Stats.Late++;
+		}
+	}
+
+	std::mutex m_Mutex;
+	std::shared_ptr<IFramePacingClock> m_Clock;
+	const FramePacingMode m_Mode;
+	//The interval between frames is m_IntervalNumerator / m_IntervalDenominator, in 100 nanosecond units.
+	int64_t m_IntervalNumerator;
+	int64_t m_IntervalDenominator;
+	bool m_IsStarted;
+	//The time the grid starts at, and the index on the grid of the last frame produced.
+	int64_t m_Anchor;
+	int64_t m_Index;
+	//When the last frame was due. Deadline pacing schedules from it instead of from the grid, since its interval changes from frame to frame.
+	int64_t m_LastDue;
+	FRAME_PACING_STATS m_Stats;
+};
+
+/// <summary>
+/// A clock that only advances when it is waited on or advanced explicitly, so pacing can be simulated deterministically, e.g. in tests.
+/// A wake up latency can be added to every wait, to simulate a producer that wakes up late.
+/// </summary>
+class VirtualPacingClock : public IFramePacingClock
+{
+public:
+	VirtualPacingClock(int64_t startTime = 0) :
+		m_Time(startTime),
+		m_WakeLatency(0),
+		m_IsCanceled(false)
+	{
+	}
+	int64_t GetTime() override { return m_Time; }
+	bool WaitUntil(int64_t time) override {
+		if (m_IsCanceled) {
+			return false;
+		}
+		m_Time = (std::max)(m_Time.load(), time) + m_WakeLatency;
+		return true;
+	}
+	void Cancel() override { m_IsCanceled = true; }
+	/// <summary>
+	/// Moves the clock forward, e.g. by the time a simulated producer spends on a frame.
+	/// </summary>
+	void Advance(int64_t duration) { m_Time += duration; }
+	/// <summary>
+	/// Sets how long after the requested time every wait ends.
+	/// </summary>
+	void SetWakeLatency(int64_t latency) { m_WakeLatency = latency; }
+
+private:
+	std::atomic<int64_t> m_Time;
+	std::atomic<int64_t> m_WakeLatency;
+	std::atomic<bool> m_IsCanceled;
+};
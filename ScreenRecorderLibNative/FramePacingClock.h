@@ -0,0 +1,64 @@
+#pragma once
+#include "FramePacer.h"
+#include "HighresTimer.h"
+#include "Log.h"
+#include <atomic>
+#include <chrono>
+#include <functional>
+
+/// <summary>
+/// Paces frames against the steady clock of the system, waiting on a high resolution waitable timer.
+/// </summary>
+class HighresTimerPacingClock : public IFramePacingClock
+{
+public:
+	HighresTimerPacingClock() :
+		m_IsCanceled(false)
+	{
+	}
+	int64_t GetTime() override {
+		return std::chrono::duration_cast<std::chrono::duration<int64_t, std::ratio<1, 10000000>>>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+	bool WaitUntil(int64_t time) override {
+		if (m_IsCanceled) {
+			return false;
+		}
+		int64_t remaining = time - GetTime();
+		if (remaining <= 0) {
+			return true;
+		}
+		return SUCCEEDED(m_Timer.WaitFor(remaining));
+	}
+	void Cancel() override {
+		m_IsCanceled = true;
+		m_Timer.StopTimer(false);
+	}
+
+private:
+	HighresTimer m_Timer;
+	std::atomic<bool> m_IsCanceled;
+};
+
+/// <summary>
+/// Paces frames against a media clock, e.g. the presentation clock of the recording, so frames are scheduled on the recording timeline.
+/// Waits use a high resolution waitable timer, which assumes the media clock runs at the rate of the system clock while it is running.
+/// </summary>
+class MediaClockPacingClock : public HighresTimerPacingClock
+{
+public:
+	/// <param name="getTime">Gets the current time of the media clock, in 100 nanosecond units</param>
+	MediaClockPacingClock(std::function<HRESULT(INT64 *)> getTime) :
+		m_GetTime(getTime)
+	{
+	}
+	int64_t GetTime() override {
+		INT64 time = 0;
+		if (FAILED(m_GetTime(&time))) {
+			LOG_WARN(L"Failed to get media clock time for frame pacing");
+		}
+		return time;
+	}
+
+private:
+	std::function<HRESULT(INT64 *)> m_GetTime;
+};
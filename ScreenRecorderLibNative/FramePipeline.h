@@ -0,0 +1,521 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+enum class PipelineDropPolicy {
+	///<summary>Wait for room in the queue. A slow stage throttles the stages feeding it.</summary>
+	Block = 0,
+	///<summary>Drop the oldest queued item to make room for the new one.</summary>
+	DropOldest = 1,
+	///<summary>Drop the new item and keep the queued ones.</summary>
+	DropNewest = 2
+};
+
+struct PIPELINE_STAGE_STATS {
+	//Items processed by the stage.
+	uint64_t Processed = 0;
+	//Items dropped because the queue was full.
+	uint64_t Dropped = 0;
+	//Items queued without their costly part, e.g. the video frame, because the stage had fallen behind. Only optional outputs of a PipelineFanOut shed items.
+	uint64_t Shed = 0;
+	//Pushes that had to wait for room in the queue.
+	uint64_t Blocked = 0;
+	//Time spent by producers waiting for room in the queue, in 100 nanosecond units.
+	int64_t TotalBlockedTime = 0;
+	//Time from an item was queued until the stage started processing it, in 100 nanosecond units.
+	int64_t TotalQueueLatency = 0;
+	int64_t MaxQueueLatency = 0;
+	//Time spent processing items, in 100 nanosecond units.
+	int64_t TotalProcessingTime = 0;
+	int64_t MaxProcessingTime = 0;
+	//Items waiting in the queue.
+	size_t QueueDepth = 0;
+	size_t MaxQueueDepth = 0;
+};
+
+/// <summary>
+/// Bounded, blocking queue between two pipeline stages.
+/// When the queue is full, the drop policy decides whether the producer waits or an item is dropped. A dropped item can be folded into
+/// the item that survives it, e.g. to extend the duration of the surviving frame so the timeline stays continuous.
+/// Items popped by the consumer count as in flight until Complete is called, so WaitUntilIdle can tell when everything pushed has been handled.
+/// The items are held in a ring of Capacity slots created up front, so pushing and popping does not allocate.
+/// </summary>
+template <typename T>
+class PipelineQueue
+{
+public:
+	typedef std::function<void(T &dropped, T &survivor)> DropHandler;
+
+	PipelineQueue(size_t capacity, PipelineDropPolicy policy, DropHandler onDropped = nullptr) :
+		m_Capacity((std::max)(capacity, (size_t)1)),
+		m_Policy(policy),
+		m_OnDropped(onDropped),
+		m_Items(m_Capacity),
+		m_Head(0),
+		m_Count(0),
+		m_InFlight(0),
+		m_IsClosed(false)
+	{
+	}
+	PipelineQueue(const PipelineQueue &) = delete;
+	PipelineQueue &operator=(const PipelineQueue &) = delete;
+
+	/// <summary>
+	/// Queues an item, applying the drop policy if the queue is full.
+	/// </summary>
+	/// <returns>false if the item itself was dropped, or the queue is closed</returns>
+	bool Push(T &&item)
+	{
+		std::unique_lock<std::mutex> lock(m_Mutex);
+		if (m_IsClosed) {
+			return false;
+		}
+		if (m_Count >= m_Capacity) {
+			switch (m_Policy)
+			{
+			case PipelineDropPolicy::Block: {
+				auto blockedSince = std::chrono::steady_clock::now();
+				m_NotFullCondition.wait(lock, [&]() { return m_IsClosed || m_Count < m_Capacity; });
+				m_Stats.Blocked++;
+				m_Stats.TotalBlockedTime += ElapsedSince(blockedSince);
+				if (m_IsClosed) {
+					return false;
+				}
+				break;
+			}
+			case PipelineDropPolicy::DropOldest: {
+				QUEUE_ENTRY dropped = std::move(Front());
+				PopFront();
+				m_Stats.Dropped++;
+				if (m_OnDropped) {
+					m_OnDropped(dropped.Item, m_Count == 0 ? item : Front().Item);
+				}
+				break;
+			}
+			case PipelineDropPolicy::DropNewest:
+				m_Stats.Dropped++;
+				if (m_OnDropped) {
+					m_OnDropped(item, Back().Item);
+				}
+				return false;
+			}
+		}
+		QUEUE_ENTRY &entry = m_Items[(m_Head + m_Count) % m_Capacity];
+		entry.Item = std::move(item);
+		entry.Queued = std::chrono::steady_clock::now();
+		m_Count++;
+		m_Stats.MaxQueueDepth = (std::max)(m_Stats.MaxQueueDepth, m_Count);
+		lock.unlock();
+		m_NotEmptyCondition.notify_one();
+		return true;
+	}
+
+	/// <summary>
+	/// Waits for the next item. The item counts as in flight until Complete is called.
+	/// </summary>
+	/// <returns>false if the queue was closed</returns>
+	bool Pop(T *pItem)
+	{
+		std::unique_lock<std::mutex> lock(m_Mutex);
+		m_NotEmptyCondition.wait(lock, [&]() { return m_IsClosed || m_Count > 0; });
+		if (m_IsClosed) {
+			return false;
+		}
+		int64_t queueLatency = ElapsedSince(Front().Queued);
+		m_Stats.TotalQueueLatency += queueLatency;
+		m_Stats.MaxQueueLatency = (std::max)(m_Stats.MaxQueueLatency, queueLatency);
+		*pItem = std::move(Front().Item);
+		PopFront();
+		m_InFlight++;
+		lock.unlock();
+		m_NotFullCondition.notify_one();
+		return true;
+	}
+
+	/// <summary>
+	/// Marks an item returned by Pop as handled, recording how long it took.
+	/// </summary>
+	void Complete(int64_t processingTime)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_InFlight--;
+			m_Stats.Processed++;
+			m_Stats.TotalProcessingTime += processingTime;
+			m_Stats.MaxProcessingTime = (std::max)(m_Stats.MaxProcessingTime, processingTime);
+		}
+		m_IdleCondition.notify_all();
+	}
+
+	/// <summary>
+	/// Waits until the queue is empty and no item is in flight, or the queue is closed.
+	/// </summary>
+	/// <returns>false if the queue was closed before it became idle</returns>
+	bool WaitUntilIdle()
+	{
+		std::unique_lock<std::mutex> lock(m_Mutex);
+		m_IdleCondition.wait(lock, [&]() { return m_IsClosed || (m_Count == 0 && m_InFlight == 0); });
+		return !m_IsClosed;
+	}
+
+	/// <summary>
+	/// Discards all queued items, and makes any waiting or later Push and Pop calls fail.
+	/// </summary>
+	void Close()
+	{
+		//The discarded items are released outside the lock. A closed queue is never used again, so its slots are not needed anymore.
+		std::vector<QUEUE_ENTRY> discarded;
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_IsClosed = true;
+			discarded.swap(m_Items);
+			m_Head = 0;
+			m_Count = 0;
+		}
+		m_NotEmptyCondition.notify_all();
+		m_NotFullCondition.notify_all();
+		m_IdleCondition.notify_all();
+	}
+
+	bool IsClosed()
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		return m_IsClosed;
+	}
+
+	PIPELINE_STAGE_STATS GetStats()
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		PIPELINE_STAGE_STATS stats = m_Stats;
+		stats.QueueDepth = m_Count;
+		return stats;
+	}
+
+private:
+	struct QUEUE_ENTRY {
+		T Item;
+		std::chrono::steady_clock::time_point Queued;
+	};
+	const size_t m_Capacity;
+	const PipelineDropPolicy m_Policy;
+	DropHandler m_OnDropped;
+
+	std::mutex m_Mutex;
+	std::condition_variable m_NotEmptyCondition;
+	std::condition_variable m_NotFullCondition;
+	std::condition_variable m_IdleCondition;
+	//Ring of queued items, starting at m_Head.
+	std::vector<QUEUE_ENTRY> m_Items;
+	size_t m_Head;
+	size_t m_Count;
+	size_t m_InFlight;
+	bool m_IsClosed;
+	PIPELINE_STAGE_STATS m_Stats;
+
+	QUEUE_ENTRY &Front() { return m_Items[m_Head]; }
+	QUEUE_ENTRY &Back() { return m_Items[(m_Head + m_Count - 1) % m_Capacity]; }
+	//Removes the front entry, whose item must have been moved out. The slot is reset, so it does not keep anything the item referenced alive.
+	void PopFront()
+	{
+		m_Items[m_Head].Item = T();
+		m_Head = (m_Head + 1) % m_Capacity;
+		m_Count--;
+	}
+
+	static int64_t ElapsedSince(std::chrono::steady_clock::time_point start) {
+		return std::chrono::duration_cast<std::chrono::duration<int64_t, std::ratio<1, 10000000>>>(std::chrono::steady_clock::now() - start).count();
+	}
+};
+
+/// <summary>
+/// A pipeline stage that processes the items pushed to its input queue in order, on a dedicated worker thread.
+/// If the handler fails, the stage stops: queued items are discarded and further pushes are rejected.
+/// </summary>
+template <typename T>
+class PipelineStage
+{
+public:
+	/// <summary>
+	/// Processes one item. Return false to fail the stage.
+	/// </summary>
+	typedef std::function<bool(T &item)> Handler;
+
+	PipelineStage(size_t capacity, PipelineDropPolicy policy, Handler handler, typename PipelineQueue<T>::DropHandler onDropped = nullptr) :
+		m_Queue(capacity, policy, onDropped),
+		m_Handler(handler),
+		m_IsFailed(false)
+	{
+	}
+	PipelineStage(const PipelineStage &) = delete;
+	PipelineStage &operator=(const PipelineStage &) = delete;
+	~PipelineStage()
+	{
+		Stop();
+	}
+
+	/// <summary>
+	/// Starts the worker thread.
+	/// </summary>
+	/// <param name="onThreadStart">Optional function called on the worker thread before the first item, e.g. to initialize COM.</param>
+	/// <param name="onThreadExit">Optional function called on the worker thread before it exits.</param>
+	void Start(std::function<void()> onThreadStart = nullptr, std::function<void()> onThreadExit = nullptr)
+	{
+		if (m_WorkerThread.joinable()) {
+			return;
+		}
+		m_WorkerThread = std::thread([this, onThreadStart, onThreadExit]() {
+			if (onThreadStart) {
+				onThreadStart();
+			}
+			WorkerThreadProc();
+			if (onThreadExit) {
+				onThreadExit();
+			}
+		});
+	}
+
+	/// <summary>
+	/// Queues an item for processing according to the drop policy of the stage.
+	/// </summary>
+	/// <returns>false if the item was dropped, or the stage is stopped or failed</returns>
+	bool Push(T &&item)
+	{
+		return m_Queue.Push(std::move(item));
+	}
+
+	/// <summary>
+	/// Waits until every item pushed so far has been processed.
+	/// </summary>
+	/// <returns>false if the stage failed or was stopped</returns>
+	bool Drain()
+	{
+		return m_Queue.WaitUntilIdle() && !m_IsFailed;
+	}
+
+	/// <summary>
+	/// Discards any queued items and waits for the item in flight, if any, before returning.
+	/// </summary>
+	void Stop()
+	{
+		m_Queue.Close();
+		if (m_WorkerThread.joinable()) {
+			m_WorkerThread.join();
+		}
+	}
+
+	bool IsFailed() { return m_IsFailed; }
+
+	PIPELINE_STAGE_STATS GetStats() { return m_Queue.GetStats(); }
+
+private:
+	PipelineQueue<T> m_Queue;
+	Handler m_Handler;
+	std::atomic<bool> m_IsFailed;
+	std::thread m_WorkerThread;
+
+	void WorkerThreadProc()
+	{
+		T item;
+		while (m_Queue.Pop(&item)) {
+			auto start = std::chrono::steady_clock::now();
+			bool isSuccess = m_Handler(item);
+			//Release whatever the item holds before it is reported as handled.
+			item = T();
+			int64_t processingTime = std::chrono::duration_cast<std::chrono::duration<int64_t, std::ratio<1, 10000000>>>(std::chrono::steady_clock::now() - start).count();
+			if (!isSuccess) {
+				m_IsFailed = true;
+				m_Queue.Close();
+			}
+			m_Queue.Complete(processingTime);
+		}
+	}
+};
+
+/// <summary>
+/// Feeds each item to several pipeline stages, the outputs, each with its own queue, drop policy and worker thread.
+/// An output falling behind only holds up the others once its queue is full and its policy is Block.
+/// A required output that fails fails the fan-out. An optional output that fails is detached and gets no further items, while the other outputs carry on.
+/// Optional outputs shed items instead of dropping them: an item pushed while the output has fallen behind has its costly part, e.g. the video frame,
+/// moved out, and the newest part shed is carried over to the first item the output has room for that has none of its own.
+/// Every item still reaches the output, so the rest of it, e.g. the audio and the timeline, stays continuous.
+/// Outputs must be added before Start, and items must be pushed from one thread at a time.
+/// </summary>
+template <typename T>
+class PipelineFanOut
+{
+public:
+	typedef typename PipelineStage<T>::Handler Handler;
+	typedef typename PipelineQueue<T>::DropHandler DropHandler;
+	/// <summary>
+	/// Moves the costly part of source, if it has one, to destination, unless destination already has its own.
+	/// Either may be a default constructed item, e.g. when nothing is carried over yet.
+	/// </summary>
+	typedef std::function<void(T &source, T &destination)> ShedHandler;
+
+	PipelineFanOut() {}
+	PipelineFanOut(const PipelineFanOut &) = delete;
+	PipelineFanOut &operator=(const PipelineFanOut &) = delete;
+	~PipelineFanOut()
+	{
+		Stop();
+	}
+
+	/// <summary>
+	/// Adds a required output, which fails the fan-out if its handler fails.
+	/// </summary>
+	/// <returns>The index of the output</returns>
+	size_t AddOutput(size_t capacity, PipelineDropPolicy policy, Handler handler, DropHandler onDropped = nullptr)
+	{
+		m_Outputs.push_back(std::make_unique<FAN_OUT_OUTPUT>(capacity, policy, handler, onDropped, true));
+		return m_Outputs.size() - 1;
+	}
+
+	/// <summary>
+	/// Adds an optional output, which is detached if its handler fails.
+	/// </summary>
+	/// <param name="capacity">The most items queued for the output. The queue blocks when full, so it should have room for a few items without their costly part.</param>
+	/// <param name="shedDepth">The number of queued items at which the output counts as fallen behind, and further items are shed.</param>
+	/// <param name="onShed">Moves the costly part out of an item. If nullptr, items are never shed.</param>
+	/// <returns>The index of the output</returns>
+	size_t AddOptionalOutput(size_t capacity, size_t shedDepth, Handler handler, ShedHandler onShed = nullptr)
+	{
+		m_Outputs.push_back(std::make_unique<FAN_OUT_OUTPUT>(capacity, PipelineDropPolicy::Block, handler, nullptr, false));
+		m_Outputs.back()->ShedDepth = (std::max)(shedDepth, (size_t)1);
+		m_Outputs.back()->OnShed = onShed;
+		return m_Outputs.size() - 1;
+	}
+
+	size_t GetOutputCount() const { return m_Outputs.size(); }
+
+	/// <summary>
+	/// Starts the worker threads of all outputs.
+	/// </summary>
+	void Start(std::function<void()> onThreadStart = nullptr, std::function<void()> onThreadExit = nullptr)
+	{
+		for (auto &output : m_Outputs) {
+			output->Stage.Start(onThreadStart, onThreadExit);
+		}
+	}
+
+	/// <summary>
+	/// Queues a copy of the item for every output still running. The last output gets the item itself.
+	/// </summary>
+	/// <returns>false if a required output dropped the item, or is stopped or failed</returns>
+	bool Push(T &&item)
+	{
+		size_t last = m_Outputs.size();
+		for (size_t i = 0; i < m_Outputs.size(); i++) {
+			if (!IsDetached(*m_Outputs[i])) {
+				last = i;
+			}
+		}
+		bool isPushed = true;
+		for (size_t i = 0; i < m_Outputs.size(); i++) {
+			FAN_OUT_OUTPUT &output = *m_Outputs[i];
+			if (IsDetached(output)) {
+				continue;
+			}
+			T copy = i == last ? std::move(item) : item;
+			if (output.OnShed) {
+				Shed(output, copy);
+			}
+			if (!output.Stage.Push(std::move(copy)) && output.IsRequired) {
+				isPushed = false;
+			}
+		}
+		return isPushed;
+	}
+
+	/// <summary>
+	/// Waits until every item pushed so far has been processed by the outputs still running.
+	/// </summary>
+	/// <returns>false if a required output failed or was stopped</returns>
+	bool Drain()
+	{
+		bool isDrained = true;
+		for (auto &output : m_Outputs) {
+			if (!output->Stage.Drain() && output->IsRequired) {
+				isDrained = false;
+			}
+		}
+		return isDrained;
+	}
+
+	/// <summary>
+	/// Stops all outputs, discarding any queued items and carried over parts.
+	/// </summary>
+	void Stop()
+	{
+		for (auto &output : m_Outputs) {
+			output->Stage.Stop();
+			output->Carried = T();
+		}
+	}
+
+	/// <summary>
+	/// true if a required output failed.
+	/// </summary>
+	bool IsFailed()
+	{
+		return std::any_of(m_Outputs.begin(), m_Outputs.end(), [](const std::unique_ptr<FAN_OUT_OUTPUT> &output) { return output->IsRequired && output->Stage.IsFailed(); });
+	}
+
+	bool IsOutputFailed(size_t index) { return m_Outputs.at(index)->Stage.IsFailed(); }
+
+	PIPELINE_STAGE_STATS GetStats(size_t index)
+	{
+		FAN_OUT_OUTPUT &output = *m_Outputs.at(index);
+		PIPELINE_STAGE_STATS stats = output.Stage.GetStats();
+		stats.Shed = output.ShedCount;
+		return stats;
+	}
+
+private:
+	struct FAN_OUT_OUTPUT {
+		FAN_OUT_OUTPUT(size_t capacity, PipelineDropPolicy policy, Handler handler, DropHandler onDropped, bool isRequired) :
+			Stage(capacity, policy, handler, onDropped),
+			IsRequired(isRequired),
+			ShedDepth(0),
+			ShedCount(0)
+		{
+		}
+		PipelineStage<T> Stage;
+		const bool IsRequired;
+		size_t ShedDepth;
+		ShedHandler OnShed;
+		//The newest part shed, waiting for an item to carry it.
+		T Carried{};
+		std::atomic<uint64_t> ShedCount;
+	};
+	std::vector<std::unique_ptr<FAN_OUT_OUTPUT>> m_Outputs;
+
+	static bool IsDetached(FAN_OUT_OUTPUT &output)
+	{
+		return !output.IsRequired && output.Stage.IsFailed();
+	}
+
+	static void Shed(FAN_OUT_OUTPUT &output, T &item)
+	{
+		if (output.Stage.GetStats().QueueDepth >= output.ShedDepth) {
+			//The part of the new item, if any, is newer than the carried one, so it takes precedence.
+			T shed{};
+			output.OnShed(item, shed);
+			output.OnShed(output.Carried, shed);
+			output.Carried = std::move(shed);
+			output.ShedCount++;
+		}
+		else {
+			output.OnShed(output.Carried, item);
+			output.Carried = T();
+		}
+	}
+};
@@ -0,0 +1,355 @@
+#pragma once
+#include "DirtyRegion.h"
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//Default number of staging slots in a ReadbackRing. A frame is read back up to this many frames after it was copied, so the GPU has time to finish the copy.
+#define READBACK_RING_DEFAULT_DEPTH 3
+
+struct READBACK_FRAME_INFO {
+	int FrameNumber = 0;
+	//Timestamp of the frame, in milliseconds since the epoch.
+	int64_t Timestamp = 0;
+};
+
+/// <summary>
+/// The CPU readable memory of a mapped staging slot.
+/// </summary>
+struct READBACK_MAPPING {
+	const uint8_t *pData = nullptr;
+	uint32_t RowPitch = 0;
+	uint32_t Width = 0;
+	uint32_t Height = 0;
+};
+
+struct READBACK_RING_STATS {
+	//Frames copied to a staging slot.
+	uint64_t Submitted = 0;
+	//Frames read back and passed on.
+	uint64_t Delivered = 0;
+	//Frames overwritten by a newer frame before their copy had completed.
+	uint64_t Dropped = 0;
+	//Frames skipped because a newer frame was read back first.
+	uint64_t Superseded = 0;
+	//Frames copied in full, because the slot was new or the changes since its previous frame were unknown.
+	uint64_t FullCopies = 0;
+};
+
+/// <summary>
+/// Copies frames to CPU readable staging slots and maps them, e.g. with D3D11 staging textures.
+/// </summary>
+template <typename TSource>
+class IReadbackBackend
+{
+public:
+	virtual ~IReadbackBackend() {}
+	/// <summary>
+	/// Makes sure a slot can hold a copy of the source.
+	/// </summary>
+	/// <returns>true if the slot was created or recreated, so its content is undefined</returns>
+	virtual bool PrepareSlot(size_t index, TSource source) = 0;
+	/// <summary>
+	/// Queues a copy of the source to a slot. Only the rects of the region are copied, or the whole source if pRegion is nullptr.
+	/// </summary>
+	virtual void CopyToSlot(size_t index, TSource source, const DirtyRegion *pRegion) = 0;
+	/// <summary>
+	/// Maps a slot for reading.
+	/// </summary>
+	/// <param name="wait">If false, fails instead of waiting when the copy to the slot has not completed yet.</param>
+	/// <returns>false if the slot could not be mapped</returns>
+	virtual bool MapSlot(size_t index, bool wait, READBACK_MAPPING *pMapping) = 0;
+	virtual void UnmapSlot(size_t index) = 0;
+};
+
+/// <summary>
+/// A ring of staging slots for reading frames back to the CPU without stalling on the copy.
+/// Each submitted frame is copied to the next slot, and Poll maps the newest frame whose copy has completed, skipping older ones.
+/// A slot still holds the frame it was last given, so only the parts changed since then are copied when the changes are known.
+/// Not thread safe.
+/// </summary>
+template <typename TSource>
+class ReadbackRing
+{
+public:
+	typedef std::function<void(const READBACK_FRAME_INFO &info, const READBACK_MAPPING &mapping)> FrameHandler;
+
+	ReadbackRing(std::unique_ptr<IReadbackBackend<TSource>> backend, size_t depth = READBACK_RING_DEFAULT_DEPTH) :
+		m_Backend(std::move(backend)),
+		m_Slots((std::max)(depth, (size_t)1)),
+		m_NextSlot(0),
+		m_Sequence(0),
+		m_Stats{}
+	{
+	}
+	ReadbackRing(const ReadbackRing &) = delete;
+	ReadbackRing &operator=(const ReadbackRing &) = delete;
+
+	/// <summary>
+	/// Queues a copy of a frame to the next slot. A frame still waiting in that slot is dropped.
+	/// </summary>
+	/// <param name="pUpdatedRegion">The area changed since the previous submitted frame, or nullptr if unknown.</param>
+	void Submit(TSource source, const READBACK_FRAME_INFO &info, const DirtyRegion *pUpdatedRegion)
+	{
+		size_t index = m_NextSlot;
+		m_NextSlot = (m_NextSlot + 1) % m_Slots.size();
+		READBACK_SLOT &slot = m_Slots[index];
+		if (slot.IsPending) {
+			slot.IsPending = false;
+			m_Stats.Dropped++;
+		}
+		//Every slot now lags one more frame behind, so it must also be updated where this frame changed.
+		for (READBACK_SLOT &other : m_Slots) {
+			if (!pUpdatedRegion) {
+				other.IsValid = false;
+			}
+			else if (other.IsValid) {
+				other.StaleRegion.Add(*pUpdatedRegion);
+			}
+		}
+		if (m_Backend->PrepareSlot(index, source)) {
+			slot.IsValid = false;
+		}
+		if (slot.IsValid) {
+			m_Backend->CopyToSlot(index, source, &slot.StaleRegion);
+		}
+		else {
+			m_Backend->CopyToSlot(index, source, nullptr);
+			m_Stats.FullCopies++;
+		}
+		slot.StaleRegion.Clear();
+		slot.IsValid = true;
+		slot.IsPending = true;
+		slot.Sequence = ++m_Sequence;
+		slot.Info = info;
+		m_Stats.Submitted++;
+	}
+
+	/// <summary>
+	/// Maps the newest frame whose copy has completed and passes it to the handler. Older frames waiting to be read back are skipped.
+	/// </summary>
+	/// <param name="wait">If true, waits for the copy of the newest frame instead of skipping frames that are not done yet.</param>
+	/// <returns>true if a frame was passed to the handler</returns>
+	bool Poll(const FrameHandler &onFrame, bool wait = false)
+	{
+		//Try the pending slots from newest to oldest, so the first one that maps is the newest available frame.
+		for (size_t i = 0; i < m_Slots.size(); i++) {
+			size_t index = (m_NextSlot + m_Slots.size() - 1 - i) % m_Slots.size();
+			READBACK_SLOT &slot = m_Slots[index];
+			if (!slot.IsPending) {
+				continue;
+			}
+			READBACK_MAPPING mapping{};
+			if (!m_Backend->MapSlot(index, wait, &mapping)) {
+				if (wait) {
+					//The slot cannot be read back at all, so give up on it rather than failing every poll.
+					slot.IsPending = false;
+					m_Stats.Dropped++;
+				}
+				continue;
+			}
+			slot.IsPending = false;
+			onFrame(slot.Info, mapping);
+			m_Backend->UnmapSlot(index);
+			m_Stats.Delivered++;
+			for (READBACK_SLOT &older : m_Slots) {
+				if (older.IsPending && older.Sequence < slot.Sequence) {
+					older.IsPending = false;
+					m_Stats.Superseded++;
+				}
+			}
+			return true;
+		}
+		return false;
+	}
+
+	/// <summary>
+	/// Discards all pending frames and forgets the content of the slots, e.g. after the frame size or device changed.
+	/// </summary>
+	void Reset()
+	{
+		for (READBACK_SLOT &slot : m_Slots) {
+			slot.IsPending = false;
+			slot.IsValid = false;
+			slot.StaleRegion.Clear();
+		}
+	}
+
+	inline size_t GetDepth() const { return m_Slots.size(); }
+	inline READBACK_RING_STATS GetStats() const { return m_Stats; }
+
+private:
+	struct READBACK_SLOT {
+		//Set when the slot holds a frame that has not been read back yet.
+		bool IsPending = false;
+		//Set when the content of the slot is a known frame, so it can be updated with partial copies.
+		bool IsValid = false;
+		uint64_t Sequence = 0;
+		READBACK_FRAME_INFO Info{};
+		//The area changed since the frame in the slot.
+		DirtyRegion StaleRegion{};
+	};
+
+	std::unique_ptr<IReadbackBackend<TSource>> m_Backend;
+	std::vector<READBACK_SLOT> m_Slots;
+	size_t m_NextSlot;
+	uint64_t m_Sequence;
+	READBACK_RING_STATS m_Stats;
+};
+
+struct LATEST_VALUE_DISPATCHER_STATS {
+	//Values published by the producer.
+	uint64_t Published = 0;
+	//Values passed to the handler.
+	uint64_t Delivered = 0;
+	//Values replaced by a newer one before the handler got to them.
+	uint64_t Dropped = 0;
+};
+
+/// <summary>
+/// Passes values from a producer to a handler on a dedicated thread, keeping only the latest value when the handler falls behind,
+/// so a slow consumer never blocks the producer.
+/// The values are triple buffered: the producer writes one, one waits for the handler and the handler reads one, and they are reused without copying.
+/// </summary>
+template <typename T>
+class LatestValueDispatcher
+{
+public:
+	typedef std::function<void(T &value)> Handler;
+
+	LatestValueDispatcher(Handler handler) :
+		m_Handler(handler),
+		m_WriteIndex(0),
+		m_PendingIndex(-1),
+		m_ReadIndex(-1),
+		m_IsStopping(false),
+		m_Stats{}
+	{
+	}
+	LatestValueDispatcher(const LatestValueDispatcher &) = delete;
+	LatestValueDispatcher &operator=(const LatestValueDispatcher &) = delete;
+	~LatestValueDispatcher()
+	{
+		Stop(false);
+	}
+
+	/// <summary>
+	/// Starts the handler thread.
+	/// </summary>
+	/// <param name="onThreadStart">Optional function called on the handler thread before the first value, e.g. to initialize COM.</param>
+	/// <param name="onThreadExit">Optional function called on the handler thread before it exits.</param>
+	void Start(std::function<void()> onThreadStart = nullptr, std::function<void()> onThreadExit = nullptr)
+	{
+		if (m_WorkerThread.joinable()) {
+			return;
+		}
+		m_IsStopping = false;
+		m_WorkerThread = std::thread([this, onThreadStart, onThreadExit]() {
+			if (onThreadStart) {
+				onThreadStart();
+			}
+			WorkerThreadProc();
+			if (onThreadExit) {
+				onThreadExit();
+			}
+		});
+	}
+
+	/// <summary>
+	/// Gets the value to fill in before calling Publish. It is not touched by the handler thread until published.
+	/// Only one producer thread may write and publish values.
+	/// </summary>
+	T *BeginWrite()
+	{
+		return &m_Values[m_WriteIndex];
+	}
+
+	/// <summary>
+	/// Hands the value from BeginWrite to the handler, replacing any value still waiting for it.
+	/// </summary>
+	void Publish()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			int published = m_WriteIndex;
+			if (m_PendingIndex >= 0) {
+				//The waiting value is replaced, and its buffer is written next.
+				m_WriteIndex = m_PendingIndex;
+				m_Stats.Dropped++;
+			}
+			else {
+				//Write to the buffer that is neither published nor being read by the handler.
+				m_WriteIndex = 0;
+				while (m_WriteIndex == published || m_WriteIndex == m_ReadIndex) {
+					m_WriteIndex++;
+				}
+			}
+			m_PendingIndex = published;
+			m_Stats.Published++;
+		}
+		m_Condition.notify_all();
+	}
+
+	/// <summary>
+	/// Stops the handler thread.
+	/// </summary>
+	/// <param name="deliverPending">If true, a value waiting for the handler is delivered before the thread exits.</param>
+	void Stop(bool deliverPending)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_IsStopping = true;
+			if (!deliverPending && m_PendingIndex >= 0) {
+				m_Stats.Dropped++;
+				m_PendingIndex = -1;
+			}
+		}
+		m_Condition.notify_all();
+		if (m_WorkerThread.joinable()) {
+			m_WorkerThread.join();
+		}
+	}
+
+	LATEST_VALUE_DISPATCHER_STATS GetStats()
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		return m_Stats;
+	}
+
+private:
+	Handler m_Handler;
+	T m_Values[3];
+	//Indices into m_Values, or -1 when there is no value in that state.
+	int m_WriteIndex;
+	int m_PendingIndex;
+	int m_ReadIndex;
+	bool m_IsStopping;
+	LATEST_VALUE_DISPATCHER_STATS m_Stats;
+	std::mutex m_Mutex;
+	std::condition_variable m_Condition;
+	std::thread m_WorkerThread;
+
+	void WorkerThreadProc()
+	{
+		std::unique_lock<std::mutex> lock(m_Mutex);
+		while (true) {
+			m_Condition.wait(lock, [&]() { return m_IsStopping || m_PendingIndex >= 0; });
+			if (m_PendingIndex < 0) {
+				break;
+			}
+			m_ReadIndex = m_PendingIndex;
+			m_PendingIndex = -1;
+			lock.unlock();
+			m_Handler(m_Values[m_ReadIndex]);
+			lock.lock();
+			m_ReadIndex = -1;
+			m_Stats.Delivered++;
+		}
+	}
+};
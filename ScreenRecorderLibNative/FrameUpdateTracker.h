@@ -0,0 +1,38 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+/// <summary>
+/// Tells which capture sources and overlays updated since the recorder last acquired a frame with updates, from the timestamps each source writes with its updates.
+/// Only the thread acquiring frames moves the acquire time. Stages that process a frame later, like drawing the overlays on it, compare updates with the acquire time
+/// carried in the frame instead, so updates arriving while the frame waits in the pipeline are still counted as changes by the next acquire.
+/// </summary>
+class FrameUpdateTracker
+{
+public:
+	/// <summary>
+	/// The time updates are compared with, or 0 before the first frame with updates was acquired.
+	/// </summary>
+	int64_t GetLastAcquireTime() const
+	{
+		return m_LastAcquireTime.load(std::memory_order_acquire);
+	}
+	/// <summary>
+	/// Sets the time updates are compared with, once a frame with updates was acquired or the sources were restarted. Called by the thread acquiring frames.
+	/// </summary>
+	void SetLastAcquireTime(int64_t acquireTime)
+	{
+		m_LastAcquireTime.store(acquireTime, std::memory_order_release);
+	}
+	bool IsUpdatedSinceLastAcquire(int64_t updateTime) const
+	{
+		return IsUpdatedSince(updateTime, GetLastAcquireTime());
+	}
+	static bool IsUpdatedSince(int64_t updateTime, int64_t acquireTime)
+	{
+		return updateTime > acquireTime;
+	}
+
+private:
+	std::atomic<int64_t> m_LastAcquireTime{ 0 };
+};
@@ -0,0 +1,139 @@
+#pragma once
+#include "GifFrameComposer.h"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/// <summary>
+/// A composed GIF frame in a GifFrameCache, stored as the area it changed since the frame before it.
+/// </summary>
+struct GIF_CACHED_FRAME {
+	//The changed area, and where its pixels start in the cache. The pixels are tightly packed, Rect.Width to a row.
+	GIF_RECT Rect{};
+	size_t PixelOffset = 0;
+	//How long the frame is shown, in milliseconds.
+	uint32_t DelayMillis = 0;
+};
+
+/// <summary>
+/// The frames of a GIF, decoded and composed once so looping animations are played without decoding them again.
+/// Each frame keeps only the area it changed since the frame before it, so playing the frames in order on a canvas gives the composed frames.
+/// The first frame covers the whole image, so playback can start or loop from it on any canvas.
+/// Immutable once built, so it can be shared between threads.
+/// </summary>
+class GifFrameCache
+{
+public:
+	GifFrameCache(uint32_t width, uint32_t height) :
+		m_Width(width),
+		m_Height(height)
+	{
+	}
+	GifFrameCache(const GifFrameCache &) = delete;
+	GifFrameCache &operator=(const GifFrameCache &) = delete;
+
+	/// <summary>
+	/// Adds the frame the composer composed last, keeping the area it changed.
+	/// </summary>
+	/// <param name="maxBytes">The most bytes the cache may hold</param>
+	/// <returns>false if the frame does not fit in maxBytes, in which case the cache is left unchanged</returns>
+	bool AddFrame(const GifFrameComposer &composer, uint32_t delayMillis, size_t maxBytes)
+	{
+		GIF_CACHED_FRAME frame;
+		frame.Rect = m_Frames.empty() ? GIF_RECT{ 0, 0, m_Width, m_Height } : composer.GetChangedRect();
+		frame.PixelOffset = m_Pixels.size();
+		frame.DelayMillis = delayMillis;
+		size_t framePixels = static_cast<size_t>(frame.Rect.Width) * frame.Rect.Height;
+		if (GetSizeInBytes() + (framePixels * sizeof(uint32_t)) + sizeof(GIF_CACHED_FRAME) > maxBytes) {
+			return false;
+		}
+		const uint32_t *pCanvas = composer.GetCanvas();
+		for (uint32_t row = frame.Rect.Top; row < frame.Rect.Top + frame.Rect.Height; row++) {
+			const uint32_t *pRow = pCanvas + static_cast<size_t>(row) * composer.GetWidth() + frame.Rect.Left;
+			m_Pixels.insert(m_Pixels.end(), pRow, pRow + frame.Rect.Width);
+		}
+		m_Frames.push_back(frame);
+		return true;
+	}
+
+	/// <summary>
+	/// Frees the memory reserved for frames that were not added, once all frames are.
+	/// </summary>
+	void ShrinkToFit()
+	{
+		m_Pixels.shrink_to_fit();
+		m_Frames.shrink_to_fit();
+	}
+
+	inline uint32_t GetWidth() const { return m_Width; }
+	inline uint32_t GetHeight() const { return m_Height; }
+	inline size_t GetFrameCount() const { return m_Frames.size(); }
+	inline const GIF_CACHED_FRAME &GetFrame(size_t index) const { return m_Frames[index]; }
+	/// <summary>
+	/// The pixels of the area the frame changed, with a pitch of GetFrame(index).Rect.Width pixels.
+	/// </summary>
+	inline const uint32_t *GetFramePixels(size_t index) const { return m_Pixels.data() + m_Frames[index].PixelOffset; }
+	inline size_t GetSizeInBytes() const
+	{
+		return m_Pixels.size() * sizeof(uint32_t) + m_Frames.size() * sizeof(GIF_CACHED_FRAME);
+	}
+
+private:
+	uint32_t m_Width;
+	uint32_t m_Height;
+	std::vector<GIF_CACHED_FRAME> m_Frames;
+	std::vector<uint32_t> m_Pixels;
+};
+
+/// <summary>
+/// Shares GIF frame caches between all readers of the same GIF, and keeps the caches alive at the same time within a memory budget.
+/// A cache lives as long as a reader holds it. Thread safe. Caches are built while the registry is locked, so a GIF read by several readers at once is only decoded once.
+/// </summary>
+class GifFrameCacheRegistry
+{
+public:
+	/// <summary>
+	/// Gets the cache for the given GIF, building it if no reader holds one.
+	/// </summary>
+	/// <param name="key">Identifies the GIF, e.g. its path and last write time. Caches with an empty key are not shared, but count towards the budget.</param>
+	/// <param name="maxBytes">The most bytes all caches alive at the same time may hold</param>
+	/// <param name="createCache">Builds the cache within the given number of bytes, or returns nullptr if it does not fit</param>
+	/// <returns>The cache, or nullptr if it does not fit in the budget</returns>
+	std::shared_ptr<const GifFrameCache> GetOrCreate(const std::wstring &key, size_t maxBytes, const std::function<std::shared_ptr<GifFrameCache>(size_t maxBytes)> &createCache)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		size_t liveBytes = 0;
+		for (auto it = m_Entries.begin(); it != m_Entries.end();) {
+			std::shared_ptr<const GifFrameCache> pCache = it->Cache.lock();
+			if (!pCache) {
+				it = m_Entries.erase(it);
+				continue;
+			}
+			if (!key.empty() && it->Key == key) {
+				return pCache;
+			}
+			liveBytes += pCache->GetSizeInBytes();
+			it++;
+		}
+		if (liveBytes >= maxBytes) {
+			return nullptr;
+		}
+		std::shared_ptr<GifFrameCache> pCache = createCache(maxBytes - liveBytes);
+		if (pCache) {
+			m_Entries.push_back(CACHE_ENTRY{ key, pCache });
+		}
+		return pCache;
+	}
+
+private:
+	struct CACHE_ENTRY {
+		std::wstring Key;
+		std::weak_ptr<const GifFrameCache> Cache;
+	};
+	std::mutex m_Mutex;
+	std::vector<CACHE_ENTRY> m_Entries;
+};
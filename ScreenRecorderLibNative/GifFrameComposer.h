@@ -0,0 +1,214 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+//The disposal methods of GIF frames, from the Graphic Control Extension. They tell what happens to the area of a frame before the next frame is drawn.
+#define GIF_DISPOSAL_UNDEFINED 0
+#define GIF_DISPOSAL_NONE 1
+#define GIF_DISPOSAL_BACKGROUND 2
+#define GIF_DISPOSAL_PREVIOUS 3
+
+/// <summary>
+/// An area of a GIF image, in pixels.
+/// </summary>
+struct GIF_RECT {
+	uint32_t Left = 0;
+	uint32_t Top = 0;
+	uint32_t Width = 0;
+	uint32_t Height = 0;
+
+	bool IsEmpty() const
+	{
+		return Width == 0 || Height == 0;
+	}
+	/// <summary>
+	/// The smallest area covering both areas.
+	/// </summary>
+	GIF_RECT Union(const GIF_RECT &other) const
+	{
+		if (IsEmpty()) {
+			return other;
+		}
+		if (other.IsEmpty()) {
+			return *this;
+		}
+		uint32_t left = (std::min)(Left, other.Left);
+		uint32_t top = (std::min)(Top, other.Top);
+		uint32_t right = (std::max)(Left + Width, other.Left + other.Width);
+		uint32_t bottom = (std::max)(Top + Height, other.Top + other.Height);
+		return GIF_RECT{ left, top, right - left, bottom - top };
+	}
+};
+
+/// <summary>
+/// The metadata of a GIF frame, from its Image Descriptor and Graphic Control Extension.
+/// </summary>
+struct GIF_FRAME_INFO {
+	//The area of the image the frame is drawn to. May reach outside the image, in which case it is clipped.
+	GIF_RECT Position{};
+	uint8_t Disposal = GIF_DISPOSAL_UNDEFINED;
+	//How long the frame is shown, in milliseconds, from GetGifFrameDelayMillis.
+	uint32_t DelayMillis = 0;
+};
+
+/// <summary>
+/// Converts the delay of a GIF frame to the time it is shown. Frames with very small or no delay are shown for 90 ms, to match the speed most browsers show them at.
+/// This makes intermediate frames without a delay visible, but keeps GIFs relying on browser behavior from playing too fast.
+/// </summary>
+/// <param name="delayCentiseconds">The delay in the Graphic Control Extension, in 10 ms units</param>
+inline uint32_t GetGifFrameDelayMillis(uint16_t delayCentiseconds)
+{
+	uint32_t delayMillis = static_cast<uint32_t>(delayCentiseconds) * 10;
+	return delayMillis < 20 ? 90 : delayMillis;
+}
+
+/// <summary>
+/// Composes the frames of an animated GIF on a canvas of premultiplied BGRA pixels, the way the disposal method of each frame asks.
+/// Before a frame is drawn, the frame before it is disposed of: left in place, cleared to transparent, or replaced by the canvas as it was before it was drawn.
+/// The first frame of each loop starts from a transparent canvas. Frames are drawn on top of the canvas, so their transparent pixels show the frames below.
+/// Also tracks the area each frame changes, so the canvas can be uploaded or cached one changed area at a time.
+/// </summary>
+class GifFrameComposer
+{
+public:
+	GifFrameComposer(uint32_t width, uint32_t height) :
+		m_Width(width),
+		m_Height(height),
+		m_Canvas(static_cast<size_t>(width) * height, 0),
+		m_LastFrame{},
+		m_ChangedRect{}
+	{
+	}
+
+	/// <summary>
+	/// Clears the canvas and forgets the frame drawn last, so the next frame is composed as if it was the first.
+	/// </summary>
+	void Reset()
+	{
+		std::fill(m_Canvas.begin(), m_Canvas.end(), 0u);
+		m_LastFrame = GIF_FRAME_INFO{};
+		m_ChangedRect = GIF_RECT{};
+		m_SavedCanvas.clear();
+	}
+
+	/// <summary>
+	/// Disposes of the frame drawn last and draws the given frame on top of the canvas.
+	/// </summary>
+	/// <param name="frameIndex">The index of the frame in the GIF. Frame 0 starts a new loop on a cleared canvas.</param>
+	/// <param name="pPixels">The premultiplied BGRA pixels of the frame, Position.Width by Position.Height</param>
+	/// <param name="pitch">The distance between rows of pPixels, in bytes</param>
+	void ComposeFrame(uint32_t frameIndex, const GIF_FRAME_INFO &frame, const uint8_t *pPixels, uint32_t pitch)
+	{
+		GIF_RECT lastFrameRect = Clip(m_LastFrame.Position);
+		GIF_RECT frameRect = Clip(frame.Position);
+		if (frameIndex == 0) {
+			std::fill(m_Canvas.begin(), m_Canvas.end(), 0u);
+			m_ChangedRect = GIF_RECT{ 0, 0, m_Width, m_Height };
+		}
+		else {
+			m_ChangedRect = GIF_RECT{};
+			switch (m_LastFrame.Disposal)
+			{
+				case GIF_DISPOSAL_BACKGROUND:
+					//Cleared to transparent rather than the background color, like browsers do.
+					FillRect(lastFrameRect, 0);
+					m_ChangedRect = lastFrameRect;
+					break;
+				case GIF_DISPOSAL_PREVIOUS:
+					//Only the area of the frame drawn last changed since the canvas was saved.
+					if (!m_SavedCanvas.empty()) {
+						CopyRect(lastFrameRect, m_SavedCanvas.data(), m_Canvas.data());
+						m_ChangedRect = lastFrameRect;
+					}
+					break;
+				default:
+					//Undefined, none, and the reserved methods leave the frame in place.
+					break;
+			}
+		}
+		if (frame.Disposal == GIF_DISPOSAL_PREVIOUS) {
+			m_SavedCanvas = m_Canvas;
+		}
+		DrawFrame(frame.Position, frameRect, pPixels, pitch);
+		m_ChangedRect = m_ChangedRect.Union(frameRect);
+		m_LastFrame = frame;
+	}
+
+	inline const uint32_t *GetCanvas() const { return m_Canvas.data(); }
+	inline uint32_t GetWidth() const { return m_Width; }
+	inline uint32_t GetHeight() const { return m_Height; }
+	/// <summary>
+	/// The area of the canvas the last call to ComposeFrame changed. Pixels outside of it are the same as before the call.
+	/// </summary>
+	inline GIF_RECT GetChangedRect() const { return m_ChangedRect; }
+
+private:
+	GIF_RECT Clip(const GIF_RECT &rect) const
+	{
+		if (rect.Left >= m_Width || rect.Top >= m_Height) {
+			return GIF_RECT{};
+		}
+		return GIF_RECT{ rect.Left, rect.Top, (std::min)(rect.Width, m_Width - rect.Left), (std::min)(rect.Height, m_Height - rect.Top) };
+	}
+
+	void FillRect(const GIF_RECT &rect, uint32_t value)
+	{
+		for (uint32_t row = rect.Top; row < rect.Top + rect.Height; row++) {
+			uint32_t *pRow = m_Canvas.data() + static_cast<size_t>(row) * m_Width + rect.Left;
+			std::fill(pRow, pRow + rect.Width, value);
+		}
+	}
+
+	void CopyRect(const GIF_RECT &rect, const uint32_t *pSource, uint32_t *pDestination)
+	{
+		for (uint32_t row = rect.Top; row < rect.Top + rect.Height; row++) {
+			size_t offset = static_cast<size_t>(row) * m_Width + rect.Left;
+			memcpy(pDestination + offset, pSource + offset, static_cast<size_t>(rect.Width) * sizeof(uint32_t));
+		}
+	}
+
+	/// <summary>
+	/// Draws the clipped area of the frame with premultiplied source-over blending. GIF pixels are either opaque or transparent, so most pixels are copied or skipped.
+	/// </summary>
+	void DrawFrame(const GIF_RECT &position, const GIF_RECT &clippedRect, const uint8_t *pPixels, uint32_t pitch)
+	{
+		for (uint32_t row = 0; row < clippedRect.Height; row++) {
+			const uint8_t *pSourceRow = pPixels + static_cast<size_t>(clippedRect.Top - position.Top + row) * pitch;
+			uint32_t *pDestinationRow = m_Canvas.data() + static_cast<size_t>(clippedRect.Top + row) * m_Width + clippedRect.Left;
+			for (uint32_t col = 0; col < clippedRect.Width; col++) {
+				uint32_t source;
+				memcpy(&source, pSourceRow + static_cast<size_t>(col) * sizeof(uint32_t), sizeof(source));
+				uint32_t alpha = source >> 24;
+				if (alpha == 0xFF) {
+					pDestinationRow[col] = source;
+				}
+				else if (alpha != 0) {
+					pDestinationRow[col] = BlendOver(source, pDestinationRow[col], alpha);
+				}
+			}
+		}
+	}
+
+	static uint32_t BlendOver(uint32_t source, uint32_t destination, uint32_t alpha)
+	{
+		uint32_t result = 0;
+		for (int shift = 0; shift < 32; shift += 8) {
+			uint32_t sourceChannel = (source >> shift) & 0xFF;
+			uint32_t destinationChannel = (destination >> shift) & 0xFF;
+			uint32_t channel = sourceChannel + (destinationChannel * (255 - alpha) + 127) / 255;
+			result |= (std::min)(channel, 255u) << shift;
+		}
+		return result;
+	}
+
+	uint32_t m_Width;
+	uint32_t m_Height;
+	std::vector<uint32_t> m_Canvas;
+	//The canvas before the last frame with the previous disposal method was drawn.
+	std::vector<uint32_t> m_SavedCanvas;
+	GIF_FRAME_INFO m_LastFrame;
+	GIF_RECT m_ChangedRect;
+};
@@ -3,21 +3,43 @@
 
 using namespace std;
 
-GifReader::GifReader()
+//Shares the decoded frames of each GIF between all readers playing it, e.g. the same GIF used as several overlays.
+static GifFrameCacheRegistry g_GifFrameCaches;
+
+/// <summary>
+/// Identifies a GIF file in the shared frame caches by its full path, size and last write time, so a changed file is decoded again.
+/// </summary>
+/// <returns>The key, or an empty string if the file cannot be read</returns>
+static std::wstring GetFrameCacheKey(_In_ const std::wstring &path)
+{
+	WCHAR fullPath[MAX_PATH];
+	DWORD length = GetFullPathNameW(path.c_str(), MAX_PATH, fullPath, nullptr);
+	if (length == 0 || length >= MAX_PATH) {
+		return L"";
+	}
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	if (!GetFileAttributesExW(fullPath, GetFileExInfoStandard, &attributes)) {
+		return L"";
+	}
+	return string_format(L"%ls|%lu:%lu|%lu:%lu", fullPath,
+		attributes.nFileSizeHigh, attributes.nFileSizeLow,
+		attributes.ftLastWriteTime.dwHighDateTime, attributes.ftLastWriteTime.dwLowDateTime);
+}
+
+GifReader::GifReader(_In_ UINT64 frameCacheMaxBytes)
 	:
-	m_RenderTarget(nullptr),
 	m_RenderTexture(nullptr),
-	m_pD2DFactory(nullptr),
-	m_pFrameComposeRT(nullptr),
-	m_pRawFrame(nullptr),
-	m_pSavedFrame(nullptr),
+	m_pFrameComposer(nullptr),
+	m_pFrameCache(nullptr),
+	m_FrameCacheMaxBytes(frameCacheMaxBytes),
+	m_FrameCacheKey(L""),
+	m_RawFrameInfo{},
 	m_pIWICFactory(nullptr),
 	m_pDecoder(nullptr),
-	m_FramerateTimer(nullptr),
+	m_FramePacer(nullptr),
 	m_LastSampleReceivedTimeStamp{ 0 },
 	m_cxGifImage(0),
 	m_cyGifImage(0),
-	m_backgroundColor(D2D1::ColorF(0, 0.f)),
 	m_cFrames(0),
 	m_cxGifImagePixel(0),
 	m_cyGifImagePixel(0),
@@ -25,9 +47,7 @@ GifReader::GifReader()
 	m_uLoopNumber(0),
 	m_uNextFrameIndex(0),
 	m_uTotalLoopCount(0),
-	m_uFrameDisposal(0),
-	m_uFrameDelay(0),
-	m_framePosition{}
+	m_uFrameDelay(0)
 {
 	InitializeCriticalSection(&m_CriticalSection);
 	m_NewFrameEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
@@ -36,11 +56,6 @@ GifReader::GifReader()
 GifReader::~GifReader()
 {
 	StopCapture();
-	SafeRelease(&m_RenderTarget);
-	SafeRelease(&m_pD2DFactory);
-	SafeRelease(&m_pFrameComposeRT);
-	SafeRelease(&m_pRawFrame);
-	SafeRelease(&m_pSavedFrame);
 	SafeRelease(&m_pIWICFactory);
 	SafeRelease(&m_pDecoder);
 	SafeRelease(&m_RenderTexture);
@@ -61,6 +76,7 @@ HRESULT GifReader::StartCapture(_In_ RECORDING_SOURCE_BASE &recordingSource)
 		RETURN_ON_BAD_HR(hr = InitializeDecoder(recordingSource.SourcePath));
 	}
 	RETURN_ON_BAD_HR(hr = CreateDeviceResources());
+	InitializeFrameCache();
 	// If we have at least one frame, start playing
 	// the animation from the first frame
 	if (m_cFrames > 0)
@@ -89,13 +105,13 @@ HRESULT GifReader::GetNativeSize(_In_ RECORDING_SOURCE_BASE &recordingSource, _O
 
 HRESULT GifReader::StopCapture()
 {
-	if (m_FramerateTimer) {
-		LOG_DEBUG("Stopping GIF reader sync timer");
-		HRESULT hr = m_FramerateTimer->StopTimer(true);
-		if (FAILED(hr)) {
-			return hr;
-		}
+	if (m_FramePacer) {
+		LOG_DEBUG("Stopping GIF reader frame pacer");
+		m_FramePacer->Cancel();
 		m_CaptureTask.wait();
+		FRAME_PACING_STATS stats = m_FramePacer->GetStats();
+		LOG_DEBUG(L"GIF reader frame pacing: %llu frames, %llu late, %llu restarts, mean jitter %.2f ms, max jitter %.2f ms",
+			stats.Frames, stats.Late, stats.Restarts, HundredNanosToMillisDouble((INT64)stats.GetMeanJitter()), HundredNanosToMillisDouble(stats.MaxJitter));
 	}
 	return S_OK;
 }
@@ -223,9 +239,10 @@ void GifReader::ResetGifState()
 {
 	// Reset the states
 	m_uNextFrameIndex = 0;
-	m_uFrameDisposal = DM_NONE;  // No previous frame, use disposal none
 	m_uLoopNumber = 0;
 	m_fHasLoop = FALSE;
+	m_pFrameComposer.reset();
+	m_pFrameCache.reset();
 }
 
 HRESULT GifReader::InitializeDecoder(_In_ std::wstring source)
@@ -233,12 +250,8 @@ HRESULT GifReader::InitializeDecoder(_In_ std::wstring source)
 	HRESULT hr = E_FAIL;
 
 	ResetGifState();
-	SafeRelease(&m_pSavedFrame);
+	m_FrameCacheKey = L"";
 
-	if (!m_pD2DFactory) {
-		// Create D2D factory
-		RETURN_ON_BAD_HR(hr = D2D1CreateFactory(D2D1_FACTORY_TYPE_SINGLE_THREADED, __uuidof(ID2D1Factory), (void **)&m_pD2DFactory));
-	}
 	if (!m_pIWICFactory) {
 		// Create WIC factory
 		RETURN_ON_BAD_HR(hr = CoCreateInstance(
@@ -261,6 +274,10 @@ HRESULT GifReader::InitializeDecoder(_In_ std::wstring source)
 	{
 		hr = GetGlobalMetadata();
 	}
+	if (SUCCEEDED(hr))
+	{
+		m_FrameCacheKey = GetFrameCacheKey(source);
+	}
 
 	return hr;
 }
@@ -270,12 +287,8 @@ HRESULT GifReader::InitializeDecoder(_In_ IStream *pSourceStream)
 	HRESULT hr = E_FAIL;
 
 	ResetGifState();
-	SafeRelease(&m_pSavedFrame);
+	m_FrameCacheKey = L"";
 
-	if (!m_pD2DFactory) {
-		// Create D2D factory
-		RETURN_ON_BAD_HR(hr = D2D1CreateFactory(D2D1_FACTORY_TYPE_SINGLE_THREADED, __uuidof(ID2D1Factory), (void **)&m_pD2DFactory));
-	}
 	if (!m_pIWICFactory) {
 		// Create WIC factory
 		RETURN_ON_BAD_HR(hr = CoCreateInstance(
@@ -304,22 +317,9 @@ HRESULT GifReader::InitializeDecoder(_In_ IStream *pSourceStream)
 HRESULT GifReader::CreateDeviceResources()
 {
 	HRESULT hr = S_OK;
-
-
-	if (m_RenderTarget == NULL)
+	if (m_RenderTexture == NULL)
 	{
-		// Create the DXGI Surface Render Target.
-		UINT dpi = GetSystemDpi();
-		/* RenderTargetProperties contains the description for render target */
-		D2D1_RENDER_TARGET_PROPERTIES RenderTargetProperties =
-			D2D1::RenderTargetProperties(
-				D2D1_RENDER_TARGET_TYPE_DEFAULT,
-				D2D1::PixelFormat(DXGI_FORMAT_UNKNOWN, D2D1_ALPHA_MODE_PREMULTIPLIED),
-				static_cast<float>(dpi),
-				static_cast<float>(dpi)
-			);
-
-
+		//The composed frames are copied to the texture one changed area at a time, so it is not cleared between frames.
 		D3D11_TEXTURE2D_DESC desc = { 0 };
 		desc.MipLevels = 1;
 		desc.ArraySize = 1;
@@ -327,24 +327,10 @@ HRESULT GifReader::CreateDeviceResources()
 		desc.SampleDesc.Count = 1;
 		desc.SampleDesc.Quality = 0;
 		desc.Usage = D3D11_USAGE_DEFAULT;
-		desc.BindFlags = D3D11_BIND_RENDER_TARGET;
+		desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
 		desc.Width = m_cxGifImagePixel;
 		desc.Height = m_cyGifImagePixel;
 		RETURN_ON_BAD_HR(hr = m_Device->CreateTexture2D(&desc, nullptr, &m_RenderTexture));
-
-		ATL::CComPtr<IDXGISurface> pSharedSurface;
-		RETURN_ON_BAD_HR(hr = m_RenderTexture->QueryInterface(__uuidof(IDXGISurface), (void **)&pSharedSurface));
-		RETURN_ON_BAD_HR(hr = m_pD2DFactory->CreateDxgiSurfaceRenderTarget(pSharedSurface, RenderTargetProperties, &m_RenderTarget));
-
-		if (SUCCEEDED(hr))
-		{
-			SafeRelease(&m_pFrameComposeRT);
-			hr = m_RenderTarget->CreateCompatibleRenderTarget(
-				D2D1::SizeF(
-					static_cast<FLOAT>(m_cxGifImage),
-					static_cast<FLOAT>(m_cyGifImage)),
-				&m_pFrameComposeRT);
-		}
 	}
 	return hr;
 }
@@ -364,16 +350,6 @@ HRESULT GifReader::GetGlobalMetadata()
 			&pMetadataQueryReader);
 	}
 
-	if (SUCCEEDED(hr))
-	{
-		// Get background color
-		if (FAILED(GetBackgroundColor(pMetadataQueryReader)))
-		{
-			// Default to transparent if failed to get the color
-			m_backgroundColor = D2D1::ColorF(0, 0.f);
-		}
-	}
-
 	// Get global frame size
 	if (SUCCEEDED(hr))
 	{
@@ -517,7 +493,7 @@ HRESULT GifReader::GetRawFrame(UINT uFrameIndex)
 	HRESULT hr = m_pDecoder->GetFrame(uFrameIndex, &pWicFrame);
 	if (SUCCEEDED(hr))
 	{
-		// Format convert to 32bppPBGRA which D2D expects
+		// Format convert to 32bppPBGRA, which the frames are composed in
 		hr = m_pIWICFactory->CreateFormatConverter(&pConverter);
 	}
 
@@ -532,14 +508,22 @@ HRESULT GifReader::GetRawFrame(UINT uFrameIndex)
 			WICBitmapPaletteTypeCustom);
 	}
 
+	UINT width = 0;
+	UINT height = 0;
+	if (SUCCEEDED(hr))
+	{
+		hr = pConverter->GetSize(&width, &height);
+	}
+
 	if (SUCCEEDED(hr))
 	{
-		// Create a D2DBitmap from IWICBitmapSource
-		SafeRelease(&m_pRawFrame);
-		hr = m_RenderTarget->CreateBitmapFromWicBitmap(
-			pConverter,
+		// Decode the frame to the reused raw frame buffer
+		m_RawFrameBuffer.resize(static_cast<size_t>(width) * height * 4);
+		hr = pConverter->CopyPixels(
 			NULL,
-			&m_pRawFrame);
+			width * 4,
+			static_cast<UINT>(m_RawFrameBuffer.size()),
+			m_RawFrameBuffer.data());
 	}
 
 	if (SUCCEEDED(hr))
@@ -557,7 +541,7 @@ HRESULT GifReader::GetRawFrame(UINT uFrameIndex)
 			hr = (propValue.vt == VT_UI2 ? S_OK : E_FAIL);
 			if (SUCCEEDED(hr))
 			{
-				m_framePosition.left = static_cast<FLOAT>(propValue.uiVal);
+				m_RawFrameInfo.Position.Left = propValue.uiVal;
 			}
 			PropVariantClear(&propValue);
 		}
@@ -571,7 +555,7 @@ HRESULT GifReader::GetRawFrame(UINT uFrameIndex)
 			hr = (propValue.vt == VT_UI2 ? S_OK : E_FAIL);
 			if (SUCCEEDED(hr))
 			{
-				m_framePosition.top = static_cast<FLOAT>(propValue.uiVal);
+				m_RawFrameInfo.Position.Top = propValue.uiVal;
 			}
 			PropVariantClear(&propValue);
 		}
@@ -585,8 +569,7 @@ HRESULT GifReader::GetRawFrame(UINT uFrameIndex)
 			hr = (propValue.vt == VT_UI2 ? S_OK : E_FAIL);
 			if (SUCCEEDED(hr))
 			{
-				m_framePosition.right = static_cast<FLOAT>(propValue.uiVal)
-					+ m_framePosition.left;
+				m_RawFrameInfo.Position.Width = propValue.uiVal;
 			}
 			PropVariantClear(&propValue);
 		}
@@ -600,8 +583,7 @@ HRESULT GifReader::GetRawFrame(UINT uFrameIndex)
 			hr = (propValue.vt == VT_UI2 ? S_OK : E_FAIL);
 			if (SUCCEEDED(hr))
 			{
-				m_framePosition.bottom = static_cast<FLOAT>(propValue.uiVal)
-					+ m_framePosition.top;
+				m_RawFrameInfo.Position.Height = propValue.uiVal;
 			}
 			PropVariantClear(&propValue);
 		}
@@ -610,6 +592,7 @@ HRESULT GifReader::GetRawFrame(UINT uFrameIndex)
 	if (SUCCEEDED(hr))
 	{
 		// Get delay from the optional Graphic Control Extension
+		USHORT delayCentiseconds = 0;
 		if (SUCCEEDED(pFrameMetadataQueryReader->GetMetadataByName(
 			L"/grctlext/Delay",
 			&propValue)))
@@ -617,32 +600,13 @@ HRESULT GifReader::GetRawFrame(UINT uFrameIndex)
 			hr = (propValue.vt == VT_UI2 ? S_OK : E_FAIL);
 			if (SUCCEEDED(hr))
 			{
-				// Convert the delay retrieved in 10 ms units to a delay in 1 ms units
-				hr = UIntMult(propValue.uiVal, 10, &m_uFrameDelay);
+				delayCentiseconds = propValue.uiVal;
 			}
 			PropVariantClear(&propValue);
 		}
-		else
-		{
-			// Failed to get delay from graphic control extension. Possibly a
-			// single frame image (non-animated gif)
-			m_uFrameDelay = 0;
-		}
-
-		if (SUCCEEDED(hr))
-		{
-			// Insert an artificial delay to ensure rendering for gif with very small
-			// or 0 delay.  This delay number is picked to match with most browsers' 
-			// gif display speed.
-			//
-			// This will defeat the purpose of using zero delay intermediate frames in 
-			// order to preserve compatibility. If this is removed, the zero delay 
-			// intermediate frames will not be visible.
-			if (m_uFrameDelay < 20)
-			{
-				m_uFrameDelay = 90;
-			}
-		}
+		// Frames without a delay, e.g. a single frame image (non-animated gif),
+		// get the artificial delay browsers show them with.
+		m_RawFrameInfo.DelayMillis = GetGifFrameDelayMillis(delayCentiseconds);
 	}
 
 	if (SUCCEEDED(hr))
@@ -654,17 +618,24 @@ HRESULT GifReader::GetRawFrame(UINT uFrameIndex)
 			hr = (propValue.vt == VT_UI1) ? S_OK : E_FAIL;
 			if (SUCCEEDED(hr))
 			{
-				m_uFrameDisposal = propValue.bVal;
+				m_RawFrameInfo.Disposal = propValue.bVal;
 			}
 		}
 		else
 		{
 			// Failed to get the disposal method, use default. Possibly a 
 			// non-animated gif.
-			m_uFrameDisposal = DM_UNDEFINED;
+			m_RawFrameInfo.Disposal = GIF_DISPOSAL_UNDEFINED;
 		}
 	}
 
+	if (SUCCEEDED(hr))
+	{
+		// Never draw more pixels than were decoded, should the image descriptor disagree with them
+		m_RawFrameInfo.Position.Width = (std::min)(m_RawFrameInfo.Position.Width, width);
+		m_RawFrameInfo.Position.Height = (std::min)(m_RawFrameInfo.Position.Height, height);
+	}
+
 	PropVariantClear(&propValue);
 
 	SafeRelease(&pConverter);
@@ -674,293 +645,143 @@ HRESULT GifReader::GetRawFrame(UINT uFrameIndex)
 	return hr;
 }
 
-HRESULT GifReader::GetBackgroundColor(
-	IWICMetadataQueryReader *pMetadataQueryReader)
+void GifReader::InitializeFrameCache()
 {
-	DWORD dwBGColor;
-	BYTE backgroundIndex = 0;
-	WICColor rgColors[256];
-	UINT cColorsCopied = 0;
-	PROPVARIANT propVariant;
-	PropVariantInit(&propVariant);
-	IWICPalette *pWicPalette = NULL;
-
-	// If we have a global palette, get the palette and background color
-	HRESULT hr = pMetadataQueryReader->GetMetadataByName(
-		L"/logscrdesc/GlobalColorTableFlag",
-		&propVariant);
-	if (SUCCEEDED(hr))
-	{
-		hr = (propVariant.vt != VT_BOOL || !propVariant.boolVal) ? E_FAIL : S_OK;
-		PropVariantClear(&propVariant);
+	if (m_FrameCacheMaxBytes == 0 || m_cFrames < 2) {
+		return;
 	}
-
-	if (SUCCEEDED(hr))
-	{
-		// Background color index
-		hr = pMetadataQueryReader->GetMetadataByName(
-			L"/logscrdesc/BackgroundColorIndex",
-			&propVariant);
-		if (SUCCEEDED(hr))
-		{
-			hr = (propVariant.vt != VT_UI1) ? E_FAIL : S_OK;
-			if (SUCCEEDED(hr))
-			{
-				backgroundIndex = propVariant.bVal;
-			}
-			PropVariantClear(&propVariant);
-		}
-	}
-
-	// Get the color from the palette
-	if (SUCCEEDED(hr))
-	{
-		hr = m_pIWICFactory->CreatePalette(&pWicPalette);
-	}
-
-	if (SUCCEEDED(hr))
-	{
-		// Get the global palette
-		hr = m_pDecoder->CopyPalette(pWicPalette);
-	}
-
-	if (SUCCEEDED(hr))
-	{
-		hr = pWicPalette->GetColors(
-			ARRAYSIZE(rgColors),
-			rgColors,
-			&cColorsCopied);
-	}
-
-	if (SUCCEEDED(hr))
-	{
-		// Check whether background color is outside range 
-		hr = (backgroundIndex >= cColorsCopied) ? E_FAIL : S_OK;
+	size_t maxBytes = static_cast<size_t>((std::min)(m_FrameCacheMaxBytes, static_cast<UINT64>(SIZE_MAX)));
+	m_pFrameCache = g_GifFrameCaches.GetOrCreate(m_FrameCacheKey, maxBytes, [this](size_t availableBytes) {
+		return CreateFrameCache(availableBytes);
+		});
+	if (m_pFrameCache) {
+		LOG_DEBUG(L"Playing %u GIF frames from a frame cache of %.1f MB", m_cFrames, m_pFrameCache->GetSizeInBytes() / (1024.0 * 1024.0));
+		//Decoding is done, so the buffer used for it is freed.
+		std::vector<BYTE>().swap(m_RawFrameBuffer);
 	}
-
-	if (SUCCEEDED(hr))
-	{
-		// Get the color in ARGB format
-		dwBGColor = rgColors[backgroundIndex];
-
-		// The background color is in ARGB format, and we want to 
-		// extract the alpha value and convert it in FLOAT
-		FLOAT alpha = (dwBGColor >> 24) / 255.f;
-		m_backgroundColor = D2D1::ColorF(dwBGColor, alpha);
+	else {
+		LOG_INFO(L"GIF frames do not fit in the frame cache budget of %llu bytes, decoding them as they are shown", m_FrameCacheMaxBytes);
 	}
-
-	SafeRelease(&pWicPalette);
-	return hr;
 }
 
-HRESULT GifReader::RestoreSavedFrame()
+std::shared_ptr<GifFrameCache> GifReader::CreateFrameCache(_In_ size_t maxBytes)
 {
-	HRESULT hr = S_OK;
-
-	ID2D1Bitmap *pFrameToCopyTo = NULL;
-
-	hr = m_pSavedFrame ? S_OK : E_FAIL;
-
-	if (SUCCEEDED(hr))
-	{
-		hr = m_pFrameComposeRT->GetBitmap(&pFrameToCopyTo);
-	}
-
-	if (SUCCEEDED(hr))
-	{
-		// Copy the whole bitmap
-		hr = pFrameToCopyTo->CopyFromBitmap(NULL, m_pSavedFrame, NULL);
+	MeasureExecutionTime measure(L"GifReader CreateFrameCache");
+	std::shared_ptr<GifFrameCache> pCache = make_shared<GifFrameCache>(m_cxGifImage, m_cyGifImage);
+	GifFrameComposer composer(m_cxGifImage, m_cyGifImage);
+	for (UINT i = 0; i < m_cFrames; i++) {
+		HRESULT hr = GetRawFrame(i);
+		if (FAILED(hr)) {
+			LOG_ERROR(L"Failed to decode GIF frame %u for the frame cache: hr = 0x%08x", i, hr);
+			return nullptr;
+		}
+		composer.ComposeFrame(i, m_RawFrameInfo, m_RawFrameBuffer.data(), m_RawFrameInfo.Position.Width * 4);
+		if (!pCache->AddFrame(composer, m_RawFrameInfo.DelayMillis, maxBytes)) {
+			return nullptr;
+		}
 	}
-
-	SafeRelease(&pFrameToCopyTo);
-
-	return hr;
+	pCache->ShrinkToFit();
+	return pCache;
 }
 
-HRESULT GifReader::ClearCurrentFrameArea()
+HRESULT GifReader::StartCaptureLoop()
 {
-	m_pFrameComposeRT->BeginDraw();
-
-	// Clip the render target to the size of the raw frame
-	m_pFrameComposeRT->PushAxisAlignedClip(
-		&m_framePosition,
-		D2D1_ANTIALIAS_MODE_PER_PRIMITIVE);
-
-	m_pFrameComposeRT->Clear(NULL);//m_backgroundColor);
-
-	// Remove the clipping
-	m_pFrameComposeRT->PopAxisAlignedClip();
-
-	return m_pFrameComposeRT->EndDraw();
+	if (!m_FramePacer) {
+		//Each frame is due its delay after the previous one was due, so the time spent composing frames does not slow down the animation.
+		m_FramePacer = make_unique<FramePacer>(make_shared<HighresTimerPacingClock>(), FramePacingMode::Deadline);
+	}
+	m_CaptureTask = concurrency::create_task([this]() {
+		do
+		{
+			//The first frame is due immediately.
+			if (!m_FramePacer->WaitForNextFrame()) {
+				LOG_DEBUG(L"StartCaptureLoop frame pacer was canceled");
+				return;
+			}
+			EnterCriticalSection(&m_CriticalSection);
+			HRESULT hr = ComposeNextFrame();
+			LeaveCriticalSection(&m_CriticalSection);
+			if (FAILED(hr)) {
+				LOG_ERROR(L"Failed to compose GIF frame: hr = 0x%08x", hr);
+			}
+			//Update timestamp and notify that there is a new sample available
+			QueryPerformanceCounter(&m_LastSampleReceivedTimeStamp);
+			SetEvent(m_NewFrameEvent);
+			m_FramePacer->SetInterval(MillisToHundredNanos(m_uFrameDelay));
+		} while (!EndOfAnimation() && m_cFrames > 1);
+		});
+	return S_OK;
 }
 
-HRESULT GifReader::DisposeCurrentFrame()
+HRESULT GifReader::ComposeNextFrame()
 {
 	HRESULT hr = S_OK;
-
-	switch (m_uFrameDisposal)
+	// Check to see if the render texture is initialized
+	if (m_RenderTexture)
 	{
-		case DM_UNDEFINED:
-		case DM_NONE:
-			// We simply draw on the previous frames. Do nothing here.
-			break;
-		case DM_BACKGROUND:
-			// Dispose background
-			// Clear the area covered by the current raw frame with background color
-			hr = ClearCurrentFrameArea();
-			break;
-		case DM_PREVIOUS:
-			// Dispose previous
-			// We restore the previous composed frame first
-			hr = RestoreSavedFrame();
-			break;
-		default:
-			// Invalid disposal method
-			hr = E_FAIL;
+		// Compose one frame, then keep composing frames until we see a frame with
+		// delay greater than 0 (0 delay frames are the invisible intermediate frames),
+		// or until we have reached the very last frame.
+		do
+		{
+			hr = m_pFrameCache ? DrawNextCachedFrame() : DecodeNextFrame();
+		} while (SUCCEEDED(hr) && m_uFrameDelay == 0 && !IsLastFrame());
 	}
-
 	return hr;
 }
 
-HRESULT GifReader::OverlayNextFrame()
+HRESULT GifReader::DecodeNextFrame()
 {
+	if (!m_pFrameComposer) {
+		m_pFrameComposer = make_unique<GifFrameComposer>(m_cxGifImage, m_cyGifImage);
+	}
 	// Get Frame information
 	HRESULT hr = GetRawFrame(m_uNextFrameIndex);
 	if (SUCCEEDED(hr))
 	{
-		// For disposal 3 method, we would want to save a copy of the current
-		// composed frame
-		if (m_uFrameDisposal == DM_PREVIOUS)
-		{
-			hr = SaveComposedFrame();
-		}
-	}
+		// Dispose of the current frame and draw the next one on top of it
+		m_pFrameComposer->ComposeFrame(m_uNextFrameIndex, m_RawFrameInfo, m_RawFrameBuffer.data(), m_RawFrameInfo.Position.Width * 4);
+		GIF_RECT changedRect = m_pFrameComposer->GetChangedRect();
+		const UINT32 *pCanvas = m_pFrameComposer->GetCanvas();
+		UpdateRenderTexture(changedRect, pCanvas + static_cast<size_t>(changedRect.Top) * m_cxGifImage + changedRect.Left, m_cxGifImage * 4);
+		m_uFrameDelay = m_RawFrameInfo.DelayMillis;
 
-	if (SUCCEEDED(hr))
-	{
-		// Start producing the next bitmap
-		m_pFrameComposeRT->BeginDraw();
-
-		// If starting a new animation loop
+		// If starting a new animation loop, increase loop count
 		if (m_uNextFrameIndex == 0)
 		{
-			// Draw background and increase loop count
-			m_pFrameComposeRT->Clear(NULL);//m_backgroundColor);
 			m_uLoopNumber++;
 		}
-
-		// Produce the next frame
-		m_pFrameComposeRT->DrawBitmap(
-			m_pRawFrame,
-			m_framePosition);
-
-		hr = m_pFrameComposeRT->EndDraw();
-	}
-
-	// To improve performance and avoid decoding/composing this frame in the 
-	// following animation loops, the composed frame can be cached here in system 
-	// or video memory.
-
-	if (SUCCEEDED(hr))
-	{
 		// Increase the frame index by 1
-		m_uNextFrameIndex = (++m_uNextFrameIndex) % m_cFrames;
+		m_uNextFrameIndex = (m_uNextFrameIndex + 1) % m_cFrames;
 	}
-
 	return hr;
 }
 
-HRESULT GifReader::SaveComposedFrame()
+HRESULT GifReader::DrawNextCachedFrame()
 {
-	HRESULT hr = S_OK;
-
-	ID2D1Bitmap *pFrameToBeSaved = NULL;
-
-	hr = m_pFrameComposeRT->GetBitmap(&pFrameToBeSaved);
-	if (SUCCEEDED(hr))
-	{
-		// Create the temporary bitmap if it hasn't been created yet 
-		if (m_pSavedFrame == NULL)
-		{
-			D2D1_SIZE_U bitmapSize = pFrameToBeSaved->GetPixelSize();
-			D2D1_BITMAP_PROPERTIES bitmapProp;
-			pFrameToBeSaved->GetDpi(&bitmapProp.dpiX, &bitmapProp.dpiY);
-			bitmapProp.pixelFormat = pFrameToBeSaved->GetPixelFormat();
-
-			hr = m_pFrameComposeRT->CreateBitmap(
-				bitmapSize,
-				bitmapProp,
-				&m_pSavedFrame);
-		}
-	}
-
-	if (SUCCEEDED(hr))
+	const GIF_CACHED_FRAME &frame = m_pFrameCache->GetFrame(m_uNextFrameIndex);
+	UpdateRenderTexture(frame.Rect, m_pFrameCache->GetFramePixels(m_uNextFrameIndex), frame.Rect.Width * 4);
+	m_uFrameDelay = frame.DelayMillis;
+	if (m_uNextFrameIndex == 0)
 	{
-		// Copy the whole bitmap
-		hr = m_pSavedFrame->CopyFromBitmap(NULL, pFrameToBeSaved, NULL);
+		m_uLoopNumber++;
 	}
-
-	SafeRelease(&pFrameToBeSaved);
-
-	return hr;
-}
-
-HRESULT GifReader::StartCaptureLoop()
-{
-	m_CaptureTask = concurrency::create_task([this]() {
-		if (!m_FramerateTimer) {
-			m_FramerateTimer = make_unique<HighresTimer>();
-		}
-		do
-		{
-			EnterCriticalSection(&m_CriticalSection);
-			ComposeNextFrame();
-			CComPtr<ID2D1Bitmap> pFrameToRender = nullptr;
-			HRESULT hr = m_pFrameComposeRT->GetBitmap(&pFrameToRender);
-			if (SUCCEEDED(hr)) {
-				m_RenderTarget->BeginDraw();
-				m_RenderTarget->Clear(NULL);
-				m_RenderTarget->DrawBitmap(pFrameToRender);
-				m_RenderTarget->EndDraw();
-			}
-			LeaveCriticalSection(&m_CriticalSection);
-			//Update timestamp and notify that there is a new sample available
-			QueryPerformanceCounter(&m_LastSampleReceivedTimeStamp);
-			SetEvent(m_NewFrameEvent);
-			hr = m_FramerateTimer->WaitFor(MillisToHundredNanos(m_uFrameDelay));
-			if (FAILED(hr)) {
-				LOG_ERROR(L"StartCaptureLoop wait for frame failed: hr = 0x%08x", hr);
-				return;
-			}
-		} while (!EndOfAnimation() && m_cFrames > 1);
-		});
+	m_uNextFrameIndex = (m_uNextFrameIndex + 1) % m_cFrames;
 	return S_OK;
 }
 
-HRESULT GifReader::ComposeNextFrame()
+void GifReader::UpdateRenderTexture(_In_ const GIF_RECT &rect, _In_ const UINT32 *pPixels, _In_ UINT pitch)
 {
-	HRESULT hr = S_OK;
-	// Check to see if the render targets are initialized
-	if (m_RenderTarget && m_pFrameComposeRT)
-	{
-		// Compose one frame
-		hr = DisposeCurrentFrame();
-		if (SUCCEEDED(hr))
-		{
-			hr = OverlayNextFrame();
-		}
-
-		// Keep composing frames until we see a frame with delay greater than
-		// 0 (0 delay frames are the invisible intermediate frames), or until
-		// we have reached the very last frame.
-		while (SUCCEEDED(hr) && m_uFrameDelay == 0 && !IsLastFrame())
-		{
-			hr = DisposeCurrentFrame();
-			if (SUCCEEDED(hr))
-			{
-				hr = OverlayNextFrame();
-			}
-		}
-	}
-	return hr;
-}
\ No newline at end of file
+	//The render texture is smaller than the composed frame for GIFs with non-square pixels, so the area is clipped to it.
+	if (rect.IsEmpty() || rect.Left >= m_cxGifImagePixel || rect.Top >= m_cyGifImagePixel) {
+		return;
+	}
+	D3D11_BOX box{};
+	box.left = rect.Left;
+	box.top = rect.Top;
+	box.right = (std::min)(rect.Left + rect.Width, m_cxGifImagePixel);
+	box.bottom = (std::min)(rect.Top + rect.Height, m_cyGifImagePixel);
+	box.front = 0;
+	box.back = 1;
+	m_DeviceContext->UpdateSubresource(m_RenderTexture, 0, &box, pPixels, pitch, 0);
+}
@@ -1,19 +1,21 @@
 #pragma once
-#include <d2d1.h>
 #include <wincodec.h>
 #include <concrt.h>
 #include <ppltasks.h> 
 #include "CommonTypes.h"
 #include "DX.util.h"
-#include "HighresTimer.h"
+#include "FramePacingClock.h"
 #include "CaptureBase.h"
 #include "TextureManager.h"
+#include "GifFrameCache.h"
 
 	class GifReader : public CaptureBase
 	{
 	public:
 
-		GifReader();
+		/// <param name="frameCacheMaxBytes">The most bytes the decoded frames of all GIFs played at the same time may hold, so they are decoded only once.
+		/// GIFs that do not fit, or all GIFs if 0, are decoded as they are shown.</param>
+		GifReader(_In_ UINT64 frameCacheMaxBytes = 0);
 		~GifReader();
 		virtual HRESULT Initialize(_In_ ID3D11DeviceContext *pDeviceContext, _In_ ID3D11Device *pDevice) override;
 		virtual HRESULT StartCapture(_In_ RECORDING_SOURCE_BASE &source) override;
@@ -25,31 +27,35 @@
 			return S_FALSE;
 		}
 		virtual inline std::wstring Name() override { return L"GifReader"; };
+		virtual inline HANDLE GetFrameArrivedEvent() override { return m_NewFrameEvent; }
 	private:
-		enum DISPOSAL_METHODS
-		{
-			DM_UNDEFINED = 0,
-			DM_NONE = 1,
-			DM_BACKGROUND = 2,
-			DM_PREVIOUS = 3
-		};
 		HRESULT InitializeDecoder(_In_ std::wstring source);
 		HRESULT InitializeDecoder(_In_ IStream *pSourceStream);
 		HRESULT CreateDeviceResources();
 
 
+		/// <summary>
+		/// Decodes the frame to m_RawFrameBuffer as premultiplied BGRA, and reads its position, delay and disposal method to m_RawFrameInfo.
+		/// </summary>
 		HRESULT GetRawFrame(UINT uFrameIndex);
 		HRESULT GetGlobalMetadata();
-		HRESULT GetBackgroundColor(IWICMetadataQueryReader *pMetadataQueryReader);
+		/// <summary>
+		/// Gets the shared frame cache of the GIF, decoding all frames if no other reader holds it.
+		/// If the frames do not fit in the budget, m_pFrameCache is left empty and the frames are decoded as they are shown.
+		/// </summary>
+		void InitializeFrameCache();
+		std::shared_ptr<GifFrameCache> CreateFrameCache(_In_ size_t maxBytes);
 
 		HRESULT StartCaptureLoop();
 		HRESULT ComposeNextFrame();
-		HRESULT DisposeCurrentFrame();
-		HRESULT OverlayNextFrame();
-
-		HRESULT SaveComposedFrame();
-		HRESULT RestoreSavedFrame();
-		HRESULT ClearCurrentFrameArea();
+		HRESULT DecodeNextFrame();
+		HRESULT DrawNextCachedFrame();
+		/// <summary>
+		/// Copies the area of the composed frame that changed to the render texture.
+		/// </summary>
+		/// <param name="pPixels">The pixels of the area, starting at its top left corner</param>
+		/// <param name="pitch">The distance between rows of pPixels, in bytes</param>
+		void UpdateRenderTexture(_In_ const GIF_RECT &rect, _In_ const UINT32 *pPixels, _In_ UINT pitch);
 
 		void ResetGifState();
 
@@ -68,15 +74,17 @@
 		CRITICAL_SECTION m_CriticalSection;
 		Concurrency::task<void> m_CaptureTask = concurrency::task_from_result();
 		LARGE_INTEGER m_LastSampleReceivedTimeStamp;
-		std::unique_ptr<HighresTimer> m_FramerateTimer;
+		std::unique_ptr<FramePacer> m_FramePacer;
 
 		ID3D11Texture2D *m_RenderTexture;
-		ID2D1Factory *m_pD2DFactory;
-		ID2D1BitmapRenderTarget *m_pFrameComposeRT;
-		ID2D1RenderTarget *m_RenderTarget;
-		ID2D1Bitmap *m_pRawFrame;
-		ID2D1Bitmap *m_pSavedFrame;          // The temporary bitmap used for disposal 3 method
-		D2D1_COLOR_F                m_backgroundColor;
+		//Composes the frames as they are decoded, when they are not cached.
+		std::unique_ptr<GifFrameComposer> m_pFrameComposer;
+		std::shared_ptr<const GifFrameCache> m_pFrameCache;
+		UINT64 m_FrameCacheMaxBytes;
+		//Identifies the GIF in the shared frame caches. Empty for GIFs read from a stream, whose caches are not shared.
+		std::wstring m_FrameCacheKey;
+		std::vector<BYTE> m_RawFrameBuffer;
+		GIF_FRAME_INFO m_RawFrameInfo;
 
 		IWICImagingFactory *m_pIWICFactory;
 		IWICBitmapDecoder *m_pDecoder;
@@ -86,11 +94,9 @@
 		UINT    m_uLoopNumber;      // The current animation loop number (e.g. 1 when the animation is first played)
 		BOOL    m_fHasLoop;         // Whether the gif has a loop
 		UINT    m_cFrames;
-		UINT    m_uFrameDisposal;
 		UINT    m_uFrameDelay;
 		UINT    m_cxGifImage;
 		UINT    m_cyGifImage;
 		UINT    m_cxGifImagePixel;  // Width of the displayed image in pixel calculated using pixel aspect ratio
 		UINT    m_cyGifImagePixel;  // Height of the displayed image in pixel calculated using pixel aspect ratio
-		D2D1_RECT_F m_framePosition;
 	};
\ No newline at end of file
@@ -0,0 +1,470 @@
+#pragma once
+#include "WorkerPool.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define JPEG_ENCODER_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+/// <summary>
+/// Encodes BGRA images as baseline JPEG files with 4:2:0 chroma subsampling and the standard Huffman tables, dropping alpha.
+/// Each row of 16 pixel high MCUs is a restart interval, so rows are encoded independently and in parallel on a WorkerPool,
+/// and joined with restart markers. Quality is scaled from the example tables of the JPEG standard, as libjpeg does.
+/// Keeps its buffers between images, so encoding images of the same size does not allocate. Encode is not reentrant.
+/// </summary>
+class JpegEncoder
+{
+public:
+	/// <param name="quality">The quality from 1 to 100. 90 matches the default of the WIC JPEG encoder.</param>
+	JpegEncoder(int quality = 90)
+	{
+		static const uint8_t LUMINANCE_QUANTIZATION[64] = {
+			16, 11, 10, 16, 24, 40, 51, 61,
+			12, 12, 14, 19, 26, 58, 60, 55,
+			14, 13, 16, 24, 40, 57, 69, 56,
+			14, 17, 22, 29, 51, 87, 80, 62,
+			18, 22, 37, 56, 68, 109, 103, 77,
+			24, 35, 55, 64, 81, 104, 113, 92,
+			49, 64, 78, 87, 103, 121, 120, 101,
+			72, 92, 95, 98, 112, 100, 103, 99
+		};
+		static const uint8_t CHROMINANCE_QUANTIZATION[64] = {
+			17, 18, 24, 47, 99, 99, 99, 99,
+			18, 21, 26, 66, 99, 99, 99, 99,
+			24, 26, 56, 99, 99, 99, 99, 99,
+			47, 66, 99, 99, 99, 99, 99, 99,
+			99, 99, 99, 99, 99, 99, 99, 99,
+			99, 99, 99, 99, 99, 99, 99, 99,
+			99, 99, 99, 99, 99, 99, 99, 99,
+			99, 99, 99, 99, 99, 99, 99, 99
+		};
+		//The scale factors of the AAN DCT, which are folded into the quantization divisors.
+		static const float AAN_SCALE[8] = { 1.0f, 1.387039845f, 1.306562965f, 1.175875602f, 1.0f, 0.785694958f, 0.541196100f, 0.275899379f };
+		quality = (std::max)((std::min)(quality, 100), 1);
+		int scale = quality < 50 ? 5000 / quality : 200 - quality * 2;
+		for (int i = 0; i < 64; i++) {
+			m_Quantization[0][i] = static_cast<uint8_t>((std::max)((std::min)((LUMINANCE_QUANTIZATION[i] * scale + 50) / 100, 255), 1));
+			m_Quantization[1][i] = static_cast<uint8_t>((std::max)((std::min)((CHROMINANCE_QUANTIZATION[i] * scale + 50) / 100, 255), 1));
+			for (int table = 0; table < 2; table++) {
+				m_Divisors[table][i] = 1.0f / (m_Quantization[table][i] * AAN_SCALE[i / 8] * AAN_SCALE[i % 8] * 8.0f);
+			}
+		}
+		BuildHuffmanTable(DC_LUMINANCE_BITS, DC_LUMINANCE_VALUES, m_HuffmanTables[0]);
+		BuildHuffmanTable(AC_LUMINANCE_BITS, AC_LUMINANCE_VALUES, m_HuffmanTables[1]);
+		BuildHuffmanTable(DC_CHROMINANCE_BITS, DC_CHROMINANCE_VALUES, m_HuffmanTables[2]);
+		BuildHuffmanTable(AC_CHROMINANCE_BITS, AC_CHROMINANCE_VALUES, m_HuffmanTables[3]);
+	}
+	JpegEncoder(const JpegEncoder &) = delete;
+	JpegEncoder &operator=(const JpegEncoder &) = delete;
+
+	/// <summary>
+	/// Encodes an image and replaces the contents of output with the JPEG file.
+	/// </summary>
+	/// <param name="pBgra">The pixels, 4 bytes each in B, G, R, A order</param>
+	/// <param name="pitch">The distance between rows of pBgra, in bytes</param>
+	/// <param name="pPool">Optional pool to encode rows on. The calling thread encodes rows too, so the pool may be busy or be the pool the caller runs on.</param>
+	/// <returns>false if the image is empty or too large for a JPEG</returns>
+	bool Encode(const uint8_t *pBgra, uint32_t width, uint32_t height, uint32_t pitch, std::vector<uint8_t> &output, WorkerPool *pPool = nullptr)
+	{
+		output.clear();
+		if (width == 0 || height == 0 || width > 65535 || height > 65535) {
+			return false;
+		}
+		m_pBgra = pBgra;
+		m_Width = width;
+		m_Height = height;
+		m_Pitch = pitch;
+		m_McuColumns = (width + 15) / 16;
+		size_t mcuRows = (height + 15) / 16;
+		m_Rows.resize(mcuRows);
+		auto encodeRow([&](size_t index) { EncodeMcuRow(static_cast<uint32_t>(index), m_Rows[index]); });
+		if (pPool) {
+			pPool->ParallelFor(mcuRows, encodeRow);
+		}
+		else {
+			for (size_t i = 0; i < mcuRows; i++) {
+				encodeRow(i);
+			}
+		}
+		m_pBgra = nullptr;
+
+		size_t scanSize = 0;
+		for (const std::vector<uint8_t> &row : m_Rows) {
+			scanSize += row.size() + 2;
+		}
+		output.reserve(scanSize + 1024);
+		WriteHeaders(output);
+		for (size_t i = 0; i < mcuRows; i++) {
+			output.insert(output.end(), m_Rows[i].begin(), m_Rows[i].end());
+			if (i + 1 < mcuRows) {
+				//RST0 to RST7, in turn.
+				output.push_back(0xFF);
+				output.push_back(static_cast<uint8_t>(0xD0 + (i % 8)));
+			}
+		}
+		output.push_back(0xFF);
+		output.push_back(0xD9);
+		return true;
+	}
+
+private:
+	struct HUFFMAN_TABLE {
+		uint16_t Codes[256];
+		uint8_t Sizes[256];
+		const uint8_t *pBits;
+		const uint8_t *pValues;
+		size_t ValueCount;
+	};
+
+	//The typical Huffman tables from Annex K of the JPEG standard: the number of codes of each length from 1 to 16 bits, and the values in order of their codes.
+	static constexpr uint8_t DC_LUMINANCE_BITS[16] = { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
+	static constexpr uint8_t DC_LUMINANCE_VALUES[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+	static constexpr uint8_t DC_CHROMINANCE_BITS[16] = { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 };
+	static constexpr uint8_t DC_CHROMINANCE_VALUES[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+	static constexpr uint8_t AC_LUMINANCE_BITS[16] = { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7D };
+	static constexpr uint8_t AC_LUMINANCE_VALUES[162] = {
+		0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+		0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xA1, 0x08, 0x23, 0x42, 0xB1, 0xC1, 0x15, 0x52, 0xD1, 0xF0,
+		0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0A, 0x16, 0x17, 0x18, 0x19, 0x1A, 0x25, 0x26, 0x27, 0x28,
+		0x29, 0x2A, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+		0x4A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5A, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+		0x6A, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+		0x8A, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7,
+		0xA8, 0xA9, 0xAA, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA, 0xC2, 0xC3, 0xC4, 0xC5,
+		0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA, 0xE1, 0xE2,
+		0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA, 0xF1, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8,
+		0xF9, 0xFA
+	};
+	static constexpr uint8_t AC_CHROMINANCE_BITS[16] = { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 };
+	static constexpr uint8_t AC_CHROMINANCE_VALUES[162] = {
+		0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+		0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xA1, 0xB1, 0xC1, 0x09, 0x23, 0x33, 0x52, 0xF0,
+		0x15, 0x62, 0x72, 0xD1, 0x0A, 0x16, 0x24, 0x34, 0xE1, 0x25, 0xF1, 0x17, 0x18, 0x19, 0x1A, 0x26,
+		0x27, 0x28, 0x29, 0x2A, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+		0x49, 0x4A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5A, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+		0x69, 0x6A, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+		0x88, 0x89, 0x8A, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A, 0xA2, 0xA3, 0xA4, 0xA5,
+		0xA6, 0xA7, 0xA8, 0xA9, 0xAA, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA, 0xC2, 0xC3,
+		0xC4, 0xC5, 0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA,
+		0xE2, 0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8,
+		0xF9, 0xFA
+	};
+	//The index in natural order of each coefficient in zigzag order.
+	static constexpr uint8_t ZIGZAG[64] = {
+		0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5,
+		12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21, 28,
+		35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+		58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+	};
+
+	/// <summary>
+	/// Writes bits of Huffman coded data most significant bit first, stuffing a zero byte after each 0xFF byte.
+	/// </summary>
+	struct BIT_WRITER {
+		std::vector<uint8_t> *pOutput;
+		uint32_t Bits = 0;
+		int Count = 0;
+
+		inline void Put(uint32_t value, int size)
+		{
+			Bits = (Bits << size) | (value & ((1u << size) - 1));
+			Count += size;
+			while (Count >= 8) {
+				uint8_t byte = static_cast<uint8_t>(Bits >> (Count - 8));
+				pOutput->push_back(byte);
+				if (byte == 0xFF) {
+					pOutput->push_back(0);
+				}
+				Count -= 8;
+			}
+		}
+
+		/// <summary>
+		/// Pads the last byte with one bits, as the standard asks before a marker.
+		/// </summary>
+		void Flush()
+		{
+			if (Count > 0) {
+				Put(0x7F, 8 - Count);
+			}
+		}
+	};
+
+	uint8_t m_Quantization[2][64];
+	//The reciprocals of the quantization steps, scaled for the AAN DCT, in natural order.
+	float m_Divisors[2][64];
+	//DC and AC tables for luminance, then for chrominance.
+	HUFFMAN_TABLE m_HuffmanTables[4];
+	const uint8_t *m_pBgra = nullptr;
+	uint32_t m_Width = 0;
+	uint32_t m_Height = 0;
+	uint32_t m_Pitch = 0;
+	uint32_t m_McuColumns = 0;
+	//The entropy coded data of each row of MCUs.
+	std::vector<std::vector<uint8_t>> m_Rows;
+
+	static void BuildHuffmanTable(const uint8_t *pBits, const uint8_t *pValues, HUFFMAN_TABLE &table)
+	{
+		memset(table.Codes, 0, sizeof(table.Codes));
+		memset(table.Sizes, 0, sizeof(table.Sizes));
+		table.pBits = pBits;
+		table.pValues = pValues;
+		uint32_t code = 0;
+		size_t index = 0;
+		for (int length = 1; length <= 16; length++) {
+			for (int i = 0; i < pBits[length - 1]; i++) {
+				table.Codes[pValues[index]] = static_cast<uint16_t>(code++);
+				table.Sizes[pValues[index]] = static_cast<uint8_t>(length);
+				index++;
+			}
+			code <<= 1;
+		}
+		table.ValueCount = index;
+	}
+
+	static void WriteMarker(uint8_t marker, uint16_t length, std::vector<uint8_t> &output)
+	{
+		output.push_back(0xFF);
+		output.push_back(marker);
+		output.push_back(static_cast<uint8_t>(length >> 8));
+		output.push_back(static_cast<uint8_t>(length));
+	}
+
+	void WriteHeaders(std::vector<uint8_t> &output) const
+	{
+		output.push_back(0xFF);
+		output.push_back(0xD8);
+		static const uint8_t JFIF[14] = { 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0 };
+		WriteMarker(0xE0, 2 + sizeof(JFIF), output);
+		output.insert(output.end(), JFIF, JFIF + sizeof(JFIF));
+
+		WriteMarker(0xDB, 2 + 2 * 65, output);
+		for (uint8_t table = 0; table < 2; table++) {
+			output.push_back(table);
+			for (int i = 0; i < 64; i++) {
+				output.push_back(m_Quantization[table][ZIGZAG[i]]);
+			}
+		}
+
+		//Y is sampled at full resolution, Cb and Cr at half resolution in both directions.
+		WriteMarker(0xC0, 17, output);
+		const uint8_t frame[15] = {
+			8,
+			static_cast<uint8_t>(m_Height >> 8), static_cast<uint8_t>(m_Height), static_cast<uint8_t>(m_Width >> 8), static_cast<uint8_t>(m_Width),
+			3,
+			1, 0x22, 0,
+			2, 0x11, 1,
+			3, 0x11, 1
+		};
+		output.insert(output.end(), frame, frame + sizeof(frame));
+
+		static const uint8_t TABLE_CLASSES[4] = { 0x00, 0x10, 0x01, 0x11 };
+		uint16_t huffmanLength = 2;
+		for (const HUFFMAN_TABLE &table : m_HuffmanTables) {
+			huffmanLength += static_cast<uint16_t>(1 + 16 + table.ValueCount);
+		}
+		WriteMarker(0xC4, huffmanLength, output);
+		for (int i = 0; i < 4; i++) {
+			output.push_back(TABLE_CLASSES[i]);
+			output.insert(output.end(), m_HuffmanTables[i].pBits, m_HuffmanTables[i].pBits + 16);
+			output.insert(output.end(), m_HuffmanTables[i].pValues, m_HuffmanTables[i].pValues + m_HuffmanTables[i].ValueCount);
+		}
+
+		WriteMarker(0xDD, 4, output);
+		output.push_back(static_cast<uint8_t>(m_McuColumns >> 8));
+		output.push_back(static_cast<uint8_t>(m_McuColumns));
+
+		WriteMarker(0xDA, 12, output);
+		static const uint8_t SCAN[10] = { 3, 1, 0x00, 2, 0x11, 3, 0x11, 0, 63, 0 };
+		output.insert(output.end(), SCAN, SCAN + sizeof(SCAN));
+	}
+
+	/// <summary>
+	/// The forward DCT of the AAN algorithm, in floating point as libjpeg's jfdctflt.c, leaving the outputs scaled by the factors folded into the divisors.
+	/// Both passes transform eight columns at a time with the same operations, so compilers vectorize them.
+	/// </summary>
+	static void ForwardDct(float *pBlock)
+	{
+		float transposed[64];
+		for (int pass = 0; pass < 2; pass++) {
+			for (int i = 0; i < 8; i++) {
+				for (int j = 0; j < 8; j++) {
+					transposed[j * 8 + i] = pBlock[i * 8 + j];
+				}
+			}
+			for (int column = 0; column < 8; column++) {
+				float *p = transposed + column;
+				float tmp0 = p[0] + p[56];
+				float tmp7 = p[0] - p[56];
+				float tmp1 = p[8] + p[48];
+				float tmp6 = p[8] - p[48];
+				float tmp2 = p[16] + p[40];
+				float tmp5 = p[16] - p[40];
+				float tmp3 = p[24] + p[32];
+				float tmp4 = p[24] - p[32];
+
+				float tmp10 = tmp0 + tmp3;
+				float tmp13 = tmp0 - tmp3;
+				float tmp11 = tmp1 + tmp2;
+				float tmp12 = tmp1 - tmp2;
+				float *pOut = pBlock + column;
+				pOut[0] = tmp10 + tmp11;
+				pOut[32] = tmp10 - tmp11;
+				float z1 = (tmp12 + tmp13) * 0.707106781f;
+				pOut[16] = tmp13 + z1;
+				pOut[48] = tmp13 - z1;
+
+				tmp10 = tmp4 + tmp5;
+				tmp11 = tmp5 + tmp6;
+				tmp12 = tmp6 + tmp7;
+				float z5 = (tmp10 - tmp12) * 0.382683433f;
+				float z2 = 0.541196100f * tmp10 + z5;
+				float z4 = 1.306562965f * tmp12 + z5;
+				float z3 = tmp11 * 0.707106781f;
+				float z11 = tmp7 + z3;
+				float z13 = tmp7 - z3;
+				pOut[40] = z13 + z2;
+				pOut[24] = z13 - z2;
+				pOut[8] = z11 + z4;
+				pOut[56] = z11 - z4;
+			}
+		}
+	}
+
+	static inline void Quantize(const float *pBlock, const float *pDivisors, int16_t *pCoefficients)
+	{
+		int i = 0;
+#ifdef JPEG_ENCODER_SSE2
+		for (; i < 64; i += 8) {
+			__m128i low = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(pBlock + i), _mm_loadu_ps(pDivisors + i)));
+			__m128i high = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(pBlock + i + 4), _mm_loadu_ps(pDivisors + i + 4)));
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(pCoefficients + i), _mm_packs_epi32(low, high));
+		}
+#endif
+		for (; i < 64; i++) {
+			float value = pBlock[i] * pDivisors[i];
+			pCoefficients[i] = static_cast<int16_t>(value < 0 ? value - 0.5f : value + 0.5f);
+		}
+	}
+
+	static inline int GetBitCount(int value)
+	{
+		uint32_t magnitude = static_cast<uint32_t>(value < 0 ? -value : value);
+		if (magnitude == 0) {
+			return 0;
+		}
+#if defined(_MSC_VER)
+		unsigned long index;
+		_BitScanReverse(&index, magnitude);
+		return static_cast<int>(index) + 1;
+#else
+		return 32 - __builtin_clz(magnitude);
+#endif
+	}
+
+	/// <summary>
+	/// Transforms, quantizes and writes a block of samples, level shifted to be centered on 0.
+	/// </summary>
+	void EncodeBlock(float *pBlock, int table, int &dcPredictor, BIT_WRITER &writer) const
+	{
+		ForwardDct(pBlock);
+		alignas(16) int16_t coefficients[64];
+		Quantize(pBlock, m_Divisors[table], coefficients);
+		const HUFFMAN_TABLE &dcTable = m_HuffmanTables[table * 2];
+		const HUFFMAN_TABLE &acTable = m_HuffmanTables[table * 2 + 1];
+
+		int difference = coefficients[0] - dcPredictor;
+		dcPredictor = coefficients[0];
+		int size = GetBitCount(difference);
+		writer.Put(dcTable.Codes[size], dcTable.Sizes[size]);
+		if (size > 0) {
+			//Negative values are written as their ones' complement.
+			writer.Put(static_cast<uint32_t>(difference < 0 ? difference - 1 : difference), size);
+		}
+		int zeroRun = 0;
+		for (int i = 1; i < 64; i++) {
+			int value = coefficients[ZIGZAG[i]];
+			if (value == 0) {
+				zeroRun++;
+				continue;
+			}
+			while (zeroRun >= 16) {
+				writer.Put(acTable.Codes[0xF0], acTable.Sizes[0xF0]);
+				zeroRun -= 16;
+			}
+			size = GetBitCount(value);
+			int symbol = (zeroRun << 4) | size;
+			writer.Put(acTable.Codes[symbol], acTable.Sizes[symbol]);
+			writer.Put(static_cast<uint32_t>(value < 0 ? value - 1 : value), size);
+			zeroRun = 0;
+		}
+		if (zeroRun > 0) {
+			writer.Put(acTable.Codes[0x00], acTable.Sizes[0x00]);
+		}
+	}
+
+	/// <summary>
+	/// Encodes a row of MCUs as one restart interval. Pixels past the right and bottom edges repeat the edge pixels.
+	/// </summary>
+	void EncodeMcuRow(uint32_t mcuRow, std::vector<uint8_t> &output) const
+	{
+		output.clear();
+		BIT_WRITER writer;
+		writer.pOutput = &output;
+		int dcPredictors[3] = { 0, 0, 0 };
+		alignas(16) float y[256];
+		alignas(16) float cb[256];
+		alignas(16) float cr[256];
+		alignas(16) float block[64];
+		const uint8_t *pRows[16];
+		for (uint32_t row = 0; row < 16; row++) {
+			pRows[row] = m_pBgra + static_cast<size_t>(m_Pitch) * (std::min)(mcuRow * 16 + row, m_Height - 1);
+		}
+		for (uint32_t mcuColumn = 0; mcuColumn < m_McuColumns; mcuColumn++) {
+			uint32_t left = mcuColumn * 16;
+			uint32_t columnOffsets[16];
+			for (uint32_t column = 0; column < 16; column++) {
+				columnOffsets[column] = (std::min)(left + column, m_Width - 1) * 4;
+			}
+			for (uint32_t row = 0; row < 16; row++) {
+				for (uint32_t column = 0; column < 16; column++) {
+					const uint8_t *pPixel = pRows[row] + columnOffsets[column];
+					float b = pPixel[0];
+					float g = pPixel[1];
+					float r = pPixel[2];
+					int index = row * 16 + column;
+					y[index] = 0.299f * r + 0.587f * g + 0.114f * b - 128.0f;
+					cb[index] = -0.168736f * r - 0.331264f * g + 0.5f * b;
+					cr[index] = 0.5f * r - 0.418688f * g - 0.081312f * b;
+				}
+			}
+			for (int blockIndex = 0; blockIndex < 4; blockIndex++) {
+				const float *pSource = y + (blockIndex / 2) * 128 + (blockIndex % 2) * 8;
+				for (int row = 0; row < 8; row++) {
+					memcpy(block + row * 8, pSource + row * 16, 8 * sizeof(float));
+				}
+				EncodeBlock(block, 0, dcPredictors[0], writer);
+			}
+			for (int component = 1; component < 3; component++) {
+				const float *pSource = component == 1 ? cb : cr;
+				for (int row = 0; row < 8; row++) {
+					for (int column = 0; column < 8; column++) {
+						const float *p = pSource + row * 32 + column * 2;
+						block[row * 8 + column] = (p[0] + p[1] + p[16] + p[17]) * 0.25f;
+					}
+				}
+				EncodeBlock(block, 1, dcPredictors[component], writer);
+			}
+		}
+		writer.Flush();
+	}
+};
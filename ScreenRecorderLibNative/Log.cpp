@@ -1,32 +1,38 @@
 #include "Log.h"
-#include <mutex>
+#include "AsyncLogWriter.h"
 
-static std::mutex g_Mtx{};
+static AsyncLogWriter *GetLogWriter() {
+	//Intentionally never deleted. Logging may happen during static destruction, and the writer thread must not be joined under the loader lock when the library is unloaded.
+	static AsyncLogWriter *writer = []() {
+		AsyncLogWriter *pWriter = new AsyncLogWriter();
+		pWriter->SetFallbackSink([](const wchar_t *message) { OutputDebugStringW(message); });
+		return pWriter;
+	}();
+	return writer;
+}
 
 void _log(PCWSTR format, ...)
 {
-	const std::lock_guard<std::mutex> lock(g_Mtx);
-	wchar_t buffer[LOG_BUFFER_SIZE];
 	va_list args;
 	va_start(args, format);
+	GetLogWriter()->Write(format, args);
+	va_end(args);
+}
+
+void SetLogFile(std::wstring path)
+{
+	logFilePath = path;
+	GetLogWriter()->SetFilePath(path);
+}
 
-	vswprintf_s(buffer, LOG_BUFFER_SIZE, format, args);
-	if (!logFilePath.empty()) {
+void FlushLog()
+{
+	GetLogWriter()->Flush(std::chrono::milliseconds(LOG_FLUSH_TIMEOUT_MS));
+}
 
-		std::wofstream logFile(logFilePath, std::ios_base::app | std::ios_base::out);
-		if (logFile.is_open())
-		{
-			logFile << buffer;
-			logFile.close();
-		}
-		else {
-			OutputDebugStringW(L"Error opening log file for write");
-		}
-	}
-	else {
-		OutputDebugStringW(buffer);
-	}
-	va_end(args);
+UINT64 GetDroppedLogMessageCount()
+{
+	return GetLogWriter()->GetStats().Dropped;
 }
 
 std::wstring GetTimestamp() {
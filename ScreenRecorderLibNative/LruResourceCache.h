@@ -0,0 +1,212 @@
+#pragma once
+#include "ResourcePool.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+struct LRU_RESOURCE_CACHE_STATS {
+	//Requests served by a cached resource.
+	uint64_t Hits = 0;
+	//Requests that had to allocate a new resource.
+	uint64_t Misses = 0;
+	//Resources freed to stay within the budget.
+	uint64_t Evictions = 0;
+	//Requests that failed because the allocator failed.
+	uint64_t Failures = 0;
+	//Cached resources, and how many of them are pinned.
+	size_t Entries = 0;
+	size_t Pinned = 0;
+	//The summed size of the cached resources, the most it has been, and the budget.
+	uint64_t Bytes = 0;
+	uint64_t PeakBytes = 0;
+	uint64_t BudgetBytes = 0;
+};
+
+/// <summary>
+/// A thread safe cache of reusable resources keyed by their description, holding at most a budget of bytes.
+/// Requesting a description returns a cached resource matching it, or allocates a new one. When the cached resources exceed the budget,
+/// the least recently used are freed. The budget is a soft limit: the resource just returned and pinned resources are never freed,
+/// so the cache may exceed it while they alone are larger.
+/// A pinned resource is also not returned for another request, so a resource still in use, e.g. a frame waiting to be encoded,
+/// is not handed out again to be overwritten. Another resource matching the same description is allocated instead.
+/// Returned resources belong to the cache, and may be freed by the next request or budget change unless they are pinned.
+/// Unpinning never frees resources, so it may be done from another thread than the requests; a cache over its budget after unpinning is trimmed by the next request.
+/// </summary>
+template <typename TDescription, typename TResource, typename TDescriptionHash = std::hash<TDescription>, typename TDescriptionEqual = std::equal_to<TDescription>>
+class LruResourceCache
+{
+public:
+	/// <param name="allocator">Creates and frees the cached resources</param>
+	/// <param name="getSize">Returns the size in bytes of a resource matching a description</param>
+	/// <param name="budgetBytes">The most bytes to keep cached</param>
+	LruResourceCache(std::unique_ptr<IResourceAllocator<TDescription, TResource>> allocator, std::function<uint64_t(const TDescription &)> getSize, uint64_t budgetBytes) :
+		m_Allocator(std::move(allocator)),
+		m_GetSize(getSize),
+		m_BudgetBytes(budgetBytes),
+		m_Bytes(0),
+		m_Stats{}
+	{
+	}
+	LruResourceCache(const LruResourceCache &) = delete;
+	LruResourceCache &operator=(const LruResourceCache &) = delete;
+	~LruResourceCache()
+	{
+		Clear();
+	}
+
+	/// <summary>
+	/// Gets an unpinned cached resource matching the description, or allocates a new one, evicting the least recently used resources if that exceeds the budget.
+	/// </summary>
+	/// <returns>true if a resource was returned in pResource</returns>
+	bool Get(const TDescription &description, TResource *pResource)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		auto range = m_Index.equal_range(description);
+		for (auto it = range.first; it != range.second; it++) {
+			EntryIterator entry = it->second;
+			if (entry->PinCount == 0) {
+				m_Entries.splice(m_Entries.begin(), m_Entries, entry);
+				m_Stats.Hits++;
+				EvictOverBudget(entry);
+				*pResource = entry->Resource;
+				return true;
+			}
+		}
+		TResource resource{};
+		if (!m_Allocator->Allocate(description, &resource)) {
+			m_Stats.Failures++;
+			return false;
+		}
+		m_Stats.Misses++;
+		uint64_t size = m_GetSize(description);
+		m_Entries.push_front(CACHE_ENTRY{ description, resource, size, 0 });
+		m_Index.emplace(description, m_Entries.begin());
+		m_Resources[resource] = m_Entries.begin();
+		m_Bytes += size;
+		m_Stats.PeakBytes = (std::max)(m_Stats.PeakBytes, m_Bytes);
+		EvictOverBudget(m_Entries.begin());
+		*pResource = resource;
+		return true;
+	}
+
+	/// <summary>
+	/// Pins a cached resource, so it is neither returned for another request nor evicted until it is unpinned as many times as it was pinned.
+	/// </summary>
+	/// <returns>false if the resource is not in the cache</returns>
+	bool Pin(TResource resource)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		auto it = m_Resources.find(resource);
+		if (it == m_Resources.end()) {
+			return false;
+		}
+		it->second->PinCount++;
+		return true;
+	}
+
+	/// <summary>
+	/// Unpins a resource pinned with Pin. Resources no longer in the cache, e.g. after Clear, are ignored.
+	/// The resource is not freed even if the cache is over its budget, since requests may be made on another thread and still use it.
+	/// </summary>
+	void Unpin(TResource resource)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		auto it = m_Resources.find(resource);
+		if (it == m_Resources.end() || it->second->PinCount == 0) {
+			return;
+		}
+		it->second->PinCount--;
+	}
+
+	/// <summary>
+	/// Changes the budget, evicting resources if the cache exceeds the new one.
+	/// </summary>
+	void SetBudget(uint64_t budgetBytes)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_BudgetBytes = budgetBytes;
+		EvictOverBudget(m_Entries.end());
+	}
+
+	/// <summary>
+	/// Frees all cached resources, including pinned ones.
+	/// </summary>
+	void Clear()
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		for (CACHE_ENTRY &entry : m_Entries) {
+			m_Allocator->Free(entry.Resource);
+		}
+		m_Entries.clear();
+		m_Index.clear();
+		m_Resources.clear();
+		m_Bytes = 0;
+	}
+
+	LRU_RESOURCE_CACHE_STATS GetStats()
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		LRU_RESOURCE_CACHE_STATS stats = m_Stats;
+		stats.Entries = m_Entries.size();
+		stats.Pinned = std::count_if(m_Entries.begin(), m_Entries.end(), [](const CACHE_ENTRY &entry) { return entry.PinCount > 0; });
+		stats.Bytes = m_Bytes;
+		stats.BudgetBytes = m_BudgetBytes;
+		return stats;
+	}
+
+private:
+	struct CACHE_ENTRY {
+		TDescription Description;
+		TResource Resource;
+		uint64_t Size;
+		uint32_t PinCount;
+	};
+	typedef typename std::list<CACHE_ENTRY>::iterator EntryIterator;
+
+	//Frees the least recently used unpinned resources, except keep, until the cache is within the budget.
+	void EvictOverBudget(EntryIterator keep)
+	{
+		auto it = m_Entries.end();
+		while (m_Bytes > m_BudgetBytes && it != m_Entries.begin()) {
+			EntryIterator candidate = std::prev(it);
+			if (candidate == keep || candidate->PinCount > 0) {
+				it = candidate;
+				continue;
+			}
+			Remove(candidate);
+			m_Stats.Evictions++;
+		}
+	}
+
+	void Remove(EntryIterator entry)
+	{
+		auto range = m_Index.equal_range(entry->Description);
+		for (auto it = range.first; it != range.second; it++) {
+			if (it->second == entry) {
+				m_Index.erase(it);
+				break;
+			}
+		}
+		m_Resources.erase(entry->Resource);
+		m_Bytes -= entry->Size;
+		m_Allocator->Free(entry->Resource);
+		m_Entries.erase(entry);
+	}
+
+	std::mutex m_Mutex;
+	std::unique_ptr<IResourceAllocator<TDescription, TResource>> m_Allocator;
+	std::function<uint64_t(const TDescription &)> m_GetSize;
+	uint64_t m_BudgetBytes;
+	uint64_t m_Bytes;
+	//Most recently used first.
+	std::list<CACHE_ENTRY> m_Entries;
+	std::unordered_multimap<TDescription, EntryIterator, TDescriptionHash, TDescriptionEqual> m_Index;
+	std::unordered_map<TResource, EntryIterator> m_Resources;
+	LRU_RESOURCE_CACHE_STATS m_Stats;
+};
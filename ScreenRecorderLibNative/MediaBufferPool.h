@@ -0,0 +1,41 @@
+#pragma once
+#include "AudioBufferPool.h"
+#include "Log.h"
+#include <mfapi.h>
+#include <mfidl.h>
+
+/// <summary>
+/// Allocates Media Foundation memory buffers. The pool owns one reference to each buffer.
+/// </summary>
+class MFMemoryBufferAllocator : public IAudioBufferAllocator<IMFMediaBuffer *>
+{
+public:
+	bool Allocate(const size_t &capacity, IMFMediaBuffer **ppBuffer) override {
+		*ppBuffer = nullptr;
+		HRESULT hr = MFCreateMemoryBuffer((DWORD)capacity, ppBuffer);
+		if (FAILED(hr)) {
+			LOG_ERROR(L"Failed to create pooled media buffer: hr = 0x%08x", hr);
+			return false;
+		}
+		return true;
+	}
+	void Free(IMFMediaBuffer *pBuffer) override {
+		pBuffer->Release();
+	}
+	uint8_t *Lock(IMFMediaBuffer *pBuffer) override {
+		BYTE *pData = nullptr;
+		HRESULT hr = pBuffer->Lock(&pData, nullptr, nullptr);
+		if (FAILED(hr)) {
+			LOG_ERROR(L"Failed to lock pooled media buffer: hr = 0x%08x", hr);
+			return nullptr;
+		}
+		return pData;
+	}
+	void Unlock(IMFMediaBuffer *pBuffer, size_t length) override {
+		pBuffer->Unlock();
+		pBuffer->SetCurrentLength((DWORD)length);
+	}
+};
+
+typedef AudioBufferPool<IMFMediaBuffer *> MediaBufferPool;
+typedef AudioBufferRef<IMFMediaBuffer *> MediaBufferRef;
@@ -0,0 +1,193 @@
+#pragma once
+#include "BoundedMpscQueue.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#define MOUSE_CLICK_BUTTON_NONE 0
+#define MOUSE_CLICK_BUTTON_LEFT 1
+#define MOUSE_CLICK_BUTTON_RIGHT 2
+
+/// <summary>
+/// A mouse button being pressed or released, at a time of the media clock in 100 nanosecond units.
+/// </summary>
+struct MOUSE_CLICK_EVENT {
+	int64_t Timestamp = 0;
+	uint8_t Button = MOUSE_CLICK_BUTTON_NONE;
+	bool IsPressed = false;
+};
+
+struct MOUSE_CLICK_TIMELINE_STATS {
+	//Button presses added to the timeline.
+	uint64_t Clicks = 0;
+	//Events lost because the event queue was full, and clicks dropped because the timeline was full before they were drawn.
+	uint64_t DroppedEvents = 0;
+	uint64_t DroppedClicks = 0;
+};
+
+/// <summary>
+/// Places mouse clicks on the timeline of the recording, so each frame highlights the clicks made while it was shown.
+/// Presses and releases are posted from the thread receiving them through a lock-free queue, and are turned into clicks lasting from the press
+/// until the highlight duration after the release. A frame highlights any click overlapping the time since the frame before it,
+/// so clicks shorter than a frame are still drawn.
+/// PostEvent is safe to call from any thread. The other methods must not be called concurrently with each other.
+/// </summary>
+class MouseClickTimeline
+{
+public:
+	/// <param name="eventCapacity">The most events queued until the timeline is next read</param>
+	/// <param name="clickCapacity">The most clicks kept until they are discarded, after which the oldest click is dropped</param>
+	MouseClickTimeline(size_t eventCapacity = 256, size_t clickCapacity = 64) :
+		m_Events(eventCapacity),
+		m_ClickCapacity(clickCapacity > 0 ? clickCapacity : 1),
+		m_HighlightDuration(0),
+		m_DroppedEvents(0),
+		m_Stats{}
+	{
+		m_Clicks.reserve(m_ClickCapacity);
+	}
+	MouseClickTimeline(const MouseClickTimeline &) = delete;
+	MouseClickTimeline &operator=(const MouseClickTimeline &) = delete;
+
+	/// <summary>
+	/// Queues a press or release of a button. Does not block or allocate, so it can be called from a low-level input hook.
+	/// </summary>
+	/// <returns>false if the queue is full and the event is dropped</returns>
+	bool PostEvent(int64_t timestamp, uint8_t button, bool isPressed)
+	{
+		bool isQueued = m_Events.TryPush([&](MOUSE_CLICK_EVENT &evt) {
+			evt.Timestamp = timestamp;
+			evt.Button = button;
+			evt.IsPressed = isPressed;
+		});
+		if (!isQueued) {
+			m_DroppedEvents.fetch_add(1, std::memory_order_relaxed);
+		}
+		return isQueued;
+	}
+
+	/// <summary>
+	/// Sets how long a click stays highlighted after the button is released, in 100 nanosecond units.
+	/// </summary>
+	void SetHighlightDuration(int64_t duration)
+	{
+		m_HighlightDuration = duration > 0 ? duration : 0;
+	}
+
+	/// <summary>
+	/// Gets the button to highlight in the frame shown from frameStartPos until frameEndPos. If several clicks overlap the frame, the button pressed last wins.
+	/// </summary>
+	/// <returns>The button, or MOUSE_CLICK_BUTTON_NONE if no click overlaps the frame</returns>
+	uint8_t GetButtonForFrame(int64_t frameStartPos, int64_t frameEndPos)
+	{
+		DrainEvents();
+		//Clicks are ordered by their press, so the last overlapping click is the one pressed last.
+		for (auto it = m_Clicks.rbegin(); it != m_Clicks.rend(); it++) {
+			if (it->PressPos <= frameEndPos && GetHighlightEndPos(*it) > frameStartPos) {
+				return it->Button;
+			}
+		}
+		return MOUSE_CLICK_BUTTON_NONE;
+	}
+
+	/// <summary>
+	/// Discards the clicks whose highlight ended at or before the given position, e.g. the start of the oldest frame still to be drawn.
+	/// </summary>
+	void DiscardBefore(int64_t pos)
+	{
+		DrainEvents();
+		size_t kept = 0;
+		for (size_t i = 0; i < m_Clicks.size(); i++) {
+			if (GetHighlightEndPos(m_Clicks[i]) > pos) {
+				m_Clicks[kept++] = m_Clicks[i];
+			}
+		}
+		m_Clicks.resize(kept);
+	}
+
+	/// <summary>
+	/// Discards all queued events and clicks, e.g. when the clock the events are timestamped with is changed.
+	/// </summary>
+	void Clear()
+	{
+		while (m_Events.TryPop([](MOUSE_CLICK_EVENT &) {})) {
+		}
+		m_Clicks.clear();
+	}
+
+	MOUSE_CLICK_TIMELINE_STATS GetStats() const
+	{
+		MOUSE_CLICK_TIMELINE_STATS stats = m_Stats;
+		stats.DroppedEvents = m_DroppedEvents.load(std::memory_order_relaxed);
+		return stats;
+	}
+
+private:
+	struct MOUSE_CLICK {
+		int64_t PressPos;
+		//The maximum value while the button is held.
+		int64_t ReleasePos;
+		uint8_t Button;
+	};
+
+	int64_t GetHighlightEndPos(const MOUSE_CLICK &click) const
+	{
+		if (click.ReleasePos > (std::numeric_limits<int64_t>::max)() - m_HighlightDuration) {
+			return (std::numeric_limits<int64_t>::max)();
+		}
+		return click.ReleasePos + m_HighlightDuration;
+	}
+
+	void DrainEvents()
+	{
+		MOUSE_CLICK_EVENT evt;
+		while (m_Events.TryPop([&](MOUSE_CLICK_EVENT &item) { evt = item; })) {
+			if (evt.IsPressed) {
+				//A press while the button is held means the release was lost, so the held click ends here.
+				Release(evt.Button, evt.Timestamp);
+				AddClick(MOUSE_CLICK{ evt.Timestamp, (std::numeric_limits<int64_t>::max)(), evt.Button });
+			}
+			else {
+				//A release without a press, e.g. of a button held since before clicks were detected, is ignored.
+				Release(evt.Button, evt.Timestamp);
+			}
+		}
+	}
+
+	void Release(uint8_t button, int64_t timestamp)
+	{
+		for (auto it = m_Clicks.rbegin(); it != m_Clicks.rend(); it++) {
+			if (it->Button == button) {
+				if (it->ReleasePos == (std::numeric_limits<int64_t>::max)()) {
+					it->ReleasePos = timestamp > it->PressPos ? timestamp : it->PressPos;
+				}
+				return;
+			}
+		}
+	}
+
+	void AddClick(const MOUSE_CLICK &click)
+	{
+		if (m_Clicks.size() >= m_ClickCapacity) {
+			m_Clicks.erase(m_Clicks.begin());
+			m_Stats.DroppedClicks++;
+		}
+		//Events from several threads may arrive slightly out of order, so the click is inserted by its press to keep the clicks ordered.
+		auto pos = m_Clicks.end();
+		while (pos != m_Clicks.begin() && (pos - 1)->PressPos > click.PressPos) {
+			pos--;
+		}
+		m_Clicks.insert(pos, click);
+		m_Stats.Clicks++;
+	}
+
+	BoundedMpscQueue<MOUSE_CLICK_EVENT> m_Events;
+	//Ordered by their press. Reserved up front, so adding clicks does not allocate.
+	std::vector<MOUSE_CLICK> m_Clicks;
+	size_t m_ClickCapacity;
+	int64_t m_HighlightDuration;
+	std::atomic<uint64_t> m_DroppedEvents;
+	MOUSE_CLICK_TIMELINE_STATS m_Stats;
+};
@@ -3,8 +3,10 @@
 #include "Log.h"
 #include "Util.h"
 #include "Cleanup.h"
+#include "CursorMaskBlender.h"
 #include <concrt.h>
 #include <ppltasks.h>
+#include <chrono>
 
 using namespace DirectX;
 using namespace Concurrency;
@@ -14,60 +16,42 @@ using namespace std;
 #pragma comment(lib, "D2d1.lib")
 
 #define ET_QUITLOOP WM_USER+1
+#ifndef HID_USAGE_PAGE_GENERIC
+#define HID_USAGE_PAGE_GENERIC 0x01
+#endif
+#ifndef HID_USAGE_GENERIC_MOUSE
+#define HID_USAGE_GENERIC_MOUSE 0x02
+#endif
 
-INT64 g_LastMouseClickDurationRemaining = 0;
-INT g_MouseClickDetectionDurationMillis = 50;
-UINT g_LastMouseClickButton = 0;
-
-
-DWORD WINAPI MouseHookThreadProc(_In_ void *Param) {
-	HHOOK mouseHook = SetWindowsHookEx(WH_MOUSE_LL, MouseHookProc, nullptr, 0);
-	MSG msg;
-	while (true) {
-		GetMessage(&msg, NULL, 0, 0);
-		if (msg.message == ET_QUITLOOP) {
-			break;
-		}
-	}
-	UnhookWindowsHookEx(mouseHook);
-	LOG_INFO("Exiting mouse click hook thread");
-	return 0;
-}
-LRESULT CALLBACK MouseHookProc(int nCode, WPARAM wParam, LPARAM lParam)
-{
-	// MB1 click
-	if (wParam == WM_LBUTTONDOWN)
-	{
-		g_LastMouseClickButton = VK_LBUTTON;
-		g_LastMouseClickDurationRemaining = g_MouseClickDetectionDurationMillis;
-	}
-	else if (wParam == WM_RBUTTONDOWN)
-	{
-		g_LastMouseClickButton = VK_RBUTTON;
-		g_LastMouseClickDurationRemaining = g_MouseClickDetectionDurationMillis;
-	}
-	return CallNextHookEx(0, nCode, wParam, lParam);
-}
+//The mouse manager the mouse click thread detects clicks for. Low-level hooks are called on the thread that installed them, so the hook finds it here.
+thread_local MouseManager *t_pMouseClickManager = nullptr;
 
 MouseManager::MouseManager() :
 	m_MouseOptions(nullptr),
 	m_DeviceContext(nullptr),
 	m_Device(nullptr),
-	m_StopPollingTaskEvent(nullptr),
-	m_LastMouseDrawTimeStamp(std::chrono::steady_clock::now()),
 	m_IsCapturingMouseClicks(false),
-	m_MouseHookThread(nullptr),
-	m_MouseHookThreadId(0),
-	m_TextureManager(nullptr)
+	m_MouseClicks(),
+	m_GetMediaTime(nullptr),
+	m_LastMouseClickFrameEndPos(0),
+	m_MouseClickThread(nullptr),
+	m_MouseClickThreadId(0),
+	m_MouseClickThreadStartedEvent(nullptr),
+	m_MouseClickThreadMode(MOUSE_OPTIONS::MOUSE_DETECTION_MODE_POLLING),
+	m_TextureManager(nullptr),
+	m_CursorShapeCache(CURSOR_SHAPE_CACHE_CAPACITY),
+	m_LastCursorHandle(nullptr),
+	m_LastCursorShapeInfo{}
 {
 	InitializeCriticalSection(&m_CriticalSection);
+	m_MouseClickThreadStartedEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
 }
 
 MouseManager::~MouseManager()
 {
 	CleanDX();
 	StopMouseClickDetection();
-	CloseHandle(m_StopPollingTaskEvent);
+	CloseHandle(m_MouseClickThreadStartedEvent);
 	DeleteCriticalSection(&m_CriticalSection);
 }
 
@@ -103,6 +87,16 @@ HRESULT MouseManager::Initialize(_In_ ID3D11DeviceContext *pDeviceContext, _In_
 	hr = pDevice->CreateBlendState(&BlendStateDesc, &m_BlendState);
 	RETURN_ON_BAD_HR(hr);
 
+	// Create the blend state for inverting pointer pixels, the source times the inverse of the background plus the background times the inverse of the source.
+	// A white source gives the inverse of the background and a black source leaves it unchanged, so inverting pointers are drawn without reading the background back.
+	BlendStateDesc.RenderTarget[0].SrcBlend = D3D11_BLEND_INV_DEST_COLOR;
+	BlendStateDesc.RenderTarget[0].DestBlend = D3D11_BLEND_INV_SRC_COLOR;
+	BlendStateDesc.RenderTarget[0].SrcBlendAlpha = D3D11_BLEND_ZERO;
+	BlendStateDesc.RenderTarget[0].DestBlendAlpha = D3D11_BLEND_ONE;
+	if (FAILED(pDevice->CreateBlendState(&BlendStateDesc, &m_InvertBlendState))) {
+		LOG_WARN(L"Failed to create blend state for inverting mouse pointers, they are drawn against a copy of the background instead");
+	}
+
 	m_TextureManager = make_unique<TextureManager>();
 	RETURN_ON_BAD_HR(hr = m_TextureManager->Initialize(pDeviceContext, pDevice));
 	// Initialize shaders
@@ -113,8 +107,6 @@ HRESULT MouseManager::Initialize(_In_ ID3D11DeviceContext *pDeviceContext, _In_
 	m_MouseOptions = pOptions;
 
 	StopMouseClickDetection();
-	CloseHandle(m_StopPollingTaskEvent);
-	m_StopPollingTaskEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
 	InitializeMouseClickDetection();
 	return hr;
 }
@@ -123,45 +115,22 @@ void MouseManager::InitializeMouseClickDetection()
 {
 	if (m_MouseOptions->IsMouseClicksDetected()) {
 		if (!m_IsCapturingMouseClicks) {
-			switch (m_MouseOptions->GetMouseClickDetectionMode())
-			{
-				default:
-				case MOUSE_OPTIONS::MOUSE_DETECTION_MODE_POLLING: {
-					ResetEvent(m_StopPollingTaskEvent);
-					m_MousePollingThread = std::thread([this] {
-						LOG_INFO("Starting mouse click polling task");
-						while (true) {
-							if (GetKeyState(VK_LBUTTON) < 0)
-							{
-								//If left mouse button is held, reset the duration of click duration
-								g_LastMouseClickButton = VK_LBUTTON;
-								g_LastMouseClickDurationRemaining = g_MouseClickDetectionDurationMillis;
-							}
-							else if (GetKeyState(VK_RBUTTON) < 0)
-							{
-								//If right mouse button is held, reset the duration of click duration
-								g_LastMouseClickButton = VK_RBUTTON;
-								g_LastMouseClickDurationRemaining = g_MouseClickDetectionDurationMillis;
-							}
-
-							if (WaitForSingleObjectEx(m_StopPollingTaskEvent, 0, FALSE) == WAIT_OBJECT_0) {
-								break;
-							}
-							wait(1);
-						}
-						LOG_INFO("Exiting mouse click polling task");
-
-						});
-					m_IsCapturingMouseClicks = true;
-					break;
-				}
-				case MOUSE_OPTIONS::MOUSE_DETECTION_MODE_HOOK: {
-					m_MouseHookThread = CreateThread(nullptr, 0, MouseHookThreadProc, nullptr, 0, &m_MouseHookThreadId);
-					m_IsCapturingMouseClicks = true;
-					LOG_INFO("Created mouse click detection hook");
-					break;
+			//Both modes wait for mouse input instead of polling the buttons, so the thread does not wake up while the mouse is not used.
+			//Raw input only reads the input, while the low-level hook sits in the input chain of the system and delays the input if the thread is slow to respond.
+			m_MouseClickThreadMode = m_MouseOptions->GetMouseClickDetectionMode();
+			ResetEvent(m_MouseClickThreadStartedEvent);
+			m_MouseClickThread = CreateThread(nullptr, 0, MouseClickThreadProc, this, 0, &m_MouseClickThreadId);
+			if (m_MouseClickThread) {
+				//The thread creates its message queue before it signals, so the message to stop it cannot be lost.
+				if (WaitForSingleObjectEx(m_MouseClickThreadStartedEvent, 5000, FALSE) != WAIT_OBJECT_0) {
+					LOG_ERROR("Timeout waiting for mouse click detection thread to start.");
 				}
+				LOG_INFO("Started mouse click detection with %ls", m_MouseClickThreadMode == MOUSE_OPTIONS::MOUSE_DETECTION_MODE_HOOK ? L"low-level mouse hook" : L"raw input");
 			}
+			else {
+				LOG_ERROR("Failed to create mouse click detection thread: %lu", GetLastError());
+			}
+			m_IsCapturingMouseClicks = true;
 		}
 	}
 	else if (m_IsCapturingMouseClicks) {
@@ -171,20 +140,198 @@ void MouseManager::InitializeMouseClickDetection()
 
 void MouseManager::StopMouseClickDetection()
 {
-	if (m_MouseHookThread) {
-		PostThreadMessageA(m_MouseHookThreadId, ET_QUITLOOP, 0, 0);
-		DWORD dwWaitResult = WaitForSingleObjectEx(m_MouseHookThread, 5000, false);
+	if (m_MouseClickThread) {
+		PostThreadMessage(m_MouseClickThreadId, ET_QUITLOOP, 0, 0);
+		DWORD dwWaitResult = WaitForSingleObjectEx(m_MouseClickThread, 5000, false);
 		if (dwWaitResult != WAIT_OBJECT_0) {
-			LOG_ERROR("Timeout waiting for mouse hook thread to exit.");
+			LOG_ERROR("Timeout waiting for mouse click detection thread to exit.");
 		}
-		m_MouseHookThread = nullptr;
-		m_MouseHookThreadId = 0;
-	}
-	if (m_MousePollingThread.joinable()) {
-		SetEvent(m_StopPollingTaskEvent);
-		m_MousePollingThread.join();
+		CloseHandle(m_MouseClickThread);
+		m_MouseClickThread = nullptr;
+		m_MouseClickThreadId = 0;
 	}
 	m_IsCapturingMouseClicks = false;
+	EnterCriticalSection(&m_CriticalSection);
+	m_MouseClicks.Clear();
+	LeaveCriticalSection(&m_CriticalSection);
+}
+
+void MouseManager::SetMediaClock(_In_ std::function<HRESULT(INT64 *)> getTime)
+{
+	EnterCriticalSection(&m_CriticalSection);
+	LeaveCriticalSectionOnExit leaveOnExit(&m_CriticalSection);
+	//The thread reads the clock without locking, so it is stopped while the clock is changed. Clicks timestamped with the old clock are discarded.
+	bool isCapturingMouseClicks = m_IsCapturingMouseClicks;
+	StopMouseClickDetection();
+	m_GetMediaTime = getTime;
+	m_LastMouseClickFrameEndPos = 0;
+	if (isCapturingMouseClicks) {
+		InitializeMouseClickDetection();
+	}
+}
+
+DWORD WINAPI MouseManager::MouseClickThreadProc(_In_ void *pParam)
+{
+	MouseManager *pMouseManager = static_cast<MouseManager *>(pParam);
+	t_pMouseClickManager = pMouseManager;
+	MSG msg;
+	PeekMessage(&msg, nullptr, WM_USER, WM_USER, PM_NOREMOVE);
+	HHOOK mouseHook = nullptr;
+	HWND rawInputWindow = nullptr;
+	bool isHookUsed = pMouseManager->m_MouseClickThreadMode == MOUSE_OPTIONS::MOUSE_DETECTION_MODE_HOOK;
+	if (!isHookUsed && IsRawMouseInputRegistered(nullptr)) {
+		//A process has a single raw input registration per device type, so registering would take the mouse input away from the window of the host application.
+		LOG_WARN("Raw mouse input is already registered by the process, using a mouse hook to detect mouse clicks");
+		isHookUsed = true;
+	}
+	if (isHookUsed) {
+		mouseHook = SetWindowsHookEx(WH_MOUSE_LL, MouseHookProc, nullptr, 0);
+		if (!mouseHook) {
+			LOG_ERROR("Failed to install mouse click hook: %lu", GetLastError());
+		}
+	}
+	else {
+		//A message-only window receiving the input of the mouse even when it is not in the foreground.
+		rawInputWindow = CreateWindowEx(0, L"Message", nullptr, 0, 0, 0, 0, 0, HWND_MESSAGE, nullptr, nullptr, nullptr);
+		RAWINPUTDEVICE device{ HID_USAGE_PAGE_GENERIC, HID_USAGE_GENERIC_MOUSE, RIDEV_INPUTSINK, rawInputWindow };
+		if (!rawInputWindow || !RegisterRawInputDevices(&device, 1, sizeof(device))) {
+			LOG_ERROR("Failed to register for raw mouse input: %lu", GetLastError());
+		}
+	}
+	SetEvent(pMouseManager->m_MouseClickThreadStartedEvent);
+	while (GetMessage(&msg, nullptr, 0, 0) > 0) {
+		if (msg.message == ET_QUITLOOP) {
+			break;
+		}
+		if (msg.message == WM_INPUT) {
+			pMouseManager->OnRawMouseInput(reinterpret_cast<HRAWINPUT>(msg.lParam));
+		}
+		DispatchMessage(&msg);
+	}
+	if (mouseHook) {
+		UnhookWindowsHookEx(mouseHook);
+	}
+	if (rawInputWindow) {
+		//Only removed if still ours, in case the host application registered for the mouse while recording.
+		if (IsRawMouseInputRegistered(rawInputWindow)) {
+			RAWINPUTDEVICE device{ HID_USAGE_PAGE_GENERIC, HID_USAGE_GENERIC_MOUSE, RIDEV_REMOVE, nullptr };
+			RegisterRawInputDevices(&device, 1, sizeof(device));
+		}
+		DestroyWindow(rawInputWindow);
+	}
+	t_pMouseClickManager = nullptr;
+	LOG_INFO("Exiting mouse click detection thread");
+	return 0;
+}
+
+bool MouseManager::IsRawMouseInputRegistered(_In_opt_ HWND hwndTarget)
+{
+	UINT count = 0;
+	if (GetRegisteredRawInputDevices(nullptr, &count, sizeof(RAWINPUTDEVICE)) == (UINT)-1 || count == 0) {
+		return false;
+	}
+	std::vector<RAWINPUTDEVICE> devices(count);
+	count = GetRegisteredRawInputDevices(devices.data(), &count, sizeof(RAWINPUTDEVICE));
+	if (count == (UINT)-1) {
+		return false;
+	}
+	for (UINT i = 0; i < count; i++) {
+		if (devices[i].usUsagePage == HID_USAGE_PAGE_GENERIC && devices[i].usUsage == HID_USAGE_GENERIC_MOUSE) {
+			return !hwndTarget || devices[i].hwndTarget == hwndTarget;
+		}
+	}
+	return false;
+}
+
+LRESULT CALLBACK MouseManager::MouseHookProc(int nCode, WPARAM wParam, LPARAM lParam)
+{
+	if (nCode == HC_ACTION && t_pMouseClickManager) {
+		switch (wParam)
+		{
+			case WM_LBUTTONDOWN:
+				t_pMouseClickManager->OnMouseButton(MOUSE_CLICK_BUTTON_LEFT, true);
+				break;
+			case WM_LBUTTONUP:
+				t_pMouseClickManager->OnMouseButton(MOUSE_CLICK_BUTTON_LEFT, false);
+				break;
+			case WM_RBUTTONDOWN:
+				t_pMouseClickManager->OnMouseButton(MOUSE_CLICK_BUTTON_RIGHT, true);
+				break;
+			case WM_RBUTTONUP:
+				t_pMouseClickManager->OnMouseButton(MOUSE_CLICK_BUTTON_RIGHT, false);
+				break;
+			default:
+				break;
+		}
+	}
+	return CallNextHookEx(0, nCode, wParam, lParam);
+}
+
+void MouseManager::OnRawMouseInput(_In_ HRAWINPUT rawInput)
+{
+	RAWINPUT input{};
+	UINT size = sizeof(input);
+	if (GetRawInputData(rawInput, RID_INPUT, &input, &size, sizeof(RAWINPUTHEADER)) == (UINT)-1
+		|| input.header.dwType != RIM_TYPEMOUSE) {
+		return;
+	}
+	USHORT buttonFlags = input.data.mouse.usButtonFlags;
+	if (!(buttonFlags & (RI_MOUSE_LEFT_BUTTON_DOWN | RI_MOUSE_LEFT_BUTTON_UP | RI_MOUSE_RIGHT_BUTTON_DOWN | RI_MOUSE_RIGHT_BUTTON_UP))) {
+		return;
+	}
+	//Raw input reports the physical buttons, so they are swapped like the system does for left handed users.
+	bool isSwapped = GetSystemMetrics(SM_SWAPBUTTON) != 0;
+	UINT8 leftButton = isSwapped ? MOUSE_CLICK_BUTTON_RIGHT : MOUSE_CLICK_BUTTON_LEFT;
+	UINT8 rightButton = isSwapped ? MOUSE_CLICK_BUTTON_LEFT : MOUSE_CLICK_BUTTON_RIGHT;
+	if (buttonFlags & RI_MOUSE_LEFT_BUTTON_DOWN) {
+		OnMouseButton(leftButton, true);
+	}
+	if (buttonFlags & RI_MOUSE_LEFT_BUTTON_UP) {
+		OnMouseButton(leftButton, false);
+	}
+	if (buttonFlags & RI_MOUSE_RIGHT_BUTTON_DOWN) {
+		OnMouseButton(rightButton, true);
+	}
+	if (buttonFlags & RI_MOUSE_RIGHT_BUTTON_UP) {
+		OnMouseButton(rightButton, false);
+	}
+}
+
+void MouseManager::OnMouseButton(_In_ UINT8 button, _In_ bool isPressed)
+{
+	//Timestamped when received, which is within a few milliseconds of the click and well within a frame.
+	INT64 timestamp = 0;
+	if (FAILED(GetMouseClickTime(&timestamp))) {
+		return;
+	}
+	if (!m_MouseClicks.PostEvent(timestamp, button, isPressed)) {
+		LOG_WARN("Mouse click event queue is full, dropping mouse click");
+	}
+}
+
+HRESULT MouseManager::GetMouseClickTime(_Out_ INT64 *pTime)
+{
+	if (m_GetMediaTime) {
+		return m_GetMediaTime(pTime);
+	}
+	*pTime = std::chrono::duration_cast<std::chrono::duration<INT64, std::ratio<1, 10000000>>>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	return S_OK;
+}
+
+UINT8 MouseManager::GetMouseClickButton(_In_ INT64 frameStartPos, _In_ INT64 frameEndPos)
+{
+	if (!m_MouseOptions->IsMouseClicksDetected()) {
+		return MOUSE_CLICK_BUTTON_NONE;
+	}
+	m_MouseClicks.SetHighlightDuration(MillisToHundredNanos(m_MouseOptions->GetMouseClickDetectionDurationMillis()));
+	return m_MouseClicks.GetButtonForFrame(frameStartPos, frameEndPos);
+}
+
+MOUSE_CLICK_TIMELINE_STATS MouseManager::GetMouseClickStats()
+{
+	EnterCriticalSection(&m_CriticalSection);
+	LeaveCriticalSectionOnExit leaveOnExit(&m_CriticalSection);
+	return m_MouseClicks.GetStats();
 }
 
 HRESULT MouseManager::InitMouseClickTexture(_In_ ID3D11DeviceContext *pDeviceContext, _In_ ID3D11Device *pDevice) {
@@ -234,33 +381,84 @@ void MouseManager::GetPointerPosition(_In_ PTR_INFO *pPtrInfo, DXGI_MODE_ROTATIO
 
 HRESULT MouseManager::ProcessMousePointer(_In_ ID3D11Texture2D *pFrame, _In_ PTR_INFO *pPtrInfo)
 {
-	HRESULT hr = S_FALSE;
 	EnterCriticalSection(&m_CriticalSection);
 	LeaveCriticalSectionOnExit leaveOnExit(&m_CriticalSection);
+	INT64 frameEndPos = m_LastMouseClickFrameEndPos;
+	LOG_ON_BAD_HR(GetMouseClickTime(&frameEndPos));
+	INT64 frameStartPos = min(m_LastMouseClickFrameEndPos, frameEndPos);
+	m_LastMouseClickFrameEndPos = frameEndPos;
+	//Frames drawn without timing, like the bitmap data callback, may be drawn alongside the recorded frames, so they leave the clicks for those to discard.
+	return DrawMousePointerAndClick(pFrame, pPtrInfo, frameStartPos, frameEndPos);
+}
+
+HRESULT MouseManager::ProcessMousePointer(_In_ ID3D11Texture2D *pFrame, _In_ PTR_INFO *pPtrInfo, _In_ INT64 frameStartPos, _In_ INT64 frameEndPos)
+{
+	EnterCriticalSection(&m_CriticalSection);
+	LeaveCriticalSectionOnExit leaveOnExit(&m_CriticalSection);
+	HRESULT hr = DrawMousePointerAndClick(pFrame, pPtrInfo, frameStartPos, frameEndPos);
+	//Frames are drawn in order, so clicks ending before this frame are not drawn again.
+	m_MouseClicks.DiscardBefore(frameStartPos);
+	return hr;
+}
+
+HRESULT MouseManager::DrawMousePointerAndClick(_In_ ID3D11Texture2D *pFrame, _In_ PTR_INFO *pPtrInfo, _In_ INT64 frameStartPos, _In_ INT64 frameEndPos)
+{
+	HRESULT hr = S_FALSE;
 	InitializeMouseClickDetection();
-	if (g_LastMouseClickDurationRemaining > 0
-		&& m_MouseOptions->IsMouseClicksDetected())
+	UINT8 clickButton = GetMouseClickButton(frameStartPos, frameEndPos);
+	if (clickButton == MOUSE_CLICK_BUTTON_LEFT)
 	{
-		if (g_LastMouseClickButton == VK_LBUTTON)
-		{
-			hr = DrawMouseClick(pPtrInfo, pFrame, m_MouseOptions->GetMouseClickDetectionLMBColor(), (float)m_MouseOptions->GetMouseClickDetectionRadius(), DXGI_MODE_ROTATION_UNSPECIFIED);
-		}
-		if (g_LastMouseClickButton == VK_RBUTTON)
-		{
-			hr = DrawMouseClick(pPtrInfo, pFrame, m_MouseOptions->GetMouseClickDetectionRMBColor(), (float)m_MouseOptions->GetMouseClickDetectionRadius(), DXGI_MODE_ROTATION_UNSPECIFIED);
-		}
-		INT64 millisSinceLastMouseDraw = (INT64)max(0, (std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_LastMouseDrawTimeStamp).count()));
-		g_LastMouseClickDurationRemaining = max(g_LastMouseClickDurationRemaining - millisSinceLastMouseDraw, 0);
-		LOG_TRACE("Drawing mouse click, duration remaining on click is %u ms", g_LastMouseClickDurationRemaining);
+		hr = DrawMouseClick(pPtrInfo, pFrame, m_MouseOptions->GetMouseClickDetectionLMBColor(), (float)m_MouseOptions->GetMouseClickDetectionRadius(), DXGI_MODE_ROTATION_UNSPECIFIED);
+	}
+	else if (clickButton == MOUSE_CLICK_BUTTON_RIGHT)
+	{
+		hr = DrawMouseClick(pPtrInfo, pFrame, m_MouseOptions->GetMouseClickDetectionRMBColor(), (float)m_MouseOptions->GetMouseClickDetectionRadius(), DXGI_MODE_ROTATION_UNSPECIFIED);
 	}
 
 	if (m_MouseOptions->IsMousePointerEnabled()) {
 		hr = DrawMousePointer(pPtrInfo, pFrame, DXGI_MODE_ROTATION_UNSPECIFIED);
 	}
-	m_LastMouseDrawTimeStamp = std::chrono::steady_clock::now();
 	return hr;
 }
 
+RECT MouseManager::GetPointerBounds(_In_ const PTR_INFO *pPtrInfo, _In_ INT64 frameStartPos, _In_ INT64 frameEndPos)
+{
+	RECT bounds{};
+	int left = static_cast<int>(round((pPtrInfo->Position.x + pPtrInfo->Offset.x) * pPtrInfo->Scale.cx));
+	int top = static_cast<int>(round((pPtrInfo->Position.y + pPtrInfo->Offset.y) * pPtrInfo->Scale.cy));
+	if (m_MouseOptions->IsMousePointerEnabled() && pPtrInfo->Visible && pPtrInfo->PtrShapeBuffer != nullptr) {
+		//Monochrome pointers are drawn at half the height of the shape, so the full height covers every shape type.
+		bounds = RECT{
+			left,
+			top,
+			left + static_cast<int>(ceil(pPtrInfo->ShapeInfo.Width * pPtrInfo->Scale.cx)),
+			top + static_cast<int>(ceil(pPtrInfo->ShapeInfo.Height * pPtrInfo->Scale.cy)) };
+	}
+	if (IsDrawingMouseClick(frameStartPos, frameEndPos)) {
+		float dpiScale = GetSystemDpi() / 96.0f;
+		int centerX = left + static_cast<int>(round(pPtrInfo->ShapeInfo.HotSpot.x * pPtrInfo->Scale.cx));
+		int centerY = top + static_cast<int>(round(pPtrInfo->ShapeInfo.HotSpot.y * pPtrInfo->Scale.cy));
+		//Add a pixel for the antialiased edge of the ellipse.
+		int radiusX = static_cast<int>(ceil(m_MouseOptions->GetMouseClickDetectionRadius() * pPtrInfo->Scale.cx * dpiScale)) + 1;
+		int radiusY = static_cast<int>(ceil(m_MouseOptions->GetMouseClickDetectionRadius() * pPtrInfo->Scale.cy * dpiScale)) + 1;
+		RECT clickBounds{ centerX - radiusX, centerY - radiusY, centerX + radiusX, centerY + radiusY };
+		if (IsRectEmpty(&bounds)) {
+			bounds = clickBounds;
+		}
+		else {
+			UnionRect(&bounds, &bounds, &clickBounds);
+		}
+	}
+	return bounds;
+}
+
+bool MouseManager::IsDrawingMouseClick(_In_ INT64 frameStartPos, _In_ INT64 frameEndPos)
+{
+	EnterCriticalSection(&m_CriticalSection);
+	LeaveCriticalSectionOnExit leaveOnExit(&m_CriticalSection);
+	return GetMouseClickButton(frameStartPos, frameEndPos) != MOUSE_CLICK_BUTTON_NONE;
+}
+
 HRESULT MouseManager::DrawMouseClick(_In_ PTR_INFO *pPtrInfo, _In_ ID3D11Texture2D *pBgTexture, std::string colorStr, float radius, DXGI_MODE_ROTATION rotation)
 {
 	ATL::CComPtr<IDXGISurface> pSharedSurface;
@@ -331,12 +529,7 @@ HRESULT MouseManager::DrawMousePointer(_In_ PTR_INFO *pPtrInfo, _Inout_ ID3D11Te
 	if (!pPtrInfo || !pPtrInfo->Visible || pPtrInfo->PtrShapeBuffer == nullptr)
 		return S_FALSE;
 	// Vars to be used
-	ID3D11Texture2D *MouseTex = nullptr;
-	ID3D11ShaderResourceView *ShaderRes = nullptr;
-	ID3D11Buffer *VertexBufferMouse = nullptr;
-	D3D11_SUBRESOURCE_DATA InitData = { 0 };
-	D3D11_TEXTURE2D_DESC Desc = { 0 };
-	D3D11_SHADER_RESOURCE_VIEW_DESC SDesc;
+	CComPtr<ID3D11ShaderResourceView> ShaderRes;
 	D3D11_TEXTURE2D_DESC DesktopDesc = { 0 };
 	pBgTexture->GetDesc(&DesktopDesc);
 	// Position will be changed based on mouse position
@@ -363,66 +556,59 @@ HRESULT MouseManager::DrawMousePointer(_In_ PTR_INFO *pPtrInfo, _Inout_ ID3D11Te
 	INT PtrLeft = 0;
 	INT PtrTop = 0;
 
-	// Buffer used if necessary (in case of monochrome or masked pointer)
-	BYTE *InitBuffer = nullptr;
-
-	Desc.MipLevels = 1;
-	Desc.ArraySize = 1;
-	Desc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
-	Desc.SampleDesc.Count = 1;
-	Desc.SampleDesc.Quality = 0;
-	Desc.Usage = D3D11_USAGE_DEFAULT;
-	Desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
-	Desc.CPUAccessFlags = 0;
-	Desc.MiscFlags = 0;
-
-	// Set shader resource properties
-	SDesc.Format = Desc.Format;
-	SDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
-	SDesc.Texture2D.MostDetailedMip = Desc.MipLevels - 1;
-	SDesc.Texture2D.MipLevels = Desc.MipLevels;
-
-	switch (pPtrInfo->ShapeInfo.Type)
-	{
-		case DXGI_OUTDUPL_POINTER_SHAPE_TYPE_COLOR:
-		{
-			PtrWidth = static_cast<INT>(pPtrInfo->ShapeInfo.Width);
-			PtrHeight = static_cast<INT>(pPtrInfo->ShapeInfo.Height);
-			GetPointerPosition(pPtrInfo, rotation, DesktopWidth, DesktopHeight, &PtrLeft, &PtrTop);
-			break;
-		}
-		case DXGI_OUTDUPL_POINTER_SHAPE_TYPE_MONOCHROME:
-		{
-			ProcessMonoMask(pBgTexture, rotation, true, pPtrInfo, &PtrWidth, &PtrHeight, &PtrLeft, &PtrTop, &InitBuffer);
-			break;
+	//Pointers that do not depend on the background are converted and uploaded once per shape, and drawn from the cache after that.
+	CURSOR_TEXTURE cachedPointer{};
+	HRESULT hr = GetCachedPointer(pPtrInfo, &cachedPointer);
+	if (FAILED(hr)) {
+		return hr;
+	}
+	if (cachedPointer.ShaderResource) {
+		ShaderRes = cachedPointer.ShaderResource;
+		PtrWidth = cachedPointer.Width;
+		PtrHeight = cachedPointer.Height;
+		GetPointerPosition(pPtrInfo, rotation, DesktopWidth, DesktopHeight, &PtrLeft, &PtrTop);
+		if (PtrWidth <= 0 || PtrHeight <= 0) {
+			return S_FALSE;
 		}
-		case DXGI_OUTDUPL_POINTER_SHAPE_TYPE_MASKED_COLOR:
+	}
+	else {
+		// Buffer used if necessary (in case of monochrome or masked pointer)
+		BYTE *InitBuffer = nullptr;
+		switch (pPtrInfo->ShapeInfo.Type)
 		{
-			ProcessMonoMask(pBgTexture, rotation, false, pPtrInfo, &PtrWidth, &PtrHeight, &PtrLeft, &PtrTop, &InitBuffer);
-			break;
+			case DXGI_OUTDUPL_POINTER_SHAPE_TYPE_COLOR:
+			{
+				PtrWidth = static_cast<INT>(pPtrInfo->ShapeInfo.Width);
+				PtrHeight = static_cast<INT>(pPtrInfo->ShapeInfo.Height);
+				GetPointerPosition(pPtrInfo, rotation, DesktopWidth, DesktopHeight, &PtrLeft, &PtrTop);
+				break;
+			}
+			case DXGI_OUTDUPL_POINTER_SHAPE_TYPE_MONOCHROME:
+			{
+				ProcessMonoMask(pBgTexture, rotation, true, pPtrInfo, &PtrWidth, &PtrHeight, &PtrLeft, &PtrTop, &InitBuffer);
+				break;
+			}
+			case DXGI_OUTDUPL_POINTER_SHAPE_TYPE_MASKED_COLOR:
+			{
+				ProcessMonoMask(pBgTexture, rotation, false, pPtrInfo, &PtrWidth, &PtrHeight, &PtrLeft, &PtrTop, &InitBuffer);
+				break;
+			}
+			default:
+				LOG_ERROR("Unrecognized mouse pointer type");
+				return E_FAIL;
 		}
-		default:
-			LOG_ERROR("Unrecognized mouse pointer type");
-			return E_FAIL;
-	}
 
-	if (PtrWidth <= 0 || PtrHeight <= 0 || unsigned(PtrWidth) > DesktopDesc.Width || unsigned(PtrHeight) > DesktopDesc.Height) {
-		return S_FALSE;
+		if (PtrWidth <= 0 || PtrHeight <= 0 || unsigned(PtrWidth) > DesktopDesc.Width || unsigned(PtrHeight) > DesktopDesc.Height) {
+			return S_FALSE;
+		}
+		bool isColor = pPtrInfo->ShapeInfo.Type == DXGI_OUTDUPL_POINTER_SHAPE_TYPE_COLOR;
+		SIZE size{ PtrWidth, PtrHeight };
+		// Scaled width and height
+		PtrWidth = static_cast<int>(round(PtrWidth * pPtrInfo->Scale.cx));
+		PtrHeight = static_cast<int>(round(PtrHeight * pPtrInfo->Scale.cy));
+		RETURN_ON_BAD_HR(hr = CreatePointerShaderResource(isColor ? pPtrInfo->PtrShapeBuffer : InitBuffer, isColor ? pPtrInfo->ShapeInfo.Pitch : size.cx * BPP, size, SIZE{ PtrWidth, PtrHeight }, &ShaderRes, nullptr));
 	}
 
-	// Set original texture properties
-	Desc.Width = PtrWidth;
-	Desc.Height = PtrHeight;
-
-	// Set up init data
-	InitData.pSysMem = (pPtrInfo->ShapeInfo.Type == DXGI_OUTDUPL_POINTER_SHAPE_TYPE_COLOR) ? pPtrInfo->PtrShapeBuffer : InitBuffer;
-	InitData.SysMemPitch = (pPtrInfo->ShapeInfo.Type == DXGI_OUTDUPL_POINTER_SHAPE_TYPE_COLOR) ? pPtrInfo->ShapeInfo.Pitch : PtrWidth * BPP;
-	InitData.SysMemSlicePitch = 0;
-
-	// Scaled width and height
-	PtrWidth = static_cast<int>(round(PtrWidth * pPtrInfo->Scale.cx));
-	PtrHeight = static_cast<int>(round(PtrHeight * pPtrInfo->Scale.cy));
-
 	// VERTEX creation
 	if (rotation == DXGI_MODE_ROTATION_UNSPECIFIED
 		|| rotation == DXGI_MODE_ROTATION_IDENTITY) {
@@ -471,55 +657,34 @@ HRESULT MouseManager::DrawMousePointer(_In_ PTR_INFO *pPtrInfo, _Inout_ ID3D11Te
 	Vertices[4].Pos.x = Vertices[1].Pos.x;
 	Vertices[4].Pos.y = Vertices[1].Pos.y;
 
-	// Create mouseshape as texture
-	HRESULT hr = m_Device->CreateTexture2D(&Desc, &InitData, &MouseTex);
-	if (FAILED(hr))
-	{
-		_com_error err(hr);
-		LOG_ERROR(L"Failed to create mouse pointer texture: %ls", err.ErrorMessage());
-		return hr;
-	}
-
-	if (pPtrInfo->Scale.cx != 1.0 || pPtrInfo->Scale.cy != 1.0) {
-		ID3D11Texture2D *pResizedTexture;
-		RETURN_ON_BAD_HR(hr = m_TextureManager->ResizeTexture(MouseTex, SIZE{ PtrWidth,PtrHeight }, TextureStretchMode::Uniform, &pResizedTexture));
-		SafeRelease(&MouseTex);
-		MouseTex = pResizedTexture;
+	if (!m_PointerVertexBuffer) {
+		D3D11_BUFFER_DESC BDesc;
+		ZeroMemory(&BDesc, sizeof(D3D11_BUFFER_DESC));
+		BDesc.Usage = D3D11_USAGE_DYNAMIC;
+		BDesc.ByteWidth = sizeof(VERTEX) * NUMVERTICES;
+		BDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+		BDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+
+		// Create vertex buffer
+		hr = m_Device->CreateBuffer(&BDesc, nullptr, &m_PointerVertexBuffer);
+		if (FAILED(hr))
+		{
+			_com_error err(hr);
+			LOG_ERROR(L"Failed to create mouse pointer vertex buffer: %ls", err.ErrorMessage());
+			return hr;
+		}
 	}
-	// Create shader resource from texture
-	hr = m_Device->CreateShaderResourceView(MouseTex, &SDesc, &ShaderRes);
+	D3D11_MAPPED_SUBRESOURCE MappedVertices;
+	hr = m_DeviceContext->Map(m_PointerVertexBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &MappedVertices);
 	if (FAILED(hr))
 	{
-		MouseTex->Release();
-		MouseTex = nullptr;
 		_com_error err(hr);
-		LOG_ERROR(L"Failed to create shader resource from mouse pointer texture: %ls", err.ErrorMessage());
+		LOG_ERROR(L"Failed to map mouse pointer vertex buffer: %ls", err.ErrorMessage());
 		return hr;
 	}
+	memcpy(MappedVertices.pData, Vertices, sizeof(Vertices));
+	m_DeviceContext->Unmap(m_PointerVertexBuffer, 0);
 
-	D3D11_BUFFER_DESC BDesc;
-	ZeroMemory(&BDesc, sizeof(D3D11_BUFFER_DESC));
-	BDesc.Usage = D3D11_USAGE_DEFAULT;
-	BDesc.ByteWidth = sizeof(VERTEX) * NUMVERTICES;
-	BDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-	BDesc.CPUAccessFlags = 0;
-
-	ZeroMemory(&InitData, sizeof(D3D11_SUBRESOURCE_DATA));
-	InitData.pSysMem = Vertices;
-
-	// Create vertex buffer
-	hr = m_Device->CreateBuffer(&BDesc, &InitData, &VertexBufferMouse);
-	if (FAILED(hr))
-	{
-		ShaderRes->Release();
-		ShaderRes = nullptr;
-		MouseTex->Release();
-		MouseTex = nullptr;
-
-		_com_error err(hr);
-		LOG_ERROR(L"Failed to create mouse pointer vertex buffer: %ls", err.ErrorMessage());
-		return hr;
-	}
 	ID3D11RenderTargetView *RTV;
 	// Create a render target view
 	hr = m_Device->CreateRenderTargetView(pBgTexture, nullptr, &RTV);
@@ -527,12 +692,12 @@ HRESULT MouseManager::DrawMousePointer(_In_ PTR_INFO *pPtrInfo, _Inout_ ID3D11Te
 	FLOAT BlendFactor[4] = { 0.f, 0.f, 0.f, 0.f };
 	UINT Stride = sizeof(VERTEX);
 	UINT Offset = 0;
-	m_DeviceContext->IASetVertexBuffers(0, 1, &VertexBufferMouse, &Stride, &Offset);
+	m_DeviceContext->IASetVertexBuffers(0, 1, &m_PointerVertexBuffer.p, &Stride, &Offset);
 	m_DeviceContext->OMSetBlendState(m_BlendState.p, BlendFactor, 0xFFFFFFFF);
 	m_DeviceContext->OMSetRenderTargets(1, &RTV, nullptr);
 	m_DeviceContext->VSSetShader(m_VertexShader, nullptr, 0);
 	m_DeviceContext->PSSetShader(m_PixelShader, nullptr, 0);
-	m_DeviceContext->PSSetShaderResources(0, 1, &ShaderRes);
+	m_DeviceContext->PSSetShaderResources(0, 1, &ShaderRes.p);
 	m_DeviceContext->PSSetSamplers(0, 1, &m_SamplerLinear.p);
 	m_DeviceContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 
@@ -543,6 +708,13 @@ HRESULT MouseManager::DrawMousePointer(_In_ PTR_INFO *pPtrInfo, _Inout_ ID3D11Te
 	SetViewPort(m_DeviceContext, static_cast<float>(DesktopDesc.Width), static_cast<float>(DesktopDesc.Height));
 	// Draw
 	m_DeviceContext->Draw(NUMVERTICES, 0);
+	if (cachedPointer.InvertShaderResource) {
+		// Invert the background under the inverting pixels
+		m_DeviceContext->OMSetBlendState(m_InvertBlendState.p, BlendFactor, 0xFFFFFFFF);
+		m_DeviceContext->PSSetShaderResources(0, 1, &cachedPointer.InvertShaderResource.p);
+		m_DeviceContext->Draw(NUMVERTICES, 0);
+		m_DeviceContext->OMSetBlendState(m_BlendState.p, BlendFactor, 0xFFFFFFFF);
+	}
 	// Restore view port
 	m_DeviceContext->RSSetViewports(1, &VP);
 	// Clean
@@ -554,22 +726,115 @@ HRESULT MouseManager::DrawMousePointer(_In_ PTR_INFO *pPtrInfo, _Inout_ ID3D11Te
 	ID3D11ShaderResourceView *null[] = { nullptr, nullptr };
 	m_DeviceContext->PSSetShaderResources(0, 1, null);
 
-	if (VertexBufferMouse)
-	{
-		VertexBufferMouse->Release();
-		VertexBufferMouse = nullptr;
+	return hr;
+}
+
+//
+// Gets the pointer drawn for the current shape from the cache, converting and uploading it if the shape is new.
+// Pixels inverting the background are uploaded as a separate mask, drawn with the inverting blend state.
+// Shapes XORing the background with other colors get an empty shader resource, and are drawn against the background every frame.
+//
+HRESULT MouseManager::GetCachedPointer(_In_ PTR_INFO *pPtrInfo, _Out_ CURSOR_TEXTURE *pCursor)
+{
+	*pCursor = CURSOR_TEXTURE{};
+	CURSOR_SHAPE_KEY key{};
+	key.Type = pPtrInfo->ShapeInfo.Type;
+	key.Width = pPtrInfo->ShapeInfo.Width;
+	key.Height = pPtrInfo->ShapeInfo.Height;
+	key.Pitch = pPtrInfo->ShapeInfo.Pitch;
+	key.ScaleX = pPtrInfo->Scale.cx;
+	key.ScaleY = pPtrInfo->Scale.cy;
+	UINT minPitch = key.Type == DXGI_OUTDUPL_POINTER_SHAPE_TYPE_MONOCHROME ? (key.Width + 7) / 8 : key.Width * BPP;
+	if (key.Width == 0 || key.Height == 0 || key.Pitch < minPitch || key.GetShapeSize() > pPtrInfo->BufferSize) {
+		return S_FALSE;
 	}
-	if (ShaderRes)
-	{
-		ShaderRes->Release();
-		ShaderRes = nullptr;
+	key.Hash = HashCursorShape(pPtrInfo->PtrShapeBuffer, key.GetShapeSize());
+	if (m_CursorShapeCache.Find(key, pPtrInfo->PtrShapeBuffer, pCursor)) {
+		return S_OK;
+	}
+	SIZE size{ static_cast<LONG>(key.Width), static_cast<LONG>(key.Type == DXGI_OUTDUPL_POINTER_SHAPE_TYPE_MONOCHROME ? key.Height / 2 : key.Height) };
+	const void *pPixels = pPtrInfo->PtrShapeBuffer;
+	UINT pitch = key.Pitch;
+	bool isInverting = false;
+	if (key.Type != DXGI_OUTDUPL_POINTER_SHAPE_TYPE_COLOR) {
+		m_CursorPixels.resize(static_cast<size_t>(size.cx) * size.cy);
+		m_CursorInvertMask.resize(m_CursorPixels.size());
+		if (!ConvertCursorShape(key, pPtrInfo->PtrShapeBuffer, m_CursorPixels.data(), m_InvertBlendState ? m_CursorInvertMask.data() : nullptr, &isInverting)) {
+			//Remember that the shape depends on the background, so it is not converted again every frame.
+			m_CursorShapeCache.Insert(key, pPtrInfo->PtrShapeBuffer, CURSOR_TEXTURE{});
+			return S_FALSE;
+		}
+		pPixels = m_CursorPixels.data();
+		pitch = size.cx * BPP;
+	}
+	CURSOR_TEXTURE cursor{};
+	cursor.Width = static_cast<INT>(round(size.cx * pPtrInfo->Scale.cx));
+	cursor.Height = static_cast<INT>(round(size.cy * pPtrInfo->Scale.cy));
+	if (cursor.Width <= 0 || cursor.Height <= 0) {
+		return S_FALSE;
 	}
-	if (MouseTex)
+	RETURN_ON_BAD_HR(CreatePointerShaderResource(pPixels, pitch, size, SIZE{ cursor.Width, cursor.Height }, &cursor.ShaderResource, &cursor.PinnedTexture));
+	if (isInverting) {
+		RETURN_ON_BAD_HR(CreatePointerShaderResource(m_CursorInvertMask.data(), size.cx * BPP, size, SIZE{ cursor.Width, cursor.Height }, &cursor.InvertShaderResource, &cursor.PinnedInvertTexture));
+	}
+	m_CursorShapeCache.Insert(key, pPtrInfo->PtrShapeBuffer, cursor);
+	*pCursor = cursor;
+	return S_OK;
+}
+
+HRESULT MouseManager::CreatePointerShaderResource(_In_ const void *pPixels, _In_ UINT pitch, _In_ SIZE size, _In_ SIZE scaledSize, _Outptr_ ID3D11ShaderResourceView **ppShaderResource, _Out_opt_ std::shared_ptr<ID3D11Texture2D> *pPinnedTexture)
+{
+	D3D11_TEXTURE2D_DESC Desc = { 0 };
+	Desc.Width = size.cx;
+	Desc.Height = size.cy;
+	Desc.MipLevels = 1;
+	Desc.ArraySize = 1;
+	Desc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+	Desc.SampleDesc.Count = 1;
+	Desc.SampleDesc.Quality = 0;
+	Desc.Usage = D3D11_USAGE_DEFAULT;
+	Desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+	Desc.CPUAccessFlags = 0;
+	Desc.MiscFlags = 0;
+
+	// Set up init data
+	D3D11_SUBRESOURCE_DATA InitData = { 0 };
+	InitData.pSysMem = pPixels;
+	InitData.SysMemPitch = pitch;
+	InitData.SysMemSlicePitch = 0;
+
+	// Create mouseshape as texture
+	CComPtr<ID3D11Texture2D> MouseTex;
+	HRESULT hr = m_Device->CreateTexture2D(&Desc, &InitData, &MouseTex);
+	if (FAILED(hr))
 	{
-		MouseTex->Release();
-		MouseTex = nullptr;
+		_com_error err(hr);
+		LOG_ERROR(L"Failed to create mouse pointer texture: %ls", err.ErrorMessage());
+		return hr;
 	}
 
+	if (scaledSize.cx != size.cx || scaledSize.cy != size.cy) {
+		CComPtr<ID3D11Texture2D> pResizedTexture;
+		RETURN_ON_BAD_HR(hr = m_TextureManager->ResizeTexture(MouseTex, scaledSize, TextureStretchMode::Uniform, &pResizedTexture));
+		MouseTex = pResizedTexture;
+		if (pPinnedTexture) {
+			*pPinnedTexture = m_TextureManager->PinTexture(MouseTex);
+		}
+	}
+	// Set shader resource properties
+	D3D11_SHADER_RESOURCE_VIEW_DESC SDesc;
+	SDesc.Format = Desc.Format;
+	SDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
+	SDesc.Texture2D.MostDetailedMip = Desc.MipLevels - 1;
+	SDesc.Texture2D.MipLevels = Desc.MipLevels;
+	// Create shader resource from texture
+	hr = m_Device->CreateShaderResourceView(MouseTex, &SDesc, ppShaderResource);
+	if (FAILED(hr))
+	{
+		_com_error err(hr);
+		LOG_ERROR(L"Failed to create shader resource from mouse pointer texture: %ls", err.ErrorMessage());
+		return hr;
+	}
 	return hr;
 }
 
@@ -749,76 +1014,26 @@ HRESULT MouseManager::ProcessMonoMask(
 		DesktopBuffer32 = reinterpret_cast<UINT *>(MappedSurface.pBits);
 	}
 
+	CURSOR_MASK_BLEND blend{};
+	blend.pShape = pPtrInfo->PtrShapeBuffer;
+	blend.ShapePitch = pPtrInfo->ShapeInfo.Pitch;
+	blend.XorMaskOffset = IsMono ? pPtrInfo->ShapeInfo.Pitch * (pPtrInfo->ShapeInfo.Height / 2) : 0;
+	blend.ShapeLeft = SkipX;
+	blend.ShapeTop = SkipY;
+	blend.pBackground = DesktopBuffer32;
+	//The rotated background is packed to the width of the pointer.
+	blend.BackgroundPitch = DesktopBuffer32 == reinterpret_cast<UINT *>(MappedSurface.pBits) ? DesktopPitchInPixels : *ptrWidth;
+	blend.pOutput = InitBuffer32;
+	blend.OutputPitch = *ptrWidth;
+	blend.Width = *ptrWidth;
+	blend.Height = *ptrHeight;
 	if (IsMono)
 	{
-		//https://docs.microsoft.com/en-us/windows-hardware/drivers/display/drawing-monochrome-pointers
-		for (INT Row = 0; Row < *ptrHeight; ++Row)
-		{
-			// Set mask
-			BYTE Mask = 0x80;
-			Mask = Mask >> (SkipX % 8);
-			for (INT Col = 0; Col < *ptrWidth; ++Col)
-			{
-				// Get masks using appropriate offsets
-				BYTE AndMask = pPtrInfo->PtrShapeBuffer[((Col + SkipX) / 8) + ((Row + SkipY) * (pPtrInfo->ShapeInfo.Pitch))] & Mask;
-				BYTE XorMask = pPtrInfo->PtrShapeBuffer[((Col + SkipX) / 8) + ((Row + SkipY + (pPtrInfo->ShapeInfo.Height / 2)) * (pPtrInfo->ShapeInfo.Pitch))] & Mask;
-				UINT AndMask32 = (AndMask) ? OPAQUE_WHITE : OPAQUE_BLACK;
-				UINT XorMask32 = (XorMask) ? TRANSPARENT_WHITE : TRANSPARENT_BLACK;
-
-				if (AndMask && !XorMask) {
-					// Instead of copying the desktop pixel for parts where the cursor is not visible, transparent white is used instead,
-					// to enable the pointer texture to be resized independently of the background and drawn on top of it.
-					InitBuffer32[(Row * *ptrWidth) + Col] = TRANSPARENT_WHITE;
-				}
-				else {
-					// Set new pixel with background from desktop
-					InitBuffer32[(Row * *ptrWidth) + Col] = (DesktopBuffer32[(Row * DesktopPitchInPixels) + Col] & AndMask32) ^ XorMask32;
-				}
-
-				// Adjust mask
-				if (Mask == 0x01)
-				{
-					Mask = 0x80;
-				}
-				else
-				{
-					Mask = Mask >> 1;
-				}
-			}
-		}
+		CursorMaskBlender::BlendMonochrome(blend);
 	}
 	else
 	{
-		//https://docs.microsoft.com/en-us/windows-hardware/drivers/display/drawing-color-pointers
-		UINT *Buffer32 = reinterpret_cast<UINT *>(pPtrInfo->PtrShapeBuffer);
-
-		// Iterate through pixels
-		for (INT Row = 0; Row < *ptrHeight; ++Row)
-		{
-			for (INT Col = 0; Col < *ptrWidth; ++Col)
-			{
-				UINT RgbValue = Buffer32[(Col + SkipX) + ((Row + SkipY) * (pPtrInfo->ShapeInfo.Pitch / sizeof(UINT)))];
-				// Set up mask
-				UINT MaskVal = OPAQUE_BLACK & RgbValue;
-				if (MaskVal)
-				{
-					// Mask was 0xFF
-					if (RgbValue == MaskVal) {
-						// Instead of copying the desktop pixel for parts where the cursor is not visible, we use transparent white,
-						// to enable the pointer texture to be resized independently of the background and drawn on top of it.
-						InitBuffer32[(Row * *ptrWidth) + Col] = TRANSPARENT_WHITE;
-					}
-					else {
-						InitBuffer32[(Row * *ptrWidth) + Col] = (DesktopBuffer32[(Row * DesktopPitchInPixels) + Col] ^ RgbValue) | OPAQUE_BLACK;
-					}
-				}
-				else
-				{
-					// Mask was 0x00
-					InitBuffer32[(Row * *ptrWidth) + Col] = RgbValue | OPAQUE_BLACK;
-				}
-			}
-		}
+		CursorMaskBlender::BlendMaskedColor(blend);
 	}
 
 	// Done with resource
@@ -936,133 +1151,138 @@ HRESULT MouseManager::GetMouse(_Inout_ PTR_INFO *pPtrInfo, _In_ bool getShapeBuf
 		return E_FAIL;
 	}
 
-	ICONINFO iconInfo = { 0 };
-	if (!cursorInfo.hCursor || !GetIconInfo(cursorInfo.hCursor, &iconInfo)) {
-		DWORD dwErr = GetLastError();
-		LOG_ERROR(L"GetIconInfo failed: last error = %u", dwErr);
-		return E_FAIL;
-	}
 	bool isVisible = cursorInfo.flags == CURSOR_SHOWING;
-	LONG width = 0;
-	LONG height = 0;
-	LONG widthBytes = 0;
-	LONG cursorType = 0;
-	DeleteGdiObjectOnExit deleteColor(iconInfo.hbmColor);
-	DeleteGdiObjectOnExit deleteMask(iconInfo.hbmMask);
-
-	if (iconInfo.hbmColor) {
-		BITMAP cursorBitmap;
-		GetObject(iconInfo.hbmColor, sizeof(cursorBitmap), &cursorBitmap);
-		cursorType = DXGI_OUTDUPL_POINTER_SHAPE_TYPE_COLOR;
-		width = cursorBitmap.bmWidth;
-		height = cursorBitmap.bmHeight;
-		widthBytes = cursorBitmap.bmWidthBytes;
-		int colorBits = cursorBitmap.bmBitsPixel;
-		if (getShapeBuffer) {
-			HDC dc = GetDC(NULL);
-			ReleaseDCOnExit ReleaseDC(dc);
-
-			BITMAPINFO bmInfo = { 0 };
-			bmInfo.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
-			bmInfo.bmiHeader.biBitCount = 0;    // don't get the color table  
-			int result = GetDIBits(dc, iconInfo.hbmColor, 0, 0, NULL, &bmInfo, DIB_RGB_COLORS);
-			if (result == 0) {
-				LOG_ERROR(L"GetIconInfo failed");
-				return E_FAIL;
-			}
-			else if (result == ERROR_INVALID_PARAMETER) {
-				LOG_ERROR(L"GetIconInfo failed due to invalid parameters");
-				return E_FAIL;
-			}
+	DXGI_OUTDUPL_POINTER_SHAPE_INFO shapeInfo = { 0 };
+	if (!getShapeBuffer && cursorInfo.hCursor && cursorInfo.hCursor == m_LastCursorHandle) {
+		//The shape of a cursor handle does not change, so the cursor bitmaps are only copied out with GetIconInfo when the cursor changes.
+		shapeInfo = m_LastCursorShapeInfo;
+	}
+	else {
+		ICONINFO iconInfo = { 0 };
+		if (!cursorInfo.hCursor || !GetIconInfo(cursorInfo.hCursor, &iconInfo)) {
+			DWORD dwErr = GetLastError();
+			LOG_ERROR(L"GetIconInfo failed: last error = %u", dwErr);
+			return E_FAIL;
+		}
+		LONG width = 0;
+		LONG height = 0;
+		LONG widthBytes = 0;
+		LONG cursorType = 0;
+		DeleteGdiObjectOnExit deleteColor(iconInfo.hbmColor);
+		DeleteGdiObjectOnExit deleteMask(iconInfo.hbmMask);
+
+		if (iconInfo.hbmColor) {
+			BITMAP cursorBitmap;
+			GetObject(iconInfo.hbmColor, sizeof(cursorBitmap), &cursorBitmap);
+			cursorType = DXGI_OUTDUPL_POINTER_SHAPE_TYPE_COLOR;
+			width = cursorBitmap.bmWidth;
+			height = cursorBitmap.bmHeight;
+			widthBytes = cursorBitmap.bmWidthBytes;
+			int colorBits = cursorBitmap.bmBitsPixel;
+			if (getShapeBuffer) {
+				HDC dc = GetDC(NULL);
+				ReleaseDCOnExit ReleaseDC(dc);
+
+				BITMAPINFO bmInfo = { 0 };
+				bmInfo.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+				bmInfo.bmiHeader.biBitCount = 0;    // don't get the color table  
+				int result = GetDIBits(dc, iconInfo.hbmColor, 0, 0, NULL, &bmInfo, DIB_RGB_COLORS);
+				if (result == 0) {
+					LOG_ERROR(L"GetIconInfo failed");
+					return E_FAIL;
+				}
+				else if (result == ERROR_INVALID_PARAMETER) {
+					LOG_ERROR(L"GetIconInfo failed due to invalid parameters");
+					return E_FAIL;
+				}
 
-			// Allocate size of bitmap info header plus space for color table:
-			int nBmInfoSize = sizeof(BITMAPINFOHEADER);
-			if (colorBits < 24)
-			{
-				nBmInfoSize += (int)sizeof(RGBQUAD) * (1 << colorBits);
-			}
+				// Allocate size of bitmap info header plus space for color table:
+				int nBmInfoSize = sizeof(BITMAPINFOHEADER);
+				if (colorBits < 24)
+				{
+					nBmInfoSize += (int)sizeof(RGBQUAD) * (1 << colorBits);
+				}
 
-			CAutoVectorPtr<UCHAR> bitmapInfo;
-			bitmapInfo.Allocate(nBmInfoSize);
-			BITMAPINFO *pBmInfo = (BITMAPINFO *)(UCHAR *)bitmapInfo;
-			memcpy(pBmInfo, &bmInfo, sizeof(BITMAPINFOHEADER));
-
-			// Get bitmap data:
-			RETURN_ON_BAD_HR(ResizeShapeBuffer(pPtrInfo, bmInfo.bmiHeader.biSizeImage));
-			pBmInfo->bmiHeader.biBitCount = colorBits;
-			pBmInfo->bmiHeader.biCompression = BI_RGB;
-			pBmInfo->bmiHeader.biHeight = -bmInfo.bmiHeader.biHeight;
-			result = GetDIBits(dc, iconInfo.hbmColor, 0, bmInfo.bmiHeader.biHeight, pPtrInfo->PtrShapeBuffer, pBmInfo, DIB_RGB_COLORS);
-			if (result == 0) {
-				LOG_ERROR(L"GetIconInfo failed");
-				return E_FAIL;
-			}
-			else if (result == ERROR_INVALID_PARAMETER) {
-				LOG_ERROR(L"GetIconInfo failed due to invalid parameters");
-				return E_FAIL;
+				CAutoVectorPtr<UCHAR> bitmapInfo;
+				bitmapInfo.Allocate(nBmInfoSize);
+				BITMAPINFO *pBmInfo = (BITMAPINFO *)(UCHAR *)bitmapInfo;
+				memcpy(pBmInfo, &bmInfo, sizeof(BITMAPINFOHEADER));
+
+				// Get bitmap data:
+				RETURN_ON_BAD_HR(ResizeShapeBuffer(pPtrInfo, bmInfo.bmiHeader.biSizeImage));
+				pBmInfo->bmiHeader.biBitCount = colorBits;
+				pBmInfo->bmiHeader.biCompression = BI_RGB;
+				pBmInfo->bmiHeader.biHeight = -bmInfo.bmiHeader.biHeight;
+				result = GetDIBits(dc, iconInfo.hbmColor, 0, bmInfo.bmiHeader.biHeight, pPtrInfo->PtrShapeBuffer, pBmInfo, DIB_RGB_COLORS);
+				if (result == 0) {
+					LOG_ERROR(L"GetIconInfo failed");
+					return E_FAIL;
+				}
+				else if (result == ERROR_INVALID_PARAMETER) {
+					LOG_ERROR(L"GetIconInfo failed due to invalid parameters");
+					return E_FAIL;
+				}
+				pPtrInfo->IsPointerShapeUpdated = true;
 			}
-			pPtrInfo->IsPointerShapeUpdated = true;
 		}
-	}
-	else {
-		BITMAP cursorBitmap;
-		GetObject(iconInfo.hbmMask, sizeof(cursorBitmap), &cursorBitmap);
-		cursorType = DXGI_OUTDUPL_POINTER_SHAPE_TYPE_MONOCHROME;
-		width = cursorBitmap.bmWidth;
-		height = cursorBitmap.bmHeight;
-		widthBytes = cursorBitmap.bmWidthBytes;
-		int colorBits = cursorBitmap.bmBitsPixel;
-		if (getShapeBuffer) {
-			HDC dc = GetDC(NULL);
-			ReleaseDCOnExit ReleaseDC(dc);
-
-			BITMAPINFO maskInfo = { 0 };
-			maskInfo.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
-			maskInfo.bmiHeader.biBitCount = 0;  // don't get the color table     
-			int result = GetDIBits(dc, iconInfo.hbmMask, 0, 0, NULL, &maskInfo, DIB_RGB_COLORS);
-			if (result == 0) {
-				LOG_ERROR(L"GetIconInfo failed");
-				return E_FAIL;
-			}
-			else if (result == ERROR_INVALID_PARAMETER) {
-				LOG_ERROR(L"GetIconInfo failed due to invalid parameters");
-				return E_FAIL;
-			}
+		else {
+			BITMAP cursorBitmap;
+			GetObject(iconInfo.hbmMask, sizeof(cursorBitmap), &cursorBitmap);
+			cursorType = DXGI_OUTDUPL_POINTER_SHAPE_TYPE_MONOCHROME;
+			width = cursorBitmap.bmWidth;
+			height = cursorBitmap.bmHeight;
+			widthBytes = cursorBitmap.bmWidthBytes;
+			int colorBits = cursorBitmap.bmBitsPixel;
+			if (getShapeBuffer) {
+				HDC dc = GetDC(NULL);
+				ReleaseDCOnExit ReleaseDC(dc);
+
+				BITMAPINFO maskInfo = { 0 };
+				maskInfo.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+				maskInfo.bmiHeader.biBitCount = 0;  // don't get the color table     
+				int result = GetDIBits(dc, iconInfo.hbmMask, 0, 0, NULL, &maskInfo, DIB_RGB_COLORS);
+				if (result == 0) {
+					LOG_ERROR(L"GetIconInfo failed");
+					return E_FAIL;
+				}
+				else if (result == ERROR_INVALID_PARAMETER) {
+					LOG_ERROR(L"GetIconInfo failed due to invalid parameters");
+					return E_FAIL;
+				}
 
-			RETURN_ON_BAD_HR(ResizeShapeBuffer(pPtrInfo, maskInfo.bmiHeader.biSizeImage));
-			CAutoVectorPtr<UCHAR> maskInfoBytes;
-			maskInfoBytes.Allocate(sizeof(BITMAPINFO) + 2 * sizeof(RGBQUAD));
-			BITMAPINFO *pMaskInfo = (BITMAPINFO *)(UCHAR *)maskInfoBytes;
-			memcpy(pMaskInfo, &maskInfo, sizeof(maskInfo));
-			pMaskInfo->bmiHeader.biBitCount = colorBits;
-			pMaskInfo->bmiHeader.biCompression = BI_RGB;
-			pMaskInfo->bmiHeader.biHeight = -maskInfo.bmiHeader.biHeight;
-			result = GetDIBits(dc, iconInfo.hbmMask, 0, maskInfo.bmiHeader.biHeight, pPtrInfo->PtrShapeBuffer, pMaskInfo, DIB_RGB_COLORS);
-			if (result == 0) {
-				LOG_ERROR(L"GetIconInfo failed");
-				return E_FAIL;
-			}
-			else if (result == ERROR_INVALID_PARAMETER) {
-				LOG_ERROR(L"GetIconInfo failed due to invalid parameters");
-				return E_FAIL;
+				RETURN_ON_BAD_HR(ResizeShapeBuffer(pPtrInfo, maskInfo.bmiHeader.biSizeImage));
+				CAutoVectorPtr<UCHAR> maskInfoBytes;
+				maskInfoBytes.Allocate(sizeof(BITMAPINFO) + 2 * sizeof(RGBQUAD));
+				BITMAPINFO *pMaskInfo = (BITMAPINFO *)(UCHAR *)maskInfoBytes;
+				memcpy(pMaskInfo, &maskInfo, sizeof(maskInfo));
+				pMaskInfo->bmiHeader.biBitCount = colorBits;
+				pMaskInfo->bmiHeader.biCompression = BI_RGB;
+				pMaskInfo->bmiHeader.biHeight = -maskInfo.bmiHeader.biHeight;
+				result = GetDIBits(dc, iconInfo.hbmMask, 0, maskInfo.bmiHeader.biHeight, pPtrInfo->PtrShapeBuffer, pMaskInfo, DIB_RGB_COLORS);
+				if (result == 0) {
+					LOG_ERROR(L"GetIconInfo failed");
+					return E_FAIL;
+				}
+				else if (result == ERROR_INVALID_PARAMETER) {
+					LOG_ERROR(L"GetIconInfo failed due to invalid parameters");
+					return E_FAIL;
+				}
+				pPtrInfo->IsPointerShapeUpdated = true;
 			}
-			pPtrInfo->IsPointerShapeUpdated = true;
 		}
+
+		shapeInfo.HotSpot.x = iconInfo.xHotspot;
+		shapeInfo.HotSpot.y = iconInfo.yHotspot;
+		shapeInfo.Width = width;
+		shapeInfo.Height = height;
+		shapeInfo.Type = cursorType;
+		shapeInfo.Pitch = widthBytes;
+		m_LastCursorHandle = cursorInfo.hCursor;
+		m_LastCursorShapeInfo = shapeInfo;
 	}
 
-	DXGI_OUTDUPL_POINTER_SHAPE_INFO shapeInfo = { 0 };
-	POINT hotSpot = { 0 };
-	hotSpot.x = iconInfo.xHotspot;
-	hotSpot.y = iconInfo.yHotspot;
-
-	shapeInfo.HotSpot = hotSpot;
-	shapeInfo.Width = width;
-	shapeInfo.Height = height;
-	shapeInfo.Type = cursorType;
-	shapeInfo.Pitch = widthBytes;
-
-	cursorInfo.ptScreenPos.x = cursorInfo.ptScreenPos.x + offsetX - hotSpot.x;
-	cursorInfo.ptScreenPos.y = cursorInfo.ptScreenPos.y + offsetY - hotSpot.y;
+	cursorInfo.ptScreenPos.x = cursorInfo.ptScreenPos.x + offsetX - shapeInfo.HotSpot.x;
+	cursorInfo.ptScreenPos.y = cursorInfo.ptScreenPos.y + offsetY - shapeInfo.HotSpot.y;
 	pPtrInfo->Position = cursorInfo.ptScreenPos;
 	pPtrInfo->ShapeInfo = shapeInfo;
 	pPtrInfo->Visible = isVisible;
@@ -1076,6 +1296,8 @@ void MouseManager::CleanDX()
 		m_SamplerLinear.Release();
 	if (m_BlendState)
 		m_BlendState.Release();
+	if (m_InvertBlendState)
+		m_InvertBlendState.Release();
 	if (m_InputLayout)
 		m_InputLayout.Release();
 	if (m_VertexShader)
@@ -1084,4 +1306,13 @@ void MouseManager::CleanDX()
 		m_PixelShader.Release();
 	if (m_D2DFactory)
 		m_D2DFactory.Release();
+	if (m_PointerVertexBuffer)
+		m_PointerVertexBuffer.Release();
+	//The cached pointers belong to the device.
+	m_CursorShapeCache.Clear();
+}
+
+CURSOR_SHAPE_CACHE_STATS MouseManager::GetCursorShapeCacheStats()
+{
+	return m_CursorShapeCache.GetStats();
 }
@@ -5,8 +5,25 @@
 #include <memory>
 #include "CommonTypes.h"
 #include "TextureManager.h"
-#include <thread>
-LRESULT CALLBACK MouseHookProc(int nCode, WPARAM wParam, LPARAM lParam);
+#include "CursorShapeCache.h"
+#include "MouseClickTimeline.h"
+#include <functional>
+
+/// <summary>
+/// A pointer shape converted and uploaded for drawing, cached per shape by MouseManager.
+/// </summary>
+struct CURSOR_TEXTURE {
+	//Empty for shapes that need the background to be converted, which are drawn against it every frame.
+	ATL::CComPtr<ID3D11ShaderResourceView> ShaderResource;
+	//The pixels inverting the background, drawn with the inverting blend state after the pointer. Empty if the pointer inverts no pixels.
+	ATL::CComPtr<ID3D11ShaderResourceView> InvertShaderResource;
+	//Keeps scaled pointer textures taken from the texture cache of the TextureManager from being reused for something else.
+	std::shared_ptr<ID3D11Texture2D> PinnedTexture;
+	std::shared_ptr<ID3D11Texture2D> PinnedInvertTexture;
+	//The size the pointer is drawn at, after scaling.
+	INT Width = 0;
+	INT Height = 0;
+};
 
 class MouseManager
 {
@@ -17,27 +34,62 @@ public:
 	HRESULT Initialize(_In_ ID3D11DeviceContext *pDeviceContext, _In_ ID3D11Device *pDevice, _In_ std::shared_ptr<MOUSE_OPTIONS> &pOptions);
 	void InitializeMouseClickDetection();
 	void StopMouseClickDetection();
+	/// <summary>
+	/// Sets the clock mouse clicks are timestamped with, so they are drawn in the frames shown at the time they were made.
+	/// Without one, clicks are timestamped with the steady clock of the system.
+	/// </summary>
+	/// <param name="getTime">Gets the current time of the media clock, in 100 nanosecond units. Called from the thread detecting mouse clicks.</param>
+	void SetMediaClock(_In_ std::function<HRESULT(INT64 *)> getTime);
+	/// <summary>
+	/// Draws the mouse pointer, and the mouse clicks made since the last call. Leaves the clicks in the timeline for the frames drawn with timing.
+	/// </summary>
 	HRESULT ProcessMousePointer(_In_ ID3D11Texture2D *pFrame, _In_ PTR_INFO *pPtrInfo);
+	/// <summary>
+	/// Draws the mouse pointer, and the mouse clicks made while the frame was shown. Frames must be drawn in the order they are shown.
+	/// </summary>
+	/// <param name="frameStartPos">The time of the media clock the frame is shown from, in 100 nanosecond units</param>
+	/// <param name="frameEndPos">The time of the media clock the frame was taken at, in 100 nanosecond units</param>
+	HRESULT ProcessMousePointer(_In_ ID3D11Texture2D *pFrame, _In_ PTR_INFO *pPtrInfo, _In_ INT64 frameStartPos, _In_ INT64 frameEndPos);
+	/// <summary>
+	/// Gets the area of the frame ProcessMousePointer draws to for the given pointer, including the mouse click if one is drawn in the frame.
+	/// </summary>
+	/// <returns>The area drawn to, or an empty rect if nothing is drawn</returns>
+	RECT GetPointerBounds(_In_ const PTR_INFO *pPtrInfo, _In_ INT64 frameStartPos, _In_ INT64 frameEndPos);
+	/// <summary>
+	/// Returns true if ProcessMousePointer draws a mouse click in the frame shown between the given times of the media clock.
+	/// </summary>
+	bool IsDrawingMouseClick(_In_ INT64 frameStartPos, _In_ INT64 frameEndPos);
 	HRESULT GetMouse(_Inout_ PTR_INFO *pPtrInfo, _In_ bool getShapeBuffer, _In_ DXGI_OUTDUPL_FRAME_INFO *pFrameInfo, _In_ RECT screenRect, _In_ IDXGIOutputDuplication *pDeskDupl, _In_ int offsetX, _In_ int offsetY);
 	HRESULT GetMouse(_Inout_ PTR_INFO *pPtrInfo, _In_ bool getShapeBuffer, _In_ int offsetX, _In_ int offsetY);
 	void CleanDX();
+	CURSOR_SHAPE_CACHE_STATS GetCursorShapeCacheStats();
+	MOUSE_CLICK_TIMELINE_STATS GetMouseClickStats();
 protected:
 	HRESULT DrawMousePointer(_In_ PTR_INFO *pPtrInfo, _Inout_ ID3D11Texture2D *pBbgTexture, DXGI_MODE_ROTATION rotation);
 	HRESULT DrawMouseClick(_In_ PTR_INFO *pPtrInfo, _In_ ID3D11Texture2D *pBgTexture, std::string colorStr, float radius, DXGI_MODE_ROTATION rotation);
 private:
-	static const UINT TRANSPARENT_WHITE = 0x00FFFFFF;
-	static const UINT TRANSPARENT_BLACK = 0x00000000;
-	static const UINT OPAQUE_WHITE = 0xFFFFFFFF;
-	static const UINT OPAQUE_BLACK = 0xFF000000;
 	static const int NUMVERTICES = 6;
 	static const int BPP = 4;
+	//The most pointer shapes kept converted and uploaded. Applications rarely use more than a handful of pointers, but animated pointers
+	//have a shape per frame, e.g. the 18 of the busy pointer, and cycling through more shapes than the cache holds would miss on every frame.
+	static const int CURSOR_SHAPE_CACHE_CAPACITY = 32;
 
 	ATL::CComPtr<ID3D11SamplerState> m_SamplerLinear;
 	ATL::CComPtr<ID3D11BlendState> m_BlendState;
+	//Inverts the background where the source is white, and leaves it unchanged where the source is black.
+	ATL::CComPtr<ID3D11BlendState> m_InvertBlendState;
 	ATL::CComPtr<ID3D11VertexShader> m_VertexShader;
 	ATL::CComPtr<ID3D11PixelShader> m_PixelShader;
 	ATL::CComPtr<ID3D11InputLayout> m_InputLayout;
 	ATL::CComPtr<ID2D1Factory> m_D2DFactory;
+	//Dynamic, so the pointer quad is updated every frame instead of creating a buffer for it.
+	ATL::CComPtr<ID3D11Buffer> m_PointerVertexBuffer;
+	CursorShapeCache<CURSOR_TEXTURE> m_CursorShapeCache;
+	std::vector<UINT> m_CursorPixels;
+	std::vector<UINT> m_CursorInvertMask;
+	//The pointer last read with GetCursorInfo, whose shape info is reused while it is showing.
+	HCURSOR m_LastCursorHandle;
+	DXGI_OUTDUPL_POINTER_SHAPE_INFO m_LastCursorShapeInfo;
 
 	std::unique_ptr<TextureManager> m_TextureManager;
 	std::shared_ptr<MOUSE_OPTIONS> m_MouseOptions;
@@ -46,15 +98,33 @@ private:
 
 	CRITICAL_SECTION m_CriticalSection;
 	bool m_IsCapturingMouseClicks;
-	std::chrono::steady_clock::time_point m_LastMouseDrawTimeStamp;
-	HANDLE m_MouseHookThread;
-	DWORD m_MouseHookThreadId;
+	//Receives the mouse clicks from the thread detecting them. Read and written under m_CriticalSection, except for posting clicks.
+	MouseClickTimeline m_MouseClicks;
+	std::function<HRESULT(INT64 *)> m_GetMediaTime;
+	//The end of the last frame drawn without a frame time, which the clicks of the next such frame are drawn from.
+	INT64 m_LastMouseClickFrameEndPos;
+	//Blocks waiting for mouse input, so it only wakes up when the mouse is used.
+	HANDLE m_MouseClickThread;
+	DWORD m_MouseClickThreadId;
+	HANDLE m_MouseClickThreadStartedEvent;
+	UINT32 m_MouseClickThreadMode;
 	std::vector<BYTE> _InitBuffer;
 	std::vector<BYTE> _DesktopBuffer;
-	HANDLE m_StopPollingTaskEvent;
-	std::thread m_MousePollingThread;
+	static DWORD WINAPI MouseClickThreadProc(_In_ void *pParam);
+	static LRESULT CALLBACK MouseHookProc(int nCode, WPARAM wParam, LPARAM lParam);
+	/// <summary>
+	/// Returns true if the process has registered for raw mouse input, to the given window if one is given.
+	/// </summary>
+	static bool IsRawMouseInputRegistered(_In_opt_ HWND hwndTarget);
+	void OnRawMouseInput(_In_ HRAWINPUT rawInput);
+	void OnMouseButton(_In_ UINT8 button, _In_ bool isPressed);
+	HRESULT GetMouseClickTime(_Out_ INT64 *pTime);
+	UINT8 GetMouseClickButton(_In_ INT64 frameStartPos, _In_ INT64 frameEndPos);
+	HRESULT DrawMousePointerAndClick(_In_ ID3D11Texture2D *pFrame, _In_ PTR_INFO *pPtrInfo, _In_ INT64 frameStartPos, _In_ INT64 frameEndPos);
 	long ParseColorString(std::string color);
 	void GetPointerPosition(_In_ PTR_INFO *pPtrInfo, DXGI_MODE_ROTATION rotation, int desktopWidth, int desktopHeight, _Out_ INT *PtrLeft, _Out_ INT *PtrTop);
+	HRESULT GetCachedPointer(_In_ PTR_INFO *pPtrInfo, _Out_ CURSOR_TEXTURE *pCursor);
+	HRESULT CreatePointerShaderResource(_In_ const void *pPixels, _In_ UINT pitch, _In_ SIZE size, _In_ SIZE scaledSize, _Outptr_ ID3D11ShaderResourceView **ppShaderResource, _Out_opt_ std::shared_ptr<ID3D11Texture2D> *pPinnedTexture);
 	HRESULT ProcessMonoMask(_In_ ID3D11Texture2D *pBgTexture, _In_ DXGI_MODE_ROTATION rotation, _In_ bool IsMono, _Inout_ PTR_INFO *PtrInfo, _Out_ INT *PtrWidth, _Out_ INT *PtrHeight, _Out_ INT *PtrLeft, _Out_ INT *PtrTop, _Outptr_result_bytebuffer_(*PtrHeight **PtrWidth *BPP) BYTE **pInitBuffer);
 
 	HRESULT InitMouseClickTexture(_In_ ID3D11DeviceContext *pDeviceContext, _In_ ID3D11Device *pDevice);
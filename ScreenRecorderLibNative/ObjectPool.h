@@ -0,0 +1,173 @@
+#pragma once
+#include "AllocationTracker.h"
+#include "ResourcePool.h"
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+template <typename T>
+class ObjectPool;
+
+/// <summary>
+/// Smart pointer owning an object acquired from an ObjectPool. The object goes back to its pool when the PooledObject is reset or destroyed.
+/// Copies are deep: a copy gets an object of its own from the same pool, assigned from the original, so the storage pooled objects kept from earlier use,
+/// e.g. the capacity of their containers, is reused instead of allocated.
+/// </summary>
+template <typename T>
+class PooledObject
+{
+public:
+	PooledObject() : m_pObject(nullptr) {}
+	PooledObject(const PooledObject &other) :
+		m_pObject(nullptr)
+	{
+		if (other.m_pObject) {
+			*this = other.m_Pool->Acquire();
+			*m_pObject = *other.m_pObject;
+		}
+	}
+	PooledObject(PooledObject &&other) noexcept :
+		m_Pool(std::move(other.m_Pool)),
+		m_pObject(other.m_pObject)
+	{
+		other.m_pObject = nullptr;
+	}
+	~PooledObject()
+	{
+		Reset();
+	}
+	PooledObject &operator=(const PooledObject &other)
+	{
+		PooledObject(other).Swap(*this);
+		return *this;
+	}
+	PooledObject &operator=(PooledObject &&other) noexcept
+	{
+		PooledObject(std::move(other)).Swap(*this);
+		return *this;
+	}
+
+	void Reset()
+	{
+		if (m_pObject) {
+			T *pObject = m_pObject;
+			std::shared_ptr<ObjectPool<T>> pool = std::move(m_Pool);
+			m_pObject = nullptr;
+			pool->Recycle(pObject);
+		}
+	}
+	void Swap(PooledObject &other) noexcept
+	{
+		std::swap(m_Pool, other.m_Pool);
+		std::swap(m_pObject, other.m_pObject);
+	}
+
+	inline T *Get() const { return m_pObject; }
+	inline T *operator->() const { return m_pObject; }
+	inline T &operator*() const { return *m_pObject; }
+	inline explicit operator bool() const { return m_pObject != nullptr; }
+
+private:
+	friend class ObjectPool<T>;
+	PooledObject(std::shared_ptr<ObjectPool<T>> pool, T *pObject) :
+		m_Pool(std::move(pool)),
+		m_pObject(pObject)
+	{
+	}
+
+	//Set while an object is held, so the pool outlives every object acquired from it.
+	std::shared_ptr<ObjectPool<T>> m_Pool;
+	T *m_pObject;
+};
+
+/// <summary>
+/// A thread safe pool of reusable objects, e.g. the frames passed between the stages of the recorder loop, created up front so acquiring them does not allocate.
+/// Returned objects are cleared by the reset function, which should release what they reference but keep their storage.
+/// Like ResourcePool, at most Depth idle objects are kept, and objects are created on demand when every pooled one is in use.
+/// </summary>
+template <typename T>
+class ObjectPool : public std::enable_shared_from_this<ObjectPool<T>>
+{
+public:
+	/// <param name="depth">The number of objects created up front, and the most idle objects kept for reuse</param>
+	/// <param name="reset">Clears an object returned to the pool. If nullptr, objects are pooled as they are returned.</param>
+	/// <param name="pTracker">Optional tracker counting the objects created, to catch a pool too small for its use</param>
+	static std::shared_ptr<ObjectPool> Create(size_t depth, std::function<void(T &)> reset = nullptr, AllocationTracker *pTracker = nullptr)
+	{
+		std::shared_ptr<ObjectPool> pool(new ObjectPool(depth, reset, pTracker));
+		std::vector<T *> objects;
+		for (size_t i = 0; i < depth; i++) {
+			T *pObject = nullptr;
+			if (pool->m_Pool.Acquire(OBJECT_POOL_KEY{}, &pObject)) {
+				objects.push_back(pObject);
+			}
+		}
+		for (T *pObject : objects) {
+			pool->m_Pool.Release(OBJECT_POOL_KEY{}, pObject);
+		}
+		return pool;
+	}
+	ObjectPool(const ObjectPool &) = delete;
+	ObjectPool &operator=(const ObjectPool &) = delete;
+
+	/// <summary>
+	/// Gets an idle object, or creates a new one if every pooled object is in use.
+	/// </summary>
+	PooledObject<T> Acquire()
+	{
+		T *pObject = nullptr;
+		if (!m_Pool.Acquire(OBJECT_POOL_KEY{}, &pObject)) {
+			return PooledObject<T>();
+		}
+		return PooledObject<T>(this->shared_from_this(), pObject);
+	}
+
+	RESOURCE_POOL_STATS GetStats() { return m_Pool.GetStats(); }
+
+private:
+	friend class PooledObject<T>;
+
+	//All objects of a pool are interchangeable, so they share a single description.
+	struct OBJECT_POOL_KEY {
+		bool operator==(const OBJECT_POOL_KEY &) const { return true; }
+	};
+
+	class ObjectAllocator : public IResourceAllocator<OBJECT_POOL_KEY, T *>
+	{
+	public:
+		ObjectAllocator(AllocationTracker *pTracker) :
+			m_pTracker(pTracker)
+		{
+		}
+		bool Allocate(const OBJECT_POOL_KEY &, T **ppObject) override {
+			*ppObject = new T();
+			if (m_pTracker) {
+				m_pTracker->OnAllocation(sizeof(T));
+			}
+			return true;
+		}
+		void Free(T *pObject) override {
+			delete pObject;
+		}
+		AllocationTracker *m_pTracker;
+	};
+
+	ObjectPool(size_t depth, std::function<void(T &)> reset, AllocationTracker *pTracker) :
+		m_Reset(reset),
+		m_Pool(std::make_unique<ObjectAllocator>(pTracker), depth)
+	{
+	}
+
+	void Recycle(T *pObject)
+	{
+		if (m_Reset) {
+			m_Reset(*pObject);
+		}
+		m_Pool.Release(OBJECT_POOL_KEY{}, pObject);
+	}
+
+	std::function<void(T &)> m_Reset;
+	ResourcePool<OBJECT_POOL_KEY, T *> m_Pool;
+};
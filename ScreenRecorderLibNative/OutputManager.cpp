@@ -3,9 +3,13 @@
 #include <ppltasks.h> 
 #include <concrt.h>
 #include <filesystem>
+#include <strmif.h>
 using namespace std;
 using namespace concurrency;
 
+//Attribute of a video sample written again for unchanged frames at a fixed framerate, holding the sample whose buffers it shares.
+static const GUID OUTPUT_MANAGER_REPEATED_SAMPLE = { 0x9663623f, 0x5356, 0x4401, { 0x8c, 0xd6, 0x35, 0xe4, 0xa4, 0x2f, 0x15, 0xb4 } };
+
 OutputManager::OutputManager() :
 	m_Device(nullptr),
 	m_DeviceContext(nullptr),
@@ -19,6 +23,7 @@ OutputManager::OutputManager() :
 	m_AudioOptions(nullptr),
 	m_SnapshotOptions(nullptr),
 	m_OutputOptions(nullptr),
+	m_Metrics(nullptr),
 	m_VideoStreamIndex(0),
 	m_AudioStreamIndex(0),
 	m_OutputFolder(L""),
@@ -28,7 +33,12 @@ OutputManager::OutputManager() :
 	m_MediaTransform(nullptr),
 	m_DeviceManager(nullptr),
 	m_ResetToken(0),
-	m_UseManualNV12Converter(false)
+	m_UseManualNV12Converter(false),
+	m_SilenceBufferPool(MediaBufferPool::Create(std::make_unique<MFMemoryBufferAllocator>(), 2)),
+	m_VideoSamples{},
+	m_PendingVideoStreamIndex(0),
+	m_SegmentScheduler(nullptr),
+	m_VideoOutputFrameSize{}
 {
 	m_FinalizeEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
 	InitializeCriticalSection(&m_CriticalSection);
@@ -36,6 +46,10 @@ OutputManager::OutputManager() :
 
 OutputManager::~OutputManager()
 {
+	for each (FINALIZING_SEGMENT segment in m_FinalizingSegments)
+	{
+		CloseHandle(segment.FinalizeEvent);
+	}
 	CloseHandle(m_FinalizeEvent);
 	m_FinalizeEvent = nullptr;
 	DeleteCriticalSection(&m_CriticalSection);
@@ -47,21 +61,32 @@ HRESULT OutputManager::Initialize(
 	_In_ std::shared_ptr<ENCODER_OPTIONS> &pEncoderOptions,
 	_In_ std::shared_ptr<AUDIO_OPTIONS> pAudioOptions,
 	_In_ std::shared_ptr<SNAPSHOT_OPTIONS> pSnapshotOptions,
-	_In_ std::shared_ptr<OUTPUT_OPTIONS> pOutputOptions)
+	_In_ std::shared_ptr<OUTPUT_OPTIONS> pOutputOptions,
+	_In_opt_ std::shared_ptr<RecordingMetrics> pMetrics)
 {
 	EnterCriticalSection(&m_CriticalSection);
 	LeaveCriticalSectionOnExit leaveOnExit(&m_CriticalSection);
 
+	if (!m_FramePool || m_Device != pDevice) {
+		m_FramePool = std::make_shared<TexturePool>(std::make_unique<D3D11TextureAllocator>(pDevice), pEncoderOptions->GetFramePoolSize());
+	}
+	else {
+		m_FramePool->SetDepth(pEncoderOptions->GetFramePoolSize());
+	}
 	m_DeviceContext = pDeviceContext;
 	m_Device = pDevice;
 	m_EncoderOptions = pEncoderOptions;
+	m_VideoSamples.SetFixedFramerate(pEncoderOptions->GetIsFixedFramerate());
 	m_AudioOptions = pAudioOptions;
 	m_SnapshotOptions = pSnapshotOptions;
 	m_OutputOptions = pOutputOptions;
+	m_Metrics = pMetrics;
 	if (!m_DeviceManager) {
 		RETURN_ON_BAD_HR(MFCreateDXGIDeviceManager(&m_ResetToken, &m_DeviceManager));
 	}
 	if (m_SinkWriter) {
+		//The kept samples belong to the previous device, and are discarded along with the samples queued in the sink writer.
+		m_VideoSamples.Clear();
 		m_SinkWriter->Flush(m_VideoStreamIndex);
 	}
 	if (m_MediaTransform) {
@@ -91,22 +116,18 @@ HRESULT OutputManager::BeginRecording(_In_ std::wstring outputPath, _In_ SIZE vi
 	ResetEvent(m_FinalizeEvent);
 
 	if (GetOutputOptions()->GetRecorderMode() == RecorderModeInternal::Video) {
-		if (m_FinalizeEvent) {
-			m_CallBack.Attach(new (std::nothrow)CMFSinkWriterCallback(m_FinalizeEvent, nullptr));
+		m_VideoOutputFrameSize = videoOutputFrameSize;
+		m_SegmentScheduler.reset();
+		CreateReplayBuffer();
+		if (GetOutputOptions()->IsSegmentingEnabled()) {
+			if (m_ReplayBuffer) {
+				LOG_WARN(L"Segmenting is not supported with the replay buffer, and is ignored");
+			}
+			else {
+				m_SegmentScheduler = std::make_unique<SegmentScheduler>(MillisToHundredNanos(GetOutputOptions()->GetSegmentDuration().count()), GetOutputOptions()->GetSegmentMaxBytes());
+			}
 		}
-		CComPtr<IStream> pStream = nullptr;
-		HRESULT hr = SHCreateStreamOnFileEx(
-			outputPath.c_str(),
-			STGM_READWRITE | STGM_SHARE_EXCLUSIVE,
-			FILE_ATTRIBUTE_NORMAL,
-			TRUE,
-			nullptr,
-			&pStream
-		);
-		RECT inputMediaFrameRect = RECT{ 0,0,videoOutputFrameSize.cx,videoOutputFrameSize.cy };
-		CComPtr<IMFByteStream> mfByteStream = nullptr;
-		RETURN_ON_BAD_HR(hr = MFCreateMFByteStreamOnStream(pStream, &mfByteStream));
-		RETURN_ON_BAD_HR(hr = InitializeVideoSinkWriter(mfByteStream, inputMediaFrameRect, videoOutputFrameSize, DXGI_MODE_ROTATION_UNSPECIFIED, m_CallBack, &m_SinkWriter, &m_VideoStreamIndex, &m_AudioStreamIndex));
+		RETURN_ON_BAD_HR(hr = InitializeVideoSinkWriterForFile(outputPath, videoOutputFrameSize));
 	}
 	StartMediaClock();
 	LOG_DEBUG("Sink Writer initialized");
@@ -122,15 +143,15 @@ HRESULT OutputManager::BeginRecording(_In_ IStream *pStream, _In_ SIZE videoOutp
 	}
 	m_OutStream = pStream;
 	ResetEvent(m_FinalizeEvent);
+	m_SegmentScheduler.reset();
+	if (GetOutputOptions()->IsSegmentingEnabled()) {
+		LOG_WARN(L"Segmenting is not supported when recording to a stream, and is ignored");
+	}
 	if (GetOutputOptions()->GetRecorderMode() == RecorderModeInternal::Video) {
+		CreateReplayBuffer();
 		CComPtr<IMFByteStream> mfByteStream = nullptr;
 		RETURN_ON_BAD_HR(hr = MFCreateMFByteStreamOnStream(pStream, &mfByteStream));
-
-		if (m_FinalizeEvent) {
-			m_CallBack.Attach(new (std::nothrow)CMFSinkWriterCallback(m_FinalizeEvent, nullptr));
-		}
-		RECT inputMediaFrameRect = RECT{ 0,0,videoOutputFrameSize.cx,videoOutputFrameSize.cy };
-		RETURN_ON_BAD_HR(hr = InitializeVideoSinkWriter(mfByteStream, inputMediaFrameRect, videoOutputFrameSize, DXGI_MODE_ROTATION_UNSPECIFIED, m_CallBack, &m_SinkWriter, &m_VideoStreamIndex, &m_AudioStreamIndex));
+		RETURN_ON_BAD_HR(hr = InitializeVideoSinkWriterForStream(mfByteStream, videoOutputFrameSize));
 	}
 	StartMediaClock();
 	LOG_DEBUG("Sink Writer initialized");
@@ -142,8 +163,13 @@ HRESULT OutputManager::FinalizeRecording()
 	LOG_INFO("Cleaning up resources");
 	LOG_INFO("Finalizing recording");
 	HRESULT finalizeResult = S_OK;
+	//Segments rolled over before the last one are finished first, so their callbacks come in order.
+	CompleteFinalizedSegments(true);
 	if (m_SinkWriter) {
-
+		if (FAILED(FlushPendingVideoSample())) {
+			LOG_ERROR("Failed to write last video sample");
+		}
+		m_VideoSamples.Clear();
 		finalizeResult = m_SinkWriter->Finalize();
 		if (SUCCEEDED(finalizeResult) && m_FinalizeEvent) {
 			WaitForSingleObject(m_FinalizeEvent, INFINITE);
@@ -151,25 +177,40 @@ HRESULT OutputManager::FinalizeRecording()
 		if (FAILED(finalizeResult)) {
 			LOG_ERROR("Failed to finalize sink writer");
 		}
-		//Dispose of MPEG4MediaSink 
-		IMFMediaSink *pSink;
-		if (SUCCEEDED(m_SinkWriter->GetServiceForStream(MF_SINK_WRITER_MEDIASINK, GUID_NULL, IID_PPV_ARGS(&pSink)))) {
-			//Release the sink writer before calling Shutdown on the media sink. 
-			//https://learn.microsoft.com/en-us/windows/win32/api/mfreadwrite/nf-mfreadwrite-mfcreatesinkwriterfrommediasink
-			m_SinkWriter.Release();
-			finalizeResult = pSink->Shutdown();
-			SafeRelease(&pSink);
-			if (FAILED(finalizeResult)) {
-				LOG_ERROR("Failed to shut down IMFMediaSink");
-			}
-			else {
-				LOG_DEBUG("Shut down IMFMediaSink");
+		HRESULT shutdownResult = ShutdownMediaSink(m_SinkWriter);
+		if (SUCCEEDED(finalizeResult) && FAILED(shutdownResult)) {
+			finalizeResult = shutdownResult;
+		}
+		if (m_ReplayPassthrough) {
+			//The replay sink is shut down, so it has passed every encoded sample on, and the output can be finalized.
+			CComPtr<IMFSinkWriter> pOutputWriter = m_ReplayPassthrough->DetachWriter();
+			if (pOutputWriter) {
+				HRESULT outputResult = pOutputWriter->Finalize();
+				if (FAILED(outputResult)) {
+					LOG_ERROR("Failed to finalize output sink writer");
+				}
+				HRESULT outputShutdownResult = ShutdownMediaSink(pOutputWriter);
+				if (SUCCEEDED(outputResult)) {
+					outputResult = outputShutdownResult;
+				}
+				if (SUCCEEDED(finalizeResult)) {
+					finalizeResult = outputResult;
+				}
 			}
-		};
-		if (!m_OutputFullPath.empty()) {
+		}
+		if (m_ReplayBuffer) {
+			REPLAY_BUFFER_STATS stats = m_ReplayBuffer->GetStats();
+			LOG_DEBUG(L"Replay buffer: %llu samples buffered, %llu evicted, %llu bytes at most", stats.Inserted, stats.Evicted, stats.PeakBytes);
+		}
+		std::wstring lastOutputPath = m_OutputFullPath;
+		SEGMENT_INFO lastSegment{};
+		if (m_SegmentScheduler && m_SegmentScheduler->GetCurrentSegment(&lastSegment)) {
+			lastOutputPath = SegmentScheduler::GetSegmentPath(m_OutputFullPath, lastSegment.Index);
+		}
+		if (!lastOutputPath.empty()) {
 			bool isFileAvailable = false;
 			for (int i = 0; i < 10; i++) {
-				isFileAvailable = IsFileAvailableForReading(m_OutputFullPath);
+				isFileAvailable = IsFileAvailableForReading(lastOutputPath);
 				if (isFileAvailable) {
 					LOG_TRACE(L"Output file is ready");
 					break;
@@ -183,19 +224,45 @@ HRESULT OutputManager::FinalizeRecording()
 				LOG_WARN("Output file is still locked after maximum retries");
 			}
 		}
+		if (m_SegmentScheduler && SUCCEEDED(finalizeResult) && m_SegmentScheduler->GetCurrentSegment(&lastSegment) && m_OnSegmentComplete) {
+			m_OnSegmentComplete(lastOutputPath, lastSegment);
+		}
+	}
+	m_SegmentScheduler.reset();
+	m_ReplayBuffer.reset();
+	m_ReplayPassthrough.reset();
+	m_ReplayMediaSink.Release();
+	if (m_FramePool) {
+		RESOURCE_POOL_STATS stats = m_FramePool->GetStats();
+		LOG_DEBUG(L"Encoder frame pool: %llu hits, %llu misses, %llu discarded, %zu in use", stats.Hits, stats.Misses, stats.Discarded, stats.InUse);
+		m_FramePool->Trim();
 	}
 	StopMediaClock();
 	return finalizeResult;
 }
 
-HRESULT OutputManager::RenderFrame(_In_ FrameWriteModel &model) {
+HRESULT OutputManager::RenderFrame(_In_ FrameWriteModel &&model) {
 	HRESULT hr(S_OK);
 	EnterCriticalSection(&m_CriticalSection);
 	LeaveCriticalSectionOnExit leaveOnExit(&m_CriticalSection);
-	MeasureExecutionTime measure(L"RenderFrame");
+	MeasureRecordingTimer measureEncodeSubmit(m_Metrics.get(), RecordingTimer::EncodeSubmit);
 	auto recorderMode = GetOutputOptions()->GetRecorderMode();
 	if (recorderMode == RecorderModeInternal::Video) {
-		hr = WriteFrameToVideo(model.StartPos, model.Duration, m_VideoStreamIndex, model.Frame);
+		if (m_SegmentScheduler) {
+			CompleteFinalizedSegments(false);
+			SEGMENT_INFO endedSegment{};
+			if (m_SegmentScheduler->PlaceFrame(model.StartPos, model.Duration, model.Frame != nullptr, GetSegmentBytes(), &endedSegment)) {
+				RETURN_ON_BAD_HR(hr = StartNextSegment(endedSegment));
+			}
+			//The video and the audio of the frame go to the same segment, with timestamps relative to its start.
+			model.StartPos = m_SegmentScheduler->ToSegmentTime(model.StartPos);
+		}
+		if (model.Frame) {
+			hr = WriteFrameToVideo(model.StartPos, model.Duration, m_VideoStreamIndex, model.Frame);
+		}
+		else {
+			hr = ExtendPendingVideoSample(model.StartPos, model.Duration);
+		}
 		bool wroteAudioSample = false;
 		if (FAILED(hr)) {
 			_com_error err(hr);
@@ -208,12 +275,20 @@ HRESULT OutputManager::RenderFrame(_In_ FrameWriteModel &model) {
 		 * If we don't, the sink writer will begin throttling video frames because it expects audio samples to be delivered, and think they are delayed.
 		 * We ignore every instance where the last frame had audio, due to sometimes very short frame durations due to mouse cursor changes have zero audio length,
 		 * and inserting silence between two frames that has audio leads to glitching. */
-		if (GetAudioOptions()->IsAudioEnabled() && model.Audio.size() == 0 && model.Duration > 0) {
+		if (GetAudioOptions()->IsAudioEnabled() && model.Audio.Length() == 0 && model.Duration > 0) {
+			if (m_Metrics) {
+				m_Metrics->Increment(RecordingCounter::AudioUnderruns);
+			}
 			if (!m_LastFrameHadAudio) {
 				int frameCount = int(ceil(GetAudioOptions()->GetAudioSamplesPerSecond() * HundredNanosToMillis(model.Duration) / 1000));
 				int byteCount = frameCount * (GetAudioOptions()->GetAudioBitsPerSample() / 8) * GetAudioOptions()->GetAudioChannels();
-				model.Audio.insert(model.Audio.end(), byteCount, 0);
-				paddedAudio = true;
+				MediaBufferRef silence = m_SilenceBufferPool->Acquire(byteCount);
+				if (silence) {
+					memset(silence->Data(), 0, byteCount);
+					silence->SetLength(byteCount);
+					model.Audio = std::move(silence);
+					paddedAudio = true;
+				}
 			}
 			m_LastFrameHadAudio = false;
 		}
@@ -221,8 +296,8 @@ HRESULT OutputManager::RenderFrame(_In_ FrameWriteModel &model) {
 			m_LastFrameHadAudio = true;
 		}
 
-		if (model.Audio.size() > 0) {
-			hr = WriteAudioSamplesToVideo(model.StartPos, model.Duration, m_AudioStreamIndex, &(model.Audio)[0], (DWORD)model.Audio.size());
+		if (model.Audio.Length() > 0) {
+			hr = WriteAudioSamplesToVideo(model.StartPos, model.Duration, m_AudioStreamIndex, model.Audio);
 			if (FAILED(hr)) {
 				_com_error err(hr);
 				LOG_ERROR(L"Writing of audio sample with start pos %lld ms failed: %s", (HundredNanosToMillis(model.StartPos)), err.ErrorMessage());
@@ -232,7 +307,9 @@ HRESULT OutputManager::RenderFrame(_In_ FrameWriteModel &model) {
 				wroteAudioSample = true;
 			}
 		}
-		auto frameInfoStr = wroteAudioSample ? (paddedAudio ? L"video sample and audio padding" : L"video and audio sample") : L"video sample";
+		auto frameInfoStr = model.Frame ?
+			(wroteAudioSample ? (paddedAudio ? L"video sample and audio padding" : L"video and audio sample") : L"video sample")
+			: (wroteAudioSample ? (paddedAudio ? L"video sample extension and audio padding" : L"video sample extension and audio sample") : L"video sample extension");
 		LOG_TRACE(L"Wrote %s with duration %.2f ms", frameInfoStr, HundredNanosToMillisDouble(model.Duration));
 	}
 	else if (recorderMode == RecorderModeInternal::Slideshow) {
@@ -261,8 +338,13 @@ HRESULT OutputManager::RenderFrame(_In_ FrameWriteModel &model) {
 			LOG_TRACE(L"Wrote snapshot to %s", m_OutputFullPath.c_str());
 		}
 	}
+	bool isExtendedFrame = recorderMode == RecorderModeInternal::Video && !model.Frame;
 	model.Frame.Release();
+	model.Audio.Reset();
 	m_RenderedFrameCount++;
+	if (m_Metrics && SUCCEEDED(hr)) {
+		m_Metrics->Increment(isExtendedFrame ? RecordingCounter::ExtendedFrames : RecordingCounter::RenderedFrames);
+	}
 	return hr;
 }
 
@@ -465,12 +547,17 @@ HRESULT OutputManager::InitializeVideoSinkWriter(
 	}
 
 	//Creates a streaming writer
-	CComPtr<IMFMediaSink> pMp4StreamSink = nullptr;
-	if (GetEncoderOptions()->GetIsFragmentedMp4Enabled()) {
-		RETURN_ON_BAD_HR(MFCreateFMPEG4MediaSink(pOutStream, pVideoMediaTypeOut, pAudioMediaTypeOut, &pMp4StreamSink));
+	CComPtr<IMFMediaSink> pMediaSink = nullptr;
+	if (m_ReplayBuffer) {
+		//The encoded samples are kept in the replay buffer, and passed on to a writer muxing them to the output once their types are negotiated.
+		RETURN_ON_BAD_HR(CReplayMediaSink::CreateInstance(pVideoMediaTypeOut, pAudioMediaTypeOut, m_ReplayBuffer, m_ReplayPassthrough, &pMediaSink));
+		m_ReplayMediaSink = pMediaSink;
+	}
+	else if (GetEncoderOptions()->GetIsFragmentedMp4Enabled()) {
+		RETURN_ON_BAD_HR(MFCreateFMPEG4MediaSink(pOutStream, pVideoMediaTypeOut, pAudioMediaTypeOut, &pMediaSink));
 	}
 	else {
-		RETURN_ON_BAD_HR(MFCreateMPEG4MediaSink(pOutStream, pVideoMediaTypeOut, pAudioMediaTypeOut, &pMp4StreamSink));
+		RETURN_ON_BAD_HR(MFCreateMPEG4MediaSink(pOutStream, pVideoMediaTypeOut, pAudioMediaTypeOut, &pMediaSink));
 	}
 	pAudioMediaTypeOut.Release();
 
@@ -492,8 +579,8 @@ HRESULT OutputManager::InitializeVideoSinkWriter(
 	RETURN_ON_BAD_HR(pAttributes->SetUnknown(MF_SINK_WRITER_D3D_MANAGER, m_DeviceManager));
 	RETURN_ON_BAD_HR(pAttributes->SetUnknown(MF_SINK_WRITER_ASYNC_CALLBACK, pCallback));
 
-	RETURN_ON_BAD_HR(MFCreateSinkWriterFromMediaSink(pMp4StreamSink, pAttributes, &pSinkWriter));
-	pMp4StreamSink.Release();
+	RETURN_ON_BAD_HR(MFCreateSinkWriterFromMediaSink(pMediaSink, pAttributes, &pSinkWriter));
+	pMediaSink.Release();
 
 	LOG_TRACE("Input video format:")
 		LogMediaType(pVideoMediaTypeIn);
@@ -513,9 +600,26 @@ HRESULT OutputManager::InitializeVideoSinkWriter(
 	if (pAudioMediaTypeIn) {
 		RETURN_ON_BAD_HR(pSinkWriter->SetInputMediaType(audioStreamIndex, pAudioMediaTypeIn, nullptr));
 	}
+	if (m_ReplayBuffer) {
+		//The replay buffer is trimmed a group of pictures at a time, so a keyframe every second of frames keeps it close to its duration.
+		CComPtr<ICodecAPI> pCodecApi = nullptr;
+		if (SUCCEEDED(pSinkWriter->GetServiceForStream(videoStreamIndex, GUID_NULL, IID_PPV_ARGS(&pCodecApi)))) {
+			VARIANT gopSize{};
+			gopSize.vt = VT_UI4;
+			gopSize.ulVal = GetEncoderOptions()->GetVideoFps();
+			LOG_ON_BAD_HR(pCodecApi->SetValue(&CODECAPI_AVEncMPVGOPSize, &gopSize));
+		}
+	}
 
 	// Tell the sink writer to start accepting data.
 	RETURN_ON_BAD_HR(pSinkWriter->BeginWriting());
+	if (m_ReplayBuffer) {
+		//The replay sink now holds the types negotiated with the encoders, so a writer muxing the samples as they are can be created for the output.
+		//No sample is encoded before the first frame is written, so the output gets every sample.
+		CComPtr<IMFSinkWriter> pOutputWriter = nullptr;
+		RETURN_ON_BAD_HR(CreatePassthroughSinkWriter(m_ReplayMediaSink, pOutStream, GetEncoderOptions()->GetIsFragmentedMp4Enabled(), &pOutputWriter));
+		m_ReplayPassthrough->SetWriter(pOutputWriter);
+	}
 
 	// Return the pointer to the caller.
 	*ppWriter = pSinkWriter;
@@ -528,15 +632,39 @@ HRESULT OutputManager::InitializeVideoSinkWriter(
 HRESULT OutputManager::WriteFrameToVideo(_In_ INT64 frameStartPos, _In_ INT64 frameDuration, _In_ DWORD streamIndex, _In_ ID3D11Texture2D *pAcquiredDesktopImage)
 {
 	//The encoder works async, so the input frame has to be copied, else it can be overwritten before the encoder uses it. See issue #277.
-	CComPtr<ID3D11Texture2D> pFrameCopy;
+	//The copies come from a pool, and are returned to it by the tracked sample callback once the encoder has released the sample.
 	D3D11_TEXTURE2D_DESC desc;
 	pAcquiredDesktopImage->GetDesc(&desc);
-	m_Device->CreateTexture2D(&desc, nullptr, &pFrameCopy);
+	std::shared_ptr<TexturePool> pFramePool = m_FramePool;
+	std::shared_ptr<RecordingMetrics> pMetrics = m_Metrics;
+	ID3D11Texture2D *pFrameCopy = nullptr;
+	if (!pFramePool->Acquire(desc, &pFrameCopy)) {
+		return E_OUTOFMEMORY;
+	}
+	CComPtr<IMFTrackedSample> pTrackedSample;
+	HRESULT hr = MFCreateTrackedSample(&pTrackedSample);
+	if (SUCCEEDED(hr))
+	{
+		CComPtr<IMFAsyncCallback> pSampleCallback;
+		auto submitted = std::chrono::steady_clock::now();
+		pSampleCallback.Attach(new (std::nothrow)CMFTrackedSampleCallback([pFramePool, pMetrics, desc, pFrameCopy, submitted]() {
+			pFramePool->Release(desc, pFrameCopy);
+			if (pMetrics) {
+				pMetrics->Record(RecordingTimer::EncodeCallback, std::chrono::duration_cast<std::chrono::duration<INT64, std::ratio<1, 10000000>>>(std::chrono::steady_clock::now() - submitted).count());
+			}
+		}));
+		hr = pSampleCallback ? pTrackedSample->SetAllocator(pSampleCallback, nullptr) : E_OUTOFMEMORY;
+	}
+	if (FAILED(hr)) {
+		LOG_ERROR(L"Failed to create tracked sample: hr = 0x%08x", hr);
+		pFramePool->Release(desc, pFrameCopy);
+		return hr;
+	}
 	m_DeviceContext->CopyResource(pFrameCopy, pAcquiredDesktopImage);
 
-	IMFMediaBuffer *pMediaBuffer;
-	HRESULT hr = MFCreateDXGISurfaceBuffer(__uuidof(ID3D11Texture2D), pFrameCopy, 0, FALSE, &pMediaBuffer);
-	IMF2DBuffer *p2DBuffer;
+	IMFMediaBuffer *pMediaBuffer = nullptr;
+	hr = MFCreateDXGISurfaceBuffer(__uuidof(ID3D11Texture2D), pFrameCopy, 0, FALSE, &pMediaBuffer);
+	IMF2DBuffer *p2DBuffer = nullptr;
 	if (SUCCEEDED(hr))
 	{
 		hr = pMediaBuffer->QueryInterface(__uuidof(IMF2DBuffer), reinterpret_cast<void **>(&p2DBuffer));
@@ -550,11 +678,10 @@ HRESULT OutputManager::WriteFrameToVideo(_In_ INT64 frameStartPos, _In_ INT64 fr
 	{
 		hr = pMediaBuffer->SetCurrentLength(length);
 	}
-	IMFSample *pSample;
-	if (SUCCEEDED(hr))
-	{
-		hr = MFCreateSample(&pSample);
-	}
+	//From here on the pooled texture is returned when the last reference to the sample is released.
+	IMFSample *pSample = nullptr;
+	hr = SUCCEEDED(hr) ? pTrackedSample->QueryInterface(IID_PPV_ARGS(&pSample)) : hr;
+	pTrackedSample.Release();
 	if (SUCCEEDED(hr))
 	{
 		hr = pSample->AddBuffer(pMediaBuffer);
@@ -621,12 +748,12 @@ HRESULT OutputManager::WriteFrameToVideo(_In_ INT64 frameStartPos, _In_ INT64 fr
 			}
 			if (SUCCEEDED(hr))
 			{
-				hr = m_SinkWriter->WriteSample(streamIndex, transformSample);
+				hr = QueueVideoSample(streamIndex, transformSample);
 			}
 			SafeRelease(&transformSample);
 		}
 		else {
-			hr = m_SinkWriter->WriteSample(streamIndex, pSample);
+			hr = QueueVideoSample(streamIndex, pSample);
 		}
 	}
 	SafeRelease(&pSample);
@@ -635,50 +762,319 @@ HRESULT OutputManager::WriteFrameToVideo(_In_ INT64 frameStartPos, _In_ INT64 fr
 	return hr;
 }
 
-HRESULT OutputManager::WriteAudioSamplesToVideo(_In_ INT64 frameStartPos, _In_ INT64 frameDuration, _In_ DWORD streamIndex, _In_ BYTE *pSrc, _In_ DWORD cbData)
+HRESULT OutputManager::QueueVideoSample(_In_ DWORD streamIndex, _In_ IMFSample *pSample)
 {
-	IMFMediaBuffer *pBuffer = nullptr;
-	BYTE *pData = nullptr;
-	// Create the media buffer.
-	HRESULT hr = MFCreateMemoryBuffer(
-		cbData,   // Amount of memory to allocate, in bytes.
-		&pBuffer
+	//Fixed framerate recordings write the sample right away, else the sample held back before it is written, and this one is held back in its place.
+	DWORD writeStreamIndex = GetEncoderOptions()->GetIsFixedFramerate() ? streamIndex : m_PendingVideoStreamIndex;
+	m_PendingVideoStreamIndex = streamIndex;
+	CComPtr<IMFSample> pWriteSample = m_VideoSamples.Push(pSample);
+	if (!pWriteSample) {
+		return S_FALSE;
+	}
+	return m_SinkWriter->WriteSample(writeStreamIndex, pWriteSample);
+}
+
+HRESULT OutputManager::ExtendPendingVideoSample(_In_ INT64 frameStartPos, _In_ INT64 frameDuration)
+{
+	if (CComPtr<IMFSample> pPendingSample = m_VideoSamples.GetPending()) {
+		INT64 duration = 0;
+		RETURN_ON_BAD_HR(pPendingSample->GetSampleDuration(&duration));
+		return pPendingSample->SetSampleDuration(duration + frameDuration);
+	}
+	if (CComPtr<IMFSample> pLastSample = m_VideoSamples.GetLastWritten()) {
+		return WriteRepeatedVideoSample(frameStartPos, frameDuration, m_PendingVideoStreamIndex, pLastSample);
+	}
+	return S_FALSE;
+}
+
+HRESULT OutputManager::WriteRepeatedVideoSample(_In_ INT64 frameStartPos, _In_ INT64 frameDuration, _In_ DWORD streamIndex, _In_ IMFSample *pSample)
+{
+	//The new sample shares the buffers of the written one, so the frame is not copied again.
+	CComPtr<IMFSample> pRepeatedSample;
+	RETURN_ON_BAD_HR(MFCreateSample(&pRepeatedSample));
+	DWORD bufferCount = 0;
+	RETURN_ON_BAD_HR(pSample->GetBufferCount(&bufferCount));
+	for (DWORD i = 0; i < bufferCount; i++) {
+		CComPtr<IMFMediaBuffer> pBuffer;
+		RETURN_ON_BAD_HR(pSample->GetBufferByIndex(i, &pBuffer));
+		RETURN_ON_BAD_HR(pRepeatedSample->AddBuffer(pBuffer));
+	}
+	//The written sample may be a tracked sample, which returns its texture to the frame pool once released. The new sample references it,
+	//so the texture is not reused while the encoder still reads it.
+	RETURN_ON_BAD_HR(pRepeatedSample->SetUnknown(OUTPUT_MANAGER_REPEATED_SAMPLE, pSample));
+	RETURN_ON_BAD_HR(pRepeatedSample->SetSampleTime(frameStartPos));
+	RETURN_ON_BAD_HR(pRepeatedSample->SetSampleDuration(frameDuration));
+	return m_SinkWriter->WriteSample(streamIndex, pRepeatedSample);
+}
+
+HRESULT OutputManager::InitializeVideoSinkWriterForFile(_In_ std::wstring outputPath, _In_ SIZE videoOutputFrameSize)
+{
+	CComPtr<IStream> pStream = nullptr;
+	HRESULT hr = SHCreateStreamOnFileEx(
+		outputPath.c_str(),
+		STGM_READWRITE | STGM_SHARE_EXCLUSIVE,
+		FILE_ATTRIBUTE_NORMAL,
+		TRUE,
+		nullptr,
+		&pStream
 	);
-	//once in awhile, things get behind and we get an out of memory error when trying to create the buffer
-	//so, just check, wait and try again if necessary
-	int counter = 0;
-	while (!SUCCEEDED(hr) && counter++ < 100) {
-		Sleep(10);
-		hr = MFCreateMemoryBuffer(cbData, &pBuffer);
-	}
-	// Lock the buffer to get a pointer to the memory.
-	if (SUCCEEDED(hr))
-	{
-		hr = pBuffer->Lock(&pData, nullptr, nullptr);
+	CComPtr<IMFByteStream> mfByteStream = nullptr;
+	RETURN_ON_BAD_HR(hr = MFCreateMFByteStreamOnStream(pStream, &mfByteStream));
+	return InitializeVideoSinkWriterForStream(mfByteStream, videoOutputFrameSize);
+}
+
+HRESULT OutputManager::InitializeVideoSinkWriterForStream(_In_ IMFByteStream *pOutStream, _In_ SIZE videoOutputFrameSize)
+{
+	if (m_FinalizeEvent) {
+		m_CallBack.Attach(new (std::nothrow)CMFSinkWriterCallback(m_FinalizeEvent, nullptr));
 	}
+	RECT inputMediaFrameRect = RECT{ 0,0,videoOutputFrameSize.cx,videoOutputFrameSize.cy };
+	return InitializeVideoSinkWriter(pOutStream, inputMediaFrameRect, videoOutputFrameSize, DXGI_MODE_ROTATION_UNSPECIFIED, m_CallBack, &m_SinkWriter, &m_VideoStreamIndex, &m_AudioStreamIndex);
+}
 
-	if (SUCCEEDED(hr))
-	{
-		memcpy_s(pData, cbData, pSrc, cbData);
+void OutputManager::CreateReplayBuffer()
+{
+	m_ReplayBuffer.reset();
+	m_ReplayPassthrough.reset();
+	m_ReplayMediaSink.Release();
+	if (GetOutputOptions()->IsReplayBufferEnabled()) {
+		//The replay is aligned to the keyframes of the video, which is the first stream of the sink.
+		m_ReplayBuffer = std::make_shared<ReplaySampleBuffer>(0, MillisToHundredNanos(GetOutputOptions()->GetReplayBufferDuration().count()), GetOutputOptions()->GetReplayBufferMaxBytes());
+		m_ReplayPassthrough = std::make_shared<ReplayPassthrough>();
 	}
+}
 
-	// Update the current length.
-	if (SUCCEEDED(hr))
-	{
-		hr = pBuffer->SetCurrentLength(cbData);
+HRESULT OutputManager::SaveReplay(_In_ std::wstring path)
+{
+	std::error_code ec;
+	if (!m_OutputFullPath.empty() && std::filesystem::equivalent(path, m_OutputFullPath, ec)) {
+		LOG_ERROR(L"Failed to save replay: %ls is the output of the recording", path.c_str());
+		return E_INVALIDARG;
+	}
+	CComPtr<IStream> pStream = nullptr;
+	HRESULT hr = SHCreateStreamOnFileEx(
+		path.c_str(),
+		STGM_READWRITE | STGM_SHARE_EXCLUSIVE | STGM_CREATE,
+		FILE_ATTRIBUTE_NORMAL,
+		TRUE,
+		nullptr,
+		&pStream
+	);
+	RETURN_ON_BAD_HR(hr);
+	CComPtr<IMFByteStream> mfByteStream = nullptr;
+	RETURN_ON_BAD_HR(hr = MFCreateMFByteStreamOnStream(pStream, &mfByteStream));
+	RETURN_ON_BAD_HR(hr = WriteReplay(mfByteStream));
+	LOG_INFO(L"Saved replay to %ls", path.c_str());
+	return hr;
+}
+
+HRESULT OutputManager::SaveReplay(_In_ IStream *pStream)
+{
+	CComPtr<IMFByteStream> mfByteStream = nullptr;
+	RETURN_ON_BAD_HR(MFCreateMFByteStreamOnStream(pStream, &mfByteStream));
+	return WriteReplay(mfByteStream);
+}
+
+HRESULT OutputManager::GetReplayStreamMediaType(_In_ IMFMediaSink *pReplaySink, _In_ DWORD streamId, _Outptr_ IMFMediaType **ppMediaType)
+{
+	*ppMediaType = nullptr;
+	CComPtr<IMFStreamSink> pStreamSink;
+	RETURN_ON_BAD_HR(pReplaySink->GetStreamSinkById(streamId, &pStreamSink));
+	CComPtr<IMFMediaTypeHandler> pTypeHandler;
+	RETURN_ON_BAD_HR(pStreamSink->GetMediaTypeHandler(&pTypeHandler));
+	return pTypeHandler->GetCurrentMediaType(ppMediaType);
+}
+
+HRESULT OutputManager::CreatePassthroughSinkWriter(_In_ IMFMediaSink *pReplaySink, _In_ IMFByteStream *pOutStream, _In_ bool isFragmented, _Outptr_ IMFSinkWriter **ppWriter)
+{
+	*ppWriter = nullptr;
+	//The stream sinks hold the media types the sink writer negotiated with the encoders, so the samples are muxed in the format they were encoded in.
+	CComPtr<IMFMediaType> pVideoMediaType;
+	CComPtr<IMFMediaType> pAudioMediaType;
+	RETURN_ON_BAD_HR(GetReplayStreamMediaType(pReplaySink, m_VideoStreamIndex, &pVideoMediaType));
+	if (GetAudioOptions()->IsAudioEnabled()) {
+		RETURN_ON_BAD_HR(GetReplayStreamMediaType(pReplaySink, m_AudioStreamIndex, &pAudioMediaType));
+	}
+	CComPtr<IMFMediaSink> pMp4StreamSink = nullptr;
+	if (isFragmented) {
+		RETURN_ON_BAD_HR(MFCreateFMPEG4MediaSink(pOutStream, pVideoMediaType, pAudioMediaType, &pMp4StreamSink));
+	}
+	else {
+		RETURN_ON_BAD_HR(MFCreateMPEG4MediaSink(pOutStream, pVideoMediaType, pAudioMediaType, &pMp4StreamSink));
+	}
+	CComPtr<IMFAttributes> pAttributes = nullptr;
+	RETURN_ON_BAD_HR(MFCreateAttributes(&pAttributes, 2));
+	RETURN_ON_BAD_HR(pAttributes->SetUINT32(MF_MPEG4SINK_MOOV_BEFORE_MDAT, GetEncoderOptions()->GetIsFastStartEnabled()));
+	RETURN_ON_BAD_HR(pAttributes->SetUINT32(MF_SINK_WRITER_DISABLE_THROTTLING, TRUE));
+	CComPtr<IMFSinkWriter> pSinkWriter = nullptr;
+	RETURN_ON_BAD_HR(MFCreateSinkWriterFromMediaSink(pMp4StreamSink, pAttributes, &pSinkWriter));
+	pMp4StreamSink.Release();
+	//The samples are already encoded, so the input types match the output types and they are written as they are.
+	RETURN_ON_BAD_HR(pSinkWriter->SetInputMediaType(m_VideoStreamIndex, pVideoMediaType, nullptr));
+	if (pAudioMediaType) {
+		RETURN_ON_BAD_HR(pSinkWriter->SetInputMediaType(m_AudioStreamIndex, pAudioMediaType, nullptr));
 	}
+	RETURN_ON_BAD_HR(pSinkWriter->BeginWriting());
+	*ppWriter = pSinkWriter.Detach();
+	return S_OK;
+}
 
-	// Unlock the buffer.
-	if (pData)
+HRESULT OutputManager::WriteReplay(_In_ IMFByteStream *pOutStream)
+{
+	std::shared_ptr<ReplaySampleBuffer> pBuffer;
+	CComPtr<IMFMediaSink> pReplaySink;
 	{
-		hr = pBuffer->Unlock();
+		EnterCriticalSection(&m_CriticalSection);
+		LeaveCriticalSectionOnExit leaveOnExit(&m_CriticalSection);
+		pBuffer = m_ReplayBuffer;
+		pReplaySink = m_ReplayMediaSink;
+	}
+	if (!pBuffer || !pReplaySink) {
+		LOG_ERROR(L"Failed to save replay: the replay buffer is not enabled");
+		return E_NOT_VALID_STATE;
+	}
+	std::vector<REPLAY_SAMPLE<CComPtr<IMFSample>>> samples;
+	INT64 startPos = 0;
+	if (!pBuffer->GetWindow(&samples, &startPos)) {
+		LOG_ERROR(L"Failed to save replay: no video has been encoded yet");
+		return HRESULT_FROM_WIN32(ERROR_NO_DATA);
 	}
+	CComPtr<IMFSinkWriter> pSinkWriter = nullptr;
+	RETURN_ON_BAD_HR(CreatePassthroughSinkWriter(pReplaySink, pOutStream, false, &pSinkWriter));
+	for each (const REPLAY_SAMPLE<CComPtr<IMFSample>> &sample in samples)
+	{
+		if (sample.StreamIndex == m_AudioStreamIndex && !GetAudioOptions()->IsAudioEnabled()) {
+			continue;
+		}
+		//The buffered samples may be saved again, so they are written through a copy starting the replay at 0, sharing their media buffers.
+		CComPtr<IMFSample> pReplaySample = nullptr;
+		RETURN_ON_BAD_HR(MFCreateSample(&pReplaySample));
+		RETURN_ON_BAD_HR(sample.Payload->CopyAllItems(pReplaySample));
+		DWORD bufferCount = 0;
+		RETURN_ON_BAD_HR(sample.Payload->GetBufferCount(&bufferCount));
+		for (DWORD i = 0; i < bufferCount; i++) {
+			CComPtr<IMFMediaBuffer> pMediaBuffer = nullptr;
+			RETURN_ON_BAD_HR(sample.Payload->GetBufferByIndex(i, &pMediaBuffer));
+			RETURN_ON_BAD_HR(pReplaySample->AddBuffer(pMediaBuffer));
+		}
+		RETURN_ON_BAD_HR(pReplaySample->SetSampleTime(sample.Time - startPos));
+		RETURN_ON_BAD_HR(pReplaySample->SetSampleDuration(sample.Duration));
+		RETURN_ON_BAD_HR(pSinkWriter->WriteSample(sample.StreamIndex, pReplaySample));
+	}
+	//Without an async callback, Finalize returns once the file is written.
+	RETURN_ON_BAD_HR(pSinkWriter->Finalize());
+	HRESULT hr = ShutdownMediaSink(pSinkWriter);
+	if (SUCCEEDED(hr)) {
+		LOG_DEBUG(L"Wrote replay of %lld ms with %zu samples", HundredNanosToMillis(samples.back().Time + samples.back().Duration - startPos), samples.size());
+	}
+	return hr;
+}
+
+HRESULT OutputManager::ShutdownMediaSink(_Inout_ CComPtr<IMFSinkWriter> &pSinkWriter)
+{
+	HRESULT hr = S_FALSE;
+	//Dispose of MPEG4MediaSink 
+	IMFMediaSink *pSink;
+	if (SUCCEEDED(pSinkWriter->GetServiceForStream(MF_SINK_WRITER_MEDIASINK, GUID_NULL, IID_PPV_ARGS(&pSink)))) {
+		//Release the sink writer before calling Shutdown on the media sink. 
+		//https://learn.microsoft.com/en-us/windows/win32/api/mfreadwrite/nf-mfreadwrite-mfcreatesinkwriterfrommediasink
+		pSinkWriter.Release();
+		hr = pSink->Shutdown();
+		SafeRelease(&pSink);
+		if (FAILED(hr)) {
+			LOG_ERROR("Failed to shut down IMFMediaSink");
+		}
+		else {
+			LOG_DEBUG("Shut down IMFMediaSink");
+		}
+	};
+	return hr;
+}
 
-	IMFSample *pSample;
+UINT64 OutputManager::GetSegmentBytes()
+{
+	MF_SINK_WRITER_STATISTICS stats{};
+	stats.cb = sizeof(MF_SINK_WRITER_STATISTICS);
+	if (!m_SinkWriter || FAILED(m_SinkWriter->GetStatistics(MF_SINK_WRITER_ALL_STREAMS, &stats))) {
+		return 0;
+	}
+	return stats.qwByteCountProcessed;
+}
+
+HRESULT OutputManager::StartNextSegment(_In_ const SEGMENT_INFO &endedSegment)
+{
+	//The last frame of the ended segment is still held back, waiting to be extended. It ends where the new segment starts.
+	RETURN_ON_BAD_HR(FlushPendingVideoSample());
+	//The sink writer finalizes asynchronously, so the next segment can start right away. The ended segment is completed once its file is written.
+	FINALIZING_SEGMENT segment{};
+	segment.Path = SegmentScheduler::GetSegmentPath(m_OutputFullPath, endedSegment.Index);
+	segment.Info = endedSegment;
+	segment.FinalizeEvent = m_FinalizeEvent;
+	HRESULT hr = m_SinkWriter->Finalize();
+	if (FAILED(hr)) {
+		LOG_ERROR(L"Failed to finalize segment %ls: hr = 0x%08x", segment.Path.c_str(), hr);
+		SetEvent(segment.FinalizeEvent);
+	}
+	segment.SinkWriter.Attach(m_SinkWriter.Detach());
+	m_FinalizingSegments.push_back(segment);
+
+	m_FinalizeEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+	std::wstring segmentPath = SegmentScheduler::GetSegmentPath(m_OutputFullPath, endedSegment.Index + 1);
+	RETURN_ON_BAD_HR(hr = InitializeVideoSinkWriterForFile(segmentPath, m_VideoOutputFrameSize));
+	LOG_DEBUG(L"Started segment %u at %lld ms: %ls", endedSegment.Index + 1, HundredNanosToMillis(endedSegment.EndPos), segmentPath.c_str());
+	return hr;
+}
+
+void OutputManager::CompleteFinalizedSegments(_In_ bool wait)
+{
+	while (!m_FinalizingSegments.empty()) {
+		FINALIZING_SEGMENT &segment = m_FinalizingSegments.front();
+		if (WaitForSingleObject(segment.FinalizeEvent, wait ? INFINITE : 0) != WAIT_OBJECT_0) {
+			break;
+		}
+		HRESULT hr = ShutdownMediaSink(segment.SinkWriter);
+		CloseHandle(segment.FinalizeEvent);
+		if (SUCCEEDED(hr)) {
+			LOG_DEBUG(L"Completed segment %u from %lld ms to %lld ms: %ls", segment.Info.Index, HundredNanosToMillis(segment.Info.StartPos), HundredNanosToMillis(segment.Info.EndPos), segment.Path.c_str());
+			if (m_OnSegmentComplete) {
+				m_OnSegmentComplete(segment.Path, segment.Info);
+			}
+		}
+		m_FinalizingSegments.erase(m_FinalizingSegments.begin());
+	}
+}
+
+HRESULT OutputManager::FlushPendingVideoSample()
+{
+	CComPtr<IMFSample> pSample = m_VideoSamples.Flush();
+	if (!pSample) {
+		return S_FALSE;
+	}
+	return m_SinkWriter->WriteSample(m_PendingVideoStreamIndex, pSample);
+}
+
+HRESULT OutputManager::WriteAudioSamplesToVideo(_In_ INT64 frameStartPos, _In_ INT64 frameDuration, _In_ DWORD streamIndex, _In_ const MediaBufferRef &audio)
+{
+	//The audio was written straight into a pooled media buffer, so it is handed to the sink writer as is.
+	//The tracked sample callback holds a reference to the buffer, and returns it to the pool once the encoder has released the sample.
+	IMFMediaBuffer *pBuffer = audio->Commit();
+	CComPtr<IMFTrackedSample> pTrackedSample;
+	HRESULT hr = MFCreateTrackedSample(&pTrackedSample);
+	if (SUCCEEDED(hr))
+	{
+		CComPtr<IMFAsyncCallback> pSampleCallback;
+		MediaBufferRef bufferRef = audio;
+		pSampleCallback.Attach(new (std::nothrow)CMFTrackedSampleCallback([bufferRef]() mutable {
+			bufferRef.Reset();
+		}));
+		hr = pSampleCallback ? pTrackedSample->SetAllocator(pSampleCallback, nullptr) : E_OUTOFMEMORY;
+	}
+	IMFSample *pSample = nullptr;
 	if (SUCCEEDED(hr))
 	{
-		hr = MFCreateSample(&pSample);
+		hr = pTrackedSample->QueryInterface(IID_PPV_ARGS(&pSample));
 	}
+	pTrackedSample.Release();
 	if (SUCCEEDED(hr))
 	{
 		hr = pSample->AddBuffer(pBuffer);
@@ -699,6 +1095,5 @@ HRESULT OutputManager::WriteAudioSamplesToVideo(_In_ INT64 frameStartPos, _In_ I
 		hr = m_SinkWriter->WriteSample(streamIndex, pSample);
 	}
 	SafeRelease(&pSample);
-	SafeRelease(&pBuffer);
 	return hr;
 }
\ No newline at end of file
@@ -4,9 +4,16 @@
 #include "Util.h"
 #include "MF.util.h"
 #include "CMFSinkWriterCallback.h"
+#include "TexturePool.h"
+#include "MediaBufferPool.h"
+#include "RecordingMetrics.h"
+#include "SegmentScheduler.h"
+#include "ReplayMediaSink.h"
+#include "VideoSampleQueue.h"
 #include "cleanup.h"
 #include "fifo_map.h"
 #include <mfreadwrite.h>
+#include <functional>
 
 struct FrameWriteModel
 {
@@ -14,9 +21,9 @@ struct FrameWriteModel
 	INT64 StartPos;
 	//Duration of the frame, in 100 nanosecond units.
 	INT64 Duration;
-	//The audio sample bytes for this frame.
-	std::vector<BYTE> Audio;
-	//The frame texture.
+	//The audio sample bytes for this frame, in a pooled media buffer that is handed to the sink writer without copying.
+	MediaBufferRef Audio;
+	//The frame texture. In video recordings it is null if the frame is unchanged, and the previous frame is shown for the duration instead.
 	CComPtr<ID3D11Texture2D> Frame;
 };
 
@@ -31,16 +38,32 @@ public:
 		_In_ std::shared_ptr<ENCODER_OPTIONS> &pEncoderOptions,
 		_In_ std::shared_ptr<AUDIO_OPTIONS> pAudioOptions,
 		_In_ std::shared_ptr<SNAPSHOT_OPTIONS> pSnapshotOptions,
-		_In_ std::shared_ptr<OUTPUT_OPTIONS> pOutputOptions);
+		_In_ std::shared_ptr<OUTPUT_OPTIONS> pOutputOptions,
+		_In_opt_ std::shared_ptr<RecordingMetrics> pMetrics);
 
 	HRESULT BeginRecording(_In_ std::wstring outputPath, _In_ SIZE videoOutputFrameSizer);
 	HRESULT BeginRecording(_In_ IStream *pStream, _In_ SIZE videoOutputFrameSize);
 	HRESULT FinalizeRecording();
-	HRESULT RenderFrame(_In_ FrameWriteModel &model);
+	/// <summary>
+	/// Writes a frame and its audio. The model is consumed: its frame and audio are released or handed to the encoder.
+	/// </summary>
+	HRESULT RenderFrame(_In_ FrameWriteModel &&model);
+	/// <summary>
+	/// Writes the contents of the replay buffer to a file or stream, without interrupting the recording. Only available when the replay buffer is enabled.
+	/// The replay cannot be written to the output of the recording, which is still being written.
+	/// </summary>
+	HRESULT SaveReplay(_In_ std::wstring path);
+	HRESULT SaveReplay(_In_ IStream *pStream);
 	HRESULT WriteFrameToImage(_In_ ID3D11Texture2D *pAcquiredDesktopImage, _In_ std::wstring filePath);
 	HRESULT WriteFrameToImage(_In_ ID3D11Texture2D *pAcquiredDesktopImage, _In_ IStream *pStream);
 	inline nlohmann::fifo_map<std::wstring, int> GetFrameDelays() { return m_FrameDelays; }
 	inline UINT64 GetRenderedFrameCount() { return m_RenderedFrameCount; }
+	inline RESOURCE_POOL_STATS GetFramePoolStats() { return m_FramePool ? m_FramePool->GetStats() : RESOURCE_POOL_STATS{}; }
+	/// <summary>
+	/// Sets the callback invoked with the path and timeline position of each segment of a segmented recording, once its file is written.
+	/// It is invoked on the thread rendering frames, and for the last segment on the thread finalizing the recording.
+	/// </summary>
+	inline void SetSegmentCompleteCallback(_In_ std::function<void(const std::wstring &, const SEGMENT_INFO &)> callback) { m_OnSegmentComplete = callback; }
 	HRESULT StartMediaClock();
 	HRESULT ResumeMediaClock();
 	HRESULT PauseMediaClock();
@@ -49,6 +72,14 @@ public:
 	bool isMediaClockRunning();
 	bool isMediaClockPaused();
 private:
+	//A segment whose sink writer is finalizing in the background while the next segment is written.
+	struct FINALIZING_SEGMENT {
+		CComPtr<IMFSinkWriter> SinkWriter;
+		HANDLE FinalizeEvent;
+		std::wstring Path;
+		SEGMENT_INFO Info;
+	};
+
 	ID3D11DeviceContext *m_DeviceContext = nullptr;
 	ID3D11Device *m_Device = nullptr;
 
@@ -59,6 +90,7 @@ private:
 	std::shared_ptr<AUDIO_OPTIONS> m_AudioOptions;
 	std::shared_ptr<SNAPSHOT_OPTIONS> m_SnapshotOptions;
 	std::shared_ptr<OUTPUT_OPTIONS> m_OutputOptions;
+	std::shared_ptr<RecordingMetrics> m_Metrics;
 
 	nlohmann::fifo_map<std::wstring, int> m_FrameDelays;
 
@@ -78,6 +110,24 @@ private:
 	std::chrono::steady_clock::time_point m_PreviousSnapshotTaken;
 	CRITICAL_SECTION m_CriticalSection;
 	bool m_UseManualNV12Converter;
+	//Pool of the frame copies handed to the encoder. Shared with the callbacks of samples in flight, so it outlives a device change.
+	std::shared_ptr<TexturePool> m_FramePool;
+	//Pool of the buffers used to pad silent frames with zeroed audio.
+	std::shared_ptr<MediaBufferPool> m_SilenceBufferPool;
+	//The last video sample, held back until the next one so unchanged frames can extend its duration instead of being encoded,
+	//or at a fixed framerate the last sample written, which unchanged frames write again.
+	VideoSampleQueue<CComPtr<IMFSample>> m_VideoSamples;
+	DWORD m_PendingVideoStreamIndex;
+	//Splits the recording into segments when segmenting is enabled, and null otherwise.
+	std::unique_ptr<SegmentScheduler> m_SegmentScheduler;
+	std::vector<FINALIZING_SEGMENT> m_FinalizingSegments;
+	std::function<void(const std::wstring &, const SEGMENT_INFO &)> m_OnSegmentComplete;
+	SIZE m_VideoOutputFrameSize;
+	//The encoded samples kept when the replay buffer is enabled, and null otherwise.
+	std::shared_ptr<ReplaySampleBuffer> m_ReplayBuffer;
+	//Writes the samples taken by the replay sink to the output of the recording, when the replay buffer is enabled.
+	std::shared_ptr<ReplayPassthrough> m_ReplayPassthrough;
+	CComPtr<IMFMediaSink> m_ReplayMediaSink;
 
 	std::shared_ptr<AUDIO_OPTIONS> GetAudioOptions() { return m_AudioOptions; }
 	std::shared_ptr<ENCODER_OPTIONS> GetEncoderOptions() { return m_EncoderOptions; }
@@ -87,8 +137,63 @@ private:
 	HRESULT ConfigureOutputMediaTypes(_In_ UINT destWidth, _In_ UINT destHeight, _Outptr_ IMFMediaType **pVideoMediaTypeOut, _Outptr_result_maybenull_ IMFMediaType **pAudioMediaTypeOut);
 	HRESULT ConfigureInputMediaTypes(_In_ UINT sourceWidth, _In_ UINT sourceHeight, _In_ MFVideoRotationFormat rotationFormat, _In_ IMFMediaType *pVideoMediaTypeOut, _Outptr_ IMFMediaType **pVideoMediaTypeIn, _Outptr_result_maybenull_ IMFMediaType **pAudioMediaTypeIn);
 	HRESULT InitializeVideoSinkWriter(_In_ IMFByteStream *pOutStream, _In_ RECT sourceRect, _In_ SIZE outputFrameSize, _In_ DXGI_MODE_ROTATION rotation, _In_ IMFSinkWriterCallback *pCallback, _Outptr_ IMFSinkWriter **ppWriter, _Out_ DWORD *pVideoStreamIndex, _Out_ DWORD *pAudioStreamIndex);
+	HRESULT InitializeVideoSinkWriterForFile(_In_ std::wstring outputPath, _In_ SIZE videoOutputFrameSize);
+	/// <summary>
+	/// Creates the sink writer writing to a byte stream. If the replay buffer is enabled, the encoded samples are also kept in it.
+	/// </summary>
+	HRESULT InitializeVideoSinkWriterForStream(_In_ IMFByteStream *pOutStream, _In_ SIZE videoOutputFrameSize);
+	/// <summary>
+	/// Creates the replay buffer if it is enabled in the output options, replacing the buffer of any previous recording.
+	/// </summary>
+	void CreateReplayBuffer();
+	HRESULT GetReplayStreamMediaType(_In_ IMFMediaSink *pReplaySink, _In_ DWORD streamId, _Outptr_ IMFMediaType **ppMediaType);
+	/// <summary>
+	/// Creates a sink writer muxing samples in the format the replay sink took them in, without encoding them again.
+	/// </summary>
+	HRESULT CreatePassthroughSinkWriter(_In_ IMFMediaSink *pReplaySink, _In_ IMFByteStream *pOutStream, _In_ bool isFragmented, _Outptr_ IMFSinkWriter **ppWriter);
+	/// <summary>
+	/// Muxes the buffered replay window to an MP4 byte stream, with timestamps starting at 0.
+	/// </summary>
+	HRESULT WriteReplay(_In_ IMFByteStream *pOutStream);
+	/// <summary>
+	/// Shuts down the media sink of a finalized sink writer, and releases the sink writer.
+	/// </summary>
+	HRESULT ShutdownMediaSink(_Inout_ CComPtr<IMFSinkWriter> &pSinkWriter);
+	/// <summary>
+	/// The approximate number of bytes written to the current sink writer, as reported by its statistics.
+	/// </summary>
+	UINT64 GetSegmentBytes();
+	/// <summary>
+	/// Starts finalizing the current sink writer in the background, and starts writing the next segment to a new one.
+	/// </summary>
+	HRESULT StartNextSegment(_In_ const SEGMENT_INFO &endedSegment);
+	/// <summary>
+	/// Shuts down the segments whose sink writer has finalized, and invokes the segment complete callback for them, in order.
+	/// </summary>
+	/// <param name="wait">true to wait for all segments to finalize</param>
+	void CompleteFinalizedSegments(_In_ bool wait);
 	HRESULT WriteFrameToVideo(_In_ INT64 frameStartPos, _In_ INT64 frameDuration, _In_ DWORD streamIndex, _In_ ID3D11Texture2D *pAcquiredDesktopImage);
+	/// <summary>
+	/// Writes the pending video sample to the sink writer, and holds back the given sample in its place, so unchanged frames can extend it.
+	/// At a fixed framerate, the given sample is written right away.
+	/// </summary>
+	HRESULT QueueVideoSample(_In_ DWORD streamIndex, _In_ IMFSample *pSample);
+	/// <summary>
+	/// Adds the duration of an unchanged frame to the pending video sample. At a fixed framerate, where no sample is pending, the last sample written
+	/// is written again for the frame, e.g. for a frame shed by an additional output falling behind, so the output has no gap.
+	/// </summary>
+	/// <returns>S_FALSE if no sample was written yet</returns>
+	HRESULT ExtendPendingVideoSample(_In_ INT64 frameStartPos, _In_ INT64 frameDuration);
+	/// <summary>
+	/// Writes a new sample for the given interval, with the buffers of a sample already written.
+	/// </summary>
+	HRESULT WriteRepeatedVideoSample(_In_ INT64 frameStartPos, _In_ INT64 frameDuration, _In_ DWORD streamIndex, _In_ IMFSample *pSample);
+	/// <summary>
+	/// Writes the pending video sample to the sink writer.
+	/// </summary>
+	/// <returns>S_FALSE if there is no pending video sample</returns>
+	HRESULT FlushPendingVideoSample();
 
-	HRESULT WriteAudioSamplesToVideo(_In_ INT64 frameStartPos, _In_ INT64 frameDuration, _In_ DWORD streamIndex, _In_ BYTE *pSrc, _In_ DWORD cbData);
+	HRESULT WriteAudioSamplesToVideo(_In_ INT64 frameStartPos, _In_ INT64 frameDuration, _In_ DWORD streamIndex, _In_ const MediaBufferRef &audio);
 };
 
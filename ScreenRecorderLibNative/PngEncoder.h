@@ -0,0 +1,349 @@
+#pragma once
+#include "DeflateEncoder.h"
+#include "WorkerPool.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define PNG_ENCODER_SSE2
+#include <emmintrin.h>
+#endif
+
+/// <summary>
+/// Encodes BGRA images as 24 bit RGB PNG files, dropping alpha like the WIC encoder does for snapshots.
+/// The image is split in strips of rows that are converted, filtered and compressed in parallel on a WorkerPool.
+/// Each strip is compressed with the end of the strip before it as a dictionary and written as its own IDAT chunk,
+/// so the result compresses nearly as well as a single stream. Rows are filtered with the filter giving the smallest sum of absolute differences, as libpng does.
+/// Keeps its buffers between images, so encoding images of the same size does not allocate. Encode is not reentrant.
+/// </summary>
+class PngEncoder
+{
+public:
+	/// <param name="maxChainLength">The most earlier positions tried for each match by the deflate encoder. Higher values compress better and slower.</param>
+	PngEncoder(int maxChainLength = 8) :
+		m_MaxChainLength(maxChainLength)
+	{
+	}
+	PngEncoder(const PngEncoder &) = delete;
+	PngEncoder &operator=(const PngEncoder &) = delete;
+
+	/// <summary>
+	/// Encodes an image and replaces the contents of output with the PNG file.
+	/// </summary>
+	/// <param name="pBgra">The pixels, 4 bytes each in B, G, R, A order</param>
+	/// <param name="pitch">The distance between rows of pBgra, in bytes</param>
+	/// <param name="pPool">Optional pool to encode strips on. The calling thread encodes strips too, so the pool may be busy or be the pool the caller runs on.</param>
+	/// <returns>false if the image is empty or too large for a PNG</returns>
+	bool Encode(const uint8_t *pBgra, uint32_t width, uint32_t height, uint32_t pitch, std::vector<uint8_t> &output, WorkerPool *pPool = nullptr)
+	{
+		output.clear();
+		//The deflate encoder addresses the filtered image with 32 bit offsets, so it is kept below 1 GB.
+		if (width == 0 || height == 0 || static_cast<uint64_t>(width) * 3 + 1 > (1u << 30) / height) {
+			return false;
+		}
+		m_Width = width;
+		m_Height = height;
+		m_RowSize = static_cast<size_t>(width) * 3;
+		m_PaddedRowSize = ROW_PADDING + ((m_RowSize + 15) & ~static_cast<size_t>(15)) + ROW_PADDING;
+		m_RowsPerStrip = (std::max)(static_cast<uint32_t>(STRIP_SIZE / (m_RowSize + 1)), 1u);
+		size_t stripCount = (height + m_RowsPerStrip - 1) / m_RowsPerStrip;
+		m_Rgb.resize(m_PaddedRowSize * height);
+		m_Filtered.resize((m_RowSize + 1) * height);
+		m_Strips.resize(stripCount);
+
+		auto forEachStrip([&](const std::function<void(size_t index)> &body) {
+			if (pPool) {
+				pPool->ParallelFor(stripCount, body);
+			}
+			else {
+				for (size_t i = 0; i < stripCount; i++) {
+					body(i);
+				}
+			}
+			});
+		//Strips are filtered before any is compressed, as each strip is compressed with the filtered rows before it as its dictionary.
+		forEachStrip([&](size_t index) { FilterStrip(pBgra, pitch, index); });
+		forEachStrip([&](size_t index) { CompressStrip(index, index == stripCount - 1); });
+
+		uint32_t adler = 1;
+		size_t compressedSize = 0;
+		for (size_t i = 0; i < stripCount; i++) {
+			adler = i == 0 ? m_Strips[i].Adler : CombineAdler32(adler, m_Strips[i].Adler, GetStripSize(i));
+			compressedSize += m_Strips[i].Chunk.size();
+		}
+		output.reserve(compressedSize + 64);
+		static const uint8_t SIGNATURE[8] = { 0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A };
+		output.insert(output.end(), SIGNATURE, SIGNATURE + sizeof(SIGNATURE));
+		uint8_t header[13];
+		WriteBigEndian(header, width);
+		WriteBigEndian(header + 4, height);
+		header[8] = 8;//Bit depth
+		header[9] = 2;//Color type RGB
+		header[10] = 0;//Deflate
+		header[11] = 0;//Adaptive filtering
+		header[12] = 0;//No interlace
+		WriteChunk("IHDR", header, sizeof(header), output);
+		for (STRIP &strip : m_Strips) {
+			output.insert(output.end(), strip.Chunk.begin(), strip.Chunk.end());
+		}
+		uint8_t adlerBytes[4];
+		WriteBigEndian(adlerBytes, adler);
+		WriteChunk("IDAT", adlerBytes, sizeof(adlerBytes), output);
+		WriteChunk("IEND", nullptr, 0, output);
+		return true;
+	}
+
+private:
+	//The zero bytes before and after each converted row, so filters can read the pixel left of the first one, and whole 16 byte blocks past the last one.
+	static const size_t ROW_PADDING = 16;
+	//The filtered bytes in a strip. Smaller strips spread the work better, larger ones compress better.
+	static const size_t STRIP_SIZE = 256 * 1024;
+	static const int FILTER_COUNT = 5;
+
+	struct STRIP {
+		//The complete IDAT chunk of the strip, the first one starting with the zlib header.
+		std::vector<uint8_t> Chunk;
+		uint32_t Adler = 1;
+		//The scratch rows of the filter candidates.
+		std::vector<uint8_t> Candidates;
+	};
+
+	int m_MaxChainLength;
+	uint32_t m_Width = 0;
+	uint32_t m_Height = 0;
+	size_t m_RowSize = 0;
+	size_t m_PaddedRowSize = 0;
+	uint32_t m_RowsPerStrip = 1;
+	//The image converted to RGB, in padded rows.
+	std::vector<uint8_t> m_Rgb;
+	//The filtered rows, each starting with its filter type, as they are compressed.
+	std::vector<uint8_t> m_Filtered;
+	std::vector<STRIP> m_Strips;
+	//The deflate encoders not in use by a strip. Each thread compressing a strip takes one, so there are as many as strips compressed at the same time.
+	std::mutex m_EncodersMutex;
+	std::vector<std::unique_ptr<DeflateEncoder>> m_Encoders;
+
+	static void WriteBigEndian(uint8_t *pDestination, uint32_t value)
+	{
+		pDestination[0] = static_cast<uint8_t>(value >> 24);
+		pDestination[1] = static_cast<uint8_t>(value >> 16);
+		pDestination[2] = static_cast<uint8_t>(value >> 8);
+		pDestination[3] = static_cast<uint8_t>(value);
+	}
+
+	static void WriteChunk(const char *type, const uint8_t *pData, size_t size, std::vector<uint8_t> &output)
+	{
+		uint8_t length[4];
+		WriteBigEndian(length, static_cast<uint32_t>(size));
+		output.insert(output.end(), length, length + 4);
+		size_t typeOffset = output.size();
+		output.insert(output.end(), type, type + 4);
+		if (size > 0) {
+			output.insert(output.end(), pData, pData + size);
+		}
+		uint8_t crc[4];
+		WriteBigEndian(crc, UpdateCrc32(0, output.data() + typeOffset, size + 4));
+		output.insert(output.end(), crc, crc + 4);
+	}
+
+	inline uint8_t *GetRgbRow(uint32_t row) { return m_Rgb.data() + m_PaddedRowSize * row + ROW_PADDING; }
+	inline size_t GetStripSize(size_t index) const
+	{
+		size_t firstRow = index * m_RowsPerStrip;
+		size_t rowCount = (std::min)(static_cast<size_t>(m_RowsPerStrip), m_Height - firstRow);
+		return rowCount * (m_RowSize + 1);
+	}
+
+	static void ConvertRow(const uint8_t *pBgra, uint32_t width, uint8_t *pRgb)
+	{
+		for (uint32_t x = 0; x < width; x++) {
+			pRgb[0] = pBgra[2];
+			pRgb[1] = pBgra[1];
+			pRgb[2] = pBgra[0];
+			pBgra += 4;
+			pRgb += 3;
+		}
+	}
+
+	void FilterStrip(const uint8_t *pBgra, uint32_t pitch, size_t index)
+	{
+		STRIP &strip = m_Strips[index];
+		strip.Candidates.resize(m_PaddedRowSize * FILTER_COUNT);
+		uint32_t firstRow = static_cast<uint32_t>(index * m_RowsPerStrip);
+		uint32_t endRow = (std::min)(firstRow + m_RowsPerStrip, m_Height);
+		//The row above the strip is converted by the strip before it, which may not have got to it yet, so this strip converts its own copy.
+		std::vector<uint8_t> priorRow(m_PaddedRowSize, 0);
+		if (firstRow > 0) {
+			ConvertRow(pBgra + static_cast<size_t>(pitch) * (firstRow - 1), m_Width, priorRow.data() + ROW_PADDING);
+		}
+		for (uint32_t row = firstRow; row < endRow; row++) {
+			uint8_t *pRow = GetRgbRow(row);
+			memset(pRow - ROW_PADDING, 0, ROW_PADDING);
+			ConvertRow(pBgra + static_cast<size_t>(pitch) * row, m_Width, pRow);
+			const uint8_t *pPrior = row == firstRow ? priorRow.data() + ROW_PADDING : GetRgbRow(row - 1);
+			uint8_t *pFiltered = m_Filtered.data() + (m_RowSize + 1) * row;
+			uint64_t sums[FILTER_COUNT];
+			FilterRow(pRow, pPrior, m_RowSize, strip.Candidates.data(), m_PaddedRowSize, sums);
+			int best = 0;
+			for (int filter = 1; filter < FILTER_COUNT; filter++) {
+				if (sums[filter] < sums[best]) {
+					best = filter;
+				}
+			}
+			pFiltered[0] = static_cast<uint8_t>(best);
+			memcpy(pFiltered + 1, strip.Candidates.data() + m_PaddedRowSize * best, m_RowSize);
+		}
+	}
+
+	void CompressStrip(size_t index, bool isFinal)
+	{
+		STRIP &strip = m_Strips[index];
+		size_t start = index * m_RowsPerStrip * (m_RowSize + 1);
+		size_t size = GetStripSize(index);
+		size_t dictionarySize = (std::min)(start, static_cast<size_t>(DEFLATE_WINDOW_SIZE));
+		const uint8_t *pData = m_Filtered.data() + start;
+		strip.Adler = UpdateAdler32(1, pData, size);
+		//The chunk length is filled in once the strip is compressed.
+		static const uint8_t CHUNK_START[8] = { 0, 0, 0, 0, 'I', 'D', 'A', 'T' };
+		strip.Chunk.assign(CHUNK_START, CHUNK_START + sizeof(CHUNK_START));
+		if (index == 0) {
+			//Deflate with a 32 KB window, compressed with the fastest level.
+			strip.Chunk.push_back(0x78);
+			strip.Chunk.push_back(0x01);
+		}
+		std::unique_ptr<DeflateEncoder> pEncoder = TakeEncoder();
+		pEncoder->Compress(pData - dictionarySize, dictionarySize, size, isFinal, strip.Chunk);
+		ReturnEncoder(std::move(pEncoder));
+		uint32_t dataSize = static_cast<uint32_t>(strip.Chunk.size() - sizeof(CHUNK_START));
+		WriteBigEndian(strip.Chunk.data(), dataSize);
+		uint8_t crc[4];
+		WriteBigEndian(crc, UpdateCrc32(0, strip.Chunk.data() + 4, dataSize + 4));
+		strip.Chunk.insert(strip.Chunk.end(), crc, crc + 4);
+	}
+
+	std::unique_ptr<DeflateEncoder> TakeEncoder()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_EncodersMutex);
+			if (!m_Encoders.empty()) {
+				std::unique_ptr<DeflateEncoder> pEncoder = std::move(m_Encoders.back());
+				m_Encoders.pop_back();
+				return pEncoder;
+			}
+		}
+		return std::make_unique<DeflateEncoder>(m_MaxChainLength);
+	}
+
+	void ReturnEncoder(std::unique_ptr<DeflateEncoder> pEncoder)
+	{
+		std::lock_guard<std::mutex> lock(m_EncodersMutex);
+		m_Encoders.push_back(std::move(pEncoder));
+	}
+
+	static inline uint8_t PaethPredictor(int a, int b, int c)
+	{
+		int pa = abs(b - c);
+		int pb = abs(a - c);
+		int pc = abs(a + b - 2 * c);
+		if (pa <= pb && pa <= pc) {
+			return static_cast<uint8_t>(a);
+		}
+		return static_cast<uint8_t>(pb <= pc ? b : c);
+	}
+
+	static inline uint32_t AbsoluteValue(uint8_t filtered)
+	{
+		return static_cast<uint32_t>(abs(static_cast<int8_t>(filtered)));
+	}
+
+	/// <summary>
+	/// Applies the five PNG filters to a row, writing candidate n at pCandidates + n * candidatePitch, and sums the absolute values of each candidate's bytes as signed bytes.
+	/// The bytes before pRow and pPrior must be zero, as the pixel left of the first one is.
+	/// </summary>
+	static void FilterRow(const uint8_t *pRow, const uint8_t *pPrior, size_t size, uint8_t *pCandidates, size_t candidatePitch, uint64_t *pSums)
+	{
+		uint8_t *pNone = pCandidates;
+		uint8_t *pSub = pCandidates + candidatePitch;
+		uint8_t *pUp = pCandidates + candidatePitch * 2;
+		uint8_t *pAverage = pCandidates + candidatePitch * 3;
+		uint8_t *pPaeth = pCandidates + candidatePitch * 4;
+		for (int filter = 0; filter < FILTER_COUNT; filter++) {
+			pSums[filter] = 0;
+		}
+		size_t i = 0;
+#ifdef PNG_ENCODER_SSE2
+		const __m128i zero = _mm_setzero_si128();
+		__m128i sums[FILTER_COUNT] = { zero, zero, zero, zero, zero };
+		auto SumAbsolute([&](__m128i &sum, __m128i filtered) {
+			//The absolute value of a signed byte, as an unsigned byte.
+			__m128i absolute = _mm_min_epu8(filtered, _mm_sub_epi8(zero, filtered));
+			sum = _mm_add_epi64(sum, _mm_sad_epu8(absolute, zero));
+			});
+		auto Paeth16([&](__m128i a, __m128i b, __m128i c) {
+			__m128i bc = _mm_sub_epi16(b, c);
+			__m128i ac = _mm_sub_epi16(a, c);
+			__m128i abc = _mm_add_epi16(bc, ac);
+			__m128i pa = _mm_max_epi16(bc, _mm_sub_epi16(zero, bc));
+			__m128i pb = _mm_max_epi16(ac, _mm_sub_epi16(zero, ac));
+			__m128i pc = _mm_max_epi16(abc, _mm_sub_epi16(zero, abc));
+			__m128i notA = _mm_or_si128(_mm_cmpgt_epi16(pa, pb), _mm_cmpgt_epi16(pa, pc));
+			__m128i notB = _mm_cmpgt_epi16(pb, pc);
+			__m128i bOrC = _mm_or_si128(_mm_andnot_si128(notB, b), _mm_and_si128(notB, c));
+			return _mm_or_si128(_mm_andnot_si128(notA, a), _mm_and_si128(notA, bOrC));
+			});
+		for (; i + 16 <= size; i += 16) {
+			__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pRow + i));
+			__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pRow + i - 3));
+			__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pPrior + i));
+			__m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pPrior + i - 3));
+			__m128i sub = _mm_sub_epi8(x, a);
+			__m128i up = _mm_sub_epi8(x, b);
+			//_mm_avg_epu8 rounds up, the average filter rounds down.
+			__m128i average = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1)));
+			average = _mm_sub_epi8(x, average);
+			__m128i predictor = _mm_packus_epi16(
+				Paeth16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(c, zero)),
+				Paeth16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(c, zero)));
+			__m128i paeth = _mm_sub_epi8(x, predictor);
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(pNone + i), x);
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(pSub + i), sub);
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(pUp + i), up);
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(pAverage + i), average);
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(pPaeth + i), paeth);
+			SumAbsolute(sums[0], x);
+			SumAbsolute(sums[1], sub);
+			SumAbsolute(sums[2], up);
+			SumAbsolute(sums[3], average);
+			SumAbsolute(sums[4], paeth);
+		}
+		for (int filter = 0; filter < FILTER_COUNT; filter++) {
+			uint64_t halves[2];
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(halves), sums[filter]);
+			pSums[filter] = halves[0] + halves[1];
+		}
+#endif
+		for (; i < size; i++) {
+			uint8_t x = pRow[i];
+			uint8_t a = pRow[static_cast<ptrdiff_t>(i) - 3];
+			uint8_t b = pPrior[i];
+			uint8_t c = pPrior[static_cast<ptrdiff_t>(i) - 3];
+			pNone[i] = x;
+			pSub[i] = static_cast<uint8_t>(x - a);
+			pUp[i] = static_cast<uint8_t>(x - b);
+			pAverage[i] = static_cast<uint8_t>(x - ((a + b) >> 1));
+			pPaeth[i] = static_cast<uint8_t>(x - PaethPredictor(a, b, c));
+			pSums[0] += AbsoluteValue(pNone[i]);
+			pSums[1] += AbsoluteValue(pSub[i]);
+			pSums[2] += AbsoluteValue(pUp[i]);
+			pSums[3] += AbsoluteValue(pAverage[i]);
+			pSums[4] += AbsoluteValue(pPaeth[i]);
+		}
+	}
+};
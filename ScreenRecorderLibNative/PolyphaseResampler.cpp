@@ -0,0 +1,550 @@
+#include "PolyphaseResampler.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define POLYPHASE_RESAMPLER_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+//MSVC allows AVX2 intrinsics in any function, the kernel is only called after checking CPU support.
+#define POLYPHASE_RESAMPLER_TARGET_AVX2
+#else
+#define POLYPHASE_RESAMPLER_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace {
+	const int MIN_HALF_FILTER_LENGTH = 4;
+	const int MAX_HALF_FILTER_LENGTH = 128;
+	//Upper bound for the taps on each side when downsampling by a large factor. Larger ratios get a wider transition band instead of a longer filter.
+	const size_t MAX_HALF_TAPS = 1024;
+	const uint16_t MAX_CHANNELS = 32;
+	//Stopband attenuation of the filter, in dB.
+	const double STOPBAND_ATTENUATION = 80.0;
+	const float INT16_TO_FLOAT = 1.0f / 32768.0f;
+	const float FLOAT_TO_INT16 = 32768.0f;
+	//Standard -3 dB gain for folding center and surround channels into stereo.
+	const float SURROUND_DOWNMIX_GAIN = 0.70710678f;
+	const size_t LFE_CHANNEL = 3;
+
+	typedef float(*DotFunc)(const float *pCoefficients, const float *pSamples, size_t count);
+	typedef void(*Int16ToFloatFunc)(const int16_t *pInput, float *pOutput, size_t count);
+	typedef void(*FloatToInt16Func)(const float *pInput, int16_t *pOutput, size_t count);
+
+#pragma region Scalar
+	float DotScalar(const float *pCoefficients, const float *pSamples, size_t count) {
+		float sum = 0;
+		for (size_t i = 0; i < count; i++) {
+			sum += pCoefficients[i] * pSamples[i];
+		}
+		return sum;
+	}
+
+	void Int16ToFloatScalar(const int16_t *pInput, float *pOutput, size_t count) {
+		for (size_t i = 0; i < count; i++) {
+			pOutput[i] = pInput[i] * INT16_TO_FLOAT;
+		}
+	}
+
+	void FloatToInt16Scalar(const float *pInput, int16_t *pOutput, size_t count) {
+		for (size_t i = 0; i < count; i++) {
+			float value = (std::max)(-32768.0f, (std::min)(32767.0f, pInput[i] * FLOAT_TO_INT16));
+			//Round to nearest even, like the SIMD conversions with the default rounding mode.
+			pOutput[i] = (int16_t)std::lrintf(value);
+		}
+	}
+#pragma endregion
+
+#ifdef POLYPHASE_RESAMPLER_X86
+#pragma region SSE2
+	inline float HorizontalSumSSE2(__m128 value) {
+		__m128 shuffled = _mm_shuffle_ps(value, value, _MM_SHUFFLE(2, 3, 0, 1));
+		__m128 sums = _mm_add_ps(value, shuffled);
+		shuffled = _mm_movehl_ps(shuffled, sums);
+		return _mm_cvtss_f32(_mm_add_ss(sums, shuffled));
+	}
+
+	float DotSSE2(const float *pCoefficients, const float *pSamples, size_t count) {
+		__m128 sum0 = _mm_setzero_ps();
+		__m128 sum1 = _mm_setzero_ps();
+		size_t i = 0;
+		for (; i + 8 <= count; i += 8) {
+			sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(pCoefficients + i), _mm_loadu_ps(pSamples + i)));
+			sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(pCoefficients + i + 4), _mm_loadu_ps(pSamples + i + 4)));
+		}
+		return HorizontalSumSSE2(_mm_add_ps(sum0, sum1)) + DotScalar(pCoefficients + i, pSamples + i, count - i);
+	}
+
+	void Int16ToFloatSSE2(const int16_t *pInput, float *pOutput, size_t count) {
+		const __m128 vScale = _mm_set1_ps(INT16_TO_FLOAT);
+		size_t i = 0;
+		for (; i + 8 <= count; i += 8) {
+			__m128i samples = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pInput + i));
+			//Sign extend to 32 bits by moving each sample into the high half and shifting back.
+			__m128 lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(samples, samples), 16));
+			__m128 hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(samples, samples), 16));
+			_mm_storeu_ps(pOutput + i, _mm_mul_ps(lo, vScale));
+			_mm_storeu_ps(pOutput + i + 4, _mm_mul_ps(hi, vScale));
+		}
+		Int16ToFloatScalar(pInput + i, pOutput + i, count - i);
+	}
+
+	void FloatToInt16SSE2(const float *pInput, int16_t *pOutput, size_t count) {
+		const __m128 vScale = _mm_set1_ps(FLOAT_TO_INT16);
+		const __m128 vMax = _mm_set1_ps(32767.0f);
+		const __m128 vMin = _mm_set1_ps(-32768.0f);
+		size_t i = 0;
+		for (; i + 8 <= count; i += 8) {
+			__m128 lo = _mm_max_ps(vMin, _mm_min_ps(vMax, _mm_mul_ps(_mm_loadu_ps(pInput + i), vScale)));
+			__m128 hi = _mm_max_ps(vMin, _mm_min_ps(vMax, _mm_mul_ps(_mm_loadu_ps(pInput + i + 4), vScale)));
+			__m128i packed = _mm_packs_epi32(_mm_cvtps_epi32(lo), _mm_cvtps_epi32(hi));
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(pOutput + i), packed);
+		}
+		FloatToInt16Scalar(pInput + i, pOutput + i, count - i);
+	}
+#pragma endregion
+
+#pragma region AVX2
+	POLYPHASE_RESAMPLER_TARGET_AVX2 float DotAVX2(const float *pCoefficients, const float *pSamples, size_t count) {
+		__m256 sum0 = _mm256_setzero_ps();
+		__m256 sum1 = _mm256_setzero_ps();
+		size_t i = 0;
+		for (; i + 16 <= count; i += 16) {
+			sum0 = _mm256_add_ps(sum0, _mm256_mul_ps(_mm256_loadu_ps(pCoefficients + i), _mm256_loadu_ps(pSamples + i)));
+			sum1 = _mm256_add_ps(sum1, _mm256_mul_ps(_mm256_loadu_ps(pCoefficients + i + 8), _mm256_loadu_ps(pSamples + i + 8)));
+		}
+		if (i + 8 <= count) {
+			sum0 = _mm256_add_ps(sum0, _mm256_mul_ps(_mm256_loadu_ps(pCoefficients + i), _mm256_loadu_ps(pSamples + i)));
+			i += 8;
+		}
+		__m256 sum = _mm256_add_ps(sum0, sum1);
+		__m128 half = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+		return HorizontalSumSSE2(half) + DotScalar(pCoefficients + i, pSamples + i, count - i);
+	}
+
+	POLYPHASE_RESAMPLER_TARGET_AVX2 void Int16ToFloatAVX2(const int16_t *pInput, float *pOutput, size_t count) {
+		const __m256 vScale = _mm256_set1_ps(INT16_TO_FLOAT);
+		size_t i = 0;
+		for (; i + 8 <= count; i += 8) {
+			__m256 samples = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(pInput + i))));
+			_mm256_storeu_ps(pOutput + i, _mm256_mul_ps(samples, vScale));
+		}
+		Int16ToFloatScalar(pInput + i, pOutput + i, count - i);
+	}
+
+	POLYPHASE_RESAMPLER_TARGET_AVX2 void FloatToInt16AVX2(const float *pInput, int16_t *pOutput, size_t count) {
+		const __m256 vScale = _mm256_set1_ps(FLOAT_TO_INT16);
+		const __m256 vMax = _mm256_set1_ps(32767.0f);
+		const __m256 vMin = _mm256_set1_ps(-32768.0f);
+		size_t i = 0;
+		for (; i + 16 <= count; i += 16) {
+			__m256 lo = _mm256_max_ps(vMin, _mm256_min_ps(vMax, _mm256_mul_ps(_mm256_loadu_ps(pInput + i), vScale)));
+			__m256 hi = _mm256_max_ps(vMin, _mm256_min_ps(vMax, _mm256_mul_ps(_mm256_loadu_ps(pInput + i + 8), vScale)));
+			//packs works per 128-bit lane, so the 64-bit quarters come out as lo0 hi0 lo1 hi1 and are permuted back into order.
+			__m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(_mm256_cvtps_epi32(lo), _mm256_cvtps_epi32(hi)), _MM_SHUFFLE(3, 1, 2, 0));
+			_mm256_storeu_si256(reinterpret_cast<__m256i *>(pOutput + i), packed);
+		}
+		FloatToInt16Scalar(pInput + i, pOutput + i, count - i);
+	}
+#pragma endregion
+#endif
+
+	DotFunc GetDotFunc(AudioMixer::Kernel kernel) {
+#ifdef POLYPHASE_RESAMPLER_X86
+		if (kernel == AudioMixer::Kernel::AVX2) {
+			return DotAVX2;
+		}
+		if (kernel == AudioMixer::Kernel::SSE2) {
+			return DotSSE2;
+		}
+#endif
+		return DotScalar;
+	}
+
+	Int16ToFloatFunc GetInt16ToFloatFunc(AudioMixer::Kernel kernel) {
+#ifdef POLYPHASE_RESAMPLER_X86
+		if (kernel == AudioMixer::Kernel::AVX2) {
+			return Int16ToFloatAVX2;
+		}
+		if (kernel == AudioMixer::Kernel::SSE2) {
+			return Int16ToFloatSSE2;
+		}
+#endif
+		return Int16ToFloatScalar;
+	}
+
+	FloatToInt16Func GetFloatToInt16Func(AudioMixer::Kernel kernel) {
+#ifdef POLYPHASE_RESAMPLER_X86
+		if (kernel == AudioMixer::Kernel::AVX2) {
+			return FloatToInt16AVX2;
+		}
+		if (kernel == AudioMixer::Kernel::SSE2) {
+			return FloatToInt16SSE2;
+		}
+#endif
+		return FloatToInt16Scalar;
+	}
+
+	/// <summary>
+	/// Zeroth order modified Bessel function of the first kind, used by the Kaiser window.
+	/// </summary>
+	double BesselI0(double x) {
+		double sum = 1.0;
+		double term = 1.0;
+		double halfX = x / 2.0;
+		for (int k = 1; k < 64; k++) {
+			term *= (halfX / k) * (halfX / k);
+			sum += term;
+			if (term < sum * 1e-17) {
+				break;
+			}
+		}
+		return sum;
+	}
+}
+
+PolyphaseResampler::PolyphaseResampler() :
+	m_InputFormat{},
+	m_OutputFormat{},
+	m_Kernel(AudioMixer::GetBestKernel()),
+	m_Interpolation(1),
+	m_Decimation(1),
+	m_PhaseCount(1),
+	m_IsPhaseInterpolated(false),
+	m_HalfTaps(0),
+	m_Taps(0),
+	m_Position(0),
+	m_Phase(0),
+	m_PartialFrameBytes(0),
+	m_InputFrameTotal(0),
+	m_OutputFrameTotal(0)
+{
+}
+
+bool PolyphaseResampler::Initialize(const AUDIO_SAMPLE_FORMAT &inputFormat, const AUDIO_SAMPLE_FORMAT &outputFormat, int halfFilterLength)
+{
+	if (inputFormat.SampleRate == 0 || outputFormat.SampleRate == 0
+		|| inputFormat.Channels == 0 || inputFormat.Channels > MAX_CHANNELS
+		|| outputFormat.Channels == 0 || outputFormat.Channels > MAX_CHANNELS) {
+		return false;
+	}
+	m_InputFormat = inputFormat;
+	m_OutputFormat = outputFormat;
+
+	uint64_t divisor = std::gcd((uint64_t)inputFormat.SampleRate, (uint64_t)outputFormat.SampleRate);
+	m_Interpolation = outputFormat.SampleRate / divisor;
+	m_Decimation = inputFormat.SampleRate / divisor;
+	m_IsPhaseInterpolated = m_Interpolation > POLYPHASE_RESAMPLER_MAX_PHASES;
+	m_PhaseCount = m_IsPhaseInterpolated ? POLYPHASE_RESAMPLER_MAX_PHASES : (size_t)m_Interpolation;
+
+	//When downsampling, the cutoff moves down with the output rate, so the filter is made longer by the same factor to keep the transition band as narrow.
+	double ratio = (std::max)(1.0, (double)m_Decimation / (double)m_Interpolation);
+	size_t halfTaps = (size_t)std::ceil(std::clamp(halfFilterLength, MIN_HALF_FILTER_LENGTH, MAX_HALF_FILTER_LENGTH) * ratio);
+	//A multiple of 4, so rows are a multiple of 8 taps and the SIMD kernels need no scalar tail.
+	halfTaps = (std::min)(MAX_HALF_TAPS, (halfTaps + 3) & ~(size_t)3);
+	m_HalfTaps = halfTaps;
+	m_Taps = halfTaps * 2;
+
+	BuildFilter();
+	BuildChannelMatrix();
+	m_History.assign(outputFormat.Channels, std::vector<float>());
+	m_PartialFrame.assign(inputFormat.FrameBytes(), 0);
+	//Room for a second of audio, which covers the packets of any capture device. Larger calls grow the buffers once.
+	size_t reservedFrames = inputFormat.SampleRate + m_Taps;
+	for (std::vector<float> &history : m_History) {
+		history.reserve(reservedFrames);
+	}
+	m_InputScratch.reserve((size_t)inputFormat.SampleRate * inputFormat.Channels);
+	m_OutputScratch.reserve((size_t)outputFormat.SampleRate * outputFormat.Channels + outputFormat.Channels);
+	Reset();
+	return true;
+}
+
+void PolyphaseResampler::Reset()
+{
+	//The filter is centered on each output frame, so the first output frame needs silence before the first input frame.
+	for (std::vector<float> &history : m_History) {
+		history.assign(m_HalfTaps > 0 ? m_HalfTaps - 1 : 0, 0.0f);
+	}
+	m_Position = 0;
+	m_Phase = 0;
+	m_PartialFrameBytes = 0;
+	m_InputFrameTotal = 0;
+	m_OutputFrameTotal = 0;
+}
+
+void PolyphaseResampler::SetKernel(AudioMixer::Kernel kernel)
+{
+	m_Kernel = (std::min)(kernel, AudioMixer::GetBestKernel());
+}
+
+void PolyphaseResampler::BuildFilter()
+{
+	//Normalized to the input rate. The stopband starts at the lower Nyquist frequency, and the cutoff is placed half a transition band below it.
+	double nyquist = 0.5 * (std::min)(1.0, (double)m_Interpolation / (double)m_Decimation);
+	double transitionWidth = (STOPBAND_ATTENUATION - 7.95) / (14.36 * (double)(m_Taps - 1));
+	double cutoff = (std::max)(nyquist * 0.5, nyquist - transitionWidth / 2);
+	double beta = 0.1102 * (STOPBAND_ATTENUATION - 8.7);
+	double windowScale = 1.0 / BesselI0(beta);
+
+	m_Filter.assign((m_PhaseCount + 1) * m_Taps, 0.0f);
+	for (size_t phase = 0; phase <= m_PhaseCount; phase++) {
+		double fraction = (double)phase / (double)m_PhaseCount;
+		float *pRow = &m_Filter[phase * m_Taps];
+		double sum = 0;
+		for (size_t tap = 0; tap < m_Taps; tap++) {
+			//Distance in input frames from the tap to the output frame, which lies fraction frames after tap m_HalfTaps - 1.
+			double distance = (double)tap - (double)(m_HalfTaps - 1) - fraction;
+			double x = distance / (double)m_HalfTaps;
+			double window = std::abs(x) >= 1.0 ? 0.0 : BesselI0(beta * std::sqrt(1.0 - x * x)) * windowScale;
+			double arg = 2.0 * cutoff * distance;
+			double sinc = std::abs(arg) < 1e-12 ? 1.0 : std::sin(3.14159265358979323846 * arg) / (3.14159265358979323846 * arg);
+			double coefficient = 2.0 * cutoff * sinc * window;
+			pRow[tap] = (float)coefficient;
+			sum += coefficient;
+		}
+		//Unity gain at DC for every phase, so a constant signal comes out without ripple.
+		if (sum != 0) {
+			for (size_t tap = 0; tap < m_Taps; tap++) {
+				pRow[tap] = (float)(pRow[tap] / sum);
+			}
+		}
+	}
+}
+
+void PolyphaseResampler::BuildChannelMatrix()
+{
+	size_t inputChannels = m_InputFormat.Channels;
+	size_t outputChannels = m_OutputFormat.Channels;
+	m_ChannelMatrix.clear();
+	if (inputChannels == outputChannels) {
+		return;
+	}
+	m_ChannelMatrix.assign(outputChannels * inputChannels, 0.0f);
+	auto gain = [&](size_t output, size_t input) -> float & { return m_ChannelMatrix[output * inputChannels + input]; };
+	//Channels are in WAVEFORMATEXTENSIBLE order: FL, FR, FC, LFE, BL, BR, SL, SR.
+	if (outputChannels == 1) {
+		size_t mixedChannels = inputChannels > LFE_CHANNEL ? inputChannels - 1 : inputChannels;
+		for (size_t i = 0; i < inputChannels; i++) {
+			if (i != LFE_CHANNEL || inputChannels <= LFE_CHANNEL) {
+				gain(0, i) = 1.0f / mixedChannels;
+			}
+		}
+	}
+	else if (inputChannels == 1) {
+		gain(0, 0) = 1.0f;
+		gain(1, 0) = 1.0f;
+	}
+	else if (outputChannels == 2) {
+		//Fold the center and surrounds into the front pair and drop the LFE, then scale each side so a full scale input cannot clip.
+		for (size_t i = 0; i < inputChannels; i++) {
+			if (i == 0) {
+				gain(0, i) = 1.0f;
+			}
+			else if (i == 1) {
+				gain(1, i) = 1.0f;
+			}
+			else if (i == 2) {
+				gain(0, i) = SURROUND_DOWNMIX_GAIN;
+				gain(1, i) = SURROUND_DOWNMIX_GAIN;
+			}
+			else if (i != LFE_CHANNEL) {
+				gain(i % 2, i) = SURROUND_DOWNMIX_GAIN;
+			}
+		}
+		for (size_t output = 0; output < 2; output++) {
+			float sum = 0;
+			for (size_t i = 0; i < inputChannels; i++) {
+				sum += gain(output, i);
+			}
+			for (size_t i = 0; i < inputChannels; i++) {
+				gain(output, i) /= sum;
+			}
+		}
+	}
+	else {
+		//Channels present in both layouts are copied, and the rest of the output is left silent.
+		for (size_t i = 0; i < (std::min)(inputChannels, outputChannels); i++) {
+			gain(i, i) = 1.0f;
+		}
+	}
+}
+
+void PolyphaseResampler::AppendInput(const uint8_t *pInput, size_t frameCount)
+{
+	if (frameCount == 0) {
+		return;
+	}
+	size_t inputChannels = m_InputFormat.Channels;
+	size_t outputChannels = m_OutputFormat.Channels;
+	size_t sampleCount = frameCount * inputChannels;
+	const float *pSamples;
+	if (m_InputFormat.SampleType == AudioSampleType::Int16) {
+		m_InputScratch.resize(sampleCount);
+		GetInt16ToFloatFunc(m_Kernel)(reinterpret_cast<const int16_t *>(pInput), m_InputScratch.data(), sampleCount);
+		pSamples = m_InputScratch.data();
+	}
+	else if (reinterpret_cast<uintptr_t>(pInput) % alignof(float) == 0) {
+		pSamples = reinterpret_cast<const float *>(pInput);
+	}
+	else {
+		m_InputScratch.resize(sampleCount);
+		memcpy(m_InputScratch.data(), pInput, sampleCount * sizeof(float));
+		pSamples = m_InputScratch.data();
+	}
+
+	for (size_t output = 0; output < outputChannels; output++) {
+		std::vector<float> &history = m_History[output];
+		size_t offset = history.size();
+		history.resize(offset + frameCount);
+		float *pHistory = history.data() + offset;
+		if (m_ChannelMatrix.empty()) {
+			for (size_t frame = 0; frame < frameCount; frame++) {
+				pHistory[frame] = pSamples[frame * inputChannels + output];
+			}
+		}
+		else {
+			const float *pGains = &m_ChannelMatrix[output * inputChannels];
+			for (size_t frame = 0; frame < frameCount; frame++) {
+				const float *pFrame = pSamples + frame * inputChannels;
+				float value = 0;
+				for (size_t input = 0; input < inputChannels; input++) {
+					value += pGains[input] * pFrame[input];
+				}
+				pHistory[frame] = value;
+			}
+		}
+	}
+	m_InputFrameTotal += frameCount;
+}
+
+size_t PolyphaseResampler::Resample(size_t maxFrames)
+{
+	size_t outputChannels = m_OutputFormat.Channels;
+	size_t historyLength = m_History.empty() ? 0 : m_History[0].size();
+	m_OutputScratch.resize((std::max)(m_OutputScratch.size(), maxFrames * outputChannels));
+	float *pOutput = m_OutputScratch.data();
+	DotFunc dot = GetDotFunc(m_Kernel);
+
+	size_t frameCount = 0;
+	while (frameCount < maxFrames && m_Position + m_Taps <= historyLength) {
+		float *pFrame = pOutput + frameCount * outputChannels;
+		if (m_IsPhaseInterpolated) {
+			//The exact phase falls between two rows of the table, so the output is interpolated between the results of both.
+			double position = (double)m_Phase * (double)m_PhaseCount / (double)m_Interpolation;
+			size_t phase = (std::min)((size_t)position, m_PhaseCount - 1);
+			float weight = (float)(position - (double)phase);
+			const float *pRow = &m_Filter[phase * m_Taps];
+			for (size_t channel = 0; channel < outputChannels; channel++) {
+				const float *pSamples = m_History[channel].data() + m_Position;
+				float first = dot(pRow, pSamples, m_Taps);
+				float second = dot(pRow + m_Taps, pSamples, m_Taps);
+				pFrame[channel] = first + weight * (second - first);
+			}
+		}
+		else {
+			const float *pRow = &m_Filter[(size_t)m_Phase * m_Taps];
+			for (size_t channel = 0; channel < outputChannels; channel++) {
+				pFrame[channel] = dot(pRow, m_History[channel].data() + m_Position, m_Taps);
+			}
+		}
+		frameCount++;
+		m_Phase += m_Decimation;
+		m_Position += (size_t)(m_Phase / m_Interpolation);
+		m_Phase %= m_Interpolation;
+	}
+	return frameCount;
+}
+
+void PolyphaseResampler::WriteOutput(size_t frameCount, uint8_t *pOutput)
+{
+	size_t sampleCount = frameCount * m_OutputFormat.Channels;
+	if (m_OutputFormat.SampleType == AudioSampleType::Int16) {
+		GetFloatToInt16Func(m_Kernel)(m_OutputScratch.data(), reinterpret_cast<int16_t *>(pOutput), sampleCount);
+	}
+	else {
+		memcpy(pOutput, m_OutputScratch.data(), sampleCount * sizeof(float));
+	}
+	m_OutputFrameTotal += frameCount;
+}
+
+void PolyphaseResampler::CompactHistory()
+{
+	if (m_Position == 0 || m_History.empty()) {
+		return;
+	}
+	//When downsampling, the next output frame can start past the end of the history, so the rest of the skip carries over to the next input.
+	size_t consumed = (std::min)(m_Position, m_History[0].size());
+	for (std::vector<float> &history : m_History) {
+		history.erase(history.begin(), history.begin() + consumed);
+	}
+	m_Position -= consumed;
+}
+
+size_t PolyphaseResampler::Process(const void *pInput, size_t inputBytes, void *pOutput, size_t outputCapacityBytes)
+{
+	size_t inputFrameBytes = m_InputFormat.FrameBytes();
+	size_t outputFrameBytes = m_OutputFormat.FrameBytes();
+	if (inputFrameBytes == 0 || outputFrameBytes == 0) {
+		return 0;
+	}
+	const uint8_t *pBytes = static_cast<const uint8_t *>(pInput);
+	if (m_PartialFrameBytes > 0 && inputBytes > 0) {
+		size_t count = (std::min)(inputFrameBytes - m_PartialFrameBytes, inputBytes);
+		memcpy(m_PartialFrame.data() + m_PartialFrameBytes, pBytes, count);
+		m_PartialFrameBytes += count;
+		pBytes += count;
+		inputBytes -= count;
+		if (m_PartialFrameBytes == inputFrameBytes) {
+			AppendInput(m_PartialFrame.data(), 1);
+			m_PartialFrameBytes = 0;
+		}
+	}
+	size_t frameCount = inputBytes / inputFrameBytes;
+	AppendInput(pBytes, frameCount);
+	size_t remainder = inputBytes - frameCount * inputFrameBytes;
+	if (remainder > 0) {
+		memcpy(m_PartialFrame.data(), pBytes + frameCount * inputFrameBytes, remainder);
+		m_PartialFrameBytes = remainder;
+	}
+
+	size_t outputFrames = Resample(outputCapacityBytes / outputFrameBytes);
+	WriteOutput(outputFrames, static_cast<uint8_t *>(pOutput));
+	CompactHistory();
+	return outputFrames * outputFrameBytes;
+}
+
+size_t PolyphaseResampler::Drain(void *pOutput, size_t outputCapacityBytes)
+{
+	size_t outputFrameBytes = m_OutputFormat.FrameBytes();
+	if (outputFrameBytes == 0) {
+		return 0;
+	}
+	//Only the output frames that fall within the input are flushed, not the filter tail ringing into the silence.
+	uint64_t expectedFrames = (m_InputFrameTotal * m_Interpolation + m_Decimation - 1) / m_Decimation;
+	if (m_OutputFrameTotal >= expectedFrames) {
+		return 0;
+	}
+	for (std::vector<float> &history : m_History) {
+		history.resize(history.size() + m_HalfTaps, 0.0f);
+	}
+	size_t maxFrames = (size_t)(std::min)((uint64_t)(outputCapacityBytes / outputFrameBytes), expectedFrames - m_OutputFrameTotal);
+	size_t outputFrames = Resample(maxFrames);
+	WriteOutput(outputFrames, static_cast<uint8_t *>(pOutput));
+	CompactHistory();
+	return outputFrames * outputFrameBytes;
+}
+
+size_t PolyphaseResampler::GetMaxOutputBytes(size_t inputBytes) const
+{
+	size_t inputFrameBytes = m_InputFormat.FrameBytes();
+	if (inputFrameBytes == 0) {
+		return 0;
+	}
+	uint64_t historyFrames = m_History.empty() ? 0 : m_History[0].size();
+	uint64_t availableFrames = historyFrames + (m_PartialFrameBytes + inputBytes) / inputFrameBytes + m_HalfTaps;
+	uint64_t outputFrames = (availableFrames * m_Interpolation + m_Decimation - 1) / m_Decimation + 1;
+	return (size_t)outputFrames * m_OutputFormat.FrameBytes();
+}
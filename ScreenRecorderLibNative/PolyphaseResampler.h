@@ -0,0 +1,130 @@
+#pragma once
+#include "AudioMixer.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//Default number of filter taps on each side of an output sample, when converting between similar rates. Higher is sharper and slower.
+#define POLYPHASE_RESAMPLER_DEFAULT_HALF_FILTER_LENGTH 48
+//Largest number of filter phases kept in the filter table. Ratios that need more phases interpolate between neighbouring phases.
+#define POLYPHASE_RESAMPLER_MAX_PHASES 1024
+
+enum class AudioSampleType {
+	//Signed 16-bit integer samples.
+	Int16 = 0,
+	//32-bit float samples, nominally in [-1, 1].
+	Float32 = 1
+};
+
+struct AUDIO_SAMPLE_FORMAT {
+	uint32_t SampleRate = 0;
+	uint16_t Channels = 0;
+	AudioSampleType SampleType = AudioSampleType::Int16;
+
+	inline size_t FrameBytes() const { return (size_t)Channels * (SampleType == AudioSampleType::Int16 ? sizeof(int16_t) : sizeof(float)); }
+};
+
+/// <summary>
+/// Streaming sample rate, channel count and sample format converter for interleaved PCM audio.
+/// Input is converted to float, mixed to the output channel layout and resampled with a polyphase windowed sinc filter. The filter history is kept across calls,
+/// so a stream can be fed in chunks of any size, including partial frames, and the output is the same as if it was converted in one go.
+/// All buffers are allocated when the resampler is initialized and only grow if a call needs more room than any call before it.
+/// The filter and sample format conversions use SSE2 or AVX2 when the CPU supports it.
+/// </summary>
+class PolyphaseResampler
+{
+public:
+	PolyphaseResampler();
+	PolyphaseResampler(const PolyphaseResampler &) = delete;
+	PolyphaseResampler &operator=(const PolyphaseResampler &) = delete;
+
+	/// <summary>
+	/// Sets up the conversion and clears any buffered audio.
+	/// </summary>
+	/// <param name="inputFormat">Format of the audio passed to Process</param>
+	/// <param name="outputFormat">Format of the audio written by Process</param>
+	/// <param name="halfFilterLength">Conversion quality, as the number of filter taps on each side of an output sample. 4 (min) to 128 (max). Scaled up when downsampling.</param>
+	/// <returns>false if a format is not supported</returns>
+	bool Initialize(const AUDIO_SAMPLE_FORMAT &inputFormat, const AUDIO_SAMPLE_FORMAT &outputFormat, int halfFilterLength = POLYPHASE_RESAMPLER_DEFAULT_HALF_FILTER_LENGTH);
+
+	/// <summary>
+	/// Converts audio into a caller supplied buffer. Input that cannot be converted yet, because the filter needs samples past it or the output buffer is full, is kept for the next call.
+	/// </summary>
+	/// <param name="pInput">Interleaved input samples. The byte count does not need to be a whole number of frames.</param>
+	/// <param name="inputBytes">The number of bytes in pInput</param>
+	/// <param name="pOutput">Buffer receiving interleaved output samples</param>
+	/// <param name="outputCapacityBytes">The size of pOutput. GetMaxOutputBytes returns a size that always fits the output of the call.</param>
+	/// <returns>The number of bytes written to pOutput, always a whole number of frames</returns>
+	size_t Process(const void *pInput, size_t inputBytes, void *pOutput, size_t outputCapacityBytes);
+
+	/// <summary>
+	/// Flushes the audio still held in the filter, as if the stream was followed by silence.
+	/// </summary>
+	/// <returns>The number of bytes written to pOutput</returns>
+	size_t Drain(void *pOutput, size_t outputCapacityBytes);
+
+	/// <summary>
+	/// The largest number of bytes the next Process call can write for the given input size.
+	/// </summary>
+	size_t GetMaxOutputBytes(size_t inputBytes) const;
+
+	/// <summary>
+	/// Clears the filter history, e.g. when the input stream restarts.
+	/// </summary>
+	void Reset();
+
+	/// <summary>
+	/// Uses a specific kernel for the filter and conversions. Falls back to the best supported kernel if the requested one is not available on this CPU.
+	/// </summary>
+	void SetKernel(AudioMixer::Kernel kernel);
+
+	/// <summary>
+	/// Delay of the output relative to the input caused by the filter, in input frames.
+	/// </summary>
+	inline size_t GetLatencyFrames() const { return m_HalfTaps; }
+	inline const AUDIO_SAMPLE_FORMAT &GetInputFormat() const { return m_InputFormat; }
+	inline const AUDIO_SAMPLE_FORMAT &GetOutputFormat() const { return m_OutputFormat; }
+	inline uint64_t GetInputFrameTotal() const { return m_InputFrameTotal; }
+	inline uint64_t GetOutputFrameTotal() const { return m_OutputFrameTotal; }
+
+private:
+	AUDIO_SAMPLE_FORMAT m_InputFormat;
+	AUDIO_SAMPLE_FORMAT m_OutputFormat;
+	AudioMixer::Kernel m_Kernel;
+
+	//Resampling ratio as OutputRate/InputRate = m_Interpolation/m_Decimation, reduced to lowest terms.
+	uint64_t m_Interpolation;
+	uint64_t m_Decimation;
+	//Number of filter phases in m_Filter. Equals m_Interpolation unless the ratio needs more than POLYPHASE_RESAMPLER_MAX_PHASES phases.
+	size_t m_PhaseCount;
+	bool m_IsPhaseInterpolated;
+	size_t m_HalfTaps;
+	size_t m_Taps;
+	//m_PhaseCount + 1 rows of m_Taps coefficients. The extra row lets interpolated phases read the row after the last phase.
+	std::vector<float> m_Filter;
+	//m_OutputFormat.Channels x m_InputFormat.Channels gains, or empty if the channels map one to one.
+	std::vector<float> m_ChannelMatrix;
+
+	//Mixed, not yet consumed input, one vector per output channel.
+	std::vector<std::vector<float>> m_History;
+	//Index in m_History of the first tap for the next output frame.
+	size_t m_Position;
+	//Fractional part of the next output frame position in input frames, as a numerator over m_Interpolation.
+	uint64_t m_Phase;
+	//Bytes of an input frame split across Process calls.
+	std::vector<uint8_t> m_PartialFrame;
+	size_t m_PartialFrameBytes;
+	//Scratch buffers for the float input and output of a call.
+	std::vector<float> m_InputScratch;
+	std::vector<float> m_OutputScratch;
+
+	uint64_t m_InputFrameTotal;
+	uint64_t m_OutputFrameTotal;
+
+	void BuildFilter();
+	void BuildChannelMatrix();
+	void AppendInput(const uint8_t *pInput, size_t frameCount);
+	size_t Resample(size_t maxFrames);
+	void WriteOutput(size_t frameCount, uint8_t *pOutput);
+	void CompactHistory();
+};
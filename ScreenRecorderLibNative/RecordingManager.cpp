@@ -4,6 +4,7 @@
 #include <VersionHelpers.h>
 #include <filesystem>
 #include <WinSDKVer.h>
+#include <assert.h>
 #include "Util.h"
 #include "MF.util.h"
 #include "RecordingManager.h"
@@ -14,6 +15,10 @@
 #include "Screengrab.h"
 #include "DynamicWait.h"
 #include "HighresTimer.h"
+#include "FramePacingClock.h"
+#include "RecordingTimeline.h"
+#include "ObjectPool.h"
+#include "BlockPool.h"
 
 #pragma comment(lib, "dxguid.lib")
 #pragma comment(lib, "D3D11.lib")
@@ -65,6 +70,82 @@ struct RecordingManager::TaskWrapper {
 	Concurrency::cancellation_token_source m_RecordTaskCts;
 };
 
+//
+// A frame passed between the stages of the recorder loop.
+//
+struct PIPELINE_FRAME {
+	FrameWriteModel Model{};
+	//The copy of the captured frame. It is returned to the captured frame pool when the frame is released.
+	std::shared_ptr<ID3D11Texture2D> CapturedFrame;
+	//The processed frame, if it is a texture of the texture cache. It stays pinned in the cache until the frame is released, so later frames do not overwrite it before it is encoded.
+	std::shared_ptr<ID3D11Texture2D> ProcessedFrame;
+	std::optional<PTR_INFO> PtrInfo;
+	//The area of the output frame changed since the previous frame.
+	DirtyRegion UpdatedRegion;
+	//The time the captured frame was acquired. Overlays are drawn later, on the compose stage, and only count updates made after it.
+	INT64 AcquiredTimeStamp = 0;
+};
+//Frames are drawn from a pool and handed between the stages by moving the PooledObject. Copies for additional outputs get a pooled frame of their own.
+typedef PooledObject<PIPELINE_FRAME> PooledFrame;
+
+/// <summary>
+/// The area of a texture saved to a snapshot. A texture larger than the destination rect is cropped to it, to avoid black borders around the snapshots, else the whole texture is saved.
+/// </summary>
+static RECT GetSnapshotSourceRect(_In_ ID3D11Texture2D *pTexture, _In_ RECT destRect)
+{
+	D3D11_TEXTURE2D_DESC frameDesc;
+	pTexture->GetDesc(&frameDesc);
+	if ((LONG)frameDesc.Width <= RectWidth(destRect) && (LONG)frameDesc.Height <= RectHeight(destRect)) {
+		return RECT{ 0, 0, (LONG)frameDesc.Width, (LONG)frameDesc.Height };
+	}
+	if (RectWidth(destRect) > (LONG)frameDesc.Width) {
+		destRect.right -= RectWidth(destRect) - frameDesc.Width;
+	}
+	if (RectHeight(destRect) > (LONG)frameDesc.Height) {
+		destRect.bottom -= RectHeight(destRect) - frameDesc.Height;
+	}
+	return destRect;
+}
+
+static void LogPipelineStageStats(_In_ const wchar_t *stageName, _In_ const PIPELINE_STAGE_STATS &stats)
+{
+	double averageQueueMillis = stats.Processed > 0 ? HundredNanosToMillisDouble(stats.TotalQueueLatency / (INT64)stats.Processed) : 0;
+	double averageProcessingMillis = stats.Processed > 0 ? HundredNanosToMillisDouble(stats.TotalProcessingTime / (INT64)stats.Processed) : 0;
+	LOG_DEBUG(L"%ls stage: %llu frames processed, %llu dropped, %llu shed, %llu blocked for %.2f ms. Queue latency avg %.2f ms, max %.2f ms. Processing time avg %.2f ms, max %.2f ms. Max queue depth %zu",
+		stageName,
+		stats.Processed,
+		stats.Dropped,
+		stats.Shed,
+		stats.Blocked,
+		HundredNanosToMillisDouble(stats.TotalBlockedTime),
+		averageQueueMillis,
+		HundredNanosToMillisDouble(stats.MaxQueueLatency),
+		averageProcessingMillis,
+		HundredNanosToMillisDouble(stats.MaxProcessingTime),
+		stats.MaxQueueDepth);
+}
+
+static void LogRecordingStats(_In_ const RECORDING_STATS &stats)
+{
+	for (size_t i = 0; i < (size_t)RecordingTimer::Count; i++) {
+		const HISTOGRAM_SNAPSHOT &timer = stats.Timers[i];
+		if (timer.Count == 0) {
+			continue;
+		}
+		LOG_DEBUG(L"%ls: %llu samples. Mean %.2f ms, p50 %.2f ms, p90 %.2f ms, p99 %.2f ms, max %.2f ms",
+			RecordingMetrics::GetTimerName((RecordingTimer)i),
+			timer.Count,
+			HundredNanosToMillisDouble((INT64)timer.Mean),
+			HundredNanosToMillisDouble(timer.P50),
+			HundredNanosToMillisDouble(timer.P90),
+			HundredNanosToMillisDouble(timer.P99),
+			HundredNanosToMillisDouble(timer.Max));
+	}
+	for (size_t i = 0; i < (size_t)RecordingCounter::Count; i++) {
+		LOG_DEBUG(L"%ls: %llu", RecordingMetrics::GetCounterName((RecordingCounter)i), stats.Counters[i]);
+	}
+}
+
 RecordingManager::RecordingManager() :
 	m_TaskWrapperImpl(make_unique<TaskWrapper>()),
 	RecordingCompleteCallback(nullptr),
@@ -72,6 +153,7 @@ RecordingManager::RecordingManager() :
 	RecordingSnapshotCreatedCallback(nullptr),
 	RecordingStatusChangedCallback(nullptr),
 	RecordingFrameNumberChangedCallback(nullptr),
+	RecordingSegmentCompleteCallback(nullptr),
 	m_TextureManager(nullptr),
 	m_OutputManager(nullptr),
 	m_CaptureManager(nullptr),
@@ -81,10 +163,12 @@ RecordingManager::RecordingManager() :
 	m_MouseOptions(new MOUSE_OPTIONS),
 	m_SnapshotOptions(new SNAPSHOT_OPTIONS),
 	m_OutputOptions(new OUTPUT_OPTIONS),
+	m_Metrics(make_shared<RecordingMetrics>()),
 	m_IsDestructing(false),
 	m_RecordingSources{},
 	m_DxResources{},
-	m_FrameDataCallbackTexture(nullptr)
+	m_FramePreviewRing(nullptr),
+	m_FramePreviewDispatcher(nullptr)
 {
 	_CrtSetDbgFlag(_CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF);
 	m_MfStartupResult = MFStartup(MF_VERSION, MFSTARTUP_LITE);
@@ -95,7 +179,6 @@ RecordingManager::RecordingManager() :
 		m_TimerResolution = min(max(tc.wPeriodMin, targetResolutionMs), tc.wPeriodMax);
 		timeBeginPeriod(m_TimerResolution);
 	}
-	RtlZeroMemory(&m_FrameDataCallbackTextureDesc, sizeof(m_FrameDataCallbackTextureDesc));
 }
 
 RecordingManager::~RecordingManager()
@@ -111,19 +194,19 @@ RecordingManager::~RecordingManager()
 	if (m_TimerResolution > 0) {
 		timeEndPeriod(m_TimerResolution);
 	}
-	SafeRelease(&m_FrameDataCallbackTexture);
 	ClearRecordingSources();
 	ClearOverlays();
 	CleanDx(&m_DxResources);
 	MFShutdown();
 	LOG_INFO(L"Media Foundation shut down");
+	FlushLog();
 }
 
 void RecordingManager::SetLogEnabled(bool value) {
 	isLoggingEnabled = value;
 }
 void RecordingManager::SetLogFilePath(std::wstring value) {
-	logFilePath = value;
+	SetLogFile(value);
 }
 void RecordingManager::SetLogSeverityLevel(int value) {
 	logSeverityLevel = value;
@@ -189,6 +272,31 @@ HRESULT RecordingManager::TakeSnapshot(_In_ IStream *stream)
 	return TakeSnapshot(L"", stream);
 }
 
+HRESULT RecordingManager::SaveReplay(_In_ std::wstring path)
+{
+	if (!m_IsRecording || !m_OutputManager || !GetOutputOptions()->IsReplayBufferEnabled()) {
+		return E_NOT_VALID_STATE;
+	}
+	std::wstring directory = std::filesystem::path(path).parent_path().wstring();
+	if (!directory.empty() && !std::filesystem::exists(directory))
+	{
+		std::error_code ec;
+		if (!std::filesystem::create_directories(directory, ec)) {
+			LOG_ERROR(L"failed to create replay output folder");
+			return E_FAIL;
+		}
+	}
+	return m_OutputManager->SaveReplay(path);
+}
+
+HRESULT RecordingManager::SaveReplay(_In_ IStream *stream)
+{
+	if (!m_IsRecording || !m_OutputManager || !GetOutputOptions()->IsReplayBufferEnabled()) {
+		return E_NOT_VALID_STATE;
+	}
+	return m_OutputManager->SaveReplay(stream);
+}
+
 HRESULT RecordingManager::TakeSnapshot(_In_opt_ std::wstring path, _In_opt_ IStream *stream, _In_opt_ ID3D11Texture2D *pTexture) {
 	if (!m_IsRecording) {
 		return E_NOT_VALID_STATE;
@@ -198,9 +306,10 @@ HRESULT RecordingManager::TakeSnapshot(_In_opt_ std::wstring path, _In_opt_ IStr
 	if (!pTexture) {
 		CAPTURED_FRAME capturedFrame{};
 		if (m_IsPaused) {
+			//The acquired frame is kept by the capture manager as the base for partial updates, so the snapshot is drawn on a copy of it.
 			hr = m_CaptureManager->AcquireNextFrame(0, m_MaxFrameLengthMillis, &capturedFrame);
 			if (SUCCEEDED(hr)) {
-				capturedFrame.Frame->AddRef();
+				hr = m_CaptureManager->CopyCurrentFrame(&capturedFrame);
 			}
 		}
 		else {
@@ -208,7 +317,7 @@ HRESULT RecordingManager::TakeSnapshot(_In_opt_ std::wstring path, _In_opt_ IStr
 		}
 
 		RETURN_ON_BAD_HR(hr);
-		hr = ProcessTexture(capturedFrame.Frame, &processedTexture, capturedFrame.PtrInfo);
+		hr = ProcessTexture(capturedFrame.Frame, capturedFrame.AcquiredTimeStamp, &processedTexture, capturedFrame.PtrInfo, std::nullopt);
 		SafeRelease(&capturedFrame.Frame);
 	}
 	else {
@@ -218,19 +327,7 @@ HRESULT RecordingManager::TakeSnapshot(_In_opt_ std::wstring path, _In_opt_ IStr
 	RETURN_ON_BAD_HR(hr = InitializeRects(m_CaptureManager->GetOutputSize(), &videoInputFrameRect, nullptr));
 
 	if (!path.empty()) {
-		std::wstring directory = std::filesystem::path(path).parent_path().wstring();
-		if (!std::filesystem::exists(directory))
-		{
-			std::error_code ec;
-			if (std::filesystem::create_directories(directory, ec)) {
-				LOG_DEBUG(L"Snapshot output folder created");
-			}
-			else {
-				// Failed to create snapshot directory.
-				LOG_ERROR(L"failed to create snapshot output folder");
-				return E_FAIL;
-			}
-		}
+		RETURN_ON_BAD_HR(hr = CreateSnapshotDirectory(path));
 		RETURN_ON_BAD_HR(hr = SaveTextureAsVideoSnapshot(processedTexture, path, videoInputFrameRect));
 		LOG_TRACE(L"Wrote snapshot to %s", path.c_str());
 		if (RecordingSnapshotCreatedCallback != nullptr) {
@@ -252,6 +349,24 @@ HRESULT RecordingManager::TakeSnapshot(_In_opt_ std::wstring path, _In_opt_ IStr
 	return hr;
 }
 
+HRESULT RecordingManager::CreateSnapshotDirectory(_In_ const std::wstring &snapshotPath)
+{
+	std::wstring directory = std::filesystem::path(snapshotPath).parent_path().wstring();
+	if (!std::filesystem::exists(directory))
+	{
+		std::error_code ec;
+		if (std::filesystem::create_directories(directory, ec)) {
+			LOG_DEBUG(L"Snapshot output folder created");
+		}
+		else {
+			// Failed to create snapshot directory.
+			LOG_ERROR(L"failed to create snapshot output folder");
+			return E_FAIL;
+		}
+	}
+	return S_OK;
+}
+
 HRESULT RecordingManager::BeginRecording(_In_ IStream *stream) {
 	return BeginRecording(L"", stream);
 }
@@ -281,6 +396,7 @@ HRESULT RecordingManager::BeginRecording(_In_opt_ std::wstring path, _In_opt_ IS
 		return S_FALSE;
 	}
 	m_EncoderResult = S_FALSE;
+	m_Metrics->Reset();
 	RETURN_ON_BAD_HR(ConfigureOutputDir(path));
 
 	if (m_RecordingSources.size() == 0) {
@@ -302,17 +418,48 @@ HRESULT RecordingManager::BeginRecording(_In_opt_ std::wstring path, _In_opt_ IS
 		m_TextureManager = make_unique<TextureManager>();
 		RETURN_RESULT_ON_BAD_HR(hr = m_TextureManager->Initialize(m_DxResources.Context, m_DxResources.Device), L"Failed to initialize TextureManager");
 		m_OutputManager = make_unique<OutputManager>();
-		RETURN_RESULT_ON_BAD_HR(hr = m_OutputManager->Initialize(m_DxResources.Context, m_DxResources.Device, GetEncoderOptions(), GetAudioOptions(), GetSnapshotOptions(), GetOutputOptions()), L"Failed to initialize OutputManager");
+		m_OutputManager->SetSegmentCompleteCallback(CreateSegmentCompleteCallback());
+		RETURN_RESULT_ON_BAD_HR(hr = m_OutputManager->Initialize(m_DxResources.Context, m_DxResources.Device, GetEncoderOptions(), GetAudioOptions(), GetSnapshotOptions(), GetOutputOptions(), m_Metrics), L"Failed to initialize OutputManager");
+		m_SnapshotPipeline = make_unique<SnapshotPipeline>();
+		RETURN_RESULT_ON_BAD_HR(hr = m_SnapshotPipeline->Initialize(m_DxResources.Context, m_DxResources.Device, GetSnapshotOptions(), m_Metrics), L"Failed to initialize SnapshotPipeline");
+		m_AdditionalOutputs.clear();
+		if (GetOutputOptions()->GetRecorderMode() == RecorderModeInternal::Video) {
+			for each (RECORDING_OUTPUT options in m_RecordingOutputs)
+			{
+				auto pOutput = make_unique<ADDITIONAL_OUTPUT>();
+				pOutput->Options = options;
+				pOutput->Options.EncoderOptions = options.EncoderOptions ? options.EncoderOptions : GetEncoderOptions();
+				pOutput->Options.OutputOptions = options.OutputOptions ? options.OutputOptions : make_shared<OUTPUT_OPTIONS>();
+				//The frames are shared with the main output, so they arrive at its frame rate.
+				pOutput->Options.EncoderOptions->SetVideoFps(GetEncoderOptions()->GetVideoFps());
+				pOutput->Options.EncoderOptions->SetFixedFramerate(GetEncoderOptions()->GetIsFixedFramerate());
+				pOutput->Options.OutputOptions->SetRecorderMode(RecorderModeInternal::Video);
+				RETURN_RESULT_ON_BAD_HR(hr = InitializeAdditionalOutput(pOutput.get()), L"Failed to initialize additional output");
+				m_AdditionalOutputs.push_back(std::move(pOutput));
+			}
+		}
 		m_CaptureManager = make_unique<ScreenCaptureManager>();
-		RETURN_RESULT_ON_BAD_HR(m_CaptureManager->Initialize(m_DxResources.Context, m_DxResources.Device, GetOutputOptions(), GetEncoderOptions(), GetMouseOptions()), L"Failed to initialize ScreenCaptureManager");
+		RETURN_RESULT_ON_BAD_HR(m_CaptureManager->Initialize(m_DxResources.Context, m_DxResources.Device, GetOutputOptions(), GetEncoderOptions(), GetMouseOptions(), m_Metrics), L"Failed to initialize ScreenCaptureManager");
 		m_MouseManager = make_unique<MouseManager>();
 		RETURN_RESULT_ON_BAD_HR(hr = m_MouseManager->Initialize(m_DxResources.Context, m_DxResources.Device, GetMouseOptions()), L"Failed to initialize mouse manager");
+		//Mouse clicks are timestamped with the media clock, so they are drawn in the frames shown at the time they were made.
+		m_MouseManager->SetMediaClock([this](INT64 *pTimestamp) { return m_OutputManager->GetMediaTimeStamp(pTimestamp); });
 
 		result = StartRecorderLoop(m_RecordingSources, m_Overlays, stream);
+		//Snapshots taken during the recording are written before it is reported as complete.
+		m_SnapshotPipeline->Drain();
+		LogPipelineStageStats(L"Snapshot", m_SnapshotPipeline->GetStats());
 		if (RecordingStatusChangedCallback != nullptr && !m_IsDestructing) {
 			RecordingStatusChangedCallback(STATUS_FINALIZING);
 		}
 		result.FinalizeResult = m_OutputManager->FinalizeRecording();
+		for (auto &pOutput : m_AdditionalOutputs) {
+			HRESULT finalizeHr = pOutput->Output->FinalizeRecording();
+			if (FAILED(finalizeHr)) {
+				LOG_ERROR(L"Failed to finalize additional output %ls: hr = 0x%08x", pOutput->Options.Path.c_str(), finalizeHr);
+			}
+		}
+		LogRecordingStats(m_Metrics->GetStats());
 		CoUninitialize();
 
 		LOG_INFO("Exiting recording task");
@@ -331,6 +478,8 @@ HRESULT RecordingManager::BeginRecording(_In_opt_ std::wstring path, _In_opt_ IS
 					catch (...) {
 						LOG_ERROR(L"Exception in RecordTask");
 					}
+					m_AdditionalOutputs.clear();
+					m_SnapshotPipeline.reset(nullptr);
 					CleanupDxResources();
 					if (!m_IsDestructing) {
 						nlohmann::fifo_map<std::wstring, int> delays{};
@@ -449,6 +598,7 @@ void RecordingManager::SetRecordingCompleteStatus(_In_ REC_RESULT result, nlohma
 			LOG_DEBUG("Sent Recording Failed callback");
 		}
 	}
+	FlushLog();
 }
 
 REC_RESULT RecordingManager::StartRecorderLoop(_In_ const std::vector<RECORDING_SOURCE *> &sources, _In_ const std::vector<RECORDING_OVERLAY *> &overlays, _In_opt_ IStream *pStream)
@@ -495,6 +645,18 @@ REC_RESULT RecordingManager::StartRecorderLoop(_In_ const std::vector<RECORDING_
 	else {
 		RETURN_RESULT_ON_BAD_HR(hr = m_OutputManager->BeginRecording(m_OutputFullPath, videoOutputFrameSize), L"Failed to initialize video sink writer");
 	}
+	for (auto &pOutput : m_AdditionalOutputs) {
+		SIZE frameSize = pOutput->Options.OutputOptions->GetFrameSize().value_or(SIZE{});
+		pOutput->FrameSize = frameSize.cx > 0 && frameSize.cy > 0 ? SIZE{ MakeEven(frameSize.cx), MakeEven(frameSize.cy) } : videoOutputFrameSize;
+		if (pOutput->FrameSize.cx > videoOutputFrameSize.cx || pOutput->FrameSize.cy > videoOutputFrameSize.cy) {
+			LOG_WARN(L"Additional output %ls has a frame size of %dx%d, larger than the %dx%d of the main output. Its frames are scaled up from the frames of the main output, so they are not sharper than those.",
+				pOutput->Options.Path.c_str(), pOutput->FrameSize.cx, pOutput->FrameSize.cy, videoOutputFrameSize.cx, videoOutputFrameSize.cy);
+		}
+		std::error_code ec;
+		std::filesystem::create_directories(std::filesystem::path(pOutput->Options.Path).parent_path(), ec);
+		RETURN_RESULT_ON_BAD_HR(hr = pOutput->Output->BeginRecording(pOutput->Options.Path, pOutput->FrameSize), L"Failed to initialize video sink writer of additional output");
+		LOG_DEBUG(L"Recording additional output with frame size %dx%d to %ls", pOutput->FrameSize.cx, pOutput->FrameSize.cy, pOutput->Options.Path.c_str());
+	}
 	pAudioManager->ClearRecordedBytes();
 
 	std::chrono::steady_clock::time_point previousSnapshotTaken = (std::chrono::steady_clock::time_point::min)();
@@ -508,10 +670,51 @@ REC_RESULT RecordingManager::StartRecorderLoop(_In_ const std::vector<RECORDING_
 	INT64 videoFrameDuration100Nanos = MillisToHundredNanos(videoFrameDurationMillis);
 
 	int frameNr = 0;
-	INT64 lastFrameStartPos100Nanos = 0;
+	int capturedFrameCount = 0;
+	//Places the captured frames on the timeline, on the capture thread.
+	RecordingTimeline timeline{};
+	//Stretches the frames to the length of their audio, on the compose thread.
+	AudioTimelineAligner audioAligner{};
+	//The area the mouse pointer was last drawn to, and when it was last updated.
+	RECT previousPointerBounds{};
+	LARGE_INTEGER previousPointerTimeStamp{};
+	//Changes not yet carried by an encoded frame, e.g. those of frames dropped after the frame that replaced them. They are added to the next frame.
+	DirtyRegion pendingRegion{};
+	//False when the frame preview has missed a frame, so the next one must be read back in full.
+	bool isFramePreviewCurrent = false;
 	cancellation_token token = m_TaskWrapperImpl->m_RecordTaskCts.get_token();
 	DynamicWait retryWait{};
-	INT64 totalDiff = 0;
+
+	//Only video recordings may drop frames. Slideshows and screenshots must write every captured frame.
+	size_t frameQueueSize = max(1u, GetEncoderOptions()->GetFrameQueueSize());
+	PipelineDropPolicy frameDropPolicy = recorderMode == RecorderModeInternal::Video ? GetEncoderOptions()->GetFrameDropPolicy() : PipelineDropPolicy::Block;
+	//Each captured frame is copied to a pooled texture owned by the frame, because the capture manager reuses its frame texture for the next capture.
+	std::shared_ptr<TexturePool> pCapturedFramePool;
+	auto CreateCapturedFramePool([&]() {
+		//Room for a full queue on both stages, the frames in flight in each stage and the frame being captured.
+		//Additional outputs hold on to frames too, up to the frames they queue before shedding, the one in flight and the one carried over.
+		pCapturedFramePool = make_shared<TexturePool>(make_unique<D3D11TextureAllocator>(m_DxResources.Device), frameQueueSize * 2 + 3 + m_AdditionalOutputs.size() * (frameQueueSize + 2));
+	});
+	CreateCapturedFramePool();
+	//The frames and the references to their textures are drawn from pools created up front, so handing a frame from the capture loop to the outputs does not allocate.
+	//Room for a full queue and a frame in flight on both stages and the frame being captured, and for each additional output
+	//a full queue, the frame in flight, the frame carried over and the frames being shed and copied to it.
+	size_t framePoolDepth = frameQueueSize * 2 + 4 + m_AdditionalOutputs.size() * (frameQueueSize * 8 + 4);
+	AllocationTracker frameAllocationTracker{};
+	std::shared_ptr<ObjectPool<PIPELINE_FRAME>> pFramePool = ObjectPool<PIPELINE_FRAME>::Create(framePoolDepth, [](PIPELINE_FRAME &frame) {
+		frame.Model = FrameWriteModel{};
+		frame.CapturedFrame.reset();
+		frame.ProcessedFrame.reset();
+		frame.PtrInfo.reset();
+		frame.UpdatedRegion.Clear();
+		frame.AcquiredTimeStamp = 0;
+	}, &frameAllocationTracker);
+	//Each frame references its captured and its processed texture.
+	std::shared_ptr<BlockPool> pFrameBlockPool = make_shared<BlockPool>(framePoolDepth * 2, &frameAllocationTracker);
+	HRESULT pipelineHr = S_OK;
+	//The stages share the immediate context. Single calls on it are serialized by the multithread protection of the device,
+	//but sequences that set up pipeline state and draw, like drawing the mouse pointer or resizing, must not interleave.
+	std::mutex renderMutex;
 
 	auto IsAnySourcePreviewsActive([&]()
 		{
@@ -524,12 +727,23 @@ REC_RESULT RecordingManager::StartRecorderLoop(_In_ const std::vector<RECORDING_
 			return false;
 		});
 
+	//Frames are scheduled on the media clock, on a grid from the first frame rather than one frame duration after the last one was taken,
+	//so the time spent waking up and taking each frame does not lower the frame rate. Fixed framerate recordings skip the frames they are too late for,
+	//while others restart the grid after the capture was idle.
+	FramePacer framePacer(make_shared<MediaClockPacingClock>([&](INT64 *pTimestamp) { return m_OutputManager->GetMediaTimeStamp(pTimestamp); }),
+		recorderMode == RecorderModeInternal::Video && GetEncoderOptions()->GetIsFixedFramerate() ? FramePacingMode::FixedRate : FramePacingMode::VariableRate);
+	if (recorderMode == RecorderModeInternal::Video) {
+		framePacer.SetFrameRate(GetEncoderOptions()->GetVideoFps());
+	}
+	else {
+		framePacer.SetInterval(videoFrameDuration100Nanos);
+	}
+	//Paces the source previews while the recording is paused and the media clock is stopped.
+	FramePacer pausedPreviewPacer(make_shared<HighresTimerPacingClock>(), FramePacingMode::FixedRate);
+	pausedPreviewPacer.SetInterval(videoFrameDuration100Nanos);
+
 	auto GetTimeUntilNextFrameMillis([&]() {
-		INT64 timestamp;
-		m_OutputManager->GetMediaTimeStamp(&timestamp);
-		INT64 durationSinceLastFrame100Nanos = timestamp - lastFrameStartPos100Nanos;
-		INT64 nanosRemaining = max(0, videoFrameDuration100Nanos - durationSinceLastFrame100Nanos);
-		return HundredNanosToMillisDouble(nanosRemaining);
+		return HundredNanosToMillisDouble(framePacer.GetTimeUntilNextFrame());
 		});
 
 	auto IsTimeToTakeSnapshot([&]()
@@ -539,48 +753,275 @@ REC_RESULT RecordingManager::StartRecorderLoop(_In_ const std::vector<RECORDING_
 			(std::chrono::steady_clock::now() - previousSnapshotTaken) > GetSnapshotOptions()->GetSnapshotsInterval();
 	});
 
-	auto PrepareAndRenderFrame([&](CComPtr<ID3D11Texture2D> pTextureToRender, INT64 duration100Nanos)->HRESULT {
-		CComPtr<ID3D11Texture2D> processedTexture;
-		HRESULT renderHr = ProcessTexture(pTextureToRender, &processedTexture, pPtrInfo);
-		if (renderHr == S_OK) {
-			pTextureToRender.Release();
-			pTextureToRender.Attach(processedTexture);
-			(*pTextureToRender).AddRef();
-		}
-		if (recorderMode == RecorderModeInternal::Video) {
-			if (GetSnapshotOptions()->IsSnapshotWithVideoEnabled() && IsTimeToTakeSnapshot()) {
-				if (GetSnapshotOptions()->GetSnapshotsDirectory().empty())
-					return S_FALSE;
-				wstring snapshotPath = GetSnapshotOptions()->GetSnapshotsDirectory() + L"\\" + s2ws(CurrentTimeToFormattedString(true)) + GetSnapshotOptions()->GetImageExtension();
-				TakeSnapshot(snapshotPath, nullptr, pTextureToRender);
-				previousSnapshotTaken = steady_clock::now();
-			}
+	auto CopyCapturedFrame([&](_In_ ID3D11Texture2D *pFrame, _Out_ std::shared_ptr<ID3D11Texture2D> *pFrameCopy)->HRESULT {
+		D3D11_TEXTURE2D_DESC desc;
+		pFrame->GetDesc(&desc);
+		std::shared_ptr<TexturePool> pFramePool = pCapturedFramePool;
+		ID3D11Texture2D *pTexture = nullptr;
+		if (!pFramePool->Acquire(desc, &pTexture)) {
+			return E_OUTOFMEMORY;
 		}
+		m_DxResources.Context->CopyResource(pTexture, pFrame);
+		pFrameCopy->reset(pTexture, [pFramePool, desc](ID3D11Texture2D *pTexture) {
+			pFramePool->Release(desc, pTexture);
+		}, BlockPoolAllocator<ID3D11Texture2D>(pFrameBlockPool));
+		return S_OK;
+	});
 
-		INT64 diff = 0;
-		auto audioBytes = pAudioManager->GrabAudioFrame(duration100Nanos);
-		if (audioBytes.size() > 0) {
-			INT64 frameCount = audioBytes.size() / (INT64)((GetAudioOptions()->GetAudioBitsPerSample() / 8) * GetAudioOptions()->GetAudioChannels());
-			INT64 newDuration = (frameCount * 10 * 1000 * 1000) / GetAudioOptions()->GetAudioSamplesPerSecond();
-			diff = newDuration - duration100Nanos;
+	auto InitializePipelineThread([]() {
+		HRESULT hr = CoInitializeEx(nullptr, COINITBASE_MULTITHREADED | COINIT_DISABLE_OLE1DDE);
+		if (FAILED(hr)) {
+			LOG_ERROR(L"CoInitializeEx failed on pipeline thread: hr = 0x%08x", hr);
 		}
+	});
 
-		FrameWriteModel model{};
-		model.Frame = pTextureToRender;
-		model.Duration = duration100Nanos + diff;
-		model.StartPos = lastFrameStartPos100Nanos + totalDiff;
-		model.Audio = audioBytes;
-		RETURN_ON_BAD_HR(renderHr = m_EncoderResult = m_OutputManager->RenderFrame(model));
+	//Encode stage: writes processed frames and their audio to the main output, and to each additional output on a thread of its own.
+	PipelineFanOut<PooledFrame> encodeStage;
+	encodeStage.AddOutput(frameQueueSize, PipelineDropPolicy::Block, [&](PooledFrame &frame) {
+		//RenderFrame consumes the model, so keep a reference to the frame for the frame callback.
+		CComPtr<ID3D11Texture2D> pRenderedFrame = frame->Model.Frame;
+		HRESULT renderHr = m_EncoderResult = m_OutputManager->RenderFrame(std::move(frame->Model));
+		if (FAILED(renderHr)) {
+			pipelineHr = renderHr;
+			return false;
+		}
+		//Unchanged frames only extend the previous frame, so they are not reported as new frames.
+		if (!pRenderedFrame) {
+			return true;
+		}
 		frameNr++;
-		totalDiff += diff;
 		if (RecordingFrameNumberChangedCallback != nullptr && !m_IsDestructing) {
-			SendNewFrameCallback(frameNr, pTextureToRender);
+			std::lock_guard<std::mutex> renderLock(renderMutex);
+			HRESULT callbackHr = SendNewFrameCallback(frameNr, pRenderedFrame, isFramePreviewCurrent ? &frame->UpdatedRegion : nullptr);
+			isFramePreviewCurrent = SUCCEEDED(callbackHr) && m_OutputOptions->IsVideoFramePreviewEnabled();
+		}
+		else {
+			isFramePreviewCurrent = false;
 		}
-		lastFrameStartPos100Nanos += duration100Nanos;
-		return renderHr;
+		return true;
+	});
+	//An additional output that falls behind sheds frames, encoding the audio and extending the previous frame instead, so it does not throttle the main output.
+	//At a fixed framerate the previous frame is written again for the shed frames.
+	//An additional output that fails is detached, and the recording goes on without it.
+	for (auto &pOutput : m_AdditionalOutputs) {
+		ADDITIONAL_OUTPUT *output = pOutput.get();
+		encodeStage.AddOptionalOutput(frameQueueSize * 8, frameQueueSize, [&, output](PooledFrame &frame) {
+			if (frame->Model.Frame) {
+				std::lock_guard<std::mutex> renderLock(renderMutex);
+				D3D11_TEXTURE2D_DESC desc;
+				frame->Model.Frame->GetDesc(&desc);
+				RECT frameRect{ 0, 0, static_cast<LONG>(desc.Width), static_cast<LONG>(desc.Height) };
+				CComPtr<ID3D11Texture2D> pResizedFrame;
+				HRESULT resizeHr = ProcessTextureTransforms(frame->Model.Frame, &pResizedFrame, frameRect, output->FrameSize, output->Options.OutputOptions->GetStretch(), output->Textures.get());
+				output->Textures->EndFrame();
+				if (FAILED(resizeHr)) {
+					LOG_ERROR(L"Failed to resize frame for additional output %ls, it is stopped: hr = 0x%08x", output->Options.Path.c_str(), resizeHr);
+					return false;
+				}
+				frame->Model.Frame = pResizedFrame;
+			}
+			HRESULT renderHr = output->Output->RenderFrame(std::move(frame->Model));
+			if (FAILED(renderHr)) {
+				LOG_ERROR(L"Failed to write frame to additional output %ls, it is stopped: hr = 0x%08x", output->Options.Path.c_str(), renderHr);
+				return false;
+			}
+			return true;
+		},
+			[&](PooledFrame &source, PooledFrame &destination) {
+			if (!source || !source->Model.Frame || (destination && destination->Model.Frame)) {
+				return;
+			}
+			if (!destination) {
+				destination = pFramePool->Acquire();
+			}
+			//The shed frame keeps the textures it was made from, so they are not reused before it is encoded.
+			destination->Model.Frame = std::move(source->Model.Frame);
+			destination->CapturedFrame = std::move(source->CapturedFrame);
+			destination->ProcessedFrame = std::move(source->ProcessedFrame);
+		});
+	}
+
+	//Compose stage: draws overlays and the mouse pointer, crops and resizes the frame, takes snapshots and grabs the audio for the frame duration.
+	//The audio is grabbed here and not in the encode stage, so a full encode queue throttles this stage instead of dropping frames with audio already attached.
+	PipelineStage<PooledFrame> composeStage(frameQueueSize, frameDropPolicy, [&](PooledFrame &pFrame) {
+		PIPELINE_FRAME &frame = *pFrame;
+		{
+			std::lock_guard<std::mutex> renderLock(renderMutex);
+			MeasureRecordingTimer measureTextureProcessing(m_Metrics.get(), RecordingTimer::TextureProcessing);
+			if (frame.Model.Frame) {
+				CComPtr<ID3D11Texture2D> processedTexture;
+				if (ProcessTexture(frame.Model.Frame, frame.AcquiredTimeStamp, &processedTexture, frame.PtrInfo, FRAME_TIMING{ frame.Model.StartPos, frame.Model.Duration }) == S_OK) {
+					frame.Model.Frame = processedTexture;
+					frame.ProcessedFrame = m_TextureManager->PinTexture(processedTexture, pFrameBlockPool);
+				}
+				m_TextureManager->EndFrame();
+			}
+			if (recorderMode == RecorderModeInternal::Video) {
+				if (GetSnapshotOptions()->IsSnapshotWithVideoEnabled()
+					&& !GetSnapshotOptions()->GetSnapshotsDirectory().empty()
+					&& IsTimeToTakeSnapshot()) {
+					wstring snapshotPath = GetSnapshotOptions()->GetSnapshotsDirectory() + L"\\" + s2ws(CurrentTimeToFormattedString(true)) + GetSnapshotOptions()->GetImageExtension();
+					RECT videoInputFrameRect{};
+					if (SUCCEEDED(CreateSnapshotDirectory(snapshotPath))
+						&& SUCCEEDED(InitializeRects(m_CaptureManager->GetOutputSize(), &videoInputFrameRect, nullptr))) {
+						//Only the copy of the frame is made here, so a slow encode does not hold up the frames behind it.
+						SaveTextureAsVideoSnapshotAsync(frame.Model.Frame, snapshotPath, videoInputFrameRect, [this, snapshotPath](HRESULT hr) {
+							if (SUCCEEDED(hr)) {
+								LOG_TRACE(L"Wrote snapshot to %s", snapshotPath.c_str());
+								if (RecordingSnapshotCreatedCallback != nullptr) {
+									RecordingSnapshotCreatedCallback(snapshotPath);
+								}
+							}
+						});
+					}
+					previousSnapshotTaken = steady_clock::now();
+				}
+			}
+		}
+
+		MeasureRecordingTimer measureAudioGrab(m_Metrics.get(), RecordingTimer::AudioGrab);
+		frame.Model.Audio = pAudioManager->GrabAudioFrame(frame.Model.Duration);
+		measureAudioGrab.Stop();
+		UINT64 audioFrameCount = 0;
+		if (frame.Model.Audio.Length() > 0) {
+			audioFrameCount = frame.Model.Audio.Length() / (UINT64)((GetAudioOptions()->GetAudioBitsPerSample() / 8) * GetAudioOptions()->GetAudioChannels());
+		}
+		FRAME_TIMING timing{ frame.Model.StartPos, frame.Model.Duration };
+		audioAligner.Align(timing, audioFrameCount, GetAudioOptions()->GetAudioSamplesPerSecond());
+		frame.Model.StartPos = timing.StartPos;
+		frame.Model.Duration = timing.Duration;
+		if (frame.Model.Audio && encodeStage.GetOutputCount() > 1) {
+			//The outputs share the audio buffer and commit it before writing it, so it is committed here instead of racing between the output threads.
+			frame.Model.Audio->Commit();
+		}
+		return encodeStage.Push(std::move(pFrame));
+	},
+		[&](PooledFrame &pDropped, PooledFrame &pSurvivor) {
+		PIPELINE_FRAME &dropped = *pDropped;
+		PIPELINE_FRAME &survivor = *pSurvivor;
+		m_Metrics->Increment(RecordingCounter::DroppedFrames);
+		//Fold the dropped frame into the one that takes its place, so the timeline and the audio grabbed for it stay continuous.
+		FRAME_TIMING survivorTiming{ survivor.Model.StartPos, survivor.Model.Duration };
+		FoldDroppedFrameTiming(survivorTiming, FRAME_TIMING{ dropped.Model.StartPos, dropped.Model.Duration });
+		survivor.Model.StartPos = survivorTiming.StartPos;
+		survivor.Model.Duration = survivorTiming.Duration;
+		if (dropped.Model.Frame && !survivor.Model.Frame) {
+			//The survivor only extends the frame before it, so it takes over the content of the dropped frame, or the changes in it would be lost.
+			survivor.Model.Frame = std::move(dropped.Model.Frame);
+			survivor.CapturedFrame = std::move(dropped.CapturedFrame);
+			survivor.PtrInfo = dropped.PtrInfo;
+			survivor.AcquiredTimeStamp = dropped.AcquiredTimeStamp;
+			survivor.UpdatedRegion.Add(dropped.UpdatedRegion);
+		}
+		else if (frameDropPolicy == PipelineDropPolicy::DropOldest) {
+			//The survivor is the frame after the dropped one, so it must also cover the changes of the dropped frame.
+			survivor.UpdatedRegion.Add(dropped.UpdatedRegion);
+		}
+		else {
+			//The survivor is the frame before the dropped one, so the changes of the dropped frame go with the next frame.
+			pendingRegion.Add(dropped.UpdatedRegion);
+		}
+	});
+
+	auto CreateFramePreviewRing([&]() {
+		m_FramePreviewRing = make_unique<StagingReadbackRing>(make_unique<D3D11StagingReadbackBackend>(m_DxResources.Context, m_DxResources.Device, m_FramePreviewReadbackDepth), m_FramePreviewReadbackDepth);
+	});
+	CreateFramePreviewRing();
+	m_FramePreviewDispatcher = make_unique<LatestValueDispatcher<FRAME_PREVIEW>>([this](FRAME_PREVIEW &preview) {
+		if (RecordingFrameNumberChangedCallback != nullptr && !m_IsDestructing) {
+			FRAME_BITMAP_DATA frameData(preview.Stride, preview.Data.data(), static_cast<int>(preview.Data.size()), preview.Width, preview.Height);
+			RecordingFrameNumberChangedCallback(preview.Info.FrameNumber, preview.Info.Timestamp, &frameData);
+		}
+	});
+	m_FramePreviewDispatcher->Start();
+
+	encodeStage.Start(InitializePipelineThread, []() { CoUninitialize(); });
+	composeStage.Start(InitializePipelineThread, []() { CoUninitialize(); });
+	ExecuteFuncOnExit logPipelineStatsOnExit([&]() {
+		LogPipelineStageStats(L"Compose", composeStage.GetStats());
+		LogPipelineStageStats(L"Encode", encodeStage.GetStats(0));
+		for (size_t i = 0; i < m_AdditionalOutputs.size(); i++) {
+			LogPipelineStageStats(string_format(L"Encode (%ls)", m_AdditionalOutputs[i]->Options.Path.c_str()).c_str(), encodeStage.GetStats(i + 1));
+		}
+		FRAME_PACING_STATS pacingStats = framePacer.GetStats();
+		LOG_DEBUG(L"Frame pacing: %llu frames, %llu skipped, %llu late, %llu restarts. Jitter mean %.2f ms, rms %.2f ms, max %.2f ms. Last frame %.2f ms from schedule",
+			pacingStats.Frames,
+			pacingStats.Skipped,
+			pacingStats.Late,
+			pacingStats.Restarts,
+			HundredNanosToMillisDouble((INT64)pacingStats.GetMeanJitter()),
+			HundredNanosToMillisDouble((INT64)pacingStats.GetRmsJitter()),
+			HundredNanosToMillisDouble(pacingStats.MaxJitter),
+			HundredNanosToMillisDouble(pacingStats.Drift));
+		ALLOCATION_STATS frameStats = frameAllocationTracker.GetStats();
+		LOG_DEBUG(L"Frame hand-off: %llu pooled frames and blocks created (%.1f KB). %llu of %llu frames allocated, max %llu per frame",
+			frameStats.Allocations,
+			frameStats.Bytes / 1024.0,
+			frameStats.FramesWithAllocations,
+			frameStats.Frames,
+			frameStats.MaxFrameAllocations);
+		ALLOCATION_STATS textureStats = m_TextureManager->GetAllocationStats();
+		LOG_DEBUG(L"Compose stage: %llu textures created (%.1f MB). %llu of %llu frames created textures, mean %.2f per frame, max %llu",
+			textureStats.Allocations,
+			textureStats.Bytes / (1024.0 * 1024.0),
+			textureStats.FramesWithAllocations,
+			textureStats.Frames,
+			textureStats.GetMeanFrameAllocations(),
+			textureStats.MaxFrameAllocations);
+		LRU_RESOURCE_CACHE_STATS cacheStats = m_TextureManager->GetTextureCacheStats();
+		LOG_DEBUG(L"Compose stage texture cache: %llu hits, %llu misses, %llu evictions. %zu textures cached (%zu pinned), %.1f MB of %.1f MB budget, peak %.1f MB",
+			cacheStats.Hits,
+			cacheStats.Misses,
+			cacheStats.Evictions,
+			cacheStats.Entries,
+			cacheStats.Pinned,
+			cacheStats.Bytes / (1024.0 * 1024.0),
+			cacheStats.BudgetBytes / (1024.0 * 1024.0),
+			cacheStats.PeakBytes / (1024.0 * 1024.0));
+		if (m_MouseManager) {
+			CURSOR_SHAPE_CACHE_STATS cursorStats = m_MouseManager->GetCursorShapeCacheStats();
+			LOG_DEBUG(L"Mouse pointer cache: %llu hits, %llu misses, %llu evictions. %zu pointers cached, hit rate %.1f%%",
+				cursorStats.Hits,
+				cursorStats.Misses,
+				cursorStats.Evictions,
+				cursorStats.Entries,
+				cursorStats.GetHitRate() * 100);
+			MOUSE_CLICK_TIMELINE_STATS clickStats = m_MouseManager->GetMouseClickStats();
+			LOG_DEBUG(L"Mouse clicks: %llu clicks, %llu events dropped, %llu clicks dropped before they were drawn",
+				clickStats.Clicks,
+				clickStats.DroppedEvents,
+				clickStats.DroppedClicks);
+		}
+	});
+	ExecuteFuncOnExit stopFramePreviewsOnExit([&]() {
+		//The encode stage submits frames to the readback ring, so the stages are stopped first. When recording ends normally they are already drained.
+		composeStage.Stop();
+		encodeStage.Stop();
+		//Deliver the last frame, so the final frame number is reported.
+		PublishFramePreview(true);
+		m_FramePreviewDispatcher->Stop(true);
+		READBACK_RING_STATS readbackStats = m_FramePreviewRing->GetStats();
+		LATEST_VALUE_DISPATCHER_STATS dispatchStats = m_FramePreviewDispatcher->GetStats();
+		LOG_DEBUG(L"Frame preview readback: %llu frames submitted, %llu read back, %llu dropped, %llu superseded, %llu full copies. %llu previews delivered, %llu dropped by the preview thread",
+			readbackStats.Submitted,
+			readbackStats.Delivered,
+			readbackStats.Dropped,
+			readbackStats.Superseded,
+			readbackStats.FullCopies,
+			dispatchStats.Delivered,
+			dispatchStats.Dropped);
+		m_FramePreviewDispatcher.reset();
+		m_FramePreviewRing.reset();
+	});
+
+	auto DrainPipeline([&]() {
+		return composeStage.Drain() && encodeStage.Drain();
 	});
 
 	auto RestartCapture([&](CAPTURE_RESULT result) {
+		//Queued frames use the capture manager and D3D resources that are about to be recreated, so they are written first.
+		DrainPipeline();
+		m_SnapshotPipeline->Drain();
 		//Stop existing capture
 		hr = m_CaptureManager->StopCapture();
 
@@ -606,7 +1047,20 @@ REC_RESULT RecordingManager::StartRecorderLoop(_In_ const std::vector<RECORDING_
 					GetEncoderOptions(),
 					GetAudioOptions(),
 					GetSnapshotOptions(),
-					GetOutputOptions());
+					GetOutputOptions(),
+					m_Metrics);
+			}
+			if (SUCCEEDED(hr)) {
+				hr = m_SnapshotPipeline->Initialize(m_DxResources.Context, m_DxResources.Device, GetSnapshotOptions(), m_Metrics);
+			}
+			for (auto &pOutput : m_AdditionalOutputs) {
+				if (SUCCEEDED(hr)) {
+					hr = InitializeAdditionalOutput(pOutput.get());
+				}
+			}
+			if (SUCCEEDED(hr)) {
+				CreateCapturedFramePool();
+				CreateFramePreviewRing();
 			}
 		}
 		//Recreate capture manager and restart capture
@@ -619,7 +1073,8 @@ REC_RESULT RecordingManager::StartRecorderLoop(_In_ const std::vector<RECORDING_
 				m_DxResources.Device,
 				GetOutputOptions(),
 				GetEncoderOptions(),
-				GetMouseOptions());
+				GetMouseOptions(),
+				m_Metrics);
 		}
 		if (SUCCEEDED(hr)) {
 			if (result.NumberOfRetries > 0) {
@@ -645,6 +1100,9 @@ REC_RESULT RecordingManager::StartRecorderLoop(_In_ const std::vector<RECORDING_
 			hr = S_OK;
 			break;
 		}
+		if (composeStage.IsFailed() || encodeStage.IsFailed()) {
+			RETURN_RESULT_ON_BAD_HR(FAILED(pipelineHr) ? pipelineHr : E_FAIL, L"Failed to render frame");
+		}
 
 		if (WaitForSingleObjectEx(ErrorEvent, 0, FALSE) == WAIT_OBJECT_0) {
 			std::vector<CAPTURE_THREAD_DATA> captureData = m_CaptureManager->GetCaptureThreadData();
@@ -689,6 +1147,8 @@ REC_RESULT RecordingManager::StartRecorderLoop(_In_ const std::vector<RECORDING_
 			}
 		}
 		if (m_IsPaused) {
+			//Write out the frames captured before the pause, so the pipeline is idle while the audio and snapshot state is reset below.
+			DrainPipeline();
 			if (m_OutputManager->isMediaClockRunning()) {
 				m_OutputManager->PauseMediaClock();
 			}
@@ -708,13 +1168,17 @@ REC_RESULT RecordingManager::StartRecorderLoop(_In_ const std::vector<RECORDING_
 
 		//If there are any source previews on paused status, the loop exits here. This allows the source previews to continu render.
 		if (m_IsPaused) {
-			wait(videoFrameDurationMillis);
+			pausedPreviewPacer.WaitForNextFrame();
 			continue;
 		}
 		if (SUCCEEDED(hr)) {
+			m_Metrics->Increment(RecordingCounter::CapturedFrames);
 			if (capturedFrame.FrameUpdateCount > 0) {
 				m_RestartCaptureCount = 0;
 			}
+			else if (capturedFrameCount > 0) {
+				m_Metrics->Increment(RecordingCounter::DuplicatedFrames);
+			}
 			if (capturedFrame.PtrInfo) {
 				pPtrInfo = capturedFrame.PtrInfo.value();
 			}
@@ -724,7 +1188,8 @@ REC_RESULT RecordingManager::StartRecorderLoop(_In_ const std::vector<RECORDING_
 		}
 		INT64 timestamp;
 		RETURN_ON_BAD_HR(m_OutputManager->GetMediaTimeStamp(&timestamp));
-		INT64 durationSinceLastFrame100Nanos = timestamp - lastFrameStartPos100Nanos;
+		framePacer.OnFrame(timestamp);
+		FRAME_TIMING frameTiming = timeline.NextFrame(timestamp);
 
 
 
@@ -733,28 +1198,91 @@ REC_RESULT RecordingManager::StartRecorderLoop(_In_ const std::vector<RECORDING_
 			hr = S_OK;
 			break;
 		}
-		if (frameNr == 0) {
+		if (capturedFrameCount == 0) {
 			if (RecordingStatusChangedCallback != nullptr) {
 				RecordingStatusChangedCallback(STATUS_RECORDING);
 				LOG_DEBUG("Changed Recording Status to Recording");
 			}
 		}
-		RETURN_RESULT_ON_BAD_HR(hr = PrepareAndRenderFrame(capturedFrame.Frame, durationSinceLastFrame100Nanos), L"Failed to render frame");
+		//The mouse pointer is drawn on the frame after it is captured, so the areas it was and is drawn to change when it moves or changes shape.
+		//Mouse clicks are drawn in the frames shown while they were made, so frames with a click are not treated as unchanged.
+		if (pPtrInfo) {
+			INT64 frameEndPos = frameTiming.StartPos + frameTiming.Duration;
+			RECT pointerBounds = m_MouseManager->GetPointerBounds(&pPtrInfo.value(), frameTiming.StartPos, frameEndPos);
+			if (!EqualRect(&pointerBounds, &previousPointerBounds)
+				|| pPtrInfo->LastTimeStamp.QuadPart != previousPointerTimeStamp.QuadPart
+				|| m_MouseManager->IsDrawingMouseClick(frameTiming.StartPos, frameEndPos)) {
+				capturedFrame.UpdatedRegion.Add(previousPointerBounds);
+				capturedFrame.UpdatedRegion.Add(pointerBounds);
+			}
+			previousPointerBounds = pointerBounds;
+			previousPointerTimeStamp = pPtrInfo->LastTimeStamp;
+		}
+		else {
+			capturedFrame.UpdatedRegion.Add(previousPointerBounds);
+			previousPointerBounds = RECT{};
+		}
+		//Map the changed area to the output frame. Resized frames are treated as changed everywhere, as every output pixel is filtered from several input pixels.
+		REGION_RECT outputFrameRect{ 0, 0, videoOutputFrameSize.cx, videoOutputFrameSize.cy };
+		capturedFrame.UpdatedRegion.Offset(-videoInputFrameRect.left, -videoInputFrameRect.top);
+		capturedFrame.UpdatedRegion.Clip(outputFrameRect);
+		if (!capturedFrame.UpdatedRegion.IsEmpty()
+			&& (RectWidth(videoInputFrameRect) != videoOutputFrameSize.cx || RectHeight(videoInputFrameRect) != videoOutputFrameSize.cy)) {
+			capturedFrame.UpdatedRegion.Clear();
+			capturedFrame.UpdatedRegion.Add(outputFrameRect);
+		}
+		capturedFrame.UpdatedRegion.Add(pendingRegion);
+		pendingRegion.Clear();
+
+		//A frame without changes extends the duration of the previous frame instead of being encoded again.
+		//Fixed framerate recordings encode every frame, and a frame is encoded at least every m_MaxFrameExtensionMillis so the encoder keeps receiving video.
+		bool isUnchangedFrame = recorderMode == RecorderModeInternal::Video
+			&& !GetEncoderOptions()->GetIsFixedFramerate()
+			&& capturedFrameCount > 0
+			&& capturedFrame.UpdatedRegion.IsEmpty()
+			&& timeline.CanExtendEncodedFrame(timestamp, MillisToHundredNanos(m_MaxFrameExtensionMillis));
+
+		PooledFrame pFrame = pFramePool->Acquire();
+		PIPELINE_FRAME &frame = *pFrame;
+		if (capturedFrame.Frame && !isUnchangedFrame) {
+			RETURN_RESULT_ON_BAD_HR(hr = CopyCapturedFrame(capturedFrame.Frame, &frame.CapturedFrame), L"Failed to copy captured frame");
+			frame.Model.Frame = frame.CapturedFrame.get();
+			//Copied rather than moved, so the pooled frame keeps its own storage for the region.
+			frame.UpdatedRegion = capturedFrame.UpdatedRegion;
+			timeline.OnFrameEncoded(frameTiming);
+		}
+		else {
+			pendingRegion.Add(capturedFrame.UpdatedRegion);
+		}
+		frame.PtrInfo = pPtrInfo;
+		frame.AcquiredTimeStamp = capturedFrame.AcquiredTimeStamp;
+		frame.Model.StartPos = frameTiming.StartPos;
+		frame.Model.Duration = frameTiming.Duration;
+		//A frame dropped by the queue has its duration folded into a queued frame, so the timeline advances either way.
+		composeStage.Push(std::move(pFrame));
+		UINT64 frameAllocations = frameAllocationTracker.EndFrame();
+#if _DEBUG
+		//The pools have room for every frame the pipeline can hold, so once they are created no frame may allocate.
+		assert(frameAllocations == 0);
+#endif
+		UNREFERENCED_PARAMETER(frameAllocations);
+		capturedFrameCount++;
 		if (recorderMode == RecorderModeInternal::Screenshot) {
 			break;
 		}
 	}
-
+	if (!DrainPipeline()) {
+		RETURN_RESULT_ON_BAD_HR(FAILED(pipelineHr) ? pipelineHr : E_FAIL, L"Failed to render frame");
+	}
 	return CAPTURE_RESULT(hr);
 }
 
-HRESULT RecordingManager::SendNewFrameCallback(_In_ const int frameNumber, _In_ ID3D11Texture2D *pTexture) {
+HRESULT RecordingManager::SendNewFrameCallback(_In_ const int frameNumber, _In_ ID3D11Texture2D *pTexture, _In_opt_ const DirtyRegion *pUpdatedRegion) {
 	HRESULT hr = S_FALSE;
 	if (RecordingFrameNumberChangedCallback != nullptr) {
 		INT64 timestamp = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
 		if (m_OutputOptions->IsVideoFramePreviewEnabled()) {
 			CComPtr< ID3D11Texture2D> pProcessedTexture = nullptr;
-			unique_ptr<FRAME_BITMAP_DATA> pFramePreviewData = nullptr;
 			D3D11_TEXTURE2D_DESC textureDesc;
 			pTexture->GetDesc(&textureDesc);
 			if (m_OutputOptions->GetVideoFramePreviewSize().has_value()) {
@@ -770,41 +1298,16 @@ HRESULT RecordingManager::SendNewFrameCallback(_In_ const int frameNumber, _In_
 				RETURN_ON_BAD_HR(hr = m_TextureManager->ResizeTexture(pTexture, SIZE{ cx,cy }, TextureStretchMode::Uniform, &pResizedTexture));
 				pProcessedTexture.Attach(pResizedTexture);
 				pResizedTexture->GetDesc(&textureDesc);
+				//Every pixel of a resized preview may change, so it is read back in full.
+				pUpdatedRegion = nullptr;
 			}
 			else {
 				pProcessedTexture.Attach(pTexture);
 				pTexture->AddRef();
 			}
-			int width = textureDesc.Width;
-			int height = textureDesc.Height;
-
-			if (m_FrameDataCallbackTextureDesc.Width != width || m_FrameDataCallbackTextureDesc.Height != height) {
-				SafeRelease(&m_FrameDataCallbackTexture);
-				textureDesc.Usage = D3D11_USAGE_STAGING;
-				textureDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
-				textureDesc.MiscFlags = 0;
-				textureDesc.BindFlags = 0;
-				RETURN_ON_BAD_HR(m_DxResources.Device->CreateTexture2D(&textureDesc, nullptr, &m_FrameDataCallbackTexture));
-
-				m_FrameDataCallbackTextureDesc = textureDesc;
-			}
-
-			m_DxResources.Context->CopyResource(m_FrameDataCallbackTexture, pProcessedTexture);
-			D3D11_MAPPED_SUBRESOURCE map;
-			m_DxResources.Context->Map(m_FrameDataCallbackTexture, 0, D3D11_MAP_READ, 0, &map);
-
-			int bytesPerPixel = map.RowPitch / width;
-			int len = map.DepthPitch;
-			int stride = map.RowPitch;
-			BYTE *data = static_cast<BYTE *>(map.pData);
-			pFramePreviewData = make_unique<FRAME_BITMAP_DATA>();
-			pFramePreviewData->Data = data;
-			pFramePreviewData->Stride = stride;
-			pFramePreviewData->Width = width;
-			pFramePreviewData->Height = height;
-			pFramePreviewData->Length = len;
-			RecordingFrameNumberChangedCallback(frameNumber, timestamp, pFramePreviewData.get());
-			m_DxResources.Context->Unmap(m_FrameDataCallbackTexture, 0);
+			//The copy is read back a few frames later, once the GPU is done with it, so the recording never stalls on the readback.
+			m_FramePreviewRing->Submit(pProcessedTexture, READBACK_FRAME_INFO{ frameNumber, timestamp }, pUpdatedRegion);
+			PublishFramePreview(false);
 		}
 		else {
 			RecordingFrameNumberChangedCallback(frameNumber, timestamp, nullptr);
@@ -813,6 +1316,22 @@ HRESULT RecordingManager::SendNewFrameCallback(_In_ const int frameNumber, _In_
 	return hr;
 }
 
+bool RecordingManager::PublishFramePreview(_In_ bool wait) {
+	if (!m_FramePreviewRing || !m_FramePreviewDispatcher) {
+		return false;
+	}
+	return m_FramePreviewRing->Poll([&](const READBACK_FRAME_INFO &info, const READBACK_MAPPING &mapping) {
+		FRAME_PREVIEW *pPreview = m_FramePreviewDispatcher->BeginWrite();
+		pPreview->Info = info;
+		pPreview->Width = mapping.Width;
+		pPreview->Height = mapping.Height;
+		pPreview->Stride = mapping.RowPitch;
+		//The preview buffers are reused, so this only allocates when the frame grows.
+		pPreview->Data.assign(mapping.pData, mapping.pData + static_cast<size_t>(mapping.RowPitch) * mapping.Height);
+		m_FramePreviewDispatcher->Publish();
+	}, wait);
+}
+
 HRESULT RecordingManager::InitializeRects(_In_ SIZE captureFrameSize, _Out_opt_ RECT *pAdjustedSourceRect, _Out_opt_ SIZE *pAdjustedOutputFrameSize) {
 
 	RECT adjustedSourceRect = RECT{ 0,0, MakeEven(captureFrameSize.cx), MakeEven(captureFrameSize.cy) };
@@ -837,7 +1356,30 @@ HRESULT RecordingManager::InitializeRects(_In_ SIZE captureFrameSize, _Out_opt_
 	return S_OK;
 }
 
-HRESULT RecordingManager::ProcessTextureTransforms(_In_ ID3D11Texture2D *pTexture, _Out_ ID3D11Texture2D **ppProcessedTexture, RECT videoInputFrameRect, SIZE videoOutputFrameSize)
+std::function<void(const std::wstring &, const SEGMENT_INFO &)> RecordingManager::CreateSegmentCompleteCallback()
+{
+	return [this](const std::wstring &path, const SEGMENT_INFO &segment) {
+		if (RecordingSegmentCompleteCallback != nullptr) {
+			RecordingSegmentCompleteCallback(path, segment.Index, HundredNanosToMillis(segment.StartPos), HundredNanosToMillis(segment.EndPos));
+		}
+	};
+}
+
+HRESULT RecordingManager::InitializeAdditionalOutput(_Inout_ ADDITIONAL_OUTPUT *pOutput)
+{
+	if (!pOutput->Textures) {
+		pOutput->Textures = make_unique<TextureManager>();
+	}
+	RETURN_ON_BAD_HR(pOutput->Textures->Initialize(m_DxResources.Context, m_DxResources.Device));
+	if (!pOutput->Output) {
+		pOutput->Output = make_unique<OutputManager>();
+		pOutput->Output->SetSegmentCompleteCallback(CreateSegmentCompleteCallback());
+	}
+	//The recording metrics describe the main output, so additional outputs do not report to them.
+	return pOutput->Output->Initialize(m_DxResources.Context, m_DxResources.Device, pOutput->Options.EncoderOptions, GetAudioOptions(), GetSnapshotOptions(), pOutput->Options.OutputOptions, nullptr);
+}
+
+HRESULT RecordingManager::ProcessTextureTransforms(_In_ ID3D11Texture2D *pTexture, _Out_ ID3D11Texture2D **ppProcessedTexture, RECT videoInputFrameRect, SIZE videoOutputFrameSize, TextureStretchMode stretch, _In_ TextureManager *pTextureManager)
 {
 	D3D11_TEXTURE2D_DESC desc;
 	pTexture->GetDesc(&desc);
@@ -846,7 +1388,7 @@ HRESULT RecordingManager::ProcessTextureTransforms(_In_ ID3D11Texture2D *pTextur
 	if (RectWidth(videoInputFrameRect) < static_cast<long>(desc.Width)
 		|| RectHeight(videoInputFrameRect) < static_cast<long>(round(desc.Height))) {
 		ID3D11Texture2D *pCroppedFrameCopy;
-		RETURN_ON_BAD_HR(hr = m_TextureManager->CropTexture(pTexture, videoInputFrameRect, &pCroppedFrameCopy));
+		RETURN_ON_BAD_HR(hr = pTextureManager->CropTexture(pTexture, videoInputFrameRect, &pCroppedFrameCopy));
 		pProcessedTexture.Release();
 		pProcessedTexture.Attach(pCroppedFrameCopy);
 	}
@@ -854,27 +1396,41 @@ HRESULT RecordingManager::ProcessTextureTransforms(_In_ ID3D11Texture2D *pTextur
 		|| RectHeight(videoInputFrameRect) != videoOutputFrameSize.cy) {
 		RECT contentRect;
 		ID3D11Texture2D *pResizedFrameCopy;
-		RETURN_ON_BAD_HR(hr = m_TextureManager->ResizeTexture(pProcessedTexture, videoOutputFrameSize, GetOutputOptions()->GetStretch(), &pResizedFrameCopy, &contentRect));
+		RETURN_ON_BAD_HR(hr = pTextureManager->ResizeTexture(pProcessedTexture, videoOutputFrameSize, stretch, &pResizedFrameCopy, &contentRect));
 
 		pResizedFrameCopy->GetDesc(&desc);
-		desc.Width = videoOutputFrameSize.cx;
-		desc.Height = videoOutputFrameSize.cy;
-		ID3D11Texture2D *pCanvas;
-		RETURN_ON_BAD_HR(hr = m_DxResources.Device->CreateTexture2D(&desc, nullptr, &pCanvas));
-		int leftMargin = (int)max(0, round(((double)videoOutputFrameSize.cx - (double)RectWidth(contentRect))) / 2);
-		int topMargin = (int)max(0, round(((double)videoOutputFrameSize.cy - (double)RectHeight(contentRect))) / 2);
-
-		D3D11_BOX Box{};
-		Box.front = 0;
-		Box.back = 1;
-		Box.left = 0;
-		Box.top = 0;
-		Box.right = RectWidth(contentRect);
-		Box.bottom = RectHeight(contentRect);
-		m_DxResources.Context->CopySubresourceRegion(pCanvas, 0, leftMargin, topMargin, 0, pResizedFrameCopy, 0, &Box);
-		pResizedFrameCopy->Release();
-		pProcessedTexture.Release();
-		pProcessedTexture.Attach(pCanvas);
+		if (desc.Width == static_cast<UINT>(videoOutputFrameSize.cx) && desc.Height == static_cast<UINT>(videoOutputFrameSize.cy)) {
+			//The resized frame already fills the output, so it needs no canvas.
+			pProcessedTexture.Release();
+			pProcessedTexture.Attach(pResizedFrameCopy);
+		}
+		else {
+			//The canvas is reused from the texture cache, so the outputs do not create a texture every frame. It is cleared, as it may hold an earlier frame.
+			desc.Width = videoOutputFrameSize.cx;
+			desc.Height = videoOutputFrameSize.cy;
+			ID3D11Texture2D *pCanvas;
+			hr = pTextureManager->GetOrCreateTexture(desc, &pCanvas);
+			if (FAILED(hr)) {
+				pResizedFrameCopy->Release();
+				return hr;
+			}
+			pCanvas->AddRef();
+			pTextureManager->BlankTexture(pCanvas, RECT{ 0, 0, videoOutputFrameSize.cx, videoOutputFrameSize.cy });
+			int leftMargin = (int)max(0, round(((double)videoOutputFrameSize.cx - (double)RectWidth(contentRect))) / 2);
+			int topMargin = (int)max(0, round(((double)videoOutputFrameSize.cy - (double)RectHeight(contentRect))) / 2);
+
+			D3D11_BOX Box{};
+			Box.front = 0;
+			Box.back = 1;
+			Box.left = 0;
+			Box.top = 0;
+			Box.right = RectWidth(contentRect);
+			Box.bottom = RectHeight(contentRect);
+			m_DxResources.Context->CopySubresourceRegion(pCanvas, 0, leftMargin, topMargin, 0, pResizedFrameCopy, 0, &Box);
+			pResizedFrameCopy->Release();
+			pProcessedTexture.Release();
+			pProcessedTexture.Attach(pCanvas);
+		}
 	}
 	if (ppProcessedTexture) {
 		*ppProcessedTexture = pProcessedTexture;
@@ -912,82 +1468,34 @@ bool RecordingManager::CheckDependencies(_Out_ std::wstring *error)
 	*error = errorText;
 	return result;
 }
-void RecordingManager::SaveTextureAsVideoSnapshotAsync(_In_ ID3D11Texture2D *pTexture, _In_ std::wstring snapshotPath, _In_ RECT destRect, _In_opt_ std::function<void(HRESULT)> onCompletion)
+HRESULT RecordingManager::SaveTextureAsVideoSnapshotAsync(_In_ ID3D11Texture2D *pTexture, _In_ std::wstring snapshotPath, _In_ RECT destRect, _In_opt_ std::function<void(HRESULT)> onCompletion)
 {
-	pTexture->AddRef();
-	auto token = m_TaskWrapperImpl->m_RecordTaskCts.get_token();
-	Concurrency::create_task([this, pTexture, snapshotPath, destRect, onCompletion, token]() {
-		return SaveTextureAsVideoSnapshot(pTexture, snapshotPath, destRect);
-	   }, token).then([this, snapshotPath, pTexture, destRect, onCompletion, token](concurrency::task<HRESULT> t)
-		   {
-			   HRESULT hr;
-			   try {
-				   hr = t.get();
-				   // if .get() didn't throw and the HRESULT succeeded, there are no errors.
-			   }
-			   catch (...) {
-				   // handle error
-				   LOG_ERROR(L"Exception saving snapshot", );
-				   hr = E_FAIL;
-			   }
-			   if (token.is_canceled()) {
-				   cancel_current_task();
-			   };
-			   if (onCompletion) {
-				   std::invoke(onCompletion, hr);
-			   }
-			   return hr;
-		   }, token);
+	return m_SnapshotPipeline->SubmitSnapshot(pTexture, GetSnapshotSourceRect(pTexture, destRect), snapshotPath, onCompletion);
 }
 
 HRESULT RecordingManager::SaveTextureAsVideoSnapshot(_In_ ID3D11Texture2D *pTexture, _In_ std::wstring snapshotPath, _In_ RECT destRect)
 {
-	CComPtr<ID3D11Texture2D> pProcessedTexture = nullptr;
-	D3D11_TEXTURE2D_DESC frameDesc;
-	pTexture->GetDesc(&frameDesc);
-	int destWidth = RectWidth(destRect);
-	int destHeight = RectHeight(destRect);
-	if ((int)frameDesc.Width > RectWidth(destRect)
-		|| (int)frameDesc.Height > RectHeight(destRect)) {
-		//If the source frame is larger than the destionation rect, we crop it, to avoid black borders around the snapshots.
-		RETURN_ON_BAD_HR(m_TextureManager->CropTexture(pTexture, destRect, &pProcessedTexture));
-	}
-	else {
-		RETURN_ON_BAD_HR(m_DxResources.Device->CreateTexture2D(&frameDesc, nullptr, &pProcessedTexture));
-		// Copy the current frame for a separate thread to write it to a file asynchronously.
-		m_DxResources.Context->CopyResource(pProcessedTexture, pTexture);
-	}
-	return m_OutputManager->WriteFrameToImage(pProcessedTexture, snapshotPath.c_str());
+	return m_SnapshotPipeline->SaveSnapshot(pTexture, GetSnapshotSourceRect(pTexture, destRect), snapshotPath, nullptr);
 }
 
 HRESULT RecordingManager::SaveTextureAsVideoSnapshot(_In_ ID3D11Texture2D *pTexture, _In_ IStream *pStream, _In_ RECT destRect)
 {
-	CComPtr<ID3D11Texture2D> pProcessedTexture = nullptr;
-	D3D11_TEXTURE2D_DESC frameDesc;
-	pTexture->GetDesc(&frameDesc);
-	int destWidth = RectWidth(destRect);
-	int destHeight = RectHeight(destRect);
-	if ((int)frameDesc.Width > RectWidth(destRect)
-		|| (int)frameDesc.Height > RectHeight(destRect)) {
-		//If the source frame is larger than the destionation rect, we crop it, to avoid black borders around the snapshots.
-		RETURN_ON_BAD_HR(m_TextureManager->CropTexture(pTexture, destRect, &pProcessedTexture));
-	}
-	else {
-		RETURN_ON_BAD_HR(m_DxResources.Device->CreateTexture2D(&frameDesc, nullptr, &pProcessedTexture));
-		// Copy the current frame for a separate thread to write it to a file asynchronously.
-		m_DxResources.Context->CopyResource(pProcessedTexture, pTexture);
-	}
-	return m_OutputManager->WriteFrameToImage(pProcessedTexture, pStream);
+	return m_SnapshotPipeline->SaveSnapshot(pTexture, GetSnapshotSourceRect(pTexture, destRect), L"", pStream);
 }
 
-HRESULT RecordingManager::ProcessTexture(_In_ ID3D11Texture2D *pTexture, _Out_ ID3D11Texture2D **ppProcessedTexture, _In_opt_ std::optional<PTR_INFO> pPtrInfo = std::nullopt)
+HRESULT RecordingManager::ProcessTexture(_In_ ID3D11Texture2D *pTexture, _In_ INT64 acquiredTimeStamp, _Out_ ID3D11Texture2D **ppProcessedTexture, _In_opt_ std::optional<PTR_INFO> pPtrInfo = std::nullopt, _In_opt_ std::optional<FRAME_TIMING> frameTiming = std::nullopt)
 {
 	*ppProcessedTexture = nullptr;
 	HRESULT hr = E_FAIL;
 	int updatedOverlaysCount = 0;
-	m_CaptureManager->ProcessOverlays(pTexture, &updatedOverlaysCount);
+	m_CaptureManager->ProcessOverlays(pTexture, acquiredTimeStamp, &updatedOverlaysCount);
 	if (pPtrInfo) {
-		hr = m_MouseManager->ProcessMousePointer(pTexture, &pPtrInfo.value());
+		if (frameTiming) {
+			hr = m_MouseManager->ProcessMousePointer(pTexture, &pPtrInfo.value(), frameTiming->StartPos, frameTiming->StartPos + frameTiming->Duration);
+		}
+		else {
+			hr = m_MouseManager->ProcessMousePointer(pTexture, &pPtrInfo.value());
+		}
 		if (FAILED(hr)) {
 			_com_error err(hr);
 			LOG_ERROR(L"Error drawing mouse pointer: %s", err.ErrorMessage());
@@ -998,7 +1506,7 @@ HRESULT RecordingManager::ProcessTexture(_In_ ID3D11Texture2D *pTexture, _Out_ I
 	RECT videoInputFrameRect{};
 	RETURN_ON_BAD_HR(hr = InitializeRects(m_CaptureManager->GetOutputSize(), &videoInputFrameRect, &videoOutputFrameSize));
 	CComPtr<ID3D11Texture2D> processedTexture;
-	RETURN_ON_BAD_HR(hr = ProcessTextureTransforms(pTexture, &processedTexture, videoInputFrameRect, videoOutputFrameSize));
+	RETURN_ON_BAD_HR(hr = ProcessTextureTransforms(pTexture, &processedTexture, videoInputFrameRect, videoOutputFrameSize, GetOutputOptions()->GetStretch(), m_TextureManager.get()));
 
 	*ppProcessedTexture = processedTexture;
 	(*ppProcessedTexture)->AddRef();
@@ -7,11 +7,16 @@
 #include "Log.h"
 #include "fifo_map.h"
 #include "CommonTypes.h"
+#include "RecordingMetrics.h"
+#include "StagingReadback.h"
+#include "RecordingTimeline.h"
+#include "SnapshotPipeline.h"
 typedef void(__stdcall *CallbackCompleteFunction)(std::wstring, nlohmann::fifo_map<std::wstring, int>);
 typedef void(__stdcall *CallbackStatusChangedFunction)(int);
 typedef void(__stdcall *CallbackErrorFunction)(std::wstring, std::wstring);
 typedef void(__stdcall *CallbackSnapshotFunction)(std::wstring);
 typedef void(__stdcall *CallbackFrameNumberChangedFunction)(int, INT64, _In_opt_ FRAME_BITMAP_DATA *data);
+typedef void(__stdcall *CallbackSegmentCompleteFunction)(std::wstring, int, INT64, INT64);
 
 #define STATUS_IDLE 0
 #define STATUS_RECORDING 1
@@ -21,6 +26,17 @@ typedef void(__stdcall *CallbackFrameNumberChangedFunction)(int, INT64, _In_opt_
 #define API_DESKTOP_DUPLICATION 0
 #define API_GRAPHICS_CAPTURE 1
 
+//
+// A frame read back for the frame preview callback.
+//
+struct FRAME_PREVIEW {
+	READBACK_FRAME_INFO Info{};
+	int Width = 0;
+	int Height = 0;
+	int Stride = 0;
+	std::vector<BYTE> Data;
+};
+
 class RecordingManager
 {
 public:
@@ -31,8 +47,14 @@ public:
 	CallbackStatusChangedFunction RecordingStatusChangedCallback;
 	CallbackSnapshotFunction RecordingSnapshotCreatedCallback;
 	CallbackFrameNumberChangedFunction RecordingFrameNumberChangedCallback;
+	CallbackSegmentCompleteFunction RecordingSegmentCompleteCallback;
 	HRESULT TakeSnapshot(_In_ std::wstring path);
 	HRESULT TakeSnapshot(_In_ IStream *stream);
+	/// <summary>
+	/// Saves the contents of the replay buffer of the recording, without interrupting it.
+	/// </summary>
+	HRESULT SaveReplay(_In_ std::wstring path);
+	HRESULT SaveReplay(_In_ IStream *stream);
 	HRESULT BeginRecording(_In_ std::wstring path);
 	HRESULT BeginRecording(_In_ IStream *stream);
 	void EndRecording();
@@ -40,6 +62,10 @@ public:
 	void ResumeRecording();
 
 	bool IsRecording() { return m_IsRecording; }
+	/// <summary>
+	/// Gets the frame timings and counters of the current or most recent recording.
+	/// </summary>
+	RECORDING_STATS GetRecordingStats() { return m_Metrics->GetStats(); }
 
 	static bool SetExcludeFromCapture(HWND hwnd, bool isExcluded);
 
@@ -108,6 +134,14 @@ public:
 		}
 		return S_OK;
 	}
+	/// <summary>
+	/// Wakes up the capture threads after the options of recording sources or overlays have been changed, so the changes take effect right away.
+	/// </summary>
+	inline void NotifyOptionsChanged() {
+		if (m_IsRecording && m_CaptureManager) {
+			m_CaptureManager->NotifyOptionsChanged();
+		}
+	}
 
 	void SetLogEnabled(bool value);
 	void SetLogFilePath(std::wstring value);
@@ -123,7 +157,24 @@ public:
 	std::shared_ptr<SNAPSHOT_OPTIONS> GetSnapshotOptions() { return m_SnapshotOptions; }
 	void SetOutputOptions(OUTPUT_OPTIONS *options) { m_OutputOptions.reset(options); }
 	std::shared_ptr<OUTPUT_OPTIONS> GetOutputOptions() { return m_OutputOptions; }
+	/// <summary>
+	/// Sets outputs encoding the same video and audio as the main output, each with its own encoder settings, frame size and file, so one capture is recorded several ways at once.
+	/// Additional outputs are only written when recording video.
+	/// </summary>
+	void SetAdditionalOutputs(std::vector<RECORDING_OUTPUT> outputs) { m_RecordingOutputs = outputs; }
+	const std::vector<RECORDING_OUTPUT> &GetAdditionalOutputs() const { return m_RecordingOutputs; }
 private:
+	//
+	// An additional output while recording.
+	//
+	struct ADDITIONAL_OUTPUT {
+		RECORDING_OUTPUT Options;
+		//Resizes the frames of the main output to the frame size of this output.
+		std::unique_ptr<TextureManager> Textures;
+		std::unique_ptr<OutputManager> Output;
+		SIZE FrameSize{};
+	};
+
 	bool m_IsDestructing;
 	UINT m_TimerResolution;
 	struct TaskWrapper;
@@ -135,12 +186,15 @@ private:
 	std::unique_ptr<OutputManager> m_OutputManager;
 	std::unique_ptr<ScreenCaptureManager> m_CaptureManager;
 	std::unique_ptr<MouseManager> m_MouseManager;
+	std::unique_ptr<SnapshotPipeline> m_SnapshotPipeline;
 
 	HRESULT m_EncoderResult = E_FAIL;
 	HRESULT m_MfStartupResult = E_FAIL;
 	std::wstring m_OutputFolder = L"";
 	std::wstring m_OutputFullPath = L"";
 	double m_MaxFrameLengthMillis = 500;
+	//The longest time unchanged frames may extend the previous frame, before a frame is encoded anyway. This keeps the sink writer from throttling on missing video.
+	double m_MaxFrameExtensionMillis = 1000;
 	int m_RestartCaptureCount = 0;
 
 	std::vector<RECORDING_SOURCE *> m_RecordingSources;
@@ -153,15 +207,32 @@ private:
 	std::shared_ptr<MOUSE_OPTIONS> m_MouseOptions;
 	std::shared_ptr<SNAPSHOT_OPTIONS> m_SnapshotOptions;
 	std::shared_ptr<OUTPUT_OPTIONS> m_OutputOptions;
+	std::shared_ptr<RecordingMetrics> m_Metrics;
+	std::vector<RECORDING_OUTPUT> m_RecordingOutputs;
+	std::vector<std::unique_ptr<ADDITIONAL_OUTPUT>> m_AdditionalOutputs;
 
-	ID3D11Texture2D *m_FrameDataCallbackTexture;
-	D3D11_TEXTURE2D_DESC m_FrameDataCallbackTextureDesc;
+	//Reads back the frames passed to the frame preview callback, without waiting for the GPU to finish copying them.
+	std::unique_ptr<StagingReadbackRing> m_FramePreviewRing;
+	//Delivers the read back frame previews on a separate thread, dropping all but the latest if the callback is slow.
+	std::unique_ptr<LatestValueDispatcher<FRAME_PREVIEW>> m_FramePreviewDispatcher;
+	size_t m_FramePreviewReadbackDepth = READBACK_RING_DEFAULT_DEPTH;
 
 	bool CheckDependencies(_Out_ std::wstring *error);
 	HRESULT ConfigureOutputDir(_In_ std::wstring path);
 	REC_RESULT StartRecorderLoop(_In_ const std::vector<RECORDING_SOURCE *> &sources, _In_ const std::vector<RECORDING_OVERLAY *> &overlays, _In_opt_ IStream *pStream);
 
-	HRESULT SendNewFrameCallback(_In_ const int frameNumber, _In_ ID3D11Texture2D *pTexture);
+	/// <summary>
+	/// Invokes the frame number changed callback, with a copy of the frame if video frame previews are enabled.
+	/// The frame preview is delivered later from the frame preview thread, once the frame has been read back, and may be skipped in favor of a newer frame.
+	/// </summary>
+	/// <param name="pUpdatedRegion">The area of the frame changed since the previous frame passed to this method, or nullptr to read back the whole frame</param>
+	HRESULT SendNewFrameCallback(_In_ const int frameNumber, _In_ ID3D11Texture2D *pTexture, _In_opt_ const DirtyRegion *pUpdatedRegion = nullptr);
+	/// <summary>
+	/// Hands the newest frame preview that has been read back to the frame preview thread.
+	/// </summary>
+	/// <param name="wait">If true, waits for the readback of the last frame instead of only taking frames that are already done.</param>
+	/// <returns>true if a frame preview was handed over</returns>
+	bool PublishFramePreview(_In_ bool wait);
 	HRESULT TakeSnapshot(_In_opt_ std::wstring path, _In_opt_ IStream *pStream, _In_opt_ ID3D11Texture2D *pTexture = nullptr);
 	HRESULT BeginRecording(_In_opt_ std::wstring path, _In_opt_ IStream *pStream);
 
@@ -174,6 +245,15 @@ private:
 	/// <returns></returns>
 	HRESULT InitializeRects(_In_ SIZE outputSize, _Out_opt_ RECT *pAdjustedSourceRect, _Out_opt_ SIZE *pAdjustedOutputFrameSize);
 
+	/// <summary>
+	/// Initializes the texture and output managers of an additional output on the current device, creating them if needed.
+	/// </summary>
+	HRESULT InitializeAdditionalOutput(_Inout_ ADDITIONAL_OUTPUT *pOutput);
+	/// <summary>
+	/// Creates the callback passed to output managers, which reports completed segments with their timeline position in milliseconds.
+	/// </summary>
+	std::function<void(const std::wstring &, const SEGMENT_INFO &)> CreateSegmentCompleteCallback();
+
 	/// <summary>
 	/// Save texture as snapshot image.
 	/// </summary>
@@ -191,21 +271,27 @@ private:
 	/// <returns></returns>
 	HRESULT SaveTextureAsVideoSnapshot(_In_ ID3D11Texture2D *pTexture, _In_ IStream *pStream, _In_ RECT destRect);
 	/// <summary>
-	/// Save texture as snapshot image async.
+	/// Save texture as snapshot image async. The texture is copied before returning, and the snapshot is encoded and written on a worker thread.
 	/// </summary>
 	/// <param name="pTexture">The texture to save to a snapshot</param>
 	/// <param name="destRect">The area of the texture to save. If the texture is larger, it will be cropped to these coordinates.</param>
-	/// <returns></returns>
-	void RecordingManager::SaveTextureAsVideoSnapshotAsync(_In_ ID3D11Texture2D *pTexture, _In_ std::wstring snapshotPath, _In_ RECT destRect, _In_opt_ std::function<void(HRESULT)> onCompletion);
+	/// <param name="onCompletion">Optional function called on the worker thread once the snapshot is written or has failed</param>
+	/// <returns>S_OK if the snapshot was queued, S_FALSE if it was dropped because earlier snapshots are still being written, else an error code</returns>
+	HRESULT SaveTextureAsVideoSnapshotAsync(_In_ ID3D11Texture2D *pTexture, _In_ std::wstring snapshotPath, _In_ RECT destRect, _In_opt_ std::function<void(HRESULT)> onCompletion);
+	/// <summary>
+	/// Creates the folder of a snapshot file if it does not exist.
+	/// </summary>
+	HRESULT CreateSnapshotDirectory(_In_ const std::wstring &snapshotPath);
 
 	/// <summary>
 	/// Adds overlays, mouse cursors, and texture transforms.
 	/// </summary>
 	/// <param name="pTexture">The texture to process</param>
+	/// <param name="acquiredTimeStamp">The time the frame was acquired, from CAPTURED_FRAME::AcquiredTimeStamp.</param>
 	/// <param name="pPtrInfo">Mouse pointer info (optional).</param>
 	/// <param name="ppProcessedTexture">The output texture.</param>
 	/// <returns>S_OK if any processing has been done, S_FALSE if no changes, else an error code</returns>
-	HRESULT ProcessTexture(_In_ ID3D11Texture2D *pTexture, _Out_ ID3D11Texture2D **ppProcessedTexture, _In_opt_ std::optional<PTR_INFO> pPtrInfo);
+	HRESULT ProcessTexture(_In_ ID3D11Texture2D *pTexture, _In_ INT64 acquiredTimeStamp, _Out_ ID3D11Texture2D **ppProcessedTexture, _In_opt_ std::optional<PTR_INFO> pPtrInfo, _In_opt_ std::optional<FRAME_TIMING> frameTiming);
 
 	/// <summary>
 	/// Perform cropping and resizing on texture if needed.
@@ -214,8 +300,10 @@ private:
 	/// <param name="ppProcessedTexture">The output texture. If no transformations are done, the original texture is returned.</param>
 	/// <param name="videoInputFrameRect">The source rectangle. The texture will be cropped to these coordinates if larger.</param>
 	/// <param name="videoOutputFrameSize">The output dimensions. The texture will be resized to these coordinates if differing.</param>
+	/// <param name="stretch">How the texture is stretched when resized.</param>
+	/// <param name="pTextureManager">The texture manager to crop and resize with.</param>
 	/// <returns>S_OK if any processing has been done, S_FALSE if no changes, else an error code</returns>
-	HRESULT ProcessTextureTransforms(_In_ ID3D11Texture2D *pTexture, _Out_ ID3D11Texture2D **ppProcessedTexture, RECT videoInputFrameRect, SIZE videoOutputFrameSize);
+	HRESULT ProcessTextureTransforms(_In_ ID3D11Texture2D *pTexture, _Out_ ID3D11Texture2D **ppProcessedTexture, RECT videoInputFrameRect, SIZE videoOutputFrameSize, TextureStretchMode stretch, _In_ TextureManager *pTextureManager);
 
 	/// <summary>
 	/// Releases DirectX resources and reports any leaks
@@ -0,0 +1,197 @@
+#include "RecordingMetrics.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+	//Index of the most significant set bit. The value must be positive.
+	inline int HighestBit(uint64_t value) {
+		int bit = 0;
+		if (value >> 32) { value >>= 32; bit += 32; }
+		if (value >> 16) { value >>= 16; bit += 16; }
+		if (value >> 8) { value >>= 8; bit += 8; }
+		if (value >> 4) { value >>= 4; bit += 4; }
+		if (value >> 2) { value >>= 2; bit += 2; }
+		if (value >> 1) { bit += 1; }
+		return bit;
+	}
+}
+
+LatencyHistogram::LatencyHistogram()
+{
+	Reset();
+}
+
+size_t LatencyHistogram::GetBucketIndex(int64_t value)
+{
+	if (value < (int64_t)SUB_BUCKET_COUNT) {
+		return value < 0 ? 0 : (size_t)value;
+	}
+	//The magnitude is how far the value must be shifted to fit in the upper half of the sub-buckets.
+	int magnitude = HighestBit((uint64_t)value) - HISTOGRAM_SUB_BUCKET_BITS + 1;
+	return (size_t)magnitude * SUB_BUCKET_HALF_COUNT + (size_t)(value >> magnitude);
+}
+
+int64_t LatencyHistogram::GetBucketLowestValue(size_t index)
+{
+	if (index < SUB_BUCKET_COUNT) {
+		return (int64_t)index;
+	}
+	size_t magnitude = index / SUB_BUCKET_HALF_COUNT - 1;
+	size_t subBucket = index - magnitude * SUB_BUCKET_HALF_COUNT;
+	return (int64_t)subBucket << magnitude;
+}
+
+int64_t LatencyHistogram::GetBucketHighestValue(size_t index)
+{
+	if (index < SUB_BUCKET_COUNT) {
+		return (int64_t)index;
+	}
+	size_t magnitude = index / SUB_BUCKET_HALF_COUNT - 1;
+	return GetBucketLowestValue(index) + (int64_t(1) << magnitude) - 1;
+}
+
+void LatencyHistogram::Record(int64_t value)
+{
+	value = (std::max)(int64_t(0), (std::min)(value, MAX_VALUE));
+	m_Buckets[GetBucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+	m_Total.fetch_add(value, std::memory_order_relaxed);
+	int64_t min = m_Min.load(std::memory_order_relaxed);
+	while (value < min && !m_Min.compare_exchange_weak(min, value, std::memory_order_relaxed)) {
+	}
+	int64_t max = m_Max.load(std::memory_order_relaxed);
+	while (value > max && !m_Max.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+	}
+}
+
+HISTOGRAM_SNAPSHOT LatencyHistogram::GetSnapshot() const
+{
+	HISTOGRAM_SNAPSHOT snapshot{};
+	//Count from the buckets, so the percentiles are consistent with the bucket contents even if values are recorded meanwhile.
+	uint64_t buckets[BUCKET_COUNT];
+	uint64_t count = 0;
+	for (size_t i = 0; i < BUCKET_COUNT; i++) {
+		buckets[i] = m_Buckets[i].load(std::memory_order_relaxed);
+		count += buckets[i];
+	}
+	if (count == 0) {
+		return snapshot;
+	}
+	snapshot.Count = count;
+	snapshot.Total = m_Total.load(std::memory_order_relaxed);
+	snapshot.Min = m_Min.load(std::memory_order_relaxed);
+	snapshot.Max = m_Max.load(std::memory_order_relaxed);
+	snapshot.Mean = (double)snapshot.Total / count;
+	snapshot.P50 = GetValueAtPercentile(50.0, buckets, count);
+	snapshot.P90 = GetValueAtPercentile(90.0, buckets, count);
+	snapshot.P99 = GetValueAtPercentile(99.0, buckets, count);
+	snapshot.P999 = GetValueAtPercentile(99.9, buckets, count);
+	return snapshot;
+}
+
+int64_t LatencyHistogram::GetValueAtPercentile(double percentile, const uint64_t *pBuckets, uint64_t count) const
+{
+	uint64_t targetCount = (std::max)(uint64_t(1), (uint64_t)std::ceil(percentile / 100.0 * count));
+	uint64_t seen = 0;
+	for (size_t i = 0; i < BUCKET_COUNT; i++) {
+		seen += pBuckets[i];
+		if (seen >= targetCount) {
+			//Report the middle of the bucket, but never outside the recorded range.
+			int64_t value = GetBucketLowestValue(i) + (GetBucketHighestValue(i) - GetBucketLowestValue(i)) / 2;
+			int64_t min = m_Min.load(std::memory_order_relaxed);
+			int64_t max = m_Max.load(std::memory_order_relaxed);
+			return (std::max)(min, (std::min)(value, max));
+		}
+	}
+	return m_Max.load(std::memory_order_relaxed);
+}
+
+void LatencyHistogram::Reset()
+{
+	for (size_t i = 0; i < BUCKET_COUNT; i++) {
+		m_Buckets[i].store(0, std::memory_order_relaxed);
+	}
+	m_Total.store(0, std::memory_order_relaxed);
+	m_Min.store(MAX_VALUE, std::memory_order_relaxed);
+	m_Max.store(0, std::memory_order_relaxed);
+}
+
+RecordingMetrics::RecordingMetrics()
+{
+	Reset();
+}
+
+RECORDING_STATS RecordingMetrics::GetStats() const
+{
+	RECORDING_STATS stats{};
+	for (size_t i = 0; i < (size_t)RecordingTimer::Count; i++) {
+		stats.Timers[i] = m_Timers[i].GetSnapshot();
+	}
+	for (size_t i = 0; i < (size_t)RecordingCounter::Count; i++) {
+		stats.Counters[i] = m_Counters[i].load(std::memory_order_relaxed);
+	}
+	return stats;
+}
+
+void RecordingMetrics::Reset()
+{
+	for (size_t i = 0; i < (size_t)RecordingTimer::Count; i++) {
+		m_Timers[i].Reset();
+	}
+	for (size_t i = 0; i < (size_t)RecordingCounter::Count; i++) {
+		m_Counters[i].store(0, std::memory_order_relaxed);
+	}
+}
+
+const wchar_t *RecordingMetrics::GetTimerName(RecordingTimer timer)
+{
+	switch (timer)
+	{
+	case RecordingTimer::CaptureWait:
+		return L"Capture wait";
+	case RecordingTimer::CaptureWakeToCopy:
+		return L"Capture wake to copy";
+	case RecordingTimer::KeyedMutexHold:
+		return L"Keyed mutex hold";
+	case RecordingTimer::TextureProcessing:
+		return L"Texture processing";
+	case RecordingTimer::AudioGrab:
+		return L"Audio grab";
+	case RecordingTimer::EncodeSubmit:
+		return L"Encode submit";
+	case RecordingTimer::EncodeCallback:
+		return L"Encode callback";
+	case RecordingTimer::SnapshotQueueWait:
+		return L"Snapshot queue wait";
+	case RecordingTimer::SnapshotEncode:
+		return L"Snapshot encode";
+	default:
+		return L"Unknown";
+	}
+}
+
+const wchar_t *RecordingMetrics::GetCounterName(RecordingCounter counter)
+{
+	switch (counter)
+	{
+	case RecordingCounter::CapturedFrames:
+		return L"Captured frames";
+	case RecordingCounter::CaptureWakeups:
+		return L"Capture wakeups";
+	case RecordingCounter::RenderedFrames:
+		return L"Rendered frames";
+	case RecordingCounter::DroppedFrames:
+		return L"Dropped frames";
+	case RecordingCounter::DuplicatedFrames:
+		return L"Duplicated frames";
+	case RecordingCounter::ExtendedFrames:
+		return L"Extended frames";
+	case RecordingCounter::AudioUnderruns:
+		return L"Audio underruns";
+	case RecordingCounter::Snapshots:
+		return L"Snapshots";
+	case RecordingCounter::DroppedSnapshots:
+		return L"Dropped snapshots";
+	default:
+		return L"Unknown";
+	}
+}
@@ -0,0 +1,193 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+//Number of bits of precision kept for each power of two. Values are recorded with a relative error of at most 1/2^(HISTOGRAM_SUB_BUCKET_BITS-1).
+#define HISTOGRAM_SUB_BUCKET_BITS 5
+//Values up to 2^HISTOGRAM_VALUE_BITS - 1, in 100 nanosecond units (about 1.9 hours), are tracked. Larger values are counted as the maximum.
+#define HISTOGRAM_VALUE_BITS 36
+
+struct HISTOGRAM_SNAPSHOT {
+	//Number of recorded values.
+	uint64_t Count = 0;
+	//Sum of all recorded values.
+	int64_t Total = 0;
+	int64_t Min = 0;
+	int64_t Max = 0;
+	double Mean = 0;
+	int64_t P50 = 0;
+	int64_t P90 = 0;
+	int64_t P99 = 0;
+	int64_t P999 = 0;
+};
+
+/// <summary>
+/// Lock-free histogram of durations, in 100 nanosecond units.
+/// Values are grouped in log-linear buckets: every power of two is split into equally sized sub-buckets, so percentiles keep the same relative precision
+/// for microseconds and seconds, in a fixed amount of memory. Recording a value is a handful of relaxed atomic operations, and is safe from any thread.
+/// </summary>
+class LatencyHistogram
+{
+public:
+	LatencyHistogram();
+	LatencyHistogram(const LatencyHistogram &) = delete;
+	LatencyHistogram &operator=(const LatencyHistogram &) = delete;
+
+	/// <summary>
+	/// Records a value. Negative values are recorded as 0.
+	/// </summary>
+	void Record(int64_t value);
+	/// <summary>
+	/// Gets the count, min, max, mean and percentiles of the values recorded so far.
+	/// Values recorded concurrently with the call may or may not be included.
+	/// </summary>
+	HISTOGRAM_SNAPSHOT GetSnapshot() const;
+	/// <summary>
+	/// Removes all recorded values. Must not be called concurrently with Record, or the snapshot may be inconsistent.
+	/// </summary>
+	void Reset();
+
+	static size_t GetBucketIndex(int64_t value);
+	/// <summary>
+	/// The lowest value counted in a bucket.
+	/// </summary>
+	static int64_t GetBucketLowestValue(size_t index);
+	/// <summary>
+	/// The highest value counted in a bucket.
+	/// </summary>
+	static int64_t GetBucketHighestValue(size_t index);
+
+	static constexpr int64_t MAX_VALUE = (int64_t(1) << HISTOGRAM_VALUE_BITS) - 1;
+	static constexpr size_t SUB_BUCKET_COUNT = size_t(1) << HISTOGRAM_SUB_BUCKET_BITS;
+	static constexpr size_t SUB_BUCKET_HALF_COUNT = SUB_BUCKET_COUNT / 2;
+	//Values below SUB_BUCKET_COUNT get a bucket each. Every power of two above that is split into SUB_BUCKET_HALF_COUNT buckets.
+	static constexpr size_t BUCKET_COUNT = (HISTOGRAM_VALUE_BITS - HISTOGRAM_SUB_BUCKET_BITS + 2) * SUB_BUCKET_HALF_COUNT;
+
+private:
+	std::atomic<uint64_t> m_Buckets[BUCKET_COUNT];
+	std::atomic<int64_t> m_Total;
+	std::atomic<int64_t> m_Min;
+	std::atomic<int64_t> m_Max;
+
+	int64_t GetValueAtPercentile(double percentile, const uint64_t *pBuckets, uint64_t count) const;
+};
+
+enum class RecordingTimer {
+	///<summary>Time spent waiting for a new frame from the capture sources.</summary>
+	CaptureWait = 0,
+	///<summary>Time from a capture thread wakes up for a new frame until the frame is written to the shared capture surface.</summary>
+	CaptureWakeToCopy,
+	///<summary>Time the canvas buffer holding the latest captured frame is locked while the frame is copied out.</summary>
+	KeyedMutexHold,
+	///<summary>Time spent drawing overlays and the mouse pointer, cropping and resizing a frame.</summary>
+	TextureProcessing,
+	///<summary>Time spent grabbing and mixing the audio for a frame.</summary>
+	AudioGrab,
+	///<summary>Time spent submitting a frame and its audio to the encoder or image writer.</summary>
+	EncodeSubmit,
+	///<summary>Time from a video frame is submitted until the encoder is done with it and releases the sample.</summary>
+	EncodeCallback,
+	///<summary>Time from a snapshot is queued until a snapshot worker starts reading it back.</summary>
+	SnapshotQueueWait,
+	///<summary>Time spent reading back, encoding and writing a snapshot.</summary>
+	SnapshotEncode,
+	Count
+};
+
+enum class RecordingCounter {
+	///<summary>Frames acquired from the capture sources.</summary>
+	CapturedFrames = 0,
+	///<summary>Times a capture thread woke up from waiting for a frame, a signal or a deadline.</summary>
+	CaptureWakeups,
+	///<summary>Frames written to the output.</summary>
+	RenderedFrames,
+	///<summary>Frames dropped because processing or encoding fell behind.</summary>
+	DroppedFrames,
+	///<summary>Frames written without any new content since the previous frame.</summary>
+	DuplicatedFrames,
+	///<summary>Unchanged frames that extended the duration of the previous frame instead of being encoded.</summary>
+	ExtendedFrames,
+	///<summary>Frames that had no captured audio while audio recording is enabled.</summary>
+	AudioUnderruns,
+	///<summary>Snapshots written.</summary>
+	Snapshots,
+	///<summary>Snapshots skipped because the snapshot workers were still busy with earlier ones.</summary>
+	DroppedSnapshots,
+	Count
+};
+
+struct RECORDING_STATS {
+	HISTOGRAM_SNAPSHOT Timers[(size_t)RecordingTimer::Count];
+	uint64_t Counters[(size_t)RecordingCounter::Count] = {};
+
+	inline const HISTOGRAM_SNAPSHOT &GetTimer(RecordingTimer timer) const { return Timers[(size_t)timer]; }
+	inline uint64_t GetCounter(RecordingCounter counter) const { return Counters[(size_t)counter]; }
+};
+
+/// <summary>
+/// Always-on timing histograms and event counters for a recording. Safe to update from any thread.
+/// </summary>
+class RecordingMetrics
+{
+public:
+	RecordingMetrics();
+	RecordingMetrics(const RecordingMetrics &) = delete;
+	RecordingMetrics &operator=(const RecordingMetrics &) = delete;
+
+	/// <summary>
+	/// Records a duration, in 100 nanosecond units.
+	/// </summary>
+	inline void Record(RecordingTimer timer, int64_t duration) { m_Timers[(size_t)timer].Record(duration); }
+	inline void Increment(RecordingCounter counter, uint64_t count = 1) { m_Counters[(size_t)counter].fetch_add(count, std::memory_order_relaxed); }
+
+	RECORDING_STATS GetStats() const;
+	/// <summary>
+	/// Clears all timers and counters, e.g. before a new recording starts.
+	/// </summary>
+	void Reset();
+
+	static const wchar_t *GetTimerName(RecordingTimer timer);
+	static const wchar_t *GetCounterName(RecordingCounter counter);
+
+private:
+	LatencyHistogram m_Timers[(size_t)RecordingTimer::Count];
+	std::atomic<uint64_t> m_Counters[(size_t)RecordingCounter::Count];
+};
+
+/// <summary>
+/// Records the time from construction to destruction in a RecordingMetrics timer. Does nothing if the metrics are null.
+/// </summary>
+class MeasureRecordingTimer
+{
+public:
+	MeasureRecordingTimer(RecordingMetrics *pMetrics, RecordingTimer timer) :
+		m_Metrics(pMetrics),
+		m_Timer(timer),
+		m_Start(std::chrono::steady_clock::now())
+	{
+	}
+	~MeasureRecordingTimer()
+	{
+		Stop();
+	}
+	MeasureRecordingTimer(const MeasureRecordingTimer &) = delete;
+	MeasureRecordingTimer &operator=(const MeasureRecordingTimer &) = delete;
+
+	/// <summary>
+	/// Records the elapsed time now instead of on destruction.
+	/// </summary>
+	void Stop()
+	{
+		if (m_Metrics) {
+			m_Metrics->Record(m_Timer, std::chrono::duration_cast<std::chrono::duration<int64_t, std::ratio<1, 10000000>>>(std::chrono::steady_clock::now() - m_Start).count());
+			m_Metrics = nullptr;
+		}
+	}
+
+private:
+	RecordingMetrics *m_Metrics;
+	RecordingTimer m_Timer;
+	std::chrono::steady_clock::time_point m_Start;
+};
@@ -0,0 +1,226 @@
+#pragma once
+#include "FramePacer.h"
+#include "RecordingTimeline.h"
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+struct RECORDING_SIMULATION_OPTIONS {
+	//The length of the simulated recording on the media clock, in 100 nanosecond units like all times below.
+	int64_t Duration = 3600 * TIMELINE_UNITS_PER_SECOND;
+	uint32_t FramesPerSecond = 30;
+	bool IsFixedFramerate = false;
+	//How long the recorder loop waits for a changed frame before taking an unchanged one, like RecordingManager::m_MaxFrameLengthMillis.
+	int64_t MaxFrameLength = TIMELINE_UNITS_PER_SECOND / 2;
+	//The longest time unchanged frames extend the last encoded frame, like RecordingManager::m_MaxFrameExtensionMillis.
+	int64_t MaxFrameExtension = TIMELINE_UNITS_PER_SECOND;
+	//How late the recorder loop wakes up from every wait.
+	int64_t WakeLatency = 0;
+	//The time the recorder loop spends on the frame with the given index after taking it. If not set, frames take no time.
+	std::function<int64_t(uint64_t frame)> GetFrameProcessingTime;
+	//The first time at or after the given time the captured content changes, or INT64_MAX if it does not. If not set, the content changes continuously.
+	std::function<int64_t(int64_t time)> GetNextContentChange;
+	//Whether the frame with the given index is dropped by a full queue, and folded into the frame after it. If not set, no frames are dropped.
+	std::function<bool(uint64_t frame)> IsFrameDropped;
+	//The sample rate of the recorded audio, or 0 to record no audio.
+	uint32_t AudioSamplesPerSecond = 48000;
+	//How much faster the clock of the audio device runs than the media clock, in parts per million. Negative if it runs slower.
+	double AudioClockSkewPpm = 0;
+	//The interval the audio device delivers audio in, e.g. the period of a WASAPI capture.
+	int64_t AudioPacketDuration = TIMELINE_UNITS_PER_SECOND / 100;
+	//Whether to keep every frame in the timeline of the result. An hour long recording has hundreds of thousands of frames.
+	bool IsTimelineKept = false;
+};
+
+struct SIMULATED_FRAME {
+	//When the frame was taken on the media clock.
+	int64_t CaptureTime = 0;
+	//Where the frame was written on the timeline of the output, after it was stretched to its audio.
+	FRAME_TIMING Timing{};
+	uint64_t AudioFrames = 0;
+	//False if the frame only extended the last encoded frame, because its content was unchanged.
+	bool IsEncoded = false;
+};
+
+struct RECORDING_SIMULATION_RESULT {
+	//Every frame written, if RECORDING_SIMULATION_OPTIONS::IsTimelineKept is set.
+	std::vector<SIMULATED_FRAME> Timeline;
+	//Frames taken by the recorder loop, the frames of them that were encoded, and those dropped and folded into the next frame.
+	uint64_t Frames = 0;
+	uint64_t EncodedFrames = 0;
+	uint64_t DroppedFrames = 0;
+	//The longest time on the timeline between two encoded frames.
+	int64_t MaxEncodedFrameGap = 0;
+	//Audio frames written, and the position on the timeline where the video and the audio end.
+	uint64_t AudioFrames = 0;
+	int64_t VideoEndPos = 0;
+	int64_t AudioEndPos = 0;
+	//The largest distance between the end of the video and the end of the audio after any frame, and after the last one. Only measured when audio is recorded.
+	int64_t MaxAvOffset = 0;
+	int64_t FinalAvOffset = 0;
+	//How far the timeline ended up ahead of the media clock, from frames stretched to their audio. Negative if behind.
+	int64_t TimelineOffset = 0;
+	FRAME_PACING_STATS Pacing{};
+
+	bool IsAvSyncWithin(int64_t bound) const { return MaxAvOffset <= bound; }
+};
+
+/// <summary>
+/// Simulates the timing of a recording on a virtual clock: the pacing and capture of frames in the recorder loop and ScreenCaptureManager::AcquireNextFrame,
+/// the timeline of frames and the audio grabbed for them in RecordingManager, and an audio device delivering audio at a clock rate of its own, like WASAPICapture.
+/// The timeline uses the same FramePacer, RecordingTimeline and AudioTimelineAligner as a recording, so timing issues like audio drift, frames extended for too long
+/// or frames taken late can be reproduced deterministically, and hours of recording are simulated in seconds without capturing the screen.
+/// The simulation is portable and needs no GPU or audio device.
+/// </summary>
+class RecordingSimulator
+{
+public:
+	static RECORDING_SIMULATION_RESULT Run(const RECORDING_SIMULATION_OPTIONS &options)
+	{
+		RECORDING_SIMULATION_RESULT result{};
+		auto clock = std::make_shared<VirtualPacingClock>();
+		clock->SetWakeLatency(options.WakeLatency);
+		FramePacer pacer(clock, options.IsFixedFramerate ? FramePacingMode::FixedRate : FramePacingMode::VariableRate);
+		pacer.SetFrameRate(options.FramesPerSecond);
+		RecordingTimeline timeline{};
+		AudioTimelineAligner audioAligner{};
+		SimulatedAudioDevice audioDevice(options);
+
+		int64_t lastCaptureTime = 0;
+		int64_t lastEncodedStartPos = 0;
+		bool hasEncodedFrame = false;
+		//The timing and content of frames dropped since the last frame written, which go with the next one.
+		FRAME_TIMING droppedTiming{};
+		bool hasDroppedFrame = false;
+		bool isDroppedFrameEncoded = false;
+		for (uint64_t index = 0;; index++) {
+			//Wait for the frame like ScreenCaptureManager::AcquireNextFrame. Fixed framerate recordings, and changed content, are taken when the frame is due.
+			//Otherwise the frame is taken when the content changes, or unchanged after waiting for MaxFrameLength.
+			int64_t waitStart = clock->GetTime();
+			int64_t due = waitStart + pacer.GetTimeUntilNextFrame();
+			if (due >= options.Duration) {
+				break;
+			}
+			int64_t nextChange = options.GetNextContentChange ? options.GetNextContentChange(lastCaptureTime + 1) : lastCaptureTime + 1;
+			bool isChanged = index == 0 || options.IsFixedFramerate || nextChange <= due;
+			int64_t wakeTime = due;
+			if (!isChanged) {
+				int64_t timeout = waitStart + options.MaxFrameLength;
+				isChanged = nextChange <= timeout;
+				wakeTime = (std::max)(due, isChanged ? nextChange : timeout);
+			}
+			if (wakeTime >= options.Duration) {
+				//The recording ends before an unchanged frame is taken.
+				break;
+			}
+			if (wakeTime > clock->GetTime()) {
+				clock->WaitUntil(wakeTime);
+			}
+			int64_t timestamp = clock->GetTime();
+			if (!isChanged && options.GetNextContentChange) {
+				//The wake up latency may have let a change in.
+				isChanged = options.GetNextContentChange(lastCaptureTime + 1) <= timestamp;
+			}
+			lastCaptureTime = timestamp;
+
+			//Place the frame like RecordingManager::StartRecorderLoop.
+			pacer.OnFrame(timestamp);
+			FRAME_TIMING timing = timeline.NextFrame(timestamp);
+			bool isUnchangedFrame = !options.IsFixedFramerate
+				&& index > 0
+				&& !isChanged
+				&& timeline.CanExtendEncodedFrame(timestamp, options.MaxFrameExtension);
+			if (!isUnchangedFrame) {
+				timeline.OnFrameEncoded(timing);
+			}
+			result.Frames++;
+			if (options.GetFrameProcessingTime) {
+				clock->Advance(options.GetFrameProcessingTime(index));
+			}
+			if (options.IsFrameDropped && options.IsFrameDropped(index)) {
+				if (hasDroppedFrame) {
+					FoldDroppedFrameTiming(timing, droppedTiming);
+				}
+				droppedTiming = timing;
+				hasDroppedFrame = true;
+				isDroppedFrameEncoded |= !isUnchangedFrame;
+				result.DroppedFrames++;
+				continue;
+			}
+			if (hasDroppedFrame) {
+				FoldDroppedFrameTiming(timing, droppedTiming);
+				isUnchangedFrame &= !isDroppedFrameEncoded;
+				hasDroppedFrame = false;
+				isDroppedFrameEncoded = false;
+			}
+
+			//Grab the audio for the frame and stretch the frame to it, like the compose stage.
+			uint64_t audioFrames = audioDevice.Grab(timing.Duration, clock->GetTime());
+			audioAligner.Align(timing, audioFrames, options.AudioSamplesPerSecond);
+			result.AudioFrames += audioFrames;
+			result.VideoEndPos = timing.StartPos + timing.Duration;
+			result.AudioEndPos = GetAudioDuration(result.AudioFrames, options.AudioSamplesPerSecond);
+			if (options.AudioSamplesPerSecond > 0) {
+				result.FinalAvOffset = result.VideoEndPos - result.AudioEndPos;
+				result.MaxAvOffset = (std::max)(result.MaxAvOffset, result.FinalAvOffset < 0 ? -result.FinalAvOffset : result.FinalAvOffset);
+			}
+			if (!isUnchangedFrame) {
+				if (hasEncodedFrame) {
+					result.MaxEncodedFrameGap = (std::max)(result.MaxEncodedFrameGap, timing.StartPos - lastEncodedStartPos);
+				}
+				lastEncodedStartPos = timing.StartPos;
+				hasEncodedFrame = true;
+				result.EncodedFrames++;
+			}
+			if (options.IsTimelineKept) {
+				SIMULATED_FRAME frame;
+				frame.CaptureTime = timestamp;
+				frame.Timing = timing;
+				frame.AudioFrames = audioFrames;
+				frame.IsEncoded = !isUnchangedFrame;
+				result.Timeline.push_back(frame);
+			}
+		}
+		result.TimelineOffset = audioAligner.GetOffset();
+		result.Pacing = pacer.GetStats();
+		return result;
+	}
+
+private:
+	/// <summary>
+	/// An audio device delivering audio in packets, on a clock that may run at a slightly different rate than the media clock.
+	/// Audio is grabbed like WASAPICapture::GetRecordedBytes: the audio frames covering the duration, rounded up, or as many as were delivered.
+	/// </summary>
+	class SimulatedAudioDevice
+	{
+	public:
+		SimulatedAudioDevice(const RECORDING_SIMULATION_OPTIONS &options) :
+			m_SamplesPerSecond(options.AudioSamplesPerSecond),
+			m_ClockRate(1 + options.AudioClockSkewPpm / 1000000),
+			m_PacketFrames((std::max)(GetAudioFrameCount(options.AudioPacketDuration, options.AudioSamplesPerSecond), (uint64_t)1)),
+			m_GrabbedFrames(0)
+		{
+		}
+
+		uint64_t Grab(int64_t duration, int64_t time)
+		{
+			if (m_SamplesPerSecond == 0 || duration <= 0) {
+				return 0;
+			}
+			double deviceFrames = static_cast<double>(time) * m_ClockRate * m_SamplesPerSecond / TIMELINE_UNITS_PER_SECOND;
+			uint64_t deliveredFrames = deviceFrames > 0 ? static_cast<uint64_t>(deviceFrames) / m_PacketFrames * m_PacketFrames : 0;
+			uint64_t availableFrames = deliveredFrames > m_GrabbedFrames ? deliveredFrames - m_GrabbedFrames : 0;
+			uint64_t frames = (std::min)(GetAudioFrameCount(duration, m_SamplesPerSecond), availableFrames);
+			m_GrabbedFrames += frames;
+			return frames;
+		}
+
+	private:
+		uint32_t m_SamplesPerSecond;
+		double m_ClockRate;
+		uint64_t m_PacketFrames;
+		uint64_t m_GrabbedFrames;
+	};
+};
@@ -0,0 +1,126 @@
+#pragma once
+#include <cstdint>
+
+//100 nanosecond units per second, the unit of the media clock and of the timestamps written to the outputs.
+#define TIMELINE_UNITS_PER_SECOND 10000000ll
+
+/// <summary>
+/// The number of audio frames covering the given duration, rounded up like the audio captures request them.
+/// </summary>
+inline uint64_t GetAudioFrameCount(uint64_t duration100Nanos, uint32_t samplesPerSecond)
+{
+	return (duration100Nanos * samplesPerSecond + TIMELINE_UNITS_PER_SECOND - 1) / TIMELINE_UNITS_PER_SECOND;
+}
+
+/// <summary>
+/// The duration of the given number of audio frames, in 100 nanosecond units, rounded down.
+/// </summary>
+inline int64_t GetAudioDuration(uint64_t audioFrames, uint32_t samplesPerSecond)
+{
+	return samplesPerSecond > 0 ? static_cast<int64_t>(audioFrames * TIMELINE_UNITS_PER_SECOND / samplesPerSecond) : 0;
+}
+
+struct FRAME_TIMING {
+	//The position of the frame on the timeline, and how long it is shown, in 100 nanosecond units.
+	int64_t StartPos = 0;
+	int64_t Duration = 0;
+};
+
+/// <summary>
+/// Places the frames taken by the recorder loop on the timeline. Each frame lasts from the end of the frame before it until it is taken,
+/// so the frames cover the media clock without gaps, however irregularly they are taken.
+/// Used from the thread taking the frames only.
+/// </summary>
+class RecordingTimeline
+{
+public:
+	RecordingTimeline() :
+		m_LastFrameEndPos(0),
+		m_LastEncodedFrameStartPos(0)
+	{
+	}
+
+	/// <summary>
+	/// Places the frame taken at the given time of the media clock.
+	/// </summary>
+	FRAME_TIMING NextFrame(int64_t timestamp)
+	{
+		FRAME_TIMING timing;
+		timing.StartPos = m_LastFrameEndPos;
+		timing.Duration = timestamp - m_LastFrameEndPos;
+		m_LastFrameEndPos = timestamp;
+		return timing;
+	}
+
+	/// <summary>
+	/// Records that the frame is encoded, rather than extending the frame before it.
+	/// </summary>
+	void OnFrameEncoded(const FRAME_TIMING &timing)
+	{
+		m_LastEncodedFrameStartPos = timing.StartPos;
+	}
+
+	/// <summary>
+	/// Whether an unchanged frame taken at the given time may still extend the last encoded frame, rather than being encoded.
+	/// A frame is encoded at least every maxExtension, so the encoder keeps receiving video.
+	/// </summary>
+	bool CanExtendEncodedFrame(int64_t timestamp, int64_t maxExtension) const
+	{
+		return timestamp - m_LastEncodedFrameStartPos < maxExtension;
+	}
+
+private:
+	int64_t m_LastFrameEndPos;
+	int64_t m_LastEncodedFrameStartPos;
+};
+
+/// <summary>
+/// Stretches the frames on the timeline to the length of the audio written with them, so audio and video stay in step in the output
+/// even if the audio device delivers more or less audio than the media clock advanced, e.g. because its clock runs at a slightly different rate.
+/// The difference from the media clock is carried over to the positions of the frames after it.
+/// Used from the thread grabbing the audio only.
+/// </summary>
+class AudioTimelineAligner
+{
+public:
+	AudioTimelineAligner() :
+		m_Offset(0),
+		m_AudioFrames(0)
+	{
+	}
+
+	/// <summary>
+	/// Moves the frame by the offset built up so far, and stretches it to the duration of its audio frames, if it has any.
+	/// </summary>
+	void Align(FRAME_TIMING &timing, uint64_t audioFrames, uint32_t samplesPerSecond)
+	{
+		int64_t diff = 0;
+		if (audioFrames > 0 && samplesPerSecond > 0) {
+			//The duration is taken from the total audio written, so rounding it down does not add up over the frames.
+			int64_t audioDuration = GetAudioDuration(m_AudioFrames + audioFrames, samplesPerSecond) - GetAudioDuration(m_AudioFrames, samplesPerSecond);
+			m_AudioFrames += audioFrames;
+			diff = audioDuration - timing.Duration;
+		}
+		timing.StartPos += m_Offset;
+		timing.Duration += diff;
+		m_Offset += diff;
+	}
+
+	/// <summary>
+	/// How far the timeline is ahead of the media clock, in 100 nanosecond units, from the audio being longer than the frames it was grabbed for.
+	/// </summary>
+	int64_t GetOffset() const { return m_Offset; }
+
+private:
+	int64_t m_Offset;
+	uint64_t m_AudioFrames;
+};
+
+/// <summary>
+/// Folds the timing of a frame dropped by a full queue into the frame that takes its place, so the timeline stays continuous.
+/// </summary>
+inline void FoldDroppedFrameTiming(FRAME_TIMING &survivor, const FRAME_TIMING &dropped)
+{
+	survivor.StartPos = dropped.StartPos < survivor.StartPos ? dropped.StartPos : survivor.StartPos;
+	survivor.Duration += dropped.Duration;
+}
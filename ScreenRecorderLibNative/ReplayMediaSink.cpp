@@ -0,0 +1,536 @@
+#include "ReplayMediaSink.h"
+#include "Log.h"
+#include "Util.h"
+
+void ReplayPassthrough::SetWriter(_In_opt_ IMFSinkWriter *pWriter)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_Writer = pWriter;
+}
+
+HRESULT ReplayPassthrough::WriteSample(_In_ DWORD streamIndex, _In_ IMFSample *pSample)
+{
+	//The video and audio streams take samples on different threads, and the writer may be detached while they do.
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	if (!m_Writer) {
+		return S_FALSE;
+	}
+	return m_Writer->WriteSample(streamIndex, pSample);
+}
+
+CComPtr<IMFSinkWriter> ReplayPassthrough::DetachWriter()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	CComPtr<IMFSinkWriter> pWriter;
+	pWriter.Attach(m_Writer.Detach());
+	return pWriter;
+}
+
+CReplayStreamSink::CReplayStreamSink(_In_ CReplayMediaSink *pSink, _In_ DWORD streamId, _In_ IMFMediaType *pMediaType, _In_ std::shared_ptr<ReplaySampleBuffer> pBuffer, _In_opt_ std::shared_ptr<ReplayPassthrough> pPassthrough) :
+	m_nRefCount(1),
+	m_Sink(pSink),
+	m_StreamId(streamId),
+	m_MediaType(pMediaType),
+	m_EventQueue(nullptr),
+	m_Buffer(pBuffer),
+	m_Passthrough(pPassthrough),
+	m_IsShutdown(false)
+{
+}
+
+CReplayStreamSink::~CReplayStreamSink()
+{
+}
+
+HRESULT CReplayStreamSink::Initialize()
+{
+	return MFCreateEventQueue(&m_EventQueue);
+}
+
+HRESULT CReplayStreamSink::Start()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	RETURN_ON_BAD_HR(CheckShutdown());
+	RETURN_ON_BAD_HR(m_EventQueue->QueueEventParamVar(MEStreamSinkStarted, GUID_NULL, S_OK, nullptr));
+	return m_EventQueue->QueueEventParamVar(MEStreamSinkRequestSample, GUID_NULL, S_OK, nullptr);
+}
+
+HRESULT CReplayStreamSink::Stop()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	RETURN_ON_BAD_HR(CheckShutdown());
+	return m_EventQueue->QueueEventParamVar(MEStreamSinkStopped, GUID_NULL, S_OK, nullptr);
+}
+
+HRESULT CReplayStreamSink::Pause()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	RETURN_ON_BAD_HR(CheckShutdown());
+	return m_EventQueue->QueueEventParamVar(MEStreamSinkPaused, GUID_NULL, S_OK, nullptr);
+}
+
+void CReplayStreamSink::Shutdown()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	if (m_IsShutdown) {
+		return;
+	}
+	if (m_EventQueue) {
+		m_EventQueue->Shutdown();
+	}
+	m_EventQueue.Release();
+	m_Sink = nullptr;
+	m_IsShutdown = true;
+}
+
+STDMETHODIMP CReplayStreamSink::GetMediaSink(IMFMediaSink **ppMediaSink)
+{
+	if (!ppMediaSink) {
+		return E_POINTER;
+	}
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	RETURN_ON_BAD_HR(CheckShutdown());
+	*ppMediaSink = m_Sink;
+	(*ppMediaSink)->AddRef();
+	return S_OK;
+}
+
+STDMETHODIMP CReplayStreamSink::GetIdentifier(DWORD *pdwIdentifier)
+{
+	if (!pdwIdentifier) {
+		return E_POINTER;
+	}
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	RETURN_ON_BAD_HR(CheckShutdown());
+	*pdwIdentifier = m_StreamId;
+	return S_OK;
+}
+
+STDMETHODIMP CReplayStreamSink::GetMediaTypeHandler(IMFMediaTypeHandler **ppHandler)
+{
+	if (!ppHandler) {
+		return E_POINTER;
+	}
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	RETURN_ON_BAD_HR(CheckShutdown());
+	return QueryInterface(IID_PPV_ARGS(ppHandler));
+}
+
+STDMETHODIMP CReplayStreamSink::ProcessSample(IMFSample *pSample)
+{
+	if (!pSample) {
+		return E_POINTER;
+	}
+	CComPtr<IMFSample> pCopy;
+	DWORD length = 0;
+	RETURN_ON_BAD_HR(CopySample(pSample, &pCopy, &length));
+	REPLAY_SAMPLE<CComPtr<IMFSample>> sample{};
+	sample.StreamIndex = m_StreamId;
+	RETURN_ON_BAD_HR(pSample->GetSampleTime(&sample.Time));
+	if (FAILED(pSample->GetSampleDuration(&sample.Duration))) {
+		sample.Duration = 0;
+	}
+	sample.IsKeyframe = MFGetAttributeUINT32(pSample, MFSampleExtension_CleanPoint, FALSE) != FALSE;
+	sample.Bytes = length;
+	sample.Payload = pCopy;
+	if (m_Passthrough) {
+		//The copy is written, as the encoder may reuse the sample. The writer only reads it, so the replay buffer can share it.
+		RETURN_ON_BAD_HR(m_Passthrough->WriteSample(m_StreamId, pCopy));
+	}
+
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	RETURN_ON_BAD_HR(CheckShutdown());
+	m_Buffer->Push(std::move(sample));
+	//The passthrough writer queues samples without throttling, so the next one can be taken right away.
+	return m_EventQueue->QueueEventParamVar(MEStreamSinkRequestSample, GUID_NULL, S_OK, nullptr);
+}
+
+STDMETHODIMP CReplayStreamSink::PlaceMarker(MFSTREAMSINK_MARKER_TYPE eMarkerType, const PROPVARIANT *pvarMarkerValue, const PROPVARIANT *pvarContextValue)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	RETURN_ON_BAD_HR(CheckShutdown());
+	//Every sample before the marker has already been processed, so the marker is reached at once.
+	return m_EventQueue->QueueEventParamVar(MEStreamSinkMarker, GUID_NULL, S_OK, pvarContextValue);
+}
+
+STDMETHODIMP CReplayStreamSink::Flush()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	return CheckShutdown();
+}
+
+STDMETHODIMP CReplayStreamSink::GetEvent(DWORD dwFlags, IMFMediaEvent **ppEvent)
+{
+	//GetEvent can block, so it is called on a reference to the queue outside of the lock.
+	CComPtr<IMFMediaEventQueue> pQueue;
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		RETURN_ON_BAD_HR(CheckShutdown());
+		pQueue = m_EventQueue;
+	}
+	return pQueue->GetEvent(dwFlags, ppEvent);
+}
+
+STDMETHODIMP CReplayStreamSink::BeginGetEvent(IMFAsyncCallback *pCallback, IUnknown *punkState)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	RETURN_ON_BAD_HR(CheckShutdown());
+	return m_EventQueue->BeginGetEvent(pCallback, punkState);
+}
+
+STDMETHODIMP CReplayStreamSink::EndGetEvent(IMFAsyncResult *pResult, IMFMediaEvent **ppEvent)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	RETURN_ON_BAD_HR(CheckShutdown());
+	return m_EventQueue->EndGetEvent(pResult, ppEvent);
+}
+
+STDMETHODIMP CReplayStreamSink::QueueEvent(MediaEventType met, REFGUID guidExtendedType, HRESULT hrStatus, const PROPVARIANT *pvValue)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	RETURN_ON_BAD_HR(CheckShutdown());
+	return m_EventQueue->QueueEventParamVar(met, guidExtendedType, hrStatus, pvValue);
+}
+
+STDMETHODIMP CReplayStreamSink::IsMediaTypeSupported(IMFMediaType *pMediaType, IMFMediaType **ppMediaType)
+{
+	if (!pMediaType) {
+		return E_POINTER;
+	}
+	if (ppMediaType) {
+		*ppMediaType = nullptr;
+	}
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	RETURN_ON_BAD_HR(CheckShutdown());
+	GUID majorType, supportedMajorType;
+	RETURN_ON_BAD_HR(pMediaType->GetMajorType(&majorType));
+	RETURN_ON_BAD_HR(m_MediaType->GetMajorType(&supportedMajorType));
+	return majorType == supportedMajorType ? S_OK : MF_E_INVALIDMEDIATYPE;
+}
+
+STDMETHODIMP CReplayStreamSink::GetMediaTypeCount(DWORD *pdwTypeCount)
+{
+	if (!pdwTypeCount) {
+		return E_POINTER;
+	}
+	*pdwTypeCount = 1;
+	return S_OK;
+}
+
+STDMETHODIMP CReplayStreamSink::GetMediaTypeByIndex(DWORD dwIndex, IMFMediaType **ppType)
+{
+	if (dwIndex > 0) {
+		return MF_E_NO_MORE_TYPES;
+	}
+	return GetCurrentMediaType(ppType);
+}
+
+STDMETHODIMP CReplayStreamSink::SetCurrentMediaType(IMFMediaType *pMediaType)
+{
+	RETURN_ON_BAD_HR(IsMediaTypeSupported(pMediaType, nullptr));
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_MediaType = pMediaType;
+	return S_OK;
+}
+
+STDMETHODIMP CReplayStreamSink::GetCurrentMediaType(IMFMediaType **ppMediaType)
+{
+	if (!ppMediaType) {
+		return E_POINTER;
+	}
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	RETURN_ON_BAD_HR(CheckShutdown());
+	*ppMediaType = m_MediaType;
+	(*ppMediaType)->AddRef();
+	return S_OK;
+}
+
+STDMETHODIMP CReplayStreamSink::GetMajorType(GUID *pguidMajorType)
+{
+	if (!pguidMajorType) {
+		return E_POINTER;
+	}
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	RETURN_ON_BAD_HR(CheckShutdown());
+	return m_MediaType->GetMajorType(pguidMajorType);
+}
+
+STDMETHODIMP CReplayStreamSink::QueryInterface(REFIID riid, void **ppv)
+{
+	static const QITAB qit[] = {
+		QITABENT(CReplayStreamSink, IMFStreamSink),
+		QITABENT(CReplayStreamSink, IMFMediaEventGenerator),
+		QITABENT(CReplayStreamSink, IMFMediaTypeHandler),
+	{0}
+	};
+	return QISearch(this, qit, riid, ppv);
+}
+
+STDMETHODIMP_(ULONG) CReplayStreamSink::AddRef()
+{
+	return InterlockedIncrement(&m_nRefCount);
+}
+
+STDMETHODIMP_(ULONG) CReplayStreamSink::Release()
+{
+	ULONG refCount = InterlockedDecrement(&m_nRefCount);
+	if (refCount == 0) {
+		delete this;
+	}
+	return refCount;
+}
+
+HRESULT CReplayStreamSink::CheckShutdown()
+{
+	return m_IsShutdown ? MF_E_SHUTDOWN : S_OK;
+}
+
+HRESULT CReplayStreamSink::CopySample(_In_ IMFSample *pSample, _Outptr_ IMFSample **ppCopy, _Out_ DWORD *pLength)
+{
+	*ppCopy = nullptr;
+	*pLength = 0;
+	CComPtr<IMFMediaBuffer> pSourceBuffer;
+	RETURN_ON_BAD_HR(pSample->ConvertToContiguousBuffer(&pSourceBuffer));
+	DWORD length = 0;
+	RETURN_ON_BAD_HR(pSourceBuffer->GetCurrentLength(&length));
+	CComPtr<IMFMediaBuffer> pBuffer;
+	RETURN_ON_BAD_HR(MFCreateMemoryBuffer(length, &pBuffer));
+	BYTE *pSourceData = nullptr;
+	BYTE *pData = nullptr;
+	RETURN_ON_BAD_HR(pSourceBuffer->Lock(&pSourceData, nullptr, nullptr));
+	HRESULT hr = pBuffer->Lock(&pData, nullptr, nullptr);
+	if (SUCCEEDED(hr)) {
+		memcpy(pData, pSourceData, length);
+		pBuffer->Unlock();
+	}
+	pSourceBuffer->Unlock();
+	RETURN_ON_BAD_HR(hr);
+	RETURN_ON_BAD_HR(pBuffer->SetCurrentLength(length));
+
+	CComPtr<IMFSample> pCopy;
+	RETURN_ON_BAD_HR(MFCreateSample(&pCopy));
+	//The attributes carry e.g. the keyframe flag, which the MP4 sink needs when the replay is saved.
+	RETURN_ON_BAD_HR(pSample->CopyAllItems(pCopy));
+	RETURN_ON_BAD_HR(pCopy->AddBuffer(pBuffer));
+	LONGLONG time = 0;
+	if (SUCCEEDED(pSample->GetSampleTime(&time))) {
+		RETURN_ON_BAD_HR(pCopy->SetSampleTime(time));
+	}
+	LONGLONG duration = 0;
+	if (SUCCEEDED(pSample->GetSampleDuration(&duration))) {
+		RETURN_ON_BAD_HR(pCopy->SetSampleDuration(duration));
+	}
+	*ppCopy = pCopy.Detach();
+	*pLength = length;
+	return S_OK;
+}
+
+CReplayMediaSink::CReplayMediaSink() :
+	m_nRefCount(1),
+	m_Clock(nullptr),
+	m_IsShutdown(false)
+{
+}
+
+CReplayMediaSink::~CReplayMediaSink()
+{
+	Shutdown();
+}
+
+HRESULT CReplayMediaSink::CreateInstance(_In_ IMFMediaType *pVideoMediaType, _In_opt_ IMFMediaType *pAudioMediaType, _In_ std::shared_ptr<ReplaySampleBuffer> pBuffer, _In_opt_ std::shared_ptr<ReplayPassthrough> pPassthrough, _Outptr_ IMFMediaSink **ppSink)
+{
+	*ppSink = nullptr;
+	CComPtr<IMFMediaSink> pSink;
+	CReplayMediaSink *pReplaySink = new (std::nothrow)CReplayMediaSink();
+	if (!pReplaySink) {
+		return E_OUTOFMEMORY;
+	}
+	pSink.Attach(pReplaySink);
+	IMFMediaType *mediaTypes[] = { pVideoMediaType, pAudioMediaType };
+	for (DWORD streamId = 0; streamId < ARRAYSIZE(mediaTypes) && mediaTypes[streamId]; streamId++) {
+		CReplayStreamSink *pStream = new (std::nothrow)CReplayStreamSink(pReplaySink, streamId, mediaTypes[streamId], pBuffer, pPassthrough);
+		if (!pStream) {
+			return E_OUTOFMEMORY;
+		}
+		pReplaySink->m_Streams.push_back(pStream);
+		RETURN_ON_BAD_HR(pStream->Initialize());
+	}
+	*ppSink = pSink.Detach();
+	return S_OK;
+}
+
+STDMETHODIMP CReplayMediaSink::GetCharacteristics(DWORD *pdwCharacteristics)
+{
+	if (!pdwCharacteristics) {
+		return E_POINTER;
+	}
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	RETURN_ON_BAD_HR(CheckShutdown());
+	//Samples are taken as fast as the encoders produce them.
+	*pdwCharacteristics = MEDIASINK_FIXED_STREAMS | MEDIASINK_RATELESS;
+	return S_OK;
+}
+
+STDMETHODIMP CReplayMediaSink::AddStreamSink(DWORD dwStreamSinkIdentifier, IMFMediaType *pMediaType, IMFStreamSink **ppStreamSink)
+{
+	return MF_E_STREAMSINKS_FIXED;
+}
+
+STDMETHODIMP CReplayMediaSink::RemoveStreamSink(DWORD dwStreamSinkIdentifier)
+{
+	return MF_E_STREAMSINKS_FIXED;
+}
+
+STDMETHODIMP CReplayMediaSink::GetStreamSinkCount(DWORD *pcStreamSinkCount)
+{
+	if (!pcStreamSinkCount) {
+		return E_POINTER;
+	}
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	RETURN_ON_BAD_HR(CheckShutdown());
+	*pcStreamSinkCount = static_cast<DWORD>(m_Streams.size());
+	return S_OK;
+}
+
+STDMETHODIMP CReplayMediaSink::GetStreamSinkByIndex(DWORD dwIndex, IMFStreamSink **ppStreamSink)
+{
+	if (!ppStreamSink) {
+		return E_POINTER;
+	}
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	RETURN_ON_BAD_HR(CheckShutdown());
+	if (dwIndex >= m_Streams.size()) {
+		return MF_E_INVALIDINDEX;
+	}
+	*ppStreamSink = m_Streams[dwIndex];
+	(*ppStreamSink)->AddRef();
+	return S_OK;
+}
+
+STDMETHODIMP CReplayMediaSink::GetStreamSinkById(DWORD dwStreamSinkIdentifier, IMFStreamSink **ppStreamSink)
+{
+	//The streams are identified by their index.
+	HRESULT hr = GetStreamSinkByIndex(dwStreamSinkIdentifier, ppStreamSink);
+	return hr == MF_E_INVALIDINDEX ? MF_E_INVALIDSTREAMNUMBER : hr;
+}
+
+STDMETHODIMP CReplayMediaSink::SetPresentationClock(IMFPresentationClock *pPresentationClock)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	RETURN_ON_BAD_HR(CheckShutdown());
+	if (m_Clock) {
+		RETURN_ON_BAD_HR(m_Clock->RemoveClockStateSink(this));
+	}
+	if (pPresentationClock) {
+		RETURN_ON_BAD_HR(pPresentationClock->AddClockStateSink(this));
+	}
+	m_Clock = pPresentationClock;
+	return S_OK;
+}
+
+STDMETHODIMP CReplayMediaSink::GetPresentationClock(IMFPresentationClock **ppPresentationClock)
+{
+	if (!ppPresentationClock) {
+		return E_POINTER;
+	}
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	RETURN_ON_BAD_HR(CheckShutdown());
+	if (!m_Clock) {
+		return MF_E_NO_CLOCK;
+	}
+	*ppPresentationClock = m_Clock;
+	(*ppPresentationClock)->AddRef();
+	return S_OK;
+}
+
+STDMETHODIMP CReplayMediaSink::Shutdown()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	if (m_IsShutdown) {
+		return MF_E_SHUTDOWN;
+	}
+	for each (CReplayStreamSink *pStream in m_Streams)
+	{
+		pStream->Shutdown();
+		pStream->Release();
+	}
+	m_Streams.clear();
+	if (m_Clock) {
+		m_Clock->RemoveClockStateSink(this);
+		m_Clock.Release();
+	}
+	m_IsShutdown = true;
+	return S_OK;
+}
+
+STDMETHODIMP CReplayMediaSink::OnClockStart(MFTIME hnsSystemTime, LONGLONG llClockStartOffset)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	RETURN_ON_BAD_HR(CheckShutdown());
+	for each (CReplayStreamSink *pStream in m_Streams)
+	{
+		RETURN_ON_BAD_HR(pStream->Start());
+	}
+	return S_OK;
+}
+
+STDMETHODIMP CReplayMediaSink::OnClockStop(MFTIME hnsSystemTime)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	RETURN_ON_BAD_HR(CheckShutdown());
+	for each (CReplayStreamSink *pStream in m_Streams)
+	{
+		RETURN_ON_BAD_HR(pStream->Stop());
+	}
+	return S_OK;
+}
+
+STDMETHODIMP CReplayMediaSink::OnClockPause(MFTIME hnsSystemTime)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	RETURN_ON_BAD_HR(CheckShutdown());
+	for each (CReplayStreamSink *pStream in m_Streams)
+	{
+		RETURN_ON_BAD_HR(pStream->Pause());
+	}
+	return S_OK;
+}
+
+STDMETHODIMP CReplayMediaSink::OnClockRestart(MFTIME hnsSystemTime)
+{
+	return OnClockStart(hnsSystemTime, PRESENTATION_CURRENT_POSITION);
+}
+
+STDMETHODIMP CReplayMediaSink::OnClockSetRate(MFTIME hnsSystemTime, float flRate)
+{
+	return S_OK;
+}
+
+STDMETHODIMP CReplayMediaSink::QueryInterface(REFIID riid, void **ppv)
+{
+	static const QITAB qit[] = {
+		QITABENT(CReplayMediaSink, IMFMediaSink),
+		QITABENT(CReplayMediaSink, IMFClockStateSink),
+	{0}
+	};
+	return QISearch(this, qit, riid, ppv);
+}
+
+STDMETHODIMP_(ULONG) CReplayMediaSink::AddRef()
+{
+	return InterlockedIncrement(&m_nRefCount);
+}
+
+STDMETHODIMP_(ULONG) CReplayMediaSink::Release()
+{
+	ULONG refCount = InterlockedDecrement(&m_nRefCount);
+	if (refCount == 0) {
+		delete this;
+	}
+	return refCount;
+}
+
+HRESULT CReplayMediaSink::CheckShutdown()
+{
+	return m_IsShutdown ? MF_E_SHUTDOWN : S_OK;
+}
@@ -0,0 +1,139 @@
+#pragma once
+#include "ReplayRingBuffer.h"
+#include <mfapi.h>
+#include <mfidl.h>
+#include <mfreadwrite.h>
+#include <mferror.h>
+#include <Shlwapi.h>
+#include <atlbase.h>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+typedef ReplayRingBuffer<CComPtr<IMFSample>> ReplaySampleBuffer;
+
+/// <summary>
+/// Passes the encoded samples of a CReplayMediaSink on to a sink writer that muxes them as they are, so the recording is still written to its output while the replay buffer is filled.
+/// </summary>
+class ReplayPassthrough {
+public:
+	/// <summary>
+	/// Sets the writer the samples are passed to. It is set once the media types of the streams are negotiated, before the first sample is encoded.
+	/// </summary>
+	void SetWriter(_In_opt_ IMFSinkWriter *pWriter);
+	/// <returns>S_FALSE if no writer is set, else the result of writing the sample</returns>
+	HRESULT WriteSample(_In_ DWORD streamIndex, _In_ IMFSample *pSample);
+	/// <summary>
+	/// Removes the writer, so it can be finalized once the replay sink takes no more samples.
+	/// </summary>
+	CComPtr<IMFSinkWriter> DetachWriter();
+private:
+	std::mutex m_Mutex;
+	CComPtr<IMFSinkWriter> m_Writer;
+};
+
+class CReplayMediaSink;
+
+/// <summary>
+/// A stream sink of a CReplayMediaSink. It requests a new sample as soon as it is given one, and adds a copy of each sample to the replay buffer and passes it on to the passthrough writer.
+/// It accepts any media type of its major type, so the sink writer can set the exact type negotiated with the encoder.
+/// </summary>
+class CReplayStreamSink : public IMFStreamSink, public IMFMediaTypeHandler {
+public:
+	CReplayStreamSink(_In_ CReplayMediaSink *pSink, _In_ DWORD streamId, _In_ IMFMediaType *pMediaType, _In_ std::shared_ptr<ReplaySampleBuffer> pBuffer, _In_opt_ std::shared_ptr<ReplayPassthrough> pPassthrough);
+	virtual ~CReplayStreamSink();
+	HRESULT Initialize();
+	HRESULT Start();
+	HRESULT Stop();
+	HRESULT Pause();
+	void Shutdown();
+
+	// IMFStreamSink methods
+	STDMETHODIMP GetMediaSink(IMFMediaSink **ppMediaSink);
+	STDMETHODIMP GetIdentifier(DWORD *pdwIdentifier);
+	STDMETHODIMP GetMediaTypeHandler(IMFMediaTypeHandler **ppHandler);
+	STDMETHODIMP ProcessSample(IMFSample *pSample);
+	STDMETHODIMP PlaceMarker(MFSTREAMSINK_MARKER_TYPE eMarkerType, const PROPVARIANT *pvarMarkerValue, const PROPVARIANT *pvarContextValue);
+	STDMETHODIMP Flush();
+
+	// IMFMediaEventGenerator methods
+	STDMETHODIMP GetEvent(DWORD dwFlags, IMFMediaEvent **ppEvent);
+	STDMETHODIMP BeginGetEvent(IMFAsyncCallback *pCallback, IUnknown *punkState);
+	STDMETHODIMP EndGetEvent(IMFAsyncResult *pResult, IMFMediaEvent **ppEvent);
+	STDMETHODIMP QueueEvent(MediaEventType met, REFGUID guidExtendedType, HRESULT hrStatus, const PROPVARIANT *pvValue);
+
+	// IMFMediaTypeHandler methods
+	STDMETHODIMP IsMediaTypeSupported(IMFMediaType *pMediaType, IMFMediaType **ppMediaType);
+	STDMETHODIMP GetMediaTypeCount(DWORD *pdwTypeCount);
+	STDMETHODIMP GetMediaTypeByIndex(DWORD dwIndex, IMFMediaType **ppType);
+	STDMETHODIMP SetCurrentMediaType(IMFMediaType *pMediaType);
+	STDMETHODIMP GetCurrentMediaType(IMFMediaType **ppMediaType);
+	STDMETHODIMP GetMajorType(GUID *pguidMajorType);
+
+	// IUnknown methods
+	STDMETHODIMP QueryInterface(REFIID riid, void **ppv);
+	STDMETHODIMP_(ULONG) AddRef();
+	STDMETHODIMP_(ULONG) Release();
+
+private:
+	HRESULT CheckShutdown();
+	/// <summary>
+	/// Copies an encoded sample into memory of its own, since encoders may hand out samples from a small pool they reuse.
+	/// </summary>
+	static HRESULT CopySample(_In_ IMFSample *pSample, _Outptr_ IMFSample **ppCopy, _Out_ DWORD *pLength);
+
+	volatile long m_nRefCount;
+	std::mutex m_Mutex;
+	//The media sink owning the stream. Not referenced, since the media sink references its streams, and cleared when the media sink shuts down.
+	CReplayMediaSink *m_Sink;
+	DWORD m_StreamId;
+	CComPtr<IMFMediaType> m_MediaType;
+	CComPtr<IMFMediaEventQueue> m_EventQueue;
+	std::shared_ptr<ReplaySampleBuffer> m_Buffer;
+	std::shared_ptr<ReplayPassthrough> m_Passthrough;
+	bool m_IsShutdown;
+};
+
+/// <summary>
+/// A media sink that keeps the encoded samples written to it in a replay buffer. The samples are also passed on to a passthrough writer if one is given, which writes the recording to its output.
+/// It has a video stream with identifier 0, and an audio stream with identifier 1 if it is created with an audio type, matching the streams of the MP4 sink.
+/// </summary>
+class CReplayMediaSink : public IMFMediaSink, public IMFClockStateSink {
+public:
+	static HRESULT CreateInstance(_In_ IMFMediaType *pVideoMediaType, _In_opt_ IMFMediaType *pAudioMediaType, _In_ std::shared_ptr<ReplaySampleBuffer> pBuffer, _In_opt_ std::shared_ptr<ReplayPassthrough> pPassthrough, _Outptr_ IMFMediaSink **ppSink);
+	virtual ~CReplayMediaSink();
+
+	// IMFMediaSink methods
+	STDMETHODIMP GetCharacteristics(DWORD *pdwCharacteristics);
+	STDMETHODIMP AddStreamSink(DWORD dwStreamSinkIdentifier, IMFMediaType *pMediaType, IMFStreamSink **ppStreamSink);
+	STDMETHODIMP RemoveStreamSink(DWORD dwStreamSinkIdentifier);
+	STDMETHODIMP GetStreamSinkCount(DWORD *pcStreamSinkCount);
+	STDMETHODIMP GetStreamSinkByIndex(DWORD dwIndex, IMFStreamSink **ppStreamSink);
+	STDMETHODIMP GetStreamSinkById(DWORD dwStreamSinkIdentifier, IMFStreamSink **ppStreamSink);
+	STDMETHODIMP SetPresentationClock(IMFPresentationClock *pPresentationClock);
+	STDMETHODIMP GetPresentationClock(IMFPresentationClock **ppPresentationClock);
+	STDMETHODIMP Shutdown();
+
+	// IMFClockStateSink methods
+	STDMETHODIMP OnClockStart(MFTIME hnsSystemTime, LONGLONG llClockStartOffset);
+	STDMETHODIMP OnClockStop(MFTIME hnsSystemTime);
+	STDMETHODIMP OnClockPause(MFTIME hnsSystemTime);
+	STDMETHODIMP OnClockRestart(MFTIME hnsSystemTime);
+	STDMETHODIMP OnClockSetRate(MFTIME hnsSystemTime, float flRate);
+
+	// IUnknown methods
+	STDMETHODIMP QueryInterface(REFIID riid, void **ppv);
+	STDMETHODIMP_(ULONG) AddRef();
+	STDMETHODIMP_(ULONG) Release();
+
+private:
+	CReplayMediaSink();
+	HRESULT CheckShutdown();
+
+	volatile long m_nRefCount;
+	std::mutex m_Mutex;
+	//The stream sinks, each referenced once by the media sink.
+	std::vector<CReplayStreamSink *> m_Streams;
+	CComPtr<IMFPresentationClock> m_Clock;
+	bool m_IsShutdown;
+};
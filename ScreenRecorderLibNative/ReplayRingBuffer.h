@@ -0,0 +1,206 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+template <typename TPayload>
+struct REPLAY_SAMPLE {
+	uint32_t StreamIndex = 0;
+	//Presentation time and duration of the sample, in 100 nanosecond units.
+	int64_t Time = 0;
+	int64_t Duration = 0;
+	//true if decoding can start at this sample. Only meaningful for samples of the key stream.
+	bool IsKeyframe = false;
+	//The size of the sample, counted against the byte budget.
+	uint64_t Bytes = 0;
+	TPayload Payload{};
+};
+
+struct REPLAY_BUFFER_STATS {
+	//Samples added, and samples evicted to stay within the budgets.
+	uint64_t Inserted = 0;
+	uint64_t Evicted = 0;
+	//Samples and bytes currently buffered, and the most bytes buffered at once.
+	size_t Samples = 0;
+	uint64_t Bytes = 0;
+	uint64_t PeakBytes = 0;
+	//The duration of the buffered window, from its first keyframe to the end of the last sample.
+	int64_t Duration = 0;
+};
+
+/// <summary>
+/// A thread safe in-memory buffer of the most recent encoded samples of a recording, so the last seconds can be saved on demand.
+/// The samples of the key stream, i.e. the video, are evicted a whole group of pictures at a time, so the buffered window always starts at a keyframe.
+/// Samples of other streams, i.e. the audio, are evicted up to the time of the first retained keyframe.
+/// The duration budget is a minimum: a group of pictures is only evicted if the samples after it still cover the whole duration.
+/// The byte budget is a maximum, except that the newest group of pictures is never evicted, so a single group larger than the budget is kept whole.
+/// Until the key stream has two keyframes, nothing is evicted.
+/// </summary>
+template <typename TPayload>
+class ReplayRingBuffer
+{
+public:
+	/// <param name="keyStreamIndex">The stream whose keyframes the window is aligned to</param>
+	/// <param name="maxDuration">The duration to keep, in 100 nanosecond units, or 0 for no limit</param>
+	/// <param name="maxBytes">The most bytes to keep, or 0 for no limit</param>
+	ReplayRingBuffer(uint32_t keyStreamIndex, int64_t maxDuration, uint64_t maxBytes) :
+		m_KeyStreamIndex(keyStreamIndex),
+		m_MaxDuration(maxDuration),
+		m_MaxBytes(maxBytes),
+		m_KeyStreamSequence(0),
+		m_Bytes(0),
+		m_EndPos(0),
+		m_Stats{}
+	{
+	}
+
+	/// <summary>
+	/// Adds a sample, and evicts the oldest samples if the buffer exceeds its budgets. The samples of each stream must be added in decode order.
+	/// </summary>
+	void Push(REPLAY_SAMPLE<TPayload> sample)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (sample.StreamIndex >= m_Streams.size()) {
+			m_Streams.resize(sample.StreamIndex + 1);
+		}
+		std::deque<REPLAY_SAMPLE<TPayload>> &stream = m_Streams[sample.StreamIndex];
+		if (sample.StreamIndex == m_KeyStreamIndex && sample.IsKeyframe) {
+			m_Keyframes.push_back(m_KeyStreamSequence + stream.size());
+		}
+		m_Bytes += sample.Bytes;
+		m_EndPos = (std::max)(m_EndPos, sample.Time + sample.Duration);
+		stream.push_back(std::move(sample));
+		m_Stats.Inserted++;
+		m_Stats.PeakBytes = (std::max)(m_Stats.PeakBytes, m_Bytes);
+		EvictOverBudget();
+	}
+
+	/// <summary>
+	/// Gets the buffered window, starting at the oldest keyframe of the key stream, with the streams interleaved by time.
+	/// Samples of other streams earlier than the keyframe are left out. The buffer itself is not changed.
+	/// </summary>
+	/// <param name="pSamples">Receives the samples of the window</param>
+	/// <param name="pStartPos">Receives the time of the keyframe the window starts at</param>
+	/// <returns>false if there is no keyframe buffered yet</returns>
+	bool GetWindow(std::vector<REPLAY_SAMPLE<TPayload>> *pSamples, int64_t *pStartPos)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		pSamples->clear();
+		if (m_Keyframes.empty()) {
+			return false;
+		}
+		const std::deque<REPLAY_SAMPLE<TPayload>> &keyStream = m_Streams[m_KeyStreamIndex];
+		size_t firstKeyframe = static_cast<size_t>(m_Keyframes.front() - m_KeyStreamSequence);
+		int64_t startPos = keyStream[firstKeyframe].Time;
+		//The next sample to take from each stream.
+		std::vector<size_t> positions(m_Streams.size());
+		size_t count = 0;
+		for (size_t i = 0; i < m_Streams.size(); i++) {
+			if (i == m_KeyStreamIndex) {
+				positions[i] = firstKeyframe;
+			}
+			else {
+				positions[i] = std::find_if(m_Streams[i].begin(), m_Streams[i].end(), [startPos](const REPLAY_SAMPLE<TPayload> &sample) { return sample.Time >= startPos; }) - m_Streams[i].begin();
+			}
+			count += m_Streams[i].size() - positions[i];
+		}
+		pSamples->reserve(count);
+		//Merge the streams by time, keeping the order within each stream.
+		while (pSamples->size() < count) {
+			size_t next = m_Streams.size();
+			for (size_t i = 0; i < m_Streams.size(); i++) {
+				if (positions[i] < m_Streams[i].size()
+					&& (next == m_Streams.size() || m_Streams[i][positions[i]].Time < m_Streams[next][positions[next]].Time)) {
+					next = i;
+				}
+			}
+			pSamples->push_back(m_Streams[next][positions[next]++]);
+		}
+		*pStartPos = startPos;
+		return true;
+	}
+
+	/// <summary>
+	/// Removes all samples.
+	/// </summary>
+	void Clear()
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (m_KeyStreamIndex < m_Streams.size()) {
+			m_KeyStreamSequence += m_Streams[m_KeyStreamIndex].size();
+		}
+		for (std::deque<REPLAY_SAMPLE<TPayload>> &stream : m_Streams) {
+			stream.clear();
+		}
+		m_Keyframes.clear();
+		m_Bytes = 0;
+		m_EndPos = 0;
+	}
+
+	REPLAY_BUFFER_STATS GetStats()
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		REPLAY_BUFFER_STATS stats = m_Stats;
+		for (const std::deque<REPLAY_SAMPLE<TPayload>> &stream : m_Streams) {
+			stats.Samples += stream.size();
+		}
+		stats.Bytes = m_Bytes;
+		if (!m_Keyframes.empty()) {
+			stats.Duration = m_EndPos - m_Streams[m_KeyStreamIndex][static_cast<size_t>(m_Keyframes.front() - m_KeyStreamSequence)].Time;
+		}
+		return stats;
+	}
+
+private:
+	void EvictOverBudget()
+	{
+		while (true) {
+			//Evict up to the next keyframe: the video before the first keyframe if there is any, or else the oldest group of pictures.
+			if (m_Keyframes.empty()) {
+				return;
+			}
+			size_t cutKeyframe = m_KeyStreamSequence < m_Keyframes.front() ? 0 : 1;
+			if (cutKeyframe >= m_Keyframes.size()) {
+				return;
+			}
+			uint64_t cutSequence = m_Keyframes[cutKeyframe];
+			int64_t cutTime = m_Streams[m_KeyStreamIndex][static_cast<size_t>(cutSequence - m_KeyStreamSequence)].Time;
+			bool isOverBytes = m_MaxBytes > 0 && m_Bytes > m_MaxBytes;
+			bool isOverDuration = m_MaxDuration > 0 && m_EndPos - cutTime >= m_MaxDuration;
+			if (!isOverBytes && !isOverDuration) {
+				return;
+			}
+			for (size_t i = 0; i < m_Streams.size(); i++) {
+				std::deque<REPLAY_SAMPLE<TPayload>> &stream = m_Streams[i];
+				while (!stream.empty() && (i == m_KeyStreamIndex ? m_KeyStreamSequence < cutSequence : stream.front().Time < cutTime)) {
+					m_Bytes -= stream.front().Bytes;
+					stream.pop_front();
+					m_Stats.Evicted++;
+					if (i == m_KeyStreamIndex) {
+						m_KeyStreamSequence++;
+					}
+				}
+			}
+			while (!m_Keyframes.empty() && m_Keyframes.front() < cutSequence) {
+				m_Keyframes.pop_front();
+			}
+		}
+	}
+
+	std::mutex m_Mutex;
+	const uint32_t m_KeyStreamIndex;
+	const int64_t m_MaxDuration;
+	const uint64_t m_MaxBytes;
+	std::vector<std::deque<REPLAY_SAMPLE<TPayload>>> m_Streams;
+	//The sequence number of the first buffered sample of the key stream, counting every sample ever added to it.
+	uint64_t m_KeyStreamSequence;
+	//The sequence numbers of the buffered keyframes, oldest first.
+	std::deque<uint64_t> m_Keyframes;
+	uint64_t m_Bytes;
+	//The end of the latest sample added.
+	int64_t m_EndPos;
+	REPLAY_BUFFER_STATS m_Stats;
+};
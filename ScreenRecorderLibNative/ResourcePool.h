@@ -0,0 +1,186 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/// <summary>
+/// Creates and destroys the resources handed out by a ResourcePool.
+/// </summary>
+template <typename TDescription, typename TResource>
+class IResourceAllocator
+{
+public:
+	virtual ~IResourceAllocator() {}
+	/// <summary>
+	/// Creates a new resource matching the description.
+	/// </summary>
+	/// <returns>true if the resource was created</returns>
+	virtual bool Allocate(const TDescription &description, TResource *pResource) = 0;
+	/// <summary>
+	/// Destroys a resource previously created by Allocate.
+	/// </summary>
+	virtual void Free(TResource resource) = 0;
+};
+
+struct RESOURCE_POOL_STATS {
+	//Number of acquires served from an idle pooled resource.
+	uint64_t Hits = 0;
+	//Number of acquires that had to allocate a new resource.
+	uint64_t Misses = 0;
+	//Number of released resources that were freed instead of pooled, because the pool was already full.
+	uint64_t Discarded = 0;
+	//Number of acquires that failed because the allocator failed.
+	uint64_t Failures = 0;
+	//Resources waiting in the pool for reuse.
+	size_t Idle = 0;
+	//Resources acquired and not yet released.
+	size_t InUse = 0;
+};
+
+/// <summary>
+/// A thread safe pool of reusable resources keyed by their description.
+/// At most Depth idle resources are retained. When every pooled resource is in use, new ones are allocated on demand,
+/// and any released beyond the pool depth are freed, so a consumer that falls behind costs allocations rather than unbounded idle memory.
+/// Resources may be released from any thread. The idle list has room for Depth resources up front, so acquiring and releasing pooled resources does not allocate.
+/// </summary>
+template <typename TDescription, typename TResource, typename TDescriptionEqual = std::equal_to<TDescription>>
+class ResourcePool
+{
+public:
+	ResourcePool(std::unique_ptr<IResourceAllocator<TDescription, TResource>> allocator, size_t depth) :
+		m_Allocator(std::move(allocator)),
+		m_Depth(depth)
+	{
+		m_Idle.reserve(m_Depth);
+	}
+	ResourcePool(const ResourcePool &) = delete;
+	ResourcePool &operator=(const ResourcePool &) = delete;
+	~ResourcePool()
+	{
+		Trim();
+	}
+
+	/// <summary>
+	/// Gets an idle resource matching the description, or allocates a new one if none is available.
+	/// </summary>
+	/// <returns>true if a resource was returned in pResource</returns>
+	bool Acquire(const TDescription &description, TResource *pResource)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			for (auto it = m_Idle.begin(); it != m_Idle.end(); it++) {
+				if (m_DescriptionEqual(it->Description, description)) {
+					*pResource = it->Resource;
+					m_Idle.erase(it);
+					m_Stats.Hits++;
+					m_Stats.InUse++;
+					return true;
+				}
+			}
+			m_Stats.Misses++;
+		}
+		//Allocation can be slow, so it is done outside the lock to not block releases from other threads.
+		if (!m_Allocator->Allocate(description, pResource)) {
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Stats.Failures++;
+			return false;
+		}
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stats.InUse++;
+		return true;
+	}
+
+	/// <summary>
+	/// Returns a resource acquired from this pool. The resource is kept for reuse if the pool has room, else it is freed.
+	/// </summary>
+	void Release(const TDescription &description, TResource resource)
+	{
+		std::unique_lock<std::mutex> lock(m_Mutex);
+		m_Stats.InUse--;
+		if (m_Idle.size() < m_Depth) {
+			m_Idle.push_back({ description, resource });
+			return;
+		}
+		m_Stats.Discarded++;
+		//If the pool is full of resources with another description, e.g. after a resolution change, those are stale and replaced first.
+		for (auto it = m_Idle.begin(); it != m_Idle.end(); it++) {
+			if (!m_DescriptionEqual(it->Description, description)) {
+				TResource stale = it->Resource;
+				m_Idle.erase(it);
+				m_Idle.push_back({ description, resource });
+				lock.unlock();
+				m_Allocator->Free(stale);
+				return;
+			}
+		}
+		lock.unlock();
+		m_Allocator->Free(resource);
+	}
+
+	/// <summary>
+	/// Frees all idle resources. Resources in use are unaffected and are pooled again when released.
+	/// </summary>
+	void Trim()
+	{
+		std::vector<POOL_ENTRY> idle;
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			idle.swap(m_Idle);
+			m_Idle.reserve(m_Depth);
+		}
+		for (POOL_ENTRY &entry : idle) {
+			m_Allocator->Free(entry.Resource);
+		}
+	}
+
+	/// <summary>
+	/// Sets the maximum number of idle resources kept for reuse. Excess idle resources are freed, oldest first.
+	/// </summary>
+	void SetDepth(size_t depth)
+	{
+		std::vector<POOL_ENTRY> evicted;
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Depth = depth;
+			if (m_Idle.size() > m_Depth) {
+				auto evictedEnd = m_Idle.begin() + (m_Idle.size() - m_Depth);
+				evicted.assign(m_Idle.begin(), evictedEnd);
+				m_Idle.erase(m_Idle.begin(), evictedEnd);
+			}
+			m_Idle.reserve(m_Depth);
+		}
+		for (POOL_ENTRY &entry : evicted) {
+			m_Allocator->Free(entry.Resource);
+		}
+	}
+
+	size_t GetDepth()
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		return m_Depth;
+	}
+
+	RESOURCE_POOL_STATS GetStats()
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		RESOURCE_POOL_STATS stats = m_Stats;
+		stats.Idle = m_Idle.size();
+		return stats;
+	}
+
+private:
+	struct POOL_ENTRY {
+		TDescription Description;
+		TResource Resource;
+	};
+	std::unique_ptr<IResourceAllocator<TDescription, TResource>> m_Allocator;
+	TDescriptionEqual m_DescriptionEqual;
+	std::mutex m_Mutex;
+	//Oldest first.
+	std::vector<POOL_ENTRY> m_Idle;
+	size_t m_Depth;
+	RESOURCE_POOL_STATS m_Stats;
+};
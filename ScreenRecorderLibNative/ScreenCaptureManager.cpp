@@ -10,21 +10,50 @@
 #include <typeinfo>
 #include "DynamicWait.h"
 #include "Exception.h"
+#include "CaptureWaitEvents.h"
 
 using namespace DirectX;
 using namespace std::chrono;
 using namespace std;
 DWORD WINAPI CaptureThreadProc(_In_ void *Param);
 DWORD WINAPI OverlayCaptureThreadProc(_In_ void *Param);
-_Ret_maybenull_ CaptureBase *CreateCaptureInstance(_In_ RECORDING_SOURCE_BASE *pSource);
+_Ret_maybenull_ CaptureBase *CreateCaptureInstance(_In_ RECORDING_SOURCE_BASE *pSource, _In_ UINT64 gifFrameCacheMaxBytes);
+
+static void LogCaptureWaitStats(_In_ const std::wstring &name, _In_ const CAPTURE_WAIT_STATS &stats)
+{
+	LOG_DEBUG(L"%ls capture thread: %llu wakeups in %.1f s (%.1f per second), %llu for frames, %llu for deadlines. %llu frames copied, mean wake to copy %.2f ms, max %.2f ms",
+		name.c_str(),
+		stats.GetTotalWakeups(),
+		stats.ElapsedMicros / 1000000.0,
+		stats.GetWakeupsPerSecond(),
+		stats.Wakeups[(size_t)CaptureWakeReason::FrameArrived],
+		stats.Wakeups[(size_t)CaptureWakeReason::Deadline],
+		stats.CopiedFrames,
+		stats.GetMeanWakeToCopyMillis(),
+		stats.MaxWakeToCopyMicros / 1000.0);
+}
+
+static void LogTextureAllocationStats(_In_ const std::wstring &name, _In_ const ALLOCATION_STATS &stats)
+{
+	LOG_DEBUG(L"%ls capture thread: %llu textures created (%.1f MB). %llu of %llu frames created textures, mean %.2f per frame, max %llu",
+		name.c_str(),
+		stats.Allocations,
+		stats.Bytes / (1024.0 * 1024.0),
+		stats.FramesWithAllocations,
+		stats.Frames,
+		stats.GetMeanFrameAllocations(),
+		stats.MaxFrameAllocations);
+}
 ScreenCaptureManager::ScreenCaptureManager() :
 	m_Device(nullptr),
 	m_DeviceContext(nullptr),
 	m_TerminateThreadsEvent(nullptr),
-	m_LastAcquiredFrameTimeStamp{},
+	m_FrameWrittenEvent(nullptr),
+	m_FrameDeadline{},
+	m_UpdateTracker{},
 	m_OutputRect{},
-	m_SharedSurf(nullptr),
-	m_KeyMutex(nullptr),
+	m_CanvasView(nullptr),
+	m_Canvas(nullptr),
 	m_CaptureThreads{},
 	m_OverlayThreads{},
 	m_TextureManager(nullptr),
@@ -32,13 +61,19 @@ ScreenCaptureManager::ScreenCaptureManager() :
 	m_OutputOptions(nullptr),
 	m_EncoderOptions(nullptr),
 	m_MouseOptions(nullptr),
+	m_Metrics(nullptr),
 	m_FrameCopy(nullptr),
+	m_UpdatedRegion{},
+	m_IsFrameCopyInvalidated(false),
 	m_IsInitialFrameWriteComplete(false),
 	m_IsInitialOverlayWriteComplete(false)
 {
 	// Event to tell spawned threads to quit
 	m_TerminateThreadsEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+	// Event to tell the recorder a capture thread has written a frame
+	m_FrameWrittenEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
 	InitializeCriticalSection(&m_CriticalSection);
+	InitializeCriticalSection(&m_PtrInfoCriticalSection);
 }
 
 ScreenCaptureManager::~ScreenCaptureManager()
@@ -48,6 +83,7 @@ ScreenCaptureManager::~ScreenCaptureManager()
 	}
 	Clean();
 	DeleteCriticalSection(&m_CriticalSection);
+	DeleteCriticalSection(&m_PtrInfoCriticalSection);
 }
 
 //
@@ -58,7 +94,8 @@ HRESULT ScreenCaptureManager::Initialize(
 	_In_ ID3D11Device *pDevice,
 	_In_ std::shared_ptr<OUTPUT_OPTIONS> pOutputOptions,
 	_In_ std::shared_ptr<ENCODER_OPTIONS> pEncoderOptions,
-	_In_ std::shared_ptr<MOUSE_OPTIONS> pMouseOptions)
+	_In_ std::shared_ptr<MOUSE_OPTIONS> pMouseOptions,
+	_In_opt_ std::shared_ptr<RecordingMetrics> pMetrics)
 {
 	HRESULT hr = S_OK;
 	m_Device = pDevice;
@@ -67,6 +104,7 @@ HRESULT ScreenCaptureManager::Initialize(
 	m_OutputOptions = pOutputOptions;
 	m_EncoderOptions = pEncoderOptions;
 	m_MouseOptions = pMouseOptions;
+	m_Metrics = pMetrics;
 
 	m_TextureManager = make_unique<TextureManager>();
 	RETURN_ON_BAD_HR(hr = m_TextureManager->Initialize(m_DeviceContext, m_Device));
@@ -81,11 +119,18 @@ HRESULT ScreenCaptureManager::StartCapture(_In_ const std::vector<RECORDING_SOUR
 	EnterCriticalSection(&m_CriticalSection);
 	LeaveCriticalSectionOnExit leaveOnExit(&m_CriticalSection);
 	ResetEvent(m_TerminateThreadsEvent);
+	ResetEvent(m_FrameWrittenEvent);
+	m_FrameDeadline.Reset();
 	m_IsInitialFrameWriteComplete = false;
 
 	HRESULT hr = E_FAIL;
 	std::vector<RECORDING_SOURCE_DATA *> createdOutputs{};
-	RETURN_ON_BAD_HR(hr = CreateSharedSurf(sources, &createdOutputs, &m_OutputRect, &m_SharedSurf, &m_KeyMutex));
+	D3D11SharedCanvasView *pCanvasView = nullptr;
+	RETURN_ON_BAD_HR(hr = CreateSharedSurf(sources, &createdOutputs, &m_OutputRect, &pCanvasView));
+	m_CanvasView.reset(pCanvasView);
+	//The new buffers are all blank, so the canvas starts out with all of them up to date.
+	m_Canvas = make_unique<TripleBufferedCanvas>();
+	m_IsFrameCopyInvalidated = true;
 	RETURN_ON_BAD_HR(hr = InitializeRecordingSources(createdOutputs, hErrorEvent));
 	RETURN_ON_BAD_HR(hr = InitializeOverlays(overlays, hErrorEvent));
 	m_IsCapturing = true;
@@ -107,7 +152,6 @@ HRESULT ScreenCaptureManager::InitializeRecordingSources(_In_ const std::vector<
 		}
 		startedEventHandles.push_back(startedEvent);
 
-		HANDLE sharedHandle = GetSharedHandle(m_SharedSurf);
 		// Create appropriate # of threads for duplication
 
 		RECORDING_SOURCE_DATA *data = recordingSources.at(i);
@@ -117,8 +161,17 @@ HRESULT ScreenCaptureManager::InitializeRecordingSources(_In_ const std::vector<
 		threadData->ErrorEvent = hErrorEvent;
 		threadData->StartedEvent = startedEvent;
 		threadData->TerminateThreadsEvent = m_TerminateThreadsEvent;
-		threadData->CanvasTexSharedHandle = sharedHandle;
+		threadData->Canvas = m_Canvas.get();
+		for (size_t bufferIndex = 0; bufferIndex < CANVAS_BUFFER_COUNT; bufferIndex++) {
+			threadData->CanvasBufferSharedHandles[bufferIndex] = m_CanvasView->GetSharedHandle(bufferIndex);
+		}
+		threadData->OptionsChangedEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+		threadData->FrameWrittenEvent = m_FrameWrittenEvent;
+		threadData->FrameDeadline = &m_FrameDeadline;
+		threadData->Metrics = m_Metrics.get();
+		threadData->GifFrameCacheMaxBytes = m_OutputOptions->GetGifFrameCacheMaxBytes();
 		threadData->PtrInfo = &m_PtrInfo;
+		threadData->PtrInfoCriticalSection = &m_PtrInfoCriticalSection;
 
 		threadData->RecordingSource = data;
 		RtlZeroMemory(&threadData->RecordingSource->DxRes, sizeof(DX_RESOURCES));
@@ -148,11 +201,10 @@ HRESULT ScreenCaptureManager::InitializeRecordingSources(_In_ const std::vector<
 HRESULT ScreenCaptureManager::InitializeOverlays(_In_ const std::vector<RECORDING_OVERLAY *> &overlays, _In_opt_  HANDLE hErrorEvent)
 {
 	HRESULT hr = S_FALSE;
-	if (!m_SharedSurf) {
-		LOG_ERROR(L"Shared surface is not initialized");
+	if (!m_Canvas) {
+		LOG_ERROR(L"Shared canvas is not initialized");
 		return E_FAIL;
 	}
-	HANDLE sharedHandle = GetSharedHandle(m_SharedSurf);
 	UINT overlayCount = static_cast<UINT>(overlays.size());
 	std::vector<HANDLE> startedEventHandles{};
 	for (UINT i = 0; i < overlayCount; i++)
@@ -176,8 +228,12 @@ HRESULT ScreenCaptureManager::InitializeOverlays(_In_ const std::vector<RECORDIN
 			threadData->ErrorEvent = hErrorEvent;
 			threadData->StartedEvent = startedEvent;
 			threadData->TerminateThreadsEvent = m_TerminateThreadsEvent;
-			threadData->CanvasTexSharedHandle = sharedHandle;
 			threadData->TerminateThreadsEvent = m_TerminateThreadsEvent;
+			threadData->OptionsChangedEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+			threadData->FrameWrittenEvent = m_FrameWrittenEvent;
+			threadData->FrameDeadline = &m_FrameDeadline;
+			threadData->Metrics = m_Metrics.get();
+			threadData->GifFrameCacheMaxBytes = m_OutputOptions->GetGifFrameCacheMaxBytes();
 			threadData->RecordingOverlay = new RECORDING_OVERLAY_DATA(overlay);
 			RtlZeroMemory(&threadData->RecordingOverlay->DxRes, sizeof(DX_RESOURCES));
 			RETURN_ON_BAD_HR(hr = InitializeDx(nullptr, &threadData->RecordingOverlay->DxRes));
@@ -220,6 +276,15 @@ HRESULT ScreenCaptureManager::StopCapture()
 	}
 	HRESULT hr = WaitForThreadTermination();
 	m_IsCapturing = false;
+	if (m_Canvas) {
+		CANVAS_STATS stats = m_Canvas->GetStats();
+		LOG_DEBUG(L"Shared canvas: %llu frames published, %llu acquired, %llu skipped. %llu catch-up copies of %llu pixels",
+			stats.Published,
+			stats.Acquired,
+			stats.Skipped,
+			stats.CatchUpCopies,
+			stats.CatchUpArea);
+	}
 	return hr;
 }
 
@@ -235,14 +300,19 @@ HRESULT ScreenCaptureManager::CopyCurrentFrame(_Out_ CAPTURED_FRAME *pFrame)
 	m_DeviceContext->CopyResource(pFrameCopy, m_FrameCopy);
 	RtlZeroMemory(pFrame, sizeof(pFrame));
 	pFrame->Frame = pFrameCopy;
-	pFrame->PtrInfo = m_PtrInfo;
+	{
+		EnterCriticalSection(&m_PtrInfoCriticalSection);
+		LeaveCriticalSectionOnExit leavePtrInfoOnExit(&m_PtrInfoCriticalSection);
+		pFrame->PtrInfo = m_PtrInfo;
+	}
 	pFrame->FrameUpdateCount = 0;
+	pFrame->AcquiredTimeStamp = m_UpdateTracker.GetLastAcquireTime();
 	return S_OK;
 }
 
 HRESULT ScreenCaptureManager::AcquireNextFrame(_In_  double timeUntilNextFrame, _In_ double maxFrameLength, _Out_ CAPTURED_FRAME *pFrame)
 {
-	HRESULT hr;
+	HRESULT hr = S_OK;
 	auto  start = std::chrono::steady_clock::now();
 	bool haveNewFrame = false;
 	auto GetMillisUntilNextFrame([&]()
@@ -265,7 +335,7 @@ HRESULT ScreenCaptureManager::AcquireNextFrame(_In_  double timeUntilNextFrame,
 			if (!IsInitialFrameWriteComplete() && millisWaited < maxFrameLength) {
 				return true;
 			}
-			if (m_LastAcquiredFrameTimeStamp.QuadPart == 0 && IsInitialFrameWriteComplete()) {
+			if (m_UpdateTracker.GetLastAcquireTime() == 0 && IsInitialFrameWriteComplete()) {
 				return false;
 			}
 			if (m_OutputOptions->GetRecorderMode() == RecorderModeInternal::Video) {
@@ -286,66 +356,87 @@ HRESULT ScreenCaptureManager::AcquireNextFrame(_In_  double timeUntilNextFrame,
 			return false;
 		});
 
-	DWORD syncTimeout = GetNextSyncTimeout();
-
+	{
+		//Let the capture threads know when the next frame is due, so they can wake up in time for it.
+		int64_t nowMicros = duration_cast<microseconds>(start.time_since_epoch()).count();
+		UINT32 fps = m_EncoderOptions->GetVideoFps();
+		m_FrameDeadline.SetNextDeadline(nowMicros + static_cast<int64_t>((std::max)(0.0, timeUntilNextFrame) * 1000), fps > 0 ? 1000000 / fps : 0);
+	}
+	MeasureRecordingTimer measureCaptureWait(m_Metrics.get(), RecordingTimer::CaptureWait);
 	while (true)
 	{
-		// Try to acquire keyed mutex in order to access shared surface
-		hr = m_KeyMutex->AcquireSync(1, syncTimeout);
-
-		if (hr == static_cast<HRESULT>(WAIT_TIMEOUT)) {
-			if (!ShouldDelay()) {
-				hr = m_KeyMutex->AcquireSync(0, 0);
-				if (SUCCEEDED(hr)) {
-					hr = m_KeyMutex->ReleaseSync(1);
-					syncTimeout = 0;
-				}
-			}
-			else {
-				syncTimeout = GetNextSyncTimeout();
-			}
+		haveNewFrame = IsUpdatedFramesAvailable();
+		if (!ShouldDelay()) {
+			break;
 		}
-		else if (hr == static_cast<HRESULT>(WAIT_ABANDONED)) {
+		//Wake up when a capture thread writes a frame, or when it is time to take the next frame.
+		if (WaitForSingleObject(m_FrameWrittenEvent, GetNextSyncTimeout()) == WAIT_FAILED) {
+			LOG_ERROR(L"Failed to wait for captured frames: last error is %u", GetLastError());
 			return E_FAIL;
 		}
-		else if (SUCCEEDED(hr)) {
-			haveNewFrame = true;
-			if (ShouldDelay()) {
-				m_KeyMutex->ReleaseSync(0);
-				syncTimeout = GetNextSyncTimeout();
-			}
-			else {
-				break;
-			}
-		}
-		else if (FAILED(hr)) {
-			return hr;
-		}
 	}
+	measureCaptureWait.Stop();
 	{
-		ReleaseKeyedMutexOnExit releaseMutex(m_KeyMutex, 0);
-		MeasureExecutionTime measure(L"AcquireNextFrame lock");
+		MeasureRecordingTimer measureKeyedMutexHold(m_Metrics.get(), RecordingTimer::KeyedMutexHold);
+		//Frames written after this are counted as updates to the next frame, even if they are already in the buffer taken below.
+		LARGE_INTEGER acquiredTimeStamp;
+		QueryPerformanceCounter(&acquiredTimeStamp);
 		int updatedFrameCount = GetUpdatedSourceCount();
 		int updatedOverlaysCount = GetUpdatedOverlayCount();
 
+		//Take the latest frame published by the capture threads. They keep drawing to the other buffers of the canvas meanwhile,
+		//so the buffer only has to be locked against a capture thread bringing another buffer up to date from it.
+		m_Canvas->AcquireLatest(&m_UpdatedRegion);
+		size_t readIndex = m_Canvas->GetReadIndex();
+		ID3D11Texture2D *pCanvasBuffer = m_CanvasView->GetBuffer(readIndex);
+		if (!m_CanvasView->LockBuffer(readIndex)) {
+			return E_FAIL;
+		}
+		ExecuteFuncOnExit unlockBuffer([&]() { m_CanvasView->UnlockBuffer(readIndex); });
+
+		D3D11_TEXTURE2D_DESC desc;
+		pCanvasBuffer->GetDesc(&desc);
+		REGION_RECT frameRect{ 0, 0, static_cast<int32_t>(desc.Width), static_cast<int32_t>(desc.Height) };
+		//Overlays are drawn on the frame after it is acquired, so an overlay update is treated as a change to the whole frame.
+		bool isFullFrameUpdated = updatedOverlaysCount > 0 || m_IsFrameCopyInvalidated.exchange(false);
 		if (!m_FrameCopy) {
-			D3D11_TEXTURE2D_DESC desc;
-			m_SharedSurf->GetDesc(&desc);
 			desc.MiscFlags = 0;
 			desc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_RENDER_TARGET;
 			RETURN_ON_BAD_HR(hr = m_Device->CreateTexture2D(&desc, nullptr, &m_FrameCopy));
+			isFullFrameUpdated = true;
+		}
+		if (isFullFrameUpdated) {
+			m_UpdatedRegion.Clear();
+			m_UpdatedRegion.Add(frameRect);
+		}
+		m_UpdatedRegion.Clip(frameRect);
+		if (!m_OutputOptions->IsVideoCaptureEnabled()) {
+			//The frame copy is not updated, so it must be fully updated once video capture is enabled again.
+			m_IsFrameCopyInvalidated = true;
+		}
+		else if (m_UpdatedRegion.GetArea() * 2 < frameRect.Area()) {
+			//The frame copy holds the previous frame, so only the changed parts of the canvas need to be copied.
+			for (const REGION_RECT &rect : m_UpdatedRegion.GetRects()) {
+				D3D11_BOX box{ static_cast<UINT>(rect.left), static_cast<UINT>(rect.top), 0, static_cast<UINT>(rect.right), static_cast<UINT>(rect.bottom), 1 };
+				m_DeviceContext->CopySubresourceRegion(m_FrameCopy, 0, rect.left, rect.top, 0, pCanvasBuffer, 0, &box);
+			}
 		}
-		if (m_OutputOptions->IsVideoCaptureEnabled()) {
-			m_DeviceContext->CopyResource(m_FrameCopy, m_SharedSurf);
+		else {
+			m_DeviceContext->CopyResource(m_FrameCopy, pCanvasBuffer);
 		}
 		if (updatedFrameCount > 0 || updatedOverlaysCount > 0) {
-			QueryPerformanceCounter(&m_LastAcquiredFrameTimeStamp);
+			m_UpdateTracker.SetLastAcquireTime(acquiredTimeStamp.QuadPart);
 		}
+		EnterCriticalSection(&m_PtrInfoCriticalSection);
+		LeaveCriticalSectionOnExit leavePtrInfoOnExit(&m_PtrInfoCriticalSection);
 		m_PtrInfo.IsPointerShapeUpdated = false;
 		RtlZeroMemory(pFrame, sizeof(pFrame));
 		pFrame->Frame = m_FrameCopy;
 		pFrame->PtrInfo = m_PtrInfo;
 		pFrame->FrameUpdateCount = updatedFrameCount;
+		pFrame->UpdatedRegion = m_UpdatedRegion;
+		pFrame->AcquiredTimeStamp = acquiredTimeStamp.QuadPart;
+		m_UpdatedRegion.Clear();
 	}
 	return hr;
 }
@@ -357,15 +448,8 @@ void ScreenCaptureManager::Clean()
 {
 	EnterCriticalSection(&m_CriticalSection);
 	LeaveCriticalSectionOnExit leaveOnExit(&m_CriticalSection);
-	if (m_SharedSurf) {
-		m_SharedSurf->Release();
-		m_SharedSurf = nullptr;
-	}
-	if (m_KeyMutex)
-	{
-		m_KeyMutex->Release();
-		m_KeyMutex = nullptr;
-	}
+	m_CanvasView.reset();
+	m_Canvas.reset();
 	if (m_PtrInfo.PtrShapeBuffer)
 	{
 		delete[] m_PtrInfo.PtrShapeBuffer;
@@ -384,6 +468,9 @@ void ScreenCaptureManager::Clean()
 			threadObject->ThreadData->RecordingSource = nullptr;
 			delete threadObject->ThreadData->ThreadResult;
 			threadObject->ThreadData->ThreadResult = nullptr;
+			if (threadObject->ThreadData->OptionsChangedEvent) {
+				CloseHandle(threadObject->ThreadData->OptionsChangedEvent);
+			}
 			delete threadObject->ThreadData;
 			threadObject->ThreadData = nullptr;
 		}
@@ -403,6 +490,9 @@ void ScreenCaptureManager::Clean()
 			threadObject->ThreadData->RecordingOverlay = nullptr;
 			delete threadObject->ThreadData->ThreadResult;
 			threadObject->ThreadData->ThreadResult = nullptr;
+			if (threadObject->ThreadData->OptionsChangedEvent) {
+				CloseHandle(threadObject->ThreadData->OptionsChangedEvent);
+			}
 			delete threadObject->ThreadData;
 			threadObject->ThreadData = nullptr;
 		}
@@ -411,6 +501,7 @@ void ScreenCaptureManager::Clean()
 	m_OverlayThreads.clear();
 
 	CloseHandle(m_TerminateThreadsEvent);
+	CloseHandle(m_FrameWrittenEvent);
 }
 
 //
@@ -470,13 +561,13 @@ bool ScreenCaptureManager::IsUpdatedFramesAvailable()
 {
 	for each (CAPTURE_THREAD * threadObject in m_CaptureThreads)
 	{
-		if (threadObject->ThreadData->LastUpdateTimeStamp.QuadPart > m_LastAcquiredFrameTimeStamp.QuadPart) {
+		if (m_UpdateTracker.IsUpdatedSinceLastAcquire(threadObject->ThreadData->LastUpdateTimeStamp.QuadPart)) {
 			return true;
 		}
 	}
 	for each (OVERLAY_THREAD * threadObject in m_OverlayThreads)
 	{
-		if (threadObject->ThreadData && threadObject->ThreadData->LastUpdateTimeStamp.QuadPart > m_LastAcquiredFrameTimeStamp.QuadPart) {
+		if (threadObject->ThreadData && m_UpdateTracker.IsUpdatedSinceLastAcquire(threadObject->ThreadData->LastUpdateTimeStamp.QuadPart)) {
 			return true;
 		}
 	}
@@ -521,7 +612,7 @@ UINT ScreenCaptureManager::GetUpdatedSourceCount()
 
 	for each (CAPTURE_THREAD * threadObject in m_CaptureThreads)
 	{
-		if (threadObject->ThreadData && threadObject->ThreadData->LastUpdateTimeStamp.QuadPart > m_LastAcquiredFrameTimeStamp.QuadPart) {
+		if (threadObject->ThreadData && m_UpdateTracker.IsUpdatedSinceLastAcquire(threadObject->ThreadData->LastUpdateTimeStamp.QuadPart)) {
 			updatedFrameCount++;
 		}
 	}
@@ -534,7 +625,7 @@ UINT ScreenCaptureManager::GetUpdatedOverlayCount()
 
 	for each (OVERLAY_THREAD * thread in m_OverlayThreads)
 	{
-		if (thread->ThreadData && thread->ThreadData->LastUpdateTimeStamp.QuadPart > m_LastAcquiredFrameTimeStamp.QuadPart) {
+		if (thread->ThreadData && m_UpdateTracker.IsUpdatedSinceLastAcquire(thread->ThreadData->LastUpdateTimeStamp.QuadPart)) {
 			updatedFrameCount++;
 		}
 	}
@@ -544,15 +635,37 @@ UINT ScreenCaptureManager::GetUpdatedOverlayCount()
 void ScreenCaptureManager::InvalidateCaptureSources()
 {
 	m_IsInitialFrameWriteComplete = false;
+	m_IsFrameCopyInvalidated = true;
 	for each (CAPTURE_THREAD * threadObject in m_CaptureThreads)
 	{
 		threadObject->ThreadData->TotalUpdatedFrameCount = 0;
 		if (threadObject->ThreadData) {			
 			threadObject->ThreadData->LastUpdateTimeStamp.QuadPart == 0;
 		}
-		QueryPerformanceCounter(&m_LastAcquiredFrameTimeStamp);
+		LARGE_INTEGER now;
+		QueryPerformanceCounter(&now);
+		m_UpdateTracker.SetLastAcquireTime(now.QuadPart);
+	}
+}
+
+void ScreenCaptureManager::NotifyOptionsChanged()
+{
+	EnterCriticalSection(&m_CriticalSection);
+	LeaveCriticalSectionOnExit leaveOnExit(&m_CriticalSection);
+	for each (CAPTURE_THREAD * threadObject in m_CaptureThreads)
+	{
+		if (threadObject->ThreadData && threadObject->ThreadData->OptionsChangedEvent) {
+			SetEvent(threadObject->ThreadData->OptionsChangedEvent);
+		}
+	}
+	for each (OVERLAY_THREAD * threadObject in m_OverlayThreads)
+	{
+		if (threadObject->ThreadData && threadObject->ThreadData->OptionsChangedEvent) {
+			SetEvent(threadObject->ThreadData->OptionsChangedEvent);
+		}
 	}
 }
+
 std::vector<CAPTURE_RESULT *> ScreenCaptureManager::GetCaptureResults()
 {
 	std::vector<CAPTURE_RESULT *> results;
@@ -643,7 +756,7 @@ RECT ScreenCaptureManager::GetOverlayRect(_In_ SIZE canvasSize, _In_ SIZE overla
 	return RECT{ overlayLeft,overlayTop,overlayLeft + overlayWidth,overlayTop + overlayHeight };
 }
 
-HRESULT ScreenCaptureManager::ProcessOverlays(_Inout_ ID3D11Texture2D *pCanvasTexture, _Out_ int *updateCount)
+HRESULT ScreenCaptureManager::ProcessOverlays(_Inout_ ID3D11Texture2D *pCanvasTexture, _In_ INT64 acquiredTimeStamp, _Out_ int *updateCount)
 {
 	HRESULT hr = S_FALSE;
 	int count = 0;
@@ -667,20 +780,18 @@ HRESULT ScreenCaptureManager::ProcessOverlays(_Inout_ ID3D11Texture2D *pCanvasTe
 				pOverlayTexture->GetDesc(&overlayDesc);
 				SIZE textureSize = SIZE{ static_cast<LONG>(overlayDesc.Width),static_cast<LONG>(overlayDesc.Height) };
 				CONTINUE_ON_BAD_HR(hr = m_TextureManager->DrawTexture(pCanvasTexture, pOverlayTexture, GetOverlayRect(canvasSize, textureSize, pOverlayData->RecordingOverlay)));
-				if (threadObject->ThreadData->LastUpdateTimeStamp.QuadPart > m_LastAcquiredFrameTimeStamp.QuadPart) {
+				//Compared with the time the frame was acquired, not the latest acquire, as this may run on another thread several frames later.
+				if (FrameUpdateTracker::IsUpdatedSince(threadObject->ThreadData->LastUpdateTimeStamp.QuadPart, acquiredTimeStamp)) {
 					count++;
 				}
 			}
 		}
 	}
-	if (count > 0) {
-		QueryPerformanceCounter(&m_LastAcquiredFrameTimeStamp);
-	}
 	*updateCount = count;
 	return hr;
 }
 
-HRESULT ScreenCaptureManager::CreateSharedSurf(_In_ const std::vector<RECORDING_SOURCE *> &sources, _Out_ std::vector<RECORDING_SOURCE_DATA *> *pCreatedOutputs, _Out_ RECT *pDeskBounds, _Outptr_ ID3D11Texture2D **ppSharedTexture, _Outptr_ IDXGIKeyedMutex **ppKeyedMutex)
+HRESULT ScreenCaptureManager::CreateSharedSurf(_In_ const std::vector<RECORDING_SOURCE *> &sources, _Out_ std::vector<RECORDING_SOURCE_DATA *> *pCreatedOutputs, _Out_ RECT *pDeskBounds, _Outptr_ D3D11SharedCanvasView **ppCanvasView)
 {
 	*pCreatedOutputs = std::vector<RECORDING_SOURCE_DATA *>();
 	std::vector<std::pair<RECORDING_SOURCE *, RECT>> validOutputs;
@@ -717,12 +828,22 @@ HRESULT ScreenCaptureManager::CreateSharedSurf(_In_ const std::vector<RECORDING_
 		pCreatedOutputs->push_back(data);
 	}
 
-	// Set created outputs
-	hr = ScreenCaptureManager::CreateSharedSurf(*pDeskBounds, ppSharedTexture, ppKeyedMutex);
+	// Create the buffers of the canvas the capture threads draw into
+	CComPtr<ID3D11Texture2D> pBuffers[CANVAS_BUFFER_COUNT];
+	for (size_t i = 0; i < CANVAS_BUFFER_COUNT; i++) {
+		RETURN_ON_BAD_HR(hr = ScreenCaptureManager::CreateSharedSurf(*pDeskBounds, &pBuffers[i], nullptr));
+	}
+	std::unique_ptr<D3D11SharedCanvasView> pCanvasView = make_unique<D3D11SharedCanvasView>(m_DeviceContext);
+	ID3D11Texture2D *pBufferPointers[CANVAS_BUFFER_COUNT];
+	for (size_t i = 0; i < CANVAS_BUFFER_COUNT; i++) {
+		pBufferPointers[i] = pBuffers[i];
+	}
+	RETURN_ON_BAD_HR(hr = pCanvasView->SetBuffers(pBufferPointers));
+	*ppCanvasView = pCanvasView.release();
 	return hr;
 }
 
-HRESULT ScreenCaptureManager::CreateSharedSurf(_In_ RECT desktopRect, _Outptr_ ID3D11Texture2D **ppSharedTexture, _Outptr_ IDXGIKeyedMutex **ppKeyedMutex)
+HRESULT ScreenCaptureManager::CreateSharedSurf(_In_ RECT desktopRect, _Outptr_ ID3D11Texture2D **ppSharedTexture, _Outptr_opt_ IDXGIKeyedMutex **ppKeyedMutex)
 {
 	CComPtr<ID3D11Texture2D> pSharedTexture = nullptr;
 	CComPtr<IDXGIKeyedMutex> pKeyedMutex = nullptr;
@@ -784,7 +905,6 @@ DWORD WINAPI CaptureThreadProc(_In_ void *Param)
 	bool isCapturingVideo = true;
 	bool isSharedSurfaceDirty = false;
 	bool isSourceDirty = false;
-	bool waitToProcessCurrentFrame = false;
 
 	hr = CoInitializeEx(nullptr, COINITBASE_MULTITHREADED | COINIT_DISABLE_OLE1DDE);
 	if (FAILED(hr)) {
@@ -798,8 +918,7 @@ Start:
 		{
 			std::unique_ptr<CaptureBase> pRecordingSourceCapture = nullptr;
 			// D3D objects
-			CComPtr<ID3D11Texture2D> SharedSurf = nullptr;
-			CComPtr<IDXGIKeyedMutex> KeyMutex = nullptr;
+			D3D11SharedCanvasView canvasView(pSourceData->DxRes.Context);
 			SetEvent(pData->StartedEvent);
 
 			if (WaitForSingleObjectEx(pData->TerminateThreadsEvent, 0, FALSE) == WAIT_OBJECT_0) {
@@ -807,24 +926,18 @@ Start:
 				goto Exit;
 			}
 
-			pRecordingSourceCapture.reset(CreateCaptureInstance(pSource));
+			pRecordingSourceCapture.reset(CreateCaptureInstance(pSource, pData->GifFrameCacheMaxBytes));
 			if (!pRecordingSourceCapture) {
 				LOG_ERROR(L"Failed to create recording source");
 				hr = E_FAIL;
 				goto Exit;
 			}
 
-			// Obtain handle to sync shared Surface
-			hr = pSourceData->DxRes.Device->OpenSharedResource(pData->CanvasTexSharedHandle, __uuidof(ID3D11Texture2D), reinterpret_cast<void **>(&SharedSurf));
+			// Open the buffers of the shared canvas on the device of this thread
+			hr = canvasView.OpenBuffers(pSourceData->DxRes.Device, pData->CanvasBufferSharedHandles);
 			if (FAILED(hr))
 			{
-				LOG_ERROR(L"Opening shared texture failed");
-				goto Exit;
-			}
-			hr = SharedSurf->QueryInterface(__uuidof(IDXGIKeyedMutex), reinterpret_cast<void **>(&KeyMutex));
-			if (FAILED(hr))
-			{
-				LOG_ERROR(L"Failed to get keyed mutex interface in spawned thread");
+				LOG_ERROR(L"Opening shared canvas failed");
 				goto Exit;
 			}
 			// Make duplication
@@ -862,21 +975,40 @@ Start:
 					|| sourceOutputSize.cy != currentSize.cy;
 			});
 
+			//The area of the shared canvas this source is drawn to.
+			RECT sourceRect = pSourceData->FrameCoordinates;
+			OffsetRect(&sourceRect, pSourceData->OffsetX, pSourceData->OffsetY);
+
+			size_t bufferIndex;
 			ExecuteFuncOnExit blankFrameOnExit([&]() {
 				if (!IsSourceChanged(pSource)
 					&& WaitForSingleObjectEx(pData->TerminateThreadsEvent, 0, FALSE) != WAIT_OBJECT_0
-					&& KeyMutex->AcquireSync(0, 500) == S_OK) {
-					textureManager.BlankTexture(SharedSurf, pSourceData->FrameCoordinates, pSourceData->OffsetX, pSourceData->OffsetY);
-					KeyMutex->ReleaseSync(1);
+					&& pData->Canvas->BeginWrite(&canvasView, &bufferIndex)) {
+					DirtyRegion blankedRegion{};
+					if (SUCCEEDED(textureManager.BlankTexture(canvasView.GetBuffer(bufferIndex), pSourceData->FrameCoordinates, pSourceData->OffsetX, pSourceData->OffsetY))) {
+						blankedRegion.Add(sourceRect);
+					}
+					pData->Canvas->EndWrite(&canvasView, blankedRegion);
+					SetEvent(pData->FrameWrittenEvent);
 				}
 			});
 
+			//Sources with a frame event are waited for together with the other events. Others block in AcquireNextFrame until the next frame deadline.
+			HANDLE frameArrivedEvent = pRecordingSourceCapture->GetFrameArrivedEvent();
+			CaptureWaitScheduler scheduler(
+				make_unique<EventCaptureWaitBackend>(pData->TerminateThreadsEvent, pData->OptionsChangedEvent, frameArrivedEvent),
+				pData->FrameDeadline,
+				pData->Metrics);
+			ExecuteFuncOnExit logWaitStatsOnExit([&]() {
+				LogCaptureWaitStats(pRecordingSourceCapture->Name(), scheduler.GetStats());
+				LogTextureAllocationStats(pRecordingSourceCapture->Name(), textureManager.GetAllocationStats());
+			});
+
 			*pData->ThreadResult = {};
 			pData->ThreadResult->RecordingResult = S_OK;
 
 			bool isPreviewEnabled = pSource->IsVideoFramePreviewEnabled.value_or(false);
 			// Main duplication loop
-			std::chrono::steady_clock::time_point WaitForFrameBegin = (std::chrono::steady_clock::time_point::min)();
 			while (true)
 			{
 				if (WaitForSingleObjectEx(pData->TerminateThreadsEvent, 0, FALSE) == WAIT_OBJECT_0) {
@@ -897,7 +1029,8 @@ Start:
 					isSharedSurfaceDirty = true;
 				}
 				if (!isCapturingVideo) {
-					Sleep(1);
+					//Nothing is captured until video capture is enabled again, which is an options change.
+					scheduler.WaitIdle(CAPTURE_WAKE_MASK_CONTROL);
 					if (pSource->IsVideoCaptureEnabled.value_or(true)) {
 						isCapturingVideo = true;
 						isSharedSurfaceDirty = true;
@@ -905,71 +1038,73 @@ Start:
 					continue;
 				}
 				CComPtr<ID3D11Texture2D> pFrame = nullptr;
-				if (!waitToProcessCurrentFrame)
-				{
-					if (isSharedSurfaceDirty) {
-						hr = pRecordingSourceCapture->AcquireNextFrame(10, &pFrame);
-					}
-					else {
-						hr = pRecordingSourceCapture->AcquireNextFrame(10, nullptr);
-					}
-					if (hr == DXGI_ERROR_WAIT_TIMEOUT) {
+				DWORD acquireTimeout = 0;
+				if (frameArrivedEvent) {
+					if (scheduler.WaitUntilDeadline(CAPTURE_WAKE_MASK_CONTROL | GetCaptureWakeMask(CaptureWakeReason::FrameArrived)) != CaptureWakeReason::FrameArrived) {
 						continue;
 					}
-					else if (hr == S_FALSE) {
-						Sleep(10);
-						continue;
-					}
-					else if (FAILED(hr)) {
-						break;
-					}
 				}
-				{
-					MeasureExecutionTime measure(L"CaptureThreadProc wait for sync");
-					// We have a new frame so try and process it
-					// Try to acquire keyed mutex in order to access shared surface
-					hr = KeyMutex->AcquireSync(0, 1);
+				else {
+					acquireTimeout = static_cast<DWORD>((scheduler.GetTimeoutMicros() + 999) / 1000);
 				}
-				if (hr == static_cast<HRESULT>(WAIT_TIMEOUT))
-				{
-					// Can't use shared surface right now, try again later
-					if (!waitToProcessCurrentFrame) {
-						WaitForFrameBegin = chrono::steady_clock::now();
-					}
-					waitToProcessCurrentFrame = true;
+				if (isSharedSurfaceDirty) {
+					hr = pRecordingSourceCapture->AcquireNextFrame(acquireTimeout, &pFrame);
+				}
+				else {
+					hr = pRecordingSourceCapture->AcquireNextFrame(acquireTimeout, nullptr);
+				}
+				if (!frameArrivedEvent) {
+					scheduler.OnWake(hr == DXGI_ERROR_WAIT_TIMEOUT ? CaptureWakeReason::Deadline : CaptureWakeReason::FrameArrived);
+				}
+				if (hr == DXGI_ERROR_WAIT_TIMEOUT) {
 					continue;
 				}
-				else if (FAILED(hr))
-				{
-					// Generic unknown failure
-					LOG_ERROR(L"Unexpected error acquiring KeyMutex");
+				else if (hr == S_FALSE) {
+					//The source has no new frames until it is changed.
+					scheduler.WaitIdle(CAPTURE_WAKE_MASK_CONTROL);
+					continue;
+				}
+				else if (FAILED(hr)) {
 					break;
 				}
+				{
+					MeasureExecutionTime measure(L"CaptureThreadProc wait for sync");
+					// We have a new frame so try and process it
+					// Lock the write buffer of the canvas. This only waits for other capture threads, never for the recorder.
+					if (!pData->Canvas->BeginWrite(&canvasView, &bufferIndex)) {
+						//The frame is lost, so the source is redrawn in full with the next one.
+						isSharedSurfaceDirty = true;
+						continue;
+					}
+				}
 #if MEASURE_EXECUTION_TIME
 				MeasureExecutionTime measureLock(string_format(L"CaptureThreadProc sync lock for %ls", pRecordingSourceCapture->Name().c_str()));
 #endif
-				ReleaseKeyedMutexOnExit releaseMutex(KeyMutex, 1);
+				CComPtr<ID3D11Texture2D> SharedSurf = canvasView.GetBuffer(bufferIndex);
+				//The area written to the canvas, published as a new frame when the buffer is unlocked.
+				DirtyRegion writtenRegion{};
+				bool isWriteEnded = false;
+				auto EndWrite([&]() {
+					if (!isWriteEnded) {
+						isWriteEnded = true;
+						pData->Canvas->EndWrite(&canvasView, writtenRegion);
+					}
+				});
+				ExecuteFuncOnExit endWriteOnExit(EndWrite);
 
 				// We can now process the current frame
-				if (waitToProcessCurrentFrame) {
-					waitToProcessCurrentFrame = false;
-					LONGLONG waitTimeMillis = duration_cast<milliseconds>(chrono::steady_clock::now() - WaitForFrameBegin).count();
-					//If the capture has been waiting for an excessive time to draw a frame, we assume the frame is stale, and drop it.
-					if (pData->TotalUpdatedFrameCount > 0 && waitTimeMillis > 1000) {
-						isSharedSurfaceDirty = true;
-						LOG_DEBUG("Dropped %ls frame because wait time exceeded limit", pRecordingSourceCapture->Name().c_str());
-						continue;
-					}
-					LOG_TRACE(L"CaptureThreadProc waited for busy shared surface for %lld ms", waitTimeMillis);
-				}
 				if (pSource->IsCursorCaptureEnabled.value_or(true)) {
 					// Get mouse info
+					EnterCriticalSection(pData->PtrInfoCriticalSection);
+					LeaveCriticalSectionOnExit leavePtrInfoOnExit(pData->PtrInfoCriticalSection);
 					hr = pRecordingSourceCapture->GetMouse(pData->PtrInfo, pSourceData->FrameCoordinates, pSourceData->OffsetX, pSourceData->OffsetY);
 					if (FAILED(hr)) {
 						LOG_ERROR("Failed to get mouse data");
 					}
 				}
 				else if (pData->PtrInfo) {
+					EnterCriticalSection(pData->PtrInfoCriticalSection);
+					LeaveCriticalSectionOnExit leavePtrInfoOnExit(pData->PtrInfoCriticalSection);
 					pData->PtrInfo->Visible = false;
 				}
 
@@ -989,10 +1124,12 @@ Start:
 					OffsetRect(&offsetFrameCoordinates, pSourceData->OffsetX + contentOffset.cx, pSourceData->OffsetY + contentOffset.cy);
 					if (isSourceDirty) {
 						textureManager.BlankTexture(SharedSurf, pSourceData->FrameCoordinates, pSourceData->OffsetX, pSourceData->OffsetY);
+						writtenRegion.Add(sourceRect);
 						isSourceDirty = false;
 					}
 					if (isSharedSurfaceDirty && pFrame) {
 						textureManager.BlankTexture(SharedSurf, pSourceData->FrameCoordinates, pSourceData->OffsetX, pSourceData->OffsetY);
+						writtenRegion.Add(sourceRect);
 						//The screen has been blacked out, so we restore a full frame to the shared surface before starting to apply updates.
 						hr = pRecordingSourceCapture->WriteNextFrameToSharedSurface(0, SharedSurf, pSourceData->OffsetX, pSourceData->OffsetY, offsetFrameCoordinates, pFrame);
 						isSharedSurfaceDirty = false;
@@ -1004,6 +1141,7 @@ Start:
 				else {
 					hr = textureManager.BlankTexture(SharedSurf, pSourceData->FrameCoordinates, pSourceData->OffsetX, pSourceData->OffsetY);
 					if (SUCCEEDED(hr)) {
+						writtenRegion.Add(sourceRect);
 						isCapturingVideo = false;
 					}
 				}
@@ -1016,8 +1154,16 @@ Start:
 				else if (hr == S_FALSE) {
 					continue;
 				}
+				if (isCapturingVideo) {
+					pRecordingSourceCapture->GetUpdatedRegion(sourceRect, &writtenRegion);
+				}
+				//Publish the frame before it is counted, so the recorder finds it in the canvas when it sees the new timestamp.
+				EndWrite();
+				scheduler.OnFrameCopied();
 				pData->TotalUpdatedFrameCount++;
 				QueryPerformanceCounter(&pData->LastUpdateTimeStamp);
+				SetEvent(pData->FrameWrittenEvent);
+				textureManager.EndFrame();
 			}
 		}
 		catch (const AccessViolationException &ex) {
@@ -1088,10 +1234,16 @@ DWORD WINAPI OverlayCaptureThreadProc(_In_ void *Param) {
 	int retryCount = 0;
 	bool IsCapturingVideo = true;
 	CComPtr<ID3D11Texture2D> pSharedTexture = nullptr;
+	TextureManager textureManager{};
 	hr = CoInitializeEx(nullptr, COINITBASE_MULTITHREADED | COINIT_DISABLE_OLE1DDE);
 	if (FAILED(hr)) {
 		goto Exit;
 	}
+	hr = textureManager.Initialize(pOverlayData->DxRes.Context, pOverlayData->DxRes.Device);
+	if (FAILED(hr)) {
+		LOG_ERROR(L"Failed to initialize TextureManager");
+		goto Exit;
+	}
 
 Start:
 	{
@@ -1101,8 +1253,6 @@ Start:
 			unique_ptr<CaptureBase> overlayCapture = nullptr;
 			// D3D objects
 			CComPtr<ID3D11Texture2D> pCurrentFrame = nullptr;
-			CComPtr<ID3D11Texture2D> SharedSurf = nullptr;
-			CComPtr<IDXGIKeyedMutex> KeyMutex = nullptr;
 
 			SetEvent(pData->StartedEvent);
 
@@ -1111,7 +1261,7 @@ Start:
 				goto Exit;
 			}
 
-			overlayCapture.reset(CreateCaptureInstance(pOverlay));
+			overlayCapture.reset(CreateCaptureInstance(pOverlay, pData->GifFrameCacheMaxBytes));
 			if (!overlayCapture) {
 				LOG_ERROR(L"Failed to create recording source");
 				goto Exit;
@@ -1124,20 +1274,6 @@ Start:
 				goto Exit;
 			}
 
-			// Obtain handle to sync shared Surface
-			hr = pOverlayData->DxRes.Device->OpenSharedResource(pData->CanvasTexSharedHandle, __uuidof(ID3D11Texture2D), reinterpret_cast<void **>(&SharedSurf));
-			if (FAILED(hr))
-			{
-				LOG_ERROR(L"Opening shared texture failed");
-				goto Exit;
-			}
-			hr = SharedSurf->QueryInterface(__uuidof(IDXGIKeyedMutex), reinterpret_cast<void **>(&KeyMutex));
-			if (FAILED(hr))
-			{
-				LOG_ERROR(L"Failed to get keyed mutex interface in spawned thread");
-				goto Exit;
-			}
-
 			const IStream *sourceStream = pOverlay->SourceStream;
 			const std::wstring sourcePath = pOverlay->SourcePath;
 			const HWND sourceWindowHandle = pOverlay->SourceWindow;
@@ -1146,6 +1282,16 @@ Start:
 				return overlay->SourcePath != sourcePath || overlay->SourceStream != sourceStream || overlay->SourceWindow != sourceWindowHandle;
 				});
 
+			HANDLE frameArrivedEvent = overlayCapture->GetFrameArrivedEvent();
+			CaptureWaitScheduler scheduler(
+				make_unique<EventCaptureWaitBackend>(pData->TerminateThreadsEvent, pData->OptionsChangedEvent, frameArrivedEvent),
+				pData->FrameDeadline,
+				pData->Metrics);
+			ExecuteFuncOnExit logWaitStatsOnExit([&]() {
+				LogCaptureWaitStats(overlayCapture->Name(), scheduler.GetStats());
+				LogTextureAllocationStats(overlayCapture->Name(), textureManager.GetAllocationStats());
+			});
+
 			*pData->ThreadResult = {};
 			pData->ThreadResult->RecordingResult = S_OK;
 			// Main capture loop
@@ -1161,18 +1307,30 @@ Start:
 				}
 
 				if (!IsCapturingVideo) {
-					Sleep(1);
+					scheduler.WaitIdle(CAPTURE_WAKE_MASK_CONTROL);
 					IsCapturingVideo = pOverlay->IsVideoCaptureEnabled.value_or(true);
 					continue;
 				}
 				pCurrentFrame.Release();
+				DWORD acquireTimeout = 0;
+				if (frameArrivedEvent) {
+					if (scheduler.WaitUntilDeadline(CAPTURE_WAKE_MASK_CONTROL | GetCaptureWakeMask(CaptureWakeReason::FrameArrived)) != CaptureWakeReason::FrameArrived) {
+						continue;
+					}
+				}
+				else {
+					acquireTimeout = static_cast<DWORD>((scheduler.GetTimeoutMicros() + 999) / 1000);
+				}
 				// Get new frame from video capture
-				hr = overlayCapture->AcquireNextFrame(10, &pCurrentFrame);
+				hr = overlayCapture->AcquireNextFrame(acquireTimeout, &pCurrentFrame);
+				if (!frameArrivedEvent) {
+					scheduler.OnWake(hr == DXGI_ERROR_WAIT_TIMEOUT ? CaptureWakeReason::Deadline : CaptureWakeReason::FrameArrived);
+				}
 				if (hr == DXGI_ERROR_WAIT_TIMEOUT) {
 					continue;
 				}
 				else if (hr == S_FALSE) {
-					Sleep(10);
+					scheduler.WaitIdle(CAPTURE_WAKE_MASK_CONTROL);
 					continue;
 				}
 				else if (FAILED(hr)) {
@@ -1194,13 +1352,11 @@ Start:
 						}
 					}
 					if (createSharedTexture) {
-						desc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
-						desc.SampleDesc.Count = 1;
-						desc.Usage = D3D11_USAGE_DEFAULT;
-						desc.BindFlags = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE;
-						desc.CPUAccessFlags = 0;
-						desc.MiscFlags = D3D11_RESOURCE_MISC_SHARED;
-						pOverlayData->DxRes.Device->CreateTexture2D(&desc, nullptr, &pSharedTexture);
+						hr = textureManager.CreateTexture(desc.Width, desc.Height, &pSharedTexture, D3D11_RESOURCE_MISC_SHARED, D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE);
+						if (FAILED(hr)) {
+							LOG_ERROR(L"Failed to create overlay shared texture: hr = 0x%08x", hr);
+							break;
+						}
 						HANDLE sharedHandle = GetSharedHandle(pSharedTexture);
 						pData->OverlayTexSharedHandle = sharedHandle;
 						LOG_INFO("Created new overlay shared texture");
@@ -1208,24 +1364,23 @@ Start:
 					isSharedTextureDirty = false;
 				}
 
-				if (!pOverlay->IsVideoCaptureEnabled.value_or(true)) {
+				if (pOverlay->IsVideoCaptureEnabled.value_or(true)) {
+					pOverlayData->DxRes.Context->CopyResource(pSharedTexture, pCurrentFrame);
+				}
+				else {
 					D3D11_TEXTURE2D_DESC desc;
-					pCurrentFrame->GetDesc(&desc);
-					pCurrentFrame.Release();
-					pOverlayData->DxRes.Device->CreateTexture2D(&desc, nullptr, &pCurrentFrame);
+					pSharedTexture->GetDesc(&desc);
+					textureManager.BlankTexture(pSharedTexture, RECT{ 0, 0, static_cast<LONG>(desc.Width), static_cast<LONG>(desc.Height) });
 					IsCapturingVideo = false;
 				}
-
-				pOverlayData->DxRes.Context->CopyResource(pSharedTexture, pCurrentFrame);
 				//If a shared texture is updated on one device ID3D11DeviceContext::Flush must be called on that device. 
 				//https://docs.microsoft.com/en-us/windows/win32/api/d3d11/nf-d3d11-id3d11device-opensharedresource
 				pOverlayData->DxRes.Context->Flush();
+				scheduler.OnFrameCopied();
 				QueryPerformanceCounter(&pData->LastUpdateTimeStamp);
-				// Try to acquire keyed mutex in order to access shared surface. The timeout value is 0, and we just continue if we don't get a lock.
-				// This is just used to notify the rendering loop about updated overlays, so no reason to wait around if it's already updating.
-				if (KeyMutex->AcquireSync(0, 0) == S_OK) {
-					KeyMutex->ReleaseSync(1);
-				}
+				//Overlays are drawn on the frame by the recorder, so it only needs to be woken up to pick up the new overlay frame.
+				SetEvent(pData->FrameWrittenEvent);
+				textureManager.EndFrame();
 			}
 		}
 		catch (const AccessViolationException &e) {
@@ -1278,9 +1433,7 @@ Exit:
 	if (pSharedTexture) {
 		D3D11_TEXTURE2D_DESC desc;
 		pSharedTexture->GetDesc(&desc);
-		CComPtr<ID3D11Texture2D> pBlankTexture;
-		pOverlayData->DxRes.Device->CreateTexture2D(&desc, nullptr, &pBlankTexture);
-		pOverlayData->DxRes.Context->CopyResource(pSharedTexture, pBlankTexture);
+		textureManager.BlankTexture(pSharedTexture, RECT{ 0, 0, static_cast<LONG>(desc.Width), static_cast<LONG>(desc.Height) });
 	}
 
 	CoUninitialize();
@@ -1288,7 +1441,7 @@ Exit:
 	return 0;
 }
 
-_Ret_maybenull_ CaptureBase *CreateCaptureInstance(_In_ RECORDING_SOURCE_BASE *pSource)
+_Ret_maybenull_ CaptureBase *CreateCaptureInstance(_In_ RECORDING_SOURCE_BASE *pSource, _In_ UINT64 gifFrameCacheMaxBytes)
 {
 	switch (pSource->Type)
 	{
@@ -1323,7 +1476,7 @@ _Ret_maybenull_ CaptureBase *CreateCaptureInstance(_In_ RECORDING_SOURCE_BASE *p
 			}
 			ImageFileType imageType = getImageTypeByMagic(signature.c_str());
 			if (imageType == ImageFileType::IMAGE_FILE_GIF) {
-				return new GifReader();
+				return new GifReader(gifFrameCacheMaxBytes);
 			}
 			else {
 				return new ImageReader();
@@ -5,7 +5,11 @@
 #include "Screengrab.h"
 #include "TextureManager.h"
 #include "Util.h"
+#include "RecordingMetrics.h"
+#include "SharedCanvasView.h"
+#include "FrameUpdateTracker.h"
 #include <atlbase.h>
+#include <atomic>
 
 void ProcessCaptureHRESULT(_In_ HRESULT hr, _Inout_ CAPTURE_RESULT *pResult, _In_opt_ ID3D11Device *pDevice);
 
@@ -19,7 +23,8 @@ public:
 		_In_ ID3D11Device *pDevice,
 		_In_ std::shared_ptr<OUTPUT_OPTIONS> pOutputOptions,
 		_In_ std::shared_ptr<ENCODER_OPTIONS> pEncoderOptions,
-		_In_ std::shared_ptr<MOUSE_OPTIONS> pMouseOptions);
+		_In_ std::shared_ptr<MOUSE_OPTIONS> pMouseOptions,
+		_In_opt_ std::shared_ptr<RecordingMetrics> pMetrics);
 	virtual inline PTR_INFO *GetPointerInfo() {
 		return &m_PtrInfo;
 	}
@@ -36,33 +41,55 @@ public:
 	virtual UINT GetUpdatedSourceCount();
 	virtual UINT GetUpdatedOverlayCount();
 	virtual void InvalidateCaptureSources();
+	/// <summary>
+	/// Wakes up the capture threads, so they pick up changes to the options of their recording source or overlay.
+	/// </summary>
+	virtual void NotifyOptionsChanged();
 	std::vector<CAPTURE_RESULT *> GetCaptureResults();
 	std::vector<CAPTURE_THREAD_DATA> GetCaptureThreadData();
 	std::vector<OVERLAY_THREAD_DATA> GetOverlayThreadData();
-	virtual HRESULT ProcessOverlays(_Inout_ ID3D11Texture2D *pBackgroundFrame, _Out_ int *updateCount);
+	/// <summary>
+	/// Draws the overlays on a frame. Can be called on another thread than the one acquiring frames.
+	/// </summary>
+	/// <param name="acquiredTimeStamp">The AcquiredTimeStamp of the frame</param>
+	/// <param name="updateCount">The number of overlays updated after the frame was acquired. They are drawn on this frame, and still count as updates to the next frame acquired.</param>
+	virtual HRESULT ProcessOverlays(_Inout_ ID3D11Texture2D *pBackgroundFrame, _In_ INT64 acquiredTimeStamp, _Out_ int *updateCount);
 	HRESULT InitializeOverlays(_In_ const std::vector<RECORDING_OVERLAY *> &overlays, _In_opt_  HANDLE hErrorEvent);
 protected:
-	LARGE_INTEGER m_LastAcquiredFrameTimeStamp;
-	ID3D11Texture2D *m_SharedSurf;
-	IDXGIKeyedMutex *m_KeyMutex;
+	//The time of the last frame acquired with updates. Only moved by the thread acquiring frames.
+	FrameUpdateTracker m_UpdateTracker;
+	//The buffers of the canvas the capture threads draw into, as seen from the device of the recorder.
+	std::unique_ptr<D3D11SharedCanvasView> m_CanvasView;
+	std::unique_ptr<TripleBufferedCanvas> m_Canvas;
 	ID3D11Device *m_Device;
 	ID3D11DeviceContext *m_DeviceContext;
 	RECT m_OutputRect;
 	PTR_INFO m_PtrInfo;
 
-	virtual HRESULT CreateSharedSurf(_In_ RECT desktopRect, _Outptr_ ID3D11Texture2D **ppSharedTexture, _Outptr_ IDXGIKeyedMutex **ppKeyedMutex);
-	virtual HRESULT CreateSharedSurf(_In_ const std::vector<RECORDING_SOURCE *> &sources, _Out_ std::vector<RECORDING_SOURCE_DATA *> *pCreatedOutputs, _Out_ RECT *pDeskBounds, _Outptr_ ID3D11Texture2D **ppSharedTexture, _Outptr_ IDXGIKeyedMutex **ppKeyedMutex);
+	virtual HRESULT CreateSharedSurf(_In_ RECT desktopRect, _Outptr_ ID3D11Texture2D **ppSharedTexture, _Outptr_opt_ IDXGIKeyedMutex **ppKeyedMutex);
+	virtual HRESULT CreateSharedSurf(_In_ const std::vector<RECORDING_SOURCE *> &sources, _Out_ std::vector<RECORDING_SOURCE_DATA *> *pCreatedOutputs, _Out_ RECT *pDeskBounds, _Outptr_ D3D11SharedCanvasView **ppCanvasView);
 private:
 	bool m_IsInitialFrameWriteComplete;
 	bool m_IsInitialOverlayWriteComplete;
 	bool m_IsCapturing;
 	HANDLE m_TerminateThreadsEvent;
+	//Signaled when a capture thread has written a frame, to wake up the recorder waiting for one.
+	HANDLE m_FrameWrittenEvent;
+	//The time the recorder will take the next frame, published when it starts waiting for one.
+	FrameDeadlineClock m_FrameDeadline;
 	CRITICAL_SECTION m_CriticalSection;
+	//Guards m_PtrInfo, which the capture threads update while the recorder reads it.
+	CRITICAL_SECTION m_PtrInfoCriticalSection;
 	std::shared_ptr<ENCODER_OPTIONS> m_EncoderOptions;
 	std::shared_ptr<OUTPUT_OPTIONS> m_OutputOptions;
 	std::shared_ptr<MOUSE_OPTIONS> m_MouseOptions;
+	std::shared_ptr<RecordingMetrics> m_Metrics;
 	std::unique_ptr<TextureManager> m_TextureManager;
 	CComPtr<ID3D11Texture2D> m_FrameCopy;
+	//The area of the canvas changed since m_FrameCopy was last updated.
+	DirtyRegion m_UpdatedRegion;
+	//Set when m_FrameCopy must be fully updated on the next acquired frame, e.g. after a pause.
+	std::atomic<bool> m_IsFrameCopyInvalidated;
 
 	std::vector<CAPTURE_THREAD *> m_CaptureThreads;
 	std::vector<OVERLAY_THREAD *> m_OverlayThreads;
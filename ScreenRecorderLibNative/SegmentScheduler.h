@@ -0,0 +1,117 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+struct SEGMENT_INFO {
+	//The number of the segment, starting at 0.
+	uint32_t Index = 0;
+	//Where the segment starts and ends on the recording timeline, in 100 nanosecond units. A segment ends where the next one starts.
+	int64_t StartPos = 0;
+	int64_t EndPos = 0;
+};
+
+/// <summary>
+/// Decides where a recording is split into segments, each written to a file of its own.
+/// A segment ends once it is at least the maximum duration or size, on the next frame carrying a new video frame, since a segment must start with a keyframe.
+/// Frames are placed whole, with the audio attached to them, so a boundary falls between two frames and no audio is dropped or written twice.
+/// The frames of a segment are written with timestamps relative to the start of the segment, so every segment starts at 0.
+/// The limits are soft: a segment runs until the first frame with video after the limit.
+/// </summary>
+class SegmentScheduler
+{
+public:
+	/// <param name="maxDuration">The duration after which a new segment is started, in 100 nanosecond units, or 0 for no limit</param>
+	/// <param name="maxBytes">The size after which a new segment is started, or 0 for no limit</param>
+	SegmentScheduler(int64_t maxDuration, uint64_t maxBytes) :
+		m_MaxDuration(maxDuration),
+		m_MaxBytes(maxBytes),
+		m_Segment{},
+		m_IsStarted(false)
+	{
+	}
+
+	bool IsEnabled() const { return m_MaxDuration > 0 || m_MaxBytes > 0; }
+
+	/// <summary>
+	/// Places the next frame in a segment. The first frame starts the first segment.
+	/// </summary>
+	/// <param name="startPos">The start of the frame on the recording timeline</param>
+	/// <param name="duration">The duration of the frame</param>
+	/// <param name="hasVideo">true if the frame carries a new video frame, false if it only extends the previous one</param>
+	/// <param name="segmentBytes">The number of bytes written to the current segment so far</param>
+	/// <param name="pEndedSegment">Receives the segment ended by this frame, if any</param>
+	/// <returns>true if the frame ends the current segment and starts a new one</returns>
+	bool PlaceFrame(int64_t startPos, int64_t duration, bool hasVideo, uint64_t segmentBytes, SEGMENT_INFO *pEndedSegment)
+	{
+		bool isNewSegment = false;
+		if (!m_IsStarted) {
+			m_Segment = SEGMENT_INFO{ 0, startPos, startPos };
+			m_IsStarted = true;
+		}
+		else if (hasVideo && IsSegmentFull(startPos, segmentBytes)) {
+			//The boundary is the start of the frame, so the segments cover the timeline without gaps or overlap.
+			m_Segment.EndPos = startPos;
+			if (pEndedSegment) {
+				*pEndedSegment = m_Segment;
+			}
+			m_Segment = SEGMENT_INFO{ m_Segment.Index + 1, startPos, startPos };
+			isNewSegment = true;
+		}
+		m_Segment.EndPos = (std::max)(m_Segment.EndPos, startPos + duration);
+		return isNewSegment;
+	}
+
+	/// <summary>
+	/// Converts a position on the recording timeline to a timestamp in the current segment.
+	/// </summary>
+	int64_t ToSegmentTime(int64_t pos) const
+	{
+		return pos - m_Segment.StartPos;
+	}
+
+	/// <summary>
+	/// The current segment, ending at the end of the last frame placed in it.
+	/// </summary>
+	/// <returns>false if no frame has been placed yet</returns>
+	bool GetCurrentSegment(SEGMENT_INFO *pSegment) const
+	{
+		if (!m_IsStarted) {
+			return false;
+		}
+		*pSegment = m_Segment;
+		return true;
+	}
+
+	/// <summary>
+	/// The path of a segment. The first segment is written to the output path itself, and later ones get their number appended to the file name,
+	/// e.g. video.mp4, video_002.mp4, video_003.mp4.
+	/// </summary>
+	static std::wstring GetSegmentPath(const std::wstring &outputPath, uint32_t index)
+	{
+		if (index == 0) {
+			return outputPath;
+		}
+		size_t fileNameStart = outputPath.find_last_of(L"\\/");
+		size_t extensionStart = outputPath.find_last_of(L'.');
+		if (extensionStart == std::wstring::npos || (fileNameStart != std::wstring::npos && extensionStart < fileNameStart)) {
+			extensionStart = outputPath.length();
+		}
+		wchar_t suffix[16];
+		swprintf(suffix, sizeof(suffix) / sizeof(suffix[0]), L"_%03u", index + 1);
+		return outputPath.substr(0, extensionStart) + suffix + outputPath.substr(extensionStart);
+	}
+
+private:
+	bool IsSegmentFull(int64_t startPos, uint64_t segmentBytes) const
+	{
+		return (m_MaxDuration > 0 && startPos - m_Segment.StartPos >= m_MaxDuration)
+			|| (m_MaxBytes > 0 && segmentBytes >= m_MaxBytes);
+	}
+
+	const int64_t m_MaxDuration;
+	const uint64_t m_MaxBytes;
+	SEGMENT_INFO m_Segment;
+	bool m_IsStarted;
+};
@@ -0,0 +1,95 @@
+#pragma once
+#include "TripleBufferedCanvas.h"
+#include "DX.util.h"
+#include "Log.h"
+#include <d3d11.h>
+#include <atlbase.h>
+
+//Longest wait for another device to release a canvas buffer. The buffers are only held while copying to or from them, so a longer wait means the device is gone.
+#define SHARED_CANVAS_LOCK_TIMEOUT_MILLIS 1000
+
+/// <summary>
+/// The buffers of a TripleBufferedCanvas as D3D11 textures shared between devices, each synchronized across devices with its keyed mutex.
+/// The textures are created on the device of the recorder, and opened through their shared handles on the device of each capture thread.
+/// </summary>
+class D3D11SharedCanvasView : public ICanvasBufferView
+{
+public:
+	D3D11SharedCanvasView(_In_ ID3D11DeviceContext *pDeviceContext) :
+		m_DeviceContext(pDeviceContext)
+	{
+	}
+
+	/// <summary>
+	/// Uses buffers created on the device of the view.
+	/// </summary>
+	HRESULT SetBuffers(_In_reads_(CANVAS_BUFFER_COUNT) ID3D11Texture2D *const *ppBuffers)
+	{
+		HRESULT hr = S_OK;
+		for (size_t i = 0; i < CANVAS_BUFFER_COUNT; i++) {
+			m_Buffers[i] = ppBuffers[i];
+			RETURN_ON_BAD_HR(hr = m_Buffers[i]->QueryInterface(__uuidof(IDXGIKeyedMutex), reinterpret_cast<void **>(&m_KeyedMutexes[i])));
+		}
+		return hr;
+	}
+
+	/// <summary>
+	/// Opens buffers created on another device.
+	/// </summary>
+	HRESULT OpenBuffers(_In_ ID3D11Device *pDevice, _In_reads_(CANVAS_BUFFER_COUNT) const HANDLE *pSharedHandles)
+	{
+		HRESULT hr = S_OK;
+		for (size_t i = 0; i < CANVAS_BUFFER_COUNT; i++) {
+			m_Buffers[i].Release();
+			m_KeyedMutexes[i].Release();
+			hr = pDevice->OpenSharedResource(pSharedHandles[i], __uuidof(ID3D11Texture2D), reinterpret_cast<void **>(&m_Buffers[i]));
+			if (FAILED(hr)) {
+				LOG_ERROR(L"Opening shared canvas buffer failed: hr = 0x%08x", hr);
+				return hr;
+			}
+			RETURN_ON_BAD_HR(hr = m_Buffers[i]->QueryInterface(__uuidof(IDXGIKeyedMutex), reinterpret_cast<void **>(&m_KeyedMutexes[i])));
+		}
+		return hr;
+	}
+
+	inline ID3D11Texture2D *GetBuffer(size_t index) const { return m_Buffers[index]; }
+	inline HANDLE GetSharedHandle(size_t index) const { return ::GetSharedHandle(m_Buffers[index]); }
+
+	bool LockBuffer(size_t index) override {
+		HRESULT hr = m_KeyedMutexes[index]->AcquireSync(0, SHARED_CANVAS_LOCK_TIMEOUT_MILLIS);
+		if (hr != S_OK) {
+			LOG_ERROR(L"Failed to lock shared canvas buffer %zu: hr = 0x%08x", index, hr);
+			return false;
+		}
+		return true;
+	}
+
+	void UnlockBuffer(size_t index) override {
+		m_KeyedMutexes[index]->ReleaseSync(0);
+	}
+
+	void CopyBufferRegion(size_t destination, size_t source, const DirtyRegion &region) override {
+		D3D11_TEXTURE2D_DESC desc;
+		m_Buffers[source]->GetDesc(&desc);
+		REGION_RECT frameRect{ 0, 0, static_cast<int32_t>(desc.Width), static_cast<int32_t>(desc.Height) };
+		//Separate copies only pay off while the changed area is small.
+		if (region.GetArea() * 2 < frameRect.Area()) {
+			for (const REGION_RECT &regionRect : region.GetRects()) {
+				REGION_RECT rect = DirtyRegion::Intersect(regionRect, frameRect);
+				if (rect.IsEmpty()) {
+					continue;
+				}
+				D3D11_BOX box{ static_cast<UINT>(rect.left), static_cast<UINT>(rect.top), 0, static_cast<UINT>(rect.right), static_cast<UINT>(rect.bottom), 1 };
+				m_DeviceContext->CopySubresourceRegion(m_Buffers[destination], 0, rect.left, rect.top, 0, m_Buffers[source], 0, &box);
+			}
+		}
+		else {
+			m_DeviceContext->CopyResource(m_Buffers[destination], m_Buffers[source]);
+		}
+	}
+
+private:
+	CComPtr<ID3D11DeviceContext> m_DeviceContext;
+	CComPtr<ID3D11Texture2D> m_Buffers[CANVAS_BUFFER_COUNT];
+	CComPtr<IDXGIKeyedMutex> m_KeyedMutexes[CANVAS_BUFFER_COUNT];
+};
@@ -0,0 +1,299 @@
+#include "SnapshotPipeline.h"
+#include "screengrab.h"
+#include "Log.h"
+#include "util.h"
+#include <thread>
+
+using namespace std;
+
+SnapshotPipeline::SnapshotPipeline() :
+	m_DeviceContext(nullptr),
+	m_Device(nullptr),
+	m_SnapshotOptions(nullptr),
+	m_Metrics(nullptr),
+	m_WorkerPool(nullptr)
+{
+}
+
+SnapshotPipeline::~SnapshotPipeline()
+{
+	if (m_WorkerPool) {
+		//Queued snapshots hold staging textures and callbacks into the recording, so they are written before the workers stop.
+		m_WorkerPool->Drain();
+		m_WorkerPool->Stop();
+	}
+}
+
+HRESULT SnapshotPipeline::Initialize(_In_ ID3D11DeviceContext *pDeviceContext, _In_ ID3D11Device *pDevice, _In_ std::shared_ptr<SNAPSHOT_OPTIONS> pOptions, _In_opt_ std::shared_ptr<RecordingMetrics> pMetrics, _In_ size_t depth)
+{
+	if (!pDeviceContext || !pDevice || !pOptions) {
+		return E_INVALIDARG;
+	}
+	if (m_WorkerPool) {
+		//The queued snapshots were copied on the previous device.
+		m_WorkerPool->Drain();
+	}
+	else {
+		size_t threadCount = (std::max)((std::min)(std::thread::hardware_concurrency() / 2, (unsigned int)SNAPSHOT_PIPELINE_MAX_THREADS), 1u);
+		//Room for the queued snapshots, and for the helpers each snapshot being encoded posts for both passes of the encoders.
+		m_WorkerPool = make_unique<WorkerPool>(threadCount, depth + (depth + 1) * threadCount * 2);
+		m_WorkerPool->Start([]() {
+			HRESULT hr = CoInitializeEx(nullptr, COINITBASE_MULTITHREADED | COINIT_DISABLE_OLE1DDE);
+			if (FAILED(hr)) {
+				LOG_ERROR(L"CoInitializeEx failed on snapshot worker thread: hr = 0x%08x", hr);
+			}
+			}, []() { CoUninitialize(); });
+	}
+	{
+		std::scoped_lock lock(m_SlotsMutex, m_SaveMutex);
+		m_DeviceContext = pDeviceContext;
+		m_Device = pDevice;
+		m_SnapshotOptions = pOptions;
+		m_Metrics = pMetrics;
+		m_Slots.clear();
+		for (size_t i = 0; i < (std::max)(depth, (size_t)1); i++) {
+			m_Slots.push_back(make_unique<STAGING_SLOT>());
+		}
+		m_SaveSlot = STAGING_SLOT{};
+		m_Encoders = ObjectPool<SNAPSHOT_ENCODER>::Create(m_Slots.size() + 1);
+	}
+	return S_OK;
+}
+
+HRESULT SnapshotPipeline::SubmitSnapshot(_In_ ID3D11Texture2D *pTexture, _In_ RECT sourceRect, _In_ std::wstring path, _In_opt_ std::function<void(HRESULT)> onCompleted)
+{
+	if (!m_WorkerPool) {
+		return E_NOT_VALID_STATE;
+	}
+	STAGING_SLOT *pSlot = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(m_SlotsMutex);
+		for (auto &slot : m_Slots) {
+			if (!slot->IsInUse) {
+				pSlot = slot.get();
+				break;
+			}
+		}
+		if (pSlot) {
+			pSlot->IsInUse = true;
+		}
+	}
+	if (!pSlot) {
+		if (m_Metrics) {
+			m_Metrics->Increment(RecordingCounter::DroppedSnapshots);
+		}
+		LOG_DEBUG(L"Dropped snapshot %ls, the snapshot workers are busy", path.c_str());
+		return S_FALSE;
+	}
+	auto ReleaseSlot([this, pSlot]() {
+		std::lock_guard<std::mutex> lock(m_SlotsMutex);
+		pSlot->IsInUse = false;
+	});
+	HRESULT hr = CopyToSlot(pTexture, sourceRect, pSlot);
+	if (FAILED(hr)) {
+		ReleaseSlot();
+		return hr;
+	}
+	auto queuedTime = std::chrono::steady_clock::now();
+	bool isQueued = m_WorkerPool->TryPost([this, pSlot, path, onCompleted, queuedTime, ReleaseSlot]() {
+		if (m_Metrics) {
+			m_Metrics->Record(RecordingTimer::SnapshotQueueWait, std::chrono::duration_cast<std::chrono::duration<int64_t, std::ratio<1, 10000000>>>(std::chrono::steady_clock::now() - queuedTime).count());
+		}
+		HRESULT hr = WriteSnapshot(pSlot, path, nullptr);
+		ReleaseSlot();
+		if (FAILED(hr)) {
+			LOG_ERROR(L"Failed to write snapshot to %ls: hr = 0x%08x", path.c_str(), hr);
+		}
+		if (onCompleted) {
+			onCompleted(hr);
+		}
+	});
+	if (!isQueued) {
+		ReleaseSlot();
+		if (m_Metrics) {
+			m_Metrics->Increment(RecordingCounter::DroppedSnapshots);
+		}
+		LOG_DEBUG(L"Dropped snapshot %ls, the snapshot queue is full", path.c_str());
+		return S_FALSE;
+	}
+	return S_OK;
+}
+
+HRESULT SnapshotPipeline::SaveSnapshot(_In_ ID3D11Texture2D *pTexture, _In_ RECT sourceRect, _In_opt_ std::wstring path, _In_opt_ IStream *pStream)
+{
+	if (!m_WorkerPool) {
+		return E_NOT_VALID_STATE;
+	}
+	if (path.empty() && !pStream) {
+		return E_INVALIDARG;
+	}
+	std::lock_guard<std::mutex> lock(m_SaveMutex);
+	HRESULT hr;
+	RETURN_ON_BAD_HR(hr = CopyToSlot(pTexture, sourceRect, &m_SaveSlot));
+	return WriteSnapshot(&m_SaveSlot, path, pStream);
+}
+
+void SnapshotPipeline::Drain()
+{
+	if (m_WorkerPool) {
+		m_WorkerPool->Drain();
+	}
+}
+
+PIPELINE_STAGE_STATS SnapshotPipeline::GetStats()
+{
+	return m_WorkerPool ? m_WorkerPool->GetStats() : PIPELINE_STAGE_STATS{};
+}
+
+HRESULT SnapshotPipeline::CopyToSlot(_In_ ID3D11Texture2D *pTexture, _In_ RECT sourceRect, _Inout_ STAGING_SLOT *pSlot)
+{
+	D3D11_TEXTURE2D_DESC desc;
+	pTexture->GetDesc(&desc);
+	D3D11_BOX box{};
+	box.left = static_cast<UINT>((std::max)(sourceRect.left, 0L));
+	box.top = static_cast<UINT>((std::max)(sourceRect.top, 0L));
+	box.right = (std::min)(static_cast<UINT>((std::max)(sourceRect.right, 0L)), desc.Width);
+	box.bottom = (std::min)(static_cast<UINT>((std::max)(sourceRect.bottom, 0L)), desc.Height);
+	box.front = 0;
+	box.back = 1;
+	if (box.right <= box.left || box.bottom <= box.top) {
+		LOG_ERROR(L"Snapshot area is outside the texture");
+		return E_INVALIDARG;
+	}
+	UINT width = box.right - box.left;
+	UINT height = box.bottom - box.top;
+	if (!pSlot->Texture || pSlot->Desc.Width != width || pSlot->Desc.Height != height || pSlot->Desc.Format != desc.Format) {
+		pSlot->Texture.Release();
+		desc.Width = width;
+		desc.Height = height;
+		desc.Usage = D3D11_USAGE_STAGING;
+		desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+		desc.MiscFlags = 0;
+		desc.BindFlags = 0;
+		desc.MipLevels = 1;
+		desc.ArraySize = 1;
+		desc.SampleDesc.Count = 1;
+		desc.SampleDesc.Quality = 0;
+		HRESULT hr = m_Device->CreateTexture2D(&desc, nullptr, &pSlot->Texture);
+		if (FAILED(hr)) {
+			LOG_ERROR(L"Failed to create staging texture for snapshot: hr = 0x%08x", hr);
+			return hr;
+		}
+		pSlot->Desc = desc;
+	}
+	m_DeviceContext->CopySubresourceRegion(pSlot->Texture, 0, 0, 0, 0, pTexture, 0, &box);
+	//Start the copy now, so it is done by the time a worker gets to the snapshot.
+	m_DeviceContext->Flush();
+	return S_OK;
+}
+
+HRESULT SnapshotPipeline::WriteSnapshot(_In_ STAGING_SLOT *pSlot, _In_opt_ std::wstring path, _In_opt_ IStream *pStream)
+{
+	MeasureRecordingTimer measureSnapshotEncode(m_Metrics.get(), RecordingTimer::SnapshotEncode);
+	HRESULT hr;
+	D3D11_MAPPED_SUBRESOURCE map;
+	//Polled rather than waited for, as a waiting Map holds the device context lock and would stall the recording thread until the GPU catches up.
+	while ((hr = m_DeviceContext->Map(pSlot->Texture, 0, D3D11_MAP_READ, D3D11_MAP_FLAG_DO_NOT_WAIT, &map)) == DXGI_ERROR_WAS_STILL_DRAWING) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	RETURN_ON_BAD_HR(hr);
+	if (IsBuiltInEncoderUsed(pSlot->Desc)) {
+		PooledObject<SNAPSHOT_ENCODER> pEncoder = m_Encoders->Acquire();
+		hr = pEncoder ? EncodeSnapshot(pSlot->Desc, map, *pEncoder) : E_OUTOFMEMORY;
+		m_DeviceContext->Unmap(pSlot->Texture, 0);
+		RETURN_ON_BAD_HR(hr);
+		RETURN_ON_BAD_HR(hr = path.empty() ? WriteToStream(pStream, pEncoder->EncodedImage) : WriteToFile(path, pEncoder->EncodedImage));
+	}
+	else {
+		//The copy is done, so WIC maps the staging texture without waiting.
+		m_DeviceContext->Unmap(pSlot->Texture, 0);
+		if (path.empty()) {
+			RETURN_ON_BAD_HR(hr = SaveWICTextureToStream(m_DeviceContext, pSlot->Texture, m_SnapshotOptions->GetSnapshotEncoderFormat(), pStream));
+		}
+		else {
+			RETURN_ON_BAD_HR(hr = SaveWICTextureToFile(m_DeviceContext, pSlot->Texture, m_SnapshotOptions->GetSnapshotEncoderFormat(), path.c_str()));
+		}
+	}
+	if (m_Metrics) {
+		m_Metrics->Increment(RecordingCounter::Snapshots);
+	}
+	return hr;
+}
+
+bool SnapshotPipeline::IsBuiltInEncoderUsed(_In_ const D3D11_TEXTURE2D_DESC &desc)
+{
+	if (!m_SnapshotOptions->IsBuiltInEncoderEnabled()) {
+		return false;
+	}
+	GUID format = m_SnapshotOptions->GetSnapshotEncoderFormat();
+	if (format != GUID_ContainerFormatPng && format != GUID_ContainerFormatJpeg) {
+		return false;
+	}
+	switch (desc.Format)
+	{
+		case DXGI_FORMAT_B8G8R8A8_UNORM:
+		case DXGI_FORMAT_B8G8R8A8_UNORM_SRGB:
+		case DXGI_FORMAT_B8G8R8X8_UNORM:
+		case DXGI_FORMAT_B8G8R8X8_UNORM_SRGB:
+			return true;
+		default:
+			return false;
+	}
+}
+
+HRESULT SnapshotPipeline::EncodeSnapshot(_In_ const D3D11_TEXTURE2D_DESC &desc, _In_ const D3D11_MAPPED_SUBRESOURCE &map, _Inout_ SNAPSHOT_ENCODER &encoder)
+{
+	const uint8_t *pData = static_cast<const uint8_t *>(map.pData);
+	bool isEncoded;
+	if (m_SnapshotOptions->GetSnapshotEncoderFormat() == GUID_ContainerFormatJpeg) {
+		isEncoded = encoder.Jpeg.Encode(pData, desc.Width, desc.Height, map.RowPitch, encoder.EncodedImage, m_WorkerPool.get());
+	}
+	else {
+		isEncoded = encoder.Png.Encode(pData, desc.Width, desc.Height, map.RowPitch, encoder.EncodedImage, m_WorkerPool.get());
+	}
+	if (!isEncoded) {
+		LOG_ERROR(L"Failed to encode snapshot of %ux%u pixels", desc.Width, desc.Height);
+		return E_FAIL;
+	}
+	return S_OK;
+}
+
+HRESULT SnapshotPipeline::WriteToFile(_In_ const std::wstring &path, _In_ const std::vector<uint8_t> &data)
+{
+	HANDLE hFile = CreateFileW(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (hFile == INVALID_HANDLE_VALUE) {
+		return HRESULT_FROM_WIN32(GetLastError());
+	}
+	HRESULT hr = S_OK;
+	size_t written = 0;
+	while (written < data.size()) {
+		DWORD chunkSize = static_cast<DWORD>((std::min)(data.size() - written, (size_t)MAXDWORD));
+		DWORD chunkWritten = 0;
+		if (!WriteFile(hFile, data.data() + written, chunkSize, &chunkWritten, nullptr)) {
+			hr = HRESULT_FROM_WIN32(GetLastError());
+			break;
+		}
+		written += chunkWritten;
+	}
+	CloseHandle(hFile);
+	if (FAILED(hr)) {
+		DeleteFileW(path.c_str());
+	}
+	return hr;
+}
+
+HRESULT SnapshotPipeline::WriteToStream(_In_ IStream *pStream, _In_ const std::vector<uint8_t> &data)
+{
+	size_t written = 0;
+	while (written < data.size()) {
+		ULONG chunkSize = static_cast<ULONG>((std::min)(data.size() - written, (size_t)ULONG_MAX));
+		ULONG chunkWritten = 0;
+		HRESULT hr;
+		RETURN_ON_BAD_HR(hr = pStream->Write(data.data() + written, chunkSize, &chunkWritten));
+		if (chunkWritten == 0) {
+			return STG_E_MEDIUMFULL;
+		}
+		written += chunkWritten;
+	}
+	return S_OK;
+}
@@ -0,0 +1,100 @@
+#pragma once
+#include "CommonTypes.h"
+#include "RecordingMetrics.h"
+#include "WorkerPool.h"
+#include "ObjectPool.h"
+#include "PngEncoder.h"
+#include "JpegEncoder.h"
+#include <d3d11.h>
+#include <atlbase.h>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//The snapshots that may wait to be encoded at the same time. Snapshots taken while as many are waiting are dropped.
+#define SNAPSHOT_PIPELINE_DEFAULT_DEPTH 2
+//The most worker threads encoding snapshots, so snapshots never take more than a few cores from the recording.
+#define SNAPSHOT_PIPELINE_MAX_THREADS 4
+
+/// <summary>
+/// Reads back, encodes and writes snapshots on a pool of worker threads, so a snapshot taken during a recording only costs the recording thread a GPU copy.
+/// The copies go to staging textures that are reused between snapshots of the same size.
+/// PNG and JPEG snapshots of BGRA textures can be encoded by the built-in encoders, which split each image between the workers. Other snapshots are encoded by WIC on a worker.
+/// Each snapshot being written takes its own encoders from a pool, so snapshots are encoded at the same time and share the idle workers.
+/// </summary>
+class SnapshotPipeline
+{
+public:
+	SnapshotPipeline();
+	~SnapshotPipeline();
+	/// <summary>
+	/// Sets the device the snapshots are taken on, and starts the workers the first time it is called.
+	/// Waits for the queued snapshots first, so it can be called again after the device is recreated.
+	/// </summary>
+	/// <param name="depth">The most snapshots that may wait to be encoded at the same time</param>
+	HRESULT Initialize(_In_ ID3D11DeviceContext *pDeviceContext, _In_ ID3D11Device *pDevice, _In_ std::shared_ptr<SNAPSHOT_OPTIONS> pOptions, _In_opt_ std::shared_ptr<RecordingMetrics> pMetrics, _In_ size_t depth = SNAPSHOT_PIPELINE_DEFAULT_DEPTH);
+	/// <summary>
+	/// Copies an area of a texture to a staging texture and queues it to be written to a file by a worker.
+	/// </summary>
+	/// <param name="sourceRect">The area of the texture to save. It is clipped to the texture.</param>
+	/// <param name="onCompleted">Optional function called on the worker once the snapshot is written or has failed</param>
+	/// <returns>S_OK if the snapshot was queued, S_FALSE if it was dropped because the workers are still busy with earlier snapshots, else an error code</returns>
+	HRESULT SubmitSnapshot(_In_ ID3D11Texture2D *pTexture, _In_ RECT sourceRect, _In_ std::wstring path, _In_opt_ std::function<void(HRESULT)> onCompleted = nullptr);
+	/// <summary>
+	/// Saves an area of a texture to a file or stream and waits for it to be written. The workers help encode the image if they are idle.
+	/// </summary>
+	/// <param name="sourceRect">The area of the texture to save. It is clipped to the texture.</param>
+	/// <param name="path">The file to write to, or empty to write to pStream</param>
+	HRESULT SaveSnapshot(_In_ ID3D11Texture2D *pTexture, _In_ RECT sourceRect, _In_opt_ std::wstring path, _In_opt_ IStream *pStream);
+	/// <summary>
+	/// Waits until every queued snapshot has been written.
+	/// </summary>
+	void Drain();
+	/// <summary>
+	/// The snapshots and encoding work run by the workers, and the time they waited and took.
+	/// </summary>
+	PIPELINE_STAGE_STATS GetStats();
+private:
+	struct STAGING_SLOT {
+		CComPtr<ID3D11Texture2D> Texture;
+		D3D11_TEXTURE2D_DESC Desc{};
+		bool IsInUse = false;
+	};
+	//The built-in encoders and the encoded image of a snapshot being written. Kept in a pool, so their buffers are reused between snapshots.
+	struct SNAPSHOT_ENCODER {
+		PngEncoder Png;
+		JpegEncoder Jpeg;
+		std::vector<uint8_t> EncodedImage;
+	};
+
+	HRESULT CopyToSlot(_In_ ID3D11Texture2D *pTexture, _In_ RECT sourceRect, _Inout_ STAGING_SLOT *pSlot);
+	/// <summary>
+	/// Encodes the contents of a slot and writes them to a file or stream. Waits for the copy to the slot to finish without blocking the device context.
+	/// </summary>
+	HRESULT WriteSnapshot(_In_ STAGING_SLOT *pSlot, _In_opt_ std::wstring path, _In_opt_ IStream *pStream);
+	/// <summary>
+	/// Encodes the contents of a mapped slot with the built-in encoder for the snapshot format.
+	/// </summary>
+	HRESULT EncodeSnapshot(_In_ const D3D11_TEXTURE2D_DESC &desc, _In_ const D3D11_MAPPED_SUBRESOURCE &map, _Inout_ SNAPSHOT_ENCODER &encoder);
+	bool IsBuiltInEncoderUsed(_In_ const D3D11_TEXTURE2D_DESC &desc);
+	static HRESULT WriteToFile(_In_ const std::wstring &path, _In_ const std::vector<uint8_t> &data);
+	static HRESULT WriteToStream(_In_ IStream *pStream, _In_ const std::vector<uint8_t> &data);
+
+	CComPtr<ID3D11DeviceContext> m_DeviceContext;
+	CComPtr<ID3D11Device> m_Device;
+	std::shared_ptr<SNAPSHOT_OPTIONS> m_SnapshotOptions;
+	std::shared_ptr<RecordingMetrics> m_Metrics;
+	std::unique_ptr<WorkerPool> m_WorkerPool;
+
+	//The staging textures of the snapshots queued on the workers.
+	std::mutex m_SlotsMutex;
+	std::vector<std::unique_ptr<STAGING_SLOT>> m_Slots;
+	//The staging texture of the snapshots saved with SaveSnapshot, which are saved one at a time.
+	std::mutex m_SaveMutex;
+	STAGING_SLOT m_SaveSlot;
+
+	//An encoder for each snapshot that may be written at the same time: the queued snapshots and the one saved with SaveSnapshot.
+	std::shared_ptr<ObjectPool<SNAPSHOT_ENCODER>> m_Encoders;
+};
@@ -10,7 +10,7 @@ SourceReaderBase::SourceReaderBase() :
 	m_Stride(0),
 	m_FrameRate(0),
 	m_FrameSize{},
-	m_FramerateTimer(nullptr),
+	m_FramePacer(nullptr),
 	m_NewFrameEvent(nullptr),
 	m_StopCaptureEvent(nullptr),
 	m_OutputMediaType(nullptr),
@@ -31,7 +31,6 @@ SourceReaderBase::~SourceReaderBase()
 	Close();
 	EnterCriticalSection(&m_CriticalSection);
 
-	delete m_FramerateTimer;
 	CloseHandle(m_NewFrameEvent);
 	CloseHandle(m_StopCaptureEvent);
 	LeaveCriticalSection(&m_CriticalSection);
@@ -93,8 +92,11 @@ void SourceReaderBase::Close()
 {
 	EnterCriticalSection(&m_CriticalSection);
 	SafeRelease(&m_Sample);
-	if (m_FramerateTimer) {
-		m_FramerateTimer->StopTimer(true);
+	if (m_FramePacer) {
+		m_FramePacer->Cancel();
+		FRAME_PACING_STATS stats = m_FramePacer->GetStats();
+		LOG_DEBUG(L"Source reader frame pacing: %llu frames, %llu skipped, %llu late, mean jitter %.2f ms, max jitter %.2f ms",
+			stats.Frames, stats.Skipped, stats.Late, HundredNanosToMillisDouble((INT64)stats.GetMeanJitter()), HundredNanosToMillisDouble(stats.MaxJitter));
 	}
 	SetEvent(m_StopCaptureEvent);
 	LeaveCriticalSection(&m_CriticalSection);
@@ -424,15 +426,16 @@ HRESULT SourceReaderBase::OnReadSample(HRESULT status, DWORD streamIndex, DWORD
 				SetEvent(m_NewFrameEvent);
 			}
 			if (SUCCEEDED(hr)) {
-				if (!m_FramerateTimer) {
-					m_FramerateTimer = new HighresTimer();
-					m_FramerateTimer->StartRecurringTimer((INT64)floor(1000 / m_FrameRate));
-				}
 				if (m_FrameRate > 0) {
+					if (!m_FramePacer) {
+						//Frames are due on a grid from the first one, so the source keeps its frame rate exactly instead of running at a rounded down interval.
+						m_FramePacer = make_unique<FramePacer>(make_shared<HighresTimerPacingClock>(), FramePacingMode::FixedRate);
+						m_FramePacer->SetFrameRate(m_FrameRate);
+					}
 					auto t1 = std::chrono::high_resolution_clock::now();
-					auto sleepTime = m_FramerateTimer->GetMillisUntilNextTick();
+					auto sleepTime = HundredNanosToMillisDouble(m_FramePacer->GetTimeUntilNextFrame());
 					MeasureExecutionTime measureNextTick(L"OnReadSample scheduled delay");
-					hr = m_FramerateTimer->WaitForNextTick();
+					hr = m_FramePacer->WaitForNextFrame() ? S_OK : E_FAIL;
 					if (SUCCEEDED(hr)) {
 						auto t2 = std::chrono::high_resolution_clock::now();
 						std::chrono::duration<double, std::milli> ms_double = t2 - t1;
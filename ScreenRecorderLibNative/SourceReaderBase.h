@@ -8,7 +8,7 @@
 #include <Shlwapi.h>
 #include <atlbase.h>
 #include "CommonTypes.h"
-#include "HighresTimer.h"
+#include "FramePacingClock.h"
 #include "LogMediaType.h"
 #include "CaptureBase.h"
 #include "TextureManager.h"
@@ -23,6 +23,7 @@ public:
 	virtual HRESULT StartCapture(_In_ RECORDING_SOURCE_BASE &recordingSource) override;
 	virtual HRESULT GetNativeSize(_In_ RECORDING_SOURCE_BASE &recordingSource, _Out_ SIZE *nativeMediaSize) override;
 	virtual HRESULT AcquireNextFrame(_In_ DWORD timeoutMillis, _Outptr_opt_ ID3D11Texture2D **ppFrame) override;
+	virtual inline HANDLE GetFrameArrivedEvent() override { return m_NewFrameEvent; }
 	virtual HRESULT Initialize(_In_ ID3D11DeviceContext *pDeviceContext, _In_ ID3D11Device *pDevice) override;
 	virtual HRESULT WriteNextFrameToSharedSurface(_In_ DWORD timeoutMillis, _Inout_ ID3D11Texture2D *pSharedSurf, INT offsetX, INT offsetY, _In_ RECT destinationRect, _In_opt_ ID3D11Texture2D *pTexture = nullptr) override;
 	inline virtual HRESULT GetMouse(_Inout_ PTR_INFO *pPtrInfo, _In_ RECT frameCoordinates, _In_ int offsetX, _In_ int offsetY) override {
@@ -69,7 +70,7 @@ private:
 	HANDLE m_StopCaptureEvent;
 	LARGE_INTEGER m_LastSampleReceivedTimeStamp;
 	IMFMediaBuffer *m_Sample;
-	HighresTimer *m_FramerateTimer;
+	std::unique_ptr<FramePacer> m_FramePacer;
 	IMFMediaType *m_OutputMediaType;
 	IMFMediaType *m_InputMediaType;
 	IMFSourceReader *m_SourceReader;
@@ -0,0 +1,208 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <algorithm>
+
+#define RING_BUFFER_CACHE_LINE_SIZE 64
+
+/// <summary>
+/// A readable region of a ring buffer. The data may wrap around the end of the buffer, so it is exposed as up to two contiguous spans.
+/// </summary>
+struct RING_BUFFER_SPANS {
+	const uint8_t *First = nullptr;
+	size_t FirstLength = 0;
+	const uint8_t *Second = nullptr;
+	size_t SecondLength = 0;
+
+	size_t TotalLength() const { return FirstLength + SecondLength; }
+};
+
+/// <summary>
+/// Fixed capacity, lock-free byte ring buffer for exactly one producer thread and one consumer thread.
+/// The read and write positions live on separate cache lines, so the producer and consumer never share a cache line for their own position.
+/// Positions are free-running counters, and the capacity is always a power of two, so wrap-around is a mask operation.
+/// </summary>
+class SpscRingBuffer
+{
+public:
+	SpscRingBuffer() :
+		m_Buffer(nullptr),
+		m_Capacity(0),
+		m_Mask(0),
+		m_WritePos(0),
+		m_CachedReadPos(0),
+		m_ReadPos(0),
+		m_CachedWritePos(0)
+	{
+	}
+	explicit SpscRingBuffer(size_t minimumCapacity) :SpscRingBuffer() {
+		Reset(minimumCapacity);
+	}
+	SpscRingBuffer(const SpscRingBuffer &) = delete;
+	SpscRingBuffer &operator=(const SpscRingBuffer &) = delete;
+
+	/// <summary>
+	/// Reallocates the buffer to hold at least the given number of bytes, rounded up to a power of two, and discards any content.
+	/// Not thread safe. Must only be called while neither the producer nor the consumer is active.
+	/// </summary>
+	void Reset(size_t minimumCapacity) {
+		size_t capacity = 1;
+		while (capacity < minimumCapacity) {
+			capacity <<= 1;
+		}
+		if (capacity != m_Capacity) {
+			m_Buffer.reset(new uint8_t[capacity]);
+			m_Capacity = capacity;
+			m_Mask = capacity - 1;
+		}
+		m_WritePos.store(0, std::memory_order_relaxed);
+		m_ReadPos.store(0, std::memory_order_relaxed);
+		m_CachedReadPos = 0;
+		m_CachedWritePos = 0;
+	}
+
+	inline size_t Capacity() const { return m_Capacity; }
+
+	/// <summary>
+	/// The number of bytes available for reading. Exact when called from the consumer, a lower bound when called from the producer.
+	/// </summary>
+	inline size_t Size() const {
+		return m_WritePos.load(std::memory_order_acquire) - m_ReadPos.load(std::memory_order_acquire);
+	}
+
+	inline bool IsEmpty() const { return Size() == 0; }
+
+#pragma region Producer
+	/// <summary>
+	/// The number of bytes that can be written without overwriting unread data. Producer only.
+	/// </summary>
+	inline size_t AvailableToWrite() {
+		m_CachedReadPos = m_ReadPos.load(std::memory_order_acquire);
+		return m_Capacity - (m_WritePos.load(std::memory_order_relaxed) - m_CachedReadPos);
+	}
+
+	/// <summary>
+	/// Copies up to count bytes into the buffer. Producer only.
+	/// </summary>
+	/// <returns>The number of bytes written. Less than count if the buffer is full.</returns>
+	size_t Write(const void *pData, size_t count) {
+		return WriteInternal(static_cast<const uint8_t *>(pData), count);
+	}
+
+	/// <summary>
+	/// Writes up to count zero bytes into the buffer. Producer only.
+	/// </summary>
+	/// <returns>The number of bytes written. Less than count if the buffer is full.</returns>
+	size_t WriteSilence(size_t count) {
+		return WriteInternal(nullptr, count);
+	}
+#pragma endregion
+
+#pragma region Consumer
+	/// <summary>
+	/// Exposes up to maxCount readable bytes without copying them. The data stays valid until Consume is called. Consumer only.
+	/// </summary>
+	/// <returns>The number of readable bytes exposed in the spans</returns>
+	size_t Peek(RING_BUFFER_SPANS *pSpans, size_t maxCount = SIZE_MAX) {
+		*pSpans = {};
+		size_t readPos = m_ReadPos.load(std::memory_order_relaxed);
+		size_t available = m_CachedWritePos - readPos;
+		if (available < maxCount) {
+			m_CachedWritePos = m_WritePos.load(std::memory_order_acquire);
+			available = m_CachedWritePos - readPos;
+		}
+		size_t count = (std::min)(available, maxCount);
+		if (count == 0) {
+			return 0;
+		}
+		size_t offset = readPos & m_Mask;
+		size_t firstLength = (std::min)(count, m_Capacity - offset);
+		pSpans->First = m_Buffer.get() + offset;
+		pSpans->FirstLength = firstLength;
+		if (firstLength < count) {
+			pSpans->Second = m_Buffer.get();
+			pSpans->SecondLength = count - firstLength;
+		}
+		return count;
+	}
+
+	/// <summary>
+	/// Releases count bytes previously exposed by Peek back to the producer. Consumer only.
+	/// </summary>
+	void Consume(size_t count) {
+		m_ReadPos.store(m_ReadPos.load(std::memory_order_relaxed) + count, std::memory_order_release);
+	}
+
+	/// <summary>
+	/// Copies up to count bytes out of the buffer and consumes them. Consumer only.
+	/// </summary>
+	/// <returns>The number of bytes read</returns>
+	size_t Read(void *pDest, size_t count) {
+		RING_BUFFER_SPANS spans;
+		size_t read = Peek(&spans, count);
+		uint8_t *pOut = static_cast<uint8_t *>(pDest);
+		if (spans.FirstLength > 0) {
+			memcpy(pOut, spans.First, spans.FirstLength);
+		}
+		if (spans.SecondLength > 0) {
+			memcpy(pOut + spans.FirstLength, spans.Second, spans.SecondLength);
+		}
+		Consume(read);
+		return read;
+	}
+
+	/// <summary>
+	/// Discards all readable bytes. Consumer only.
+	/// </summary>
+	void Clear() {
+		m_CachedWritePos = m_WritePos.load(std::memory_order_acquire);
+		m_ReadPos.store(m_CachedWritePos, std::memory_order_release);
+	}
+#pragma endregion
+
+private:
+	size_t WriteInternal(const uint8_t *pData, size_t count) {
+		size_t writePos = m_WritePos.load(std::memory_order_relaxed);
+		size_t freeBytes = m_Capacity - (writePos - m_CachedReadPos);
+		if (freeBytes < count) {
+			//Only touch the consumer's cache line when the cached read position says there is not enough room.
+			freeBytes = AvailableToWrite();
+		}
+		size_t writeCount = (std::min)(count, freeBytes);
+		if (writeCount == 0) {
+			return 0;
+		}
+		size_t offset = writePos & m_Mask;
+		size_t firstLength = (std::min)(writeCount, m_Capacity - offset);
+		if (pData) {
+			memcpy(m_Buffer.get() + offset, pData, firstLength);
+			if (firstLength < writeCount) {
+				memcpy(m_Buffer.get(), pData + firstLength, writeCount - firstLength);
+			}
+		}
+		else {
+			memset(m_Buffer.get() + offset, 0, firstLength);
+			if (firstLength < writeCount) {
+				memset(m_Buffer.get(), 0, writeCount - firstLength);
+			}
+		}
+		m_WritePos.store(writePos + writeCount, std::memory_order_release);
+		return writeCount;
+	}
+
+	std::unique_ptr<uint8_t[]> m_Buffer;
+	size_t m_Capacity;
+	size_t m_Mask;
+
+	//Producer owned cache line: the write position and the producer's last seen read position.
+	alignas(RING_BUFFER_CACHE_LINE_SIZE) std::atomic<size_t> m_WritePos;
+	size_t m_CachedReadPos;
+
+	//Consumer owned cache line: the read position and the consumer's last seen write position.
+	alignas(RING_BUFFER_CACHE_LINE_SIZE) std::atomic<size_t> m_ReadPos;
+	size_t m_CachedWritePos;
+	char m_Padding[RING_BUFFER_CACHE_LINE_SIZE - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+};
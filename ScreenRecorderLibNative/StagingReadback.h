@@ -0,0 +1,99 @@
+#pragma once
+#include "FrameReadback.h"
+#include "Log.h"
+#include <d3d11.h>
+#include <atlbase.h>
+#include <vector>
+
+/// <summary>
+/// Reads frames back through a set of D3D11 staging textures, one for each slot of a ReadbackRing.
+/// </summary>
+class D3D11StagingReadbackBackend : public IReadbackBackend<ID3D11Texture2D *>
+{
+public:
+	D3D11StagingReadbackBackend(_In_ ID3D11DeviceContext *pDeviceContext, _In_ ID3D11Device *pDevice, size_t depth) :
+		m_DeviceContext(pDeviceContext),
+		m_Device(pDevice),
+		m_Slots((std::max)(depth, (size_t)1))
+	{
+	}
+
+	bool PrepareSlot(size_t index, ID3D11Texture2D *pSource) override {
+		D3D11_TEXTURE2D_DESC desc;
+		pSource->GetDesc(&desc);
+		STAGING_SLOT &slot = m_Slots[index];
+		if (slot.Texture && slot.Desc.Width == desc.Width && slot.Desc.Height == desc.Height && slot.Desc.Format == desc.Format) {
+			return false;
+		}
+		slot.Texture.Release();
+		desc.Usage = D3D11_USAGE_STAGING;
+		desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+		desc.MiscFlags = 0;
+		desc.BindFlags = 0;
+		desc.MipLevels = 1;
+		desc.ArraySize = 1;
+		HRESULT hr = m_Device->CreateTexture2D(&desc, nullptr, &slot.Texture);
+		if (FAILED(hr)) {
+			LOG_ERROR(L"Failed to create staging texture for frame readback: hr = 0x%08x", hr);
+		}
+		slot.Desc = desc;
+		return true;
+	}
+
+	void CopyToSlot(size_t index, ID3D11Texture2D *pSource, const DirtyRegion *pRegion) override {
+		STAGING_SLOT &slot = m_Slots[index];
+		if (!slot.Texture) {
+			return;
+		}
+		//Separate copies only pay off while the changed area is small.
+		REGION_RECT frameRect{ 0, 0, static_cast<int32_t>(slot.Desc.Width), static_cast<int32_t>(slot.Desc.Height) };
+		if (pRegion && pRegion->GetArea() * 2 < frameRect.Area()) {
+			for (const REGION_RECT &regionRect : pRegion->GetRects()) {
+				REGION_RECT rect = DirtyRegion::Intersect(regionRect, frameRect);
+				if (rect.IsEmpty()) {
+					continue;
+				}
+				D3D11_BOX box{ static_cast<UINT>(rect.left), static_cast<UINT>(rect.top), 0, static_cast<UINT>(rect.right), static_cast<UINT>(rect.bottom), 1 };
+				m_DeviceContext->CopySubresourceRegion(slot.Texture, 0, rect.left, rect.top, 0, pSource, 0, &box);
+			}
+		}
+		else {
+			m_DeviceContext->CopyResource(slot.Texture, pSource);
+		}
+	}
+
+	bool MapSlot(size_t index, bool wait, READBACK_MAPPING *pMapping) override {
+		STAGING_SLOT &slot = m_Slots[index];
+		if (!slot.Texture) {
+			return false;
+		}
+		D3D11_MAPPED_SUBRESOURCE map;
+		HRESULT hr = m_DeviceContext->Map(slot.Texture, 0, D3D11_MAP_READ, wait ? 0 : D3D11_MAP_FLAG_DO_NOT_WAIT, &map);
+		if (FAILED(hr)) {
+			if (hr != DXGI_ERROR_WAS_STILL_DRAWING) {
+				LOG_ERROR(L"Failed to map staging texture for frame readback: hr = 0x%08x", hr);
+			}
+			return false;
+		}
+		pMapping->pData = static_cast<const uint8_t *>(map.pData);
+		pMapping->RowPitch = map.RowPitch;
+		pMapping->Width = slot.Desc.Width;
+		pMapping->Height = slot.Desc.Height;
+		return true;
+	}
+
+	void UnmapSlot(size_t index) override {
+		m_DeviceContext->Unmap(m_Slots[index].Texture, 0);
+	}
+
+private:
+	struct STAGING_SLOT {
+		CComPtr<ID3D11Texture2D> Texture;
+		D3D11_TEXTURE2D_DESC Desc{};
+	};
+	CComPtr<ID3D11DeviceContext> m_DeviceContext;
+	CComPtr<ID3D11Device> m_Device;
+	std::vector<STAGING_SLOT> m_Slots;
+};
+
+typedef ReadbackRing<ID3D11Texture2D *> StagingReadbackRing;
@@ -13,7 +13,10 @@ TextureManager::TextureManager() :
 	m_BlendState(nullptr),
 	m_VertexShader(nullptr),
 	m_PixelShader(nullptr),
-	m_InputLayout(nullptr)
+	m_InputLayout(nullptr),
+	m_AllocationTracker{},
+	m_BlankTextures(nullptr),
+	m_TextureCache(nullptr)
 {
 }
 
@@ -30,6 +33,8 @@ HRESULT TextureManager::Initialize(_In_ ID3D11DeviceContext *pDeviceContext, _In
 	CleanRefs();
 
 	HRESULT hr = S_OK;
+	m_BlankTextures = make_unique<BlankTextureCache>(make_unique<D3D11BlankTextureAllocator>(m_Device, &m_AllocationTracker));
+	m_TextureCache = make_shared<TextureCache>(make_unique<D3D11TextureAllocator>(m_Device, &m_AllocationTracker), GetTextureByteSize, TEXTURE_CACHE_BUDGET_BYTES);
 
 	// Create the sample state
 	D3D11_SAMPLER_DESC SampDesc;
@@ -563,12 +568,8 @@ HRESULT TextureManager::InitializeDesc(_In_ UINT width, _In_ UINT height, _Out_
 HRESULT TextureManager::GetOrCreateTexture(_In_ D3D11_TEXTURE2D_DESC desc, _Outptr_ ID3D11Texture2D **ppTexture)
 {
 	ID3D11Texture2D *tex = nullptr;
-	if (m_TextureCache.find(desc) != m_TextureCache.end()) {
-		tex = m_TextureCache.at(desc);
-	}
-	else {
-		RETURN_ON_BAD_HR(m_Device->CreateTexture2D(&desc, nullptr, &tex));
-		m_TextureCache[desc] = tex;
+	if (!m_TextureCache->Get(desc, &tex)) {
+		return E_OUTOFMEMORY;
 	}
 	*ppTexture = tex;
 	return S_OK;
@@ -598,7 +599,7 @@ HRESULT TextureManager::CropTexture(_In_ ID3D11Texture2D *pTexture, _In_ RECT cr
 	ID3D11Texture2D *pCroppedFrame = nullptr;
 	RETURN_ON_BAD_HR(GetOrCreateTexture(frameDesc, &pCroppedFrame));
 	if (pCroppedFrame == pTexture) {
-		RETURN_ON_BAD_HR(pDevice->CreateTexture2D(&frameDesc, nullptr, &pCroppedFrame));
+		RETURN_ON_BAD_HR(CreateTexture2D(pDevice, &frameDesc, nullptr, &pCroppedFrame));
 	}
 	D3D11_BOX sourceRegion;
 	RtlZeroMemory(&sourceRegion, sizeof(sourceRegion));
@@ -632,7 +633,7 @@ HRESULT TextureManager::CopyTextureWithCPU(_In_ ID3D11Device *pDevice, _In_ ID3D
 	stagingDesc.Usage = D3D11_USAGE_STAGING;
 	stagingDesc.MiscFlags = 0;
 	stagingDesc.BindFlags = 0;
-	RETURN_ON_BAD_HR(hr = pSourceDevice->CreateTexture2D(&stagingDesc, nullptr, &pStagingTexture));
+	RETURN_ON_BAD_HR(hr = CreateTexture2D(pSourceDevice, &stagingDesc, nullptr, &pStagingTexture));
 	//Copy the source surface to the new staging texture.
 	pDuplicationDeviceContext->CopyResource(pStagingTexture, pSourceTexture);
 	D3D11_MAPPED_SUBRESOURCE mapped{};
@@ -651,7 +652,7 @@ HRESULT TextureManager::CopyTextureWithCPU(_In_ ID3D11Device *pDevice, _In_ ID3D
 	mappedTextureDesc.MiscFlags = 0;
 	mappedTextureDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
 	CComPtr<ID3D11Texture2D> pTextureCopy;
-	RETURN_ON_BAD_HR(hr = pDevice->CreateTexture2D(&mappedTextureDesc, &initData, &pTextureCopy));
+	RETURN_ON_BAD_HR(hr = CreateTexture2D(pDevice, &mappedTextureDesc, &initData, &pTextureCopy));
 	*ppTextureCopy = pTextureCopy;
 	(*ppTextureCopy)->AddRef();
 	return hr;
@@ -677,7 +678,7 @@ HRESULT TextureManager::CreateTexture(_In_ UINT width, _In_ UINT height, _Outptr
 
 	// Create overlay as texture
 
-	HRESULT hr = m_Device->CreateTexture2D(&desc, nullptr, ppTexture);
+	HRESULT hr = CreateTexture2D(m_Device, &desc, nullptr, ppTexture);
 	return hr;
 }
 
@@ -707,30 +708,83 @@ HRESULT TextureManager::CreateTextureFromBuffer(_In_ BYTE *pFrameBuffer, _In_ LO
 
 	// Create overlay as texture
 
-	HRESULT hr = m_Device->CreateTexture2D(&desc, &initData, ppTexture);
+	HRESULT hr = CreateTexture2D(m_Device, &desc, &initData, ppTexture);
 	return hr;
 }
 
 HRESULT TextureManager::BlankTexture(_Inout_ ID3D11Texture2D *pTexture, _In_ RECT rect, _In_ INT offsetX, _In_  INT offsetY) {
-	int width = RectWidth(rect);
-	int height = RectHeight(rect);
+	D3D11_TEXTURE2D_DESC desc;
+	pTexture->GetDesc(&desc);
+	OffsetRect(&rect, offsetX, offsetY);
+	RECT textureRect{ 0, 0, static_cast<LONG>(desc.Width), static_cast<LONG>(desc.Height) };
+	RECT blankRect;
+	if (!IntersectRect(&blankRect, &rect, &textureRect)) {
+		return S_FALSE;
+	}
+
+	if (desc.BindFlags & D3D11_BIND_RENDER_TARGET) {
+		//Clearing a view needs no texture to copy from. Only the view is created, which is far cheaper than a texture.
+		CComPtr<ID3D11DeviceContext1> pDeviceContext1;
+		CComPtr<ID3D11RenderTargetView> pRenderTargetView;
+		if (SUCCEEDED(m_DeviceContext->QueryInterface(__uuidof(ID3D11DeviceContext1), reinterpret_cast<void **>(&pDeviceContext1)))
+			&& SUCCEEDED(m_Device->CreateRenderTargetView(pTexture, nullptr, &pRenderTargetView))) {
+			const FLOAT clearColor[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+			pDeviceContext1->ClearView(pRenderTargetView, clearColor, &blankRect, 1);
+			return S_OK;
+		}
+	}
+
+	ID3D11Texture2D *pBlankFrame = nullptr;
+	if (!m_BlankTextures->Get(desc.Format, RectWidth(blankRect), RectHeight(blankRect), &pBlankFrame)) {
+		return E_OUTOFMEMORY;
+	}
 	D3D11_BOX Box{};
-	// Copy back to shared surface
-	Box.right = width;
-	Box.bottom = height;
+	Box.right = RectWidth(blankRect);
+	Box.bottom = RectHeight(blankRect);
 	Box.back = 1;
+	m_DeviceContext->CopySubresourceRegion(pTexture, 0, blankRect.left, blankRect.top, 0, pBlankFrame, 0, &Box);
+	return S_OK;
+}
 
-	CComPtr<ID3D11Texture2D> pBlankFrame;
-	D3D11_TEXTURE2D_DESC desc;
-	pTexture->GetDesc(&desc);
-	desc.MiscFlags = 0;
-	desc.Width = width;
-	desc.Height = height;
-	HRESULT hr = m_Device->CreateTexture2D(&desc, nullptr, &pBlankFrame);
+UINT64 TextureManager::EndFrame()
+{
+	return m_AllocationTracker.EndFrame();
+}
+
+ALLOCATION_STATS TextureManager::GetAllocationStats()
+{
+	return m_AllocationTracker.GetStats();
+}
+
+std::shared_ptr<ID3D11Texture2D> TextureManager::PinTexture(_In_ ID3D11Texture2D *pTexture, _In_opt_ std::shared_ptr<BlockPool> pBlockPool)
+{
+	std::shared_ptr<TextureCache> pCache = m_TextureCache;
+	if (!pCache || !pCache->Pin(pTexture)) {
+		return nullptr;
+	}
+	pTexture->AddRef();
+	auto unpin = [pCache](ID3D11Texture2D *pTexture) {
+		pCache->Unpin(pTexture);
+		pTexture->Release();
+	};
+	if (pBlockPool) {
+		return std::shared_ptr<ID3D11Texture2D>(pTexture, unpin, BlockPoolAllocator<ID3D11Texture2D>(pBlockPool));
+	}
+	return std::shared_ptr<ID3D11Texture2D>(pTexture, unpin);
+}
+
+LRU_RESOURCE_CACHE_STATS TextureManager::GetTextureCacheStats()
+{
+	return m_TextureCache ? m_TextureCache->GetStats() : LRU_RESOURCE_CACHE_STATS{};
+}
+
+HRESULT TextureManager::CreateTexture2D(_In_ ID3D11Device *pDevice, _In_ const D3D11_TEXTURE2D_DESC *pDesc, _In_opt_ const D3D11_SUBRESOURCE_DATA *pInitialData, _Outptr_ ID3D11Texture2D **ppTexture)
+{
+	HRESULT hr = pDevice->CreateTexture2D(pDesc, pInitialData, ppTexture);
 	if (SUCCEEDED(hr)) {
-		m_DeviceContext->CopySubresourceRegion(pTexture, 0, rect.left + offsetX, rect.top + offsetY, 0, pBlankFrame, 0, &Box);
+		m_AllocationTracker.OnAllocation(GetTextureByteSize(*pDesc));
 	}
-	return S_OK;
+	return hr;
 }
 
 //
@@ -767,8 +821,7 @@ void TextureManager::CleanRefs()
 		m_BlendState->Release();
 		m_BlendState = nullptr;
 	}
-	for (auto &pair : m_TextureCache)
-	{
-		SafeRelease(&pair.second);
-	}
+	//Textures still pinned are released by the cache when their last pin is.
+	m_TextureCache.reset();
+	m_BlankTextures.reset();
 }
@@ -2,10 +2,16 @@
 #include <DirectXMath.h>
 #include "CommonTypes.h"
 #include "DX.util.h"
+#include "BlankTextureCache.h"
+#include "BlockPool.h"
+#include <memory>
 #include <unordered_map>
 
 using namespace std;
 
+//The most memory the textures cached by a TextureManager for cropping, resizing and rotating may use, unless they are pinned.
+#define TEXTURE_CACHE_BUDGET_BYTES (256ull * 1024 * 1024)
+
 class TextureManager
 {
 public:
@@ -32,10 +38,37 @@ public:
 	HRESULT CopyTextureWithCPU(_In_ ID3D11Device *pDevice, _In_ ID3D11Texture2D *pTexture, _Outptr_ ID3D11Texture2D **ppTextureCopy);
 	HRESULT CreateTexture(_In_ UINT width, _In_ UINT height, _Outptr_ ID3D11Texture2D **ppTexture, UINT miscFlag = 0, UINT bindFlag = 0);
 	HRESULT CreateTextureFromBuffer(_In_ BYTE *pFrameBuffer, _In_ LONG stride, _In_ UINT width, _In_ UINT height, _Outptr_ ID3D11Texture2D **ppTexture, UINT miscFlag = 0, UINT bindFlag = 0);
+	/// <summary>
+	/// Clears a region of a texture to transparent black. Render targets are cleared directly, other textures by copying from a cached blank texture, so clearing does not create textures.
+	/// </summary>
+	/// <param name="pTexture">The texture to clear</param>
+	/// <param name="rect">The region to clear, before the offset is applied</param>
+	/// <returns>S_OK if successful, S_FALSE if the region is outside the texture, error code on failure</returns>
 	HRESULT BlankTexture(_Inout_ ID3D11Texture2D *pTexture, _In_ RECT rect, _In_ INT OffsetX = 0, _In_  INT OffsetY = 0);
+	/// <summary>
+	/// Marks the end of a frame for the tracking of the textures created by this instance.
+	/// </summary>
+	/// <returns>The number of textures created during the frame</returns>
+	UINT64 EndFrame();
+	ALLOCATION_STATS GetAllocationStats();
+	/// <summary>
+	/// Pins a texture returned by this instance, so the texture cache neither evicts it nor returns it again to be overwritten while it is in use, e.g. by the encoder.
+	/// </summary>
+	/// <param name="pBlockPool">Optional pool to allocate the reference from, so pinning a texture for every frame does not allocate</param>
+	/// <returns>A reference to the texture that unpins it when released, or nullptr if the texture is not cached</returns>
+	std::shared_ptr<ID3D11Texture2D> PinTexture(_In_ ID3D11Texture2D *pTexture, _In_opt_ std::shared_ptr<BlockPool> pBlockPool = nullptr);
+	LRU_RESOURCE_CACHE_STATS GetTextureCacheStats();
+	/// <summary>
+	/// Gets a texture matching the description from the texture cache, creating it only if no unpinned texture matches.
+	/// The texture is owned by the cache and may hold the content of an earlier frame. It must be pinned if it is kept after the texture cache is next used.
+	/// </summary>
+	/// <param name="desc">The description of the texture</param>
+	/// <param name="ppTexture">The cached texture. No reference is added.</param>
+	/// <returns>S_OK if successful, E_OUTOFMEMORY if the texture could not be created</returns>
+	HRESULT GetOrCreateTexture(_In_ D3D11_TEXTURE2D_DESC desc, _Outptr_ ID3D11Texture2D **ppTexture);
 private:
+	HRESULT CreateTexture2D(_In_ ID3D11Device *pDevice, _In_ const D3D11_TEXTURE2D_DESC *pDesc, _In_opt_ const D3D11_SUBRESOURCE_DATA *pInitialData, _Outptr_ ID3D11Texture2D **ppTexture);
 	HRESULT InitializeDesc(_In_ UINT width, _In_ UINT height, _Out_ D3D11_TEXTURE2D_DESC *pTargetDesc);
-	HRESULT GetOrCreateTexture(_In_ D3D11_TEXTURE2D_DESC desc, _Outptr_ ID3D11Texture2D **ppTexture);
 	void ConfigureRotationVertices(_Inout_ VERTEX(&vertices)[6], _In_ RECT textureRect, _In_opt_ DXGI_MODE_ROTATION rotation = DXGI_MODE_ROTATION_UNSPECIFIED);
 	void CleanRefs();
 
@@ -46,43 +79,9 @@ private:
 	ID3D11VertexShader *m_VertexShader;
 	ID3D11PixelShader *m_PixelShader;
 	ID3D11InputLayout *m_InputLayout;
+	AllocationTracker m_AllocationTracker;
+	std::unique_ptr<BlankTextureCache> m_BlankTextures;
 
-
-	struct TextureDescHasher {
-		std::size_t operator()(const D3D11_TEXTURE2D_DESC &desc) const noexcept {
-			std::string temp =
-				to_string(desc.Format)
-				.append(to_string(desc.ArraySize))
-				.append(to_string(desc.BindFlags))
-				.append(to_string(desc.CPUAccessFlags))
-				.append(to_string(desc.Format))
-				.append(to_string(desc.Height))
-				.append(to_string(desc.MipLevels))
-				.append(to_string(desc.MiscFlags))
-				.append(to_string(desc.SampleDesc.Count))
-				.append(to_string(desc.SampleDesc.Quality))
-				.append(to_string(desc.Width))
-				.append(to_string(desc.Usage));
-			return hash<string>{}(temp);
-		};
-	};
-
-	struct TextureDescComparator {
-		bool operator()(const D3D11_TEXTURE2D_DESC &A,
-						const D3D11_TEXTURE2D_DESC &B) const noexcept {
-			return A.Format == B.Format
-				&& A.ArraySize == B.ArraySize
-				&& A.BindFlags == B.BindFlags
-				&& A.CPUAccessFlags == B.CPUAccessFlags
-				&& A.Format == B.Format
-				&& A.Height == B.Height
-				&& A.MipLevels == B.MipLevels
-				&& A.MiscFlags == B.MiscFlags
-				&& A.SampleDesc.Count == B.SampleDesc.Count
-				&& A.SampleDesc.Quality == B.SampleDesc.Quality
-				&& A.Usage == B.Usage
-				&& A.Width == B.Width;
-		};
-	};
-	std::unordered_map<D3D11_TEXTURE2D_DESC, ID3D11Texture2D *, TextureDescHasher, TextureDescComparator> m_TextureCache;
+	//Shared with the pins handed out by PinTexture, which may outlive a reinitialization.
+	std::shared_ptr<TextureCache> m_TextureCache;
 };
@@ -0,0 +1,135 @@
+#pragma once
+#include "ResourcePool.h"
+#include "LruResourceCache.h"
+#include "AllocationTracker.h"
+#include "Log.h"
+#include <d3d11.h>
+#include <atlbase.h>
+#include <mfapi.h>
+#include <mfidl.h>
+#include <Shlwapi.h>
+#include <functional>
+
+struct D3D11_TEXTURE2D_DESC_EQUAL {
+	bool operator()(const D3D11_TEXTURE2D_DESC &a, const D3D11_TEXTURE2D_DESC &b) const {
+		return memcmp(&a, &b, sizeof(D3D11_TEXTURE2D_DESC)) == 0;
+	}
+};
+
+struct D3D11_TEXTURE2D_DESC_HASH {
+	size_t operator()(const D3D11_TEXTURE2D_DESC &desc) const {
+		//FNV-1a over the fields, which are all 32 bit values without padding between them.
+		const BYTE *pBytes = reinterpret_cast<const BYTE *>(&desc);
+		uint64_t hash = 14695981039346656037ull;
+		for (size_t i = 0; i < sizeof(D3D11_TEXTURE2D_DESC); i++) {
+			hash = (hash ^ pBytes[i]) * 1099511628211ull;
+		}
+		return static_cast<size_t>(hash);
+	}
+};
+
+/// <summary>
+/// The approximate size in bytes of the memory backing a texture.
+/// </summary>
+inline uint64_t GetTextureByteSize(_In_ const D3D11_TEXTURE2D_DESC &desc)
+{
+	uint64_t pixels = static_cast<uint64_t>(desc.Width) * desc.Height * (std::max)(desc.ArraySize, 1u) * (std::max)(desc.SampleDesc.Count, 1u);
+	switch (desc.Format)
+	{
+	case DXGI_FORMAT_NV12:
+		return pixels * 3 / 2;
+	case DXGI_FORMAT_R16G16B16A16_FLOAT:
+	case DXGI_FORMAT_R16G16B16A16_UNORM:
+		return pixels * 8;
+	case DXGI_FORMAT_R32G32B32A32_FLOAT:
+		return pixels * 16;
+	default:
+		return pixels * 4;
+	}
+}
+
+/// <summary>
+/// Allocates textures from a D3D11 device. The pool or cache owns one reference to each texture.
+/// </summary>
+class D3D11TextureAllocator : public IResourceAllocator<D3D11_TEXTURE2D_DESC, ID3D11Texture2D *>
+{
+public:
+	D3D11TextureAllocator(_In_ ID3D11Device *pDevice, _In_opt_ AllocationTracker *pTracker = nullptr) :
+		m_Device(pDevice),
+		m_Tracker(pTracker)
+	{
+	}
+	bool Allocate(const D3D11_TEXTURE2D_DESC &description, ID3D11Texture2D **ppTexture) override {
+		*ppTexture = nullptr;
+		HRESULT hr = m_Device->CreateTexture2D(&description, nullptr, ppTexture);
+		if (FAILED(hr)) {
+			LOG_ERROR(L"Failed to create pooled texture: hr = 0x%08x", hr);
+			return false;
+		}
+		if (m_Tracker) {
+			m_Tracker->OnAllocation(GetTextureByteSize(description));
+		}
+		return true;
+	}
+	void Free(ID3D11Texture2D *pTexture) override {
+		pTexture->Release();
+	}
+private:
+	CComPtr<ID3D11Device> m_Device;
+	AllocationTracker *m_Tracker;
+};
+
+typedef ResourcePool<D3D11_TEXTURE2D_DESC, ID3D11Texture2D *, D3D11_TEXTURE2D_DESC_EQUAL> TexturePool;
+typedef LruResourceCache<D3D11_TEXTURE2D_DESC, ID3D11Texture2D *, D3D11_TEXTURE2D_DESC_HASH, D3D11_TEXTURE2D_DESC_EQUAL> TextureCache;
+
+/// <summary>
+/// Callback set as the allocator of an IMFTrackedSample. It is invoked when the last reference to the sample is released,
+/// which for samples passed to the sink writer is when the encoder is done with it.
+/// </summary>
+class CMFTrackedSampleCallback : public IMFAsyncCallback {
+
+public:
+	CMFTrackedSampleCallback(_In_ std::function<void()> onSampleReleased) :
+		m_nRefCount(1),
+		m_OnSampleReleased(onSampleReleased) {}
+	virtual ~CMFTrackedSampleCallback()
+	{
+	}
+	// IMFAsyncCallback methods
+	STDMETHODIMP GetParameters(DWORD *pdwFlags, DWORD *pdwQueue) {
+		return E_NOTIMPL;
+	}
+
+	STDMETHODIMP Invoke(IMFAsyncResult *pAsyncResult) {
+		if (m_OnSampleReleased) {
+			m_OnSampleReleased();
+			m_OnSampleReleased = nullptr;
+		}
+		return S_OK;
+	}
+
+	// IUnknown methods
+	STDMETHODIMP QueryInterface(REFIID riid, void **ppv) {
+		static const QITAB qit[] = {
+			QITABENT(CMFTrackedSampleCallback, IMFAsyncCallback),
+		{0}
+		};
+		return QISearch(this, qit, riid, ppv);
+	}
+
+	STDMETHODIMP_(ULONG) AddRef() {
+		return InterlockedIncrement(&m_nRefCount);
+	}
+
+	STDMETHODIMP_(ULONG) Release() {
+		ULONG refCount = InterlockedDecrement(&m_nRefCount);
+		if (refCount == 0) {
+			delete this;
+		}
+		return refCount;
+	}
+
+private:
+	volatile long m_nRefCount;
+	std::function<void()> m_OnSampleReleased;
+};
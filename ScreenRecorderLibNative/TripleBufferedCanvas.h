@@ -0,0 +1,203 @@
+#pragma once
+#include "DirtyRegion.h"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+#define CANVAS_BUFFER_COUNT 3
+
+/// <summary>
+/// Access to the buffers of a TripleBufferedCanvas from one device, e.g. the shared textures opened on the D3D device of a capture thread.
+/// </summary>
+class ICanvasBufferView
+{
+public:
+	virtual ~ICanvasBufferView() {}
+	/// <summary>
+	/// Gets exclusive access to a buffer, waiting for other devices to be done with it.
+	/// </summary>
+	/// <returns>false if the buffer could not be locked</returns>
+	virtual bool LockBuffer(size_t index) = 0;
+	virtual void UnlockBuffer(size_t index) = 0;
+	/// <summary>
+	/// Copies the rects of a region from one buffer to another. Both buffers are locked.
+	/// </summary>
+	virtual void CopyBufferRegion(size_t destination, size_t source, const DirtyRegion &region) = 0;
+};
+
+struct CANVAS_STATS {
+	//Frames published by the writers.
+	uint64_t Published = 0;
+	//Frames taken by the reader.
+	uint64_t Acquired = 0;
+	//Published frames replaced by a newer frame before the reader took them.
+	uint64_t Skipped = 0;
+	//Copies made to bring a write buffer up to date with the latest frame, and the summed area of the copied rects.
+	uint64_t CatchUpCopies = 0;
+	uint64_t CatchUpArea = 0;
+};
+
+/// <summary>
+/// A canvas of three buffers, so the writers can compose the next frame while the reader copies out the latest finished one, and neither waits for the other.
+/// One buffer is written to, one holds the latest published frame, and one is read. Publishing a frame swaps the write and the ready buffer,
+/// and the reader swaps the ready buffer for its read buffer when it wants the latest frame, so frames the reader does not get to in time are skipped.
+/// The writers update the frame incrementally, so a buffer that becomes the write buffer is first brought up to date by copying the area changed since it was last current
+/// from the latest published frame. Each writer only locks the write buffer and, for these copies, the latest published one, so writers never wait for the reader
+/// to take a frame, and the reader only waits for a writer while it copies from the buffer being read.
+/// Writers are serialized with each other. There must be only one reader.
+/// </summary>
+class TripleBufferedCanvas
+{
+public:
+	TripleBufferedCanvas() :
+		m_ReadyState(1),
+		m_WriteIndex(0),
+		m_ReadIndex(2),
+		m_LatestIndex(1),
+		m_Stats{}
+	{
+	}
+	TripleBufferedCanvas(const TripleBufferedCanvas &) = delete;
+	TripleBufferedCanvas &operator=(const TripleBufferedCanvas &) = delete;
+
+	/// <summary>
+	/// Locks the write buffer, after bringing it up to date with the latest published frame. Other writers block until EndWrite is called.
+	/// </summary>
+	/// <param name="pView">The buffers as seen from the device of the writer</param>
+	/// <param name="pIndex">Receives the index of the buffer to write to</param>
+	/// <returns>false if the buffers could not be locked, in which case EndWrite must not be called</returns>
+	bool BeginWrite(ICanvasBufferView *pView, size_t *pIndex)
+	{
+		m_WriterMutex.lock();
+		size_t index = m_WriteIndex;
+		DirtyRegion &staleRegion = m_StaleRegions[index];
+		if (staleRegion.IsEmpty()) {
+			if (!pView->LockBuffer(index)) {
+				m_WriterMutex.unlock();
+				return false;
+			}
+		}
+		else {
+			//The latest published buffer cannot change while the writer lock is held, so it is safe to copy from even if the reader has taken it.
+			//The two buffers are locked in index order, so the order is the same no matter which of them is written to.
+			size_t source = m_LatestIndex;
+			size_t first = (std::min)(index, source);
+			size_t second = (std::max)(index, source);
+			if (!pView->LockBuffer(first)) {
+				m_WriterMutex.unlock();
+				return false;
+			}
+			if (!pView->LockBuffer(second)) {
+				pView->UnlockBuffer(first);
+				m_WriterMutex.unlock();
+				return false;
+			}
+			pView->CopyBufferRegion(index, source, staleRegion);
+			pView->UnlockBuffer(source);
+			m_Stats.CatchUpCopies++;
+			m_Stats.CatchUpArea += staleRegion.GetArea();
+			staleRegion.Clear();
+		}
+		*pIndex = index;
+		return true;
+	}
+
+	/// <summary>
+	/// Unlocks the write buffer, and publishes it as the latest frame if anything was written to it.
+	/// </summary>
+	/// <param name="pView">The view passed to BeginWrite</param>
+	/// <param name="writtenRegion">The area written since BeginWrite. If empty, nothing is published and the buffer is written to again by the next writer.</param>
+	void EndWrite(ICanvasBufferView *pView, const DirtyRegion &writtenRegion)
+	{
+		size_t index = m_WriteIndex;
+		pView->UnlockBuffer(index);
+		if (!writtenRegion.IsEmpty()) {
+			//The other buffers now lag behind the written one in the written area.
+			for (size_t i = 0; i < CANVAS_BUFFER_COUNT; i++) {
+				if (i != index) {
+					m_StaleRegions[i].Add(writtenRegion);
+				}
+			}
+			uint32_t previousState;
+			{
+				//The region the reader must copy is swapped together with the buffer, so the reader never takes a buffer without the changes in it.
+				std::lock_guard<std::mutex> lock(m_PublishMutex);
+				m_ReaderRegion.Add(writtenRegion);
+				previousState = m_ReadyState.exchange(static_cast<uint32_t>(index) | STATE_FRESH, std::memory_order_acq_rel);
+				m_Stats.Published++;
+				if (previousState & STATE_FRESH) {
+					m_Stats.Skipped++;
+				}
+			}
+			m_LatestIndex = index;
+			m_WriteIndex = previousState & STATE_INDEX_MASK;
+		}
+		m_WriterMutex.unlock();
+	}
+
+	/// <summary>
+	/// Checks if a frame has been published since the reader last took one. Does not block.
+	/// </summary>
+	inline bool IsNewFrameAvailable() const
+	{
+		return (m_ReadyState.load(std::memory_order_acquire) & STATE_FRESH) != 0;
+	}
+
+	/// <summary>
+	/// Takes the latest published frame as the read buffer, if there is a new one. Called by the reader only.
+	/// </summary>
+	/// <param name="pUpdatedRegion">Receives the area changed since the previous read buffer, added to what it already holds</param>
+	/// <returns>true if the read buffer changed</returns>
+	bool AcquireLatest(DirtyRegion *pUpdatedRegion)
+	{
+		if (!IsNewFrameAvailable()) {
+			return false;
+		}
+		std::lock_guard<std::mutex> lock(m_PublishMutex);
+		uint32_t previousState = m_ReadyState.exchange(static_cast<uint32_t>(m_ReadIndex), std::memory_order_acq_rel);
+		m_ReadIndex = previousState & STATE_INDEX_MASK;
+		if (pUpdatedRegion) {
+			pUpdatedRegion->Add(m_ReaderRegion);
+		}
+		m_ReaderRegion.Clear();
+		m_Stats.Acquired++;
+		return true;
+	}
+
+	/// <summary>
+	/// The buffer the reader took last. Only the reader may access it.
+	/// </summary>
+	inline size_t GetReadIndex() const { return m_ReadIndex; }
+
+	CANVAS_STATS GetStats()
+	{
+		std::lock_guard<std::mutex> writerLock(m_WriterMutex);
+		std::lock_guard<std::mutex> publishLock(m_PublishMutex);
+		return m_Stats;
+	}
+
+private:
+	static const uint32_t STATE_INDEX_MASK = 0x3;
+	//Set in the ready state when the ready buffer holds a frame the reader has not taken yet.
+	static const uint32_t STATE_FRESH = 0x4;
+
+	//Serializes the writers. Held from BeginWrite to EndWrite.
+	std::mutex m_WriterMutex;
+	//Guards the index swaps and the reader region.
+	std::mutex m_PublishMutex;
+	//The index of the ready buffer, and STATE_FRESH.
+	std::atomic<uint32_t> m_ReadyState;
+	//Owned by the writers.
+	size_t m_WriteIndex;
+	//Owned by the reader.
+	size_t m_ReadIndex;
+	//The most recently published buffer. Owned by the writers.
+	size_t m_LatestIndex;
+	//The area each buffer lags behind the latest published frame. Owned by the writers.
+	DirtyRegion m_StaleRegions[CANVAS_BUFFER_COUNT];
+	//The area changed since the reader last took a frame.
+	DirtyRegion m_ReaderRegion;
+	CANVAS_STATS m_Stats;
+};
@@ -0,0 +1,73 @@
+#pragma once
+#include <utility>
+
+/// <summary>
+/// Orders the video samples of an output for writing. At a variable framerate the last sample is held back until the next one, so unchanged frames
+/// extend its duration instead of being encoded again. At a fixed framerate every sample is written right away, and the last one written is kept,
+/// so an unchanged frame, like one shed by an output falling behind, writes it again for its interval instead of leaving a gap in the output.
+/// TSample is a smart pointer to a sample, e.g. CComPtr&lt;IMFSample&gt;.
+/// </summary>
+template <typename TSample>
+class VideoSampleQueue
+{
+public:
+	void SetFixedFramerate(bool isFixedFramerate)
+	{
+		m_IsFixedFramerate = isFixedFramerate;
+	}
+
+	/// <summary>
+	/// Takes the sample of a changed frame.
+	/// </summary>
+	/// <returns>The sample to write now: the given sample at a fixed framerate, else the sample held back before it, which is empty for the first sample</returns>
+	TSample Push(TSample sample)
+	{
+		if (m_IsFixedFramerate) {
+			m_LastWritten = sample;
+			return sample;
+		}
+		TSample previous = Flush();
+		m_Pending = std::move(sample);
+		return previous;
+	}
+
+	/// <summary>
+	/// The sample held back, which unchanged frames extend. Empty at a fixed framerate.
+	/// </summary>
+	const TSample &GetPending() const
+	{
+		return m_Pending;
+	}
+
+	/// <summary>
+	/// The last sample written at a fixed framerate, which unchanged frames write again. Empty at a variable framerate.
+	/// </summary>
+	const TSample &GetLastWritten() const
+	{
+		return m_LastWritten;
+	}
+
+	/// <summary>
+	/// Takes the sample held back, to write it before the output ends.
+	/// </summary>
+	TSample Flush()
+	{
+		TSample pending = std::move(m_Pending);
+		m_Pending = TSample{};
+		return pending;
+	}
+
+	/// <summary>
+	/// Discards the samples kept, e.g. when the samples queued in the sink writer are discarded.
+	/// </summary>
+	void Clear()
+	{
+		m_Pending = TSample{};
+		m_LastWritten = TSample{};
+	}
+
+private:
+	bool m_IsFixedFramerate = false;
+	TSample m_Pending{};
+	TSample m_LastWritten{};
+};
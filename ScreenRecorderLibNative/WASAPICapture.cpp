@@ -7,6 +7,7 @@
 #include "DynamicWait.h"
 #include "WASAPINotify.h"
 #include "Exception.h"
+#include "RecordingTimeline.h"
 
 using namespace std;
 
@@ -22,6 +23,7 @@ WASAPICapture::WASAPICapture(_In_ std::shared_ptr<AUDIO_OPTIONS> &audioOptions,
 	m_DeviceName(L""),
 	m_DefaultDeviceId(L""),
 	m_Resampler(nullptr),
+	m_PolyphaseResampler(nullptr),
 	m_pEnumerator(nullptr),
 	m_Flow(eRender),
 	m_IsDefaultDevice(false)
@@ -92,9 +94,11 @@ HRESULT WASAPICapture::Initialize(_In_ std::wstring deviceId, _In_ EDataFlow flo
 	hr = InitializeAudioClient(pDevice, &m_AudioClient);
 	if (SUCCEEDED(hr)) {
 		WWMFResampler *pResampler;
-		hr = InitializeResampler(m_AudioOptions->GetAudioSamplesPerSecond(), m_AudioOptions->GetAudioChannels(), m_AudioClient, &m_InputFormat, &m_OutputFormat, &pResampler);
+		PolyphaseResampler *pPolyphaseResampler;
+		hr = InitializeResampler(m_AudioOptions->GetAudioSamplesPerSecond(), m_AudioOptions->GetAudioChannels(), m_AudioClient, &m_InputFormat, &m_OutputFormat, &pResampler, &pPolyphaseResampler);
 		if (SUCCEEDED(hr)) {
 			m_Resampler.reset(pResampler);
+			m_PolyphaseResampler.reset(pPolyphaseResampler);
 		}
 	}
 	return hr;
@@ -153,9 +157,11 @@ HRESULT WASAPICapture::InitializeResampler(
 	_In_ IAudioClient *pAudioClient,
 	_Out_ WWMFPcmFormat *audioInputFormat,
 	_Out_ WWMFPcmFormat *audioOutputFormat,
-	_Outptr_result_maybenull_ WWMFResampler **ppResampler)
+	_Outptr_result_maybenull_ WWMFResampler **ppResampler,
+	_Outptr_result_maybenull_ PolyphaseResampler **ppPolyphaseResampler)
 {
 	*ppResampler = nullptr;
+	*ppPolyphaseResampler = nullptr;
 	WWMFPcmFormat inputFormat = {};
 	WWMFPcmFormat outputFormat = {};
 	UINT32 outputSampleRate;
@@ -205,8 +211,21 @@ HRESULT WASAPICapture::InitializeResampler(
 		LOG_DEBUG("Resampler (sampleFormat): %i -> %i", inputFormat.sampleFormat, outputFormat.sampleFormat);
 		LOG_DEBUG("Resampler (sampleRate): %lu -> %lu", inputFormat.sampleRate, outputFormat.sampleRate);
 		LOG_DEBUG("Resampler (validBitsPerSample): %u -> %u", inputFormat.validBitsPerSample, outputFormat.validBitsPerSample);
-		*ppResampler = new WWMFResampler();
-		(*ppResampler)->Initialize(inputFormat, outputFormat, 60);
+		if (m_AudioOptions->GetResamplerType() == AudioResamplerType::Polyphase) {
+			LOG_DEBUG("Using polyphase resampler");
+			AUDIO_SAMPLE_FORMAT polyphaseInputFormat{ inputFormat.sampleRate, inputFormat.nChannels, AudioSampleType::Int16 };
+			AUDIO_SAMPLE_FORMAT polyphaseOutputFormat{ outputFormat.sampleRate, outputFormat.nChannels, AudioSampleType::Int16 };
+			std::unique_ptr<PolyphaseResampler> pResampler = make_unique<PolyphaseResampler>();
+			if (!pResampler->Initialize(polyphaseInputFormat, polyphaseOutputFormat)) {
+				LOG_ERROR(L"Failed to initialize polyphase resampler for %ls", m_Tag.c_str());
+				return E_INVALIDARG;
+			}
+			*ppPolyphaseResampler = pResampler.release();
+		}
+		else {
+			*ppResampler = new WWMFResampler();
+			(*ppResampler)->Initialize(inputFormat, outputFormat, 60);
+		}
 		return S_OK;
 	}
 	else
@@ -278,11 +297,12 @@ HRESULT WASAPICapture::StartCaptureLoop(
 	CoTaskMemFreeOnExit freeMixFormat(pwfx);
 	UINT32 nBlockAlign = pwfx->nChannels * pwfx->wBitsPerSample / 8;
 	UINT32 nFrames = 0;
+	if (nBlockAlign != m_InputFormat.FrameBytes() || pwfx->nSamplesPerSec != m_InputFormat.sampleRate) {
+		//The format changed since the device was initialized, so the ring buffer and the resampler do not fit it. Reconnecting initializes them for the new format.
+		LOG_WARN(L"Audio format of %ls changed to %u Hz with %u byte frames, reconnecting", m_Tag.c_str(), pwfx->nSamplesPerSec, nBlockAlign);
+		return AUDCLNT_E_DEVICE_INVALIDATED;
+	}
 
-	int bufferFrameCount = int(ceil(pwfx->nSamplesPerSec * HundredNanosToSeconds(AUDIO_CLIENT_BUFFER_100_NS)));
-	int bufferByteCount = bufferFrameCount * nBlockAlign;
-	BYTE *bufferData = new BYTE[bufferByteCount]{ 0 };
-	DeleteArrayOnExit deleteBufferData(bufferData);
 	{
 		// activate an IAudioCaptureClient
 		CComPtr<IAudioCaptureClient> pAudioCaptureClient = nullptr;
@@ -345,6 +365,12 @@ HRESULT WASAPICapture::StartCaptureLoop(
 		bool bDone = false;
 		bool bFirstPacket = true;
 		UINT64 nLastDevicePosition = 0;
+		UINT32 nLastNumFramesRead = 0;
+		UINT64 nDroppedBytes = 0;
+		UINT32 nDroppedPackets = 0;
+		//Packets are dropped in runs while the consumer is stalled, so each run is logged once when it starts and once when it ends.
+		UINT64 nRunDroppedBytes = 0;
+		UINT32 nRunDroppedPackets = 0;
 		for (UINT32 nPasses = 0; !bDone; nPasses++) {
 			// drain data while it is available
 			UINT32 nNextPacketSize;
@@ -372,6 +398,7 @@ HRESULT WASAPICapture::StartCaptureLoop(
 					continue; // exits loop
 				}
 				bool isDiscontinuity = false;
+				bool isSilent = false;
 				if ((dwFlags & (AUDCLNT_BUFFERFLAGS_DATA_DISCONTINUITY)) != 0) {
 					if (bFirstPacket) {
 						LOG_DEBUG(L"Probably spurious glitch reported on first packet on %ls", m_Tag.c_str());
@@ -384,7 +411,7 @@ HRESULT WASAPICapture::StartCaptureLoop(
 				else if ((dwFlags & AUDCLNT_BUFFERFLAGS_SILENT) != 0) {
 					//Captured data should be replaced with silence as according to https://docs.microsoft.com/en-us/windows/win32/coreaudio/capturing-a-stream
 					LOG_DEBUG(L"IAudioCaptureClient::GetBuffer set flags to 0x%08x on pass %u after %u frames on %ls", dwFlags, nPasses, nFrames, m_Tag.c_str());
-					memset(pData, 0, sizeof(pData));
+					isSilent = true;
 				}
 				else if (0 != dwFlags) {
 					LOG_DEBUG(L"IAudioCaptureClient::GetBuffer set flags to 0x%08x on pass %u after %u frames on %ls", dwFlags, nPasses, nFrames, m_Tag.c_str());
@@ -398,7 +425,21 @@ HRESULT WASAPICapture::StartCaptureLoop(
 				}
 
 				UINT32 size = nNumFramesToRead * nBlockAlign;
-				memcpy_s(bufferData, bufferByteCount, pData, size);
+				//This should reduce glitching if there is discontinuity in the audio stream.
+				//The gap is padded with silence before the packet, so the samples stay in sync with the device position.
+				if (isDiscontinuity && nDevicePosition > nLastDevicePosition + nLastNumFramesRead) {
+					UINT64 missingFrames = nDevicePosition - nLastDevicePosition - nLastNumFramesRead;
+					//Only whole frames are written to the buffer, so it never holds a partial sample.
+					UINT64 maxSilenceFrames = (m_RecordedBytes.AvailableToWrite() / nBlockAlign);
+					size_t silenceByteCount = (size_t)(min(missingFrames, maxSilenceFrames) * nBlockAlign);
+					m_RecordedBytes.WriteSilence(silenceByteCount);
+					LOG_DEBUG(L"Discontinuity detected, padded audio bytes with %llu bytes of silence on %ls", (UINT64)silenceByteCount, m_Tag.c_str());
+				}
+				size_t written = 0;
+				if (m_RecordedBytes.AvailableToWrite() >= size) {
+#pragma prefast(suppress: __WARNING_INCORRECT_ANNOTATION, "IAudioCaptureClient::GetBuffer SAL annotation implies a 1-byte buffer")
+					written = isSilent ? m_RecordedBytes.WriteSilence(size) : m_RecordedBytes.Write(pData, size);
+				}
 
 				hr = pAudioCaptureClient->ReleaseBuffer(nNumFramesToRead);
 				if (FAILED(hr)) {
@@ -406,23 +447,25 @@ HRESULT WASAPICapture::StartCaptureLoop(
 					bDone = true;
 					continue; // exits loop
 				}
-#pragma warning(disable: 26110)
-				const std::lock_guard<std::mutex> lock(m_TaskWrapperImpl->m_Mutex);
-#pragma prefast(suppress: __WARNING_INCORRECT_ANNOTATION, "IAudioCaptureClient::GetBuffer SAL annotation implies a 1-byte buffer")
-				if (m_RecordedBytes.size() == 0)
-					m_RecordedBytes.reserve(size);
-				m_RecordedBytes.insert(m_RecordedBytes.end(), &bufferData[0], &bufferData[size]);
-				//This should reduce glitching if there is discontinuity in the audio stream.
-				if (isDiscontinuity) {
-					UINT64 frameDiff = nDevicePosition - nLastDevicePosition;
-					if (frameDiff != nNumFramesToRead) {
-						m_RecordedBytes.insert(m_RecordedBytes.begin(), (size_t)(frameDiff * nBlockAlign), 0);
-						LOG_DEBUG(L"Discontinuity detected, padded audio bytes with %d bytes of silence on %ls", frameDiff, m_Tag.c_str());
+				if (written < size) {
+					//The consumer has fallen too far behind. Drop the whole packet rather than blocking the audio thread.
+					if (nRunDroppedPackets == 0) {
+						LOG_WARN(L"Audio buffer full on %ls, dropping packets until the consumer catches up", m_Tag.c_str());
 					}
+					nDroppedBytes += size;
+					nDroppedPackets++;
+					nRunDroppedBytes += size;
+					nRunDroppedPackets++;
+				}
+				else if (nRunDroppedPackets > 0) {
+					LOG_WARN(L"Audio consumer caught up on %ls after %u dropped packets and %llu dropped bytes", m_Tag.c_str(), nRunDroppedPackets, nRunDroppedBytes);
+					nRunDroppedBytes = 0;
+					nRunDroppedPackets = 0;
 				}
 				nFrames += nNumFramesToRead;
 				bFirstPacket = false;
 				nLastDevicePosition = nDevicePosition;
+				nLastNumFramesRead = nNumFramesToRead;
 			}
 
 			if (FAILED(hr)) {
@@ -452,48 +495,99 @@ HRESULT WASAPICapture::StartCaptureLoop(
 				bDone = true;
 			}
 		} // capture loop
+		if (nDroppedPackets > 0) {
+			LOG_WARN(L"Dropped %u audio packets and %llu bytes in total on %ls", nDroppedPackets, nDroppedBytes, m_Tag.c_str());
+		}
 	}
-#pragma warning(disable: 26117)
 	return hr;
 }
 std::vector<BYTE> WASAPICapture::PeakRecordedBytes()
 {
-	return m_RecordedBytes;
+	const std::lock_guard<std::mutex> lock(m_TaskWrapperImpl->m_Mutex);
+	RING_BUFFER_SPANS spans;
+	m_RecordedBytes.Peek(&spans);
+	std::vector<BYTE> bytes;
+	bytes.reserve(spans.TotalLength());
+	bytes.insert(bytes.end(), spans.First, spans.First + spans.FirstLength);
+	bytes.insert(bytes.end(), spans.Second, spans.Second + spans.SecondLength);
+	return bytes;
 }
 
-std::vector<BYTE> WASAPICapture::GetRecordedBytes(UINT64 duration100Nanos)
+void WASAPICapture::GetRecordedBytes(_In_ UINT64 duration100Nanos, _Inout_ std::vector<BYTE> *pRecordedBytes)
 {
-	int frameCount = int(ceil(m_InputFormat.sampleRate * HundredNanosToSeconds(duration100Nanos)));
-	std::vector<BYTE> newvector;
+	size_t frameCount = (size_t)GetAudioFrameCount(duration100Nanos, m_InputFormat.sampleRate);
+	std::vector<BYTE> &newvector = *pRecordedBytes;
+	newvector.clear();
 	size_t byteCount;
 	{
 		const std::lock_guard<std::mutex> lock(m_TaskWrapperImpl->m_Mutex);
-		byteCount = min((frameCount * m_InputFormat.FrameBytes()), m_RecordedBytes.size());
-		newvector = std::vector<BYTE>(m_RecordedBytes.begin(), m_RecordedBytes.begin() + byteCount);
-		m_RecordedBytes.erase(m_RecordedBytes.begin(), m_RecordedBytes.begin() + byteCount);
-		LOG_TRACE(L"Got %d bytes from WASAPICapture %ls. %d bytes remaining", newvector.size(), m_Tag.c_str(), m_RecordedBytes.size());
+		//The capture thread only appends to the ring buffer, so the lock here just serializes consumers and the resampler against StartCapture.
+		RING_BUFFER_SPANS spans;
+		byteCount = m_RecordedBytes.Peek(&spans, frameCount * m_InputFormat.FrameBytes());
+		//Sized for the converted output, so the vector only grows the first time, and not every time the resampler output is larger than its input.
+		newvector.reserve(m_OverflowBytes.size() + GetMaxConvertedBytes(byteCount));
+		newvector.insert(newvector.end(), m_OverflowBytes.begin(), m_OverflowBytes.end());
+		m_OverflowBytes.clear();
+		size_t overflowCount = newvector.size();
 
 		// convert audio
 		if (m_Resampler && byteCount > 0) {
+			//The resampler needs contiguous input, so only copy when the readable bytes wrap around the end of the ring buffer.
+			const BYTE *pInput = spans.First;
+			if (spans.SecondLength > 0) {
+				m_ResamplerInputBytes.clear();
+				m_ResamplerInputBytes.insert(m_ResamplerInputBytes.end(), spans.First, spans.First + spans.FirstLength);
+				m_ResamplerInputBytes.insert(m_ResamplerInputBytes.end(), spans.Second, spans.Second + spans.SecondLength);
+				pInput = m_ResamplerInputBytes.data();
+			}
 			WWMFSampleData sampleData;
-			HRESULT hr = m_Resampler->Resample(newvector.data(), (DWORD)newvector.size(), &sampleData);
+			HRESULT hr = m_Resampler->Resample(pInput, (DWORD)byteCount, &sampleData);
+			m_RecordedBytes.Consume(byteCount);
 			if (SUCCEEDED(hr)) {
 				LOG_TRACE(L"Resampled audio from %dch %uhz to %dch %uhz", m_InputFormat.nChannels, m_InputFormat.sampleRate, m_OutputFormat.nChannels, m_OutputFormat.sampleRate);
+				newvector.insert(newvector.end(), &sampleData.data[0], &sampleData.data[sampleData.bytes]);
 			}
 			else {
 				LOG_ERROR(L"Resampling of audio failed: hr = 0x%08x", hr);
 			}
-			newvector.clear();
-			newvector.insert(newvector.end(), &sampleData.data[0], &sampleData.data[sampleData.bytes]);
 			sampleData.Release();
 		}
+		else if (m_PolyphaseResampler && byteCount > 0) {
+			//The polyphase resampler keeps its own history, so the two spans of the ring buffer are fed in turn, converted straight into the output vector.
+			size_t outputOffset = newvector.size();
+			newvector.resize(outputOffset + m_PolyphaseResampler->GetMaxOutputBytes(byteCount));
+			size_t outputBytes = m_PolyphaseResampler->Process(spans.First, spans.FirstLength, newvector.data() + outputOffset, newvector.size() - outputOffset);
+			outputBytes += m_PolyphaseResampler->Process(spans.Second, spans.SecondLength, newvector.data() + outputOffset + outputBytes, newvector.size() - outputOffset - outputBytes);
+			newvector.resize(outputOffset + outputBytes);
+			m_RecordedBytes.Consume(byteCount);
+			LOG_TRACE(L"Resampled audio from %dch %uhz to %dch %uhz", m_InputFormat.nChannels, m_InputFormat.sampleRate, m_OutputFormat.nChannels, m_OutputFormat.sampleRate);
+		}
+		else {
+			newvector.insert(newvector.end(), spans.First, spans.First + spans.FirstLength);
+			newvector.insert(newvector.end(), spans.Second, spans.Second + spans.SecondLength);
+			m_RecordedBytes.Consume(byteCount);
+		}
+		LOG_TRACE(L"Got %d bytes from WASAPICapture %ls. %d bytes remaining", newvector.size() - overflowCount, m_Tag.c_str(), m_RecordedBytes.Size());
 	}
-	if (m_OverflowBytes.size() > 0) {
-		newvector.insert(newvector.begin(), m_OverflowBytes.begin(), m_OverflowBytes.end());
-		m_OverflowBytes.clear();
+}
+
+size_t WASAPICapture::GetMaxConvertedBytes(_In_ size_t inputBytes)
+{
+	if (m_PolyphaseResampler) {
+		return m_PolyphaseResampler->GetMaxOutputBytes(inputBytes);
+	}
+	if (m_Resampler) {
+		//The Media Foundation resampler may also release audio it held back in an earlier call, so allow for an extra 10 ms of output.
+		UINT64 inputFrames = inputBytes / m_InputFormat.FrameBytes() + 1;
+		UINT64 outputFrames = (inputFrames * m_OutputFormat.sampleRate + m_InputFormat.sampleRate - 1) / m_InputFormat.sampleRate + m_OutputFormat.sampleRate / 100;
+		return (size_t)outputFrames * m_OutputFormat.FrameBytes();
 	}
+	return inputBytes;
+}
 
-	return newvector;
+size_t WASAPICapture::GetRecordedBytesCapacity(_In_ const WWMFPcmFormat &format)
+{
+	return (size_t)(format.sampleRate * HundredNanosToSeconds(RECORDED_BYTES_BUFFER_100_NS)) * format.FrameBytes();
 }
 
 HRESULT WASAPICapture::StartCapture()
@@ -506,6 +600,7 @@ HRESULT WASAPICapture::StartCapture()
 	if (m_IsOffline.load()) {
 		return E_ABORT;
 	}
+	bool isInitialized = false;
 	if (!m_AudioClient) {
 		HRESULT hr = Initialize(m_DeviceId, m_Flow);
 		if (FAILED(hr)) {
@@ -514,12 +609,18 @@ HRESULT WASAPICapture::StartCapture()
 			}
 			return hr;
 		}
-		m_RecordedBytes.clear();
+		isInitialized = true;
 	}
 	if (m_TaskWrapperImpl->m_CaptureThread.joinable()) {
 		SetEvent(m_CaptureStopEvent);
 		m_TaskWrapperImpl->m_CaptureThread.join();
 	}
+	//The ring buffer can only be resized while the capture thread is stopped, and the consumer is blocked by the lock.
+	//The format is read again whenever the device is initialized, also outside of this method, so the ring buffer is resized to hold the same duration in the current format.
+	size_t recordedBytesCapacity = GetRecordedBytesCapacity(m_InputFormat);
+	if (isInitialized || m_RecordedBytes.Capacity() != recordedBytesCapacity) {
+		m_RecordedBytes.Reset(recordedBytesCapacity);
+	}
 
 	ResetEvent(m_CaptureRestartEvent);
 	ResetEvent(m_CaptureStopEvent);
@@ -648,9 +749,9 @@ bool WASAPICapture::StopListeners() {
 	return true;
 }
 
-void WASAPICapture::ReturnAudioBytesToBuffer(std::vector<BYTE> bytes)
+void WASAPICapture::ReturnAudioBytesToBuffer(_In_reads_bytes_(count) const BYTE *pBytes, _In_ size_t count)
 {
-	m_OverflowBytes.swap(bytes);
+	m_OverflowBytes.assign(pBytes, pBytes + count);
 	LOG_TRACE(L"Returned %d bytes to buffer in WASAPICapture %ls", m_OverflowBytes.size(), m_Tag.c_str());
 }
 
@@ -690,7 +791,7 @@ bool WASAPICapture::IsCapturing() {
 void WASAPICapture::ClearRecordedBytes()
 {
 	const std::lock_guard<std::mutex> lock(m_TaskWrapperImpl->m_Mutex);
-	m_RecordedBytes.clear();
+	m_RecordedBytes.Clear();
 }
 
 HRESULT WASAPICapture::ReconnectThreadLoop() {
@@ -1,9 +1,11 @@
 //https://github.com/mvaneerde/blog/tree/master/loopback-capture
 #pragma once
 #include "WWMFResampler.h"
+#include "PolyphaseResampler.h"
 #include "Log.h"
 #include "CommonTypes.h"
 #include "DynamicWait.h"
+#include "SpscRingBuffer.h"
 #include <windows.h>
 #include <avrt.h>
 #include <mmdeviceapi.h>
@@ -26,11 +28,17 @@ public:
 	void ClearRecordedBytes();
 	bool IsCapturing();
 	std::vector<BYTE> PeakRecordedBytes();
-	std::vector<BYTE> GetRecordedBytes(UINT64 duration100Nanos);
+	/// <summary>
+	/// Gets the audio captured for the given duration, converted to the output format. The bytes replace the contents of the caller's vector, so a vector reused across calls is not reallocated.
+	/// </summary>
+	void GetRecordedBytes(_In_ UINT64 duration100Nanos, _Inout_ std::vector<BYTE> *pRecordedBytes);
 	HRESULT Initialize(_In_ std::wstring deviceId, _In_ EDataFlow flow);
 	HRESULT StartCapture();
 	HRESULT StopCapture();
-	void ReturnAudioBytesToBuffer(std::vector<BYTE> bytes);
+	/// <summary>
+	/// Puts bytes fetched with GetRecordedBytes back, so they are returned first by the next call.
+	/// </summary>
+	void ReturnAudioBytesToBuffer(_In_reads_bytes_(count) const BYTE *pBytes, _In_ size_t count);
 	void SetDefaultDevice(EDataFlow flow, ERole role, LPCWSTR id);
 	void SetOffline(bool isOffline);
 	inline EDataFlow GetFlow() { return m_Flow; }
@@ -40,6 +48,8 @@ public:
 
 private:
 	const long AUDIO_CLIENT_BUFFER_100_NS = 200 * 10000;
+	//Size of the buffer holding captured audio until it is fetched by GetRecordedBytes. Packets are dropped if the consumer falls further behind than this.
+	const long RECORDED_BYTES_BUFFER_100_NS = 5000 * 10000;
 	HRESULT GetWaveFormat(
 		_In_ IAudioClient *pAudioClient,
 		_In_ bool bInt16,
@@ -54,7 +64,8 @@ private:
 		_In_ IAudioClient *pAudioClient,
 		_Out_ WWMFPcmFormat *pInputFormat,
 		_Out_ WWMFPcmFormat *pOutputFormat,
-		_Outptr_result_maybenull_ WWMFResampler **ppResampler);
+		_Outptr_result_maybenull_ WWMFResampler **ppResampler,
+		_Outptr_result_maybenull_ PolyphaseResampler **ppPolyphaseResampler);
 
 	HRESULT StartCaptureLoop(
 		_In_ IAudioClient *pAudioClient,
@@ -63,6 +74,15 @@ private:
 		_In_ HANDLE hRestartEvent
 	);
 
+	/// <summary>
+	/// The largest number of bytes the given number of captured bytes can convert to in the output format.
+	/// </summary>
+	size_t GetMaxConvertedBytes(_In_ size_t inputBytes);
+	/// <summary>
+	/// The size of the ring buffer holding RECORDED_BYTES_BUFFER_100_NS of audio captured in the given format.
+	/// </summary>
+	size_t GetRecordedBytesCapacity(_In_ const WWMFPcmFormat &format);
+
 	bool StartListeners();
 	bool StopListeners();
 
@@ -82,7 +102,10 @@ private:
 	std::atomic<bool> m_IsCapturing = false;
 	std::atomic<bool> m_IsOffline = false;
 	std::vector<BYTE> m_OverflowBytes = {};
-	std::vector<BYTE> m_RecordedBytes = {};
+	//Joins the two spans of the ring buffer when they wrap around, as the Media Foundation resampler needs contiguous input.
+	std::vector<BYTE> m_ResamplerInputBytes = {};
+	//Written lock-free by the capture thread, read by GetRecordedBytes.
+	SpscRingBuffer m_RecordedBytes;
 	HANDLE m_CaptureStartedEvent = nullptr;
 	HANDLE m_CaptureStopEvent = nullptr;
 	HANDLE m_CaptureRestartEvent = nullptr;
@@ -94,6 +117,7 @@ private:
 	CComPtr<IMMDeviceEnumerator> m_pEnumerator;
 	CComPtr<IAudioClient> m_AudioClient;
 	std::unique_ptr<WWMFResampler> m_Resampler;
+	std::unique_ptr<PolyphaseResampler> m_PolyphaseResampler;
 	WWMFPcmFormat m_InputFormat;
 	WWMFPcmFormat m_OutputFormat;
 
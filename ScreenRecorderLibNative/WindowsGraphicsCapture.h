@@ -18,6 +18,7 @@ public:
 	virtual HRESULT GetNativeSize(_In_ RECORDING_SOURCE_BASE &recordingSource, _Out_ SIZE *nativeMediaSize) override;
 	virtual HRESULT GetMouse(_Inout_ PTR_INFO *pPtrInfo, _In_ RECT frameCoordinates, _In_ int offsetX, _In_ int offsetY) override;
 	virtual inline std::wstring Name() override { return L"WindowsGraphicsCapture"; };
+	virtual inline HANDLE GetFrameArrivedEvent() override { return m_NewFrameEvent; }
 
 private:
 	void OnFrameArrived(winrt::Windows::Graphics::Capture::Direct3D11CaptureFramePool const &sender, winrt::Windows::Foundation::IInspectable const &args);
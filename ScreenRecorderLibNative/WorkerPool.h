@@ -0,0 +1,160 @@
+#pragma once
+#include "FramePipeline.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// <summary>
+/// A fixed number of worker threads running tasks from a bounded queue, e.g. encoding snapshots off the recording thread.
+/// Tasks posted while the queue is full are rejected rather than waited for, so a slow pool never holds up the thread posting to it.
+/// ParallelFor splits work between the calling thread and any idle workers, so it can be called from a task of the pool itself without deadlocking.
+/// </summary>
+class WorkerPool
+{
+public:
+	typedef std::function<void()> Task;
+
+	WorkerPool(size_t threadCount, size_t queueCapacity) :
+		m_ThreadCount((std::max)(threadCount, (size_t)1)),
+		m_Queue(queueCapacity, PipelineDropPolicy::DropNewest)
+	{
+	}
+	WorkerPool(const WorkerPool &) = delete;
+	WorkerPool &operator=(const WorkerPool &) = delete;
+	~WorkerPool()
+	{
+		Stop();
+	}
+
+	/// <summary>
+	/// Starts the worker threads.
+	/// </summary>
+	/// <param name="onThreadStart">Optional function called on each worker thread before the first task, e.g. to initialize COM.</param>
+	/// <param name="onThreadExit">Optional function called on each worker thread before it exits.</param>
+	void Start(std::function<void()> onThreadStart = nullptr, std::function<void()> onThreadExit = nullptr)
+	{
+		if (!m_WorkerThreads.empty()) {
+			return;
+		}
+		for (size_t i = 0; i < m_ThreadCount; i++) {
+			m_WorkerThreads.emplace_back([this, onThreadStart, onThreadExit]() {
+				if (onThreadStart) {
+					onThreadStart();
+				}
+				WorkerThreadProc();
+				if (onThreadExit) {
+					onThreadExit();
+				}
+			});
+		}
+	}
+
+	/// <summary>
+	/// Queues a task to run on a worker thread.
+	/// </summary>
+	/// <returns>false if the queue is full or the pool is stopped, in which case the task is not run</returns>
+	bool TryPost(Task &&task)
+	{
+		return m_Queue.Push(std::move(task));
+	}
+
+	/// <summary>
+	/// Calls body for each index from 0 to count - 1, on the calling thread and on the workers that are idle, and returns when all calls are done.
+	/// The calling thread takes any index no worker got to, so the loop completes even if every worker is busy or the queue is full.
+	/// </summary>
+	void ParallelFor(size_t count, const std::function<void(size_t index)> &body)
+	{
+		if (count == 0) {
+			return;
+		}
+		std::shared_ptr<PARALLEL_FOR> pLoop = std::make_shared<PARALLEL_FOR>();
+		pLoop->Count = count;
+		pLoop->pBody = &body;
+		size_t helperCount = m_WorkerThreads.empty() ? 0 : (std::min)(m_ThreadCount, count - 1);
+		for (size_t i = 0; i < helperCount; i++) {
+			//A helper that starts after the loop is done finds no index left and returns without touching the body.
+			if (!TryPost([pLoop]() { RunLoop(*pLoop); })) {
+				break;
+			}
+		}
+		RunLoop(*pLoop);
+		std::unique_lock<std::mutex> lock(pLoop->Mutex);
+		pLoop->DoneCondition.wait(lock, [&]() { return pLoop->Completed == pLoop->Count; });
+	}
+
+	/// <summary>
+	/// Waits until every task posted so far has run.
+	/// </summary>
+	/// <returns>false if the pool was stopped</returns>
+	bool Drain()
+	{
+		return m_Queue.WaitUntilIdle();
+	}
+
+	/// <summary>
+	/// Discards the queued tasks and waits for the running ones to finish.
+	/// </summary>
+	void Stop()
+	{
+		m_Queue.Close();
+		for (std::thread &thread : m_WorkerThreads) {
+			if (thread.joinable()) {
+				thread.join();
+			}
+		}
+		m_WorkerThreads.clear();
+	}
+
+	inline size_t GetThreadCount() const { return m_ThreadCount; }
+	/// <summary>
+	/// The tasks run, rejected and queued, and the time they waited in the queue and took to run.
+	/// </summary>
+	PIPELINE_STAGE_STATS GetStats() { return m_Queue.GetStats(); }
+
+private:
+	struct PARALLEL_FOR {
+		std::atomic<size_t> NextIndex{ 0 };
+		size_t Count = 0;
+		const std::function<void(size_t index)> *pBody = nullptr;
+		std::mutex Mutex;
+		std::condition_variable DoneCondition;
+		size_t Completed = 0;
+	};
+
+	const size_t m_ThreadCount;
+	PipelineQueue<Task> m_Queue;
+	std::vector<std::thread> m_WorkerThreads;
+
+	static void RunLoop(PARALLEL_FOR &loop)
+	{
+		size_t completed = 0;
+		for (size_t index = loop.NextIndex.fetch_add(1); index < loop.Count; index = loop.NextIndex.fetch_add(1)) {
+			(*loop.pBody)(index);
+			completed++;
+		}
+		if (completed > 0) {
+			std::lock_guard<std::mutex> lock(loop.Mutex);
+			loop.Completed += completed;
+			if (loop.Completed == loop.Count) {
+				loop.DoneCondition.notify_all();
+			}
+		}
+	}
+
+	void WorkerThreadProc()
+	{
+		Task task;
+		while (m_Queue.Pop(&task)) {
+			auto start = std::chrono::steady_clock::now();
+			task();
+			task = nullptr;
+			m_Queue.Complete(std::chrono::duration_cast<std::chrono::duration<int64_t, std::ratio<1, 10000000>>>(std::chrono::steady_clock::now() - start).count());
+		}
+	}
+};
@@ -13,6 +13,8 @@
 #endif
 
 #define LOG_BUFFER_SIZE 1024
+//Maximum time to wait for queued log messages to be written when flushing the log.
+#define LOG_FLUSH_TIMEOUT_MS 2000
 
 #define LOG_LVL_TRACE 0
 #define LOG_LVL_DEBUG 1
@@ -29,7 +31,22 @@
 extern bool isLoggingEnabled;
 extern int logSeverityLevel;
 extern std::wstring logFilePath;
+/// <summary>
+/// Queues a formatted message for the background log writer. Never blocks on file I/O, and drops the message if the log queue is full.
+/// </summary>
 void _log(PCWSTR format, ...);
+/// <summary>
+/// Sets the file the log is written to. If empty, log messages are sent to the debugger output.
+/// </summary>
+void SetLogFile(std::wstring path);
+/// <summary>
+/// Waits until all queued log messages are written to the log file.
+/// </summary>
+void FlushLog();
+/// <summary>
+/// The number of log messages dropped because they were logged faster than they could be written.
+/// </summary>
+UINT64 GetDroppedLogMessageCount();
 std::wstring GetTimestamp();
 
 constexpr const char *file_name(const char *path) {
@@ -0,0 +1,133 @@
+#include "NativeTest.h"
+#include "AsyncLogWriter.h"
+#include <cstdarg>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+//Compares the time a logging thread spends per message with AsyncLogWriter against the synchronous _log it replaced,
+//which formatted the message under a mutex and opened the log file in append mode for every message.
+
+static std::mutex SyncLogMutex;
+
+static void SyncLog(const std::filesystem::path &path, const wchar_t *format, ...)
+{
+	std::lock_guard<std::mutex> lock(SyncLogMutex);
+	wchar_t buffer[ASYNC_LOG_MESSAGE_SIZE];
+	va_list args;
+	va_start(args, format);
+	vswprintf(buffer, ASYNC_LOG_MESSAGE_SIZE, format, args);
+	va_end(args);
+	std::wofstream logFile(path, std::ios_base::app | std::ios_base::out);
+	logFile << buffer;
+}
+
+static bool AsyncLog(AsyncLogWriter &writer, const wchar_t *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	bool isQueued = writer.Write(format, args);
+	va_end(args);
+	return isQueued;
+}
+
+/// <summary>
+/// Runs threadCount threads that each log messagesPerThread messages, and returns the average time per message on a logging thread in nanoseconds.
+/// </summary>
+template<typename LogFunction>
+static double MeasureNanosPerMessage(int threadCount, int messagesPerThread, LogFunction log)
+{
+	std::vector<double> threadNanos(threadCount);
+	std::vector<std::thread> threads;
+	for (int t = 0; t < threadCount; t++) {
+		threads.emplace_back([&, t]() {
+			auto start = std::chrono::steady_clock::now();
+			for (int i = 0; i < messagesPerThread; i++) {
+				log(t, i);
+			}
+			threadNanos[t] = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+		});
+	}
+	for (std::thread &thread : threads) {
+		thread.join();
+	}
+	double total = 0;
+	for (double nanos : threadNanos) {
+		total += nanos;
+	}
+	return total / ((double)threadCount * messagesPerThread);
+}
+
+int main()
+{
+	std::filesystem::path folder = std::filesystem::temp_directory_path() / "AsyncLogWriterBenchmark";
+	std::filesystem::remove_all(folder);
+	std::filesystem::create_directories(folder);
+	std::filesystem::path syncPath = folder / "sync.txt";
+	std::filesystem::path asyncPath = folder / "async.txt";
+	const wchar_t *format = L"[INFO]  %ls (%d): frame %d written, %d bytes\n";
+
+	printf("%-34s %12s %12s %8s\n", "", "ns/message", "messages/s", "dropped");
+	for (int threadCount : { 1, 4 }) {
+		const int messagesPerThread = 50000;
+		std::filesystem::remove(syncPath);
+		auto start = std::chrono::steady_clock::now();
+		double syncNanos = MeasureNanosPerMessage(threadCount, messagesPerThread, [&](int t, int i) {
+			SyncLog(syncPath, format, L"RecordingManager.cpp", t, i, 1234);
+		});
+		double syncSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		char name[64];
+		snprintf(name, sizeof(name), "Synchronous _log, %d thread%s", threadCount, threadCount > 1 ? "s" : "");
+		printf("%-34s %12.0f %12.0f %8d\n", name, syncNanos, threadCount * messagesPerThread / syncSeconds, 0);
+
+		std::filesystem::remove(asyncPath);
+		start = std::chrono::steady_clock::now();
+		ASYNC_LOG_STATS stats;
+		double asyncNanos;
+		{
+			AsyncLogWriter writer;
+			writer.SetFilePath(asyncPath.wstring());
+			writer.SetMaxFileSize(0);
+			asyncNanos = MeasureNanosPerMessage(threadCount, messagesPerThread, [&](int t, int i) {
+				AsyncLog(writer, format, L"RecordingManager.cpp", t, i, 1234);
+			});
+			writer.Flush(std::chrono::milliseconds(60000));
+			stats = writer.GetStats();
+		}
+		//End to end throughput includes writing the queue to disk, so it is bounded by the writer thread rather than the callers.
+		double asyncSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		snprintf(name, sizeof(name), "AsyncLogWriter, %d thread%s", threadCount, threadCount > 1 ? "s" : "");
+		printf("%-34s %12.0f %12.0f %8llu\n", name, asyncNanos, stats.Written / asyncSeconds, (unsigned long long)stats.Dropped);
+
+		//Callers that retry when the queue is full measure the rate the writer thread sustains without losing messages.
+		std::filesystem::remove(asyncPath);
+		start = std::chrono::steady_clock::now();
+		{
+			AsyncLogWriter writer;
+			writer.SetFilePath(asyncPath.wstring());
+			writer.SetMaxFileSize(0);
+			asyncNanos = MeasureNanosPerMessage(threadCount, messagesPerThread, [&](int t, int i) {
+				while (!AsyncLog(writer, format, L"RecordingManager.cpp", t, i, 1234)) {
+					std::this_thread::yield();
+				}
+			});
+			writer.Flush(std::chrono::milliseconds(60000));
+			stats = writer.GetStats();
+		}
+		asyncSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		snprintf(name, sizeof(name), "AsyncLogWriter retrying, %d thread%s", threadCount, threadCount > 1 ? "s" : "");
+		printf("%-34s %12.0f %12.0f %8d\n", name, asyncNanos, stats.Written / asyncSeconds, 0);
+	}
+
+	//The cost of the queue alone, without formatting or file writes.
+	BoundedMpscQueue<uint64_t> queue(1024);
+	double queueNanos = 1e6 * MeasureMillisPerCall([&]() {
+		queue.TryPush([](uint64_t &item) { item = 1; });
+		queue.TryPop([](uint64_t &) {});
+	});
+	printf("%-34s %12.1f\n", "BoundedMpscQueue push and pop", queueNanos);
+
+	std::filesystem::remove_all(folder);
+	return 0;
+}
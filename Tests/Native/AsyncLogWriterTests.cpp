@@ -0,0 +1,273 @@
+#include "NativeTest.h"
+#include "AsyncLogWriter.h"
+#include <condition_variable>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace {
+	bool WriteFormatted(AsyncLogWriter &writer, const wchar_t *format, ...) {
+		va_list args;
+		va_start(args, format);
+		bool isQueued = writer.Write(format, args);
+		va_end(args);
+		return isQueued;
+	}
+
+	std::vector<std::string> ReadLines(const std::filesystem::path &path) {
+		std::vector<std::string> lines;
+		std::ifstream file(path);
+		std::string line;
+		while (std::getline(file, line)) {
+			lines.push_back(line);
+		}
+		return lines;
+	}
+
+	/// <summary>
+	/// A folder for the log files of one test, deleted with its contents when the test ends.
+	/// </summary>
+	class TempFolder
+	{
+	public:
+		TempFolder(const char *name) {
+			m_Path = std::filesystem::temp_directory_path() / ("AsyncLogWriterTests_" + std::string(name));
+			std::filesystem::remove_all(m_Path);
+			std::filesystem::create_directories(m_Path);
+		}
+		~TempFolder() {
+			std::error_code ec;
+			std::filesystem::remove_all(m_Path, ec);
+		}
+		const std::filesystem::path &GetPath() const { return m_Path; }
+	private:
+		std::filesystem::path m_Path;
+	};
+
+	/// <summary>
+	/// A fallback sink that records messages, and can hold the writer thread inside the sink to simulate a stalled writer.
+	/// </summary>
+	class RecordingSink
+	{
+	public:
+		void operator()(const wchar_t *text) {
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_Messages.push_back(text);
+			m_Condition.notify_all();
+			m_Condition.wait(lock, [&]() { return !m_IsHolding; });
+		}
+		void Hold() {
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_IsHolding = true;
+		}
+		void Release() {
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_IsHolding = false;
+			m_Condition.notify_all();
+		}
+		void WaitForMessages(size_t count) {
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_Condition.wait(lock, [&]() { return m_Messages.size() >= count; });
+		}
+		std::vector<std::wstring> GetMessages() {
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			return m_Messages;
+		}
+	private:
+		std::mutex m_Mutex;
+		std::condition_variable m_Condition;
+		std::vector<std::wstring> m_Messages;
+		bool m_IsHolding = false;
+	};
+}
+
+NATIVE_TEST(FallbackSinkReceivesMessagesInOrder)
+{
+	auto sink = std::make_shared<RecordingSink>();
+	AsyncLogWriter writer(16);
+	writer.SetFallbackSink([sink](const wchar_t *text) { (*sink)(text); });
+	for (int i = 0; i < 100; i++) {
+		//Flushing every few messages keeps the small queue from overflowing.
+		CHECK(WriteFormatted(writer, L"message %d %ls\n", i, L"text"));
+		if (i % 8 == 7) {
+			CHECK(writer.Flush(std::chrono::milliseconds(5000)));
+		}
+	}
+	CHECK(writer.Flush(std::chrono::milliseconds(5000)));
+	std::vector<std::wstring> messages = sink->GetMessages();
+	CHECK_EQUAL((size_t)100, messages.size());
+	for (int i = 0; i < 100; i++) {
+		CHECK(messages[i] == L"message " + std::to_wstring(i) + L" text\n");
+	}
+	CHECK_EQUAL((uint64_t)100, writer.GetStats().Written);
+}
+
+NATIVE_TEST(LongMessagesAreTruncatedToOneLine)
+{
+	auto sink = std::make_shared<RecordingSink>();
+	AsyncLogWriter writer(16);
+	writer.SetFallbackSink([sink](const wchar_t *text) { (*sink)(text); });
+	std::wstring longText(3 * ASYNC_LOG_MESSAGE_SIZE, L'x');
+	WriteFormatted(writer, L"%ls\n", longText.c_str());
+	writer.WriteString(longText.c_str());
+	CHECK(writer.Flush(std::chrono::milliseconds(5000)));
+	std::vector<std::wstring> messages = sink->GetMessages();
+	CHECK_EQUAL((size_t)2, messages.size());
+	//The formatted message keeps its line break, the preformatted one is cut at the size limit.
+	CHECK_EQUAL((size_t)ASYNC_LOG_MESSAGE_SIZE - 1, messages[0].size());
+	CHECK(messages[0].back() == L'\n');
+	CHECK_EQUAL((size_t)ASYNC_LOG_MESSAGE_SIZE - 1, messages[1].size());
+}
+
+NATIVE_TEST(DroppedMessagesAreCountedAndReported)
+{
+	auto sink = std::make_shared<RecordingSink>();
+	AsyncLogWriter writer(8);
+	writer.SetFallbackSink([sink](const wchar_t *text) { (*sink)(text); });
+	//Releases the writer thread if a check fails, so destroying the writer does not wait on it forever.
+	std::shared_ptr<void> releaseOnExit(nullptr, [sink](void *) { sink->Release(); });
+	//Stall the writer thread inside the sink on the first message, so the queue fills up behind it.
+	sink->Hold();
+	CHECK(writer.WriteString(L"first\n"));
+	sink->WaitForMessages(1);
+	int queued = 0;
+	int dropped = 0;
+	for (int i = 0; i < 20; i++) {
+		if (WriteFormatted(writer, L"message %d\n", i)) {
+			queued++;
+		}
+		else {
+			dropped++;
+		}
+	}
+	//The message being written still occupies its queue slot, so 7 more fit.
+	CHECK_EQUAL(7, queued);
+	CHECK_EQUAL(13, dropped);
+	//Flush cannot finish while the writer is stalled.
+	CHECK(!writer.Flush(std::chrono::milliseconds(50)));
+	sink->Release();
+	CHECK(writer.Flush(std::chrono::milliseconds(5000)));
+	ASYNC_LOG_STATS stats = writer.GetStats();
+	CHECK_EQUAL((uint64_t)13, stats.Dropped);
+	CHECK_EQUAL((uint64_t)8, stats.Written);
+	std::vector<std::wstring> messages = sink->GetMessages();
+	CHECK_EQUAL((size_t)9, messages.size());
+	CHECK(messages.back().find(L"13 log messages dropped") != std::wstring::npos);
+}
+
+NATIVE_TEST(FileIsWrittenAndRotated)
+{
+	TempFolder folder("Rotation");
+	std::filesystem::path path = folder.GetPath() / "log.txt";
+	std::filesystem::path rotatedPath = folder.GetPath() / "log.1.txt";
+	const uint64_t maxFileSize = 4000;
+	const int messageCount = 1000;
+	{
+		AsyncLogWriter writer(64);
+		writer.SetFilePath(path.wstring());
+		writer.SetMaxFileSize(maxFileSize);
+		for (int i = 0; i < messageCount; i++) {
+			WriteFormatted(writer, L"message %04d\n", i);
+			if (i % 32 == 31) {
+				CHECK(writer.Flush(std::chrono::milliseconds(5000)));
+			}
+		}
+		CHECK(writer.Flush(std::chrono::milliseconds(5000)));
+		ASYNC_LOG_STATS stats = writer.GetStats();
+		CHECK_EQUAL((uint64_t)messageCount, stats.Written);
+		CHECK_EQUAL((uint64_t)0, stats.Dropped);
+		//13 characters per message, so each file holds 307 messages.
+		CHECK_EQUAL((uint64_t)3, stats.Rotations);
+	}
+	CHECK(std::filesystem::file_size(path) <= maxFileSize);
+	CHECK(std::filesystem::file_size(rotatedPath) <= maxFileSize);
+	//The rotated file holds the messages right before the current file, so the two read back in order.
+	std::vector<std::string> lines = ReadLines(rotatedPath);
+	std::vector<std::string> currentLines = ReadLines(path);
+	lines.insert(lines.end(), currentLines.begin(), currentLines.end());
+	int first = messageCount - (int)lines.size();
+	for (size_t i = 0; i < lines.size(); i++) {
+		char expected[32];
+		snprintf(expected, sizeof(expected), "message %04d", first + (int)i);
+		CHECK_EQUAL(std::string(expected), lines[i]);
+	}
+}
+
+NATIVE_TEST(ExistingFileIsAppendedTo)
+{
+	TempFolder folder("Append");
+	std::filesystem::path path = folder.GetPath() / "log.txt";
+	{
+		std::ofstream file(path);
+		file << "existing\n";
+	}
+	{
+		AsyncLogWriter writer(16);
+		writer.SetFilePath(path.wstring());
+		writer.WriteString(L"appended\n");
+		CHECK(writer.Flush(std::chrono::milliseconds(5000)));
+	}
+	CHECK(ReadLines(path) == std::vector<std::string>({ "existing", "appended" }));
+}
+
+NATIVE_TEST(DestructorWritesQueuedMessages)
+{
+	TempFolder folder("Destructor");
+	std::filesystem::path path = folder.GetPath() / "log.txt";
+	{
+		AsyncLogWriter writer(256);
+		writer.SetFilePath(path.wstring());
+		writer.SetFlushInterval(std::chrono::milliseconds(60000));
+		for (int i = 0; i < 100; i++) {
+			WriteFormatted(writer, L"message %d\n", i);
+		}
+	}
+	CHECK_EQUAL((size_t)100, ReadLines(path).size());
+}
+
+NATIVE_TEST(ConcurrentWritersLoseNothingWhenFlushed)
+{
+	TempFolder folder("Concurrent");
+	std::filesystem::path path = folder.GetPath() / "log.txt";
+	const int threadCount = 4;
+	const int messagesPerThread = 20000;
+	uint64_t totalDropped;
+	{
+		AsyncLogWriter writer(1024);
+		writer.SetFilePath(path.wstring());
+		writer.SetMaxFileSize(0);
+		std::vector<std::thread> threads;
+		for (int t = 0; t < threadCount; t++) {
+			threads.emplace_back([&, t]() {
+				for (int i = 0; i < messagesPerThread; i++) {
+					WriteFormatted(writer, L"thread %d message %d\n", t, i);
+				}
+			});
+		}
+		for (std::thread &thread : threads) {
+			thread.join();
+		}
+		CHECK(writer.Flush(std::chrono::milliseconds(10000)));
+		ASYNC_LOG_STATS stats = writer.GetStats();
+		totalDropped = stats.Dropped;
+		//Every message is either written or counted as dropped.
+		CHECK_EQUAL((uint64_t)threadCount * messagesPerThread, stats.Written + stats.Dropped);
+	}
+	std::vector<int> last(threadCount, -1);
+	int outOfOrder = 0;
+	size_t messageLines = 0;
+	for (const std::string &line : ReadLines(path)) {
+		int thread, message;
+		if (sscanf(line.c_str(), "thread %d message %d", &thread, &message) == 2) {
+			messageLines++;
+			if (message <= last[thread]) {
+				outOfOrder++;
+			}
+			last[thread] = message;
+		}
+	}
+	CHECK_EQUAL(0, outOfOrder);
+	CHECK_EQUAL((uint64_t)threadCount * messagesPerThread - totalDropped, (uint64_t)messageLines);
+}
@@ -0,0 +1,297 @@
+#include "NativeTest.h"
+#include "AudioBufferPool.h"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <set>
+#include <thread>
+
+namespace {
+	/// <summary>
+	/// Stands in for an IMFMediaBuffer: a block of memory with a current length, that must be locked for writing.
+	/// </summary>
+	struct FAKE_MEDIA_BUFFER {
+		std::vector<uint8_t> Memory;
+		size_t CurrentLength = 0;
+		int LockCount = 0;
+	};
+
+	/// <summary>
+	/// Allocates fake media buffers like MFMemoryBufferAllocator, and checks that the pool locks, unlocks and frees them correctly.
+	/// </summary>
+	class FakeMediaBufferAllocator : public IAudioBufferAllocator<FAKE_MEDIA_BUFFER *>
+	{
+	public:
+		struct STATE {
+			std::mutex Mutex;
+			std::set<FAKE_MEDIA_BUFFER *> Live;
+			int Allocations = 0;
+			int Frees = 0;
+			int Errors = 0;
+			bool IsAllocationFailing = false;
+			bool IsLockFailing = false;
+		};
+		FakeMediaBufferAllocator(STATE *pState) :m_State(pState) {}
+		bool Allocate(const size_t &capacity, FAKE_MEDIA_BUFFER **ppBuffer) override {
+			std::lock_guard<std::mutex> lock(m_State->Mutex);
+			if (m_State->IsAllocationFailing) {
+				return false;
+			}
+			*ppBuffer = new FAKE_MEDIA_BUFFER();
+			(*ppBuffer)->Memory.resize(capacity);
+			m_State->Live.insert(*ppBuffer);
+			m_State->Allocations++;
+			return true;
+		}
+		void Free(FAKE_MEDIA_BUFFER *pBuffer) override {
+			std::lock_guard<std::mutex> lock(m_State->Mutex);
+			if (m_State->Live.erase(pBuffer) == 0 || pBuffer->LockCount != 0) {
+				m_State->Errors++;
+				return;
+			}
+			m_State->Frees++;
+			delete pBuffer;
+		}
+		uint8_t *Lock(FAKE_MEDIA_BUFFER *pBuffer) override {
+			std::lock_guard<std::mutex> lock(m_State->Mutex);
+			if (m_State->IsLockFailing) {
+				return nullptr;
+			}
+			if (pBuffer->LockCount++ != 0) {
+				m_State->Errors++;
+			}
+			return pBuffer->Memory.data();
+		}
+		void Unlock(FAKE_MEDIA_BUFFER *pBuffer, size_t length) override {
+			std::lock_guard<std::mutex> lock(m_State->Mutex);
+			if (--pBuffer->LockCount != 0 || length > pBuffer->Memory.size()) {
+				m_State->Errors++;
+			}
+			pBuffer->CurrentLength = length;
+		}
+	private:
+		STATE *m_State;
+	};
+
+	typedef AudioBufferPool<FAKE_MEDIA_BUFFER *> FakeMediaBufferPool;
+	typedef AudioBufferRef<FAKE_MEDIA_BUFFER *> FakeMediaBufferRef;
+
+	//The bytes of 48 kHz stereo 16-bit audio for a frame of the given duration in 100 nanosecond units.
+	size_t GetAudioBytes(int64_t duration) {
+		return (size_t)(duration * 48000 / 10000000) * 2 * sizeof(int16_t);
+	}
+}
+
+NATIVE_TEST(VaryingFrameLengthsShareOneSizeClass)
+{
+	FakeMediaBufferAllocator::STATE state;
+	auto pool = FakeMediaBufferPool::Create(std::make_unique<FakeMediaBufferAllocator>(&state), 4);
+	std::mt19937 rng(1);
+	//Frame durations jitter around 60 fps, so the audio length differs slightly from frame to frame.
+	for (int frame = 0; frame < 1000; frame++) {
+		size_t length = GetAudioBytes(166667 + (int64_t)(rng() % 20000) - 10000);
+		FakeMediaBufferRef buffer = pool->Acquire(length);
+		CHECK(buffer);
+		CHECK_EQUAL((size_t)4096, buffer->Capacity());
+		memset(buffer->Data(), frame & 0xFF, length);
+		buffer->SetLength(length);
+		FAKE_MEDIA_BUFFER *pMediaBuffer = buffer->Commit();
+		CHECK_EQUAL(length, pMediaBuffer->CurrentLength);
+	}
+	CHECK_EQUAL(1, state.Allocations);
+	CHECK_EQUAL((uint64_t)999, pool->GetStats().Hits);
+	CHECK_EQUAL((size_t)8192, FakeMediaBufferPool::GetCapacityClass(4097));
+	CHECK_EQUAL((size_t)AUDIO_BUFFER_MIN_CAPACITY, FakeMediaBufferPool::GetCapacityClass(0));
+}
+
+NATIVE_TEST(CommitEndsWritesAndSetsBackingLength)
+{
+	FakeMediaBufferAllocator::STATE state;
+	auto pool = FakeMediaBufferPool::Create(std::make_unique<FakeMediaBufferAllocator>(&state), 4);
+	FakeMediaBufferRef buffer = pool->Acquire(1000);
+	CHECK(!buffer->IsCommitted());
+	CHECK_EQUAL((size_t)0, buffer->Length());
+	CHECK_EQUAL(1, buffer->GetBuffer()->LockCount);
+	buffer->SetLength(100000);
+	CHECK_EQUAL(buffer->Capacity(), buffer->Length());
+	buffer->SetLength(1000);
+	FAKE_MEDIA_BUFFER *pMediaBuffer = buffer->Commit();
+	CHECK(buffer->IsCommitted());
+	CHECK(buffer->Data() == nullptr);
+	CHECK_EQUAL(0, pMediaBuffer->LockCount);
+	CHECK_EQUAL((size_t)1000, pMediaBuffer->CurrentLength);
+	//Committing twice does not unlock twice.
+	buffer->Commit();
+	CHECK_EQUAL(0, state.Errors);
+}
+
+NATIVE_TEST(UncommittedBufferIsUnlockedWhenReleased)
+{
+	FakeMediaBufferAllocator::STATE state;
+	auto pool = FakeMediaBufferPool::Create(std::make_unique<FakeMediaBufferAllocator>(&state), 4);
+	FAKE_MEDIA_BUFFER *pMediaBuffer;
+	{
+		FakeMediaBufferRef buffer = pool->Acquire(1000);
+		pMediaBuffer = buffer->GetBuffer();
+		buffer->SetLength(10);
+	}
+	CHECK_EQUAL(0, pMediaBuffer->LockCount);
+	//A reused buffer starts empty and writable again.
+	FakeMediaBufferRef buffer = pool->Acquire(1000);
+	CHECK(buffer->GetBuffer() == pMediaBuffer);
+	CHECK_EQUAL((size_t)0, buffer->Length());
+	CHECK(buffer->Data() != nullptr);
+	CHECK_EQUAL(0, state.Errors);
+}
+
+NATIVE_TEST(BufferReturnsToPoolWhenLastReferenceIsReleased)
+{
+	FakeMediaBufferAllocator::STATE state;
+	auto pool = FakeMediaBufferPool::Create(std::make_unique<FakeMediaBufferAllocator>(&state), 4);
+	FakeMediaBufferRef buffer = pool->Acquire(1000);
+	FakeMediaBufferRef copy = buffer;
+	FakeMediaBufferRef moved = std::move(copy);
+	CHECK(!copy);
+	CHECK(moved.Get() == buffer.Get());
+	buffer.Reset();
+	CHECK_EQUAL((size_t)1, pool->GetStats().InUse);
+	moved->SetLength(500);
+	CHECK_EQUAL((size_t)500, moved.Length());
+	moved = FakeMediaBufferRef();
+	RESOURCE_POOL_STATS stats = pool->GetStats();
+	CHECK_EQUAL((size_t)0, stats.InUse);
+	CHECK_EQUAL((size_t)1, stats.Idle);
+	CHECK_EQUAL((size_t)0, moved.Length());
+}
+
+NATIVE_TEST(BuffersOutliveTheirPool)
+{
+	FakeMediaBufferAllocator::STATE state;
+	{
+		auto pool = FakeMediaBufferPool::Create(std::make_unique<FakeMediaBufferAllocator>(&state), 4);
+		FakeMediaBufferRef first = pool->Acquire(1000);
+		FakeMediaBufferRef second = pool->Acquire(10000);
+		//The encoder may still hold buffers when the recording tears down the pool.
+		pool.reset();
+		first.Reset();
+		CHECK_EQUAL(0, state.Frees);
+		second.Reset();
+	}
+	CHECK_EQUAL(2, state.Allocations);
+	CHECK_EQUAL(2, state.Frees);
+	CHECK(state.Live.empty());
+	CHECK_EQUAL(0, state.Errors);
+}
+
+NATIVE_TEST(BackendFailuresReturnEmptyReferences)
+{
+	FakeMediaBufferAllocator::STATE state;
+	auto pool = FakeMediaBufferPool::Create(std::make_unique<FakeMediaBufferAllocator>(&state), 4);
+	state.IsAllocationFailing = true;
+	CHECK(!pool->Acquire(1000));
+	state.IsAllocationFailing = false;
+	state.IsLockFailing = true;
+	FakeMediaBufferRef buffer = pool->Acquire(1000);
+	CHECK(!buffer);
+	CHECK_EQUAL((size_t)0, buffer.Length());
+	//The buffer that could not be locked is kept for later.
+	state.IsLockFailing = false;
+	CHECK(pool->Acquire(1000));
+	CHECK_EQUAL(1, state.Allocations);
+	CHECK_EQUAL((size_t)0, pool->GetStats().InUse);
+}
+
+NATIVE_TEST(EncoderHoldingBuffersOnlyAllocatesWhatIsInFlight)
+{
+	FakeMediaBufferAllocator::STATE state;
+	const size_t depth = 8;
+	{
+		auto pool = FakeMediaBufferPool::Create(std::make_unique<FakeMediaBufferAllocator>(&state), depth);
+		std::mutex mutex;
+		std::condition_variable condition;
+		std::deque<FakeMediaBufferRef> encoderQueue;
+		bool isDone = false;
+		size_t maxInFlight = 0;
+		//The encoder releases its samples on its own thread, some time after they are written, as Media Foundation does.
+		std::thread encoder([&]() {
+			for (;;) {
+				FakeMediaBufferRef buffer;
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					condition.wait(lock, [&]() { return isDone || !encoderQueue.empty(); });
+					if (encoderQueue.empty()) {
+						return;
+					}
+					buffer = std::move(encoderQueue.front());
+					encoderQueue.pop_front();
+				}
+				condition.notify_all();
+				std::this_thread::sleep_for(std::chrono::microseconds(50));
+			}
+		});
+		std::mt19937 rng(2);
+		for (int frame = 0; frame < 10000; frame++) {
+			FakeMediaBufferRef buffer = pool->Acquire(GetAudioBytes(166667 + (int64_t)(rng() % 20000) - 10000));
+			CHECK(buffer);
+			maxInFlight = (std::max)(maxInFlight, pool->GetStats().InUse);
+			buffer->SetLength(buffer->Capacity() / 2);
+			buffer->Commit();
+			std::unique_lock<std::mutex> lock(mutex);
+			//Like the encoder input queue, at most a few samples are pending.
+			condition.wait(lock, [&]() { return encoderQueue.size() < 4; });
+			encoderQueue.push_back(std::move(buffer));
+			condition.notify_all();
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			isDone = true;
+		}
+		condition.notify_all();
+		encoder.join();
+		RESOURCE_POOL_STATS stats = pool->GetStats();
+		CHECK_EQUAL((size_t)0, stats.InUse);
+		CHECK(maxInFlight <= 6);
+		CHECK((size_t)state.Allocations <= maxInFlight);
+		CHECK_EQUAL((uint64_t)10000, stats.Hits + stats.Misses);
+		CHECK_EQUAL((uint64_t)0, stats.Discarded);
+	}
+	CHECK_EQUAL(state.Allocations, state.Frees);
+	CHECK_EQUAL(0, state.Errors);
+}
+
+NATIVE_TEST(ConcurrentAcquireAndReleaseKeepBuffersConsistent)
+{
+	FakeMediaBufferAllocator::STATE state;
+	{
+		auto pool = FakeMediaBufferPool::Create(std::make_unique<FakeMediaBufferAllocator>(&state), 8);
+		std::atomic<int> corruptBuffers = 0;
+		std::vector<std::thread> threads;
+		for (int t = 0; t < 4; t++) {
+			threads.emplace_back([&, t]() {
+				for (int i = 0; i < 20000; i++) {
+					FakeMediaBufferRef buffer = pool->Acquire(4096 << (i % 2));
+					memset(buffer->Data(), t, 64);
+					buffer->SetLength(64);
+					FakeMediaBufferRef copy = buffer;
+					buffer.Reset();
+					//No other thread writes to a buffer while it is held here.
+					for (int j = 0; j < 64; j++) {
+						if (copy->Data()[j] != t) {
+							corruptBuffers++;
+							break;
+						}
+					}
+					copy->Commit();
+				}
+			});
+		}
+		for (std::thread &thread : threads) {
+			thread.join();
+		}
+		CHECK_EQUAL(0, corruptBuffers.load());
+		CHECK_EQUAL((size_t)0, pool->GetStats().InUse);
+	}
+	CHECK_EQUAL(state.Allocations, state.Frees);
+	CHECK_EQUAL(0, state.Errors);
+}
@@ -0,0 +1,61 @@
+#include "NativeTest.h"
+#include "AudioMixer.h"
+#include <random>
+
+//Compares the time to mix 10 ms of 48 kHz stereo audio with the byte vector MixAudio that AudioMixer replaced, and with each AudioMixer kernel.
+
+static std::vector<uint8_t> MixAudio(const std::vector<uint8_t> &first, const std::vector<uint8_t> &second, float firstVolume, float secondVolume)
+{
+	std::vector<uint8_t> newvector((std::max)(first.size(), second.size()));
+	for (size_t i = 0; i < newvector.size(); i += 2) {
+		short firstSample = first.size() > i + 1 ? static_cast<short>(first[i] | first[i + 1] << 8) : 0;
+		short secondSample = second.size() > i + 1 ? static_cast<short>(second[i] | second[i + 1] << 8) : 0;
+		auto out = reinterpret_cast<short *>(&newvector[i]);
+		int mixedSample = int(round((firstSample)*firstVolume + (secondSample)*secondVolume));
+		mixedSample = (std::max)(-32767, (std::min)(32767, mixedSample));
+		*out = (short)mixedSample;
+	}
+	return newvector;
+}
+
+int main()
+{
+	const size_t sampleCount = 48000 * 2 / 100;
+	std::mt19937 rng(1);
+	std::vector<std::vector<int16_t>> samples(4, std::vector<int16_t>(sampleCount));
+	for (auto &source : samples) {
+		for (int16_t &sample : source) {
+			sample = (int16_t)(rng() % 20000 - 10000);
+		}
+	}
+	std::vector<int16_t> output(sampleCount);
+	printf("Mixing 10 ms of 48 kHz stereo audio, best kernel on this CPU: %d\n", (int)AudioMixer::GetBestKernel());
+
+	std::vector<uint8_t> firstBytes(sampleCount * 2), secondBytes(sampleCount * 2);
+	memcpy(firstBytes.data(), samples[0].data(), firstBytes.size());
+	memcpy(secondBytes.data(), samples[1].data(), secondBytes.size());
+	double previousMicros = 1000 * MeasureMillisPerCall([&]() {
+		std::vector<uint8_t> mixed = MixAudio(firstBytes, secondBytes, 0.7f, 0.6f);
+		output[0] = mixed[0];
+	});
+	printf("%-28s %8.2f us\n", "MixAudio, 2 sources", previousMicros);
+
+	const char *kernelNames[] = { "Scalar", "SSE2", "AVX2" };
+	for (size_t sourceCount : { 2, 4 }) {
+		std::vector<AUDIO_MIX_SOURCE> sources(sourceCount);
+		for (size_t i = 0; i < sourceCount; i++) {
+			sources[i].pSamples = samples[i].data();
+			sources[i].SampleCount = sampleCount;
+			sources[i].Volume = 0.5f + 0.1f * i;
+		}
+		for (int kernel = 0; kernel < 3; kernel++) {
+			double micros = 1000 * MeasureMillisPerCall([&]() {
+				AudioMixer::Mix((AudioMixer::Kernel)kernel, sources.data(), sources.size(), output.data(), output.size());
+			});
+			char name[64];
+			snprintf(name, sizeof(name), "AudioMixer %s, %zu sources", kernelNames[kernel], sourceCount);
+			printf("%-28s %8.2f us\n", name, micros);
+		}
+	}
+	return 0;
+}
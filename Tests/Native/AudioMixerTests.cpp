@@ -0,0 +1,164 @@
+#include "NativeTest.h"
+#include "AudioMixer.h"
+#include <random>
+
+namespace {
+	const AudioMixer::Kernel KERNELS[] = { AudioMixer::Kernel::Scalar, AudioMixer::Kernel::SSE2, AudioMixer::Kernel::AVX2 };
+
+	/// <summary>
+	/// The two input mix from AudioManager::MixAudio before AudioMixer replaced it, on 16-bit little endian byte vectors.
+	/// The products are stored to volatile floats so the compiler cannot fuse them into a multiply-add, which the MSVC build never did.
+	/// </summary>
+	bool MixAudioReference(const std::vector<uint8_t> &first, const std::vector<uint8_t> &second, float firstVolume, float secondVolume, std::vector<uint8_t> &newvector) {
+		newvector.assign((std::max)(first.size(), second.size()), 0);
+		bool clipped = false;
+		for (size_t i = 0; i + 1 < newvector.size(); i += 2) {
+			short firstSample = first.size() > i + 1 ? static_cast<short>(first[i] | first[i + 1] << 8) : 0;
+			short secondSample = second.size() > i + 1 ? static_cast<short>(second[i] | second[i + 1] << 8) : 0;
+			volatile float firstProduct = firstSample * firstVolume;
+			volatile float secondProduct = secondSample * secondVolume;
+			int mixedSample = int(round(firstProduct + secondProduct));
+			if (mixedSample > 32767) {
+				clipped = true;
+				mixedSample = 32767;
+			}
+			else if (mixedSample < -32767) {
+				clipped = true;
+				mixedSample = -32767;
+			}
+			newvector[i] = (uint8_t)(mixedSample & 0xFF);
+			newvector[i + 1] = (uint8_t)((mixedSample >> 8) & 0xFF);
+		}
+		return clipped;
+	}
+
+	std::vector<int16_t> RandomSamples(std::mt19937 &rng, size_t count) {
+		std::vector<int16_t> samples(count);
+		for (int16_t &sample : samples) {
+			sample = (int16_t)rng();
+		}
+		return samples;
+	}
+
+	std::vector<uint8_t> ToBytes(const std::vector<int16_t> &samples) {
+		std::vector<uint8_t> bytes(samples.size() * 2);
+		memcpy(bytes.data(), samples.data(), bytes.size());
+		return bytes;
+	}
+}
+
+NATIVE_TEST(TwoSourcesMatchPreviousMixBitForBit)
+{
+	std::mt19937 rng(1);
+	const float volumes[] = { 0.0f, 0.5f, 1.0f, 0.3f, 1.7f, 0.999f, 2.5f, -1.0f, 20000.0f, 0.1234567f };
+	for (int iteration = 0; iteration < 3000; iteration++) {
+		std::vector<int16_t> first = RandomSamples(rng, rng() % 2000);
+		std::vector<int16_t> second = RandomSamples(rng, rng() % 2000);
+		float firstVolume = volumes[rng() % 10];
+		float secondVolume = volumes[rng() % 10];
+		if (rng() % 3 == 0) {
+			firstVolume = std::uniform_real_distribution<float>(0, 3)(rng);
+			secondVolume = std::uniform_real_distribution<float>(0, 3)(rng);
+		}
+		std::vector<uint8_t> expected;
+		bool expectedClipped = MixAudioReference(ToBytes(first), ToBytes(second), firstVolume, secondVolume, expected);
+		for (AudioMixer::Kernel kernel : KERNELS) {
+			AUDIO_MIX_SOURCE sources[2];
+			sources[0].pSamples = first.data();
+			sources[0].SampleCount = first.size();
+			sources[0].Volume = firstVolume;
+			sources[1].pSamples = second.data();
+			sources[1].SampleCount = second.size();
+			sources[1].Volume = secondVolume;
+			std::vector<int16_t> output(expected.size() / 2);
+			bool clipped = AudioMixer::Mix(kernel, sources, 2, output.data(), output.size());
+			CHECK(ToBytes(output) == expected);
+			CHECK_EQUAL(expectedClipped, clipped);
+		}
+	}
+}
+
+NATIVE_TEST(MixingInPlaceMatchesMixingToNewBuffer)
+{
+	std::mt19937 rng(2);
+	for (AudioMixer::Kernel kernel : KERNELS) {
+		std::vector<int16_t> first = RandomSamples(rng, 1000);
+		std::vector<int16_t> second = RandomSamples(rng, 777);
+		AUDIO_MIX_SOURCE sources[2];
+		sources[0].pSamples = first.data();
+		sources[0].SampleCount = first.size();
+		sources[0].Volume = 0.6f;
+		sources[1].pSamples = second.data();
+		sources[1].SampleCount = second.size();
+		sources[1].Volume = 0.7f;
+		std::vector<int16_t> expected(first.size());
+		AudioMixer::Mix(kernel, sources, 2, expected.data(), expected.size());
+		AudioMixer::Mix(kernel, sources, 2, first.data(), first.size());
+		CHECK(first == expected);
+	}
+}
+
+NATIVE_TEST(ManySourcesMatchScalarKernel)
+{
+	std::mt19937 rng(3);
+	for (int iteration = 0; iteration < 300; iteration++) {
+		size_t sourceCount = 1 + rng() % 6;
+		std::vector<std::vector<int16_t>> samples;
+		std::vector<AUDIO_MIX_SOURCE> sources(sourceCount);
+		for (size_t i = 0; i < sourceCount; i++) {
+			samples.push_back(RandomSamples(rng, rng() % 3000));
+			sources[i].pSamples = samples[i].data();
+			sources[i].SampleCount = samples[i].size();
+			sources[i].Volume = std::uniform_real_distribution<float>(0, 1.5f)(rng);
+		}
+		size_t outputCount = rng() % 3000;
+		std::vector<int16_t> expected(outputCount);
+		bool expectedClipped = AudioMixer::Mix(AudioMixer::Kernel::Scalar, sources.data(), sources.size(), expected.data(), expected.size());
+		for (AudioMixer::Kernel kernel : { AudioMixer::Kernel::SSE2, AudioMixer::Kernel::AVX2 }) {
+			std::vector<int16_t> output(outputCount);
+			bool clipped = AudioMixer::Mix(kernel, sources.data(), sources.size(), output.data(), output.size());
+			CHECK(output == expected);
+			CHECK_EQUAL(expectedClipped, clipped);
+		}
+	}
+}
+
+NATIVE_TEST(HalvesRoundAwayFromZero)
+{
+	std::vector<int16_t> samples = { 1, 3, 5, -1, -3, -5, 7, 9, 11, 13, 15, 17, 19, 21, 23, 25, 27, 29 };
+	std::vector<int16_t> expected = { 1, 2, 3, -1, -2, -3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 };
+	for (AudioMixer::Kernel kernel : KERNELS) {
+		AUDIO_MIX_SOURCE source;
+		source.pSamples = samples.data();
+		source.SampleCount = samples.size();
+		source.Volume = 0.5f;
+		std::vector<int16_t> output(samples.size());
+		AudioMixer::Mix(kernel, &source, 1, output.data(), output.size());
+		CHECK(output == expected);
+	}
+}
+
+NATIVE_TEST(NoSourcesWriteSilence)
+{
+	for (AudioMixer::Kernel kernel : KERNELS) {
+		std::vector<int16_t> output(100, 1234);
+		CHECK(!AudioMixer::Mix(kernel, nullptr, 0, output.data(), output.size()));
+		CHECK(output == std::vector<int16_t>(100, 0));
+	}
+}
+
+NATIVE_TEST(ClippingIsReportedAndClamped)
+{
+	std::vector<int16_t> samples(64, 30000);
+	samples[10] = -30000;
+	for (AudioMixer::Kernel kernel : KERNELS) {
+		AUDIO_MIX_SOURCE sources[2];
+		sources[0].pSamples = samples.data();
+		sources[0].SampleCount = samples.size();
+		sources[1] = sources[0];
+		std::vector<int16_t> output(samples.size());
+		CHECK(AudioMixer::Mix(kernel, sources, 2, output.data(), output.size()));
+		CHECK_EQUAL(32767, output[0]);
+		CHECK_EQUAL(-32767, output[10]);
+	}
+}
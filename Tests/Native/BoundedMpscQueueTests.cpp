@@ -0,0 +1,81 @@
+#include "NativeTest.h"
+#include "BoundedMpscQueue.h"
+#include <thread>
+
+NATIVE_TEST(CapacityIsRoundedUpToPowerOfTwo)
+{
+	CHECK_EQUAL((size_t)2, BoundedMpscQueue<int>(1).Capacity());
+	CHECK_EQUAL((size_t)8, BoundedMpscQueue<int>(5).Capacity());
+	CHECK_EQUAL((size_t)1024, BoundedMpscQueue<int>(1024).Capacity());
+}
+
+NATIVE_TEST(ItemsArePoppedInPushOrder)
+{
+	BoundedMpscQueue<int> queue(4);
+	for (int lap = 0; lap < 3; lap++) {
+		for (int i = 0; i < 4; i++) {
+			CHECK(queue.TryPush([&](int &item) { item = lap * 10 + i; }));
+		}
+		CHECK_EQUAL((size_t)4, queue.ApproximateSize());
+		for (int i = 0; i < 4; i++) {
+			int value = -1;
+			CHECK(queue.TryPop([&](int &item) { value = item; }));
+			CHECK_EQUAL(lap * 10 + i, value);
+		}
+		CHECK(!queue.TryPop([](int &) {}));
+	}
+}
+
+NATIVE_TEST(PushFailsWhenFullWithoutCallingWriter)
+{
+	BoundedMpscQueue<int> queue(2);
+	CHECK(queue.TryPush([](int &item) { item = 1; }));
+	CHECK(queue.TryPush([](int &item) { item = 2; }));
+	bool isWriterCalled = false;
+	CHECK(!queue.TryPush([&](int &) { isWriterCalled = true; }));
+	CHECK(!isWriterCalled);
+	CHECK(queue.TryPop([](int &) {}));
+	CHECK(queue.TryPush([](int &item) { item = 3; }));
+}
+
+NATIVE_TEST(ConcurrentProducersDeliverEveryItemOnceInProducerOrder)
+{
+	const int producerCount = 4;
+	const int itemsPerProducer = 200000;
+	BoundedMpscQueue<std::pair<int, int>> queue(64);
+	std::vector<std::thread> producers;
+	for (int producer = 0; producer < producerCount; producer++) {
+		producers.emplace_back([&, producer]() {
+			for (int i = 0; i < itemsPerProducer; i++) {
+				while (!queue.TryPush([&](std::pair<int, int> &item) { item = { producer, i }; })) {
+					std::this_thread::yield();
+				}
+			}
+		});
+	}
+	std::vector<int> nextExpected(producerCount, 0);
+	int outOfOrder = 0;
+	int received = 0;
+	while (received < producerCount * itemsPerProducer) {
+		bool isPopped = queue.TryPop([&](std::pair<int, int> &item) {
+			if (item.second != nextExpected[item.first]) {
+				outOfOrder++;
+			}
+			nextExpected[item.first] = item.second + 1;
+		});
+		if (isPopped) {
+			received++;
+		}
+		else {
+			std::this_thread::yield();
+		}
+	}
+	for (std::thread &producer : producers) {
+		producer.join();
+	}
+	CHECK_EQUAL(0, outOfOrder);
+	for (int next : nextExpected) {
+		CHECK_EQUAL(itemsPerProducer, next);
+	}
+	CHECK(!queue.TryPop([](std::pair<int, int> &) {}));
+}
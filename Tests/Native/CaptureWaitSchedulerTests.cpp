@@ -0,0 +1,313 @@
+#include "NativeTest.h"
+#include "CaptureWaitScheduler.h"
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <random>
+#include <thread>
+
+namespace {
+	const uint32_t FRAME_MASK = CAPTURE_WAKE_MASK_CONTROL | GetCaptureWakeMask(CaptureWakeReason::FrameArrived);
+
+	/// <summary>
+	/// Simulates the event sources of a capture thread on a virtual clock. Signals are scheduled at a time and stay set until a wait
+	/// reports them, except Terminate, which stays set like the manual-reset event it stands in for. Waiting advances the clock instantly.
+	/// </summary>
+	class SimulatedWaitBackend : public ICaptureWaitBackend
+	{
+	public:
+		struct STATE {
+			int64_t Now = 0;
+			std::multimap<int64_t, CaptureWakeReason> ScheduledSignals;
+			bool IsSet[(size_t)CaptureWakeReason::Deadline] = {};
+			//The time each blocking wait returned.
+			std::vector<int64_t> WakeTimes;
+			std::vector<int64_t> Timeouts;
+		};
+		SimulatedWaitBackend(STATE *pState) :m_State(pState) {}
+
+		CaptureWakeReason Wait(uint32_t signalMask, int64_t timeoutMicros) override {
+			SetDueSignals();
+			CaptureWakeReason reason = TakeSignal(signalMask);
+			if (reason != CaptureWakeReason::Deadline || timeoutMicros <= 0) {
+				return reason;
+			}
+			m_State->Timeouts.push_back(timeoutMicros);
+			int64_t end = m_State->Now + timeoutMicros;
+			for (auto &scheduled : m_State->ScheduledSignals) {
+				if (scheduled.first > end) {
+					break;
+				}
+				if (signalMask & GetCaptureWakeMask(scheduled.second)) {
+					end = scheduled.first;
+					break;
+				}
+			}
+			m_State->Now = end;
+			m_State->WakeTimes.push_back(end);
+			SetDueSignals();
+			return TakeSignal(signalMask);
+		}
+		int64_t GetTimeMicros() override {
+			return m_State->Now;
+		}
+	private:
+		STATE *m_State;
+
+		void SetDueSignals() {
+			auto end = m_State->ScheduledSignals.upper_bound(m_State->Now);
+			for (auto it = m_State->ScheduledSignals.begin(); it != end; it++) {
+				m_State->IsSet[(size_t)it->second] = true;
+			}
+			m_State->ScheduledSignals.erase(m_State->ScheduledSignals.begin(), end);
+		}
+
+		CaptureWakeReason TakeSignal(uint32_t signalMask) {
+			for (size_t i = 0; i < (size_t)CaptureWakeReason::Deadline; i++) {
+				CaptureWakeReason reason = (CaptureWakeReason)i;
+				if (m_State->IsSet[i] && (signalMask & GetCaptureWakeMask(reason))) {
+					if (reason != CaptureWakeReason::Terminate) {
+						m_State->IsSet[i] = false;
+					}
+					return reason;
+				}
+			}
+			return CaptureWakeReason::Deadline;
+		}
+	};
+
+	std::unique_ptr<CaptureWaitScheduler> CreateScheduler(SimulatedWaitBackend::STATE *pState, const FrameDeadlineClock *pClock, RecordingMetrics *pMetrics = nullptr) {
+		return std::make_unique<CaptureWaitScheduler>(std::make_unique<SimulatedWaitBackend>(pState), pClock, pMetrics);
+	}
+
+	/// <summary>
+	/// Waits for real on a condition variable, to check how fast a blocked thread responds to a signal.
+	/// </summary>
+	class ConditionWaitBackend : public ICaptureWaitBackend
+	{
+	public:
+		struct STATE {
+			std::mutex Mutex;
+			std::condition_variable Condition;
+			uint32_t SetSignals = 0;
+		};
+		ConditionWaitBackend(STATE *pState) :m_State(pState) {}
+
+		CaptureWakeReason Wait(uint32_t signalMask, int64_t timeoutMicros) override {
+			std::unique_lock<std::mutex> lock(m_State->Mutex);
+			m_State->Condition.wait_for(lock, std::chrono::microseconds(timeoutMicros), [&]() { return (m_State->SetSignals & signalMask) != 0; });
+			for (size_t i = 0; i < (size_t)CaptureWakeReason::Deadline; i++) {
+				if (m_State->SetSignals & signalMask & GetCaptureWakeMask((CaptureWakeReason)i)) {
+					return (CaptureWakeReason)i;
+				}
+			}
+			return CaptureWakeReason::Deadline;
+		}
+	private:
+		STATE *m_State;
+	};
+}
+
+NATIVE_TEST(DeadlineClockExtrapolatesPassedDeadlines)
+{
+	FrameDeadlineClock clock;
+	CHECK_EQUAL(INT64_MAX, clock.GetNextDeadline(1000));
+	clock.SetNextDeadline(10000, 1000);
+	CHECK_EQUAL((int64_t)10000, clock.GetNextDeadline(0));
+	CHECK_EQUAL((int64_t)10000, clock.GetNextDeadline(9999));
+	//A deadline at the given time has passed, so the next one is reported.
+	CHECK_EQUAL((int64_t)11000, clock.GetNextDeadline(10000));
+	CHECK_EQUAL((int64_t)13000, clock.GetNextDeadline(12500));
+	//Without an interval, a passed deadline cannot be extrapolated.
+	clock.SetNextDeadline(10000, 0);
+	CHECK_EQUAL(INT64_MAX, clock.GetNextDeadline(12500));
+	clock.SetNextDeadline(10000, 1000);
+	clock.Reset();
+	CHECK_EQUAL(INT64_MAX, clock.GetNextDeadline(0));
+}
+
+NATIVE_TEST(TimeoutEndsLeadTimeBeforeNextDeadline)
+{
+	SimulatedWaitBackend::STATE state;
+	state.Now = 100000;
+	FrameDeadlineClock clock;
+	auto scheduler = CreateScheduler(&state, &clock);
+	//No deadline known yet.
+	CHECK_EQUAL((int64_t)CAPTURE_WAIT_DEFAULT_MAX_MICROS, scheduler->GetTimeoutMicros());
+	clock.SetNextDeadline(120000, 33333);
+	CHECK_EQUAL((int64_t)(20000 - CAPTURE_WAIT_DEFAULT_LEAD_MICROS), scheduler->GetTimeoutMicros());
+	//A deadline too close to wake up for in time is skipped in favor of the next one.
+	clock.SetNextDeadline(102500, 33333);
+	CHECK_EQUAL((int64_t)(35833 - CAPTURE_WAIT_DEFAULT_LEAD_MICROS), scheduler->GetTimeoutMicros());
+	//Far away deadlines are bounded by the maximum wait.
+	clock.SetNextDeadline(1000000, 0);
+	CHECK_EQUAL((int64_t)CAPTURE_WAIT_DEFAULT_MAX_MICROS, scheduler->GetTimeoutMicros());
+	//Without a clock, the thread only wakes up for its signals and the maximum wait.
+	CaptureWaitScheduler unclocked(std::make_unique<SimulatedWaitBackend>(&state), nullptr);
+	CHECK_EQUAL((int64_t)CAPTURE_WAIT_DEFAULT_MAX_MICROS, unclocked.GetTimeoutMicros());
+}
+
+NATIVE_TEST(IdleSourceWakesOncePerFrame)
+{
+	for (int fps : { 1, 24, 30, 60, 144 }) {
+		SimulatedWaitBackend::STATE state;
+		FrameDeadlineClock clock;
+		int64_t interval = 1000000 / fps;
+		clock.SetNextDeadline(interval, interval);
+		auto scheduler = CreateScheduler(&state, &clock);
+		//Ten seconds of a source that has no new frames.
+		while (state.Now < 10000000) {
+			CHECK(scheduler->WaitUntilDeadline(FRAME_MASK) == CaptureWakeReason::Deadline);
+		}
+		CAPTURE_WAIT_STATS stats = scheduler->GetStats();
+		double expected = (std::max)(fps, 10);
+		CHECK_NEAR(expected, stats.GetWakeupsPerSecond(), expected * 0.02 + 0.2);
+		CHECK_EQUAL(stats.GetTotalWakeups(), stats.Wakeups[(size_t)CaptureWakeReason::Deadline]);
+		//Every wakeup lands the lead time before a deadline, when it was not bounded by the maximum wait.
+		if (interval <= CAPTURE_WAIT_DEFAULT_MAX_MICROS) {
+			for (int64_t wakeTime : state.WakeTimes) {
+				CHECK_EQUAL(interval - CAPTURE_WAIT_DEFAULT_LEAD_MICROS, wakeTime % interval);
+			}
+		}
+	}
+}
+
+NATIVE_TEST(EveryDeadlineIsPrecededByWakeup)
+{
+	std::mt19937 rng(1);
+	SimulatedWaitBackend::STATE state;
+	FrameDeadlineClock clock;
+	const int64_t interval = 16667;
+	clock.SetNextDeadline(interval, interval);
+	//A 24 fps source with jitter, next to the 60 fps recorder, and an options change now and then.
+	for (int64_t time = 5000; time < 5000000; time += 41667 + rng() % 4000) {
+		state.ScheduledSignals.emplace(time, CaptureWakeReason::FrameArrived);
+	}
+	for (int64_t time = 123457; time < 5000000; time += 777777) {
+		state.ScheduledSignals.emplace(time, CaptureWakeReason::OptionsChanged);
+	}
+	auto scheduler = CreateScheduler(&state, &clock);
+	int framesCopied = 0;
+	int optionChanges = 0;
+	//When the thread woke up, and when it went back to sleep.
+	std::vector<std::pair<int64_t, int64_t>> awakeTimes;
+	while (state.Now < 5000000) {
+		CaptureWakeReason reason = scheduler->WaitUntilDeadline(FRAME_MASK);
+		int64_t wakeTime = state.Now;
+		if (reason == CaptureWakeReason::FrameArrived) {
+			//Copying the frame takes 300 us.
+			state.Now += 300;
+			CHECK_EQUAL((int64_t)300, scheduler->OnFrameCopied());
+			framesCopied++;
+		}
+		else if (reason == CaptureWakeReason::OptionsChanged) {
+			optionChanges++;
+		}
+		awakeTimes.emplace_back(wakeTime, state.Now);
+	}
+	CHECK_EQUAL(7, optionChanges);
+	CHECK(framesCopied >= 110);
+	//The thread is awake shortly before each recorder frame, whatever else woke it up in between.
+	for (int64_t deadline = 2 * interval; deadline < 4900000; deadline += interval) {
+		bool isAwake = false;
+		for (auto &awake : awakeTimes) {
+			if (awake.first <= deadline - CAPTURE_WAIT_DEFAULT_LEAD_MICROS && awake.second >= deadline - CAPTURE_WAIT_DEFAULT_LEAD_MICROS - CAPTURE_WAIT_DEFAULT_MIN_MICROS) {
+				isAwake = true;
+				break;
+			}
+		}
+		CHECK(isAwake);
+	}
+	//No wait is ever shorter than the minimum, so the thread never spins.
+	for (int64_t timeout : state.Timeouts) {
+		CHECK(timeout >= CAPTURE_WAIT_DEFAULT_MIN_MICROS);
+	}
+	CAPTURE_WAIT_STATS stats = scheduler->GetStats();
+	CHECK_EQUAL((uint64_t)framesCopied, stats.CopiedFrames);
+	CHECK_EQUAL((int64_t)300, stats.MaxWakeToCopyMicros);
+	CHECK_NEAR(0.3, stats.GetMeanWakeToCopyMillis(), 1e-9);
+}
+
+NATIVE_TEST(SignalsAreReportedInPriorityOrder)
+{
+	SimulatedWaitBackend::STATE state;
+	auto scheduler = CreateScheduler(&state, nullptr);
+	state.ScheduledSignals.emplace(500, CaptureWakeReason::FrameArrived);
+	state.ScheduledSignals.emplace(500, CaptureWakeReason::OptionsChanged);
+	state.ScheduledSignals.emplace(500, CaptureWakeReason::Terminate);
+	//A signal outside the mask does not end the wait.
+	CHECK(scheduler->WaitUntilDeadline(GetCaptureWakeMask(CaptureWakeReason::Deadline)) == CaptureWakeReason::Deadline);
+	CHECK_EQUAL((int64_t)CAPTURE_WAIT_DEFAULT_MAX_MICROS, state.Now);
+	CHECK(scheduler->Poll(FRAME_MASK) == CaptureWakeReason::Terminate);
+	CHECK(scheduler->Poll(FRAME_MASK) == CaptureWakeReason::Terminate);
+	CHECK(scheduler->Poll(GetCaptureWakeMask(CaptureWakeReason::FrameArrived) | GetCaptureWakeMask(CaptureWakeReason::OptionsChanged)) == CaptureWakeReason::OptionsChanged);
+	CHECK(scheduler->Poll(FRAME_MASK & ~GetCaptureWakeMask(CaptureWakeReason::Terminate)) == CaptureWakeReason::FrameArrived);
+	CHECK(scheduler->Poll(GetCaptureWakeMask(CaptureWakeReason::FrameArrived)) == CaptureWakeReason::Deadline);
+	//Polls do not count as wakeups.
+	CHECK_EQUAL((uint64_t)1, scheduler->GetStats().GetTotalWakeups());
+}
+
+NATIVE_TEST(IdleWaitIgnoresDeadlines)
+{
+	SimulatedWaitBackend::STATE state;
+	FrameDeadlineClock clock;
+	clock.SetNextDeadline(16667, 16667);
+	auto scheduler = CreateScheduler(&state, &clock);
+	CHECK(scheduler->WaitIdle(CAPTURE_WAKE_MASK_CONTROL) == CaptureWakeReason::Deadline);
+	CHECK_EQUAL((int64_t)CAPTURE_WAIT_DEFAULT_IDLE_MICROS, state.Now);
+	state.ScheduledSignals.emplace(state.Now + 1234, CaptureWakeReason::OptionsChanged);
+	CHECK(scheduler->WaitIdle(CAPTURE_WAKE_MASK_CONTROL) == CaptureWakeReason::OptionsChanged);
+	CHECK_EQUAL((int64_t)CAPTURE_WAIT_DEFAULT_IDLE_MICROS + 1234, state.Now);
+}
+
+NATIVE_TEST(ExternalWakeupsAndCopyLatencyAreRecorded)
+{
+	SimulatedWaitBackend::STATE state;
+	RecordingMetrics metrics;
+	auto scheduler = CreateScheduler(&state, nullptr, &metrics);
+	//Without a frame wakeup there is nothing to measure.
+	CHECK_EQUAL((int64_t)-1, scheduler->OnFrameCopied());
+	//Like the result of AcquireNextFrame, which cannot wait on the signals.
+	scheduler->OnWake(CaptureWakeReason::FrameArrived);
+	state.Now += 1500;
+	CHECK_EQUAL((int64_t)1500, scheduler->OnFrameCopied());
+	CHECK_EQUAL((int64_t)-1, scheduler->OnFrameCopied());
+	scheduler->OnWake(CaptureWakeReason::Deadline);
+	RECORDING_STATS stats = metrics.GetStats();
+	CHECK_EQUAL((uint64_t)2, stats.GetCounter(RecordingCounter::CaptureWakeups));
+	const HISTOGRAM_SNAPSHOT &timer = stats.GetTimer(RecordingTimer::CaptureWakeToCopy);
+	CHECK_EQUAL((uint64_t)1, timer.Count);
+	//Recorded in 100 ns units.
+	CHECK_NEAR(15000.0, (double)timer.Max, 15000 / 32.0 + 1);
+	CHECK_EQUAL((uint64_t)1, scheduler->GetStats().Wakeups[(size_t)CaptureWakeReason::FrameArrived]);
+}
+
+NATIVE_TEST(TerminateWakesBlockedThreadPromptly)
+{
+	ConditionWaitBackend::STATE state;
+	CaptureWaitScheduler scheduler(std::make_unique<ConditionWaitBackend>(&state), nullptr);
+	std::atomic<bool> isWaiting(false);
+	std::chrono::steady_clock::time_point wakeTime;
+	CaptureWakeReason reason = CaptureWakeReason::Count;
+	std::thread captureThread([&]() {
+		isWaiting = true;
+		reason = scheduler.WaitIdle(CAPTURE_WAKE_MASK_CONTROL);
+		wakeTime = std::chrono::steady_clock::now();
+	});
+	while (!isWaiting) {
+		std::this_thread::yield();
+	}
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	auto signalTime = std::chrono::steady_clock::now();
+	{
+		std::lock_guard<std::mutex> lock(state.Mutex);
+		state.SetSignals |= GetCaptureWakeMask(CaptureWakeReason::Terminate);
+	}
+	state.Condition.notify_all();
+	captureThread.join();
+	CHECK(reason == CaptureWakeReason::Terminate);
+	//The idle wait is 500 ms, so anything well below that was woken by the signal.
+	double wakeMillis = std::chrono::duration<double, std::milli>(wakeTime - signalTime).count();
+	CHECK(wakeMillis < 100);
+}
@@ -0,0 +1,154 @@
+#include "NativeTest.h"
+#include "CursorMaskBlender.h"
+#include <random>
+
+//Compares the cost of blending a monochrome and a masked color pointer with the background, using the per pixel loops MouseManager::ProcessMonoMask had before
+//and each kernel of CursorMaskBlender the CPU supports, for the pointer sizes of 100% to 300% display scaling.
+//The old loops are copied here unchanged, apart from taking the mapped desktop surface and the pointer info as arguments.
+
+namespace {
+	const uint32_t TRANSPARENT_WHITE = 0x00FFFFFF;
+	const uint32_t TRANSPARENT_BLACK = 0x00000000;
+	const uint32_t OPAQUE_WHITE = 0xFFFFFFFF;
+	const uint32_t OPAQUE_BLACK = 0xFF000000;
+
+	void ProcessMonoMaskOld(const uint8_t *PtrShapeBuffer, uint32_t Pitch, uint32_t ShapeHeight, const uint32_t *DesktopBuffer32, uint32_t DesktopPitchInPixels, uint32_t *InitBuffer32, int ptrWidth, int ptrHeight)
+	{
+		for (int Row = 0; Row < ptrHeight; ++Row)
+		{
+			uint8_t Mask = 0x80;
+			for (int Col = 0; Col < ptrWidth; ++Col)
+			{
+				uint8_t AndMask = PtrShapeBuffer[(Col / 8) + (Row * (Pitch))] & Mask;
+				uint8_t XorMask = PtrShapeBuffer[(Col / 8) + ((Row + (ShapeHeight / 2)) * (Pitch))] & Mask;
+				uint32_t AndMask32 = (AndMask) ? OPAQUE_WHITE : OPAQUE_BLACK;
+				uint32_t XorMask32 = (XorMask) ? TRANSPARENT_WHITE : TRANSPARENT_BLACK;
+				if (AndMask && !XorMask) {
+					InitBuffer32[(Row * ptrWidth) + Col] = TRANSPARENT_WHITE;
+				}
+				else {
+					InitBuffer32[(Row * ptrWidth) + Col] = (DesktopBuffer32[(Row * DesktopPitchInPixels) + Col] & AndMask32) ^ XorMask32;
+				}
+				if (Mask == 0x01)
+				{
+					Mask = 0x80;
+				}
+				else
+				{
+					Mask = Mask >> 1;
+				}
+			}
+		}
+	}
+
+	void ProcessMaskedColorOld(const uint8_t *PtrShapeBuffer, uint32_t Pitch, const uint32_t *DesktopBuffer32, uint32_t DesktopPitchInPixels, uint32_t *InitBuffer32, int ptrWidth, int ptrHeight)
+	{
+		const uint32_t *Buffer32 = reinterpret_cast<const uint32_t *>(PtrShapeBuffer);
+		for (int Row = 0; Row < ptrHeight; ++Row)
+		{
+			for (int Col = 0; Col < ptrWidth; ++Col)
+			{
+				uint32_t RgbValue = Buffer32[Col + (Row * (Pitch / sizeof(uint32_t)))];
+				uint32_t MaskVal = OPAQUE_BLACK & RgbValue;
+				if (MaskVal)
+				{
+					if (RgbValue == MaskVal) {
+						InitBuffer32[(Row * ptrWidth) + Col] = TRANSPARENT_WHITE;
+					}
+					else {
+						InitBuffer32[(Row * ptrWidth) + Col] = (DesktopBuffer32[(Row * DesktopPitchInPixels) + Col] ^ RgbValue) | OPAQUE_BLACK;
+					}
+				}
+				else
+				{
+					InitBuffer32[(Row * ptrWidth) + Col] = RgbValue | OPAQUE_BLACK;
+				}
+			}
+		}
+	}
+
+	const char *GetKernelName(CursorMaskBlender::Kernel kernel) {
+		switch (kernel)
+		{
+		case CursorMaskBlender::Kernel::SSE2:
+			return "SSE2";
+		case CursorMaskBlender::Kernel::AVX2:
+			return "AVX2";
+		case CursorMaskBlender::Kernel::NEON:
+			return "NEON";
+		default:
+			return "Scalar";
+		}
+	}
+}
+
+int main()
+{
+	const CursorMaskBlender::Kernel kernels[] = {
+		CursorMaskBlender::Kernel::Scalar,
+		CursorMaskBlender::Kernel::SSE2,
+		CursorMaskBlender::Kernel::AVX2,
+		CursorMaskBlender::Kernel::NEON
+	};
+	printf("%-24s %14s", "Pointer", "old ns/blend");
+	for (CursorMaskBlender::Kernel kernel : kernels) {
+		if (CursorMaskBlender::IsKernelSupported(kernel)) {
+			printf(" %14s", GetKernelName(kernel));
+		}
+	}
+	printf(" %10s\n", "speedup");
+	for (bool isMonochrome : { true, false }) {
+		for (uint32_t size : { 32u, 48u, 64u, 96u }) {
+			uint32_t pitch = isMonochrome ? (size + 31) / 32 * 4 : size * 4;
+			std::vector<uint8_t> shape(static_cast<size_t>(pitch) * size * (isMonochrome ? 2 : 1));
+			std::vector<uint32_t> desktop(static_cast<size_t>(size) * size);
+			std::vector<uint32_t> output(desktop.size());
+			std::mt19937 random(size);
+			for (uint8_t &byte : shape) {
+				byte = static_cast<uint8_t>(random());
+			}
+			for (uint32_t &pixel : desktop) {
+				pixel = static_cast<uint32_t>(random());
+			}
+			double oldMillis = MeasureMillisPerCall([&]() {
+				if (isMonochrome) {
+					ProcessMonoMaskOld(shape.data(), pitch, size * 2, desktop.data(), size, output.data(), (int)size, (int)size);
+				}
+				else {
+					ProcessMaskedColorOld(shape.data(), pitch, desktop.data(), size, output.data(), (int)size, (int)size);
+				}
+			});
+			CURSOR_MASK_BLEND blend{};
+			blend.pShape = shape.data();
+			blend.ShapePitch = pitch;
+			blend.XorMaskOffset = pitch * size;
+			blend.pBackground = desktop.data();
+			blend.BackgroundPitch = size;
+			blend.pOutput = output.data();
+			blend.OutputPitch = size;
+			blend.Width = size;
+			blend.Height = size;
+			char name[64];
+			snprintf(name, sizeof(name), "%s %ux%u", isMonochrome ? "monochrome" : "masked color", size, size);
+			printf("%-24s %14.1f", name, oldMillis * 1e6);
+			double bestMillis = oldMillis;
+			for (CursorMaskBlender::Kernel kernel : kernels) {
+				if (!CursorMaskBlender::IsKernelSupported(kernel)) {
+					continue;
+				}
+				double millis = MeasureMillisPerCall([&]() {
+					if (isMonochrome) {
+						CursorMaskBlender::BlendMonochrome(kernel, blend);
+					}
+					else {
+						CursorMaskBlender::BlendMaskedColor(kernel, blend);
+					}
+				});
+				bestMillis = (std::min)(bestMillis, millis);
+				printf(" %14.1f", millis * 1e6);
+			}
+			printf(" %9.1fx\n", oldMillis / bestMillis);
+		}
+	}
+	return 0;
+}
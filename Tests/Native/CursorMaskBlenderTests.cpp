@@ -0,0 +1,291 @@
+#include "NativeTest.h"
+#include "CursorMaskBlender.h"
+#include <algorithm>
+#include <random>
+
+namespace {
+	const uint32_t TRANSPARENT_WHITE = 0x00FFFFFF;
+	const uint32_t TRANSPARENT_BLACK = 0x00000000;
+	const uint32_t OPAQUE_WHITE = 0xFFFFFFFF;
+	const uint32_t OPAQUE_BLACK = 0xFF000000;
+	//Written around the blended area, to catch kernels writing past its edges.
+	const uint32_t GUARD = 0xDEADBEEF;
+
+	const CursorMaskBlender::Kernel ALL_KERNELS[] = {
+		CursorMaskBlender::Kernel::Scalar,
+		CursorMaskBlender::Kernel::SSE2,
+		CursorMaskBlender::Kernel::AVX2,
+		CursorMaskBlender::Kernel::NEON
+	};
+
+	/// <summary>
+	/// The monochrome loop of MouseManager::ProcessMonoMask before the blender replaced it, with the mapped desktop surface and the pointer info as arguments.
+	/// </summary>
+	void ProcessMonoMaskReference(const uint8_t *PtrShapeBuffer, uint32_t Pitch, uint32_t ShapeHeight, uint32_t SkipX, uint32_t SkipY,
+		const uint32_t *DesktopBuffer32, uint32_t DesktopPitchInPixels, uint32_t *InitBuffer32, int ptrWidth, int ptrHeight)
+	{
+		for (int Row = 0; Row < ptrHeight; ++Row)
+		{
+			// Set mask
+			uint8_t Mask = 0x80;
+			Mask = Mask >> (SkipX % 8);
+			for (int Col = 0; Col < ptrWidth; ++Col)
+			{
+				// Get masks using appropriate offsets
+				uint8_t AndMask = PtrShapeBuffer[((Col + SkipX) / 8) + ((Row + SkipY) * (Pitch))] & Mask;
+				uint8_t XorMask = PtrShapeBuffer[((Col + SkipX) / 8) + ((Row + SkipY + (ShapeHeight / 2)) * (Pitch))] & Mask;
+				uint32_t AndMask32 = (AndMask) ? OPAQUE_WHITE : OPAQUE_BLACK;
+				uint32_t XorMask32 = (XorMask) ? TRANSPARENT_WHITE : TRANSPARENT_BLACK;
+
+				if (AndMask && !XorMask) {
+					InitBuffer32[(Row * ptrWidth) + Col] = TRANSPARENT_WHITE;
+				}
+				else {
+					// Set new pixel with background from desktop
+					InitBuffer32[(Row * ptrWidth) + Col] = (DesktopBuffer32[(Row * DesktopPitchInPixels) + Col] & AndMask32) ^ XorMask32;
+				}
+
+				// Adjust mask
+				if (Mask == 0x01)
+				{
+					Mask = 0x80;
+				}
+				else
+				{
+					Mask = Mask >> 1;
+				}
+			}
+		}
+	}
+
+	/// <summary>
+	/// The masked color loop of MouseManager::ProcessMonoMask before the blender replaced it.
+	/// </summary>
+	void ProcessMaskedColorReference(const uint8_t *PtrShapeBuffer, uint32_t Pitch, uint32_t SkipX, uint32_t SkipY,
+		const uint32_t *DesktopBuffer32, uint32_t DesktopPitchInPixels, uint32_t *InitBuffer32, int ptrWidth, int ptrHeight)
+	{
+		const uint32_t *Buffer32 = reinterpret_cast<const uint32_t *>(PtrShapeBuffer);
+
+		// Iterate through pixels
+		for (int Row = 0; Row < ptrHeight; ++Row)
+		{
+			for (int Col = 0; Col < ptrWidth; ++Col)
+			{
+				uint32_t RgbValue = Buffer32[(Col + SkipX) + ((Row + SkipY) * (Pitch / sizeof(uint32_t)))];
+				// Set up mask
+				uint32_t MaskVal = OPAQUE_BLACK & RgbValue;
+				if (MaskVal)
+				{
+					// Mask was 0xFF
+					if (RgbValue == MaskVal) {
+						InitBuffer32[(Row * ptrWidth) + Col] = TRANSPARENT_WHITE;
+					}
+					else {
+						InitBuffer32[(Row * ptrWidth) + Col] = (DesktopBuffer32[(Row * DesktopPitchInPixels) + Col] ^ RgbValue) | OPAQUE_BLACK;
+					}
+				}
+				else
+				{
+					// Mask was 0x00
+					InitBuffer32[(Row * ptrWidth) + Col] = RgbValue | OPAQUE_BLACK;
+				}
+			}
+		}
+	}
+
+	/// <summary>
+	/// A pointer partly off the desktop: the shape, the desktop under the visible part, and the position of the visible part in the shape.
+	/// </summary>
+	struct BLEND_CASE {
+		uint32_t Width;
+		uint32_t Height;
+		uint32_t Pitch;
+		uint32_t SkipX;
+		uint32_t SkipY;
+		uint32_t VisibleWidth;
+		uint32_t VisibleHeight;
+		uint32_t DesktopPitch;
+		std::vector<uint8_t> Shape;
+		std::vector<uint32_t> Desktop;
+	};
+
+	uint32_t RandomMaskedColorPixel(std::mt19937 &random) {
+		//Every kind of pixel: opaque color, transparent white, XOR with white, and XOR with another color, with random alpha below the mask.
+		switch (random() % 4)
+		{
+		case 0:
+			return random() & 0x00FFFFFF;
+		case 1:
+			return OPAQUE_BLACK;
+		case 2:
+			return OPAQUE_WHITE;
+		default:
+			return static_cast<uint32_t>(random()) | OPAQUE_BLACK;
+		}
+	}
+
+	BLEND_CASE MakeCase(bool isMonochrome, uint32_t width, uint32_t height, uint32_t skipX, uint32_t skipY, uint32_t seed) {
+		std::mt19937 random(seed);
+		BLEND_CASE blendCase{};
+		blendCase.Width = width;
+		blendCase.Height = height;
+		//Pitches are padded like the shapes GetPointerShape returns, e.g. to a multiple of 4 bytes, and sometimes more.
+		uint32_t minPitch = isMonochrome ? (width + 7) / 8 : width * 4;
+		blendCase.Pitch = (minPitch + 3) / 4 * 4 + (random() % 3) * 4;
+		blendCase.SkipX = skipX;
+		blendCase.SkipY = skipY;
+		blendCase.VisibleWidth = width - skipX;
+		blendCase.VisibleHeight = height - skipY;
+		blendCase.DesktopPitch = blendCase.VisibleWidth + random() % 9;
+		blendCase.Shape.resize(static_cast<size_t>(blendCase.Pitch) * height * (isMonochrome ? 2 : 1));
+		if (isMonochrome) {
+			for (uint8_t &byte : blendCase.Shape) {
+				byte = static_cast<uint8_t>(random());
+			}
+		}
+		else {
+			for (size_t i = 0; i + 4 <= blendCase.Shape.size(); i += 4) {
+				uint32_t pixel = RandomMaskedColorPixel(random);
+				memcpy(&blendCase.Shape[i], &pixel, sizeof(pixel));
+			}
+		}
+		blendCase.Desktop.resize(static_cast<size_t>(blendCase.DesktopPitch) * blendCase.VisibleHeight);
+		for (uint32_t &pixel : blendCase.Desktop) {
+			pixel = static_cast<uint32_t>(random());
+		}
+		return blendCase;
+	}
+
+	/// <summary>
+	/// Blends the case with the kernel into an output with guard pixels around it, and compares every pixel with the old loops.
+	/// </summary>
+	/// <returns>The number of pixels that differ, including guard pixels overwritten</returns>
+	size_t CompareWithReference(bool isMonochrome, CursorMaskBlender::Kernel kernel, const BLEND_CASE &blendCase) {
+		uint32_t width = blendCase.VisibleWidth;
+		uint32_t height = blendCase.VisibleHeight;
+		std::vector<uint32_t> expected(static_cast<size_t>(width) * height);
+		if (isMonochrome) {
+			ProcessMonoMaskReference(blendCase.Shape.data(), blendCase.Pitch, blendCase.Height * 2, blendCase.SkipX, blendCase.SkipY,
+				blendCase.Desktop.data(), blendCase.DesktopPitch, expected.data(), (int)width, (int)height);
+		}
+		else {
+			ProcessMaskedColorReference(blendCase.Shape.data(), blendCase.Pitch, blendCase.SkipX, blendCase.SkipY,
+				blendCase.Desktop.data(), blendCase.DesktopPitch, expected.data(), (int)width, (int)height);
+		}
+		//A pixel of guard on every side, and an output pitch wider than the area.
+		uint32_t outputPitch = width + 3;
+		std::vector<uint32_t> output(static_cast<size_t>(outputPitch) * (height + 2), GUARD);
+		CURSOR_MASK_BLEND blend{};
+		blend.pShape = blendCase.Shape.data();
+		blend.ShapePitch = blendCase.Pitch;
+		blend.XorMaskOffset = blendCase.Pitch * blendCase.Height;
+		blend.ShapeLeft = blendCase.SkipX;
+		blend.ShapeTop = blendCase.SkipY;
+		blend.pBackground = blendCase.Desktop.data();
+		blend.BackgroundPitch = blendCase.DesktopPitch;
+		blend.pOutput = output.data() + outputPitch + 1;
+		blend.OutputPitch = outputPitch;
+		blend.Width = width;
+		blend.Height = height;
+		if (isMonochrome) {
+			CursorMaskBlender::BlendMonochrome(kernel, blend);
+		}
+		else {
+			CursorMaskBlender::BlendMaskedColor(kernel, blend);
+		}
+		size_t differences = 0;
+		for (uint32_t row = 0; row < height + 2; row++) {
+			for (uint32_t col = 0; col < outputPitch; col++) {
+				bool isInside = row >= 1 && row <= height && col >= 1 && col <= width;
+				uint32_t want = isInside ? expected[static_cast<size_t>(row - 1) * width + col - 1] : GUARD;
+				differences += output[static_cast<size_t>(row) * outputPitch + col] != want ? 1 : 0;
+			}
+		}
+		return differences;
+	}
+
+	/// <summary>
+	/// Runs every width from 1 to 80 pixels, so every kernel goes through its vector loop and its scalar tail, and every start bit of the mask.
+	/// </summary>
+	void CompareAllShapes(bool isMonochrome) {
+		for (CursorMaskBlender::Kernel kernel : ALL_KERNELS) {
+			if (!CursorMaskBlender::IsKernelSupported(kernel)) {
+				continue;
+			}
+			uint32_t seed = 0;
+			for (uint32_t width = 1; width <= 80; width++) {
+				for (uint32_t skipX = 0; skipX < (std::min)(width, 17u); skipX++) {
+					uint32_t height = 1 + seed % 7;
+					uint32_t skipY = seed % height;
+					BLEND_CASE blendCase = MakeCase(isMonochrome, width, height, skipX, skipY, seed++);
+					size_t differences = CompareWithReference(isMonochrome, kernel, blendCase);
+					if (differences > 0) {
+						printf("       Kernel %d, width %u, skip %u,%u: %zu pixels differ\n", (int)kernel, width, skipX, skipY, differences);
+						CHECK_EQUAL((size_t)0, differences);
+					}
+				}
+			}
+		}
+	}
+}
+
+NATIVE_TEST(MonochromeKernelsMatchTheOldLoopBitForBit)
+{
+	CompareAllShapes(true);
+}
+
+NATIVE_TEST(MaskedColorKernelsMatchTheOldLoopBitForBit)
+{
+	CompareAllShapes(false);
+}
+
+NATIVE_TEST(KernelsMatchTheOldLoopsForFullSizePointers)
+{
+	//The sizes of pointers at 100% to 300% display scaling, fully on the desktop.
+	for (CursorMaskBlender::Kernel kernel : ALL_KERNELS) {
+		if (!CursorMaskBlender::IsKernelSupported(kernel)) {
+			continue;
+		}
+		for (uint32_t size : { 32u, 48u, 64u, 96u, 128u, 256u }) {
+			CHECK_EQUAL((size_t)0, CompareWithReference(true, kernel, MakeCase(true, size, size, 0, 0, size)));
+			CHECK_EQUAL((size_t)0, CompareWithReference(false, kernel, MakeCase(false, size, size, 0, 0, size)));
+		}
+	}
+}
+
+NATIVE_TEST(MonochromePixelsFollowTheDrawingRules)
+{
+	//AND 0 XOR 0 is black, AND 0 XOR 1 is white, AND 1 XOR 0 leaves the background, and AND 1 XOR 1 inverts it, keeping the alpha of the background.
+	const uint8_t shape[2] = { 0x30, 0x50 };
+	const uint32_t background[4] = { 0x80123456, 0x80123456, 0x80123456, 0x80123456 };
+	for (CursorMaskBlender::Kernel kernel : ALL_KERNELS) {
+		uint32_t output[4] = {};
+		CURSOR_MASK_BLEND blend{};
+		blend.pShape = shape;
+		blend.ShapePitch = 1;
+		blend.XorMaskOffset = 1;
+		blend.pBackground = background;
+		blend.BackgroundPitch = 4;
+		blend.pOutput = output;
+		blend.OutputPitch = 4;
+		blend.Width = 4;
+		blend.Height = 1;
+		CursorMaskBlender::BlendMonochrome(kernel, blend);
+		CHECK_EQUAL(0x80000000u, output[0]);
+		CHECK_EQUAL(0x80FFFFFFu, output[1]);
+		CHECK_EQUAL(TRANSPARENT_WHITE, output[2]);
+		CHECK_EQUAL(0x80EDCBA9u, output[3]);
+	}
+}
+
+NATIVE_TEST(UnsupportedKernelsFallBackToTheBestOne)
+{
+	CHECK(CursorMaskBlender::IsKernelSupported(CursorMaskBlender::Kernel::Scalar));
+	CHECK(CursorMaskBlender::IsKernelSupported(CursorMaskBlender::GetBestKernel()));
+	for (CursorMaskBlender::Kernel kernel : ALL_KERNELS) {
+		if (!CursorMaskBlender::IsKernelSupported(kernel)) {
+			CHECK_EQUAL((size_t)0, CompareWithReference(true, kernel, MakeCase(true, 45, 9, 3, 2, 1)));
+			CHECK_EQUAL((size_t)0, CompareWithReference(false, kernel, MakeCase(false, 45, 9, 3, 2, 1)));
+		}
+	}
+}
@@ -0,0 +1,113 @@
+#include "NativeTest.h"
+#include "CursorShapeCache.h"
+#include <random>
+
+//Compares the cost of drawing a pointer from the cursor shape cache with converting its shape on every frame, as MouseManager did before,
+//for the pointer sizes of 100% to 300% display scaling. Uploading the converted pixels to a new texture came on top of the conversion, and is not measured here,
+//so for color pointers, which are only copied, hashing the shape costs more than the copy it saves.
+//Then replays a session of pointer changes to show the hit rate and evictions of the cache at different capacities.
+
+namespace {
+	struct BENCHMARK_SHAPE {
+		CURSOR_SHAPE_KEY Key;
+		std::vector<uint8_t> Buffer;
+	};
+
+	BENCHMARK_SHAPE MakeShape(uint32_t type, uint32_t size, uint32_t seed) {
+		BENCHMARK_SHAPE shape;
+		shape.Key.Type = type;
+		shape.Key.Width = size;
+		shape.Key.Height = type == CURSOR_SHAPE_TYPE_MONOCHROME ? size * 2 : size;
+		shape.Key.Pitch = type == CURSOR_SHAPE_TYPE_MONOCHROME ? (size + 31) / 32 * 4 : size * 4;
+		shape.Buffer.resize(shape.Key.GetShapeSize());
+		std::mt19937 random(seed);
+		for (size_t i = 0; i < shape.Buffer.size(); i++) {
+			shape.Buffer[i] = static_cast<uint8_t>(random());
+		}
+		if (type == CURSOR_SHAPE_TYPE_MASKED_COLOR) {
+			//Only fully opaque or fully transparent pixels, so the shape converts.
+			for (size_t i = 3; i < shape.Buffer.size(); i += 4) {
+				shape.Buffer[i] = 0;
+			}
+		}
+		shape.Key.Hash = HashCursorShape(shape.Buffer.data(), shape.Buffer.size());
+		return shape;
+	}
+
+	const char *GetTypeName(uint32_t type) {
+		switch (type)
+		{
+		case CURSOR_SHAPE_TYPE_MONOCHROME:
+			return "monochrome";
+		case CURSOR_SHAPE_TYPE_COLOR:
+			return "color";
+		default:
+			return "masked color";
+		}
+	}
+}
+
+int main()
+{
+	printf("%-24s %16s %16s %10s\n", "Pointer", "convert ns/draw", "cached ns/draw", "speedup");
+	const uint32_t types[] = { CURSOR_SHAPE_TYPE_MONOCHROME, CURSOR_SHAPE_TYPE_MASKED_COLOR, CURSOR_SHAPE_TYPE_COLOR };
+	for (uint32_t type : types) {
+		for (uint32_t size : { 32u, 48u, 64u, 96u }) {
+			BENCHMARK_SHAPE shape = MakeShape(type, size, size);
+			std::vector<uint32_t> pixels(static_cast<size_t>(size) * size);
+			std::vector<uint32_t> invertMask(pixels.size());
+			double convertMillis = MeasureMillisPerCall([&]() {
+				ConvertCursorShape(shape.Key, shape.Buffer.data(), pixels.data(), invertMask.data());
+			});
+			CursorShapeCache<int> cache(16);
+			cache.Insert(shape.Key, shape.Buffer.data(), 1);
+			double cachedMillis = MeasureMillisPerCall([&]() {
+				CURSOR_SHAPE_KEY key = shape.Key;
+				key.Hash = HashCursorShape(shape.Buffer.data(), shape.Buffer.size());
+				int resource;
+				cache.Find(key, shape.Buffer.data(), &resource);
+			});
+			char name[64];
+			snprintf(name, sizeof(name), "%s %ux%u", GetTypeName(type), size, size);
+			printf("%-24s %16.1f %16.1f %9.1fx\n", name, convertMillis * 1e6, cachedMillis * 1e6, convertMillis / cachedMillis);
+		}
+	}
+
+	//An hour at 30 fps, switching between the arrow, the text pointer, the hand and the resize pointers, with now and then a busy pointer animated over 18 frames.
+	std::vector<BENCHMARK_SHAPE> shapes;
+	for (uint32_t i = 0; i < 6; i++) {
+		shapes.push_back(MakeShape(CURSOR_SHAPE_TYPE_MASKED_COLOR, 32, 100 + i));
+	}
+	for (uint32_t i = 0; i < 18; i++) {
+		shapes.push_back(MakeShape(CURSOR_SHAPE_TYPE_COLOR, 32, 200 + i));
+	}
+	printf("\n%-24s %12s %12s %12s\n", "Session, 108000 draws", "hit rate", "conversions", "evictions");
+	for (size_t capacity : { 4, 8, 16, 32 }) {
+		CursorShapeCache<int> cache(capacity);
+		std::mt19937 random(1);
+		size_t current = 0;
+		uint32_t busyFrames = 0;
+		for (uint32_t frame = 0; frame < 108000; frame++) {
+			if (busyFrames > 0) {
+				current = 6 + (busyFrames-- / 2) % 18;
+			}
+			else if (random() % 90 == 0) {
+				//The pointer moves over something else about every 3 seconds.
+				current = random() % 6;
+				if (random() % 10 == 0) {
+					busyFrames = 90;
+				}
+			}
+			const BENCHMARK_SHAPE &shape = shapes[current];
+			int resource;
+			if (!cache.Find(shape.Key, shape.Buffer.data(), &resource)) {
+				cache.Insert(shape.Key, shape.Buffer.data(), (int)current);
+			}
+		}
+		CURSOR_SHAPE_CACHE_STATS stats = cache.GetStats();
+		char name[64];
+		snprintf(name, sizeof(name), "Capacity %zu", capacity);
+		printf("%-24s %11.2f%% %12llu %12llu\n", name, stats.GetHitRate() * 100, (unsigned long long)stats.Misses, (unsigned long long)stats.Evictions);
+	}
+	return 0;
+}
@@ -0,0 +1,304 @@
+#include "NativeTest.h"
+#include "CursorShapeCache.h"
+#include <atomic>
+#include <memory>
+#include <random>
+#include <thread>
+#include <unordered_set>
+
+namespace {
+	/// <summary>
+	/// A pointer shape buffer and the key describing it, as MouseManager builds them from DXGI_OUTDUPL_POINTER_SHAPE_INFO.
+	/// </summary>
+	struct TEST_SHAPE {
+		CURSOR_SHAPE_KEY Key;
+		std::vector<uint8_t> Buffer;
+	};
+
+	TEST_SHAPE MakeShape(uint32_t type, uint32_t width, uint32_t height, uint32_t pitch, uint32_t seed) {
+		TEST_SHAPE shape;
+		shape.Key.Type = type;
+		shape.Key.Width = width;
+		shape.Key.Height = height;
+		shape.Key.Pitch = pitch;
+		shape.Buffer.resize(shape.Key.GetShapeSize());
+		std::mt19937 random(seed);
+		for (uint8_t &byte : shape.Buffer) {
+			byte = static_cast<uint8_t>(random());
+		}
+		shape.Key.Hash = HashCursorShape(shape.Buffer.data(), shape.Buffer.size());
+		return shape;
+	}
+
+	TEST_SHAPE MakeColorShape(uint32_t size, uint32_t seed) {
+		return MakeShape(CURSOR_SHAPE_TYPE_COLOR, size, size, size * 4, seed);
+	}
+
+	int PopCount(uint64_t value) {
+		int count = 0;
+		for (; value; value &= value - 1) {
+			count++;
+		}
+		return count;
+	}
+
+	/// <summary>
+	/// Counts the resources alive, to tell when the cache frees them.
+	/// </summary>
+	struct COUNTED_RESOURCE {
+		std::shared_ptr<int> Alive;
+		int Id = 0;
+	};
+}
+
+NATIVE_TEST(HashDependsOnEveryBitOfTheShape)
+{
+	TEST_SHAPE shape = MakeColorShape(32, 1);
+	uint64_t hash = HashCursorShape(shape.Buffer.data(), shape.Buffer.size());
+	CHECK_EQUAL(hash, HashCursorShape(shape.Buffer.data(), shape.Buffer.size()));
+	std::unordered_set<uint64_t> hashes{ hash };
+	double totalChangedBits = 0;
+	for (size_t i = 0; i < shape.Buffer.size(); i++) {
+		for (int bit = 0; bit < 8; bit++) {
+			shape.Buffer[i] ^= static_cast<uint8_t>(1 << bit);
+			uint64_t flipped = HashCursorShape(shape.Buffer.data(), shape.Buffer.size());
+			shape.Buffer[i] ^= static_cast<uint8_t>(1 << bit);
+			hashes.insert(flipped);
+			totalChangedBits += PopCount(hash ^ flipped);
+		}
+	}
+	//Every single bit change gives a hash of its own, and changes about half the bits of the hash.
+	CHECK_EQUAL(shape.Buffer.size() * 8 + 1, hashes.size());
+	CHECK_NEAR(32, totalChangedBits / (shape.Buffer.size() * 8), 1);
+}
+
+NATIVE_TEST(HashCoversTheBytesAfterTheLastWholeWord)
+{
+	//Monochrome shapes of odd widths have buffers that are not a multiple of eight bytes.
+	std::vector<uint8_t> buffer(61, 0x5A);
+	uint64_t hash = HashCursorShape(buffer.data(), buffer.size());
+	for (size_t i = 56; i < buffer.size(); i++) {
+		buffer[i] ^= 1;
+		CHECK(HashCursorShape(buffer.data(), buffer.size()) != hash);
+		buffer[i] ^= 1;
+	}
+	CHECK(HashCursorShape(buffer.data(), buffer.size() - 1) != hash);
+	CHECK(HashCursorShape(buffer.data(), 0) != HashCursorShape(buffer.data(), 1));
+}
+
+NATIVE_TEST(HashDoesNotDependOnTheAlignmentOfTheBuffer)
+{
+	TEST_SHAPE shape = MakeColorShape(48, 2);
+	std::vector<uint8_t> unaligned(shape.Buffer.size() + 3);
+	for (size_t offset = 0; offset < 4; offset++) {
+		std::copy(shape.Buffer.begin(), shape.Buffer.end(), unaligned.begin() + offset);
+		CHECK_EQUAL(shape.Key.Hash, HashCursorShape(unaligned.data() + offset, shape.Buffer.size()));
+	}
+}
+
+NATIVE_TEST(DistinctPointersGetDistinctHashes)
+{
+	std::unordered_set<uint64_t> hashes;
+	const uint32_t shapes = 20000;
+	for (uint32_t seed = 0; seed < shapes; seed++) {
+		hashes.insert(MakeShape(CURSOR_SHAPE_TYPE_MONOCHROME, 32, 64, 4, seed).Key.Hash);
+	}
+	CHECK_EQUAL((size_t)shapes, hashes.size());
+}
+
+NATIVE_TEST(CachedShapesAreFoundAndCountedAsHits)
+{
+	CursorShapeCache<int> cache(4);
+	TEST_SHAPE arrow = MakeColorShape(32, 1);
+	TEST_SHAPE beam = MakeShape(CURSOR_SHAPE_TYPE_MONOCHROME, 32, 64, 4, 2);
+	int resource = 0;
+	CHECK(!cache.Find(arrow.Key, arrow.Buffer.data(), &resource));
+	cache.Insert(arrow.Key, arrow.Buffer.data(), 1);
+	CHECK(!cache.Find(beam.Key, beam.Buffer.data(), &resource));
+	cache.Insert(beam.Key, beam.Buffer.data(), 2);
+	for (int i = 0; i < 98; i++) {
+		const TEST_SHAPE &shape = i % 2 == 0 ? arrow : beam;
+		CHECK(cache.Find(shape.Key, shape.Buffer.data(), &resource));
+		CHECK_EQUAL(i % 2 == 0 ? 1 : 2, resource);
+	}
+	CURSOR_SHAPE_CACHE_STATS stats = cache.GetStats();
+	CHECK_EQUAL((uint64_t)98, stats.Hits);
+	CHECK_EQUAL((uint64_t)2, stats.Misses);
+	CHECK_EQUAL((uint64_t)0, stats.Evictions);
+	CHECK_EQUAL((size_t)2, stats.Entries);
+	CHECK_NEAR(0.98, stats.GetHitRate(), 1e-9);
+}
+
+NATIVE_TEST(ShapesWithTheSameHashAreToldApartByTheirBytes)
+{
+	CursorShapeCache<int> cache(4);
+	TEST_SHAPE first = MakeColorShape(32, 1);
+	TEST_SHAPE second = MakeColorShape(32, 2);
+	//Force a collision, as if two shapes had the same hash.
+	second.Key.Hash = first.Key.Hash;
+	cache.Insert(first.Key, first.Buffer.data(), 1);
+	int resource = 0;
+	CHECK(!cache.Find(second.Key, second.Buffer.data(), &resource));
+	cache.Insert(second.Key, second.Buffer.data(), 2);
+	CHECK(cache.Find(first.Key, first.Buffer.data(), &resource));
+	CHECK_EQUAL(1, resource);
+	CHECK(cache.Find(second.Key, second.Buffer.data(), &resource));
+	CHECK_EQUAL(2, resource);
+	CHECK_EQUAL((size_t)2, cache.GetStats().Entries);
+}
+
+NATIVE_TEST(SameShapeAtAnotherScaleOrPitchIsCachedSeparately)
+{
+	CursorShapeCache<int> cache(4);
+	TEST_SHAPE shape = MakeColorShape(32, 1);
+	cache.Insert(shape.Key, shape.Buffer.data(), 1);
+	int resource = 0;
+	CURSOR_SHAPE_KEY scaled = shape.Key;
+	scaled.ScaleX = 1.5f;
+	scaled.ScaleY = 1.5f;
+	CHECK(!cache.Find(scaled, shape.Buffer.data(), &resource));
+	CURSOR_SHAPE_KEY otherType = shape.Key;
+	otherType.Type = CURSOR_SHAPE_TYPE_MASKED_COLOR;
+	CHECK(!cache.Find(otherType, shape.Buffer.data(), &resource));
+	CURSOR_SHAPE_KEY narrower = shape.Key;
+	narrower.Width = 31;
+	CHECK(!cache.Find(narrower, shape.Buffer.data(), &resource));
+	CHECK(cache.Find(shape.Key, shape.Buffer.data(), &resource));
+}
+
+NATIVE_TEST(LeastRecentlyDrawnPointerIsEvictedFirst)
+{
+	CursorShapeCache<int> cache(3);
+	std::vector<TEST_SHAPE> shapes;
+	for (uint32_t i = 0; i < 5; i++) {
+		shapes.push_back(MakeColorShape(32, i));
+	}
+	int resource = 0;
+	for (int i = 0; i < 3; i++) {
+		cache.Insert(shapes[i].Key, shapes[i].Buffer.data(), i);
+	}
+	//Drawing the first pointer again makes the second the least recently drawn.
+	CHECK(cache.Find(shapes[0].Key, shapes[0].Buffer.data(), &resource));
+	cache.Insert(shapes[3].Key, shapes[3].Buffer.data(), 3);
+	CHECK(!cache.Find(shapes[1].Key, shapes[1].Buffer.data(), &resource));
+	CHECK(cache.Find(shapes[0].Key, shapes[0].Buffer.data(), &resource));
+	CHECK(cache.Find(shapes[2].Key, shapes[2].Buffer.data(), &resource));
+	CHECK(cache.Find(shapes[3].Key, shapes[3].Buffer.data(), &resource));
+	//Now the first pointer is the least recently drawn.
+	cache.Insert(shapes[4].Key, shapes[4].Buffer.data(), 4);
+	CHECK(!cache.Find(shapes[0].Key, shapes[0].Buffer.data(), &resource));
+	CURSOR_SHAPE_CACHE_STATS stats = cache.GetStats();
+	CHECK_EQUAL((uint64_t)2, stats.Evictions);
+	CHECK_EQUAL((size_t)3, stats.Entries);
+}
+
+NATIVE_TEST(EvictedAndClearedResourcesAreFreed)
+{
+	std::shared_ptr<int> alive = std::make_shared<int>(0);
+	CursorShapeCache<COUNTED_RESOURCE> cache(2);
+	for (uint32_t i = 0; i < 10; i++) {
+		TEST_SHAPE shape = MakeColorShape(16, i);
+		cache.Insert(shape.Key, shape.Buffer.data(), COUNTED_RESOURCE{ alive, (int)i });
+		//The cache holds at most its capacity, and the counter itself holds one more reference.
+		CHECK_EQUAL((long)(std::min)(i + 1, 2u) + 1, alive.use_count());
+	}
+	CHECK_EQUAL((uint64_t)8, cache.GetStats().Evictions);
+	cache.Clear();
+	CHECK_EQUAL(1L, alive.use_count());
+	CHECK_EQUAL((size_t)0, cache.GetStats().Entries);
+}
+
+NATIVE_TEST(ShapesThatCannotBeConvertedAreCachedAsEmptyResources)
+{
+	//A pointer XORing the background with a color other than white cannot be converted, and is remembered as such.
+	TEST_SHAPE shape = MakeShape(CURSOR_SHAPE_TYPE_MASKED_COLOR, 4, 1, 16, 1);
+	uint32_t values[] = { 0x00000000, 0xFF000000, 0xFF123456, 0x00FF0000 };
+	memcpy(shape.Buffer.data(), values, sizeof(values));
+	shape.Key.Hash = HashCursorShape(shape.Buffer.data(), shape.Buffer.size());
+	uint32_t pixels[4];
+	uint32_t invertMask[4];
+	CHECK(!ConvertCursorShape(shape.Key, shape.Buffer.data(), pixels, invertMask));
+	CursorShapeCache<COUNTED_RESOURCE> cache(4);
+	cache.Insert(shape.Key, shape.Buffer.data(), COUNTED_RESOURCE{});
+	COUNTED_RESOURCE resource{ std::make_shared<int>(0), 7 };
+	CHECK(cache.Find(shape.Key, shape.Buffer.data(), &resource));
+	CHECK(!resource.Alive);
+}
+
+NATIVE_TEST(ZeroCapacityKeepsOnePointer)
+{
+	CursorShapeCache<int> cache(0);
+	TEST_SHAPE first = MakeColorShape(8, 1);
+	TEST_SHAPE second = MakeColorShape(8, 2);
+	int resource = 0;
+	cache.Insert(first.Key, first.Buffer.data(), 1);
+	CHECK(cache.Find(first.Key, first.Buffer.data(), &resource));
+	cache.Insert(second.Key, second.Buffer.data(), 2);
+	CHECK(!cache.Find(first.Key, first.Buffer.data(), &resource));
+	CHECK(cache.Find(second.Key, second.Buffer.data(), &resource));
+	CHECK_EQUAL(2, resource);
+}
+
+NATIVE_TEST(CacheCanBeUsedFromSeveralThreads)
+{
+	//The recorder thread draws pointers while the capture thread may clear the cache when the device is lost.
+	CursorShapeCache<int> cache(8);
+	std::vector<TEST_SHAPE> shapes;
+	for (uint32_t i = 0; i < 12; i++) {
+		shapes.push_back(MakeColorShape(16, i));
+	}
+	std::atomic<uint64_t> wrongResources{ 0 };
+	std::vector<std::thread> threads;
+	for (int t = 0; t < 4; t++) {
+		threads.emplace_back([&, t]() {
+			for (int i = 0; i < 20000; i++) {
+				size_t index = (i * 7 + t) % shapes.size();
+				int resource = -1;
+				if (cache.Find(shapes[index].Key, shapes[index].Buffer.data(), &resource)) {
+					if (resource != (int)index) {
+						wrongResources++;
+					}
+				}
+				else {
+					cache.Insert(shapes[index].Key, shapes[index].Buffer.data(), (int)index);
+				}
+				if (t == 0 && i % 5000 == 4999) {
+					cache.Clear();
+				}
+			}
+		});
+	}
+	for (std::thread &thread : threads) {
+		thread.join();
+	}
+	CHECK_EQUAL((uint64_t)0, wrongResources.load());
+	CURSOR_SHAPE_CACHE_STATS stats = cache.GetStats();
+	CHECK_EQUAL((uint64_t)80000, stats.Hits + stats.Misses);
+	CHECK(stats.Entries <= 8);
+}
+
+NATIVE_TEST(MonochromeShapesConvertToTransparentBlackWhiteAndInvertedPixels)
+{
+	//One row of 4 pixels: AND 0 XOR 0 is black, AND 0 XOR 1 is white, AND 1 XOR 0 leaves the background, AND 1 XOR 1 inverts it.
+	CURSOR_SHAPE_KEY key{};
+	key.Type = CURSOR_SHAPE_TYPE_MONOCHROME;
+	key.Width = 4;
+	key.Height = 2;
+	key.Pitch = 4;
+	uint8_t shape[8] = { 0x30, 0, 0, 0, 0x50, 0, 0, 0 };
+	uint32_t pixels[4];
+	uint32_t invertMask[4];
+	bool isInverting = false;
+	CHECK(ConvertCursorShape(key, shape, pixels, invertMask, &isInverting));
+	CHECK(isInverting);
+	CHECK_EQUAL(0xFF000000u, pixels[0]);
+	CHECK_EQUAL(0xFFFFFFFFu, pixels[1]);
+	CHECK_EQUAL(0x00FFFFFFu, pixels[2]);
+	CHECK_EQUAL(0x00FFFFFFu, pixels[3]);
+	CHECK_EQUAL(0u, invertMask[0]);
+	CHECK_EQUAL(0u, invertMask[1]);
+	CHECK_EQUAL(0u, invertMask[2]);
+	CHECK_EQUAL(0xFFFFFFFFu, invertMask[3]);
+	//Without an inversion mask to draw them with, inverting pixels cannot be converted.
+	CHECK(!ConvertCursorShape(key, shape, pixels));
+}
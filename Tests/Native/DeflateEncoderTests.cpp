@@ -0,0 +1,170 @@
+#include "NativeTest.h"
+#include "DeflateEncoder.h"
+#include "InflateTestDecoder.h"
+#include "TestImage.h"
+
+namespace {
+	/// <summary>
+	/// Compresses data as pieceCount pieces of about the same size, each by its own encoder with the end of the piece before it as a dictionary,
+	/// the way PngEncoder compresses strips in parallel, and joins the pieces into one stream.
+	/// </summary>
+	std::vector<uint8_t> CompressInPieces(const std::vector<uint8_t> &data, size_t pieceCount, int maxChainLength) {
+		std::vector<uint8_t> stream;
+		size_t pieceSize = (data.size() + pieceCount - 1) / pieceCount;
+		for (size_t i = 0; i < pieceCount; i++) {
+			size_t start = (std::min)(i * pieceSize, data.size());
+			size_t size = (std::min)(pieceSize, data.size() - start);
+			size_t dictionarySize = (std::min)(start, (size_t)DEFLATE_WINDOW_SIZE);
+			DeflateEncoder encoder(maxChainLength);
+			encoder.Compress(data.data() + start - dictionarySize, dictionarySize, size, i == pieceCount - 1, stream);
+		}
+		return stream;
+	}
+
+	void CheckRoundTrip(const char *name, const std::vector<uint8_t> &data) {
+		for (size_t pieceCount : { 1, 2, 5, 17 }) {
+			for (int maxChainLength : { 1, 8, 64 }) {
+				std::vector<uint8_t> stream = CompressInPieces(data, pieceCount, maxChainLength);
+				std::vector<uint8_t> inflated;
+				try {
+					inflated = InflateTestDecoder::Inflate(stream.data(), stream.size());
+				}
+				catch (const std::exception &e) {
+					printf("       %s in %zu pieces with chains of %d is not a valid stream: %s\n", name, pieceCount, maxChainLength, e.what());
+					CHECK(false);
+				}
+				if (inflated != data) {
+					printf("       %s in %zu pieces with chains of %d does not inflate to the data\n", name, pieceCount, maxChainLength);
+					CHECK(inflated == data);
+				}
+			}
+		}
+	}
+
+	std::vector<uint8_t> MakeRandomBytes(size_t size, uint32_t seed) {
+		std::vector<uint8_t> data(size);
+		uint32_t state = seed;
+		for (uint8_t &value : data) {
+			state = state * 1664525 + 1013904223;
+			value = static_cast<uint8_t>(state >> 24);
+		}
+		return data;
+	}
+
+	/// <summary>
+	/// Text from a small vocabulary, with matches of every length and distance up to the window.
+	/// </summary>
+	std::vector<uint8_t> MakeText(size_t size) {
+		static const char *WORDS[] = { "the ", "snapshot ", "encoder ", "writes ", "strips ", "of ", "rows ", "in ", "parallel", ", ", ".\n", "deflate " };
+		std::vector<uint8_t> data;
+		uint32_t state = 7;
+		while (data.size() < size) {
+			state = state * 1664525 + 1013904223;
+			const char *word = WORDS[(state >> 16) % 12];
+			data.insert(data.end(), word, word + strlen(word));
+		}
+		data.resize(size);
+		return data;
+	}
+}
+
+NATIVE_TEST(EmptyAndTinyInputsRoundTrip)
+{
+	CheckRoundTrip("empty", {});
+	CheckRoundTrip("one byte", { 0x42 });
+	CheckRoundTrip("three bytes", { 1, 2, 3 });
+	CheckRoundTrip("four equal bytes", { 9, 9, 9, 9 });
+}
+
+NATIVE_TEST(RepetitiveInputsRoundTrip)
+{
+	CheckRoundTrip("zeros", std::vector<uint8_t>(200000, 0));
+	CheckRoundTrip("text", MakeText(150000));
+	std::vector<uint8_t> period(100000);
+	for (size_t i = 0; i < period.size(); i++) {
+		period[i] = static_cast<uint8_t>(i % 251);
+	}
+	CheckRoundTrip("bytes repeating every 251", period);
+}
+
+NATIVE_TEST(IncompressibleInputsRoundTrip)
+{
+	CheckRoundTrip("random bytes", MakeRandomBytes(100000, 1));
+	//Random data with repeats reaching back exactly the window size, and one byte past it.
+	std::vector<uint8_t> data = MakeRandomBytes(3 * DEFLATE_WINDOW_SIZE, 2);
+	memcpy(&data[2 * DEFLATE_WINDOW_SIZE], &data[DEFLATE_WINDOW_SIZE], 1000);
+	memcpy(&data[2 * DEFLATE_WINDOW_SIZE + 2000], &data[DEFLATE_WINDOW_SIZE + 1999], 1000);
+	CheckRoundTrip("random bytes with far repeats", data);
+}
+
+NATIVE_TEST(ImageRowsRoundTrip)
+{
+	TEST_IMAGE image = MakeScreenLikeImage(1000, 300);
+	CheckRoundTrip("screen-like pixels", image.Bgra);
+}
+
+NATIVE_TEST(RepetitiveInputsCompressWell)
+{
+	std::vector<uint8_t> zeros(1 << 20, 0);
+	std::vector<uint8_t> stream = CompressInPieces(zeros, 1, 8);
+	CHECK(stream.size() < zeros.size() / 200);
+	std::vector<uint8_t> text = MakeText(1 << 20);
+	stream = CompressInPieces(text, 1, 8);
+	CHECK(stream.size() < text.size() / 3);
+	//Pieces see the data before them, so splitting costs little.
+	std::vector<uint8_t> pieces = CompressInPieces(text, 8, 8);
+	CHECK(pieces.size() < stream.size() * 21 / 20);
+	//Random data is stored, costing a few bytes per block.
+	std::vector<uint8_t> random = MakeRandomBytes(1 << 20, 3);
+	stream = CompressInPieces(random, 1, 8);
+	CHECK(stream.size() < random.size() + random.size() / 1000);
+}
+
+NATIVE_TEST(ReusedEncoderGivesTheSameStream)
+{
+	std::vector<uint8_t> text = MakeText(100000);
+	std::vector<uint8_t> random = MakeRandomBytes(50000, 4);
+	DeflateEncoder encoder;
+	std::vector<uint8_t> first;
+	encoder.Compress(text.data(), 0, text.size(), true, first);
+	std::vector<uint8_t> other;
+	encoder.Compress(random.data(), 0, random.size(), true, other);
+	std::vector<uint8_t> second;
+	encoder.Compress(text.data(), 0, text.size(), true, second);
+	CHECK(first == second);
+}
+
+NATIVE_TEST(ChecksumsMatchKnownValues)
+{
+	const char *text = "Wikipedia";
+	CHECK_EQUAL(0x11E60398u, UpdateAdler32(1, reinterpret_cast<const uint8_t *>(text), strlen(text)));
+	const char *digits = "123456789";
+	CHECK_EQUAL(0xCBF43926u, UpdateCrc32(0, reinterpret_cast<const uint8_t *>(digits), strlen(digits)));
+	CHECK_EQUAL(1u, UpdateAdler32(1, nullptr, 0));
+	CHECK_EQUAL(0u, UpdateCrc32(0, nullptr, 0));
+	//Long inputs of 0xFF make the sums as large as they get between reductions.
+	std::vector<uint8_t> ones(100000, 0xFF);
+	uint32_t a = 1;
+	uint32_t b = 0;
+	for (uint8_t value : ones) {
+		a = (a + value) % 65521;
+		b = (b + a) % 65521;
+	}
+	CHECK_EQUAL(b << 16 | a, UpdateAdler32(1, ones.data(), ones.size()));
+}
+
+NATIVE_TEST(ChecksumsOfPiecesCombine)
+{
+	std::vector<uint8_t> data = MakeRandomBytes(200000, 5);
+	uint32_t whole = UpdateAdler32(1, data.data(), data.size());
+	for (size_t split : { (size_t)0, (size_t)1, (size_t)65521, (size_t)65522, (size_t)131042, (size_t)199999, data.size() }) {
+		uint32_t first = UpdateAdler32(1, data.data(), split);
+		uint32_t second = UpdateAdler32(1, data.data() + split, data.size() - split);
+		if (CombineAdler32(first, second, data.size() - split) != whole) {
+			printf("       Split at %zu\n", split);
+			CHECK_EQUAL(whole, CombineAdler32(first, second, data.size() - split));
+		}
+		//CRC-32 continues from the CRC of the data before.
+		CHECK_EQUAL(UpdateCrc32(0, data.data(), data.size()), UpdateCrc32(UpdateCrc32(0, data.data(), split), data.data() + split, data.size() - split));
+	}
+}
@@ -0,0 +1,63 @@
+#include "NativeTest.h"
+#include "DirtyRegion.h"
+#include <random>
+
+//Measures the cost of building the dirty region of a frame from the dirty rects Desktop Duplication reports, and how many pixels it covers
+//compared to the bounding box of all dirty rects, which is what a single rect copy needs.
+
+struct FRAME_CASE {
+	const char *Name;
+	int RectCount;
+	int32_t MaxWidth;
+	int32_t MaxHeight;
+	//Rects are placed within this many pixels of each other, e.g. text being typed or a window being dragged.
+	int32_t Spread;
+};
+
+int main()
+{
+	const FRAME_CASE cases[] = {
+		{ "Caret and clock, 2 rects", 2, 20, 20, 1900 },
+		{ "Typing, 10 nearby rects", 10, 40, 20, 300 },
+		{ "Scattered updates, 40 rects", 40, 120, 56, 1900 },
+		{ "Window drag, 200 rects", 200, 64, 64, 600 },
+	};
+	printf("%-30s %10s %8s %14s %14s\n", "", "us/frame", "rects", "region pixels", "bounds pixels");
+	for (const FRAME_CASE &frameCase : cases) {
+		std::mt19937 rng(1);
+		//Precomputed, so the benchmark only measures the region.
+		const int frameCount = 1000;
+		std::vector<std::vector<REGION_RECT>> frames(frameCount);
+		for (std::vector<REGION_RECT> &rects : frames) {
+			int32_t originX = (int32_t)(rng() % (1920 - (std::min)(frameCase.Spread, 1900)));
+			int32_t originY = (int32_t)(rng() % 500);
+			for (int i = 0; i < frameCase.RectCount; i++) {
+				int32_t x = originX + (int32_t)(rng() % frameCase.Spread);
+				int32_t y = originY + (int32_t)(rng() % (std::min)(frameCase.Spread, 560));
+				rects.push_back(REGION_RECT{ x, y, x + 1 + (int32_t)(rng() % frameCase.MaxWidth), y + 1 + (int32_t)(rng() % frameCase.MaxHeight) });
+			}
+		}
+		DirtyRegion region;
+		size_t frame = 0;
+		double micros = 1000 * MeasureMillisPerCall([&]() {
+			region.Clear();
+			for (const REGION_RECT &rect : frames[frame]) {
+				region.Add(rect);
+			}
+			region.Clip(REGION_RECT{ 0, 0, 1920, 1080 });
+			frame = (frame + 1) % frameCount;
+		});
+		double rectCount = 0, regionPixels = 0, boundsPixels = 0;
+		for (const std::vector<REGION_RECT> &rects : frames) {
+			region.Clear();
+			for (const REGION_RECT &rect : rects) {
+				region.Add(rect);
+			}
+			rectCount += region.GetCount();
+			regionPixels += region.GetArea();
+			boundsPixels += region.GetBounds().Area();
+		}
+		printf("%-30s %10.2f %8.1f %14.0f %14.0f\n", frameCase.Name, micros, rectCount / frameCount, regionPixels / frameCount, boundsPixels / frameCount);
+	}
+	return 0;
+}
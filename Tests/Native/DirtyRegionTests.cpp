@@ -0,0 +1,215 @@
+#include "NativeTest.h"
+#include "DirtyRegion.h"
+#include <random>
+
+namespace {
+	bool IsCovered(const DirtyRegion &region, int32_t x, int32_t y) {
+		for (const REGION_RECT &rect : region.GetRects()) {
+			if (x >= rect.left && x < rect.right && y >= rect.top && y < rect.bottom) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	REGION_RECT RandomRect(std::mt19937 &rng, int32_t extent, int32_t maxSize) {
+		int32_t x = (int32_t)(rng() % extent);
+		int32_t y = (int32_t)(rng() % extent);
+		return REGION_RECT{ x, y, x + (int32_t)(rng() % maxSize), y + (int32_t)(rng() % maxSize) };
+	}
+}
+
+NATIVE_TEST(RectOperations)
+{
+	REGION_RECT a{ 0, 0, 10, 10 };
+	REGION_RECT b{ 5, 5, 20, 15 };
+	CHECK(DirtyRegion::Union(a, b) == (REGION_RECT{ 0, 0, 20, 15 }));
+	CHECK(DirtyRegion::Intersect(a, b) == (REGION_RECT{ 5, 5, 10, 10 }));
+	//Touching rects do not intersect, as right and bottom are exclusive.
+	CHECK(DirtyRegion::Intersect(a, REGION_RECT{ 10, 0, 20, 10 }).IsEmpty());
+	CHECK(DirtyRegion::Contains(a, REGION_RECT{ 2, 2, 10, 10 }));
+	CHECK(!DirtyRegion::Contains(a, b));
+	CHECK_EQUAL((uint64_t)0, (REGION_RECT{ 5, 5, 5, 10 }).Area());
+	CHECK_EQUAL((uint64_t)0, (REGION_RECT{ 5, 5, 2, 10 }).Area());
+	CHECK_EQUAL((uint64_t)150, b.Area());
+}
+
+NATIVE_TEST(AdjacentAndOverlappingRectsAreCoalesced)
+{
+	DirtyRegion region;
+	region.Add(REGION_RECT{ 0, 0, 10, 10 });
+	region.Add(REGION_RECT{ 10, 0, 20, 10 });
+	CHECK_EQUAL((size_t)1, region.GetCount());
+	CHECK(region.GetRects()[0] == (REGION_RECT{ 0, 0, 20, 10 }));
+	//Overlapping by most of their area.
+	region.Add(REGION_RECT{ 1, 1, 21, 11 });
+	CHECK_EQUAL((size_t)1, region.GetCount());
+	//Contained rects change nothing.
+	region.Add(REGION_RECT{ 5, 5, 8, 8 });
+	CHECK(region.GetRects()[0] == (REGION_RECT{ 0, 0, 21, 11 }));
+	//Empty rects are ignored.
+	region.Add(REGION_RECT{ 100, 100, 100, 200 });
+	CHECK_EQUAL((size_t)1, region.GetCount());
+}
+
+NATIVE_TEST(DistantRectsAreKeptSeparate)
+{
+	DirtyRegion region;
+	region.Add(REGION_RECT{ 0, 0, 10, 10 });
+	region.Add(REGION_RECT{ 500, 500, 510, 510 });
+	CHECK_EQUAL((size_t)2, region.GetCount());
+	CHECK_EQUAL((uint64_t)200, region.GetArea());
+	CHECK(region.GetBounds() == (REGION_RECT{ 0, 0, 510, 510 }));
+	//A diagonal neighbour would waste half the bounding box, so it stays separate too.
+	region.Add(REGION_RECT{ 10, 10, 20, 20 });
+	CHECK_EQUAL((size_t)3, region.GetCount());
+}
+
+NATIVE_TEST(MergedRectAbsorbsRectsItGrewInto)
+{
+	DirtyRegion region;
+	region.Add(REGION_RECT{ 0, 0, 10, 10 });
+	region.Add(REGION_RECT{ 20, 0, 30, 10 });
+	CHECK_EQUAL((size_t)2, region.GetCount());
+	//Bridging the gap merges all three into one strip.
+	region.Add(REGION_RECT{ 10, 0, 20, 10 });
+	CHECK_EQUAL((size_t)1, region.GetCount());
+	CHECK(region.GetRects()[0] == (REGION_RECT{ 0, 0, 30, 10 }));
+}
+
+NATIVE_TEST(FullRegionMergesCheapestPair)
+{
+	DirtyRegion region(2);
+	region.Add(REGION_RECT{ 0, 0, 10, 10 });
+	region.Add(REGION_RECT{ 1000, 0, 1010, 10 });
+	//Closer to the first rect, so merging with it wastes the least area.
+	region.Add(REGION_RECT{ 30, 0, 40, 10 });
+	CHECK_EQUAL((size_t)2, region.GetCount());
+	CHECK(region.Intersects(REGION_RECT{ 15, 0, 16, 1 }));
+	CHECK(!region.Intersects(REGION_RECT{ 500, 0, 501, 1 }));
+}
+
+NATIVE_TEST(RandomRegionsCoverEveryAddedPixel)
+{
+	std::mt19937 rng(1);
+	for (int iteration = 0; iteration < 500; iteration++) {
+		DirtyRegion region(1 + rng() % 20);
+		std::vector<REGION_RECT> added;
+		int count = rng() % 40;
+		for (int i = 0; i < count; i++) {
+			REGION_RECT rect = RandomRect(rng, 100, 30);
+			region.Add(rect);
+			added.push_back(rect);
+		}
+		CHECK(region.GetCount() <= region.GetMaxRects());
+		for (const REGION_RECT &rect : region.GetRects()) {
+			CHECK(!rect.IsEmpty());
+		}
+		for (const REGION_RECT &rect : added) {
+			for (int32_t y = rect.top; y < rect.bottom; y++) {
+				for (int32_t x = rect.left; x < rect.right; x++) {
+					CHECK(IsCovered(region, x, y));
+				}
+			}
+		}
+		//The region never covers more than the bounding box of what was added.
+		REGION_RECT bounds{};
+		for (const REGION_RECT &rect : added) {
+			if (!rect.IsEmpty()) {
+				bounds = bounds.IsEmpty() ? rect : DirtyRegion::Union(bounds, rect);
+			}
+		}
+		CHECK(bounds.IsEmpty() ? region.IsEmpty() : region.GetBounds() == bounds);
+	}
+}
+
+NATIVE_TEST(ClipAndOffset)
+{
+	std::mt19937 rng(2);
+	for (int iteration = 0; iteration < 200; iteration++) {
+		DirtyRegion region;
+		for (int i = 0; i < 20; i++) {
+			region.Add(RandomRect(rng, 200, 60));
+		}
+		REGION_RECT bounds{ 50, 50, 100, 100 };
+		bool intersected = region.Intersects(bounds);
+		region.Clip(bounds);
+		CHECK_EQUAL(intersected, !region.IsEmpty());
+		for (const REGION_RECT &rect : region.GetRects()) {
+			CHECK(DirtyRegion::Contains(bounds, rect));
+		}
+	}
+	DirtyRegion region;
+	region.Add(REGION_RECT{ 0, 0, 10, 10 });
+	region.Offset(-5, 7);
+	CHECK(region.GetRects()[0] == (REGION_RECT{ -5, 7, 5, 17 }));
+	//Offsets saturate instead of overflowing.
+	region.Offset(INT32_MAX, 0);
+	CHECK_EQUAL(INT32_MAX, region.GetRects()[0].right);
+}
+
+NATIVE_TEST(TransformCoversScaledRectsWithinDestination)
+{
+	std::mt19937 rng(3);
+	const REGION_RECT source{ 0, 0, 260, 260 };
+	const REGION_RECT destination{ 10, 20, 140, 85 };
+	for (int iteration = 0; iteration < 300; iteration++) {
+		DirtyRegion region;
+		std::vector<REGION_RECT> added;
+		for (int i = 0; i < 10; i++) {
+			REGION_RECT rect = RandomRect(rng, 250, 40);
+			region.Add(rect);
+			added.push_back(rect);
+		}
+		region.Transform(source, destination, 1);
+		for (const REGION_RECT &rect : region.GetRects()) {
+			CHECK(DirtyRegion::Contains(destination, rect));
+		}
+		for (const REGION_RECT &rect : added) {
+			for (int32_t y = rect.top; y < (std::min)(rect.bottom, source.bottom); y++) {
+				for (int32_t x = rect.left; x < (std::min)(rect.right, source.right); x++) {
+					CHECK(IsCovered(region, destination.left + x * 130 / 260, destination.top + y * 65 / 260));
+				}
+			}
+		}
+	}
+	//An identity transform without margin leaves the region as it is.
+	DirtyRegion region;
+	region.Add(REGION_RECT{ 3, 4, 50, 60 });
+	region.Transform(source, source, 0);
+	CHECK(region.GetRects()[0] == (REGION_RECT{ 3, 4, 50, 60 }));
+	//Upscaling rounds outwards.
+	region.Transform(REGION_RECT{ 0, 0, 100, 100 }, REGION_RECT{ 0, 0, 300, 300 }, 0);
+	CHECK(region.GetRects()[0] == (REGION_RECT{ 9, 12, 150, 180 }));
+	region.Transform(REGION_RECT{}, destination, 0);
+	CHECK(region.IsEmpty());
+}
+
+NATIVE_TEST(AddingRegionToItselfChangesNothing)
+{
+	DirtyRegion region;
+	region.Add(REGION_RECT{ 0, 0, 10, 10 });
+	region.Add(REGION_RECT{ 100, 0, 110, 10 });
+	region.Add(region);
+	CHECK_EQUAL((size_t)2, region.GetCount());
+	DirtyRegion other;
+	other.Add(region);
+	CHECK(other.GetRects() == region.GetRects());
+}
+
+NATIVE_TEST(ReusedRegionDoesNotReallocate)
+{
+	std::mt19937 rng(4);
+	DirtyRegion region;
+	const REGION_RECT *pRects = nullptr;
+	for (int frame = 0; frame < 1000; frame++) {
+		region.Clear();
+		for (int i = 0; i < 40; i++) {
+			region.Add(RandomRect(rng, 1900, 100));
+		}
+		if (frame == 0) {
+			pRects = region.GetRects().data();
+		}
+		CHECK(region.GetRects().data() == pRects);
+	}
+}
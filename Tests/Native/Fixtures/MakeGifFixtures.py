@@ -0,0 +1,54 @@
+#Makes the GIF fixtures of the native tests with Pillow: GIFs using the disposal methods the GIFs in Testmedia do not use,
+#and for every GIF a .frames file with a hash of each frame as Pillow composes it, which GifFrameComposerTests compares the composer with.
+#Usage: python3 MakeGifFixtures.py, from any folder. Only rerun it to add GIFs, as Pillow may write the GIFs differently between versions.
+import os
+import random
+from PIL import Image
+
+FIXTURES_DIR = os.path.dirname(os.path.abspath(__file__))
+MEDIA_DIR = os.path.join(FIXTURES_DIR, '..', '..', '..', 'Testmedia')
+
+
+def make_gif(path, disposals, size=(60, 50)):
+	#Frames of random palettes covering random areas, with transparent holes, so every disposal method shows in the composed frames.
+	frames = []
+	for disposal in disposals:
+		image = Image.new('P', size, 0)
+		image.putpalette([0, 0, 0] + [random.randrange(256) for _ in range(255 * 3)])
+		pixels = image.load()
+		left, top = random.randrange(size[0] // 2), random.randrange(size[1] // 2)
+		for y in range(top, min(size[1], top + random.randrange(5, size[1]))):
+			for x in range(left, min(size[0], left + random.randrange(5, size[0]))):
+				pixels[x, y] = random.randrange(1, 256) if random.random() < 0.8 else 0
+		frames.append(image)
+	durations = [random.choice([0, 10, 30, 100]) for _ in disposals]
+	frames[0].save(path, save_all=True, append_images=frames[1:], disposal=disposals, duration=durations, transparency=0, loop=0, optimize=False)
+
+
+def hash_frame(rgba):
+	#FNV-1a over the pixels as premultiplied BGRA words, with transparent pixels as 0, like HashComposedFrame in GifFrameComposerTests.cpp.
+	value = 0xcbf29ce484222325
+	for i in range(0, len(rgba), 4):
+		r, g, b, a = rgba[i], rgba[i + 1], rgba[i + 2], rgba[i + 3]
+		word = 0 if a == 0 else (a << 24) | ((r * a // 255) << 16) | ((g * a // 255) << 8) | (b * a // 255)
+		value = ((value ^ word) * 0x100000001b3) & 0xFFFFFFFFFFFFFFFF
+	return value
+
+
+def write_frames(gifPath):
+	image = Image.open(gifPath)
+	with open(os.path.join(FIXTURES_DIR, os.path.basename(gifPath) + '.frames'), 'w', newline='\n') as file:
+		file.write('#The hash of each frame of %s as composed by Pillow %s\n' % (os.path.basename(gifPath), Image.__version__))
+		for i in range(image.n_frames):
+			image.seek(i)
+			file.write('%016x\n' % hash_frame(image.convert('RGBA').tobytes()))
+
+
+if __name__ == '__main__':
+	random.seed(3)
+	make_gif(os.path.join(FIXTURES_DIR, 'DisposePrevious.gif'), [1, 3, 3, 1, 3, 2, 1, 3, 1, 3])
+	make_gif(os.path.join(FIXTURES_DIR, 'DisposeBackground.gif'), [2, 1, 2, 2, 3, 1, 2, 1])
+	for name in ['DisposePrevious.gif', 'DisposeBackground.gif']:
+		write_frames(os.path.join(FIXTURES_DIR, name))
+	for name in ['earth.gif', 'giftest.gif']:
+		write_frames(os.path.join(MEDIA_DIR, name))
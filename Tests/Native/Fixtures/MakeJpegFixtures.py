@@ -0,0 +1,12 @@
+#Makes the JPEG fixtures of the native tests with Pillow: renault.png from Testmedia encoded by libjpeg with 4:2:0 and 4:4:4 sampling and restart markers,
+#which JpegEncoderTests decodes to check the test decoder against another encoder before trusting it with JpegEncoder.
+#Usage: python3 MakeJpegFixtures.py, from any folder.
+import os
+from PIL import Image
+
+FIXTURES_DIR = os.path.dirname(os.path.abspath(__file__))
+MEDIA_DIR = os.path.join(FIXTURES_DIR, '..', '..', '..', 'Testmedia')
+
+image = Image.open(os.path.join(MEDIA_DIR, 'renault.png')).convert('RGB')
+image.save(os.path.join(FIXTURES_DIR, 'renault420.jpg'), quality=90, subsampling='4:2:0', restart_marker_rows=1, optimize=True)
+image.save(os.path.join(FIXTURES_DIR, 'renault444.jpg'), quality=90, subsampling='4:4:4', restart_marker_blocks=7)
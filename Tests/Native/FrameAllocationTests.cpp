@@ -0,0 +1,312 @@
+#include "NativeTest.h"
+#include "BlockPool.h"
+#include "DirtyRegion.h"
+#include "FramePipeline.h"
+#include "ObjectPool.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <thread>
+#include <vector>
+
+//Every heap allocation made by the test executable is counted, on all threads, so allocations hidden in the standard library show up too.
+static std::atomic<uint64_t> g_HeapAllocations{ 0 };
+
+void *operator new(size_t size)
+{
+	g_HeapAllocations++;
+	void *p = malloc(size > 0 ? size : 1);
+	if (!p) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+void *operator new[](size_t size) { return operator new(size); }
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+	g_HeapAllocations++;
+	return malloc(size > 0 ? size : 1);
+}
+void *operator new[](size_t size, const std::nothrow_t &tag) noexcept { return operator new(size, tag); }
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+
+namespace {
+	const size_t FRAME_QUEUE_SIZE = 3;
+	const int64_t FRAME_DURATION = 333333;
+
+	struct FAKE_TEXTURE {
+		int Id;
+	};
+
+	class FakeTextureAllocator : public IResourceAllocator<int, FAKE_TEXTURE *>
+	{
+	public:
+		bool Allocate(const int &description, FAKE_TEXTURE **ppTexture) override {
+			*ppTexture = new FAKE_TEXTURE{ m_NextId++ };
+			return true;
+		}
+		void Free(FAKE_TEXTURE *pTexture) override {
+			delete pTexture;
+		}
+	private:
+		int m_NextId = 0;
+	};
+
+	typedef ResourcePool<int, FAKE_TEXTURE *> FakeTexturePool;
+
+	/// <summary>
+	/// A frame passed between the stages, like PIPELINE_FRAME in RecordingManager: the texture to encode, the references keeping the captured
+	/// and the processed texture from being reused, and the changed area.
+	/// </summary>
+	struct SIMULATED_FRAME {
+		int64_t StartPos = 0;
+		int64_t Duration = 0;
+		FAKE_TEXTURE *Frame = nullptr;
+		std::shared_ptr<FAKE_TEXTURE> CapturedFrame;
+		std::shared_ptr<FAKE_TEXTURE> ProcessedFrame;
+		DirtyRegion UpdatedRegion;
+	};
+	typedef PooledObject<SIMULATED_FRAME> SimulatedFrame;
+
+	struct FRAME_ALLOCATION_REPORT {
+		uint64_t Frames = 0;
+		//Heap allocations on any thread while the first frames warmed the pools up, and after.
+		uint64_t WarmupAllocations = 0;
+		uint64_t SteadyAllocations = 0;
+		//Pool misses counted by the allocation tracker, as RecordingManager counts them.
+		ALLOCATION_STATS Tracked{};
+		//Textures created after the warmup, because more textures were in use than the texture pools hold.
+		uint64_t SteadyTextureMisses = 0;
+		uint64_t Dropped = 0;
+		uint64_t Shed = 0;
+		uint64_t Encoded = 0;
+		uint64_t EncodedByOptionalOutput = 0;
+	};
+
+	/// <summary>
+	/// Runs frames from a capture loop through a compose stage to a fan-out with a main output and an optional output that falls behind now and then,
+	/// with the pools sized the way RecordingManager sizes them, unless a depth is given.
+	/// </summary>
+	FRAME_ALLOCATION_REPORT RunFrames(uint64_t frameCount, uint64_t warmupFrames, size_t poolDepthOverride = 0) {
+		const size_t additionalOutputs = 1;
+		size_t framePoolDepth = poolDepthOverride > 0 ? poolDepthOverride : FRAME_QUEUE_SIZE * 2 + 4 + additionalOutputs * (FRAME_QUEUE_SIZE * 8 + 4);
+		size_t texturePoolDepth = poolDepthOverride > 0 ? poolDepthOverride : FRAME_QUEUE_SIZE * 2 + 3 + additionalOutputs * (FRAME_QUEUE_SIZE + 2);
+		AllocationTracker tracker{};
+		std::shared_ptr<ObjectPool<SIMULATED_FRAME>> pFramePool = ObjectPool<SIMULATED_FRAME>::Create(framePoolDepth, [](SIMULATED_FRAME &frame) {
+			frame.StartPos = 0;
+			frame.Duration = 0;
+			frame.Frame = nullptr;
+			frame.CapturedFrame.reset();
+			frame.ProcessedFrame.reset();
+			frame.UpdatedRegion.Clear();
+		}, &tracker);
+		std::shared_ptr<BlockPool> pBlockPool = std::make_shared<BlockPool>(framePoolDepth * 2, &tracker);
+		std::shared_ptr<FakeTexturePool> pCapturedPool = std::make_shared<FakeTexturePool>(std::make_unique<FakeTextureAllocator>(), texturePoolDepth);
+		//Stands in for the texture cache, whose textures stay pinned while a frame references them.
+		std::shared_ptr<FakeTexturePool> pProcessedPool = std::make_shared<FakeTexturePool>(std::make_unique<FakeTextureAllocator>(), texturePoolDepth);
+		//Textures are created on the GPU rather than the heap, so the texture pools are filled up front and only textures created beyond their depth are counted.
+		for (const std::shared_ptr<FakeTexturePool> &pPool : { pCapturedPool, pProcessedPool }) {
+			std::vector<FAKE_TEXTURE *> textures(texturePoolDepth);
+			for (FAKE_TEXTURE *&pTexture : textures) {
+				pPool->Acquire(0, &pTexture);
+			}
+			for (FAKE_TEXTURE *pTexture : textures) {
+				pPool->Release(0, pTexture);
+			}
+		}
+		auto AcquireTexture = [&](const std::shared_ptr<FakeTexturePool> &pPool, std::shared_ptr<FAKE_TEXTURE> *pTexture) {
+			FAKE_TEXTURE *pFakeTexture = nullptr;
+			if (pPool->Acquire(0, &pFakeTexture)) {
+				pTexture->reset(pFakeTexture, [pPool](FAKE_TEXTURE *pFakeTexture) {
+					pPool->Release(0, pFakeTexture);
+				}, BlockPoolAllocator<FAKE_TEXTURE>(pBlockPool));
+			}
+		};
+
+		std::atomic<uint64_t> encoded{ 0 };
+		std::atomic<uint64_t> encodedByOptionalOutput{ 0 };
+		std::atomic<uint64_t> dropped{ 0 };
+		PipelineFanOut<SimulatedFrame> encodeStage;
+		encodeStage.AddOutput(FRAME_QUEUE_SIZE, PipelineDropPolicy::Block, [&](SimulatedFrame &frame) {
+			encoded++;
+			return true;
+		});
+		encodeStage.AddOptionalOutput(FRAME_QUEUE_SIZE * 8, FRAME_QUEUE_SIZE, [&](SimulatedFrame &frame) {
+			//Falls behind for a moment every few thousand frames, so frames are shed to it.
+			if (frame->Frame && frame->StartPos / FRAME_DURATION % 4096 == 0) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(2));
+			}
+			encodedByOptionalOutput++;
+			return true;
+		},
+			[&](SimulatedFrame &source, SimulatedFrame &destination) {
+			if (!source || !source->Frame || (destination && destination->Frame)) {
+				return;
+			}
+			if (!destination) {
+				destination = pFramePool->Acquire();
+			}
+			destination->Frame = source->Frame;
+			source->Frame = nullptr;
+			destination->CapturedFrame = std::move(source->CapturedFrame);
+			destination->ProcessedFrame = std::move(source->ProcessedFrame);
+		});
+		PipelineStage<SimulatedFrame> composeStage(FRAME_QUEUE_SIZE, PipelineDropPolicy::DropOldest, [&](SimulatedFrame &frame) {
+			//Every other frame is resized into a texture of the cache, which the frame keeps pinned.
+			if (frame->Frame && frame->StartPos / FRAME_DURATION % 2 == 0) {
+				AcquireTexture(pProcessedPool, &frame->ProcessedFrame);
+				frame->Frame = frame->ProcessedFrame.get();
+			}
+			frame->UpdatedRegion.Offset(1, 1);
+			return encodeStage.Push(std::move(frame));
+		},
+			[&](SimulatedFrame &pDropped, SimulatedFrame &pSurvivor) {
+			dropped++;
+			pSurvivor->Duration += pDropped->Duration;
+			pSurvivor->StartPos = (std::min)(pSurvivor->StartPos, pDropped->StartPos);
+			pSurvivor->UpdatedRegion.Add(pDropped->UpdatedRegion);
+			if (pDropped->Frame && !pSurvivor->Frame) {
+				pSurvivor->Frame = pDropped->Frame;
+				pSurvivor->CapturedFrame = std::move(pDropped->CapturedFrame);
+				pSurvivor->ProcessedFrame = std::move(pDropped->ProcessedFrame);
+			}
+		});
+		encodeStage.Start();
+		composeStage.Start();
+
+		FRAME_ALLOCATION_REPORT report{};
+		uint64_t allocationsAtStart = g_HeapAllocations;
+		uint64_t allocationsAfterWarmup = allocationsAtStart;
+		uint64_t textureMissesAfterWarmup = 0;
+		auto GetTextureMisses = [&]() {
+			return pCapturedPool->GetStats().Misses + pProcessedPool->GetStats().Misses;
+		};
+		for (uint64_t i = 0; i < frameCount; i++) {
+			if (i == warmupFrames) {
+				allocationsAfterWarmup = g_HeapAllocations;
+				textureMissesAfterWarmup = GetTextureMisses();
+			}
+			SimulatedFrame frame = pFramePool->Acquire();
+			frame->StartPos = (int64_t)i * FRAME_DURATION;
+			frame->Duration = FRAME_DURATION;
+			//Most frames have a new video frame with a few changed areas, the rest only extend the previous one.
+			if (i % 5 != 4) {
+				AcquireTexture(pCapturedPool, &frame->CapturedFrame);
+				frame->Frame = frame->CapturedFrame.get();
+				for (int32_t r = 0; r < (int32_t)(i % 7); r++) {
+					frame->UpdatedRegion.Add(REGION_RECT{ r * 200, r * 100, r * 200 + 64, r * 100 + 32 });
+				}
+			}
+			//The capture loop is paced by the frame rate, so the compose stage mostly keeps up, but a burst of frames every now and then makes it drop some.
+			while (i % 64 >= 8 && composeStage.GetStats().QueueDepth >= FRAME_QUEUE_SIZE - 1) {
+				std::this_thread::yield();
+			}
+			composeStage.Push(std::move(frame));
+			tracker.EndFrame();
+		}
+		composeStage.Drain();
+		encodeStage.Drain();
+		report.Frames = frameCount;
+		report.WarmupAllocations = allocationsAfterWarmup - allocationsAtStart;
+		report.SteadyAllocations = g_HeapAllocations - allocationsAfterWarmup;
+		report.Tracked = tracker.GetStats();
+		report.SteadyTextureMisses = GetTextureMisses() - textureMissesAfterWarmup;
+		report.Dropped = dropped;
+		report.Shed = encodeStage.GetStats(1).Shed;
+		composeStage.Stop();
+		encodeStage.Stop();
+		report.Encoded = encoded;
+		report.EncodedByOptionalOutput = encodedByOptionalOutput;
+		return report;
+	}
+
+	void PrintReport(const char *name, const FRAME_ALLOCATION_REPORT &report, uint64_t warmupFrames) {
+		printf("       %s: %llu frames, %.4f allocations per frame after %llu warmup frames (%llu during warmup), %llu pool misses in %llu frames, at most %llu in a frame, %llu textures created after warmup, %llu dropped, %llu shed\n",
+			name,
+			(unsigned long long)report.Frames,
+			(double)report.SteadyAllocations / (report.Frames - warmupFrames),
+			(unsigned long long)warmupFrames,
+			(unsigned long long)report.WarmupAllocations,
+			(unsigned long long)report.Tracked.FrameAllocations,
+			(unsigned long long)report.Tracked.FramesWithAllocations,
+			(unsigned long long)report.Tracked.MaxFrameAllocations,
+			(unsigned long long)report.SteadyTextureMisses,
+			(unsigned long long)report.Dropped,
+			(unsigned long long)report.Shed);
+	}
+}
+
+NATIVE_TEST(AllocationCounterSeesStandardLibraryAllocations)
+{
+	//Without a pool, every shared_ptr with a custom deleter allocates its control block, which the harness relies on seeing.
+	uint64_t before = g_HeapAllocations;
+	for (int i = 0; i < 1000; i++) {
+		std::shared_ptr<FAKE_TEXTURE> texture(nullptr, [](FAKE_TEXTURE *) {});
+	}
+	CHECK_EQUAL((uint64_t)1000, g_HeapAllocations - before);
+}
+
+NATIVE_TEST(BlockPoolServesSharedPtrControlBlocksWithoutAllocating)
+{
+	std::shared_ptr<BlockPool> pBlockPool = std::make_shared<BlockPool>(4);
+	uint64_t missesAtStart = pBlockPool->GetStats().Misses;
+	uint64_t before = g_HeapAllocations;
+	for (int i = 0; i < 100000; i++) {
+		std::shared_ptr<FAKE_TEXTURE> texture(nullptr, [pBlockPool](FAKE_TEXTURE *) {}, BlockPoolAllocator<FAKE_TEXTURE>(pBlockPool));
+		std::shared_ptr<FAKE_TEXTURE> copy = texture;
+	}
+	CHECK_EQUAL((uint64_t)0, g_HeapAllocations - before);
+	CHECK_EQUAL(missesAtStart, pBlockPool->GetStats().Misses);
+}
+
+NATIVE_TEST(PooledObjectCopiesReuseTheStorageOfPooledObjects)
+{
+	std::shared_ptr<ObjectPool<SIMULATED_FRAME>> pPool = ObjectPool<SIMULATED_FRAME>::Create(4, [](SIMULATED_FRAME &frame) {
+		frame.UpdatedRegion.Clear();
+	});
+	//The first rounds grow the region storage of the pooled frames, after which copies assign into storage kept from before.
+	uint64_t allocationsAfterWarmup = 0;
+	uint64_t missesAfterWarmup = 0;
+	for (int i = 0; i < 100000; i++) {
+		if (i == 100) {
+			allocationsAfterWarmup = g_HeapAllocations;
+			missesAfterWarmup = pPool->GetStats().Misses;
+		}
+		SimulatedFrame frame = pPool->Acquire();
+		for (int32_t r = 0; r < 8; r++) {
+			frame->UpdatedRegion.Add(REGION_RECT{ r * 300, 0, r * 300 + 10, 10 });
+		}
+		SimulatedFrame copy = frame;
+		CHECK(copy.Get() != frame.Get());
+		CHECK(copy->UpdatedRegion.GetRects().size() == frame->UpdatedRegion.GetRects().size());
+	}
+	CHECK_EQUAL((uint64_t)0, g_HeapAllocations - allocationsAfterWarmup);
+	CHECK_EQUAL(missesAfterWarmup, pPool->GetStats().Misses);
+}
+
+NATIVE_TEST(PipelineFramesDoNotAllocateOnceThePoolsAreWarm)
+{
+	const uint64_t frames = 100000;
+	const uint64_t warmupFrames = 1000;
+	FRAME_ALLOCATION_REPORT report = RunFrames(frames, warmupFrames);
+	PrintReport("Pools sized like RecordingManager", report, warmupFrames);
+	CHECK_EQUAL((uint64_t)0, report.SteadyAllocations);
+	CHECK_EQUAL((uint64_t)0, report.Tracked.FrameAllocations);
+	CHECK_EQUAL((uint64_t)0, report.SteadyTextureMisses);
+	//Every frame reaches the main output, except the ones folded into others by the compose stage, and every frame the optional output gets.
+	CHECK_EQUAL(frames, report.Encoded + report.Dropped);
+	CHECK_EQUAL(frames, report.EncodedByOptionalOutput + report.Dropped);
+}
+
+NATIVE_TEST(UndersizedPoolsShowUpAsAllocationsPerFrame)
+{
+	const uint64_t frames = 20000;
+	const uint64_t warmupFrames = 1000;
+	FRAME_ALLOCATION_REPORT report = RunFrames(frames, warmupFrames, 2);
+	PrintReport("Pools of 2", report, warmupFrames);
+	CHECK(report.SteadyAllocations > 0);
+	CHECK(report.Tracked.FramesWithAllocations > 0);
+}
@@ -0,0 +1,262 @@
+#include "NativeTest.h"
+#include "FramePacer.h"
+#include <cstdlib>
+#include <random>
+
+namespace {
+	const int64_t SECOND = 10000000;
+
+	struct PACER_UNDER_TEST {
+		std::shared_ptr<VirtualPacingClock> Clock;
+		std::unique_ptr<FramePacer> Pacer;
+	};
+
+	PACER_UNDER_TEST CreatePacer(FramePacingMode mode) {
+		PACER_UNDER_TEST test;
+		test.Clock = std::make_shared<VirtualPacingClock>();
+		test.Pacer = std::make_unique<FramePacer>(test.Clock, mode);
+		return test;
+	}
+
+	//When frame number index is due on a grid of the given frame rate in millihertz, the way the pacer rounds it.
+	int64_t GetGridTime(int64_t index, int64_t millihertz) {
+		return index * 10000000000ll / millihertz;
+	}
+}
+
+NATIVE_TEST(FixedRateFramesStayOnTheGridForAnHourAt30Fps)
+{
+	PACER_UNDER_TEST test = CreatePacer(FramePacingMode::FixedRate);
+	test.Pacer->SetFrameRate(30);
+	const int64_t frames = 30 * 3600 + 1;
+	for (int64_t i = 0; i < frames; i++) {
+		CHECK(test.Pacer->WaitForNextFrame());
+		if (test.Clock->GetTime() != GetGridTime(i, 30000)) {
+			CHECK_EQUAL(GetGridTime(i, 30000), test.Clock->GetTime());
+		}
+	}
+	CHECK_EQUAL(3600 * SECOND, test.Clock->GetTime());
+	FRAME_PACING_STATS stats = test.Pacer->GetStats();
+	CHECK_EQUAL((uint64_t)frames, stats.Frames);
+	CHECK_EQUAL((uint64_t)0, stats.Skipped);
+	CHECK_EQUAL((uint64_t)0, stats.Late);
+	CHECK_EQUAL((uint64_t)frames - 1, stats.JitterFrames);
+	CHECK_EQUAL((int64_t)0, stats.MaxJitter);
+	CHECK_EQUAL((int64_t)0, stats.Drift);
+}
+
+NATIVE_TEST(FractionalFrameRatesDoNotDriftFromRounding)
+{
+	//29.97 fps is 333667.0003 per frame, so an interval rounded to 100 nanosecond units would be off by a frame after about 8 hours.
+	PACER_UNDER_TEST test = CreatePacer(FramePacingMode::FixedRate);
+	test.Pacer->SetFrameRate(29.97);
+	const int64_t frames = 29970 * 36 / 10 + 1;
+	for (int64_t i = 0; i < frames; i++) {
+		CHECK(test.Pacer->WaitForNextFrame());
+	}
+	CHECK_EQUAL(GetGridTime(frames - 1, 29970), test.Clock->GetTime());
+	CHECK_EQUAL(3600 * SECOND, test.Clock->GetTime());
+	CHECK_EQUAL((int64_t)0, test.Pacer->GetStats().Drift);
+}
+
+NATIVE_TEST(WakeLatencyDoesNotAddUpToDrift)
+{
+	//Every wait ends 2 ms late and every frame takes 5 ms to produce.
+	const int64_t latency = 20000;
+	const int64_t work = 50000;
+	const int64_t frames = 30 * 3600 + 1;
+	PACER_UNDER_TEST test = CreatePacer(FramePacingMode::FixedRate);
+	test.Pacer->SetFrameRate(30);
+	test.Clock->SetWakeLatency(latency);
+	for (int64_t i = 0; i < frames; i++) {
+		CHECK(test.Pacer->WaitForNextFrame());
+		test.Clock->Advance(work);
+	}
+	FRAME_PACING_STATS stats = test.Pacer->GetStats();
+	CHECK_EQUAL((uint64_t)0, stats.Skipped);
+	CHECK_EQUAL((uint64_t)0, stats.Late);
+	CHECK_EQUAL(latency, stats.MaxJitter);
+	CHECK_NEAR(latency, stats.GetMeanJitter(), 0.001);
+	CHECK_NEAR(latency, stats.GetRmsJitter(), 0.001);
+	CHECK_EQUAL(latency, stats.Drift);
+
+	//Scheduling each frame one interval after the previous one was produced, as the recorder loop did, drifts by the latency and the work on every frame,
+	//which comes to more than 12 minutes over the hour.
+	VirtualPacingClock clock;
+	clock.SetWakeLatency(latency);
+	for (int64_t i = 1; i < frames; i++) {
+		clock.WaitUntil(clock.GetTime() + SECOND / 30);
+		clock.Advance(work);
+	}
+	int64_t previousDrift = clock.GetTime() - GetGridTime(frames - 1, 30000);
+	CHECK(previousDrift > 720 * SECOND);
+}
+
+NATIVE_TEST(RandomWakeLatencyHasBoundedJitterAndNoDrift)
+{
+	const int64_t maxLatency = 40000;
+	const int64_t frames = 29970 * 36 / 10 + 1;
+	PACER_UNDER_TEST test = CreatePacer(FramePacingMode::FixedRate);
+	test.Pacer->SetFrameRate(29.97);
+	std::mt19937 random(1);
+	//The mean offset from the grid over the first and the last minute, which would differ if the offsets added up.
+	double firstMinuteOffset = 0;
+	double lastMinuteOffset = 0;
+	const int64_t minuteFrames = 1798;
+	for (int64_t i = 0; i < frames; i++) {
+		test.Clock->SetWakeLatency(random() % maxLatency);
+		CHECK(test.Pacer->WaitForNextFrame());
+		int64_t offset = test.Clock->GetTime() - GetGridTime(i, 29970);
+		CHECK(offset >= 0 && offset < maxLatency);
+		if (i > 0 && i <= minuteFrames) {
+			firstMinuteOffset += (double)offset / minuteFrames;
+		}
+		else if (i >= frames - minuteFrames) {
+			lastMinuteOffset += (double)offset / minuteFrames;
+		}
+	}
+	FRAME_PACING_STATS stats = test.Pacer->GetStats();
+	CHECK_EQUAL((uint64_t)0, stats.Skipped);
+	CHECK_EQUAL((uint64_t)0, stats.Late);
+	CHECK(stats.MaxJitter < maxLatency);
+	CHECK_NEAR(maxLatency / 2, stats.GetMeanJitter(), 500);
+	//The RMS of a uniform distribution from 0 to the maximum is the maximum divided by the square root of 3.
+	CHECK_NEAR(maxLatency / std::sqrt(3.0), stats.GetRmsJitter(), 500);
+	CHECK_NEAR(firstMinuteOffset, lastMinuteOffset, 2000);
+}
+
+NATIVE_TEST(FixedRateSkipsFramesTheProducerIsTooLateFor)
+{
+	const int64_t interval = 100000;
+	const int64_t frames = 1000;
+	PACER_UNDER_TEST test = CreatePacer(FramePacingMode::FixedRate);
+	test.Pacer->SetInterval(interval);
+	uint64_t stalls = 0;
+	bool isAfterStall = false;
+	for (int64_t i = 0; i < frames; i++) {
+		CHECK(test.Pacer->WaitForNextFrame());
+		if (!isAfterStall) {
+			//Frames are produced on the grid, except the one the producer is late for.
+			CHECK_EQUAL((int64_t)0, test.Clock->GetTime() % interval);
+		}
+		isAfterStall = false;
+		//Every tenth frame keeps the producer busy for two and a half intervals.
+		if (i % 10 == 9 && i < frames - 1) {
+			test.Clock->Advance(interval * 5 / 2);
+			stalls++;
+			isAfterStall = true;
+		}
+	}
+	FRAME_PACING_STATS stats = test.Pacer->GetStats();
+	//The frame due during the stall is produced late, the one after it is skipped instead of following in a burst, and the grid is kept.
+	CHECK_EQUAL(stalls, stats.Late);
+	CHECK_EQUAL(stalls, stats.Skipped);
+	CHECK_EQUAL((int64_t)0, stats.Drift);
+	CHECK_EQUAL((frames + (int64_t)stalls - 1) * interval, test.Clock->GetTime());
+}
+
+NATIVE_TEST(VariableRateRestartsTheGridAfterAGap)
+{
+	const int64_t interval = 100000;
+	PACER_UNDER_TEST test = CreatePacer(FramePacingMode::VariableRate);
+	test.Pacer->SetInterval(interval);
+	for (int i = 0; i < 10; i++) {
+		CHECK(test.Pacer->WaitForNextFrame());
+	}
+	CHECK_EQUAL(9 * interval, test.Clock->GetTime());
+
+	//Nothing changes for a while, and the next frame comes with a change off the grid.
+	test.Clock->Advance(5 * interval + 12345);
+	int64_t restart = test.Clock->GetTime();
+	test.Pacer->OnFrame(restart);
+	CHECK(test.Pacer->WaitForNextFrame());
+	CHECK_EQUAL(restart + interval, test.Clock->GetTime());
+
+	//A change produced ahead of time does not put off the next frame.
+	test.Clock->Advance(interval / 3);
+	test.Pacer->OnFrame(test.Clock->GetTime());
+	CHECK(test.Pacer->WaitForNextFrame());
+	CHECK_EQUAL(restart + 2 * interval, test.Clock->GetTime());
+
+	FRAME_PACING_STATS stats = test.Pacer->GetStats();
+	CHECK_EQUAL((uint64_t)14, stats.Frames);
+	CHECK_EQUAL((uint64_t)1, stats.Restarts);
+	CHECK_EQUAL((uint64_t)0, stats.Late);
+	CHECK_EQUAL((uint64_t)0, stats.Skipped);
+	//The first frame, the frame after the gap and the frame ahead of time have no offset to count.
+	CHECK_EQUAL((uint64_t)11, stats.JitterFrames);
+	CHECK_EQUAL((int64_t)0, stats.MaxJitter);
+}
+
+NATIVE_TEST(DeadlineFollowsChangingDelaysWithoutAccumulatingLatency)
+{
+	//The delays of an animated GIF, in 100 nanosecond units.
+	const int64_t delays[] = { 1000000, 500000, 2000000, 200000, 700000 };
+	const int64_t latency = 10000;
+	PACER_UNDER_TEST test = CreatePacer(FramePacingMode::Deadline);
+	test.Clock->SetWakeLatency(latency);
+	CHECK(test.Pacer->WaitForNextFrame());
+	int64_t expected = 0;
+	for (int i = 0; i < 5000; i++) {
+		int64_t delay = delays[i % 5];
+		test.Pacer->SetInterval(delay);
+		CHECK(test.Pacer->WaitForNextFrame());
+		expected += delay;
+		if (test.Clock->GetTime() != expected + latency) {
+			CHECK_EQUAL(expected + latency, test.Clock->GetTime());
+		}
+	}
+	FRAME_PACING_STATS stats = test.Pacer->GetStats();
+	CHECK_EQUAL((uint64_t)0, stats.Restarts);
+	CHECK_EQUAL((uint64_t)0, stats.Late);
+	CHECK_EQUAL(latency, stats.MaxJitter);
+	CHECK_EQUAL(latency, stats.Drift);
+}
+
+NATIVE_TEST(DeadlineRestartsInsteadOfCatchingUpAfterAStall)
+{
+	const int64_t delay = 1000000;
+	PACER_UNDER_TEST test = CreatePacer(FramePacingMode::Deadline);
+	test.Pacer->SetInterval(delay);
+	for (int i = 0; i < 3; i++) {
+		CHECK(test.Pacer->WaitForNextFrame());
+	}
+	test.Clock->Advance(delay * 3 + 500);
+	int64_t stalledUntil = test.Clock->GetTime();
+	//The late frame is produced at once, and the schedule restarts from it rather than producing the frames missed in a burst.
+	CHECK(test.Pacer->WaitForNextFrame());
+	CHECK_EQUAL(stalledUntil, test.Clock->GetTime());
+	CHECK(test.Pacer->WaitForNextFrame());
+	CHECK_EQUAL(stalledUntil + delay, test.Clock->GetTime());
+	FRAME_PACING_STATS stats = test.Pacer->GetStats();
+	CHECK_EQUAL((uint64_t)1, stats.Restarts);
+	CHECK_EQUAL((uint64_t)1, stats.Late);
+}
+
+NATIVE_TEST(ChangingTheFrameRateKeepsTheFramesAlreadyProduced)
+{
+	PACER_UNDER_TEST test = CreatePacer(FramePacingMode::FixedRate);
+	test.Pacer->SetFrameRate(30);
+	for (int i = 0; i < 10; i++) {
+		CHECK(test.Pacer->WaitForNextFrame());
+	}
+	int64_t changedAt = test.Clock->GetTime();
+	CHECK_EQUAL(GetGridTime(9, 30000), changedAt);
+	test.Pacer->SetFrameRate(60);
+	for (int64_t i = 1; i <= 600; i++) {
+		CHECK(test.Pacer->WaitForNextFrame());
+		CHECK_EQUAL(changedAt + GetGridTime(i, 60000), test.Clock->GetTime());
+	}
+	CHECK_EQUAL((int64_t)0, test.Pacer->GetStats().Drift);
+}
+
+NATIVE_TEST(CancelEndsWaitingForFrames)
+{
+	PACER_UNDER_TEST test = CreatePacer(FramePacingMode::FixedRate);
+	test.Pacer->SetFrameRate(30);
+	CHECK(test.Pacer->WaitForNextFrame());
+	test.Pacer->Cancel();
+	CHECK(!test.Pacer->WaitForNextFrame());
+	CHECK_EQUAL((int64_t)0, test.Clock->GetTime());
+	CHECK_EQUAL((uint64_t)1, test.Pacer->GetStats().Frames);
+}
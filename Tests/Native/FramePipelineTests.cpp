@@ -0,0 +1,400 @@
+#include "NativeTest.h"
+#include "FramePipeline.h"
+#include "FrameUpdateTracker.h"
+#include "VideoSampleQueue.h"
+
+namespace {
+	/// <summary>
+	/// A synthetic frame, with the video as its costly part.
+	/// </summary>
+	struct FRAME {
+		int64_t StartPos = 0;
+		int64_t Duration = 0;
+		std::shared_ptr<int> Video;
+	};
+
+	/// <summary>
+	/// Counts live instances, to check that stopped stages release the items they held.
+	/// </summary>
+	struct TRACKED {
+		static std::atomic<int> Live;
+		TRACKED() { Live++; }
+		~TRACKED() { Live--; }
+	};
+	std::atomic<int> TRACKED::Live{ 0 };
+
+	//Extends the surviving frame over the dropped one, as the recording pipeline does, so the timeline has no gaps.
+	void FoldDroppedFrame(FRAME &dropped, FRAME &survivor) {
+		survivor.StartPos = (std::min)(survivor.StartPos, dropped.StartPos);
+		survivor.Duration += dropped.Duration;
+	}
+
+	void ShedVideo(FRAME &source, FRAME &destination) {
+		if (source.Video && !destination.Video) {
+			destination.Video = std::move(source.Video);
+		}
+	}
+
+	/// <summary>
+	/// Collects the frames an output processed, from its worker thread. The delay simulates encoding, and only applies to frames with video.
+	/// </summary>
+	class FrameSink
+	{
+	public:
+		FrameSink(std::chrono::microseconds delay = std::chrono::microseconds(0)) :m_Delay(delay) {}
+		bool operator()(FRAME &frame) {
+			if (frame.Video && m_Delay.count() > 0) {
+				std::this_thread::sleep_for(m_Delay);
+			}
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Frames.push_back({ frame.StartPos, frame.Duration, frame.Video });
+			return true;
+		}
+		std::vector<FRAME> GetFrames() {
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			return m_Frames;
+		}
+	private:
+		std::chrono::microseconds m_Delay;
+		std::mutex m_Mutex;
+		std::vector<FRAME> m_Frames;
+	};
+
+	/// <summary>
+	/// Checks that the frames cover the timeline from 0 to endPos without gaps or overlaps.
+	/// </summary>
+	void CheckContinuous(const std::vector<FRAME> &frames, int64_t endPos) {
+		int64_t expectedPos = 0;
+		for (const FRAME &frame : frames) {
+			CHECK_EQUAL(expectedPos, frame.StartPos);
+			expectedPos += frame.Duration;
+		}
+		CHECK_EQUAL(endPos, expectedPos);
+	}
+
+	/// <summary>
+	/// Writes frames as video samples like OutputManager::RenderFrame. A frame with video becomes a sample, and a frame without extends the pending sample,
+	/// or at a fixed framerate writes the last sample again for its interval. The delay simulates encoding.
+	/// </summary>
+	class SampleWriter
+	{
+	public:
+		SampleWriter(bool isFixedFramerate, std::chrono::microseconds delay) :m_Delay(delay) {
+			m_Samples.SetFixedFramerate(isFixedFramerate);
+		}
+		bool operator()(FRAME &frame) {
+			if (frame.Video) {
+				std::this_thread::sleep_for(m_Delay);
+				Write(m_Samples.Push(std::make_shared<FRAME>(frame)));
+			}
+			else if (m_Samples.GetPending()) {
+				m_Samples.GetPending()->Duration += frame.Duration;
+			}
+			else if (m_Samples.GetLastWritten()) {
+				Write(std::make_shared<FRAME>(FRAME{ frame.StartPos, frame.Duration, m_Samples.GetLastWritten()->Video }));
+				m_RepeatedCount++;
+			}
+			return true;
+		}
+		std::vector<FRAME> Finalize() {
+			Write(m_Samples.Flush());
+			m_Samples.Clear();
+			return m_Written;
+		}
+		size_t GetRepeatedCount() const { return m_RepeatedCount; }
+	private:
+		void Write(const std::shared_ptr<FRAME> &pSample) {
+			if (pSample) {
+				m_Written.push_back(*pSample);
+			}
+		}
+		std::chrono::microseconds m_Delay;
+		VideoSampleQueue<std::shared_ptr<FRAME>> m_Samples;
+		std::vector<FRAME> m_Written;
+		size_t m_RepeatedCount = 0;
+	};
+
+	const int64_t FRAME_DURATION = 166667;
+}
+
+NATIVE_TEST(DropOldestFoldsDroppedItemIntoNextQueued)
+{
+	PipelineQueue<FRAME> queue(2, PipelineDropPolicy::DropOldest, FoldDroppedFrame);
+	for (int i = 0; i < 5; i++) {
+		CHECK(queue.Push({ i * FRAME_DURATION, FRAME_DURATION, std::make_shared<int>(i) }));
+	}
+	PIPELINE_STAGE_STATS stats = queue.GetStats();
+	CHECK_EQUAL((uint64_t)3, stats.Dropped);
+	CHECK_EQUAL((size_t)2, stats.QueueDepth);
+	FRAME first, second;
+	CHECK(queue.Pop(&first));
+	CHECK(queue.Pop(&second));
+	//Frames 0 to 3 survive as one frame with the video of frame 3.
+	CHECK_EQUAL((int64_t)0, first.StartPos);
+	CHECK_EQUAL(4 * FRAME_DURATION, first.Duration);
+	CHECK_EQUAL(3, *first.Video);
+	CHECK_EQUAL(4 * FRAME_DURATION, second.StartPos);
+	CHECK_EQUAL(4, *second.Video);
+}
+
+NATIVE_TEST(DropNewestFoldsNewItemIntoLastQueued)
+{
+	PipelineQueue<FRAME> queue(2, PipelineDropPolicy::DropNewest, FoldDroppedFrame);
+	int pushed = 0;
+	for (int i = 0; i < 5; i++) {
+		if (queue.Push({ i * FRAME_DURATION, FRAME_DURATION, std::make_shared<int>(i) })) {
+			pushed++;
+		}
+	}
+	CHECK_EQUAL(2, pushed);
+	CHECK_EQUAL((uint64_t)3, queue.GetStats().Dropped);
+	FRAME first, second;
+	queue.Pop(&first);
+	queue.Pop(&second);
+	CHECK_EQUAL(0, *first.Video);
+	CHECK_EQUAL(FRAME_DURATION, second.StartPos);
+	CHECK_EQUAL(4 * FRAME_DURATION, second.Duration);
+	CHECK_EQUAL(1, *second.Video);
+}
+
+NATIVE_TEST(SlowEncoderKeepsTimelineContinuousWithEveryPolicy)
+{
+	for (PipelineDropPolicy policy : { PipelineDropPolicy::Block, PipelineDropPolicy::DropOldest, PipelineDropPolicy::DropNewest }) {
+		FrameSink sink(std::chrono::microseconds(3000));
+		PipelineStage<FRAME> encode(2, PipelineDropPolicy::Block, std::ref(sink));
+		PipelineStage<FRAME> compose(3, policy, [&](FRAME &frame) { return encode.Push(std::move(frame)); }, FoldDroppedFrame);
+		encode.Start();
+		compose.Start();
+		//A capture producing frames three times faster than the encoder handles them.
+		const int frameCount = 200;
+		for (int i = 0; i < frameCount; i++) {
+			compose.Push({ i * FRAME_DURATION, FRAME_DURATION, std::make_shared<int>(i) });
+			std::this_thread::sleep_for(std::chrono::microseconds(1000));
+		}
+		CHECK(compose.Drain());
+		CHECK(encode.Drain());
+		std::vector<FRAME> frames = sink.GetFrames();
+		CheckContinuous(frames, frameCount * FRAME_DURATION);
+		PIPELINE_STAGE_STATS composeStats = compose.GetStats();
+		PIPELINE_STAGE_STATS encodeStats = encode.GetStats();
+		CHECK_EQUAL((uint64_t)frames.size(), encodeStats.Processed);
+		CHECK_EQUAL((uint64_t)frameCount, composeStats.Processed + composeStats.Dropped);
+		CHECK(composeStats.MaxQueueDepth <= 3);
+		if (policy == PipelineDropPolicy::Block) {
+			//Nothing is lost, the capture is throttled instead.
+			CHECK_EQUAL((size_t)frameCount, frames.size());
+			CHECK(composeStats.Blocked > 0);
+		}
+		else {
+			CHECK(composeStats.Dropped > 0);
+			CHECK(frames.size() < (size_t)frameCount);
+		}
+		//The video of a frame is never older than the video of the frame before it.
+		for (size_t i = 1; i < frames.size(); i++) {
+			CHECK(*frames[i].Video > *frames[i - 1].Video);
+		}
+	}
+}
+
+NATIVE_TEST(FailedHandlerStopsStageAndRejectsPushes)
+{
+	TRACKED::Live = 0;
+	{
+		PipelineStage<std::shared_ptr<TRACKED>> stage(4, PipelineDropPolicy::Block, [](std::shared_ptr<TRACKED> &) { return false; });
+		stage.Start();
+		CHECK(stage.Push(std::make_shared<TRACKED>()));
+		CHECK(!stage.Drain());
+		CHECK(stage.IsFailed());
+		CHECK(!stage.Push(std::make_shared<TRACKED>()));
+		CHECK_EQUAL(0, TRACKED::Live.load());
+	}
+}
+
+NATIVE_TEST(StopDiscardsQueuedItems)
+{
+	TRACKED::Live = 0;
+	std::atomic<int> processed = 0;
+	{
+		PipelineStage<std::shared_ptr<TRACKED>> stage(8, PipelineDropPolicy::Block, [&](std::shared_ptr<TRACKED> &) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(20));
+			processed++;
+			return true;
+		});
+		stage.Start();
+		for (int i = 0; i < 5; i++) {
+			stage.Push(std::make_shared<TRACKED>());
+		}
+		stage.Stop();
+		CHECK_EQUAL(0, TRACKED::Live.load());
+		CHECK(processed < 5);
+		CHECK(!stage.Push(std::make_shared<TRACKED>()));
+	}
+}
+
+NATIVE_TEST(StopWakesBlockedProducer)
+{
+	PipelineStage<int> stage(1, PipelineDropPolicy::Block, [](int &) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		return true;
+	});
+	stage.Start();
+	stage.Push(1);
+	stage.Push(2);
+	std::atomic<bool> isThirdPushed = true;
+	std::thread producer([&]() {
+		isThirdPushed = stage.Push(3) && stage.Push(4);
+	});
+	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	stage.Stop();
+	producer.join();
+	CHECK(!isThirdPushed);
+}
+
+NATIVE_TEST(SlowOptionalOutputShedsVideoWithoutHoldingUpOthers)
+{
+	FrameSink fileSink;
+	FrameSink streamSink(std::chrono::microseconds(4000));
+	PipelineFanOut<FRAME> fanOut;
+	size_t fileOutput = fanOut.AddOutput(4, PipelineDropPolicy::Block, std::ref(fileSink));
+	size_t streamOutput = fanOut.AddOptionalOutput(8, 2, std::ref(streamSink), ShedVideo);
+	fanOut.Start();
+	const int frameCount = 200;
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < frameCount; i++) {
+		CHECK(fanOut.Push({ i * FRAME_DURATION, FRAME_DURATION, std::make_shared<int>(i) }));
+		std::this_thread::sleep_for(std::chrono::microseconds(1000));
+	}
+	double pushMillis = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	CHECK(fanOut.Drain());
+	//The slow output needs 4 ms per frame, so pushing would take at least 800 ms if it held up the producer.
+	CHECK(pushMillis < 600);
+
+	std::vector<FRAME> fileFrames = fileSink.GetFrames();
+	CHECK_EQUAL((size_t)frameCount, fileFrames.size());
+	CheckContinuous(fileFrames, frameCount * FRAME_DURATION);
+	for (int i = 0; i < frameCount; i++) {
+		CHECK(fileFrames[i].Video && *fileFrames[i].Video == i);
+	}
+	//Every frame reaches the slow output, but some without video.
+	std::vector<FRAME> streamFrames = streamSink.GetFrames();
+	CHECK_EQUAL((size_t)frameCount, streamFrames.size());
+	CheckContinuous(streamFrames, frameCount * FRAME_DURATION);
+	PIPELINE_STAGE_STATS streamStats = fanOut.GetStats(streamOutput);
+	CHECK(streamStats.Shed > 0);
+	CHECK_EQUAL((uint64_t)0, fanOut.GetStats(fileOutput).Shed);
+	int withVideo = 0;
+	int lastVideo = -1;
+	for (int i = 0; i < frameCount; i++) {
+		if (streamFrames[i].Video) {
+			withVideo++;
+			//A carried over video is never newer than the frame carrying it, and never older than one already shown.
+			CHECK(*streamFrames[i].Video <= i);
+			CHECK(*streamFrames[i].Video > lastVideo);
+			lastVideo = *streamFrames[i].Video;
+		}
+	}
+	CHECK(withVideo > 0);
+	CHECK(withVideo < frameCount);
+	CHECK(streamStats.MaxQueueDepth <= 8);
+}
+
+NATIVE_TEST(FailedOptionalOutputIsDetached)
+{
+	FrameSink fileSink;
+	std::atomic<int> streamCalls = 0;
+	PipelineFanOut<FRAME> fanOut;
+	fanOut.AddOutput(4, PipelineDropPolicy::Block, std::ref(fileSink));
+	size_t streamOutput = fanOut.AddOptionalOutput(4, 2, [&](FRAME &) { return ++streamCalls < 3; }, ShedVideo);
+	fanOut.Start();
+	for (int i = 0; i < 50; i++) {
+		CHECK(fanOut.Push({ i * FRAME_DURATION, FRAME_DURATION, std::make_shared<int>(i) }));
+		fanOut.Drain();
+	}
+	CHECK(fanOut.Drain());
+	CHECK(!fanOut.IsFailed());
+	CHECK(fanOut.IsOutputFailed(streamOutput));
+	CHECK_EQUAL(3, streamCalls.load());
+	CHECK_EQUAL((size_t)50, fileSink.GetFrames().size());
+}
+
+NATIVE_TEST(FailedRequiredOutputFailsFanOut)
+{
+	FrameSink streamSink;
+	PipelineFanOut<FRAME> fanOut;
+	fanOut.AddOutput(4, PipelineDropPolicy::Block, [](FRAME &frame) { return frame.StartPos < 10 * FRAME_DURATION; });
+	fanOut.AddOptionalOutput(4, 2, std::ref(streamSink), ShedVideo);
+	fanOut.Start();
+	bool isPushFailed = false;
+	for (int i = 0; i < 50 && !isPushFailed; i++) {
+		isPushFailed = !fanOut.Push({ i * FRAME_DURATION, FRAME_DURATION, std::make_shared<int>(i) });
+		fanOut.Drain();
+	}
+	CHECK(isPushFailed);
+	CHECK(fanOut.IsFailed());
+	CHECK(!fanOut.Drain());
+}
+
+NATIVE_TEST(OverlayUpdateBetweenAcquireAndComposeCountsAsChange)
+{
+	//The capture loop acquires frames and the compose stage draws the overlays on them up to a queue later. An overlay updated in between
+	//is drawn on the queued frame, and must still make the next acquired frame count as changed, or that frame only extends the one before it.
+	FrameUpdateTracker tracker;
+	std::atomic<int64_t> overlayUpdateTime = 1;
+	std::atomic<bool> isComposeReleased = false;
+	std::atomic<int> composedUpdateCount = -1;
+	PipelineStage<int64_t> compose(4, PipelineDropPolicy::Block, [&](int64_t &acquiredTimeStamp) {
+		while (!isComposeReleased) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		composedUpdateCount = FrameUpdateTracker::IsUpdatedSince(overlayUpdateTime, acquiredTimeStamp) ? 1 : 0;
+		return true;
+	});
+	compose.Start();
+	CHECK(tracker.IsUpdatedSinceLastAcquire(overlayUpdateTime));
+	tracker.SetLastAcquireTime(2);
+	CHECK(compose.Push(2));
+	overlayUpdateTime = 3;
+	isComposeReleased = true;
+	CHECK(compose.Drain());
+	CHECK_EQUAL(1, composedUpdateCount.load());
+	CHECK_EQUAL((int64_t)2, tracker.GetLastAcquireTime());
+	CHECK(tracker.IsUpdatedSinceLastAcquire(overlayUpdateTime));
+	tracker.SetLastAcquireTime(5);
+	CHECK(!tracker.IsUpdatedSinceLastAcquire(overlayUpdateTime));
+}
+
+NATIVE_TEST(ShedFramesKeepTheSamplesOfSlowOutputsContinuous)
+{
+	//A slow additional output sheds the video of frames. Its samples must still cover the whole recording, at a fixed framerate by writing the last frame again.
+	for (bool isFixedFramerate : { true, false }) {
+		FrameSink fileSink;
+		SampleWriter streamWriter(isFixedFramerate, std::chrono::microseconds(4000));
+		PipelineFanOut<FRAME> fanOut;
+		fanOut.AddOutput(4, PipelineDropPolicy::Block, std::ref(fileSink));
+		size_t streamOutput = fanOut.AddOptionalOutput(8, 2, std::ref(streamWriter), ShedVideo);
+		fanOut.Start();
+		const int frameCount = 100;
+		for (int i = 0; i < frameCount; i++) {
+			CHECK(fanOut.Push({ i * FRAME_DURATION, FRAME_DURATION, std::make_shared<int>(i) }));
+			std::this_thread::sleep_for(std::chrono::microseconds(1000));
+		}
+		CHECK(fanOut.Drain());
+		CHECK(fanOut.GetStats(streamOutput).Shed > 0);
+		std::vector<FRAME> samples = streamWriter.Finalize();
+		CheckContinuous(samples, frameCount * FRAME_DURATION);
+		int lastVideo = -1;
+		for (const FRAME &sample : samples) {
+			CHECK(sample.Video && *sample.Video >= lastVideo);
+			lastVideo = *sample.Video;
+		}
+		if (isFixedFramerate) {
+			//Every frame is a sample of its own, and the shed ones repeat the frame before them.
+			CHECK_EQUAL((size_t)frameCount, samples.size());
+			CHECK(streamWriter.GetRepeatedCount() > 0);
+		}
+		else {
+			CHECK(samples.size() < (size_t)frameCount);
+			CHECK_EQUAL((size_t)0, streamWriter.GetRepeatedCount());
+		}
+	}
+}
@@ -0,0 +1,441 @@
+#include "NativeTest.h"
+#include "FrameReadback.h"
+#include <atomic>
+#include <random>
+#include <thread>
+
+namespace {
+	/// <summary>
+	/// Stands in for a GPU texture: a frame of 32-bit pixels.
+	/// </summary>
+	struct FAKE_FRAME {
+		uint32_t Width = 0;
+		uint32_t Height = 0;
+		std::vector<uint32_t> Pixels;
+	};
+
+	/// <summary>
+	/// Copies fake frames to CPU memory like D3D11StagingReadbackBackend. A copy completes after a number of calls to Advance,
+	/// and mapping a slot without waiting fails until then, like D3D11_MAP_FLAG_DO_NOT_WAIT does while the GPU is busy.
+	/// </summary>
+	class FakeReadbackBackend : public IReadbackBackend<const FAKE_FRAME *>
+	{
+	public:
+		struct STATE {
+			//Number of Advance calls a copy takes to complete.
+			int CopyLatency = 0;
+			int Tick = 0;
+			int SlotsCreated = 0;
+			int FullCopies = 0;
+			int PartialCopies = 0;
+			uint64_t CopiedPixels = 0;
+			int Maps = 0;
+			int Unmaps = 0;
+			bool IsMapFailing = false;
+		};
+		FakeReadbackBackend(STATE *pState, size_t depth) :m_State(pState), m_Slots(depth) {}
+
+		void Advance() {
+			m_State->Tick++;
+		}
+
+		bool PrepareSlot(size_t index, const FAKE_FRAME *source) override {
+			FAKE_SLOT &slot = m_Slots[index];
+			if (slot.Width == source->Width && slot.Height == source->Height) {
+				return false;
+			}
+			slot.Width = source->Width;
+			slot.Height = source->Height;
+			//New staging textures have undefined content.
+			slot.Pixels.assign(source->Pixels.size(), 0xDEADBEEF);
+			m_State->SlotsCreated++;
+			return true;
+		}
+		void CopyToSlot(size_t index, const FAKE_FRAME *source, const DirtyRegion *pRegion) override {
+			FAKE_SLOT &slot = m_Slots[index];
+			if (!pRegion) {
+				slot.Pixels = source->Pixels;
+				m_State->CopiedPixels += source->Pixels.size();
+				m_State->FullCopies++;
+			}
+			else {
+				REGION_RECT frameRect{ 0, 0, (int32_t)slot.Width, (int32_t)slot.Height };
+				for (const REGION_RECT &regionRect : pRegion->GetRects()) {
+					REGION_RECT rect = DirtyRegion::Intersect(regionRect, frameRect);
+					for (int32_t y = rect.top; y < rect.bottom; y++) {
+						for (int32_t x = rect.left; x < rect.right; x++) {
+							slot.Pixels[y * slot.Width + x] = source->Pixels[y * slot.Width + x];
+						}
+					}
+					m_State->CopiedPixels += rect.Area();
+				}
+				m_State->PartialCopies++;
+			}
+			slot.CompleteTick = m_State->Tick + m_State->CopyLatency;
+		}
+		bool MapSlot(size_t index, bool wait, READBACK_MAPPING *pMapping) override {
+			FAKE_SLOT &slot = m_Slots[index];
+			if (m_State->IsMapFailing) {
+				return false;
+			}
+			if (m_State->Tick < slot.CompleteTick) {
+				if (!wait) {
+					return false;
+				}
+				m_State->Tick = slot.CompleteTick;
+			}
+			pMapping->pData = (const uint8_t *)slot.Pixels.data();
+			pMapping->RowPitch = slot.Width * sizeof(uint32_t);
+			pMapping->Width = slot.Width;
+			pMapping->Height = slot.Height;
+			m_State->Maps++;
+			return true;
+		}
+		void UnmapSlot(size_t index) override {
+			m_State->Unmaps++;
+		}
+	private:
+		struct FAKE_SLOT {
+			uint32_t Width = 0;
+			uint32_t Height = 0;
+			std::vector<uint32_t> Pixels;
+			int CompleteTick = 0;
+		};
+		STATE *m_State;
+		std::vector<FAKE_SLOT> m_Slots;
+	};
+
+	typedef ReadbackRing<const FAKE_FRAME *> FakeRing;
+
+	/// <summary>
+	/// Creates a ring with a fake backend, and returns the backend so the test can advance its clock.
+	/// </summary>
+	std::unique_ptr<FakeRing> CreateRing(FakeReadbackBackend::STATE *pState, size_t depth, FakeReadbackBackend **ppBackend) {
+		auto backend = std::make_unique<FakeReadbackBackend>(pState, depth);
+		*ppBackend = backend.get();
+		return std::make_unique<FakeRing>(std::move(backend), depth);
+	}
+
+	FAKE_FRAME CreateFrame(uint32_t width, uint32_t height, uint32_t value) {
+		FAKE_FRAME frame;
+		frame.Width = width;
+		frame.Height = height;
+		frame.Pixels.assign(width * height, value);
+		return frame;
+	}
+
+	READBACK_FRAME_INFO FrameInfo(int frameNumber) {
+		READBACK_FRAME_INFO info;
+		info.FrameNumber = frameNumber;
+		info.Timestamp = frameNumber * 16;
+		return info;
+	}
+
+	void CheckStatsAddUp(const READBACK_RING_STATS &stats, uint64_t pending) {
+		CHECK_EQUAL(stats.Submitted, stats.Delivered + stats.Dropped + stats.Superseded + pending);
+	}
+}
+
+NATIVE_TEST(FrameIsDeliveredOnceItsCopyCompletes)
+{
+	FakeReadbackBackend::STATE state;
+	state.CopyLatency = 2;
+	FakeReadbackBackend *pBackend;
+	auto ring = CreateRing(&state, 3, &pBackend);
+	FAKE_FRAME frame = CreateFrame(8, 4, 7);
+	ring->Submit(&frame, FrameInfo(1), nullptr);
+	int delivered = 0;
+	auto onFrame = [&](const READBACK_FRAME_INFO &info, const READBACK_MAPPING &mapping) {
+		CHECK_EQUAL(1, info.FrameNumber);
+		CHECK_EQUAL((uint32_t)8, mapping.Width);
+		CHECK_EQUAL((uint32_t)4, mapping.Height);
+		CHECK_EQUAL((uint32_t)32, mapping.RowPitch);
+		CHECK_EQUAL((uint32_t)7, ((const uint32_t *)mapping.pData)[31]);
+		delivered++;
+	};
+	CHECK(!ring->Poll(onFrame));
+	pBackend->Advance();
+	CHECK(!ring->Poll(onFrame));
+	pBackend->Advance();
+	CHECK(ring->Poll(onFrame));
+	CHECK_EQUAL(1, delivered);
+	//Each frame is delivered only once.
+	CHECK(!ring->Poll(onFrame));
+	CHECK_EQUAL(state.Maps, state.Unmaps);
+	READBACK_RING_STATS stats = ring->GetStats();
+	CHECK_EQUAL((uint64_t)1, stats.Submitted);
+	CHECK_EQUAL((uint64_t)1, stats.Delivered);
+	CHECK_EQUAL((uint64_t)1, stats.FullCopies);
+}
+
+NATIVE_TEST(NewestCompletedFrameWinsAndOlderOnesAreSuperseded)
+{
+	FakeReadbackBackend::STATE state;
+	state.CopyLatency = 1;
+	FakeReadbackBackend *pBackend;
+	auto ring = CreateRing(&state, 3, &pBackend);
+	FAKE_FRAME frame = CreateFrame(4, 4, 0);
+	ring->Submit(&frame, FrameInfo(1), nullptr);
+	ring->Submit(&frame, FrameInfo(2), nullptr);
+	pBackend->Advance();
+	//Frame 3 is not done yet, so frame 2 is the newest one available, and frame 1 is skipped.
+	ring->Submit(&frame, FrameInfo(3), nullptr);
+	std::vector<int> frameNumbers;
+	auto onFrame = [&](const READBACK_FRAME_INFO &info, const READBACK_MAPPING &mapping) {
+		frameNumbers.push_back(info.FrameNumber);
+	};
+	CHECK(ring->Poll(onFrame));
+	CHECK(!ring->Poll(onFrame));
+	pBackend->Advance();
+	CHECK(ring->Poll(onFrame));
+	CHECK((frameNumbers == std::vector<int>{ 2, 3 }));
+	READBACK_RING_STATS stats = ring->GetStats();
+	CHECK_EQUAL((uint64_t)1, stats.Superseded);
+	CHECK_EQUAL((uint64_t)0, stats.Dropped);
+	CheckStatsAddUp(stats, 0);
+}
+
+NATIVE_TEST(FullRingDropsOldestPendingFrame)
+{
+	for (size_t depth : { 1, 2, 3, 5 }) {
+		FakeReadbackBackend::STATE state;
+		state.CopyLatency = 1000;
+		FakeReadbackBackend *pBackend;
+		auto ring = CreateRing(&state, depth, &pBackend);
+		CHECK_EQUAL(depth, ring->GetDepth());
+		FAKE_FRAME frame = CreateFrame(4, 4, 0);
+		//The consumer never gets a frame, as no copy completes, and each submit past the depth overwrites a pending frame.
+		for (int i = 1; i <= 20; i++) {
+			ring->Submit(&frame, FrameInfo(i), nullptr);
+			CHECK(!ring->Poll([](const READBACK_FRAME_INFO &, const READBACK_MAPPING &) {}));
+		}
+		READBACK_RING_STATS stats = ring->GetStats();
+		CHECK_EQUAL((uint64_t)(20 - depth), stats.Dropped);
+		CheckStatsAddUp(stats, depth);
+		//Waiting delivers the newest frame and skips the rest.
+		int frameNumber = 0;
+		CHECK(ring->Poll([&](const READBACK_FRAME_INFO &info, const READBACK_MAPPING &) { frameNumber = info.FrameNumber; }, true));
+		CHECK_EQUAL(20, frameNumber);
+		stats = ring->GetStats();
+		CHECK_EQUAL((uint64_t)(depth - 1), stats.Superseded);
+		CheckStatsAddUp(stats, 0);
+	}
+}
+
+NATIVE_TEST(PartialCopiesKeepSlotsInSyncWithSource)
+{
+	const uint32_t width = 64, height = 48;
+	std::mt19937 rng(1);
+	for (size_t depth : { 1, 2, 3, 4 }) {
+		FakeReadbackBackend::STATE state;
+		state.CopyLatency = 1;
+		FakeReadbackBackend *pBackend;
+		auto ring = CreateRing(&state, depth, &pBackend);
+		FAKE_FRAME source = CreateFrame(width, height, 0);
+		//Every submitted frame is kept, so each delivered one can be compared with what was submitted.
+		std::vector<std::vector<uint32_t>> history;
+		int mismatches = 0;
+		auto onFrame = [&](const READBACK_FRAME_INFO &info, const READBACK_MAPPING &mapping) {
+			const std::vector<uint32_t> &expected = history[info.FrameNumber];
+			if (memcmp(mapping.pData, expected.data(), expected.size() * sizeof(uint32_t)) != 0) {
+				mismatches++;
+			}
+		};
+		for (int frameNumber = 0; frameNumber < 500; frameNumber++) {
+			DirtyRegion changes;
+			int changeCount = rng() % 4;
+			for (int i = 0; i < changeCount; i++) {
+				int32_t x = rng() % width, y = rng() % height;
+				REGION_RECT rect{ x, y, x + 1 + (int32_t)(rng() % 16), y + 1 + (int32_t)(rng() % 16) };
+				rect = DirtyRegion::Intersect(rect, REGION_RECT{ 0, 0, (int32_t)width, (int32_t)height });
+				for (int32_t py = rect.top; py < rect.bottom; py++) {
+					for (int32_t px = rect.left; px < rect.right; px++) {
+						source.Pixels[py * width + px] = (uint32_t)rng();
+					}
+				}
+				changes.Add(rect);
+			}
+			history.push_back(source.Pixels);
+			//Now and then the changes are unknown, e.g. after a capture source switched.
+			bool isKnown = rng() % 50 != 0;
+			ring->Submit(&source, FrameInfo(frameNumber), isKnown ? &changes : nullptr);
+			//The consumer polls irregularly, so slots are sometimes dropped and sometimes skipped.
+			if (rng() % 3 == 0) {
+				pBackend->Advance();
+			}
+			if (rng() % 2 == 0) {
+				ring->Poll(onFrame);
+			}
+		}
+		CHECK_EQUAL(0, mismatches);
+		READBACK_RING_STATS stats = ring->GetStats();
+		CHECK(stats.Delivered > 50);
+		//Only the first frame of each slot and frames with unknown changes are copied in full.
+		CHECK((int)stats.FullCopies == state.FullCopies);
+		CHECK(stats.FullCopies < 50);
+		CHECK(state.CopiedPixels < (uint64_t)500 * width * height / 4);
+	}
+}
+
+NATIVE_TEST(ResizedSourceRecreatesSlotWithFullCopy)
+{
+	FakeReadbackBackend::STATE state;
+	FakeReadbackBackend *pBackend;
+	auto ring = CreateRing(&state, 2, &pBackend);
+	FAKE_FRAME small = CreateFrame(4, 4, 1);
+	FAKE_FRAME large = CreateFrame(8, 8, 2);
+	DirtyRegion changes;
+	changes.Add(REGION_RECT{ 0, 0, 1, 1 });
+	ring->Submit(&small, FrameInfo(0), nullptr);
+	ring->Submit(&small, FrameInfo(1), &changes);
+	ring->Submit(&small, FrameInfo(2), &changes);
+	CHECK_EQUAL(1, state.PartialCopies);
+	//The region is known, but the slot had to be recreated, so its content is undefined.
+	ring->Submit(&large, FrameInfo(3), &changes);
+	CHECK_EQUAL(3, state.SlotsCreated);
+	CHECK_EQUAL((uint64_t)3, ring->GetStats().FullCopies);
+	uint32_t firstPixel = 0, lastPixel = 0;
+	CHECK(ring->Poll([&](const READBACK_FRAME_INFO &info, const READBACK_MAPPING &mapping) {
+		firstPixel = ((const uint32_t *)mapping.pData)[0];
+		lastPixel = ((const uint32_t *)mapping.pData)[63];
+	}));
+	CHECK_EQUAL((uint32_t)2, firstPixel);
+	CHECK_EQUAL((uint32_t)2, lastPixel);
+}
+
+NATIVE_TEST(UnmappableSlotIsDroppedWhenWaiting)
+{
+	FakeReadbackBackend::STATE state;
+	FakeReadbackBackend *pBackend;
+	auto ring = CreateRing(&state, 3, &pBackend);
+	FAKE_FRAME frame = CreateFrame(4, 4, 0);
+	ring->Submit(&frame, FrameInfo(1), nullptr);
+	ring->Submit(&frame, FrameInfo(2), nullptr);
+	state.IsMapFailing = true;
+	auto onFrame = [](const READBACK_FRAME_INFO &, const READBACK_MAPPING &) {};
+	//Without waiting, the frames stay pending in case the copy is just not done yet.
+	CHECK(!ring->Poll(onFrame));
+	CHECK_EQUAL((uint64_t)0, ring->GetStats().Dropped);
+	CHECK(!ring->Poll(onFrame, true));
+	READBACK_RING_STATS stats = ring->GetStats();
+	CHECK_EQUAL((uint64_t)2, stats.Dropped);
+	CheckStatsAddUp(stats, 0);
+	state.IsMapFailing = false;
+	CHECK(!ring->Poll(onFrame, true));
+	CHECK_EQUAL(0, state.Maps);
+}
+
+NATIVE_TEST(ResetDiscardsPendingFramesAndForcesFullCopies)
+{
+	FakeReadbackBackend::STATE state;
+	FakeReadbackBackend *pBackend;
+	auto ring = CreateRing(&state, 2, &pBackend);
+	FAKE_FRAME frame = CreateFrame(4, 4, 0);
+	DirtyRegion changes;
+	changes.Add(REGION_RECT{ 0, 0, 1, 1 });
+	ring->Submit(&frame, FrameInfo(1), nullptr);
+	ring->Submit(&frame, FrameInfo(2), nullptr);
+	ring->Reset();
+	CHECK(!ring->Poll([](const READBACK_FRAME_INFO &, const READBACK_MAPPING &) {}, true));
+	ring->Submit(&frame, FrameInfo(3), &changes);
+	CHECK_EQUAL(3, state.FullCopies);
+	CHECK_EQUAL(0, state.PartialCopies);
+}
+
+NATIVE_TEST(DispatcherDeliversLatestValueToSlowHandler)
+{
+	std::atomic<int> handled(0);
+	std::atomic<int> lastValue(-1);
+	std::atomic<bool> isOutOfOrder(false);
+	LatestValueDispatcher<int> dispatcher([&](int &value) {
+		if (value <= lastValue) {
+			isOutOfOrder = true;
+		}
+		lastValue = value;
+		std::this_thread::sleep_for(std::chrono::milliseconds(2));
+		handled++;
+	});
+	dispatcher.Start();
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < 2000; i++) {
+		*dispatcher.BeginWrite() = i;
+		dispatcher.Publish();
+		if (i % 100 == 0) {
+			std::this_thread::yield();
+		}
+	}
+	double publishMillis = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	dispatcher.Stop(true);
+	//The producer never waits for the 2 ms handler.
+	CHECK(publishMillis < 2000);
+	CHECK(!isOutOfOrder);
+	//The last value is always delivered when stopping with deliverPending.
+	CHECK_EQUAL(1999, lastValue.load());
+	LATEST_VALUE_DISPATCHER_STATS stats = dispatcher.GetStats();
+	CHECK_EQUAL((uint64_t)2000, stats.Published);
+	CHECK_EQUAL((uint64_t)handled.load(), stats.Delivered);
+	CHECK_EQUAL(stats.Published, stats.Delivered + stats.Dropped);
+	CHECK(stats.Dropped > 0);
+}
+
+NATIVE_TEST(DispatcherNeverHandsWrittenValueToHandler)
+{
+	//Each value is a buffer filled with one number. If the producer ever wrote to the buffer the handler reads, it would see mixed numbers.
+	std::atomic<int> tornValues(0);
+	std::atomic<int> handled(0);
+	LatestValueDispatcher<std::vector<int>> dispatcher([&](std::vector<int> &value) {
+		for (int pass = 0; pass < 3; pass++) {
+			for (int number : value) {
+				if (number != value[0]) {
+					tornValues++;
+					return;
+				}
+			}
+			std::this_thread::yield();
+		}
+		handled++;
+	});
+	dispatcher.Start();
+	for (int i = 0; i < 20000; i++) {
+		std::vector<int> *pValue = dispatcher.BeginWrite();
+		pValue->assign(256, i);
+		dispatcher.Publish();
+	}
+	dispatcher.Stop(true);
+	CHECK_EQUAL(0, tornValues.load());
+	CHECK(handled > 0);
+}
+
+NATIVE_TEST(DispatcherStopWithoutDeliveringDropsPendingValue)
+{
+	std::atomic<bool> isHandling(false);
+	std::atomic<bool> isReleased(false);
+	std::vector<int> values;
+	LatestValueDispatcher<int> dispatcher([&](int &value) {
+		values.push_back(value);
+		isHandling = true;
+		while (!isReleased) {
+			std::this_thread::yield();
+		}
+	});
+	//Lets the handler return if a check fails, so the dispatcher can be destroyed.
+	std::shared_ptr<void> releaseGuard(nullptr, [&](void *) { isReleased = true; });
+	bool isThreadStarted = false, isThreadExited = false;
+	dispatcher.Start([&]() { isThreadStarted = true; }, [&]() { isThreadExited = true; });
+	*dispatcher.BeginWrite() = 1;
+	dispatcher.Publish();
+	while (!isHandling) {
+		std::this_thread::yield();
+	}
+	*dispatcher.BeginWrite() = 2;
+	dispatcher.Publish();
+	isReleased = true;
+	dispatcher.Stop(false);
+	CHECK(isThreadStarted);
+	CHECK(isThreadExited);
+	//Value 2 may have been picked up before Stop, but then nothing was dropped.
+	LATEST_VALUE_DISPATCHER_STATS stats = dispatcher.GetStats();
+	CHECK_EQUAL(stats.Published, stats.Delivered + stats.Dropped);
+	CHECK_EQUAL((size_t)stats.Delivered, values.size());
+	CHECK_EQUAL(1, values[0]);
+}
@@ -0,0 +1,178 @@
+#include "NativeTest.h"
+#include "GifFrameCache.h"
+#include "GifTestDecoder.h"
+#include <atomic>
+#include <thread>
+
+namespace {
+	void ComposeFrame(GifFrameComposer &composer, const GIF_TEST_IMAGE &image, uint32_t index) {
+		const GIF_TEST_FRAME &frame = image.Frames[index];
+		composer.ComposeFrame(index, frame.Info, reinterpret_cast<const uint8_t *>(frame.Pixels.data()), frame.Info.Position.Width * sizeof(uint32_t));
+	}
+
+	/// <summary>
+	/// Builds the cache of a GIF the way GifReader does, giving up once it no longer fits in maxBytes.
+	/// </summary>
+	std::shared_ptr<GifFrameCache> BuildCache(const GIF_TEST_IMAGE &image, size_t maxBytes) {
+		auto pCache = std::make_shared<GifFrameCache>(image.Width, image.Height);
+		GifFrameComposer composer(image.Width, image.Height);
+		for (uint32_t i = 0; i < image.Frames.size(); i++) {
+			ComposeFrame(composer, image, i);
+			if (!pCache->AddFrame(composer, image.Frames[i].Info.DelayMillis, maxBytes)) {
+				return nullptr;
+			}
+		}
+		pCache->ShrinkToFit();
+		return pCache;
+	}
+
+	/// <summary>
+	/// Plays the cache twice over on a canvas holding other pixels, and checks every frame is the frame the composer gives, with its delay.
+	/// </summary>
+	void CheckCacheReplaysComposedFrames(const std::string &path) {
+		GIF_TEST_IMAGE image = GifTestDecoder::Decode(path);
+		std::shared_ptr<GifFrameCache> pCache = BuildCache(image, SIZE_MAX);
+		CHECK(pCache != nullptr);
+		CHECK_EQUAL(image.Frames.size(), pCache->GetFrameCount());
+		std::vector<uint32_t> canvas(static_cast<size_t>(image.Width) * image.Height, 0xDEADBEEF);
+		GifFrameComposer composer(image.Width, image.Height);
+		for (int loop = 0; loop < 2; loop++) {
+			for (uint32_t i = 0; i < pCache->GetFrameCount(); i++) {
+				const GIF_CACHED_FRAME &frame = pCache->GetFrame(i);
+				const uint32_t *pPixels = pCache->GetFramePixels(i);
+				for (uint32_t row = 0; row < frame.Rect.Height; row++) {
+					memcpy(&canvas[static_cast<size_t>(frame.Rect.Top + row) * image.Width + frame.Rect.Left], pPixels + static_cast<size_t>(row) * frame.Rect.Width, frame.Rect.Width * sizeof(uint32_t));
+				}
+				ComposeFrame(composer, image, i);
+				if (memcmp(canvas.data(), composer.GetCanvas(), canvas.size() * sizeof(uint32_t)) != 0) {
+					printf("       %s frame %u differs from the composed frame\n", path.c_str(), i);
+					CHECK(false);
+				}
+				CHECK_EQUAL(image.Frames[i].Info.DelayMillis, frame.DelayMillis);
+			}
+		}
+	}
+
+	/// <summary>
+	/// A cache of a single transparent 16x16 frame, if it fits in maxBytes.
+	/// </summary>
+	std::shared_ptr<GifFrameCache> CreateSmallCache(size_t maxBytes) {
+		GifFrameComposer composer(16, 16);
+		auto pCache = std::make_shared<GifFrameCache>(16, 16);
+		return pCache->AddFrame(composer, 90, maxBytes) ? pCache : nullptr;
+	}
+
+	const size_t SMALL_CACHE_BYTES = 16 * 16 * sizeof(uint32_t) + sizeof(GIF_CACHED_FRAME);
+}
+
+NATIVE_TEST(CachedEarthGifReplaysTheComposedFrames)
+{
+	CheckCacheReplaysComposedFrames(NATIVE_TEST_MEDIA_DIR "/earth.gif");
+}
+
+NATIVE_TEST(CachedGiftestGifReplaysTheComposedFrames)
+{
+	CheckCacheReplaysComposedFrames(NATIVE_TEST_MEDIA_DIR "/giftest.gif");
+}
+
+NATIVE_TEST(CachedDisposalFixturesReplayTheComposedFrames)
+{
+	CheckCacheReplaysComposedFrames(NATIVE_TEST_FIXTURES_DIR "/DisposePrevious.gif");
+	CheckCacheReplaysComposedFrames(NATIVE_TEST_FIXTURES_DIR "/DisposeBackground.gif");
+}
+
+NATIVE_TEST(CacheKeepsOnlyTheChangedAreasOfFrames)
+{
+	//Most frames of giftest.gif change a small part of the image.
+	GIF_TEST_IMAGE image = GifTestDecoder::Decode(NATIVE_TEST_MEDIA_DIR "/giftest.gif");
+	std::shared_ptr<GifFrameCache> pCache = BuildCache(image, SIZE_MAX);
+	size_t fullFrameBytes = static_cast<size_t>(image.Width) * image.Height * sizeof(uint32_t);
+	CHECK(pCache->GetSizeInBytes() < fullFrameBytes * image.Frames.size() / 2);
+	//The first frame covers the whole image, so playback can start on any canvas.
+	CHECK_EQUAL(image.Width, pCache->GetFrame(0).Rect.Width);
+	CHECK_EQUAL(image.Height, pCache->GetFrame(0).Rect.Height);
+}
+
+NATIVE_TEST(BuildingACacheOverTheBudgetFails)
+{
+	GIF_TEST_IMAGE image = GifTestDecoder::Decode(NATIVE_TEST_MEDIA_DIR "/giftest.gif");
+	std::shared_ptr<GifFrameCache> pCache = BuildCache(image, SIZE_MAX);
+	CHECK(BuildCache(image, pCache->GetSizeInBytes()) != nullptr);
+	CHECK(BuildCache(image, pCache->GetSizeInBytes() - 1) == nullptr);
+	//A frame that does not fit leaves the cache as it was.
+	GifFrameCache cache(image.Width, image.Height);
+	GifFrameComposer composer(image.Width, image.Height);
+	ComposeFrame(composer, image, 0);
+	CHECK(!cache.AddFrame(composer, 90, 100));
+	CHECK_EQUAL((size_t)0, cache.GetFrameCount());
+	CHECK_EQUAL((size_t)0, cache.GetSizeInBytes());
+}
+
+NATIVE_TEST(RegistrySharesCachesByKey)
+{
+	GifFrameCacheRegistry registry;
+	int built = 0;
+	auto createCache = [&](size_t maxBytes) {
+		built++;
+		return CreateSmallCache(maxBytes);
+	};
+	auto pFirst = registry.GetOrCreate(L"a.gif", SMALL_CACHE_BYTES * 2, createCache);
+	auto pSecond = registry.GetOrCreate(L"a.gif", SMALL_CACHE_BYTES * 2, createCache);
+	CHECK(pFirst != nullptr);
+	CHECK(pFirst == pSecond);
+	CHECK_EQUAL(1, built);
+	//Caches without a key are not shared.
+	auto pUnshared = registry.GetOrCreate(L"", SMALL_CACHE_BYTES * 2, createCache);
+	CHECK(pUnshared != nullptr);
+	CHECK(pUnshared != pFirst);
+	CHECK_EQUAL(2, built);
+}
+
+NATIVE_TEST(RegistryKeepsLiveCachesWithinTheBudget)
+{
+	//Room for one cache and a half.
+	const size_t budget = SMALL_CACHE_BYTES * 3 / 2;
+	GifFrameCacheRegistry registry;
+	int built = 0;
+	auto createCache = [&](size_t maxBytes) {
+		built++;
+		return CreateSmallCache(maxBytes);
+	};
+	auto pFirst = registry.GetOrCreate(L"a.gif", budget, createCache);
+	auto pSecond = registry.GetOrCreate(L"b.gif", budget, createCache);
+	CHECK(pFirst != nullptr);
+	CHECK(pSecond == nullptr);
+	//Released caches no longer count towards the budget, and are built again when next read.
+	pFirst.reset();
+	pSecond = registry.GetOrCreate(L"b.gif", budget, createCache);
+	CHECK(pSecond != nullptr);
+	pSecond.reset();
+	pFirst = registry.GetOrCreate(L"a.gif", budget, createCache);
+	CHECK(pFirst != nullptr);
+	CHECK_EQUAL(4, built);
+}
+
+NATIVE_TEST(ConcurrentReadersOfAGifBuildItsCacheOnce)
+{
+	GifFrameCacheRegistry registry;
+	std::atomic<int> built{ 0 };
+	std::vector<std::shared_ptr<const GifFrameCache>> caches(8);
+	std::vector<std::thread> threads;
+	for (size_t i = 0; i < caches.size(); i++) {
+		threads.emplace_back([&, i]() {
+			caches[i] = registry.GetOrCreate(L"a.gif", SIZE_MAX, [&](size_t maxBytes) {
+				built++;
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+				return CreateSmallCache(maxBytes);
+			});
+		});
+	}
+	for (std::thread &thread : threads) {
+		thread.join();
+	}
+	CHECK_EQUAL(1, built.load());
+	for (const auto &pCache : caches) {
+		CHECK(pCache != nullptr);
+		CHECK(pCache == caches[0]);
+	}
+}
@@ -0,0 +1,136 @@
+#include "NativeTest.h"
+#include "GifFrameComposer.h"
+#include "GifTestDecoder.h"
+
+namespace {
+	/// <summary>
+	/// Composes every frame of the GIF twice over, so the restart of the loop is checked too, and compares each frame with the frame Pillow composed.
+	/// Also checks that the composer only changed the pixels within the area it reports.
+	/// </summary>
+	void CheckComposedFramesMatchPillow(const std::string &path, const std::string &gifName) {
+		GIF_TEST_IMAGE image = GifTestDecoder::Decode(path);
+		std::vector<uint64_t> referenceFrames = ReadGifReferenceFrames(gifName);
+		CHECK_EQUAL(referenceFrames.size(), image.Frames.size());
+		size_t pixelCount = static_cast<size_t>(image.Width) * image.Height;
+		GifFrameComposer composer(image.Width, image.Height);
+		std::vector<uint32_t> previousCanvas(pixelCount, 0);
+		for (int loop = 0; loop < 2; loop++) {
+			for (uint32_t i = 0; i < image.Frames.size() && i < referenceFrames.size(); i++) {
+				const GIF_TEST_FRAME &frame = image.Frames[i];
+				composer.ComposeFrame(i, frame.Info, reinterpret_cast<const uint8_t *>(frame.Pixels.data()), frame.Info.Position.Width * sizeof(uint32_t));
+				uint64_t hash = HashComposedFrame(composer.GetCanvas(), pixelCount);
+				if (hash != referenceFrames[i]) {
+					printf("       %s frame %u differs from Pillow\n", gifName.c_str(), i);
+					CHECK_EQUAL(referenceFrames[i], hash);
+				}
+				GIF_RECT changedRect = composer.GetChangedRect();
+				size_t changedOutside = 0;
+				for (uint32_t row = 0; row < image.Height; row++) {
+					for (uint32_t col = 0; col < image.Width; col++) {
+						bool isInside = col >= changedRect.Left && col < changedRect.Left + changedRect.Width && row >= changedRect.Top && row < changedRect.Top + changedRect.Height;
+						size_t index = static_cast<size_t>(row) * image.Width + col;
+						changedOutside += !isInside && composer.GetCanvas()[index] != previousCanvas[index] ? 1 : 0;
+					}
+				}
+				if (changedOutside > 0) {
+					printf("       %s frame %u changed pixels outside its changed area\n", gifName.c_str(), i);
+					CHECK_EQUAL((size_t)0, changedOutside);
+				}
+				previousCanvas.assign(composer.GetCanvas(), composer.GetCanvas() + pixelCount);
+			}
+		}
+	}
+
+	GIF_FRAME_INFO MakeFrame(uint32_t left, uint32_t top, uint32_t width, uint32_t height, uint8_t disposal) {
+		GIF_FRAME_INFO frame;
+		frame.Position = GIF_RECT{ left, top, width, height };
+		frame.Disposal = disposal;
+		return frame;
+	}
+}
+
+NATIVE_TEST(EarthGifFramesMatchPillow)
+{
+	CheckComposedFramesMatchPillow(NATIVE_TEST_MEDIA_DIR "/earth.gif", "earth.gif");
+}
+
+NATIVE_TEST(GiftestGifFramesMatchPillow)
+{
+	//Frames covering part of the image, with transparent pixels and disposal to the background.
+	CheckComposedFramesMatchPillow(NATIVE_TEST_MEDIA_DIR "/giftest.gif", "giftest.gif");
+}
+
+NATIVE_TEST(DisposeToPreviousFramesMatchPillow)
+{
+	CheckComposedFramesMatchPillow(NATIVE_TEST_FIXTURES_DIR "/DisposePrevious.gif", "DisposePrevious.gif");
+}
+
+NATIVE_TEST(DisposeToBackgroundFramesMatchPillow)
+{
+	CheckComposedFramesMatchPillow(NATIVE_TEST_FIXTURES_DIR "/DisposeBackground.gif", "DisposeBackground.gif");
+}
+
+NATIVE_TEST(UndefinedAndReservedDisposalsLeaveTheFrameInPlace)
+{
+	const uint32_t red = 0xFFFF0000;
+	const uint32_t transparent = 0;
+	GifFrameComposer composer(2, 1);
+	composer.ComposeFrame(0, MakeFrame(0, 0, 1, 1, GIF_DISPOSAL_UNDEFINED), reinterpret_cast<const uint8_t *>(&red), 4);
+	composer.ComposeFrame(1, MakeFrame(1, 0, 1, 1, 7), reinterpret_cast<const uint8_t *>(&red), 4);
+	CHECK_EQUAL(red, composer.GetCanvas()[0]);
+	GIF_RECT changedRect = composer.GetChangedRect();
+	CHECK_EQUAL(1u, changedRect.Left);
+	CHECK_EQUAL(1u, changedRect.Width);
+	composer.ComposeFrame(2, MakeFrame(0, 0, 1, 1, GIF_DISPOSAL_NONE), reinterpret_cast<const uint8_t *>(&transparent), 4);
+	CHECK_EQUAL(red, composer.GetCanvas()[0]);
+	CHECK_EQUAL(red, composer.GetCanvas()[1]);
+}
+
+NATIVE_TEST(FramesReachingOutsideTheImageAreClipped)
+{
+	GifFrameComposer composer(4, 4);
+	std::vector<uint32_t> pixels(16, 0xFF112233);
+	composer.ComposeFrame(0, MakeFrame(2, 2, 4, 4, GIF_DISPOSAL_BACKGROUND), reinterpret_cast<const uint8_t *>(pixels.data()), 16);
+	CHECK_EQUAL(0xFF112233u, composer.GetCanvas()[15]);
+	CHECK_EQUAL(0u, composer.GetCanvas()[0]);
+	//A frame entirely outside the image only disposes of the frame before it.
+	composer.ComposeFrame(1, MakeFrame(9, 9, 2, 2, GIF_DISPOSAL_NONE), reinterpret_cast<const uint8_t *>(pixels.data()), 8);
+	CHECK_EQUAL(0u, composer.GetCanvas()[15]);
+	GIF_RECT changedRect = composer.GetChangedRect();
+	CHECK_EQUAL(2u, changedRect.Left);
+	CHECK_EQUAL(2u, changedRect.Top);
+	CHECK_EQUAL(2u, changedRect.Width);
+	CHECK_EQUAL(2u, changedRect.Height);
+}
+
+NATIVE_TEST(HalfTransparentPixelsBlendOverTheCanvas)
+{
+	//The canvas shows through by 127/255 and is rounded to the nearest value, so 0x40 blue becomes 0x20.
+	const uint32_t blue = 0xFF000040;
+	const uint32_t halfGreen = 0x80008000;
+	GifFrameComposer composer(1, 1);
+	composer.ComposeFrame(0, MakeFrame(0, 0, 1, 1, GIF_DISPOSAL_NONE), reinterpret_cast<const uint8_t *>(&blue), 4);
+	composer.ComposeFrame(1, MakeFrame(0, 0, 1, 1, GIF_DISPOSAL_NONE), reinterpret_cast<const uint8_t *>(&halfGreen), 4);
+	CHECK_EQUAL(0xFF008020u, composer.GetCanvas()[0]);
+}
+
+NATIVE_TEST(FirstFrameOfALoopStartsFromAClearCanvas)
+{
+	const uint32_t red = 0xFFFF0000;
+	GifFrameComposer composer(2, 1);
+	composer.ComposeFrame(0, MakeFrame(0, 0, 1, 1, GIF_DISPOSAL_NONE), reinterpret_cast<const uint8_t *>(&red), 4);
+	composer.ComposeFrame(1, MakeFrame(1, 0, 1, 1, GIF_DISPOSAL_NONE), reinterpret_cast<const uint8_t *>(&red), 4);
+	composer.ComposeFrame(0, MakeFrame(0, 0, 1, 1, GIF_DISPOSAL_NONE), reinterpret_cast<const uint8_t *>(&red), 4);
+	CHECK_EQUAL(0u, composer.GetCanvas()[1]);
+	GIF_RECT changedRect = composer.GetChangedRect();
+	CHECK_EQUAL(2u, changedRect.Width);
+}
+
+NATIVE_TEST(ShortDelaysAreShownFor90Millis)
+{
+	CHECK_EQUAL(90u, GetGifFrameDelayMillis(0));
+	CHECK_EQUAL(90u, GetGifFrameDelayMillis(1));
+	CHECK_EQUAL(20u, GetGifFrameDelayMillis(2));
+	CHECK_EQUAL(70u, GetGifFrameDelayMillis(7));
+	CHECK_EQUAL(655350u, GetGifFrameDelayMillis(65535));
+}
@@ -0,0 +1,283 @@
+#pragma once
+#include "GifFrameComposer.h"
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+//The folders of the GIF fixtures of the tests, and of the test media of the repo, set by CMakeLists.txt.
+#ifndef NATIVE_TEST_FIXTURES_DIR
+#define NATIVE_TEST_FIXTURES_DIR "Fixtures"
+#endif
+#ifndef NATIVE_TEST_MEDIA_DIR
+#define NATIVE_TEST_MEDIA_DIR "../../Testmedia"
+#endif
+
+/// <summary>
+/// A frame of a GIF as WIC gives it to GifReader: its metadata, and its pixels as premultiplied BGRA, transparent where the frame shows the frames below.
+/// </summary>
+struct GIF_TEST_FRAME {
+	GIF_FRAME_INFO Info;
+	std::vector<uint32_t> Pixels;
+};
+
+struct GIF_TEST_IMAGE {
+	uint32_t Width = 0;
+	uint32_t Height = 0;
+	std::vector<GIF_TEST_FRAME> Frames;
+};
+
+/// <summary>
+/// A minimal GIF decoder, standing in for WIC in the tests of GifFrameComposer and GifFrameCache. Decodes the frames without composing them.
+/// Throws std::runtime_error on files it cannot read.
+/// </summary>
+class GifTestDecoder
+{
+public:
+	static GIF_TEST_IMAGE Decode(const std::string &path)
+	{
+		std::ifstream file(path, std::ios::binary);
+		if (!file) {
+			throw std::runtime_error("Cannot open " + path);
+		}
+		std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		GifTestDecoder decoder(data);
+		return decoder.DecodeImage();
+	}
+
+private:
+	const std::vector<uint8_t> &m_Data;
+	size_t m_Pos = 0;
+
+	explicit GifTestDecoder(const std::vector<uint8_t> &data) :
+		m_Data(data)
+	{
+	}
+
+	uint8_t ReadByte()
+	{
+		if (m_Pos >= m_Data.size()) {
+			throw std::runtime_error("Unexpected end of GIF");
+		}
+		return m_Data[m_Pos++];
+	}
+
+	uint16_t ReadUInt16()
+	{
+		uint8_t low = ReadByte();
+		return static_cast<uint16_t>(low | ReadByte() << 8);
+	}
+
+	/// <summary>
+	/// Reads a color table as opaque BGRA pixels.
+	/// </summary>
+	std::vector<uint32_t> ReadColorTable(uint8_t flags)
+	{
+		std::vector<uint32_t> colors(static_cast<size_t>(2) << (flags & 0x07));
+		for (uint32_t &color : colors) {
+			uint8_t red = ReadByte();
+			uint8_t green = ReadByte();
+			uint8_t blue = ReadByte();
+			color = 0xFF000000u | red << 16 | green << 8 | blue;
+		}
+		return colors;
+	}
+
+	/// <summary>
+	/// Reads data sub-blocks up to the block terminator.
+	/// </summary>
+	std::vector<uint8_t> ReadSubBlocks()
+	{
+		std::vector<uint8_t> blocks;
+		for (uint8_t size = ReadByte(); size > 0; size = ReadByte()) {
+			if (m_Pos + size > m_Data.size()) {
+				throw std::runtime_error("Unexpected end of GIF");
+			}
+			blocks.insert(blocks.end(), m_Data.begin() + m_Pos, m_Data.begin() + m_Pos + size);
+			m_Pos += size;
+		}
+		return blocks;
+	}
+
+	GIF_TEST_IMAGE DecodeImage()
+	{
+		if (m_Data.size() < 13 || memcmp(m_Data.data(), "GIF8", 4) != 0) {
+			throw std::runtime_error("Not a GIF");
+		}
+		m_Pos = 6;
+		GIF_TEST_IMAGE image;
+		image.Width = ReadUInt16();
+		image.Height = ReadUInt16();
+		uint8_t flags = ReadByte();
+		//The background color and the aspect ratio are not used.
+		m_Pos += 2;
+		std::vector<uint32_t> globalColors;
+		if (flags & 0x80) {
+			globalColors = ReadColorTable(flags);
+		}
+		//The Graphic Control Extension applies to the next frame only.
+		uint8_t disposal = GIF_DISPOSAL_UNDEFINED;
+		uint16_t delay = 0;
+		int transparentIndex = -1;
+		while (true) {
+			uint8_t blockType = ReadByte();
+			if (blockType == 0x3B) {
+				break;
+			}
+			else if (blockType == 0x21) {
+				uint8_t label = ReadByte();
+				std::vector<uint8_t> extension = ReadSubBlocks();
+				if (label == 0xF9 && extension.size() >= 4) {
+					disposal = (extension[0] >> 2) & 0x07;
+					delay = static_cast<uint16_t>(extension[1] | extension[2] << 8);
+					transparentIndex = (extension[0] & 0x01) ? extension[3] : -1;
+				}
+			}
+			else if (blockType == 0x2C) {
+				GIF_TEST_FRAME frame;
+				frame.Info.Position.Left = ReadUInt16();
+				frame.Info.Position.Top = ReadUInt16();
+				frame.Info.Position.Width = ReadUInt16();
+				frame.Info.Position.Height = ReadUInt16();
+				frame.Info.Disposal = disposal;
+				frame.Info.DelayMillis = GetGifFrameDelayMillis(delay);
+				uint8_t frameFlags = ReadByte();
+				std::vector<uint32_t> colors = (frameFlags & 0x80) ? ReadColorTable(frameFlags) : globalColors;
+				uint8_t minCodeSize = ReadByte();
+				std::vector<uint8_t> indexes = DecompressLzw(ReadSubBlocks(), minCodeSize, static_cast<size_t>(frame.Info.Position.Width) * frame.Info.Position.Height);
+				if (frameFlags & 0x40) {
+					indexes = Deinterlace(indexes, frame.Info.Position.Width, frame.Info.Position.Height);
+				}
+				frame.Pixels.resize(indexes.size());
+				for (size_t i = 0; i < indexes.size(); i++) {
+					bool isTransparent = indexes[i] == transparentIndex || indexes[i] >= colors.size();
+					frame.Pixels[i] = isTransparent ? 0 : colors[indexes[i]];
+				}
+				image.Frames.push_back(std::move(frame));
+				disposal = GIF_DISPOSAL_UNDEFINED;
+				delay = 0;
+				transparentIndex = -1;
+			}
+			else {
+				throw std::runtime_error("Unknown GIF block");
+			}
+		}
+		return image;
+	}
+
+	/// <summary>
+	/// Decompresses the color indexes of a frame. Frames with too little data are padded with index 0, like most decoders do.
+	/// </summary>
+	static std::vector<uint8_t> DecompressLzw(const std::vector<uint8_t> &data, uint8_t minCodeSize, size_t pixelCount)
+	{
+		const int maxCodes = 4096;
+		int clearCode = 1 << minCodeSize;
+		int endCode = clearCode + 1;
+		int codeSize = minCodeSize + 1;
+		int nextCode = endCode + 1;
+		std::vector<int> prefixes(maxCodes, -1);
+		std::vector<uint8_t> suffixes(maxCodes);
+		for (int i = 0; i < clearCode; i++) {
+			suffixes[i] = static_cast<uint8_t>(i);
+		}
+		std::vector<uint8_t> indexes;
+		indexes.reserve(pixelCount);
+		std::vector<uint8_t> sequence;
+		int previousCode = -1;
+		size_t bitPos = 0;
+		while (indexes.size() < pixelCount && bitPos + codeSize <= data.size() * 8) {
+			int code = 0;
+			for (int bit = 0; bit < codeSize; bit++, bitPos++) {
+				code |= ((data[bitPos / 8] >> (bitPos % 8)) & 1) << bit;
+			}
+			if (code == clearCode) {
+				codeSize = minCodeSize + 1;
+				nextCode = endCode + 1;
+				previousCode = -1;
+				continue;
+			}
+			if (code == endCode) {
+				break;
+			}
+			if (previousCode == -1) {
+				indexes.push_back(suffixes[code]);
+				previousCode = code;
+				continue;
+			}
+			//A code not in the table yet is the previous sequence followed by its own first index.
+			bool isKnown = code < nextCode;
+			sequence.clear();
+			for (int c = isKnown ? code : previousCode; c >= 0; c = prefixes[c]) {
+				sequence.push_back(suffixes[c]);
+			}
+			uint8_t firstIndex = sequence.back();
+			indexes.insert(indexes.end(), sequence.rbegin(), sequence.rend());
+			if (!isKnown) {
+				indexes.push_back(firstIndex);
+			}
+			if (nextCode < maxCodes) {
+				prefixes[nextCode] = previousCode;
+				suffixes[nextCode] = firstIndex;
+				nextCode++;
+				if (nextCode == (1 << codeSize) && codeSize < 12) {
+					codeSize++;
+				}
+			}
+			previousCode = code;
+		}
+		indexes.resize(pixelCount, 0);
+		return indexes;
+	}
+
+	/// <summary>
+	/// Puts the rows of an interlaced frame, stored in four passes, back in order.
+	/// </summary>
+	static std::vector<uint8_t> Deinterlace(const std::vector<uint8_t> &indexes, uint32_t width, uint32_t height)
+	{
+		const uint32_t passStart[4] = { 0, 4, 2, 1 };
+		const uint32_t passStep[4] = { 8, 8, 4, 2 };
+		std::vector<uint8_t> rows(indexes.size());
+		size_t sourceRow = 0;
+		for (int pass = 0; pass < 4; pass++) {
+			for (uint32_t row = passStart[pass]; row < height; row += passStep[pass], sourceRow++) {
+				std::copy(indexes.begin() + sourceRow * width, indexes.begin() + (sourceRow + 1) * width, rows.begin() + static_cast<size_t>(row) * width);
+			}
+		}
+		return rows;
+	}
+};
+
+/// <summary>
+/// Reads the hashes of the frames Pillow composed for a GIF, from its .frames fixture written by Fixtures/MakeGifFixtures.py.
+/// </summary>
+inline std::vector<uint64_t> ReadGifReferenceFrames(const std::string &gifName)
+{
+	std::ifstream file(std::string(NATIVE_TEST_FIXTURES_DIR) + "/" + gifName + ".frames");
+	if (!file) {
+		throw std::runtime_error("Cannot open the reference frames of " + gifName);
+	}
+	std::vector<uint64_t> hashes;
+	std::string line;
+	while (std::getline(file, line)) {
+		if (!line.empty() && line[0] != '#') {
+			hashes.push_back(std::stoull(line, nullptr, 16));
+		}
+	}
+	return hashes;
+}
+
+/// <summary>
+/// Hashes a composed frame the way Fixtures/MakeGifFixtures.py hashes the frames Pillow composed: FNV-1a over the pixels, with transparent pixels as 0.
+/// </summary>
+inline uint64_t HashComposedFrame(const uint32_t *pCanvas, size_t pixelCount)
+{
+	uint64_t hash = 0xcbf29ce484222325ull;
+	for (size_t i = 0; i < pixelCount; i++) {
+		uint32_t pixel = (pCanvas[i] >> 24) == 0 ? 0 : pCanvas[i];
+		hash = (hash ^ pixel) * 0x100000001b3ull;
+	}
+	return hash;
+}
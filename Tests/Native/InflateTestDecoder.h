@@ -0,0 +1,215 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+/// <summary>
+/// A minimal inflater for raw deflate streams (RFC 1951), standing in for zlib in the tests of DeflateEncoder and PngEncoder.
+/// Favors being easy to check over speed. Throws std::runtime_error on invalid streams, including data after the final block.
+/// </summary>
+class InflateTestDecoder
+{
+public:
+	/// <summary>
+	/// Decompresses a raw deflate stream, which must end with its final block.
+	/// </summary>
+	static std::vector<uint8_t> Inflate(const uint8_t *pData, size_t size)
+	{
+		InflateTestDecoder decoder(pData, size);
+		return decoder.InflateStream();
+	}
+
+private:
+	//The codes of a Huffman table as decoded in canonical order: the number of codes of each length, and the symbols sorted by code.
+	struct HUFFMAN {
+		std::vector<uint16_t> Counts;
+		std::vector<uint16_t> Symbols;
+	};
+
+	const uint8_t *m_pData;
+	size_t m_Size;
+	size_t m_BitPos = 0;
+	std::vector<uint8_t> m_Output;
+
+	InflateTestDecoder(const uint8_t *pData, size_t size) :
+		m_pData(pData),
+		m_Size(size)
+	{
+	}
+
+	uint32_t GetBits(int count)
+	{
+		uint32_t value = 0;
+		for (int i = 0; i < count; i++, m_BitPos++) {
+			if (m_BitPos / 8 >= m_Size) {
+				throw std::runtime_error("Unexpected end of deflate stream");
+			}
+			value |= static_cast<uint32_t>((m_pData[m_BitPos / 8] >> (m_BitPos % 8)) & 1) << i;
+		}
+		return value;
+	}
+
+	static HUFFMAN BuildHuffman(const uint8_t *pLengths, size_t count)
+	{
+		HUFFMAN huffman;
+		huffman.Counts.assign(16, 0);
+		for (size_t i = 0; i < count; i++) {
+			huffman.Counts[pLengths[i]]++;
+		}
+		huffman.Counts[0] = 0;
+		std::vector<uint16_t> offsets(16, 0);
+		for (int length = 1; length < 15; length++) {
+			offsets[length + 1] = offsets[length] + huffman.Counts[length];
+		}
+		huffman.Symbols.assign(count, 0);
+		for (size_t i = 0; i < count; i++) {
+			if (pLengths[i] != 0) {
+				huffman.Symbols[offsets[pLengths[i]]++] = static_cast<uint16_t>(i);
+			}
+		}
+		return huffman;
+	}
+
+	/// <summary>
+	/// Decodes a symbol one bit at a time, as puff.c in the zlib sources does. Huffman codes are stored most significant bit first.
+	/// </summary>
+	int DecodeSymbol(const HUFFMAN &huffman)
+	{
+		int code = 0;
+		int first = 0;
+		int index = 0;
+		for (int length = 1; length < 16; length++) {
+			code |= static_cast<int>(GetBits(1));
+			int count = huffman.Counts[length];
+			if (code - count < first) {
+				return huffman.Symbols[index + (code - first)];
+			}
+			index += count;
+			first += count;
+			first <<= 1;
+			code <<= 1;
+		}
+		throw std::runtime_error("Invalid Huffman code in deflate stream");
+	}
+
+	std::vector<uint8_t> InflateStream()
+	{
+		bool isFinal = false;
+		while (!isFinal) {
+			isFinal = GetBits(1) != 0;
+			uint32_t type = GetBits(2);
+			if (type == 0) {
+				InflateStored();
+			}
+			else if (type == 1) {
+				uint8_t lengths[288 + 30];
+				for (int i = 0; i < 288; i++) {
+					lengths[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+				}
+				for (int i = 0; i < 30; i++) {
+					lengths[288 + i] = 5;
+				}
+				InflateCodes(BuildHuffman(lengths, 288), BuildHuffman(lengths + 288, 30));
+			}
+			else if (type == 2) {
+				InflateDynamic();
+			}
+			else {
+				throw std::runtime_error("Invalid deflate block type");
+			}
+		}
+		if ((m_BitPos + 7) / 8 != m_Size) {
+			throw std::runtime_error("Data after the final deflate block");
+		}
+		return m_Output;
+	}
+
+	void InflateStored()
+	{
+		m_BitPos = (m_BitPos + 7) / 8 * 8;
+		uint32_t length = GetBits(16);
+		uint32_t complement = GetBits(16);
+		if ((length ^ 0xFFFF) != complement) {
+			throw std::runtime_error("Invalid stored block length");
+		}
+		for (uint32_t i = 0; i < length; i++) {
+			m_Output.push_back(static_cast<uint8_t>(GetBits(8)));
+		}
+	}
+
+	void InflateDynamic()
+	{
+		static const uint8_t CODE_LENGTH_ORDER[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+		uint32_t literalCount = GetBits(5) + 257;
+		uint32_t distanceCount = GetBits(5) + 1;
+		uint32_t codeLengthCount = GetBits(4) + 4;
+		uint8_t codeLengths[19] = {};
+		for (uint32_t i = 0; i < codeLengthCount; i++) {
+			codeLengths[CODE_LENGTH_ORDER[i]] = static_cast<uint8_t>(GetBits(3));
+		}
+		HUFFMAN codeLengthHuffman = BuildHuffman(codeLengths, 19);
+		std::vector<uint8_t> lengths;
+		while (lengths.size() < literalCount + distanceCount) {
+			int symbol = DecodeSymbol(codeLengthHuffman);
+			if (symbol < 16) {
+				lengths.push_back(static_cast<uint8_t>(symbol));
+				continue;
+			}
+			uint8_t repeated = 0;
+			uint32_t repeat;
+			if (symbol == 16) {
+				if (lengths.empty()) {
+					throw std::runtime_error("Repeated code length without a previous length");
+				}
+				repeated = lengths.back();
+				repeat = 3 + GetBits(2);
+			}
+			else if (symbol == 17) {
+				repeat = 3 + GetBits(3);
+			}
+			else {
+				repeat = 11 + GetBits(7);
+			}
+			lengths.insert(lengths.end(), repeat, repeated);
+		}
+		if (lengths.size() != literalCount + distanceCount || lengths[256] == 0) {
+			throw std::runtime_error("Invalid code lengths");
+		}
+		InflateCodes(BuildHuffman(lengths.data(), literalCount), BuildHuffman(lengths.data() + literalCount, distanceCount));
+	}
+
+	void InflateCodes(const HUFFMAN &literals, const HUFFMAN &distances)
+	{
+		static const uint16_t LENGTH_BASE[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+		static const uint8_t LENGTH_EXTRA[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+		static const uint16_t DISTANCE_BASE[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+		static const uint8_t DISTANCE_EXTRA[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+		while (true) {
+			int symbol = DecodeSymbol(literals);
+			if (symbol < 256) {
+				m_Output.push_back(static_cast<uint8_t>(symbol));
+				continue;
+			}
+			if (symbol == 256) {
+				return;
+			}
+			symbol -= 257;
+			if (symbol >= 29) {
+				throw std::runtime_error("Invalid length code");
+			}
+			size_t length = LENGTH_BASE[symbol] + GetBits(LENGTH_EXTRA[symbol]);
+			int distanceSymbol = DecodeSymbol(distances);
+			if (distanceSymbol >= 30) {
+				throw std::runtime_error("Invalid distance code");
+			}
+			size_t distance = DISTANCE_BASE[distanceSymbol] + GetBits(DISTANCE_EXTRA[distanceSymbol]);
+			if (distance > m_Output.size() || distance > 32768) {
+				throw std::runtime_error("Distance reaches before the start of the window");
+			}
+			for (size_t i = 0; i < length; i++) {
+				m_Output.push_back(m_Output[m_Output.size() - distance]);
+			}
+		}
+	}
+};
@@ -0,0 +1,179 @@
+#include "NativeTest.h"
+#include "JpegEncoder.h"
+#include "JpegTestDecoder.h"
+#include "PngTestDecoder.h"
+#include <fstream>
+#include <iterator>
+
+namespace {
+	/// <summary>
+	/// The peak signal to noise ratio of the color channels of two images, in dB. Higher is closer, and identical images give infinity.
+	/// </summary>
+	double GetPsnr(const TEST_IMAGE &expected, const TEST_IMAGE &actual) {
+		double squaredError = 0;
+		for (size_t i = 0; i < expected.Bgra.size(); i += 4) {
+			for (size_t channel = 0; channel < 3; channel++) {
+				double difference = static_cast<double>(expected.Bgra[i + channel]) - actual.Bgra[i + channel];
+				squaredError += difference * difference;
+			}
+		}
+		double meanSquaredError = squaredError / (expected.Bgra.size() / 4 * 3);
+		return 10 * std::log10(255.0 * 255.0 / meanSquaredError);
+	}
+
+	/// <summary>
+	/// Encodes an image from rows with padding and decodes it.
+	/// </summary>
+	TEST_IMAGE RoundTrip(const char *name, const TEST_IMAGE &image, int quality, std::vector<uint8_t> &jpeg, WorkerPool *pPool = nullptr) {
+		uint32_t pitch = image.Width * 4 + 20;
+		std::vector<uint8_t> pixels = CopyWithPitch(image, pitch);
+		JpegEncoder encoder(quality);
+		CHECK(encoder.Encode(pixels.data(), image.Width, image.Height, pitch, jpeg, pPool));
+		TEST_IMAGE decoded;
+		try {
+			decoded = JpegTestDecoder::Decode(jpeg);
+		}
+		catch (const std::exception &e) {
+			printf("       %s (%ux%u) is not a valid JPEG: %s\n", name, image.Width, image.Height, e.what());
+			CHECK(false);
+		}
+		CHECK_EQUAL(image.Width, decoded.Width);
+		CHECK_EQUAL(image.Height, decoded.Height);
+		return decoded;
+	}
+
+	void CheckRoundTripPsnr(const char *name, const TEST_IMAGE &image, int quality, double minPsnr) {
+		std::vector<uint8_t> jpeg;
+		double psnr = GetPsnr(image, RoundTrip(name, image, quality, jpeg));
+		if (psnr < minPsnr) {
+			printf("       %s (%ux%u) at quality %d decodes with a PSNR of %.2f dB\n", name, image.Width, image.Height, quality, psnr);
+			CHECK(psnr >= minPsnr);
+		}
+	}
+
+	/// <summary>
+	/// Smooth color gradients of the same slope at any size, which JPEG keeps well even at the edges of blocks. At most 320x320.
+	/// </summary>
+	TEST_IMAGE MakeGradientImage(uint32_t width, uint32_t height) {
+		TEST_IMAGE image;
+		image.Width = width;
+		image.Height = height;
+		image.Bgra.resize(static_cast<size_t>(width) * height * 4);
+		for (uint32_t row = 0; row < height; row++) {
+			for (uint32_t col = 0; col < width; col++) {
+				uint8_t *pPixel = &image.Bgra[(static_cast<size_t>(row) * width + col) * 4];
+				pPixel[0] = static_cast<uint8_t>(64 + col / 2);
+				pPixel[1] = static_cast<uint8_t>(32 + row / 2);
+				pPixel[2] = static_cast<uint8_t>(200 - (row + col) / 5);
+				pPixel[3] = 0xFF;
+			}
+		}
+		return image;
+	}
+
+	std::vector<uint8_t> ReadFile(const std::string &path) {
+		std::ifstream file(path, std::ios::binary);
+		return std::vector<uint8_t>((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	}
+}
+
+NATIVE_TEST(DecoderReadsJpegsFromLibjpeg)
+{
+	//Checks the test decoder itself on files Pillow wrote with other sampling factors, optimized Huffman tables and restart intervals.
+	TEST_IMAGE original = PngTestDecoder::DecodeFile(NATIVE_TEST_MEDIA_DIR "/renault.png");
+	for (const char *name : { "renault420.jpg", "renault444.jpg" }) {
+		TEST_IMAGE decoded = JpegTestDecoder::Decode(ReadFile(std::string(NATIVE_TEST_FIXTURES_DIR) + "/" + name));
+		CHECK_EQUAL(original.Width, decoded.Width);
+		CHECK_EQUAL(original.Height, decoded.Height);
+		double psnr = GetPsnr(original, decoded);
+		if (psnr < 32) {
+			printf("       %s decodes with a PSNR of %.2f dB\n", name, psnr);
+			CHECK(psnr >= 32);
+		}
+	}
+}
+
+NATIVE_TEST(PhotoRoundTripsAtHighQuality)
+{
+	//About as close as libjpeg gets at the same quality.
+	TEST_IMAGE photo = PngTestDecoder::DecodeFile(NATIVE_TEST_MEDIA_DIR "/renault.png");
+	CheckRoundTripPsnr("renault.png", photo, 90, 32);
+	CheckRoundTripPsnr("renault.png", photo, 100, 35);
+}
+
+NATIVE_TEST(SyntheticImagesRoundTripAtHighQuality)
+{
+	CheckRoundTripPsnr("gradient", MakeGradientImage(320, 200), 90, 48);
+	CheckRoundTripPsnr("screen-like", MakeScreenLikeImage(640, 480), 90, 40);
+}
+
+NATIVE_TEST(OddSizedImagesRoundTrip)
+{
+	//Sizes that are not whole MCUs repeat the edge pixels, so the edges decode as well as the rest.
+	const uint32_t sizes[][2] = { { 1, 1 }, { 1, 17 }, { 17, 1 }, { 15, 15 }, { 16, 16 }, { 17, 33 }, { 129, 7 }, { 250, 250 } };
+	for (const auto &size : sizes) {
+		CheckRoundTripPsnr("gradient", MakeGradientImage(size[0], size[1]), 90, 48);
+	}
+}
+
+NATIVE_TEST(LowerQualityGivesSmallerFiles)
+{
+	TEST_IMAGE photo = PngTestDecoder::DecodeFile(NATIVE_TEST_MEDIA_DIR "/renault.png");
+	size_t previousSize = SIZE_MAX;
+	double previousPsnr = INFINITY;
+	for (int quality : { 100, 90, 75, 50, 20, 1 }) {
+		std::vector<uint8_t> jpeg;
+		double psnr = GetPsnr(photo, RoundTrip("renault.png", photo, quality, jpeg));
+		if (jpeg.size() >= previousSize || psnr >= previousPsnr) {
+			printf("       Quality %d gives %zu bytes at %.2f dB\n", quality, jpeg.size(), psnr);
+			CHECK(jpeg.size() < previousSize);
+			CHECK(psnr < previousPsnr);
+		}
+		previousSize = jpeg.size();
+		previousPsnr = psnr;
+	}
+}
+
+NATIVE_TEST(EncodingOnAPoolGivesTheSameFile)
+{
+	WorkerPool pool(4, 64);
+	pool.Start();
+	TEST_IMAGE image = MakeScreenLikeImage(1920, 1080);
+	JpegEncoder encoder;
+	std::vector<uint8_t> alone;
+	CHECK(encoder.Encode(image.Bgra.data(), image.Width, image.Height, image.Width * 4, alone));
+	std::vector<uint8_t> pooled;
+	for (int i = 0; i < 3; i++) {
+		CHECK(encoder.Encode(image.Bgra.data(), image.Width, image.Height, image.Width * 4, pooled, &pool));
+		CHECK(pooled == alone);
+	}
+	//Rows of MCUs are restart intervals, so the file decodes only if they were joined in order.
+	TEST_IMAGE decoded = JpegTestDecoder::Decode(pooled);
+	CHECK(GetPsnr(image, decoded) >= 40);
+	pool.Stop();
+}
+
+NATIVE_TEST(ReusedEncoderGivesTheSameFile)
+{
+	TEST_IMAGE large = MakeScreenLikeImage(800, 600);
+	TEST_IMAGE small = MakeGradientImage(97, 61);
+	JpegEncoder fresh;
+	std::vector<uint8_t> expected;
+	CHECK(fresh.Encode(small.Bgra.data(), small.Width, small.Height, small.Width * 4, expected));
+	JpegEncoder reused;
+	std::vector<uint8_t> jpeg;
+	CHECK(reused.Encode(large.Bgra.data(), large.Width, large.Height, large.Width * 4, jpeg));
+	CHECK(reused.Encode(small.Bgra.data(), small.Width, small.Height, small.Width * 4, jpeg));
+	CHECK(jpeg == expected);
+}
+
+NATIVE_TEST(EmptyAndOversizedImagesAreRejected)
+{
+	uint32_t pixel = 0xFFFFFFFF;
+	JpegEncoder encoder;
+	std::vector<uint8_t> jpeg(10, 0);
+	CHECK(!encoder.Encode(reinterpret_cast<const uint8_t *>(&pixel), 0, 1, 4, jpeg));
+	CHECK(jpeg.empty());
+	CHECK(!encoder.Encode(reinterpret_cast<const uint8_t *>(&pixel), 1, 0, 4, jpeg));
+	CHECK(!encoder.Encode(reinterpret_cast<const uint8_t *>(&pixel), 65536, 1, 0, jpeg));
+}
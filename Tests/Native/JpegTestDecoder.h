@@ -0,0 +1,423 @@
+#pragma once
+#include "TestImage.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+/// <summary>
+/// A minimal baseline JPEG decoder for the tests of JpegEncoder, written from the standard rather than from the encoder.
+/// Reads any sampling factors, Huffman and quantization tables the file declares, and checks restart markers are in order.
+/// Decodes with a plain floating point IDCT and replicates chroma samples, as a reference for the quality of the encoder.
+/// Throws std::runtime_error on progressive, arithmetic coded or invalid files.
+/// </summary>
+class JpegTestDecoder
+{
+public:
+	static TEST_IMAGE Decode(const std::vector<uint8_t> &jpeg)
+	{
+		JpegTestDecoder decoder(jpeg);
+		return decoder.DecodeFile();
+	}
+
+private:
+	struct HUFFMAN {
+		//The number of codes of each length from 1 to 16 bits, and the values in order of their codes.
+		uint8_t Counts[17] = {};
+		std::vector<uint8_t> Values;
+		bool IsDefined = false;
+	};
+	struct COMPONENT {
+		uint8_t Id = 0;
+		int H = 1;
+		int V = 1;
+		int QuantizationTable = 0;
+		int DcTable = 0;
+		int AcTable = 0;
+		int DcPredictor = 0;
+		//The samples of the component, covering whole MCUs.
+		uint32_t Pitch = 0;
+		std::vector<uint8_t> Samples;
+	};
+
+	const std::vector<uint8_t> &m_Data;
+	size_t m_Pos = 0;
+	uint16_t m_Quantization[4][64] = {};
+	HUFFMAN m_Huffman[2][4];
+	std::vector<COMPONENT> m_Components;
+	uint32_t m_Width = 0;
+	uint32_t m_Height = 0;
+	uint32_t m_RestartInterval = 0;
+	uint32_t m_BitBuffer = 0;
+	int m_BitCount = 0;
+
+	explicit JpegTestDecoder(const std::vector<uint8_t> &data) :
+		m_Data(data)
+	{
+	}
+
+	uint8_t ReadByte()
+	{
+		if (m_Pos >= m_Data.size()) {
+			throw std::runtime_error("Unexpected end of JPEG");
+		}
+		return m_Data[m_Pos++];
+	}
+
+	uint16_t Read16()
+	{
+		uint16_t high = ReadByte();
+		return static_cast<uint16_t>(high << 8 | ReadByte());
+	}
+
+	TEST_IMAGE DecodeFile()
+	{
+		if (Read16() != 0xFFD8) {
+			throw std::runtime_error("Not a JPEG");
+		}
+		bool isFrameRead = false;
+		while (true) {
+			if (ReadByte() != 0xFF) {
+				throw std::runtime_error("Expected a marker");
+			}
+			uint8_t marker = ReadByte();
+			if (marker == 0xD9) {
+				throw std::runtime_error("No scan before the end of the image");
+			}
+			//The length of a segment counts its own two bytes.
+			uint16_t length = Read16();
+			size_t segmentEnd = m_Pos - 2 + length;
+			if (length < 2 || segmentEnd > m_Data.size()) {
+				throw std::runtime_error("Invalid segment length");
+			}
+			if (marker == 0xDB) {
+				while (m_Pos < segmentEnd) {
+					uint8_t table = ReadByte();
+					if ((table >> 4) != 0 || (table & 0x0F) > 3) {
+						throw std::runtime_error("Unsupported quantization table");
+					}
+					for (int i = 0; i < 64; i++) {
+						m_Quantization[table & 0x0F][ZIGZAG[i]] = ReadByte();
+					}
+				}
+			}
+			else if (marker == 0xC4) {
+				while (m_Pos < segmentEnd) {
+					uint8_t table = ReadByte();
+					if ((table >> 4) > 1 || (table & 0x0F) > 3) {
+						throw std::runtime_error("Invalid Huffman table");
+					}
+					HUFFMAN &huffman = m_Huffman[table >> 4][table & 0x0F];
+					size_t valueCount = 0;
+					for (int length = 1; length <= 16; length++) {
+						huffman.Counts[length] = ReadByte();
+						valueCount += huffman.Counts[length];
+					}
+					huffman.Values.clear();
+					for (size_t i = 0; i < valueCount; i++) {
+						huffman.Values.push_back(ReadByte());
+					}
+					huffman.IsDefined = true;
+				}
+			}
+			else if (marker == 0xC0) {
+				ReadFrameHeader();
+				isFrameRead = true;
+			}
+			else if (marker == 0xDD) {
+				m_RestartInterval = Read16();
+			}
+			else if (marker == 0xDA) {
+				if (!isFrameRead) {
+					throw std::runtime_error("Scan before the frame header");
+				}
+				ReadScanHeader();
+				if (m_Pos != segmentEnd) {
+					throw std::runtime_error("Invalid scan header length");
+				}
+				DecodeScan();
+				if (Read16() != 0xFFD9 || m_Pos != m_Data.size()) {
+					throw std::runtime_error("Expected the end of the image after the scan");
+				}
+				return ConvertToBgra();
+			}
+			else if ((marker >= 0xC1 && marker <= 0xCF) || marker < 0xC0) {
+				throw std::runtime_error("Unsupported JPEG process");
+			}
+			if (m_Pos > segmentEnd) {
+				throw std::runtime_error("Segment is longer than its length");
+			}
+			m_Pos = segmentEnd;
+		}
+	}
+
+	void ReadFrameHeader()
+	{
+		if (ReadByte() != 8) {
+			throw std::runtime_error("Unsupported sample precision");
+		}
+		m_Height = Read16();
+		m_Width = Read16();
+		uint8_t componentCount = ReadByte();
+		if (m_Width == 0 || m_Height == 0 || (componentCount != 1 && componentCount != 3)) {
+			throw std::runtime_error("Unsupported frame");
+		}
+		m_Components.resize(componentCount);
+		for (COMPONENT &component : m_Components) {
+			component.Id = ReadByte();
+			uint8_t sampling = ReadByte();
+			component.H = sampling >> 4;
+			component.V = sampling & 0x0F;
+			component.QuantizationTable = ReadByte();
+			if (component.H < 1 || component.H > 4 || component.V < 1 || component.V > 4 || component.QuantizationTable > 3) {
+				throw std::runtime_error("Invalid frame component");
+			}
+		}
+	}
+
+	void ReadScanHeader()
+	{
+		if (ReadByte() != m_Components.size()) {
+			throw std::runtime_error("Only scans of all components are supported");
+		}
+		for (COMPONENT &component : m_Components) {
+			if (ReadByte() != component.Id) {
+				throw std::runtime_error("Scan components are not in frame order");
+			}
+			uint8_t tables = ReadByte();
+			component.DcTable = tables >> 4;
+			component.AcTable = tables & 0x0F;
+			if (component.DcTable > 3 || component.AcTable > 3 || !m_Huffman[0][component.DcTable].IsDefined || !m_Huffman[1][component.AcTable].IsDefined) {
+				throw std::runtime_error("Scan refers to an undefined Huffman table");
+			}
+		}
+		if (ReadByte() != 0 || ReadByte() != 63 || ReadByte() != 0) {
+			throw std::runtime_error("Not a baseline scan");
+		}
+	}
+
+	int GetBit()
+	{
+		if (m_BitCount == 0) {
+			uint8_t byte = ReadByte();
+			if (byte == 0xFF) {
+				if (ReadByte() != 0) {
+					throw std::runtime_error("Marker inside entropy coded data");
+				}
+			}
+			m_BitBuffer = byte;
+			m_BitCount = 8;
+		}
+		m_BitCount--;
+		return (m_BitBuffer >> m_BitCount) & 1;
+	}
+
+	int GetBits(int count)
+	{
+		int value = 0;
+		for (int i = 0; i < count; i++) {
+			value = value << 1 | GetBit();
+		}
+		return value;
+	}
+
+	/// <summary>
+	/// Reads a value of count bits, where values below half the range are negative, as F.2.2.1 of the standard extends them.
+	/// </summary>
+	int Receive(int count)
+	{
+		int value = GetBits(count);
+		return count > 0 && value < (1 << (count - 1)) ? value - (1 << count) + 1 : value;
+	}
+
+	int DecodeSymbol(const HUFFMAN &huffman)
+	{
+		int code = 0;
+		int first = 0;
+		int index = 0;
+		for (int length = 1; length <= 16; length++) {
+			code |= GetBit();
+			int count = huffman.Counts[length];
+			if (code - count < first) {
+				return huffman.Values.at(index + (code - first));
+			}
+			index += count;
+			first += count;
+			first <<= 1;
+			code <<= 1;
+		}
+		throw std::runtime_error("Invalid Huffman code");
+	}
+
+	void DecodeScan()
+	{
+		int maxH = 1;
+		int maxV = 1;
+		for (const COMPONENT &component : m_Components) {
+			maxH = (std::max)(maxH, component.H);
+			maxV = (std::max)(maxV, component.V);
+		}
+		uint32_t mcuColumns = (m_Width + maxH * 8 - 1) / (maxH * 8);
+		uint32_t mcuRows = (m_Height + maxV * 8 - 1) / (maxV * 8);
+		if (m_Components.size() == 1) {
+			//A scan of one component is not interleaved, so each MCU is one block of it.
+			m_Components[0].H = m_Components[0].V = maxH = maxV = 1;
+			mcuColumns = (m_Width + 7) / 8;
+			mcuRows = (m_Height + 7) / 8;
+		}
+		for (COMPONENT &component : m_Components) {
+			component.Pitch = mcuColumns * component.H * 8;
+			component.Samples.assign(static_cast<size_t>(component.Pitch) * mcuRows * component.V * 8, 0);
+		}
+		uint32_t mcuCount = mcuColumns * mcuRows;
+		uint32_t restartsSeen = 0;
+		for (uint32_t mcu = 0; mcu < mcuCount; mcu++) {
+			if (m_RestartInterval > 0 && mcu > 0 && mcu % m_RestartInterval == 0) {
+				//Bits left in the last byte are padding.
+				m_BitCount = 0;
+				if (ReadByte() != 0xFF || ReadByte() != 0xD0 + restartsSeen % 8) {
+					throw std::runtime_error("Missing or out of order restart marker");
+				}
+				restartsSeen++;
+				for (COMPONENT &component : m_Components) {
+					component.DcPredictor = 0;
+				}
+			}
+			uint32_t mcuColumn = mcu % mcuColumns;
+			uint32_t mcuRow = mcu / mcuColumns;
+			for (COMPONENT &component : m_Components) {
+				for (int blockRow = 0; blockRow < component.V; blockRow++) {
+					for (int blockColumn = 0; blockColumn < component.H; blockColumn++) {
+						uint32_t left = (mcuColumn * component.H + blockColumn) * 8;
+						uint32_t top = (mcuRow * component.V + blockRow) * 8;
+						DecodeBlock(component, &component.Samples[static_cast<size_t>(top) * component.Pitch + left], component.Pitch);
+					}
+				}
+			}
+		}
+		m_BitCount = 0;
+	}
+
+	void DecodeBlock(COMPONENT &component, uint8_t *pOutput, uint32_t pitch)
+	{
+		int coefficients[64] = {};
+		int size = DecodeSymbol(m_Huffman[0][component.DcTable]);
+		if (size > 11) {
+			throw std::runtime_error("Invalid DC difference size");
+		}
+		component.DcPredictor += Receive(size);
+		coefficients[0] = component.DcPredictor;
+		for (int i = 1; i < 64;) {
+			int symbol = DecodeSymbol(m_Huffman[1][component.AcTable]);
+			int run = symbol >> 4;
+			size = symbol & 0x0F;
+			if (size == 0) {
+				if (run == 15) {
+					i += 16;
+					continue;
+				}
+				if (run != 0) {
+					throw std::runtime_error("Invalid AC symbol");
+				}
+				break;
+			}
+			i += run;
+			if (i > 63) {
+				throw std::runtime_error("AC coefficients run past the end of the block");
+			}
+			coefficients[ZIGZAG[i++]] = Receive(size);
+		}
+		const uint16_t *pQuantization = m_Quantization[component.QuantizationTable];
+		double dequantized[64];
+		for (int i = 0; i < 64; i++) {
+			dequantized[i] = static_cast<double>(coefficients[i]) * pQuantization[i];
+		}
+		InverseDct(dequantized, pOutput, pitch);
+	}
+
+	/// <summary>
+	/// The inverse DCT of A.3.3 of the standard, computed as a row pass and a column pass.
+	/// </summary>
+	static void InverseDct(const double *pCoefficients, uint8_t *pOutput, uint32_t pitch)
+	{
+		static const double PI = 3.14159265358979323846;
+		double cosines[8][8];
+		for (int x = 0; x < 8; x++) {
+			for (int u = 0; u < 8; u++) {
+				cosines[x][u] = (u == 0 ? std::sqrt(0.5) : 1.0) * std::cos((2 * x + 1) * u * PI / 16);
+			}
+		}
+		double rows[64];
+		for (int v = 0; v < 8; v++) {
+			for (int x = 0; x < 8; x++) {
+				double sum = 0;
+				for (int u = 0; u < 8; u++) {
+					sum += cosines[x][u] * pCoefficients[v * 8 + u];
+				}
+				rows[v * 8 + x] = sum / 2;
+			}
+		}
+		for (int y = 0; y < 8; y++) {
+			for (int x = 0; x < 8; x++) {
+				double sum = 0;
+				for (int v = 0; v < 8; v++) {
+					sum += cosines[y][v] * rows[v * 8 + x];
+				}
+				pOutput[static_cast<size_t>(y) * pitch + x] = ClampToByte(sum / 2 + 128);
+			}
+		}
+	}
+
+	static uint8_t ClampToByte(double value)
+	{
+		return static_cast<uint8_t>((std::max)(0.0, (std::min)(255.0, std::round(value))));
+	}
+
+	TEST_IMAGE ConvertToBgra() const
+	{
+		int maxH = 1;
+		int maxV = 1;
+		for (const COMPONENT &component : m_Components) {
+			maxH = (std::max)(maxH, component.H);
+			maxV = (std::max)(maxV, component.V);
+		}
+		TEST_IMAGE image;
+		image.Width = m_Width;
+		image.Height = m_Height;
+		image.Bgra.resize(static_cast<size_t>(m_Width) * m_Height * 4);
+		for (uint32_t row = 0; row < m_Height; row++) {
+			for (uint32_t col = 0; col < m_Width; col++) {
+				double samples[3];
+				for (size_t i = 0; i < m_Components.size(); i++) {
+					const COMPONENT &component = m_Components[i];
+					uint32_t sampleRow = row * component.V / maxV;
+					uint32_t sampleCol = col * component.H / maxH;
+					samples[i] = component.Samples[static_cast<size_t>(sampleRow) * component.Pitch + sampleCol];
+				}
+				uint8_t *pPixel = &image.Bgra[(static_cast<size_t>(row) * m_Width + col) * 4];
+				if (m_Components.size() == 1) {
+					pPixel[0] = pPixel[1] = pPixel[2] = static_cast<uint8_t>(samples[0]);
+				}
+				else {
+					double y = samples[0];
+					double cb = samples[1] - 128;
+					double cr = samples[2] - 128;
+					pPixel[0] = ClampToByte(y + 1.772 * cb);
+					pPixel[1] = ClampToByte(y - 0.344136 * cb - 0.714136 * cr);
+					pPixel[2] = ClampToByte(y + 1.402 * cr);
+				}
+				pPixel[3] = 0xFF;
+			}
+		}
+		return image;
+	}
+
+	//The index in natural order of each coefficient in zigzag order.
+	static constexpr uint8_t ZIGZAG[64] = {
+		0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5,
+		12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21, 28,
+		35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+		58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+	};
+};
@@ -0,0 +1,130 @@
+#include "NativeTest.h"
+#include "LruResourceCache.h"
+#include <unordered_map>
+
+//Compares the LRU texture cache with the unbounded map it replaced in TextureManager: the cost of a request served from the cache,
+//and the memory held when the frame size keeps changing, e.g. while a recorded window is being resized.
+
+namespace {
+	struct TEXTURE_DESC {
+		uint32_t Width;
+		uint32_t Height;
+		uint32_t Format;
+		bool operator==(const TEXTURE_DESC &other) const { return Width == other.Width && Height == other.Height && Format == other.Format; }
+	};
+
+	struct TEXTURE_DESC_HASH {
+		size_t operator()(const TEXTURE_DESC &desc) const {
+			//FNV-1a, like D3D11_TEXTURE2D_DESC_HASH.
+			uint64_t hash = 14695981039346656037ull;
+			const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&desc);
+			for (size_t i = 0; i < sizeof(desc); i++) {
+				hash = (hash ^ bytes[i]) * 1099511628211ull;
+			}
+			return (size_t)hash;
+		}
+	};
+
+	uint64_t GetTextureBytes(const TEXTURE_DESC &desc) {
+		return (uint64_t)desc.Width * desc.Height * 4;
+	}
+
+	/// <summary>
+	/// Hands out handles instead of textures, so only the cache itself is measured.
+	/// </summary>
+	class HandleAllocator : public IResourceAllocator<TEXTURE_DESC, uintptr_t>
+	{
+	public:
+		bool Allocate(const TEXTURE_DESC &description, uintptr_t *pResource) override {
+			*pResource = ++m_NextHandle;
+			return true;
+		}
+		void Free(uintptr_t resource) override {}
+	private:
+		uintptr_t m_NextHandle = 0;
+	};
+
+	typedef LruResourceCache<TEXTURE_DESC, uintptr_t, TEXTURE_DESC_HASH> BenchmarkCache;
+
+	/// <summary>
+	/// The cache TextureManager used before: every description ever requested stays cached until the manager is released.
+	/// </summary>
+	class UnboundedCache
+	{
+	public:
+		bool Get(const TEXTURE_DESC &description, uintptr_t *pResource) {
+			auto it = m_Textures.find(description);
+			if (it == m_Textures.end()) {
+				it = m_Textures.emplace(description, ++m_NextHandle).first;
+				m_Bytes += GetTextureBytes(description);
+			}
+			*pResource = it->second;
+			return true;
+		}
+		uint64_t GetBytes() const { return m_Bytes; }
+		size_t GetCount() const { return m_Textures.size(); }
+	private:
+		std::unordered_map<TEXTURE_DESC, uintptr_t, TEXTURE_DESC_HASH> m_Textures;
+		uintptr_t m_NextHandle = 0;
+		uint64_t m_Bytes = 0;
+	};
+}
+
+int main()
+{
+	const uint64_t budget = 256ull * 1024 * 1024;
+	//A frame crops the capture, resizes it to the output size, and pins the result until it is encoded.
+	const TEXTURE_DESC frameDescs[] = { { 1920, 1040, 87 }, { 1280, 720, 87 }, { 720, 1280, 87 } };
+	printf("%-36s %12s\n", "", "ns/request");
+	{
+		UnboundedCache cache;
+		size_t i = 0;
+		double millis = MeasureMillisPerCall([&]() {
+			uintptr_t texture;
+			cache.Get(frameDescs[i++ % 3], &texture);
+		});
+		printf("%-36s %12.1f\n", "Unbounded map", millis * 1e6);
+	}
+	{
+		BenchmarkCache cache(std::make_unique<HandleAllocator>(), GetTextureBytes, budget);
+		size_t i = 0;
+		double millis = MeasureMillisPerCall([&]() {
+			uintptr_t texture;
+			cache.Get(frameDescs[i++ % 3], &texture);
+		});
+		printf("%-36s %12.1f\n", "LRU cache", millis * 1e6);
+	}
+	{
+		BenchmarkCache cache(std::make_unique<HandleAllocator>(), GetTextureBytes, budget);
+		size_t i = 0;
+		uintptr_t pinned = 0;
+		double millis = MeasureMillisPerCall([&]() {
+			uintptr_t texture;
+			cache.Get(frameDescs[i++ % 3], &texture);
+			if (pinned) {
+				cache.Unpin(pinned);
+			}
+			cache.Pin(texture);
+			pinned = texture;
+		});
+		printf("%-36s %12.1f\n", "LRU cache, pin and unpin each", millis * 1e6);
+	}
+
+	//A window dragged larger over 2000 frames gets a new capture size, and a new resized size, on most frames.
+	printf("\n%-36s %12s %12s %12s\n", "Window resize, 2000 frames", "entries", "MB held", "MB peak");
+	UnboundedCache unbounded;
+	BenchmarkCache lru(std::make_unique<HandleAllocator>(), GetTextureBytes, budget);
+	for (uint32_t frame = 0; frame < 2000; frame++) {
+		TEXTURE_DESC captureDesc{ 640 + frame / 2, 480 + frame / 3, 87 };
+		TEXTURE_DESC resizedDesc{ 1280, 720 - (frame / 3) % 64, 87 };
+		uintptr_t texture;
+		unbounded.Get(captureDesc, &texture);
+		unbounded.Get(resizedDesc, &texture);
+		lru.Get(captureDesc, &texture);
+		lru.Get(resizedDesc, &texture);
+	}
+	LRU_RESOURCE_CACHE_STATS stats = lru.GetStats();
+	printf("%-36s %12zu %12.0f %12s\n", "Unbounded map", unbounded.GetCount(), unbounded.GetBytes() / 1048576.0, "");
+	printf("%-36s %12zu %12.0f %12.0f\n", "LRU cache, 256 MB budget", stats.Entries, stats.Bytes / 1048576.0, stats.PeakBytes / 1048576.0);
+	return 0;
+}
@@ -0,0 +1,340 @@
+#include "NativeTest.h"
+#include "LruResourceCache.h"
+#include <atomic>
+#include <random>
+#include <set>
+#include <thread>
+
+namespace {
+	/// <summary>
+	/// Stands in for a texture description. The size of a resource is its width times its height.
+	/// </summary>
+	struct FAKE_DESC {
+		int Width;
+		int Height;
+		bool operator==(const FAKE_DESC &other) const { return Width == other.Width && Height == other.Height; }
+	};
+
+	struct FAKE_DESC_HASH {
+		size_t operator()(const FAKE_DESC &desc) const { return std::hash<int>()(desc.Width * 31 + desc.Height); }
+	};
+
+	struct FAKE_RESOURCE {
+		FAKE_DESC Description;
+		int Id;
+	};
+
+	/// <summary>
+	/// Hands out heap allocated fake resources and tracks which are alive, so tests can check what the cache evicted and that nothing is freed twice.
+	/// </summary>
+	class FakeAllocator : public IResourceAllocator<FAKE_DESC, FAKE_RESOURCE *>
+	{
+	public:
+		struct STATE {
+			std::mutex Mutex;
+			std::set<FAKE_RESOURCE *> Live;
+			int Allocations = 0;
+			int DoubleFrees = 0;
+			bool IsFailing = false;
+			std::vector<int> FreedIds;
+		};
+		FakeAllocator(STATE *pState) :m_State(pState) {}
+		bool Allocate(const FAKE_DESC &description, FAKE_RESOURCE **pResource) override {
+			std::lock_guard<std::mutex> lock(m_State->Mutex);
+			if (m_State->IsFailing) {
+				return false;
+			}
+			*pResource = new FAKE_RESOURCE{ description, m_State->Allocations++ };
+			m_State->Live.insert(*pResource);
+			return true;
+		}
+		void Free(FAKE_RESOURCE *resource) override {
+			std::lock_guard<std::mutex> lock(m_State->Mutex);
+			if (m_State->Live.erase(resource) == 0) {
+				m_State->DoubleFrees++;
+				return;
+			}
+			m_State->FreedIds.push_back(resource->Id);
+			delete resource;
+		}
+	private:
+		STATE *m_State;
+	};
+
+	typedef LruResourceCache<FAKE_DESC, FAKE_RESOURCE *, FAKE_DESC_HASH> FakeCache;
+
+	uint64_t GetLiveBytes(FakeAllocator::STATE &state) {
+		std::lock_guard<std::mutex> lock(state.Mutex);
+		uint64_t bytes = 0;
+		for (FAKE_RESOURCE *resource : state.Live) {
+			bytes += (uint64_t)resource->Description.Width * resource->Description.Height;
+		}
+		return bytes;
+	}
+
+	//Checked by id, as a freed resource's address may be reused by the next one.
+	bool IsLive(FakeAllocator::STATE &state, int id) {
+		std::lock_guard<std::mutex> lock(state.Mutex);
+		for (FAKE_RESOURCE *resource : state.Live) {
+			if (resource->Id == id) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	std::unique_ptr<FakeCache> CreateCache(FakeAllocator::STATE *pState, uint64_t budgetBytes) {
+		return std::make_unique<FakeCache>(std::make_unique<FakeAllocator>(pState), [](const FAKE_DESC &desc) { return (uint64_t)desc.Width * desc.Height; }, budgetBytes);
+	}
+
+	FAKE_RESOURCE *Get(FakeCache &cache, int width, int height) {
+		FAKE_RESOURCE *resource = nullptr;
+		CHECK(cache.Get(FAKE_DESC{ width, height }, &resource));
+		return resource;
+	}
+}
+
+NATIVE_TEST(MatchingDescriptionIsServedFromCache)
+{
+	FakeAllocator::STATE state;
+	auto cache = CreateCache(&state, 1000);
+	FAKE_RESOURCE *first = Get(*cache, 10, 10);
+	CHECK(Get(*cache, 10, 10) == first);
+	FAKE_RESOURCE *other = Get(*cache, 10, 20);
+	CHECK(other != first);
+	CHECK_EQUAL(20, other->Description.Height);
+	LRU_RESOURCE_CACHE_STATS stats = cache->GetStats();
+	CHECK_EQUAL((uint64_t)1, stats.Hits);
+	CHECK_EQUAL((uint64_t)2, stats.Misses);
+	CHECK_EQUAL((size_t)2, stats.Entries);
+	CHECK_EQUAL((uint64_t)300, stats.Bytes);
+	CHECK_EQUAL((uint64_t)1000, stats.BudgetBytes);
+	cache.reset();
+	CHECK(state.Live.empty());
+	CHECK_EQUAL(0, state.DoubleFrees);
+}
+
+NATIVE_TEST(LeastRecentlyUsedIsEvictedFirst)
+{
+	FakeAllocator::STATE state;
+	auto cache = CreateCache(&state, 300);
+	FAKE_RESOURCE *a = Get(*cache, 10, 10);
+	Get(*cache, 10, 11);
+	Get(*cache, 10, 9);
+	//Using A makes B the least recently used.
+	CHECK(Get(*cache, 10, 10) == a);
+	Get(*cache, 5, 10);
+	CHECK((state.FreedIds == std::vector<int>{ 1 }));
+	//C is next. A was used more recently, so it stays.
+	Get(*cache, 10, 12);
+	CHECK((state.FreedIds == std::vector<int>{ 1, 2 }));
+	LRU_RESOURCE_CACHE_STATS stats = cache->GetStats();
+	CHECK_EQUAL((uint64_t)2, stats.Evictions);
+	CHECK_EQUAL((uint64_t)270, stats.Bytes);
+	//The peak includes the new resource before the evictions it caused.
+	CHECK_EQUAL((uint64_t)360, stats.PeakBytes);
+	CHECK_EQUAL(GetLiveBytes(state), stats.Bytes);
+}
+
+NATIVE_TEST(ReturnedResourceIsKeptEvenOverBudget)
+{
+	FakeAllocator::STATE state;
+	auto cache = CreateCache(&state, 100);
+	Get(*cache, 10, 10);
+	//Larger than the whole budget, so everything else goes, but it is still returned.
+	int largeId = Get(*cache, 20, 20)->Id;
+	CHECK(IsLive(state, largeId));
+	CHECK_EQUAL((size_t)1, state.Live.size());
+	LRU_RESOURCE_CACHE_STATS stats = cache->GetStats();
+	CHECK_EQUAL((uint64_t)400, stats.Bytes);
+	//The next request evicts it.
+	Get(*cache, 5, 5);
+	CHECK(!IsLive(state, largeId));
+	CHECK_EQUAL((uint64_t)25, cache->GetStats().Bytes);
+}
+
+NATIVE_TEST(PinnedResourceIsNeitherReturnedNorEvicted)
+{
+	FakeAllocator::STATE state;
+	auto cache = CreateCache(&state, 250);
+	FAKE_RESOURCE *pinned = Get(*cache, 10, 10);
+	int pinnedId = pinned->Id;
+	CHECK(cache->Pin(pinned));
+	//A resource still in use is not handed out again, so another one is allocated.
+	FAKE_RESOURCE *second = Get(*cache, 10, 10);
+	CHECK(second != pinned);
+	int secondId = second->Id;
+	CHECK_EQUAL((size_t)1, cache->GetStats().Pinned);
+	//Filling the cache evicts the unpinned resources only, and the cache stays over its budget while the pinned one is kept.
+	Get(*cache, 10, 20);
+	Get(*cache, 10, 21);
+	CHECK(IsLive(state, pinnedId));
+	CHECK(!IsLive(state, secondId));
+	CHECK_EQUAL((uint64_t)310, cache->GetStats().Bytes);
+	//Unpinning does not free, even over budget.
+	cache->Unpin(pinned);
+	CHECK(IsLive(state, pinnedId));
+	LRU_RESOURCE_CACHE_STATS stats = cache->GetStats();
+	CHECK_EQUAL((size_t)0, stats.Pinned);
+	CHECK_EQUAL((uint64_t)310, stats.Bytes);
+	//Resources the cache does not have, and unpinned ones, are ignored.
+	FAKE_RESOURCE unknown{ { 1, 1 }, -1 };
+	CHECK(!cache->Pin(&unknown));
+	cache->Unpin(&unknown);
+	cache->Unpin(pinned);
+	CHECK_EQUAL((size_t)0, cache->GetStats().Pinned);
+	//The next request trims the cache.
+	Get(*cache, 1, 1);
+	CHECK(cache->GetStats().Bytes <= 250);
+	CHECK_EQUAL(0, state.DoubleFrees);
+}
+
+NATIVE_TEST(PinsNest)
+{
+	FakeAllocator::STATE state;
+	auto cache = CreateCache(&state, 1000);
+	FAKE_RESOURCE *resource = Get(*cache, 10, 10);
+	CHECK(cache->Pin(resource));
+	CHECK(cache->Pin(resource));
+	cache->Unpin(resource);
+	CHECK(Get(*cache, 10, 10) != resource);
+	cache->Unpin(resource);
+	CHECK_EQUAL((size_t)0, cache->GetStats().Pinned);
+	//Both matching resources are free again, so no new one is allocated.
+	Get(*cache, 10, 10);
+	CHECK_EQUAL((uint64_t)2, cache->GetStats().Misses);
+}
+
+NATIVE_TEST(BudgetChangeAndClearFreeResources)
+{
+	FakeAllocator::STATE state;
+	auto cache = CreateCache(&state, 1000);
+	FAKE_RESOURCE *pinned = Get(*cache, 10, 10);
+	cache->Pin(pinned);
+	for (int i = 1; i <= 5; i++) {
+		Get(*cache, 10, 10 + i);
+	}
+	cache->SetBudget(250);
+	LRU_RESOURCE_CACHE_STATS stats = cache->GetStats();
+	CHECK(stats.Bytes <= 250);
+	CHECK_EQUAL((uint64_t)250, stats.BudgetBytes);
+	CHECK(state.Live.count(pinned) == 1);
+	//Clear frees pinned resources as well, and later unpins of them are ignored.
+	cache->Clear();
+	CHECK(state.Live.empty());
+	cache->Unpin(pinned);
+	CHECK_EQUAL((size_t)0, cache->GetStats().Entries);
+	CHECK_EQUAL((uint64_t)0, cache->GetStats().Bytes);
+	CHECK_EQUAL(0, state.DoubleFrees);
+}
+
+NATIVE_TEST(FailedAllocationIsCounted)
+{
+	FakeAllocator::STATE state;
+	auto cache = CreateCache(&state, 1000);
+	state.IsFailing = true;
+	FAKE_RESOURCE *resource = nullptr;
+	CHECK(!cache->Get(FAKE_DESC{ 10, 10 }, &resource));
+	CHECK(resource == nullptr);
+	LRU_RESOURCE_CACHE_STATS stats = cache->GetStats();
+	CHECK_EQUAL((uint64_t)1, stats.Failures);
+	CHECK_EQUAL((uint64_t)0, stats.Misses);
+	CHECK_EQUAL((size_t)0, stats.Entries);
+	state.IsFailing = false;
+	CHECK(cache->Get(FAKE_DESC{ 10, 10 }, &resource));
+}
+
+NATIVE_TEST(RandomUseKeepsAccountingExact)
+{
+	std::mt19937 rng(1);
+	FakeAllocator::STATE state;
+	auto pCache = CreateCache(&state, 5000);
+	FakeCache &cache = *pCache;
+	std::vector<FAKE_RESOURCE *> pinned;
+	uint64_t gets = 0;
+	for (int i = 0; i < 20000; i++) {
+		int action = rng() % 10;
+		if (action < 7) {
+			FAKE_RESOURCE *resource = Get(cache, 10 + rng() % 20, 10 + rng() % 5);
+			gets++;
+			CHECK(std::find(pinned.begin(), pinned.end(), resource) == pinned.end());
+			if (action == 0 && pinned.size() < 8) {
+				CHECK(cache.Pin(resource));
+				pinned.push_back(resource);
+			}
+		}
+		else if (action < 9 && !pinned.empty()) {
+			size_t index = rng() % pinned.size();
+			cache.Unpin(pinned[index]);
+			pinned.erase(pinned.begin() + index);
+		}
+		else if (action == 9 && rng() % 100 == 0) {
+			cache.SetBudget(1000 + rng() % 8000);
+		}
+		LRU_RESOURCE_CACHE_STATS stats = cache.GetStats();
+		CHECK_EQUAL(GetLiveBytes(state), stats.Bytes);
+		CHECK_EQUAL(state.Live.size(), stats.Entries);
+		CHECK_EQUAL(pinned.size(), stats.Pinned);
+		CHECK(stats.Bytes <= stats.PeakBytes);
+	}
+	LRU_RESOURCE_CACHE_STATS stats = cache.GetStats();
+	CHECK_EQUAL(gets, stats.Hits + stats.Misses);
+	CHECK_EQUAL((uint64_t)state.Allocations, stats.Misses);
+	CHECK_EQUAL(stats.Misses - stats.Entries, stats.Evictions);
+	CHECK_EQUAL(0, state.DoubleFrees);
+}
+
+NATIVE_TEST(ConcurrentUnpinWhileRequesting)
+{
+	FakeAllocator::STATE state;
+	{
+		auto cache = CreateCache(&state, 2000);
+		std::mutex pinnedMutex;
+		std::vector<FAKE_RESOURCE *> pinned;
+		std::atomic<bool> isDone(false);
+		std::atomic<int> reusedWhilePinned(0);
+		//The encode thread unpins frames as it is done with them, like the pipeline releasing processed frames.
+		std::thread encoder([&]() {
+			while (!isDone) {
+				FAKE_RESOURCE *resource = nullptr;
+				{
+					std::lock_guard<std::mutex> lock(pinnedMutex);
+					if (!pinned.empty()) {
+						resource = pinned.front();
+						pinned.erase(pinned.begin());
+					}
+				}
+				if (resource) {
+					cache->Unpin(resource);
+				}
+				else {
+					std::this_thread::yield();
+				}
+			}
+		});
+		std::mt19937 rng(2);
+		for (int frame = 0; frame < 100000; frame++) {
+			FAKE_RESOURCE *resource = Get(*cache, 20 + rng() % 3, 20);
+			{
+				std::lock_guard<std::mutex> lock(pinnedMutex);
+				if (std::find(pinned.begin(), pinned.end(), resource) != pinned.end()) {
+					reusedWhilePinned++;
+				}
+				CHECK(cache->Pin(resource));
+				pinned.push_back(resource);
+			}
+			if (frame % 64 == 0) {
+				std::this_thread::yield();
+			}
+		}
+		isDone = true;
+		encoder.join();
+		CHECK_EQUAL(0, reusedWhilePinned.load());
+		for (FAKE_RESOURCE *resource : pinned) {
+			cache->Unpin(resource);
+		}
+		CHECK_EQUAL((size_t)0, cache->GetStats().Pinned);
+	}
+	CHECK(state.Live.empty());
+	CHECK_EQUAL(0, state.DoubleFrees);
+}
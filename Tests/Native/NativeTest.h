@@ -0,0 +1,128 @@
+#pragma once
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/// <summary>
+/// Minimal test registry for the portable parts of ScreenRecorderLibNative, so they build and run anywhere with a C++17 compiler and no test framework.
+/// Each test file is linked into its own executable with NativeTestMain.cpp, and each executable is one CTest test.
+/// </summary>
+struct NATIVE_TEST {
+	const char *Name;
+	void (*Body)();
+};
+
+inline std::vector<NATIVE_TEST> &GetNativeTests() {
+	static std::vector<NATIVE_TEST> tests;
+	return tests;
+}
+
+struct NativeTestRegistration {
+	NativeTestRegistration(const char *name, void (*body)()) {
+		GetNativeTests().push_back({ name, body });
+	}
+};
+
+/// <summary>
+/// Thrown by a failed check to end the current test.
+/// </summary>
+class NativeTestFailure : public std::exception
+{
+public:
+	NativeTestFailure(const char *file, int line, const std::string &message) {
+		std::ostringstream text;
+		text << file << ":" << line << ": " << message;
+		m_Message = text.str();
+	}
+	const char *what() const noexcept override { return m_Message.c_str(); }
+private:
+	std::string m_Message;
+};
+
+#define NATIVE_TEST(name) \
+	static void name(); \
+	static NativeTestRegistration name##Registration(#name, name); \
+	static void name()
+
+#define CHECK(expr) \
+	do { \
+		if (!(expr)) { \
+			throw NativeTestFailure(__FILE__, __LINE__, "CHECK(" #expr ") failed"); \
+		} \
+	} while (0)
+
+#define CHECK_EQUAL(expected, actual) \
+	do { \
+		auto _expected_ = (expected); \
+		auto _actual_ = (actual); \
+		if (!(_expected_ == _actual_)) { \
+			std::ostringstream _text_; \
+			_text_ << "CHECK_EQUAL(" #expected ", " #actual ") failed: expected " << _expected_ << ", got " << _actual_; \
+			throw NativeTestFailure(__FILE__, __LINE__, _text_.str()); \
+		} \
+	} while (0)
+
+#define CHECK_NEAR(expected, actual, tolerance) \
+	do { \
+		double _expected_ = (double)(expected); \
+		double _actual_ = (double)(actual); \
+		if (!(std::fabs(_expected_ - _actual_) <= (double)(tolerance))) { \
+			std::ostringstream _text_; \
+			_text_ << "CHECK_NEAR(" #expected ", " #actual ", " #tolerance ") failed: expected " << _expected_ << ", got " << _actual_; \
+			throw NativeTestFailure(__FILE__, __LINE__, _text_.str()); \
+		} \
+	} while (0)
+
+/// <summary>
+/// Runs every registered test, or only the tests whose names contain one of the arguments.
+/// </summary>
+/// <returns>The number of failed tests</returns>
+inline int RunNativeTests(int argc, char **argv) {
+	int failed = 0;
+	int run = 0;
+	for (const NATIVE_TEST &test : GetNativeTests()) {
+		bool isSelected = argc <= 1;
+		for (int i = 1; i < argc && !isSelected; i++) {
+			isSelected = strstr(test.Name, argv[i]) != nullptr;
+		}
+		if (!isSelected) {
+			continue;
+		}
+		run++;
+		auto start = std::chrono::steady_clock::now();
+		try {
+			test.Body();
+			double millis = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			printf("[ OK ] %s (%.1f ms)\n", test.Name, millis);
+		}
+		catch (const std::exception &e) {
+			printf("[FAIL] %s\n       %s\n", test.Name, e.what());
+			failed++;
+		}
+		fflush(stdout);
+	}
+	printf("%d of %d tests passed\n", run - failed, run);
+	return failed;
+}
+
+/// <summary>
+/// Runs a function repeatedly for at least the given time, and returns the mean time of one call in milliseconds. Used by the benchmarks.
+/// </summary>
+inline double MeasureMillisPerCall(const std::function<void()> &func, double minimumMillis = 200) {
+	func();
+	size_t calls = 0;
+	auto start = std::chrono::steady_clock::now();
+	double elapsed = 0;
+	do {
+		func();
+		calls++;
+		elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	} while (elapsed < minimumMillis);
+	return elapsed / calls;
+}
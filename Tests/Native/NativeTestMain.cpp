@@ -0,0 +1,6 @@
+#include "NativeTest.h"
+
+int main(int argc, char **argv)
+{
+	return RunNativeTests(argc, argv) == 0 ? 0 : 1;
+}
@@ -0,0 +1,163 @@
+#include "NativeTest.h"
+#include "PngEncoder.h"
+#include "PngTestDecoder.h"
+
+namespace {
+	/// <summary>
+	/// Encodes an image from rows with padding, decodes it, and checks every pixel kept its color. Alpha is dropped, so it decodes as opaque.
+	/// </summary>
+	void CheckRoundTrip(const char *name, const TEST_IMAGE &image, WorkerPool *pPool = nullptr) {
+		uint32_t pitch = image.Width * 4 + 12;
+		std::vector<uint8_t> pixels = CopyWithPitch(image, pitch);
+		PngEncoder encoder;
+		std::vector<uint8_t> png;
+		CHECK(encoder.Encode(pixels.data(), image.Width, image.Height, pitch, png, pPool));
+		TEST_IMAGE decoded;
+		try {
+			decoded = PngTestDecoder::Decode(png);
+		}
+		catch (const std::exception &e) {
+			printf("       %s (%ux%u) is not a valid PNG: %s\n", name, image.Width, image.Height, e.what());
+			CHECK(false);
+		}
+		CHECK_EQUAL(image.Width, decoded.Width);
+		CHECK_EQUAL(image.Height, decoded.Height);
+		size_t differentPixels = 0;
+		for (size_t i = 0; i < image.Bgra.size(); i += 4) {
+			differentPixels += memcmp(&image.Bgra[i], &decoded.Bgra[i], 3) != 0 || decoded.Bgra[i + 3] != 0xFF ? 1 : 0;
+		}
+		if (differentPixels > 0) {
+			printf("       %s (%ux%u) has %zu pixels that changed\n", name, image.Width, image.Height, differentPixels);
+			CHECK_EQUAL((size_t)0, differentPixels);
+		}
+	}
+
+	/// <summary>
+	/// FNV-1a over the bytes of the image.
+	/// </summary>
+	uint64_t HashImage(const TEST_IMAGE &image) {
+		uint64_t hash = 0xcbf29ce484222325ull;
+		for (uint8_t value : image.Bgra) {
+			hash = (hash ^ value) * 0x100000001b3ull;
+		}
+		return hash;
+	}
+
+	/// <summary>
+	/// An image in which each row suits a different PNG filter: flat rows, vertical and horizontal gradients, and noise.
+	/// </summary>
+	TEST_IMAGE MakeFilterTestImage(uint32_t width, uint32_t height) {
+		TEST_IMAGE image = MakeNoiseImage(width, height, 11);
+		for (uint32_t row = 0; row < height; row++) {
+			for (uint32_t col = 0; col < width; col++) {
+				uint8_t *pPixel = &image.Bgra[(static_cast<size_t>(row) * width + col) * 4];
+				switch (row % 5)
+				{
+				case 0:
+					pPixel[0] = pPixel[1] = pPixel[2] = 0x30;
+					break;
+				case 1:
+					pPixel[0] = static_cast<uint8_t>(col * 3);
+					pPixel[1] = static_cast<uint8_t>(col * 5);
+					pPixel[2] = static_cast<uint8_t>(col * 7);
+					break;
+				case 2:
+					pPixel[0] = pPixel[1] = pPixel[2] = static_cast<uint8_t>(row * 9);
+					break;
+				case 3:
+					pPixel[0] = static_cast<uint8_t>(row + col);
+					pPixel[1] = static_cast<uint8_t>(row * 2 + col);
+					pPixel[2] = static_cast<uint8_t>(255 - row - col);
+					break;
+				}
+			}
+		}
+		return image;
+	}
+}
+
+NATIVE_TEST(DecoderReadsTestmediaPngsAsPillowDoes)
+{
+	//Checks the test decoder itself on files from other encoders, against the hashes of the images Pillow decodes.
+	TEST_IMAGE renault = PngTestDecoder::DecodeFile(NATIVE_TEST_MEDIA_DIR "/renault.png");
+	CHECK_EQUAL(640u, renault.Width);
+	CHECK_EQUAL(356u, renault.Height);
+	CHECK_EQUAL(0xa042984bf0d153f6ull, HashImage(renault));
+	TEST_IMAGE alphatest = PngTestDecoder::DecodeFile(NATIVE_TEST_MEDIA_DIR "/alphatest.png");
+	CHECK_EQUAL(0x2f208b21efd11e78ull, HashImage(alphatest));
+}
+
+NATIVE_TEST(SmallAndOddSizedImagesRoundTrip)
+{
+	const uint32_t sizes[][2] = { { 1, 1 }, { 2, 1 }, { 1, 3 }, { 3, 2 }, { 17, 5 }, { 5, 17 }, { 33, 31 }, { 1, 300 }, { 300, 1 } };
+	for (const auto &size : sizes) {
+		CheckRoundTrip("noise", MakeNoiseImage(size[0], size[1], size[0] * 1000 + size[1]));
+		CheckRoundTrip("filter rows", MakeFilterTestImage(size[0], size[1]));
+	}
+}
+
+NATIVE_TEST(ImagesSplitInStripsRoundTrip)
+{
+	//Strips hold 256 KB of filtered rows, so these have several strips, and a strip per row for rows wider than a strip.
+	CheckRoundTrip("screen-like", MakeScreenLikeImage(1000, 300));
+	CheckRoundTrip("filter rows", MakeFilterTestImage(701, 503));
+	CheckRoundTrip("noise", MakeNoiseImage(513, 400, 3));
+	CheckRoundTrip("wide noise", MakeNoiseImage(100000, 3, 4));
+}
+
+NATIVE_TEST(TestmediaImagesRoundTripWithoutAlpha)
+{
+	CheckRoundTrip("renault.png", PngTestDecoder::DecodeFile(NATIVE_TEST_MEDIA_DIR "/renault.png"));
+	CheckRoundTrip("alphatest.png", PngTestDecoder::DecodeFile(NATIVE_TEST_MEDIA_DIR "/alphatest.png"));
+}
+
+NATIVE_TEST(EncodingOnAPoolGivesTheSameFile)
+{
+	WorkerPool pool(4, 64);
+	pool.Start();
+	TEST_IMAGE image = MakeScreenLikeImage(1920, 1080);
+	CheckRoundTrip("screen-like on a pool", image, &pool);
+	PngEncoder encoder;
+	std::vector<uint8_t> alone;
+	CHECK(encoder.Encode(image.Bgra.data(), image.Width, image.Height, image.Width * 4, alone));
+	std::vector<uint8_t> pooled;
+	for (int i = 0; i < 3; i++) {
+		CHECK(encoder.Encode(image.Bgra.data(), image.Width, image.Height, image.Width * 4, pooled, &pool));
+		CHECK(pooled == alone);
+	}
+	pool.Stop();
+}
+
+NATIVE_TEST(ReusedEncoderGivesTheSameFile)
+{
+	//An encoder keeps its buffers between images, which must not leak into an image of another size.
+	TEST_IMAGE large = MakeScreenLikeImage(800, 600);
+	TEST_IMAGE small = MakeFilterTestImage(97, 61);
+	PngEncoder fresh;
+	std::vector<uint8_t> expected;
+	CHECK(fresh.Encode(small.Bgra.data(), small.Width, small.Height, small.Width * 4, expected));
+	PngEncoder reused;
+	std::vector<uint8_t> png;
+	CHECK(reused.Encode(large.Bgra.data(), large.Width, large.Height, large.Width * 4, png));
+	CHECK(reused.Encode(small.Bgra.data(), small.Width, small.Height, small.Width * 4, png));
+	CHECK(png == expected);
+}
+
+NATIVE_TEST(ScreenLikeImagesCompressWell)
+{
+	TEST_IMAGE image = MakeScreenLikeImage(1920, 1080);
+	PngEncoder encoder;
+	std::vector<uint8_t> png;
+	CHECK(encoder.Encode(image.Bgra.data(), image.Width, image.Height, image.Width * 4, png));
+	CHECK(png.size() < image.Bgra.size() / 20);
+}
+
+NATIVE_TEST(EmptyImagesAreRejected)
+{
+	uint32_t pixel = 0xFFFFFFFF;
+	PngEncoder encoder;
+	std::vector<uint8_t> png(10, 0);
+	CHECK(!encoder.Encode(reinterpret_cast<const uint8_t *>(&pixel), 0, 1, 4, png));
+	CHECK(png.empty());
+	CHECK(!encoder.Encode(reinterpret_cast<const uint8_t *>(&pixel), 1, 0, 4, png));
+}
@@ -0,0 +1,175 @@
+#pragma once
+#include "InflateTestDecoder.h"
+#include "TestImage.h"
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/// <summary>
+/// A minimal PNG decoder for the tests of PngEncoder, and to load the PNGs in Testmedia as test images.
+/// Reads 8 bit RGB and RGBA images without interlacing, and checks the CRC of every chunk and the Adler-32 of the image data
+/// independently of the checksums in DeflateEncoder.h. Throws std::runtime_error on anything else.
+/// </summary>
+class PngTestDecoder
+{
+public:
+	static TEST_IMAGE Decode(const std::vector<uint8_t> &png)
+	{
+		static const uint8_t SIGNATURE[8] = { 0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A };
+		if (png.size() < 8 || memcmp(png.data(), SIGNATURE, 8) != 0) {
+			throw std::runtime_error("Not a PNG");
+		}
+		TEST_IMAGE image;
+		uint8_t colorType = 0;
+		std::vector<uint8_t> zlibStream;
+		bool isEnded = false;
+		size_t pos = 8;
+		while (!isEnded) {
+			if (pos + 12 > png.size()) {
+				throw std::runtime_error("Unexpected end of PNG");
+			}
+			uint32_t length = ReadBigEndian(&png[pos]);
+			if (length > png.size() - pos - 12) {
+				throw std::runtime_error("Chunk reaches past the end of the PNG");
+			}
+			std::string type(reinterpret_cast<const char *>(&png[pos + 4]), 4);
+			const uint8_t *pChunkData = &png[pos + 8];
+			if (Crc32(&png[pos + 4], length + 4) != ReadBigEndian(pChunkData + length)) {
+				throw std::runtime_error("Invalid CRC in chunk " + type);
+			}
+			if (type == "IHDR") {
+				image.Width = ReadBigEndian(pChunkData);
+				image.Height = ReadBigEndian(pChunkData + 4);
+				colorType = pChunkData[9];
+				if (pChunkData[8] != 8 || (colorType != 2 && colorType != 6) || pChunkData[10] != 0 || pChunkData[11] != 0 || pChunkData[12] != 0) {
+					throw std::runtime_error("Unsupported PNG format");
+				}
+			}
+			else if (type == "IDAT") {
+				zlibStream.insert(zlibStream.end(), pChunkData, pChunkData + length);
+			}
+			else if (type == "IEND") {
+				isEnded = true;
+			}
+			pos += static_cast<size_t>(length) + 12;
+		}
+		if (pos != png.size()) {
+			throw std::runtime_error("Data after IEND");
+		}
+		if (zlibStream.size() < 6 || (zlibStream[0] & 0x0F) != 8 || ((zlibStream[0] << 8) | zlibStream[1]) % 31 != 0 || (zlibStream[1] & 0x20)) {
+			throw std::runtime_error("Invalid zlib header");
+		}
+		std::vector<uint8_t> filtered = InflateTestDecoder::Inflate(zlibStream.data() + 2, zlibStream.size() - 6);
+		if (Adler32(filtered.data(), filtered.size()) != ReadBigEndian(&zlibStream[zlibStream.size() - 4])) {
+			throw std::runtime_error("Invalid Adler-32");
+		}
+		size_t bytesPerPixel = colorType == 6 ? 4 : 3;
+		size_t rowSize = image.Width * bytesPerPixel;
+		if (filtered.size() != (rowSize + 1) * image.Height) {
+			throw std::runtime_error("Image data has the wrong size");
+		}
+		Unfilter(filtered, rowSize, bytesPerPixel, image.Height);
+		image.Bgra.resize(static_cast<size_t>(image.Width) * image.Height * 4);
+		for (uint32_t row = 0; row < image.Height; row++) {
+			const uint8_t *pRow = &filtered[row * (rowSize + 1) + 1];
+			for (uint32_t col = 0; col < image.Width; col++) {
+				const uint8_t *pPixel = pRow + col * bytesPerPixel;
+				uint8_t *pBgra = &image.Bgra[(static_cast<size_t>(row) * image.Width + col) * 4];
+				pBgra[0] = pPixel[2];
+				pBgra[1] = pPixel[1];
+				pBgra[2] = pPixel[0];
+				pBgra[3] = bytesPerPixel == 4 ? pPixel[3] : 0xFF;
+			}
+		}
+		return image;
+	}
+
+	static TEST_IMAGE DecodeFile(const std::string &path)
+	{
+		std::ifstream file(path, std::ios::binary);
+		if (!file) {
+			throw std::runtime_error("Cannot open " + path);
+		}
+		return Decode(std::vector<uint8_t>((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>()));
+	}
+
+private:
+	static uint32_t ReadBigEndian(const uint8_t *pData)
+	{
+		return static_cast<uint32_t>(pData[0]) << 24 | pData[1] << 16 | pData[2] << 8 | pData[3];
+	}
+
+	static uint32_t Crc32(const uint8_t *pData, size_t size)
+	{
+		uint32_t crc = 0xFFFFFFFF;
+		for (size_t i = 0; i < size; i++) {
+			crc ^= pData[i];
+			for (int bit = 0; bit < 8; bit++) {
+				crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+			}
+		}
+		return ~crc;
+	}
+
+	static uint32_t Adler32(const uint8_t *pData, size_t size)
+	{
+		uint32_t a = 1;
+		uint32_t b = 0;
+		for (size_t i = 0; i < size; i++) {
+			a = (a + pData[i]) % 65521;
+			b = (b + a) % 65521;
+		}
+		return b << 16 | a;
+	}
+
+	/// <summary>
+	/// Reverses the filter of each row in place, leaving the filter type byte before each row.
+	/// </summary>
+	static void Unfilter(std::vector<uint8_t> &data, size_t rowSize, size_t bytesPerPixel, uint32_t height)
+	{
+		for (uint32_t row = 0; row < height; row++) {
+			uint8_t *pRow = &data[row * (rowSize + 1)];
+			uint8_t filter = pRow[0];
+			uint8_t *pCurrent = pRow + 1;
+			const uint8_t *pAbove = row > 0 ? pCurrent - (rowSize + 1) : nullptr;
+			for (size_t i = 0; i < rowSize; i++) {
+				int left = i >= bytesPerPixel ? pCurrent[i - bytesPerPixel] : 0;
+				int above = pAbove ? pAbove[i] : 0;
+				int aboveLeft = pAbove && i >= bytesPerPixel ? pAbove[i - bytesPerPixel] : 0;
+				int predicted;
+				switch (filter)
+				{
+				case 0:
+					predicted = 0;
+					break;
+				case 1:
+					predicted = left;
+					break;
+				case 2:
+					predicted = above;
+					break;
+				case 3:
+					predicted = (left + above) / 2;
+					break;
+				case 4:
+				{
+					int estimate = left + above - aboveLeft;
+					int distanceLeft = std::abs(estimate - left);
+					int distanceAbove = std::abs(estimate - above);
+					int distanceAboveLeft = std::abs(estimate - aboveLeft);
+					predicted = distanceLeft <= distanceAbove && distanceLeft <= distanceAboveLeft ? left : distanceAbove <= distanceAboveLeft ? above : aboveLeft;
+					break;
+				}
+				default:
+					throw std::runtime_error("Invalid filter type");
+				}
+				pCurrent[i] = static_cast<uint8_t>(pCurrent[i] + predicted);
+			}
+		}
+	}
+};
@@ -0,0 +1,48 @@
+#include "NativeTest.h"
+#include "PolyphaseResampler.h"
+
+//Measures how many times faster than real time each kernel converts 10 ms packets, for the conversions WASAPICapture commonly needs.
+
+struct CONVERSION_CASE {
+	const char *Name;
+	AUDIO_SAMPLE_FORMAT Input;
+	AUDIO_SAMPLE_FORMAT Output;
+};
+
+int main()
+{
+	const CONVERSION_CASE cases[] = {
+		{ "44.1 kHz stereo int16 to 48 kHz", { 44100, 2, AudioSampleType::Int16 }, { 48000, 2, AudioSampleType::Int16 } },
+		{ "48 kHz stereo float to 44.1 kHz int16", { 48000, 2, AudioSampleType::Float32 }, { 44100, 2, AudioSampleType::Int16 } },
+		{ "48 kHz 5.1 float to stereo int16", { 48000, 6, AudioSampleType::Float32 }, { 48000, 2, AudioSampleType::Int16 } },
+		{ "96 kHz stereo float to 48 kHz int16", { 96000, 2, AudioSampleType::Float32 }, { 48000, 2, AudioSampleType::Int16 } },
+		{ "16 kHz mono int16 to 48 kHz stereo", { 16000, 1, AudioSampleType::Int16 }, { 48000, 2, AudioSampleType::Int16 } },
+	};
+	const char *kernelNames[] = { "Scalar", "SSE2", "AVX2" };
+	printf("%-40s %12s %12s %12s  (x real time)\n", "", kernelNames[0], kernelNames[1], kernelNames[2]);
+	for (const CONVERSION_CASE &conversion : cases) {
+		printf("%-40s", conversion.Name);
+		size_t packetFrames = conversion.Input.SampleRate / 100;
+		std::vector<uint8_t> input(packetFrames * conversion.Input.FrameBytes());
+		for (size_t i = 0; i < input.size(); i++) {
+			input[i] = (uint8_t)(i * 31);
+		}
+		if (conversion.Input.SampleType == AudioSampleType::Float32) {
+			for (size_t i = 0; i < input.size() / sizeof(float); i++) {
+				((float *)input.data())[i] = (float)std::sin(i * 0.05) * 0.5f;
+			}
+		}
+		for (int kernel = 0; kernel < 3; kernel++) {
+			PolyphaseResampler resampler;
+			resampler.SetKernel((AudioMixer::Kernel)kernel);
+			resampler.Initialize(conversion.Input, conversion.Output);
+			std::vector<uint8_t> output(resampler.GetMaxOutputBytes(input.size()));
+			double millis = MeasureMillisPerCall([&]() {
+				resampler.Process(input.data(), input.size(), output.data(), output.size());
+			});
+			printf(" %12.1f", 10.0 / millis);
+		}
+		printf("\n");
+	}
+	return 0;
+}
@@ -0,0 +1,214 @@
+#include "NativeTest.h"
+#include "PolyphaseResampler.h"
+
+namespace {
+	const double PI = 3.14159265358979323846;
+	const AudioMixer::Kernel KERNELS[] = { AudioMixer::Kernel::Scalar, AudioMixer::Kernel::SSE2, AudioMixer::Kernel::AVX2 };
+
+	/// <summary>
+	/// Feeds input to the resampler in chunks of chunkBytes, then drains it, and returns all output.
+	/// </summary>
+	std::vector<uint8_t> ConvertInChunks(PolyphaseResampler &resampler, const std::vector<uint8_t> &input, size_t chunkBytes, bool isDrained = true) {
+		std::vector<uint8_t> output;
+		for (size_t pos = 0; pos < input.size(); pos += chunkBytes) {
+			size_t length = (std::min)(chunkBytes, input.size() - pos);
+			size_t offset = output.size();
+			output.resize(offset + resampler.GetMaxOutputBytes(length));
+			size_t written = resampler.Process(input.data() + pos, length, output.data() + offset, output.size() - offset);
+			output.resize(offset + written);
+		}
+		if (isDrained) {
+			size_t offset = output.size();
+			output.resize(offset + resampler.GetMaxOutputBytes(0) + 4096 * resampler.GetOutputFormat().FrameBytes());
+			size_t written = resampler.Drain(output.data() + offset, output.size() - offset);
+			output.resize(offset + written);
+		}
+		return output;
+	}
+
+	double ReadSample(const std::vector<uint8_t> &data, AudioSampleType type, size_t index) {
+		if (type == AudioSampleType::Int16) {
+			return ((const int16_t *)data.data())[index] / 32768.0;
+		}
+		return ((const float *)data.data())[index];
+	}
+
+	void WriteSample(std::vector<uint8_t> &data, AudioSampleType type, size_t index, double value) {
+		if (type == AudioSampleType::Int16) {
+			((int16_t *)data.data())[index] = (int16_t)std::lrint(value * 32767);
+		}
+		else {
+			((float *)data.data())[index] = (float)value;
+		}
+	}
+
+	struct SINE_RESULT {
+		//Ratio of the ideal signal to the conversion error, in dB.
+		double Snr = 0;
+		//Output level relative to the ideal signal, in dB.
+		double Gain = 0;
+		size_t OutputFrames = 0;
+	};
+
+	/// <summary>
+	/// Converts one second of a stereo sine tone, with a different phase in each channel, and compares the output to the same tone generated at the output rate.
+	/// </summary>
+	SINE_RESULT ConvertSine(uint32_t inputRate, uint32_t outputRate, double frequency, AudioSampleType type, AudioMixer::Kernel kernel, size_t chunkBytes) {
+		PolyphaseResampler resampler;
+		resampler.SetKernel(kernel);
+		AUDIO_SAMPLE_FORMAT inputFormat{ inputRate, 2, type };
+		AUDIO_SAMPLE_FORMAT outputFormat{ outputRate, 2, type };
+		CHECK(resampler.Initialize(inputFormat, outputFormat));
+		size_t inputFrames = inputRate;
+		std::vector<uint8_t> input(inputFrames * inputFormat.FrameBytes());
+		for (size_t i = 0; i < inputFrames; i++) {
+			for (int channel = 0; channel < 2; channel++) {
+				WriteSample(input, type, i * 2 + channel, 0.5 * std::sin(2 * PI * frequency * i / inputRate + channel));
+			}
+		}
+		std::vector<uint8_t> output = ConvertInChunks(resampler, input, chunkBytes);
+		SINE_RESULT result;
+		result.OutputFrames = output.size() / outputFormat.FrameBytes();
+		//The edges are skipped, as the filter sees silence before and after the tone there.
+		const size_t edgeFrames = 200;
+		double signal = 0, error = 0, level = 0;
+		for (size_t i = edgeFrames; i + edgeFrames < result.OutputFrames; i++) {
+			for (int channel = 0; channel < 2; channel++) {
+				double ideal = 0.5 * std::sin(2 * PI * frequency * i / outputRate + channel);
+				double actual = ReadSample(output, type, i * 2 + channel);
+				signal += ideal * ideal;
+				error += (actual - ideal) * (actual - ideal);
+				level += actual * actual;
+			}
+		}
+		result.Snr = 10 * std::log10(signal / error);
+		result.Gain = 10 * std::log10(level / signal);
+		return result;
+	}
+}
+
+NATIVE_TEST(SineToneSnrMeetsQualityTarget)
+{
+	const uint32_t rates[][2] = { { 44100, 48000 }, { 48000, 44100 }, { 96000, 48000 }, { 16000, 48000 }, { 48000, 16000 }, { 44100, 48001 }, { 192000, 44100 } };
+	for (AudioMixer::Kernel kernel : KERNELS) {
+		for (auto &rate : rates) {
+			//16-bit output is limited by its own quantization noise, at about 86 dB for a half scale tone.
+			SINE_RESULT int16Result = ConvertSine(rate[0], rate[1], 1000, AudioSampleType::Int16, kernel, 4093);
+			SINE_RESULT floatResult = ConvertSine(rate[0], rate[1], 1000, AudioSampleType::Float32, kernel, 777);
+			CHECK(int16Result.Snr > 84);
+			CHECK(floatResult.Snr > 100);
+			//The drained output has exactly the duration of the input.
+			size_t expectedFrames = (size_t)(((uint64_t)rate[0] * rate[1] + rate[0] - 1) / rate[0]);
+			CHECK_EQUAL(expectedFrames, int16Result.OutputFrames);
+			CHECK_EQUAL(expectedFrames, floatResult.OutputFrames);
+		}
+	}
+}
+
+NATIVE_TEST(PassbandIsFlat)
+{
+	for (AudioMixer::Kernel kernel : KERNELS) {
+		for (double frequency = 100; frequency <= 18000; frequency += 1000) {
+			CHECK_NEAR(0.0, ConvertSine(44100, 48000, frequency, AudioSampleType::Float32, kernel, 100000).Gain, 0.01);
+			CHECK_NEAR(0.0, ConvertSine(48000, 44100, frequency, AudioSampleType::Float32, kernel, 100000).Gain, 0.01);
+		}
+	}
+}
+
+NATIVE_TEST(FrequenciesAboveOutputNyquistAreRemoved)
+{
+	for (AudioMixer::Kernel kernel : KERNELS) {
+		//A 23.5 kHz tone cannot be represented at 44.1 kHz, and would alias to 20.6 kHz if it was not filtered out.
+		CHECK(ConvertSine(48000, 44100, 23500, AudioSampleType::Float32, kernel, 100000).Gain < -70);
+		CHECK(ConvertSine(48000, 16000, 10000, AudioSampleType::Float32, kernel, 100000).Gain < -70);
+	}
+}
+
+NATIVE_TEST(OutputDoesNotDependOnChunkSize)
+{
+	AUDIO_SAMPLE_FORMAT inputFormat{ 44100, 6, AudioSampleType::Int16 };
+	AUDIO_SAMPLE_FORMAT outputFormat{ 48000, 2, AudioSampleType::Int16 };
+	std::vector<uint8_t> input(44100 * inputFormat.FrameBytes());
+	for (size_t i = 0; i < input.size() / 2; i++) {
+		((int16_t *)input.data())[i] = (int16_t)((i * 7919) % 20000 - 10000);
+	}
+	PolyphaseResampler reference;
+	reference.Initialize(inputFormat, outputFormat);
+	std::vector<uint8_t> expected = ConvertInChunks(reference, input, input.size());
+	//Chunks of 1, 3 and 7 bytes split frames and even samples across calls.
+	for (size_t chunkBytes : { 1, 3, 7, 1000, 4410 * 12 }) {
+		PolyphaseResampler resampler;
+		resampler.Initialize(inputFormat, outputFormat);
+		CHECK(ConvertInChunks(resampler, input, chunkBytes) == expected);
+		CHECK_EQUAL((uint64_t)44100, resampler.GetInputFrameTotal());
+		CHECK_EQUAL((uint64_t)48000, resampler.GetOutputFrameTotal());
+	}
+}
+
+NATIVE_TEST(FullOutputBufferKeepsInputForNextCall)
+{
+	PolyphaseResampler resampler;
+	AUDIO_SAMPLE_FORMAT inputFormat{ 48000, 2, AudioSampleType::Int16 };
+	AUDIO_SAMPLE_FORMAT outputFormat{ 48000, 1, AudioSampleType::Float32 };
+	CHECK(resampler.Initialize(inputFormat, outputFormat));
+	std::vector<int16_t> input(4800 * 2, 1000);
+	std::vector<float> output(10000);
+	const size_t capacityBytes = 40 * sizeof(float);
+	size_t total = resampler.Process(input.data(), input.size() * sizeof(int16_t), output.data(), capacityBytes);
+	CHECK_EQUAL(capacityBytes, total);
+	for (;;) {
+		size_t written = resampler.Process(nullptr, 0, (uint8_t *)output.data() + total, capacityBytes);
+		if (written == 0) {
+			break;
+		}
+		total += written;
+	}
+	total += resampler.Drain((uint8_t *)output.data() + total, output.size() * sizeof(float) - total);
+	CHECK_EQUAL((size_t)4800, total / sizeof(float));
+	//Equal rates pass the signal through, and both channels of the constant input mix to the same level.
+	CHECK_NEAR(1000 / 32768.0, output[2400], 1e-4);
+}
+
+NATIVE_TEST(ResetClearsFilterHistory)
+{
+	AUDIO_SAMPLE_FORMAT inputFormat{ 44100, 2, AudioSampleType::Float32 };
+	AUDIO_SAMPLE_FORMAT outputFormat{ 48000, 2, AudioSampleType::Float32 };
+	std::vector<uint8_t> input(4410 * inputFormat.FrameBytes());
+	for (size_t i = 0; i < input.size() / sizeof(float); i++) {
+		((float *)input.data())[i] = (float)std::sin(i * 0.01);
+	}
+	PolyphaseResampler resampler;
+	resampler.Initialize(inputFormat, outputFormat);
+	std::vector<uint8_t> first = ConvertInChunks(resampler, input, 1000, false);
+	resampler.Reset();
+	std::vector<uint8_t> second = ConvertInChunks(resampler, input, 1000, false);
+	CHECK(first == second);
+}
+
+NATIVE_TEST(UnsupportedFormatsAreRejected)
+{
+	PolyphaseResampler resampler;
+	CHECK(!resampler.Initialize({ 0, 2, AudioSampleType::Int16 }, { 48000, 2, AudioSampleType::Int16 }));
+	CHECK(!resampler.Initialize({ 48000, 0, AudioSampleType::Int16 }, { 48000, 2, AudioSampleType::Int16 }));
+	CHECK(!resampler.Initialize({ 48000, 2, AudioSampleType::Int16 }, { 48000, 64, AudioSampleType::Int16 }));
+}
+
+NATIVE_TEST(ResamplesFasterThanRealTime)
+{
+	for (AudioMixer::Kernel kernel : KERNELS) {
+		PolyphaseResampler resampler;
+		resampler.SetKernel(kernel);
+		resampler.Initialize({ 44100, 2, AudioSampleType::Int16 }, { 48000, 2, AudioSampleType::Int16 });
+		//10 ms packets, as delivered by WASAPI.
+		std::vector<int16_t> input(441 * 2);
+		for (size_t i = 0; i < input.size(); i++) {
+			input[i] = (int16_t)(i * 31);
+		}
+		std::vector<uint8_t> output(resampler.GetMaxOutputBytes(input.size() * sizeof(int16_t)));
+		double millis = MeasureMillisPerCall([&]() {
+			resampler.Process(input.data(), input.size() * sizeof(int16_t), output.data(), output.size());
+		}, 100);
+		//Even the scalar kernel runs well over 10 times faster than real time in an optimized build.
+		CHECK(millis < 1.0);
+	}
+}
@@ -0,0 +1,246 @@
+#include "NativeTest.h"
+#include "RecordingMetrics.h"
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <thread>
+
+namespace {
+	/// <summary>
+	/// The exact value at a percentile, by the same nearest-rank definition the histogram uses.
+	/// </summary>
+	int64_t ExactPercentile(std::vector<int64_t> sortedValues, double percentile) {
+		size_t rank = (std::max)((size_t)1, (size_t)std::ceil(percentile / 100.0 * sortedValues.size()));
+		return sortedValues[rank - 1];
+	}
+
+	//The reported percentile is the middle of a bucket, and a bucket spans at most 1/2^(HISTOGRAM_SUB_BUCKET_BITS-1) of its values.
+	void CheckPercentile(int64_t exact, int64_t reported) {
+		double tolerance = (double)exact / (1 << HISTOGRAM_SUB_BUCKET_BITS) + 1;
+		CHECK_NEAR((double)exact, (double)reported, tolerance);
+	}
+}
+
+NATIVE_TEST(BucketsCoverEveryValueWithoutGaps)
+{
+	CHECK_EQUAL((size_t)0, LatencyHistogram::GetBucketIndex(0));
+	CHECK_EQUAL((size_t)0, LatencyHistogram::GetBucketIndex(-5));
+	for (size_t i = 0; i < LatencyHistogram::BUCKET_COUNT; i++) {
+		int64_t lowest = LatencyHistogram::GetBucketLowestValue(i);
+		int64_t highest = LatencyHistogram::GetBucketHighestValue(i);
+		CHECK(lowest <= highest);
+		CHECK_EQUAL(i, LatencyHistogram::GetBucketIndex(lowest));
+		CHECK_EQUAL(i, LatencyHistogram::GetBucketIndex(highest));
+		if (i + 1 < LatencyHistogram::BUCKET_COUNT) {
+			CHECK_EQUAL(highest + 1, LatencyHistogram::GetBucketLowestValue(i + 1));
+		}
+	}
+	CHECK_EQUAL(LatencyHistogram::MAX_VALUE, LatencyHistogram::GetBucketHighestValue(LatencyHistogram::BUCKET_COUNT - 1));
+	CHECK_EQUAL(LatencyHistogram::BUCKET_COUNT - 1, LatencyHistogram::GetBucketIndex(LatencyHistogram::MAX_VALUE));
+}
+
+NATIVE_TEST(SmallValuesAreExactAndLargeValuesKeepRelativePrecision)
+{
+	for (int64_t value = 0; value < (int64_t)LatencyHistogram::SUB_BUCKET_COUNT; value++) {
+		size_t index = LatencyHistogram::GetBucketIndex(value);
+		CHECK_EQUAL(value, LatencyHistogram::GetBucketLowestValue(index));
+		CHECK_EQUAL(value, LatencyHistogram::GetBucketHighestValue(index));
+	}
+	for (size_t i = LatencyHistogram::SUB_BUCKET_COUNT; i < LatencyHistogram::BUCKET_COUNT; i++) {
+		int64_t lowest = LatencyHistogram::GetBucketLowestValue(i);
+		int64_t width = LatencyHistogram::GetBucketHighestValue(i) - lowest + 1;
+		CHECK(width * (int64_t)LatencyHistogram::SUB_BUCKET_HALF_COUNT <= lowest);
+	}
+	//Powers of two start a new bucket.
+	for (int bit = HISTOGRAM_SUB_BUCKET_BITS; bit < HISTOGRAM_VALUE_BITS; bit++) {
+		int64_t value = int64_t(1) << bit;
+		CHECK_EQUAL(value, LatencyHistogram::GetBucketLowestValue(LatencyHistogram::GetBucketIndex(value)));
+		CHECK_EQUAL(value - 1, LatencyHistogram::GetBucketHighestValue(LatencyHistogram::GetBucketIndex(value - 1)));
+	}
+}
+
+NATIVE_TEST(EmptyHistogramReportsZeros)
+{
+	LatencyHistogram histogram;
+	HISTOGRAM_SNAPSHOT snapshot = histogram.GetSnapshot();
+	CHECK_EQUAL((uint64_t)0, snapshot.Count);
+	CHECK_EQUAL((int64_t)0, snapshot.Min);
+	CHECK_EQUAL((int64_t)0, snapshot.Max);
+	CHECK_EQUAL((int64_t)0, snapshot.P999);
+}
+
+NATIVE_TEST(SingleValueIsReportedExactly)
+{
+	LatencyHistogram histogram;
+	histogram.Record(166667);
+	HISTOGRAM_SNAPSHOT snapshot = histogram.GetSnapshot();
+	CHECK_EQUAL((uint64_t)1, snapshot.Count);
+	//Percentiles are clamped to the recorded range, so a single value is exact despite the bucket width.
+	CHECK_EQUAL((int64_t)166667, snapshot.P50);
+	CHECK_EQUAL((int64_t)166667, snapshot.P999);
+	CHECK_EQUAL((int64_t)166667, snapshot.Min);
+	CHECK_EQUAL((int64_t)166667, snapshot.Max);
+	CHECK_NEAR(166667.0, snapshot.Mean, 1e-9);
+}
+
+NATIVE_TEST(OutOfRangeValuesAreClamped)
+{
+	LatencyHistogram histogram;
+	histogram.Record(-100);
+	histogram.Record(LatencyHistogram::MAX_VALUE + 12345);
+	HISTOGRAM_SNAPSHOT snapshot = histogram.GetSnapshot();
+	CHECK_EQUAL((uint64_t)2, snapshot.Count);
+	CHECK_EQUAL((int64_t)0, snapshot.Min);
+	CHECK_EQUAL(LatencyHistogram::MAX_VALUE, snapshot.Max);
+	CHECK_EQUAL(LatencyHistogram::MAX_VALUE, snapshot.Total);
+}
+
+NATIVE_TEST(PercentilesMatchExactValuesWithinBucketPrecision)
+{
+	std::mt19937 rng(1);
+	//Frame times: mostly around 16.7 ms, with a long tail of stalls.
+	std::lognormal_distribution<double> frameTimes(std::log(166667.0), 0.4);
+	std::uniform_int_distribution<int64_t> small(0, 200);
+	for (int distribution = 0; distribution < 3; distribution++) {
+		LatencyHistogram histogram;
+		std::vector<int64_t> values;
+		int64_t total = 0;
+		for (int i = 0; i < 100000; i++) {
+			int64_t value;
+			if (distribution == 0) {
+				value = (int64_t)frameTimes(rng);
+			}
+			else if (distribution == 1) {
+				value = small(rng);
+			}
+			else {
+				value = i + 1;
+			}
+			histogram.Record(value);
+			values.push_back(value);
+			total += value;
+		}
+		std::sort(values.begin(), values.end());
+		HISTOGRAM_SNAPSHOT snapshot = histogram.GetSnapshot();
+		CHECK_EQUAL((uint64_t)values.size(), snapshot.Count);
+		CHECK_EQUAL(total, snapshot.Total);
+		CHECK_EQUAL(values.front(), snapshot.Min);
+		CHECK_EQUAL(values.back(), snapshot.Max);
+		CHECK_NEAR((double)total / values.size(), snapshot.Mean, 1e-6);
+		CheckPercentile(ExactPercentile(values, 50), snapshot.P50);
+		CheckPercentile(ExactPercentile(values, 90), snapshot.P90);
+		CheckPercentile(ExactPercentile(values, 99), snapshot.P99);
+		CheckPercentile(ExactPercentile(values, 99.9), snapshot.P999);
+		CHECK(snapshot.P50 <= snapshot.P90 && snapshot.P90 <= snapshot.P99 && snapshot.P99 <= snapshot.P999);
+	}
+}
+
+NATIVE_TEST(ResetClearsRecordedValues)
+{
+	LatencyHistogram histogram;
+	histogram.Record(1000);
+	histogram.Record(5);
+	histogram.Reset();
+	histogram.Record(300);
+	HISTOGRAM_SNAPSHOT snapshot = histogram.GetSnapshot();
+	CHECK_EQUAL((uint64_t)1, snapshot.Count);
+	CHECK_EQUAL((int64_t)300, snapshot.Min);
+	CHECK_EQUAL((int64_t)300, snapshot.Max);
+	CHECK_EQUAL((int64_t)300, snapshot.Total);
+}
+
+NATIVE_TEST(ConcurrentRecordingLosesNoValues)
+{
+	LatencyHistogram histogram;
+	const int threadCount = 4;
+	const int valuesPerThread = 250000;
+	std::atomic<bool> isRecording = true;
+	std::atomic<int> decreasingCounts = 0;
+	//Snapshots taken while recording never go backwards.
+	std::thread reader([&]() {
+		uint64_t lastCount = 0;
+		while (isRecording) {
+			HISTOGRAM_SNAPSHOT snapshot = histogram.GetSnapshot();
+			if (snapshot.Count < lastCount) {
+				decreasingCounts++;
+			}
+			lastCount = snapshot.Count;
+			std::this_thread::yield();
+		}
+	});
+	std::vector<std::thread> threads;
+	for (int t = 0; t < threadCount; t++) {
+		threads.emplace_back([&, t]() {
+			for (int i = 0; i < valuesPerThread; i++) {
+				histogram.Record(t * valuesPerThread + i + 1);
+			}
+		});
+	}
+	for (std::thread &thread : threads) {
+		thread.join();
+	}
+	isRecording = false;
+	reader.join();
+	int64_t valueCount = (int64_t)threadCount * valuesPerThread;
+	HISTOGRAM_SNAPSHOT snapshot = histogram.GetSnapshot();
+	CHECK_EQUAL(0, decreasingCounts.load());
+	CHECK_EQUAL((uint64_t)valueCount, snapshot.Count);
+	CHECK_EQUAL(valueCount * (valueCount + 1) / 2, snapshot.Total);
+	CHECK_EQUAL((int64_t)1, snapshot.Min);
+	CHECK_EQUAL(valueCount, snapshot.Max);
+	CheckPercentile(valueCount / 2, snapshot.P50);
+}
+
+NATIVE_TEST(ConcurrentCountersAndTimersAreAccumulated)
+{
+	RecordingMetrics metrics;
+	std::vector<std::thread> threads;
+	for (int t = 0; t < 4; t++) {
+		threads.emplace_back([&]() {
+			for (int i = 0; i < 100000; i++) {
+				metrics.Increment(RecordingCounter::CapturedFrames);
+				metrics.Increment(RecordingCounter::DroppedFrames, 2);
+				metrics.Record(RecordingTimer::EncodeSubmit, i % 1000);
+			}
+		});
+	}
+	for (std::thread &thread : threads) {
+		thread.join();
+	}
+	RECORDING_STATS stats = metrics.GetStats();
+	CHECK_EQUAL((uint64_t)400000, stats.GetCounter(RecordingCounter::CapturedFrames));
+	CHECK_EQUAL((uint64_t)800000, stats.GetCounter(RecordingCounter::DroppedFrames));
+	CHECK_EQUAL((uint64_t)0, stats.GetCounter(RecordingCounter::RenderedFrames));
+	CHECK_EQUAL((uint64_t)400000, stats.GetTimer(RecordingTimer::EncodeSubmit).Count);
+	CHECK_EQUAL((uint64_t)0, stats.GetTimer(RecordingTimer::CaptureWait).Count);
+	metrics.Reset();
+	stats = metrics.GetStats();
+	CHECK_EQUAL((uint64_t)0, stats.GetCounter(RecordingCounter::CapturedFrames));
+	CHECK_EQUAL((uint64_t)0, stats.GetTimer(RecordingTimer::EncodeSubmit).Count);
+}
+
+NATIVE_TEST(MeasureRecordingTimerRecordsOnce)
+{
+	RecordingMetrics metrics;
+	{
+		MeasureRecordingTimer timer(&metrics, RecordingTimer::SnapshotEncode);
+		std::this_thread::sleep_for(std::chrono::milliseconds(2));
+		timer.Stop();
+	}
+	{
+		MeasureRecordingTimer timer(nullptr, RecordingTimer::SnapshotEncode);
+	}
+	HISTOGRAM_SNAPSHOT snapshot = metrics.GetStats().GetTimer(RecordingTimer::SnapshotEncode);
+	CHECK_EQUAL((uint64_t)1, snapshot.Count);
+	CHECK(snapshot.Min >= 20000);
+}
+
+NATIVE_TEST(EveryTimerAndCounterHasAName)
+{
+	for (size_t i = 0; i < (size_t)RecordingTimer::Count; i++) {
+		CHECK(std::wstring(RecordingMetrics::GetTimerName((RecordingTimer)i)) != L"Unknown");
+	}
+	for (size_t i = 0; i < (size_t)RecordingCounter::Count; i++) {
+		CHECK(std::wstring(RecordingMetrics::GetCounterName((RecordingCounter)i)) != L"Unknown");
+	}
+}
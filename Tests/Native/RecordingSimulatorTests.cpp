@@ -0,0 +1,183 @@
+#include "NativeTest.h"
+#include "RecordingSimulator.h"
+
+namespace {
+	const int64_t SECOND = TIMELINE_UNITS_PER_SECOND;
+	const int64_t MILLISECOND = SECOND / 1000;
+	const int64_t HOUR = 3600 * SECOND;
+
+	/// <summary>
+	/// Checks the timeline of a simulated recording independently of the totals the simulator keeps: the frames follow each other without gaps or overlaps,
+	/// the audio written with them stays within the given distance of the video after every frame, and no encoded frame is extended for longer than allowed.
+	/// </summary>
+	void CheckTimeline(const RECORDING_SIMULATION_OPTIONS &options, const RECORDING_SIMULATION_RESULT &result, int64_t maxAvOffset) {
+		CHECK(!result.Timeline.empty());
+		CHECK_EQUAL(result.Frames - result.DroppedFrames, (uint64_t)result.Timeline.size());
+		CHECK_EQUAL((int64_t)0, result.Timeline.front().Timing.StartPos);
+		uint64_t audioFrames = 0;
+		int64_t lastEncodedStartPos = 0;
+		for (size_t i = 0; i < result.Timeline.size(); i++) {
+			const FRAME_TIMING &timing = result.Timeline[i].Timing;
+			if (i > 0) {
+				const FRAME_TIMING &previous = result.Timeline[i - 1].Timing;
+				if (timing.StartPos != previous.StartPos + previous.Duration) {
+					CHECK_EQUAL(previous.StartPos + previous.Duration, timing.StartPos);
+				}
+			}
+			CHECK(timing.Duration >= 0);
+			audioFrames += result.Timeline[i].AudioFrames;
+			if (options.AudioSamplesPerSecond > 0) {
+				int64_t avOffset = timing.StartPos + timing.Duration - GetAudioDuration(audioFrames, options.AudioSamplesPerSecond);
+				if (avOffset > maxAvOffset || avOffset < -maxAvOffset) {
+					CHECK_EQUAL(maxAvOffset, avOffset);
+				}
+			}
+			if (result.Timeline[i].IsEncoded) {
+				lastEncodedStartPos = timing.StartPos;
+			}
+			else if (timing.StartPos + timing.Duration - lastEncodedStartPos > options.MaxFrameExtension + MILLISECOND) {
+				CHECK_EQUAL(options.MaxFrameExtension, timing.StartPos + timing.Duration - lastEncodedStartPos);
+			}
+		}
+		CHECK_EQUAL(result.AudioFrames, audioFrames);
+		CHECK(result.IsAvSyncWithin(maxAvOffset));
+		const FRAME_TIMING &last = result.Timeline.back().Timing;
+		CHECK_EQUAL(result.VideoEndPos, last.StartPos + last.Duration);
+		//The video covers the media clock up to the last frame written, moved by the offset the audio built up.
+		CHECK_EQUAL(result.Timeline.back().CaptureTime + result.TimelineOffset, result.VideoEndPos);
+		CHECK(result.Timeline.back().CaptureTime < options.Duration);
+	}
+
+	RECORDING_SIMULATION_OPTIONS CreateOptions(uint32_t framesPerSecond) {
+		RECORDING_SIMULATION_OPTIONS options{};
+		options.Duration = HOUR;
+		options.FramesPerSecond = framesPerSecond;
+		options.IsTimelineKept = true;
+		return options;
+	}
+}
+
+NATIVE_TEST(AudioFrameCountsRoundUpAndDurationsRoundDown)
+{
+	CHECK_EQUAL((uint64_t)1600, GetAudioFrameCount(333333, 48000));
+	CHECK_EQUAL((uint64_t)1601, GetAudioFrameCount(333334, 48000));
+	CHECK_EQUAL((uint64_t)0, GetAudioFrameCount(0, 48000));
+	CHECK_EQUAL((int64_t)333333, GetAudioDuration(1600, 48000));
+	CHECK_EQUAL((int64_t)0, GetAudioDuration(1600, 0));
+}
+
+NATIVE_TEST(FixedFramerateWithWakeLatencyStaysInSyncForAnHour)
+{
+	RECORDING_SIMULATION_OPTIONS options = CreateOptions(30);
+	options.IsFixedFramerate = true;
+	options.WakeLatency = 5000;
+	RECORDING_SIMULATION_RESULT result = RecordingSimulator::Run(options);
+	CheckTimeline(options, result, MILLISECOND);
+	CHECK_EQUAL((uint64_t)30 * 3600, result.Frames);
+	CHECK_EQUAL(result.Frames, result.EncodedFrames);
+	//Frames are taken on the grid, late by the wake up latency, which does not add up.
+	CHECK_EQUAL((uint64_t)0, result.Pacing.Late);
+	CHECK_EQUAL((uint64_t)0, result.Pacing.Skipped);
+	CHECK_EQUAL(options.WakeLatency, result.Pacing.Drift);
+	//Frames are only stretched by the audio rounding to whole audio frames and packets.
+	CHECK(result.MaxEncodedFrameGap <= SECOND / 30 + MILLISECOND);
+}
+
+NATIVE_TEST(SlowAudioClockStretchesTheTimelineForAnHour)
+{
+	//An audio device running 100 ppm slow delivers 360 ms less audio over the hour, so the frames are shortened to stay in step with it.
+	RECORDING_SIMULATION_OPTIONS options = CreateOptions(30);
+	options.WakeLatency = 5000;
+	options.AudioClockSkewPpm = -100;
+	RECORDING_SIMULATION_RESULT result = RecordingSimulator::Run(options);
+	CheckTimeline(options, result, MILLISECOND);
+	CHECK_NEAR(-360 * MILLISECOND, result.TimelineOffset, options.AudioPacketDuration);
+	CHECK_NEAR(result.VideoEndPos, result.AudioEndPos, MILLISECOND);
+}
+
+NATIVE_TEST(FastAudioClockAt60FpsStaysInSyncForAnHour)
+{
+	RECORDING_SIMULATION_OPTIONS options = CreateOptions(60);
+	options.AudioClockSkewPpm = 100;
+	RECORDING_SIMULATION_RESULT result = RecordingSimulator::Run(options);
+	CheckTimeline(options, result, MILLISECOND);
+	CHECK_EQUAL((uint64_t)60 * 3600, result.Frames);
+	CHECK_NEAR(360 * MILLISECOND, result.TimelineOffset, options.AudioPacketDuration);
+}
+
+NATIVE_TEST(AudioPacketsLongerThanFramesStayWithinAPacketForAnHour)
+{
+	//At 120 fps a frame is shorter than the 10 ms packets the audio device delivers, so some frames get no audio and the ones after them catch up.
+	RECORDING_SIMULATION_OPTIONS options = CreateOptions(120);
+	RECORDING_SIMULATION_RESULT result = RecordingSimulator::Run(options);
+	CheckTimeline(options, result, options.AudioPacketDuration);
+	CHECK_EQUAL((uint64_t)120 * 3600, result.Frames);
+	CHECK_NEAR(result.VideoEndPos, result.AudioEndPos, options.AudioPacketDuration);
+	CHECK_NEAR(0, result.TimelineOffset, MILLISECOND);
+}
+
+NATIVE_TEST(StaticContentExtendsFramesForAnHour)
+{
+	//The content changes every 5 seconds, and the recorder loop takes an unchanged frame every MaxFrameLength in between.
+	RECORDING_SIMULATION_OPTIONS options = CreateOptions(30);
+	options.GetNextContentChange = [](int64_t time) {
+		return (time + 5 * SECOND - 1) / (5 * SECOND) * (5 * SECOND);
+	};
+	RECORDING_SIMULATION_RESULT result = RecordingSimulator::Run(options);
+	CheckTimeline(options, result, MILLISECOND);
+	CHECK_EQUAL((uint64_t)(HOUR / options.MaxFrameLength), result.Frames);
+	CHECK(result.MaxEncodedFrameGap <= options.MaxFrameExtension);
+
+	//With a longer extension, most unchanged frames extend the frame before them instead of being encoded.
+	options.MaxFrameExtension = 2 * SECOND;
+	RECORDING_SIMULATION_RESULT extended = RecordingSimulator::Run(options);
+	CheckTimeline(options, extended, MILLISECOND);
+	CHECK_EQUAL(result.Frames, extended.Frames);
+	CHECK(extended.EncodedFrames * 2 < extended.Frames);
+	CHECK(extended.MaxEncodedFrameGap <= options.MaxFrameExtension);
+	CHECK(extended.MaxEncodedFrameGap > options.MaxFrameLength);
+}
+
+NATIVE_TEST(StallsAndDropsKeepTheTimelineContinuousForAnHour)
+{
+	//Every 1000th frame keeps the recorder loop busy for 200 ms, and every 7th frame is dropped by a full queue and folded into the next one.
+	RECORDING_SIMULATION_OPTIONS options = CreateOptions(30);
+	options.IsFixedFramerate = true;
+	options.GetFrameProcessingTime = [](uint64_t frame) {
+		return frame % 1000 == 999 ? 200 * MILLISECOND : 2 * MILLISECOND;
+	};
+	options.IsFrameDropped = [](uint64_t frame) {
+		return frame % 7 == 3;
+	};
+	RECORDING_SIMULATION_RESULT result = RecordingSimulator::Run(options);
+	CheckTimeline(options, result, MILLISECOND);
+	uint64_t expectedDropped = 0;
+	uint64_t expectedStalls = 0;
+	for (uint64_t frame = 0; frame < result.Frames; frame++) {
+		expectedDropped += frame % 7 == 3 ? 1 : 0;
+		expectedStalls += frame % 1000 == 999 && frame < result.Frames - 1 ? 1 : 0;
+	}
+	CHECK_EQUAL(expectedDropped, result.DroppedFrames);
+	CHECK_EQUAL(result.Frames - result.DroppedFrames, result.EncodedFrames);
+	//The frame due during a stall is taken late, and the 5 after it that are already due are skipped, so the frames keep to the grid.
+	CHECK_EQUAL(expectedStalls, result.Pacing.Late);
+	CHECK_EQUAL(expectedStalls * 5, result.Pacing.Skipped);
+	CHECK_EQUAL((int64_t)0, result.Pacing.Drift);
+	//A stall, and a dropped frame folded into the frame after it, make the longest frame.
+	CHECK(result.MaxEncodedFrameGap <= 200 * MILLISECOND + 2 * SECOND / 30);
+	CHECK_EQUAL(result.Frames + result.Pacing.Skipped, (uint64_t)30 * 3600);
+}
+
+NATIVE_TEST(RecordingWithoutAudioFollowsTheMediaClockForAnHour)
+{
+	RECORDING_SIMULATION_OPTIONS options = CreateOptions(30);
+	options.AudioSamplesPerSecond = 0;
+	options.WakeLatency = 5000;
+	RECORDING_SIMULATION_RESULT result = RecordingSimulator::Run(options);
+	CheckTimeline(options, result, 0);
+	CHECK_EQUAL((uint64_t)0, result.AudioFrames);
+	CHECK_EQUAL((int64_t)0, result.TimelineOffset);
+	CHECK_EQUAL((int64_t)0, result.MaxAvOffset);
+	//Without audio to stretch them to, frames end where the media clock was when they were taken.
+	CHECK_EQUAL(result.Timeline.back().CaptureTime, result.VideoEndPos);
+}
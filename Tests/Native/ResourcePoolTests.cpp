@@ -0,0 +1,220 @@
+#include "NativeTest.h"
+#include "ResourcePool.h"
+#include <atomic>
+#include <set>
+#include <thread>
+
+namespace {
+	struct FAKE_RESOURCE {
+		int Description;
+		int Id;
+	};
+
+	/// <summary>
+	/// Hands out heap allocated fake resources and tracks which are alive, so tests can check that every resource is freed exactly once.
+	/// </summary>
+	class FakeAllocator : public IResourceAllocator<int, FAKE_RESOURCE *>
+	{
+	public:
+		struct STATE {
+			std::mutex Mutex;
+			std::set<FAKE_RESOURCE *> Live;
+			int Allocations = 0;
+			int Frees = 0;
+			int DoubleFrees = 0;
+			bool IsFailing = false;
+			std::vector<int> FreedIds;
+		};
+		FakeAllocator(STATE *pState) :m_State(pState) {}
+		bool Allocate(const int &description, FAKE_RESOURCE **pResource) override {
+			std::lock_guard<std::mutex> lock(m_State->Mutex);
+			if (m_State->IsFailing) {
+				return false;
+			}
+			*pResource = new FAKE_RESOURCE{ description, m_State->Allocations++ };
+			m_State->Live.insert(*pResource);
+			return true;
+		}
+		void Free(FAKE_RESOURCE *resource) override {
+			std::lock_guard<std::mutex> lock(m_State->Mutex);
+			if (m_State->Live.erase(resource) == 0) {
+				m_State->DoubleFrees++;
+				return;
+			}
+			m_State->Frees++;
+			m_State->FreedIds.push_back(resource->Id);
+			delete resource;
+		}
+	private:
+		STATE *m_State;
+	};
+
+	typedef ResourcePool<int, FAKE_RESOURCE *> FakePool;
+}
+
+NATIVE_TEST(ReleasedResourcesAreReused)
+{
+	FakeAllocator::STATE state;
+	{
+		FakePool pool(std::make_unique<FakeAllocator>(&state), 2);
+		FAKE_RESOURCE *first;
+		CHECK(pool.Acquire(1, &first));
+		pool.Release(1, first);
+		FAKE_RESOURCE *second;
+		CHECK(pool.Acquire(1, &second));
+		CHECK(first == second);
+		pool.Release(1, second);
+		RESOURCE_POOL_STATS stats = pool.GetStats();
+		CHECK_EQUAL((uint64_t)1, stats.Hits);
+		CHECK_EQUAL((uint64_t)1, stats.Misses);
+		CHECK_EQUAL((size_t)1, stats.Idle);
+		CHECK_EQUAL((size_t)0, stats.InUse);
+		CHECK_EQUAL(1, state.Allocations);
+	}
+	//Destroying the pool frees the idle resources.
+	CHECK(state.Live.empty());
+	CHECK_EQUAL(0, state.DoubleFrees);
+}
+
+NATIVE_TEST(ResourcesAreOnlyReusedForEqualDescriptions)
+{
+	FakeAllocator::STATE state;
+	FakePool pool(std::make_unique<FakeAllocator>(&state), 4);
+	FAKE_RESOURCE *resource;
+	pool.Acquire(1, &resource);
+	pool.Release(1, resource);
+	FAKE_RESOURCE *other;
+	CHECK(pool.Acquire(2, &other));
+	CHECK_EQUAL(2, other->Description);
+	CHECK(other != resource);
+	pool.Release(2, other);
+	CHECK_EQUAL((size_t)2, pool.GetStats().Idle);
+}
+
+NATIVE_TEST(ConsumerFallingBehindAllocatesButKeepsOnlyDepthIdle)
+{
+	FakeAllocator::STATE state;
+	FakePool pool(std::make_unique<FakeAllocator>(&state), 3);
+	//Ten resources in flight at once, as when the encoder falls behind.
+	std::vector<FAKE_RESOURCE *> inFlight(10);
+	for (FAKE_RESOURCE *&resource : inFlight) {
+		CHECK(pool.Acquire(1, &resource));
+	}
+	RESOURCE_POOL_STATS stats = pool.GetStats();
+	CHECK_EQUAL((size_t)10, stats.InUse);
+	CHECK_EQUAL((uint64_t)10, stats.Misses);
+	for (FAKE_RESOURCE *resource : inFlight) {
+		pool.Release(1, resource);
+	}
+	stats = pool.GetStats();
+	CHECK_EQUAL((size_t)3, stats.Idle);
+	CHECK_EQUAL((uint64_t)7, stats.Discarded);
+	CHECK_EQUAL((size_t)0, stats.InUse);
+	CHECK_EQUAL((size_t)3, state.Live.size());
+	//Once the consumer keeps up again, the pool serves every acquire without allocating.
+	for (int frame = 0; frame < 100; frame++) {
+		FAKE_RESOURCE *first, *second;
+		pool.Acquire(1, &first);
+		pool.Acquire(1, &second);
+		pool.Release(1, first);
+		pool.Release(1, second);
+	}
+	CHECK_EQUAL(10, state.Allocations);
+	CHECK_EQUAL((uint64_t)200, pool.GetStats().Hits);
+}
+
+NATIVE_TEST(FullPoolReplacesStaleDescriptions)
+{
+	FakeAllocator::STATE state;
+	FakePool pool(std::make_unique<FakeAllocator>(&state), 2);
+	FAKE_RESOURCE *oldResources[2];
+	pool.Acquire(1, &oldResources[0]);
+	pool.Acquire(1, &oldResources[1]);
+	pool.Release(1, oldResources[0]);
+	pool.Release(1, oldResources[1]);
+	//After a resolution change, the resources of the new size displace the old ones.
+	FAKE_RESOURCE *newResources[2];
+	pool.Acquire(2, &newResources[0]);
+	pool.Acquire(2, &newResources[1]);
+	pool.Release(2, newResources[0]);
+	pool.Release(2, newResources[1]);
+	CHECK_EQUAL((size_t)2, pool.GetStats().Idle);
+	CHECK_EQUAL((size_t)2, state.Live.size());
+	for (FAKE_RESOURCE *resource : state.Live) {
+		CHECK_EQUAL(2, resource->Description);
+	}
+}
+
+NATIVE_TEST(AllocatorFailureIsCounted)
+{
+	FakeAllocator::STATE state;
+	FakePool pool(std::make_unique<FakeAllocator>(&state), 2);
+	state.IsFailing = true;
+	FAKE_RESOURCE *resource = nullptr;
+	CHECK(!pool.Acquire(1, &resource));
+	RESOURCE_POOL_STATS stats = pool.GetStats();
+	CHECK_EQUAL((uint64_t)1, stats.Failures);
+	CHECK_EQUAL((size_t)0, stats.InUse);
+	state.IsFailing = false;
+	CHECK(pool.Acquire(1, &resource));
+	pool.Release(1, resource);
+}
+
+NATIVE_TEST(SetDepthEvictsOldestAndTrimFreesIdle)
+{
+	FakeAllocator::STATE state;
+	FakePool pool(std::make_unique<FakeAllocator>(&state), 4);
+	FAKE_RESOURCE *resources[4];
+	for (FAKE_RESOURCE *&resource : resources) {
+		pool.Acquire(1, &resource);
+	}
+	for (FAKE_RESOURCE *resource : resources) {
+		pool.Release(1, resource);
+	}
+	pool.SetDepth(1);
+	CHECK_EQUAL((size_t)1, pool.GetDepth());
+	CHECK_EQUAL((size_t)1, pool.GetStats().Idle);
+	CHECK(state.FreedIds == std::vector<int>({ 0, 1, 2 }));
+	pool.Trim();
+	CHECK_EQUAL((size_t)0, pool.GetStats().Idle);
+	CHECK(state.Live.empty());
+	//A resource in use during Trim is pooled again when released.
+	FAKE_RESOURCE *resource;
+	pool.Acquire(1, &resource);
+	pool.Trim();
+	pool.Release(1, resource);
+	CHECK_EQUAL((size_t)1, pool.GetStats().Idle);
+}
+
+NATIVE_TEST(ConcurrentAcquireAndReleaseKeepAccounting)
+{
+	FakeAllocator::STATE state;
+	{
+		FakePool pool(std::make_unique<FakeAllocator>(&state), 8);
+		std::vector<std::thread> threads;
+		std::atomic<int> wrongDescriptions = 0;
+		for (int t = 0; t < 4; t++) {
+			threads.emplace_back([&]() {
+				for (int i = 0; i < 20000; i++) {
+					FAKE_RESOURCE *resource;
+					pool.Acquire(i % 3, &resource);
+					if (resource->Description != i % 3) {
+						wrongDescriptions++;
+					}
+					pool.Release(i % 3, resource);
+				}
+			});
+		}
+		for (std::thread &thread : threads) {
+			thread.join();
+		}
+		RESOURCE_POOL_STATS stats = pool.GetStats();
+		CHECK_EQUAL(0, wrongDescriptions.load());
+		CHECK_EQUAL((size_t)0, stats.InUse);
+		CHECK_EQUAL((uint64_t)80000, stats.Hits + stats.Misses);
+		CHECK(stats.Idle <= 8);
+		CHECK_EQUAL(state.Allocations - state.Frees, (int)state.Live.size());
+	}
+	CHECK(state.Live.empty());
+	CHECK_EQUAL(0, state.DoubleFrees);
+}
@@ -0,0 +1,264 @@
+#include "NativeTest.h"
+#include "SegmentScheduler.h"
+#include <algorithm>
+#include <random>
+
+namespace {
+	const int64_t SECOND = 10 * 1000 * 1000;
+	const int64_t AUDIO_SAMPLE_RATE = 48000;
+
+	/// <summary>
+	/// A frame as OutputManager gets it: a video frame, or only an extension of the previous one, with the audio captured for its duration.
+	/// </summary>
+	struct SIMULATED_FRAME {
+		int64_t StartPos;
+		int64_t Duration;
+		bool HasVideo;
+		uint64_t Bytes;
+	};
+
+	/// <summary>
+	/// A frame as it is written to a segment.
+	/// </summary>
+	struct WRITTEN_FRAME {
+		int64_t SegmentTime;
+		int64_t Duration;
+		bool HasVideo;
+		int64_t AudioSamples;
+	};
+
+	struct SIMULATED_SEGMENT {
+		SEGMENT_INFO Info;
+		std::vector<WRITTEN_FRAME> Frames;
+	};
+
+	//The audio of a frame is the samples between its start and end on the timeline, so the audio of consecutive frames adds up without rounding drift.
+	int64_t GetAudioSamples(int64_t startPos, int64_t duration) {
+		return (startPos + duration) * AUDIO_SAMPLE_RATE / SECOND - startPos * AUDIO_SAMPLE_RATE / SECOND;
+	}
+
+	/// <summary>
+	/// Places the frames like OutputManager::RenderFrame does, and collects what is written to each segment.
+	/// </summary>
+	std::vector<SIMULATED_SEGMENT> RunScheduler(SegmentScheduler &scheduler, const std::vector<SIMULATED_FRAME> &frames) {
+		std::vector<SIMULATED_SEGMENT> segments;
+		uint64_t segmentBytes = 0;
+		for (const SIMULATED_FRAME &frame : frames) {
+			SEGMENT_INFO endedSegment{};
+			if (scheduler.PlaceFrame(frame.StartPos, frame.Duration, frame.HasVideo, segmentBytes, &endedSegment)) {
+				segments.back().Info = endedSegment;
+				segmentBytes = 0;
+			}
+			SEGMENT_INFO currentSegment{};
+			scheduler.GetCurrentSegment(&currentSegment);
+			if (segments.empty() || segments.back().Info.Index != currentSegment.Index) {
+				segments.push_back(SIMULATED_SEGMENT{ currentSegment, {} });
+			}
+			segments.back().Frames.push_back(WRITTEN_FRAME{ scheduler.ToSegmentTime(frame.StartPos), frame.Duration, frame.HasVideo, GetAudioSamples(frame.StartPos, frame.Duration) });
+			segmentBytes += frame.Bytes;
+		}
+		SEGMENT_INFO lastSegment{};
+		if (scheduler.GetCurrentSegment(&lastSegment)) {
+			segments.back().Info = lastSegment;
+		}
+		return segments;
+	}
+
+	/// <summary>
+	/// Video frames at a constant rate, starting at startPos.
+	/// </summary>
+	std::vector<SIMULATED_FRAME> MakeFrames(int64_t startPos, int64_t frameDuration, size_t count, uint64_t bytesPerFrame = 0) {
+		std::vector<SIMULATED_FRAME> frames;
+		for (size_t i = 0; i < count; i++) {
+			frames.push_back(SIMULATED_FRAME{ startPos + (int64_t)i * frameDuration, frameDuration, true, bytesPerFrame });
+		}
+		return frames;
+	}
+
+	/// <summary>
+	/// Checks that the segments cover the timeline of the frames without gaps or overlap, each starting at 0 with a video frame,
+	/// and that the audio of every segment stays aligned with its video.
+	/// </summary>
+	void CheckSegments(const std::vector<SIMULATED_SEGMENT> &segments, const std::vector<SIMULATED_FRAME> &frames) {
+		CHECK(!segments.empty());
+		CHECK_EQUAL(frames.front().StartPos, segments.front().Info.StartPos);
+		CHECK_EQUAL(frames.back().StartPos + frames.back().Duration, segments.back().Info.EndPos);
+		size_t frameCount = 0;
+		int64_t totalAudioSamples = 0;
+		for (size_t i = 0; i < segments.size(); i++) {
+			const SIMULATED_SEGMENT &segment = segments[i];
+			CHECK_EQUAL((uint32_t)i, segment.Info.Index);
+			if (i + 1 < segments.size()) {
+				CHECK_EQUAL(segment.Info.EndPos, segments[i + 1].Info.StartPos);
+			}
+			CHECK(!segment.Frames.empty());
+			CHECK(segment.Frames.front().HasVideo);
+			CHECK_EQUAL((int64_t)0, segment.Frames.front().SegmentTime);
+			int64_t audioSamples = 0;
+			int64_t videoEnd = 0;
+			for (const WRITTEN_FRAME &frame : segment.Frames) {
+				//The audio written before a frame is as long as the video before it, to within a sample of rounding.
+				CHECK_EQUAL(videoEnd, frame.SegmentTime);
+				CHECK_NEAR((double)frame.SegmentTime * AUDIO_SAMPLE_RATE / SECOND, (double)audioSamples, 1.0);
+				audioSamples += frame.AudioSamples;
+				videoEnd = frame.SegmentTime + frame.Duration;
+			}
+			CHECK_EQUAL(segment.Info.EndPos - segment.Info.StartPos, videoEnd);
+			CHECK_NEAR((double)videoEnd * AUDIO_SAMPLE_RATE / SECOND, (double)audioSamples, 1.0);
+			frameCount += segment.Frames.size();
+			totalAudioSamples += audioSamples;
+		}
+		//No frame, and no audio, is dropped or written twice.
+		CHECK_EQUAL(frames.size(), frameCount);
+		int64_t expectedAudioSamples = 0;
+		for (const SIMULATED_FRAME &frame : frames) {
+			expectedAudioSamples += GetAudioSamples(frame.StartPos, frame.Duration);
+		}
+		CHECK_EQUAL(expectedAudioSamples, totalAudioSamples);
+	}
+}
+
+NATIVE_TEST(NoLimitsWriteOneSegment)
+{
+	SegmentScheduler scheduler(0, 0);
+	CHECK(!scheduler.IsEnabled());
+	std::vector<SIMULATED_FRAME> frames = MakeFrames(0, SECOND / 30, 30 * 60, 100000);
+	std::vector<SIMULATED_SEGMENT> segments = RunScheduler(scheduler, frames);
+	CHECK_EQUAL((size_t)1, segments.size());
+	CheckSegments(segments, frames);
+}
+
+NATIVE_TEST(NoSegmentBeforeTheFirstFrame)
+{
+	SegmentScheduler scheduler(10 * SECOND, 0);
+	CHECK(scheduler.IsEnabled());
+	SEGMENT_INFO segment{};
+	CHECK(!scheduler.GetCurrentSegment(&segment));
+	//The first frame starts the first segment wherever it is on the timeline, and is never a boundary.
+	CHECK(!scheduler.PlaceFrame(5 * SECOND, SECOND / 30, true, 0, &segment));
+	CHECK(scheduler.GetCurrentSegment(&segment));
+	CHECK_EQUAL((uint32_t)0, segment.Index);
+	CHECK_EQUAL(5 * SECOND, segment.StartPos);
+	CHECK_EQUAL(5 * SECOND + SECOND / 30, segment.EndPos);
+	CHECK_EQUAL((int64_t)0, scheduler.ToSegmentTime(5 * SECOND));
+}
+
+NATIVE_TEST(DurationLimitSplitsOnTheFirstFrameAtTheLimit)
+{
+	const int64_t frameDuration = SECOND / 25;
+	SegmentScheduler scheduler(10 * SECOND, 0);
+	//Every segment holds the 250 frames before the limit, and the next starts on the frame at it.
+	std::vector<SIMULATED_FRAME> frames = MakeFrames(0, frameDuration, 800);
+	std::vector<SIMULATED_SEGMENT> segments = RunScheduler(scheduler, frames);
+	CHECK_EQUAL((size_t)4, segments.size());
+	CheckSegments(segments, frames);
+	for (size_t i = 0; i < 3; i++) {
+		CHECK_EQUAL((size_t)250, segments[i].Frames.size());
+		CHECK_EQUAL((int64_t)i * 10 * SECOND, segments[i].Info.StartPos);
+		CHECK_EQUAL((int64_t)(i + 1) * 10 * SECOND, segments[i].Info.EndPos);
+	}
+	CHECK_EQUAL((size_t)50, segments[3].Frames.size());
+}
+
+NATIVE_TEST(BoundaryWaitsForAVideoFrame)
+{
+	const int64_t frameDuration = SECOND / 25;
+	SegmentScheduler scheduler(SECOND, 0);
+	//The frames at and after the limit only extend the previous video frame, so the segment runs on until the next video frame.
+	std::vector<SIMULATED_FRAME> frames = MakeFrames(0, frameDuration, 50);
+	for (size_t i = 25; i < 30; i++) {
+		frames[i].HasVideo = false;
+	}
+	std::vector<SIMULATED_SEGMENT> segments = RunScheduler(scheduler, frames);
+	CHECK_EQUAL((size_t)2, segments.size());
+	CheckSegments(segments, frames);
+	CHECK_EQUAL((size_t)30, segments[0].Frames.size());
+	CHECK_EQUAL(30 * frameDuration, segments[1].Info.StartPos);
+}
+
+NATIVE_TEST(SizeLimitSplitsOnceTheSegmentIsFull)
+{
+	const uint64_t bytesPerFrame = 50000;
+	SegmentScheduler scheduler(0, 1000000);
+	std::vector<SIMULATED_FRAME> frames = MakeFrames(0, SECOND / 60, 200, bytesPerFrame);
+	std::vector<SIMULATED_SEGMENT> segments = RunScheduler(scheduler, frames);
+	CHECK_EQUAL((size_t)10, segments.size());
+	CheckSegments(segments, frames);
+	for (const SIMULATED_SEGMENT &segment : segments) {
+		CHECK_EQUAL((size_t)20, segment.Frames.size());
+	}
+}
+
+NATIVE_TEST(EitherLimitEndsASegment)
+{
+	const int64_t frameDuration = SECOND / 25;
+	SegmentScheduler scheduler(2 * SECOND, 3000000);
+	//Small frames reach the duration limit first, and the large frames from frame 130 on reach the size limit first.
+	std::vector<SIMULATED_FRAME> frames = MakeFrames(0, frameDuration, 300, 10000);
+	for (size_t i = 130; i < frames.size(); i++) {
+		frames[i].Bytes = 300000;
+	}
+	std::vector<SIMULATED_SEGMENT> segments = RunScheduler(scheduler, frames);
+	CheckSegments(segments, frames);
+	CHECK_EQUAL((size_t)20, segments.size());
+	CHECK_EQUAL((size_t)50, segments[0].Frames.size());
+	CHECK_EQUAL((size_t)50, segments[1].Frames.size());
+	//30 small frames and 9 large ones fill the third segment.
+	CHECK_EQUAL((size_t)39, segments[2].Frames.size());
+	for (size_t i = 3; i + 1 < segments.size(); i++) {
+		CHECK_EQUAL((size_t)10, segments[i].Frames.size());
+	}
+	CHECK_EQUAL((size_t)1, segments.back().Frames.size());
+}
+
+NATIVE_TEST(IrregularFramesKeepSegmentsContiguousAndAligned)
+{
+	std::mt19937 random(7);
+	std::uniform_int_distribution<int64_t> durationMillis(1, 120);
+	std::uniform_int_distribution<int> videoChance(0, 3);
+	std::uniform_int_distribution<uint64_t> frameBytes(1000, 200000);
+	//Frames of uneven length, from cursor-only updates of a millisecond to stalls, starting late on the timeline after a pause.
+	std::vector<SIMULATED_FRAME> frames;
+	int64_t pos = 123456789;
+	for (size_t i = 0; i < 20000; i++) {
+		int64_t duration = durationMillis(random) * 10000 + (int64_t)(random() % 10000);
+		bool hasVideo = i == 0 || videoChance(random) != 0;
+		frames.push_back(SIMULATED_FRAME{ pos, duration, hasVideo, hasVideo ? frameBytes(random) : 0 });
+		pos += duration;
+	}
+	const int64_t maxDuration = 7 * SECOND;
+	const uint64_t maxBytes = 40 * 1000 * 1000;
+	SegmentScheduler scheduler(maxDuration, maxBytes);
+	std::vector<SIMULATED_SEGMENT> segments = RunScheduler(scheduler, frames);
+	CHECK(segments.size() > 10);
+	CheckSegments(segments, frames);
+	//The bytes of each segment are recounted from the frames, to check the boundaries against both limits.
+	size_t frameIndex = 0;
+	for (size_t i = 0; i + 1 < segments.size(); i++) {
+		const SIMULATED_SEGMENT &segment = segments[i];
+		uint64_t bytes = 0;
+		bool reachedLimit = false;
+		for (size_t j = 0; j < segment.Frames.size(); j++, frameIndex++) {
+			const SIMULATED_FRAME &frame = frames[frameIndex];
+			if (j > 0 && frame.HasVideo) {
+				//A segment ends on the first video frame after a limit is reached, and never before.
+				CHECK(!reachedLimit);
+			}
+			bytes += frame.Bytes;
+			reachedLimit = reachedLimit || frame.StartPos + frame.Duration - segment.Info.StartPos >= maxDuration || bytes >= maxBytes;
+		}
+		const SIMULATED_FRAME &next = frames[frameIndex];
+		CHECK(next.HasVideo);
+		CHECK(next.StartPos - segment.Info.StartPos >= maxDuration || bytes >= maxBytes);
+	}
+}
+
+NATIVE_TEST(SegmentPathsNumberTheFilesAfterTheFirst)
+{
+	CHECK(SegmentScheduler::GetSegmentPath(L"C:\\Videos\\video.mp4", 0) == L"C:\\Videos\\video.mp4");
+	CHECK(SegmentScheduler::GetSegmentPath(L"C:\\Videos\\video.mp4", 1) == L"C:\\Videos\\video_002.mp4");
+	CHECK(SegmentScheduler::GetSegmentPath(L"C:\\Videos\\video.mp4", 41) == L"C:\\Videos\\video_042.mp4");
+	CHECK(SegmentScheduler::GetSegmentPath(L"C:\\Videos\\video.mp4", 1233) == L"C:\\Videos\\video_1234.mp4");
+	CHECK(SegmentScheduler::GetSegmentPath(L"C:\\My.Videos\\video", 1) == L"C:\\My.Videos\\video_002");
+	CHECK(SegmentScheduler::GetSegmentPath(L"videos/clip.part.mp4", 2) == L"videos/clip.part_003.mp4");
+}
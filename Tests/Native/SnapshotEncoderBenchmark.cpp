@@ -0,0 +1,71 @@
+#include "NativeTest.h"
+#include "PngEncoder.h"
+#include "JpegEncoder.h"
+#include "PngTestDecoder.h"
+#include <thread>
+
+//Measures the built-in snapshot encoders on raw BGRA frames as SnapshotPipeline maps them from a staging texture: the time to encode a frame,
+//the rate of BGRA input it sustains, and the size of the file, on the calling thread alone and helped by a pool of up to 4 workers like the pipeline's.
+//Frames are a desktop-like image at 1080p and 4K, the photo in Testmedia tiled to 1080p, and noise, which neither encoder can compress.
+
+namespace {
+	/// <summary>
+	/// Repeats an image to fill the given size.
+	/// </summary>
+	TEST_IMAGE TileImage(const TEST_IMAGE &tile, uint32_t width, uint32_t height) {
+		TEST_IMAGE image;
+		image.Width = width;
+		image.Height = height;
+		image.Bgra.resize(static_cast<size_t>(width) * height * 4);
+		for (uint32_t row = 0; row < height; row++) {
+			for (uint32_t col = 0; col < width; col++) {
+				memcpy(&image.Bgra[(static_cast<size_t>(row) * width + col) * 4], &tile.Bgra[(static_cast<size_t>(row % tile.Height) * tile.Width + col % tile.Width) * 4], 4);
+			}
+		}
+		return image;
+	}
+}
+
+int main()
+{
+	size_t threadCount = (std::min)(static_cast<size_t>(std::thread::hardware_concurrency()), (size_t)4);
+	WorkerPool pool(threadCount, 64);
+	pool.Start();
+	struct FRAME {
+		const char *Name;
+		TEST_IMAGE Image;
+	};
+	TEST_IMAGE photo = PngTestDecoder::DecodeFile(NATIVE_TEST_MEDIA_DIR "/renault.png");
+	FRAME frames[] = {
+		{ "Desktop 1080p", MakeScreenLikeImage(1920, 1080) },
+		{ "Desktop 4K", MakeScreenLikeImage(3840, 2160) },
+		{ "Photo 1080p", TileImage(photo, 1920, 1080) },
+		{ "Noise 1080p", MakeNoiseImage(1920, 1080, 1) },
+	};
+	printf("%zu workers\n", threadCount);
+	printf("%-14s %-6s %12s %12s %14s %14s %10s\n", "Frame", "Format", "1 thread ms", "pool ms", "1 thread MB/s", "pool MB/s", "file KB");
+	for (const FRAME &frame : frames) {
+		const TEST_IMAGE &image = frame.Image;
+		double megabytes = image.Bgra.size() / (1024.0 * 1024.0);
+		for (const char *format : { "PNG", "JPEG" }) {
+			bool isPng = strcmp(format, "PNG") == 0;
+			PngEncoder png;
+			JpegEncoder jpeg;
+			std::vector<uint8_t> output;
+			auto encode([&](WorkerPool *pPool) {
+				if (isPng) {
+					png.Encode(image.Bgra.data(), image.Width, image.Height, image.Width * 4, output, pPool);
+				}
+				else {
+					jpeg.Encode(image.Bgra.data(), image.Width, image.Height, image.Width * 4, output, pPool);
+				}
+			});
+			double aloneMillis = MeasureMillisPerCall([&]() { encode(nullptr); }, 1000);
+			double pooledMillis = MeasureMillisPerCall([&]() { encode(&pool); }, 1000);
+			printf("%-14s %-6s %12.1f %12.1f %14.1f %14.1f %10.1f\n", frame.Name, format, aloneMillis, pooledMillis,
+				megabytes * 1000 / aloneMillis, megabytes * 1000 / pooledMillis, output.size() / 1024.0);
+		}
+	}
+	pool.Stop();
+	return 0;
+}
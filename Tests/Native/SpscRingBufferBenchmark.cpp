@@ -0,0 +1,114 @@
+#include "NativeTest.h"
+#include "SpscRingBuffer.h"
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+//Compares the ring buffer used by WASAPICapture with the mutex guarded vector it replaced, for a capture thread writing 10 ms packets and a consumer reading 1 frame of audio at a time.
+
+struct AUDIO_FORMAT_CASE {
+	const char *Name;
+	size_t SampleRate;
+	size_t Channels;
+};
+
+/// <summary>
+/// The previous buffer: the producer appends to a vector under a mutex, and the consumer copies from the front and erases it.
+/// </summary>
+class LockedVectorBuffer
+{
+public:
+	void Write(const uint8_t *pData, size_t count) {
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Bytes.insert(m_Bytes.end(), pData, pData + count);
+	}
+	size_t Read(std::vector<uint8_t> &out, size_t count) {
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		count = (std::min)(count, m_Bytes.size());
+		out = std::vector<uint8_t>(m_Bytes.begin(), m_Bytes.begin() + count);
+		m_Bytes.erase(m_Bytes.begin(), m_Bytes.begin() + count);
+		return count;
+	}
+private:
+	std::mutex m_Mutex;
+	std::vector<uint8_t> m_Bytes;
+};
+
+class RingBuffer
+{
+public:
+	RingBuffer(size_t capacity) :m_Buffer(capacity) {}
+	void Write(const uint8_t *pData, size_t count) {
+		size_t written = 0;
+		while (written < count) {
+			size_t chunkWritten = m_Buffer.Write(pData + written, count - written);
+			if (chunkWritten == 0) {
+				std::this_thread::yield();
+			}
+			written += chunkWritten;
+		}
+	}
+	size_t Read(std::vector<uint8_t> &out, size_t count) {
+		out.resize(count);
+		size_t read = m_Buffer.Read(out.data(), count);
+		out.resize(read);
+		return read;
+	}
+private:
+	SpscRingBuffer m_Buffer;
+};
+
+/// <summary>
+/// Pushes the given seconds of audio through the buffer as fast as possible, and returns the seconds of audio moved per second.
+/// </summary>
+template <typename TBuffer>
+static double MeasureThroughput(TBuffer &buffer, const AUDIO_FORMAT_CASE &format, size_t seconds)
+{
+	size_t frameBytes = format.Channels * sizeof(float);
+	size_t packetBytes = format.SampleRate / 100 * frameBytes;
+	size_t readBytes = format.SampleRate / 30 * frameBytes;
+	size_t totalBytes = format.SampleRate * seconds * frameBytes;
+	//The producer stays at most one second of audio ahead, as a capture device would when the consumer keeps up.
+	size_t maxBacklogBytes = format.SampleRate * frameBytes;
+	std::vector<uint8_t> packet(packetBytes, 0x55);
+	std::atomic<size_t> consumed = 0;
+	auto start = std::chrono::steady_clock::now();
+	std::thread producer([&]() {
+		for (size_t produced = 0; produced < totalBytes; produced += packetBytes) {
+			while (produced + packetBytes - consumed.load(std::memory_order_relaxed) > maxBacklogBytes) {
+				std::this_thread::yield();
+			}
+			buffer.Write(packet.data(), packetBytes);
+		}
+	});
+	std::vector<uint8_t> out;
+	size_t producedTotal = (totalBytes + packetBytes - 1) / packetBytes * packetBytes;
+	while (consumed.load(std::memory_order_relaxed) < producedTotal) {
+		size_t read = buffer.Read(out, readBytes);
+		if (read == 0) {
+			std::this_thread::yield();
+		}
+		consumed.fetch_add(read, std::memory_order_relaxed);
+	}
+	producer.join();
+	double elapsedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return seconds / elapsedSeconds;
+}
+
+int main()
+{
+	const AUDIO_FORMAT_CASE formats[] = {
+		{ "48 kHz, 2 channels", 48000, 2 },
+		{ "48 kHz, 6 channels", 48000, 6 },
+	};
+	const size_t seconds = 3600;
+	printf("Seconds of float audio moved per second of wall time, %zu seconds per run\n", seconds);
+	for (const AUDIO_FORMAT_CASE &format : formats) {
+		LockedVectorBuffer vectorBuffer;
+		double vectorSpeed = MeasureThroughput(vectorBuffer, format, seconds);
+		RingBuffer ringBuffer(format.SampleRate * format.Channels * sizeof(float));
+		double ringSpeed = MeasureThroughput(ringBuffer, format, seconds);
+		printf("%-20s vector %10.0fx   ring %10.0fx   (%.2fx)\n", format.Name, vectorSpeed, ringSpeed, ringSpeed / vectorSpeed);
+	}
+	return 0;
+}
@@ -0,0 +1,139 @@
+#include "NativeTest.h"
+#include "SpscRingBuffer.h"
+#include <thread>
+
+NATIVE_TEST(CapacityIsRoundedUpToPowerOfTwo)
+{
+	SpscRingBuffer buffer(1000);
+	CHECK_EQUAL((size_t)1024, buffer.Capacity());
+	buffer.Reset(1024);
+	CHECK_EQUAL((size_t)1024, buffer.Capacity());
+	buffer.Reset(1025);
+	CHECK_EQUAL((size_t)2048, buffer.Capacity());
+	CHECK(buffer.IsEmpty());
+}
+
+NATIVE_TEST(WriteStopsWhenFull)
+{
+	SpscRingBuffer buffer(16);
+	uint8_t data[24];
+	for (uint8_t i = 0; i < sizeof(data); i++) {
+		data[i] = i;
+	}
+	CHECK_EQUAL((size_t)16, buffer.Write(data, sizeof(data)));
+	CHECK_EQUAL((size_t)0, buffer.AvailableToWrite());
+	CHECK_EQUAL((size_t)0, buffer.Write(data, 1));
+	CHECK_EQUAL((size_t)16, buffer.Size());
+	uint8_t out[16];
+	CHECK_EQUAL((size_t)16, buffer.Read(out, sizeof(out)));
+	CHECK(memcmp(data, out, sizeof(out)) == 0);
+	CHECK(buffer.IsEmpty());
+}
+
+NATIVE_TEST(ReadAndWriteWrapAroundTheEnd)
+{
+	SpscRingBuffer buffer(16);
+	uint8_t data[10] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 };
+	uint8_t out[10];
+	CHECK_EQUAL((size_t)10, buffer.Write(data, 10));
+	CHECK_EQUAL((size_t)10, buffer.Read(out, 10));
+	//The second write starts at offset 10 of 16, so it is split in two.
+	CHECK_EQUAL((size_t)10, buffer.Write(data, 10));
+	RING_BUFFER_SPANS spans;
+	CHECK_EQUAL((size_t)10, buffer.Peek(&spans));
+	CHECK_EQUAL((size_t)6, spans.FirstLength);
+	CHECK_EQUAL((size_t)4, spans.SecondLength);
+	CHECK(memcmp(spans.First, data, 6) == 0);
+	CHECK(memcmp(spans.Second, data + 6, 4) == 0);
+	memset(out, 0, sizeof(out));
+	CHECK_EQUAL((size_t)10, buffer.Read(out, 10));
+	CHECK(memcmp(data, out, 10) == 0);
+}
+
+NATIVE_TEST(PeekDoesNotConsume)
+{
+	SpscRingBuffer buffer(64);
+	uint8_t data[20] = {};
+	buffer.Write(data, 20);
+	RING_BUFFER_SPANS spans;
+	CHECK_EQUAL((size_t)8, buffer.Peek(&spans, 8));
+	CHECK_EQUAL((size_t)8, spans.TotalLength());
+	CHECK_EQUAL((size_t)20, buffer.Size());
+	buffer.Consume(8);
+	CHECK_EQUAL((size_t)12, buffer.Size());
+	CHECK_EQUAL((size_t)12, buffer.Peek(&spans));
+}
+
+NATIVE_TEST(WriteSilenceWritesZeros)
+{
+	SpscRingBuffer buffer(16);
+	uint8_t ones[12];
+	memset(ones, 0xFF, sizeof(ones));
+	buffer.Write(ones, sizeof(ones));
+	uint8_t out[16];
+	buffer.Read(out, sizeof(ones));
+	//The silence wraps over bytes that held ones.
+	CHECK_EQUAL((size_t)16, buffer.WriteSilence(20));
+	CHECK_EQUAL((size_t)16, buffer.Read(out, sizeof(out)));
+	for (uint8_t b : out) {
+		CHECK_EQUAL(0, (int)b);
+	}
+}
+
+NATIVE_TEST(ClearAndResetDiscardContent)
+{
+	SpscRingBuffer buffer(32);
+	uint8_t data[20] = {};
+	buffer.Write(data, 20);
+	buffer.Clear();
+	CHECK(buffer.IsEmpty());
+	CHECK_EQUAL((size_t)32, buffer.AvailableToWrite());
+	buffer.Write(data, 20);
+	buffer.Reset(32);
+	CHECK(buffer.IsEmpty());
+	CHECK_EQUAL((size_t)32, buffer.AvailableToWrite());
+}
+
+NATIVE_TEST(ConcurrentProducerAndConsumerKeepByteOrder)
+{
+	//Odd chunk sizes on both sides, so every offset in the buffer is hit by split writes and reads.
+	SpscRingBuffer buffer(1000);
+	const size_t totalBytes = 16 * 1024 * 1024;
+	std::thread producer([&]() {
+		uint8_t chunk[777];
+		size_t produced = 0;
+		while (produced < totalBytes) {
+			size_t count = (std::min)(sizeof(chunk), totalBytes - produced);
+			for (size_t i = 0; i < count; i++) {
+				chunk[i] = (uint8_t)((produced + i) * 31);
+			}
+			size_t written = 0;
+			while (written < count) {
+				size_t chunkWritten = buffer.Write(chunk + written, count - written);
+				if (chunkWritten == 0) {
+					std::this_thread::yield();
+				}
+				written += chunkWritten;
+			}
+			produced += count;
+		}
+	});
+	size_t consumed = 0;
+	size_t mismatches = 0;
+	uint8_t out[500];
+	while (consumed < totalBytes) {
+		size_t read = buffer.Read(out, sizeof(out));
+		if (read == 0) {
+			std::this_thread::yield();
+		}
+		for (size_t i = 0; i < read; i++) {
+			if (out[i] != (uint8_t)((consumed + i) * 31)) {
+				mismatches++;
+			}
+		}
+		consumed += read;
+	}
+	producer.join();
+	CHECK_EQUAL((size_t)0, mismatches);
+	CHECK(buffer.IsEmpty());
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/// <summary>
+/// An image as 4 bytes per pixel in B, G, R, A order, with a pitch of Width * 4.
+/// </summary>
+struct TEST_IMAGE {
+	uint32_t Width = 0;
+	uint32_t Height = 0;
+	std::vector<uint8_t> Bgra;
+};
+
+/// <summary>
+/// A deterministic image that looks like a desktop to the encoders: flat backgrounds, window frames, rows of small glyphs like text, and a gradient.
+/// Compresses about as well as a screenshot, unlike noise or a photo.
+/// </summary>
+inline TEST_IMAGE MakeScreenLikeImage(uint32_t width, uint32_t height)
+{
+	TEST_IMAGE image;
+	image.Width = width;
+	image.Height = height;
+	image.Bgra.resize(static_cast<size_t>(width) * height * 4);
+	uint32_t state = 12345;
+	auto nextRandom([&]() {
+		state = state * 1664525 + 1013904223;
+		return state >> 8;
+	});
+	//Each glyph is a 6x10 bit pattern, drawn from a small font so the same glyphs repeat like letters do.
+	uint64_t glyphs[32];
+	for (uint64_t &glyph : glyphs) {
+		glyph = static_cast<uint64_t>(nextRandom()) << 32 | nextRandom();
+	}
+	for (uint32_t row = 0; row < height; row++) {
+		for (uint32_t col = 0; col < width; col++) {
+			uint8_t *pPixel = &image.Bgra[(static_cast<size_t>(row) * width + col) * 4];
+			uint32_t color;
+			bool isWindow = (col / 400) % 2 == 0 && (row / 300) % 2 == 0 && col % 400 > 20 && row % 300 > 20;
+			if (row < 40) {
+				//A title bar with a gradient.
+				color = 0xFF000000 | (col * 255 / (width > 1 ? width - 1 : 1)) << 8 | 0x60;
+			}
+			else if (!isWindow) {
+				color = 0xFF3A6EA5;
+			}
+			else if (col % 400 == 21 || row % 300 == 21) {
+				color = 0xFF808080;
+			}
+			else {
+				uint32_t glyph = ((row / 14) * 131 + (col / 8) * 7) % 37;
+				uint32_t glyphRow = row % 14;
+				uint32_t glyphCol = col % 8;
+				bool isInk = glyph < 32 && glyphRow < 10 && glyphCol < 6 && (glyphs[glyph] >> (glyphRow * 6 + glyphCol) & 1);
+				color = isInk ? 0xFF101010 : 0xFFFFFFFF;
+			}
+			memcpy(pPixel, &color, 4);
+		}
+	}
+	return image;
+}
+
+/// <summary>
+/// A deterministic image of random pixels, which neither encoder can compress.
+/// </summary>
+inline TEST_IMAGE MakeNoiseImage(uint32_t width, uint32_t height, uint32_t seed)
+{
+	TEST_IMAGE image;
+	image.Width = width;
+	image.Height = height;
+	image.Bgra.resize(static_cast<size_t>(width) * height * 4);
+	uint32_t state = seed;
+	for (uint8_t &value : image.Bgra) {
+		state = state * 1664525 + 1013904223;
+		value = static_cast<uint8_t>(state >> 24);
+	}
+	return image;
+}
+
+/// <summary>
+/// Copies an image to rows of pitch bytes, filling the padding after each row with a pattern the encoders must not read as pixels.
+/// </summary>
+inline std::vector<uint8_t> CopyWithPitch(const TEST_IMAGE &image, uint32_t pitch)
+{
+	std::vector<uint8_t> pixels(static_cast<size_t>(pitch) * image.Height, 0xA5);
+	for (uint32_t row = 0; row < image.Height; row++) {
+		memcpy(&pixels[static_cast<size_t>(row) * pitch], &image.Bgra[static_cast<size_t>(row) * image.Width * 4], image.Width * 4);
+	}
+	return pixels;
+}
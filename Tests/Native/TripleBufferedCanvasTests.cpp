@@ -0,0 +1,334 @@
+#include "NativeTest.h"
+#include "TripleBufferedCanvas.h"
+#include <atomic>
+#include <mutex>
+#include <random>
+#include <thread>
+
+namespace {
+	const int32_t CANVAS_WIDTH = 64;
+	const int32_t CANVAS_HEIGHT = 64;
+
+	/// <summary>
+	/// Stands in for the shared canvas textures: three buffers of 32-bit pixels, each with a lock like the keyed mutex of a shared texture.
+	/// </summary>
+	struct FAKE_CANVAS {
+		std::timed_mutex Locks[CANVAS_BUFFER_COUNT];
+		std::atomic<int> Holders[CANVAS_BUFFER_COUNT] = {};
+		std::vector<uint32_t> Pixels[CANVAS_BUFFER_COUNT];
+		//Locks that timed out, buffers held by two devices at once, and copies between buffers that were not locked.
+		std::atomic<int> Errors{ 0 };
+		std::atomic<bool> IsLockFailing[CANVAS_BUFFER_COUNT] = {};
+
+		FAKE_CANVAS() {
+			for (std::vector<uint32_t> &pixels : Pixels) {
+				pixels.assign(CANVAS_WIDTH * CANVAS_HEIGHT, 0);
+			}
+		}
+	};
+
+	/// <summary>
+	/// The fake canvas as seen from one device. Each thread has its own view, like each capture thread opens the shared textures on its own device.
+	/// </summary>
+	class FakeCanvasView : public ICanvasBufferView
+	{
+	public:
+		FakeCanvasView(FAKE_CANVAS *pCanvas) :m_Canvas(pCanvas), m_IsHeld{} {}
+
+		bool LockBuffer(size_t index) override {
+			if (m_Canvas->IsLockFailing[index]) {
+				return false;
+			}
+			if (!m_Canvas->Locks[index].try_lock_for(std::chrono::seconds(5))) {
+				m_Canvas->Errors++;
+				return false;
+			}
+			if (++m_Canvas->Holders[index] != 1) {
+				m_Canvas->Errors++;
+			}
+			m_IsHeld[index] = true;
+			LockCount++;
+			return true;
+		}
+		void UnlockBuffer(size_t index) override {
+			if (!m_IsHeld[index]) {
+				m_Canvas->Errors++;
+				return;
+			}
+			m_IsHeld[index] = false;
+			m_Canvas->Holders[index]--;
+			m_Canvas->Locks[index].unlock();
+			UnlockCount++;
+		}
+		void CopyBufferRegion(size_t destination, size_t source, const DirtyRegion &region) override {
+			if (!m_IsHeld[destination] || !m_IsHeld[source]) {
+				m_Canvas->Errors++;
+			}
+			for (const REGION_RECT &rect : region.GetRects()) {
+				for (int32_t y = rect.top; y < rect.bottom; y++) {
+					for (int32_t x = rect.left; x < rect.right; x++) {
+						m_Canvas->Pixels[destination][y * CANVAS_WIDTH + x] = m_Canvas->Pixels[source][y * CANVAS_WIDTH + x];
+					}
+				}
+			}
+		}
+
+		void Fill(size_t index, const REGION_RECT &rect, uint32_t value) {
+			if (!m_IsHeld[index]) {
+				m_Canvas->Errors++;
+			}
+			for (int32_t y = rect.top; y < rect.bottom; y++) {
+				for (int32_t x = rect.left; x < rect.right; x++) {
+					m_Canvas->Pixels[index][y * CANVAS_WIDTH + x] = value;
+				}
+			}
+		}
+
+		int LockCount = 0;
+		int UnlockCount = 0;
+	private:
+		FAKE_CANVAS *m_Canvas;
+		bool m_IsHeld[CANVAS_BUFFER_COUNT];
+	};
+
+	/// <summary>
+	/// Writes one frame that fills a rect with a value, and returns the buffer it was written to.
+	/// </summary>
+	size_t WriteFrame(TripleBufferedCanvas &canvas, FakeCanvasView &view, const REGION_RECT &rect, uint32_t value) {
+		size_t index = SIZE_MAX;
+		CHECK(canvas.BeginWrite(&view, &index));
+		view.Fill(index, rect, value);
+		DirtyRegion written;
+		written.Add(rect);
+		canvas.EndWrite(&view, written);
+		return index;
+	}
+}
+
+NATIVE_TEST(PublishedFrameIsTakenByReader)
+{
+	FAKE_CANVAS fake;
+	FakeCanvasView view(&fake);
+	TripleBufferedCanvas canvas;
+	CHECK(!canvas.IsNewFrameAvailable());
+	CHECK(!canvas.AcquireLatest(nullptr));
+	size_t written = WriteFrame(canvas, view, REGION_RECT{ 0, 0, 10, 10 }, 7);
+	CHECK(canvas.IsNewFrameAvailable());
+	DirtyRegion updated;
+	CHECK(canvas.AcquireLatest(&updated));
+	CHECK_EQUAL(written, canvas.GetReadIndex());
+	CHECK(updated.GetBounds() == (REGION_RECT{ 0, 0, 10, 10 }));
+	CHECK_EQUAL((uint32_t)7, fake.Pixels[canvas.GetReadIndex()][9 * CANVAS_WIDTH + 9]);
+	CHECK(!canvas.AcquireLatest(&updated));
+	CANVAS_STATS stats = canvas.GetStats();
+	CHECK_EQUAL((uint64_t)1, stats.Published);
+	CHECK_EQUAL((uint64_t)1, stats.Acquired);
+	CHECK_EQUAL((uint64_t)0, stats.Skipped);
+}
+
+NATIVE_TEST(UnreadFrameIsReplacedAndRegionsAccumulate)
+{
+	FAKE_CANVAS fake;
+	FakeCanvasView view(&fake);
+	TripleBufferedCanvas canvas;
+	WriteFrame(canvas, view, REGION_RECT{ 0, 0, 10, 10 }, 1);
+	WriteFrame(canvas, view, REGION_RECT{ 40, 40, 50, 50 }, 2);
+	size_t latest = WriteFrame(canvas, view, REGION_RECT{ 20, 0, 30, 10 }, 3);
+	DirtyRegion updated;
+	CHECK(canvas.AcquireLatest(&updated));
+	CHECK_EQUAL(latest, canvas.GetReadIndex());
+	//The reader skipped two frames, so it must copy the area of all three.
+	CHECK_EQUAL((uint64_t)300, updated.GetArea());
+	//The latest frame has all three updates, as each write buffer was brought up to date first.
+	const std::vector<uint32_t> &pixels = fake.Pixels[latest];
+	CHECK_EQUAL((uint32_t)1, pixels[0]);
+	CHECK_EQUAL((uint32_t)2, pixels[45 * CANVAS_WIDTH + 45]);
+	CHECK_EQUAL((uint32_t)3, pixels[25]);
+	CANVAS_STATS stats = canvas.GetStats();
+	CHECK_EQUAL((uint64_t)2, stats.Skipped);
+	CHECK(stats.CatchUpCopies >= 2);
+}
+
+NATIVE_TEST(CatchUpCopiesOnlyStaleArea)
+{
+	FAKE_CANVAS fake;
+	FakeCanvasView view(&fake);
+	TripleBufferedCanvas canvas;
+	for (int i = 0; i < 30; i++) {
+		WriteFrame(canvas, view, REGION_RECT{ i, i, i + 2, i + 2 }, i + 1);
+		canvas.AcquireLatest(nullptr);
+	}
+	CANVAS_STATS stats = canvas.GetStats();
+	//Each buffer lags at most the last two frames, of 4 pixels each, behind.
+	CHECK(stats.CatchUpArea <= stats.CatchUpCopies * 8);
+	CHECK(stats.CatchUpCopies >= 28);
+	CHECK_EQUAL(view.LockCount, view.UnlockCount);
+}
+
+NATIVE_TEST(EmptyWriteDoesNotPublish)
+{
+	FAKE_CANVAS fake;
+	FakeCanvasView view(&fake);
+	TripleBufferedCanvas canvas;
+	size_t index;
+	CHECK(canvas.BeginWrite(&view, &index));
+	canvas.EndWrite(&view, DirtyRegion());
+	CHECK(!canvas.IsNewFrameAvailable());
+	//The next writer gets the same buffer.
+	size_t nextIndex;
+	CHECK(canvas.BeginWrite(&view, &nextIndex));
+	CHECK_EQUAL(index, nextIndex);
+	canvas.EndWrite(&view, DirtyRegion());
+	CHECK_EQUAL((uint64_t)0, canvas.GetStats().Published);
+}
+
+NATIVE_TEST(FailedLockReleasesEverything)
+{
+	FAKE_CANVAS fake;
+	FakeCanvasView view(&fake);
+	TripleBufferedCanvas canvas;
+	size_t first = WriteFrame(canvas, view, REGION_RECT{ 0, 0, 10, 10 }, 1);
+	//The next write buffer is stale, so both it and the latest frame must be locked. Fail each of them in turn.
+	for (size_t failing = 0; failing < CANVAS_BUFFER_COUNT; failing++) {
+		fake.IsLockFailing[failing] = true;
+		size_t index;
+		bool isLocked = canvas.BeginWrite(&view, &index);
+		fake.IsLockFailing[failing] = false;
+		if (isLocked) {
+			CHECK(index != failing && first != failing);
+			canvas.EndWrite(&view, DirtyRegion());
+		}
+		CHECK_EQUAL(view.LockCount, view.UnlockCount);
+		for (size_t i = 0; i < CANVAS_BUFFER_COUNT; i++) {
+			CHECK_EQUAL(0, fake.Holders[i].load());
+		}
+	}
+	//The writer lock was released as well.
+	WriteFrame(canvas, view, REGION_RECT{ 0, 0, 10, 10 }, 2);
+	CHECK_EQUAL(0, fake.Errors.load());
+}
+
+NATIVE_TEST(ConcurrentWritersAndReaderNeverSeeTornOrStaleFrames)
+{
+	const int writerCount = 3;
+	const int framesPerWriter = 2000;
+	//Each writer owns a vertical strip of the canvas, like a capture source in a layout.
+	const int32_t stripWidth = CANVAS_WIDTH / writerCount;
+	const size_t stripPixels = (size_t)stripWidth * CANVAS_HEIGHT;
+	FAKE_CANVAS fake;
+	TripleBufferedCanvas canvas;
+	//What each writer expects its strip to show after each of its frames. A frame is recorded before it is published,
+	//and the canvas synchronizes the publish with the reader, so the reader can look up any frame it sees.
+	std::vector<std::vector<uint32_t>> history(writerCount, std::vector<uint32_t>((framesPerWriter + 1) * stripPixels, 0));
+	std::atomic<int> writeFailures(0);
+	std::atomic<int> writersDone(0);
+	std::vector<std::thread> writers;
+	for (int writer = 0; writer < writerCount; writer++) {
+		writers.emplace_back([&, writer]() {
+			std::mt19937 rng(writer + 1);
+			FakeCanvasView view(&fake);
+			REGION_RECT strip{ writer * stripWidth, 0, (writer + 1) * stripWidth, CANVAS_HEIGHT };
+			std::vector<uint32_t> model(stripPixels, 0);
+			for (int frame = 1; frame <= framesPerWriter; frame++) {
+				int32_t x = strip.left + rng() % stripWidth, y = rng() % CANVAS_HEIGHT;
+				REGION_RECT rect = DirtyRegion::Intersect(strip, REGION_RECT{ x, y, x + 1 + (int32_t)(rng() % 12), y + 1 + (int32_t)(rng() % 24) });
+				uint32_t value = ((uint32_t)(writer + 1) << 24) | (uint32_t)frame;
+				for (int32_t py = rect.top; py < rect.bottom; py++) {
+					for (int32_t px = rect.left; px < rect.right; px++) {
+						model[py * stripWidth + px - strip.left] = value;
+					}
+				}
+				std::copy(model.begin(), model.end(), history[writer].begin() + frame * stripPixels);
+				size_t index;
+				if (!canvas.BeginWrite(&view, &index)) {
+					writeFailures++;
+					continue;
+				}
+				view.Fill(index, rect, value);
+				DirtyRegion written;
+				written.Add(rect);
+				canvas.EndWrite(&view, written);
+				if (frame % 16 == 0) {
+					std::this_thread::yield();
+				}
+			}
+			writersDone++;
+		});
+	}
+	//The reader keeps its own copy of the canvas, like the recorder's output texture, and updates only the area reported as changed.
+	FakeCanvasView readerView(&fake);
+	std::vector<uint32_t> output(CANVAS_WIDTH * CANVAS_HEIGHT, 0);
+	int lastFrames[writerCount] = {};
+	int tornFrames = 0, staleFrames = 0, outputMismatches = 0, readerLockFailures = 0;
+	std::mt19937 rng(100);
+	auto readFrame = [&]() {
+		DirtyRegion updated;
+		if (!canvas.AcquireLatest(&updated)) {
+			return false;
+		}
+		size_t index = canvas.GetReadIndex();
+		if (!readerView.LockBuffer(index)) {
+			readerLockFailures++;
+			return true;
+		}
+		const std::vector<uint32_t> &pixels = fake.Pixels[index];
+		for (const REGION_RECT &rect : updated.GetRects()) {
+			for (int32_t y = rect.top; y < rect.bottom; y++) {
+				for (int32_t x = rect.left; x < rect.right; x++) {
+					output[y * CANVAS_WIDTH + x] = pixels[y * CANVAS_WIDTH + x];
+				}
+			}
+		}
+		if (output != pixels) {
+			outputMismatches++;
+		}
+		for (int writer = 0; writer < writerCount; writer++) {
+			//The newest value in the strip tells which frame of the writer this is.
+			int frame = 0;
+			std::vector<uint32_t> strip(stripPixels);
+			for (int32_t y = 0; y < CANVAS_HEIGHT; y++) {
+				for (int32_t x = 0; x < stripWidth; x++) {
+					uint32_t value = pixels[y * CANVAS_WIDTH + writer * stripWidth + x];
+					strip[y * stripWidth + x] = value;
+					frame = (std::max)(frame, (int)(value & 0xFFFFFF));
+				}
+			}
+			if (!std::equal(strip.begin(), strip.end(), history[writer].begin() + frame * stripPixels)) {
+				tornFrames++;
+			}
+			if (frame < lastFrames[writer]) {
+				staleFrames++;
+			}
+			lastFrames[writer] = frame;
+		}
+		//Now and then the copy out is slow, while the writers carry on.
+		if (rng() % 8 == 0) {
+			std::this_thread::sleep_for(std::chrono::microseconds(500));
+		}
+		readerView.UnlockBuffer(index);
+		return true;
+	};
+	while (writersDone < writerCount) {
+		if (!readFrame()) {
+			std::this_thread::yield();
+		}
+	}
+	for (std::thread &writer : writers) {
+		writer.join();
+	}
+	readFrame();
+	CHECK_EQUAL(0, writeFailures.load());
+	CHECK_EQUAL(0, readerLockFailures);
+	CHECK_EQUAL(0, fake.Errors.load());
+	CHECK_EQUAL(0, tornFrames);
+	CHECK_EQUAL(0, staleFrames);
+	CHECK_EQUAL(0, outputMismatches);
+	//The reader ends up with the last frame of every writer.
+	for (int writer = 0; writer < writerCount; writer++) {
+		CHECK_EQUAL(framesPerWriter, lastFrames[writer]);
+	}
+	CANVAS_STATS stats = canvas.GetStats();
+	CHECK_EQUAL((uint64_t)writerCount * framesPerWriter, stats.Published);
+	CHECK(stats.Acquired > 0);
+	CHECK_EQUAL(stats.Published, stats.Acquired + stats.Skipped);
+}
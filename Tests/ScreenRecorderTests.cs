@@ -800,6 +800,198 @@ namespace ScreenRecorderLib
             }
         }
 
+        [TestMethod]
+        public void RecordingWithAdditionalOutput()
+        {
+            string filePath = Path.Combine(GetTempPath(), Path.ChangeExtension(Path.GetRandomFileName(), ".mp4"));
+            string additionalFilePath = Path.Combine(GetTempPath(), Path.ChangeExtension(Path.GetRandomFileName(), ".mp4"));
+            try
+            {
+                using (var outStream = File.Open(filePath, FileMode.Create, FileAccess.ReadWrite, FileShare.Read))
+                {
+                    RecorderOptions options = new RecorderOptions();
+                    int frameWidth = 640;
+                    int frameHeight = 360;
+                    options.AdditionalOutputs = new List<AdditionalOutput>
+                    {
+                        new AdditionalOutput
+                        {
+                            FilePath = additionalFilePath,
+                            VideoEncoderOptions = new VideoEncoderOptions
+                            {
+                                Bitrate = 500 * 1000,
+                                Encoder = new H264VideoEncoder { BitrateMode = H264BitrateControlMode.CBR }
+                            },
+                            OutputOptions = new OutputOptions
+                            {
+                                OutputFrameSize = new ScreenSize(frameWidth, frameHeight)
+                            }
+                        }
+                    };
+                    using (var rec = Recorder.CreateRecorder(options))
+                    {
+                        string error = "";
+                        bool isError = false;
+                        bool isComplete = false;
+                        ManualResetEvent finalizeResetEvent = new ManualResetEvent(false);
+                        ManualResetEvent recordingResetEvent = new ManualResetEvent(false);
+                        rec.OnRecordingComplete += (s, args) =>
+                        {
+                            isComplete = true;
+                            finalizeResetEvent.Set();
+                        };
+                        rec.OnRecordingFailed += (s, args) =>
+                        {
+                            isError = true;
+                            error = args.Error;
+                            finalizeResetEvent.Set();
+                            recordingResetEvent.Set();
+                        };
+                        rec.OnFrameRecorded += (s, args) =>
+                        {
+                            if (args.FrameNumber == 10)
+                            {
+                                recordingResetEvent.Set();
+                            }
+                        };
+                        rec.Record(outStream);
+                        recordingResetEvent.WaitOne(DefaultMaxRecordingLengthMillis);
+                        rec.Stop();
+                        finalizeResetEvent.WaitOne(5000);
+                        outStream.Flush();
+                        Assert.IsFalse(isError, error);
+                        Assert.IsTrue(isComplete);
+                        Assert.AreNotEqual(outStream.Length, 0);
+                        Assert.IsTrue(new FileInfo(additionalFilePath).Length > 0);
+                        var mediaInfo = new MediaInfoWrapper(additionalFilePath);
+                        Assert.IsTrue(mediaInfo.Format == "MPEG-4");
+                        Assert.IsTrue(mediaInfo.Width == frameWidth && mediaInfo.Height == frameHeight, "Expected and actual output dimensions differ");
+                    }
+                }
+            }
+            finally
+            {
+                File.Delete(filePath);
+                File.Delete(additionalFilePath);
+            }
+        }
+
+        [TestMethod]
+        public void SegmentedRecordingToFile()
+        {
+            string filePath = Path.Combine(GetTempPath(), Path.ChangeExtension(Path.GetRandomFileName(), ".mp4"));
+            var segments = new List<SegmentCompleteEventArgs>();
+            try
+            {
+                RecorderOptions options = new RecorderOptions();
+                options.OutputOptions = new OutputOptions { SegmentDurationMillis = 1000 };
+                using (var rec = Recorder.CreateRecorder(options))
+                {
+                    string error = "";
+                    bool isError = false;
+                    bool isComplete = false;
+                    ManualResetEvent finalizeResetEvent = new ManualResetEvent(false);
+                    rec.OnRecordingComplete += (s, args) =>
+                    {
+                        isComplete = true;
+                        finalizeResetEvent.Set();
+                    };
+                    rec.OnRecordingFailed += (s, args) =>
+                    {
+                        isError = true;
+                        error = args.Error;
+                        finalizeResetEvent.Set();
+                    };
+                    rec.OnSegmentComplete += (s, args) =>
+                    {
+                        lock (segments)
+                        {
+                            segments.Add(args);
+                        }
+                    };
+                    rec.Record(filePath);
+                    Thread.Sleep(3500);
+                    rec.Stop();
+                    finalizeResetEvent.WaitOne(5000);
+                    Assert.IsFalse(isError, error);
+                    Assert.IsTrue(isComplete);
+                    Assert.IsTrue(segments.Count >= 2, $"Expected at least 2 segments, got {segments.Count}");
+                    for (int i = 0; i < segments.Count; i++)
+                    {
+                        Assert.AreEqual(i, segments[i].Index);
+                        Assert.IsTrue(segments[i].EndTime > segments[i].StartTime);
+                        if (i > 0)
+                        {
+                            Assert.AreEqual(segments[i - 1].EndTime, segments[i].StartTime, "Segments should not have gaps or overlap");
+                        }
+                        var mediaInfo = new MediaInfoWrapper(segments[i].FilePath);
+                        Assert.IsTrue(mediaInfo.Format == "MPEG-4");
+                    }
+                    Assert.AreEqual(filePath, segments[0].FilePath);
+                }
+            }
+            finally
+            {
+                File.Delete(filePath);
+                foreach (var segment in segments)
+                {
+                    File.Delete(segment.FilePath);
+                }
+            }
+        }
+
+        [TestMethod]
+        public void RecordingWithReplayBuffer()
+        {
+            string filePath = Path.Combine(GetTempPath(), Path.ChangeExtension(Path.GetRandomFileName(), ".mp4"));
+            string replayPath = Path.Combine(GetTempPath(), Path.ChangeExtension(Path.GetRandomFileName(), ".mp4"));
+            try
+            {
+                RecorderOptions options = new RecorderOptions();
+                options.OutputOptions = new OutputOptions { ReplayBufferDurationMillis = 2000 };
+                using (var rec = Recorder.CreateRecorder(options))
+                {
+                    string error = "";
+                    bool isError = false;
+                    bool isComplete = false;
+                    ManualResetEvent finalizeResetEvent = new ManualResetEvent(false);
+                    rec.OnRecordingComplete += (s, args) =>
+                    {
+                        isComplete = true;
+                        finalizeResetEvent.Set();
+                    };
+                    rec.OnRecordingFailed += (s, args) =>
+                    {
+                        isError = true;
+                        error = args.Error;
+                        finalizeResetEvent.Set();
+                    };
+                    rec.Record(filePath);
+                    Thread.Sleep(6000);
+                    Assert.IsTrue(rec.SaveReplay(replayPath));
+                    Assert.IsFalse(rec.SaveReplay(filePath), "Expected saving a replay over the output of the recording to fail");
+                    Thread.Sleep(1000);
+                    rec.Stop();
+                    finalizeResetEvent.WaitOne(5000);
+                    Assert.IsFalse(isError, error);
+                    Assert.IsTrue(isComplete);
+                    var replayInfo = new MediaInfoWrapper(replayPath);
+                    Assert.IsTrue(replayInfo.Format == "MPEG-4");
+                    double replayDuration = replayInfo.VideoStreams[0].Duration.TotalSeconds;
+                    Assert.IsTrue(replayDuration >= 1.5 && replayDuration < 5, $"Expected the replay to hold the last seconds of the recording, but it is {replayDuration} seconds long");
+                    var mediaInfo = new MediaInfoWrapper(filePath);
+                    Assert.IsTrue(mediaInfo.Format == "MPEG-4");
+                    double duration = mediaInfo.VideoStreams[0].Duration.TotalSeconds;
+                    Assert.IsTrue(duration >= 6, $"Expected the output to hold the whole recording, but it is {duration} seconds long");
+                }
+            }
+            finally
+            {
+                File.Delete(filePath);
+                File.Delete(replayPath);
+            }
+        }
+
         [DataTestMethod]
         [DynamicData(nameof(GetRecordingSources), DynamicDataSourceType.Method)]
         public void RecordingWithCustomSourceDimensionsAndPositions(IEnumerable<RecordingSourceBase> recordingSources, ScreenSize expectedSize)